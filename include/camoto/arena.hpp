@@ -0,0 +1,173 @@
+/**
+ * @file  camoto/arena.hpp
+ * @brief Allocate many short-lived objects from a few large blocks of memory.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_ARENA_HPP_
+#define _CAMOTO_ARENA_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <camoto/config.hpp>
+
+namespace camoto {
+
+/// Default size of each block of memory used by an arena, in bytes.
+#define ARENA_BLOCK_SIZE 16384
+
+/// Memory for a group of objects that are all freed at the same time.
+/**
+ * Opening a file in an archive usually creates a small stack of objects, such
+ * as a stream::sub, a stream::filtered and a filter or two, each allocated on
+ * its own and each with its own shared_ptr control block.  When opening many
+ * files in a row this allocator traffic can take longer than the work itself.
+ *
+ * An arena hands out memory from large blocks by just moving a pointer along.
+ * Objects created with make_shared() have both themselves and their control
+ * block put in the arena, so building a stream stack takes no calls to the
+ * global allocator once the first block exists.  The objects are still
+ * destroyed as normal when their last shared_ptr goes away, but the memory is
+ * only given back all at once, when the arena is released or destroyed.
+ *
+ * Every object made in the arena must have been destroyed before the arena
+ * is released or destroyed.  An arena is not thread safe, although objects in
+ * it may be destroyed from any thread.
+ *
+ * @code
+ * arena a;
+ * for (auto& f : files) {
+ *   auto sub = a.make_shared<stream::input_sub>(content, f.offset, f.size);
+ *   auto dec = a.make_shared<stream::input_filtered>(sub,
+ *     a.make_shared<filter_lzw_decompress>(...));
+ *   scan(*dec);
+ *   dec.reset();
+ *   sub.reset();
+ *   a.release();
+ * }
+ * @endcode
+ */
+class CAMOTO_GAMECOMMON_API arena
+{
+	public:
+		/// Create an empty arena.
+		/**
+		 * @param lenBlock
+		 *   Size of each block of memory.  Allocations larger than this get a
+		 *   block of their own.
+		 */
+		arena(std::size_t lenBlock = ARENA_BLOCK_SIZE);
+		~arena();
+
+		arena(const arena&) = delete;
+		arena& operator=(const arena&) = delete;
+
+		/// Get some memory from the arena.
+		/**
+		 * @param len
+		 *   Number of bytes needed.
+		 *
+		 * @param align
+		 *   Alignment of the returned memory.  Must be a power of two.
+		 *
+		 * @return Pointer to the memory, valid until release() is called or the
+		 *   arena is destroyed.
+		 */
+		void *allocate(std::size_t len, std::size_t align);
+
+		/// Give back all the memory handed out so far.
+		/**
+		 * The first block is kept for reuse, so an arena can be used over and
+		 * over again, e.g. once per file, without going back to the global
+		 * allocator.
+		 */
+		void release();
+
+		/// Create an object in the arena.
+		/**
+		 * This works like std::make_shared(), except the object and its
+		 * reference count are put in the arena.
+		 */
+		template <class T, typename... Args>
+		std::shared_ptr<T> make_shared(Args&&... args);
+
+	protected:
+		std::size_t lenBlock;                        ///< Normal size of a block
+		std::vector<std::unique_ptr<char[]> > blocks;///< Memory owned by arena
+		char *next;                                  ///< Next free byte
+		char *end;                                   ///< End of current block
+};
+
+/// Standard allocator getting its memory from an arena.
+/**
+ * Memory is never freed by deallocate(), only when the arena is released.
+ */
+template <class T>
+class arena_allocator
+{
+	public:
+		typedef T value_type;
+
+		arena_allocator(arena& a)
+			:	a(&a)
+		{
+		}
+
+		template <class U>
+		arena_allocator(const arena_allocator<U>& other)
+			:	a(other.a)
+		{
+		}
+
+		T *allocate(std::size_t n)
+		{
+			return (T *)this->a->allocate(n * sizeof(T), alignof(T));
+		}
+
+		void deallocate(T *, std::size_t)
+		{
+			return;
+		}
+
+		arena *a; ///< Arena supplying the memory
+};
+
+template <class T, class U>
+inline bool operator == (const arena_allocator<T>& l,
+	const arena_allocator<U>& r)
+{
+	return l.a == r.a;
+}
+
+template <class T, class U>
+inline bool operator != (const arena_allocator<T>& l,
+	const arena_allocator<U>& r)
+{
+	return l.a != r.a;
+}
+
+template <class T, typename... Args>
+inline std::shared_ptr<T> arena::make_shared(Args&&... args)
+{
+	return std::allocate_shared<T>(arena_allocator<T>(*this),
+		std::forward<Args>(args)...);
+}
+
+} // namespace camoto
+
+#endif // _CAMOTO_ARENA_HPP_
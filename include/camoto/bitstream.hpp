@@ -22,11 +22,16 @@
 #ifndef _CAMOTO_BITSTREAM_HPP_
 #define _CAMOTO_BITSTREAM_HPP_
 
+#include <cassert>
 #include <memory>
+#include <vector>
 #include <functional>
 #include <camoto/config.hpp>
 #include <camoto/stream.hpp>
 
+/// Number of bytes of the parent stream a bitstream keeps in memory.
+#define BITSTREAM_BUFFER_SIZE (16 * 1024)
+
 namespace camoto {
 
 typedef std::function<int (uint8_t*)> fn_getnextchar;
@@ -74,6 +79,93 @@ class CAMOTO_GAMECOMMON_API bitstream
 		 */
 		int origBufByte;
 
+		/// origBufByte value: The last operation was a write, so the bufByte
+		/// wasn't updated
+		static const int WASNT_BUFFERED = -1;
+
+		/// origBufByte value: This is the first read operation, don't write out
+		/// the bufByte
+		static const int INITIAL_VALUE = -2;
+
+		/// Block of the parent stream held in memory.
+		/**
+		 * Reads from the parent are done BITSTREAM_BUFFER_SIZE bytes at a time into
+		 * here, and completed bytes are written here too instead of going straight
+		 * to the parent.  Only used when there is a parent stream.
+		 */
+		std::vector<uint8_t> block;
+
+		/// Offset in the parent stream of the first byte in block.
+		stream::pos blockStart;
+
+		/// Number of valid bytes in block.
+		stream::len blockLen;
+
+		/// First byte in block that has been changed but not written to the parent.
+		stream::len dirtyStart;
+
+		/// One past the last changed byte in block, or 0 if nothing has changed.
+		stream::len dirtyEnd;
+
+		/// Read a byte from the parent stream, through the block buffer.
+		/**
+		 * @param pos
+		 *   Offset in the parent stream.
+		 * @param b
+		 *   On return, the byte at \e pos.
+		 * @return 1 if a byte was read, or 0 at EOF.
+		 */
+		int readParentByte(stream::pos pos, uint8_t *b);
+
+		/// Write a byte to the parent stream, through the block buffer.
+		/**
+		 * @param pos
+		 *   Offset in the parent stream.
+		 * @param b
+		 *   Value to write.
+		 */
+		void writeParentByte(stream::pos pos, uint8_t b);
+
+		/// Replace the block buffer with the data starting at \e pos.
+		/**
+		 * Any changes in the current block are written back first.
+		 */
+		void loadBlock(stream::pos pos);
+
+		/// Write any changed part of the block buffer back to the parent.
+		/**
+		 * @return true if anything was written.
+		 */
+		bool writeBlock();
+
+		/// Write a run of bytes to the parent stream, through the block buffer.
+		/**
+		 * @param pos
+		 *   Offset in the parent stream of the first byte.
+		 * @param data
+		 *   Bytes to write.
+		 * @param len
+		 *   Number of bytes to write.
+		 */
+		void writeParentBytes(stream::pos pos, const uint8_t *data,
+			stream::len len);
+
+		/// Implementation of read_array() for both value types.
+		template <typename T>
+		stream::len readValues(unsigned int bits, T *out, stream::len count);
+
+		/// Implementation of write_array() for both value types.
+		template <typename T>
+		void writeValues(unsigned int bits, const T *in, stream::len count);
+
+		/// Read from a memory buffer one byte at a time.
+		/**
+		 * This is the fallback for read(const uint8_t **...) when there are too
+		 * few bytes left in the buffer to use the fast path.
+		 */
+		int readSlow(const uint8_t **in, const uint8_t *inEnd, unsigned int bits,
+			unsigned int *out);
+
 	public:
 
 		/// Byte order in the bitstream
@@ -111,6 +203,11 @@ class CAMOTO_GAMECOMMON_API bitstream
 		bitstream(endian endianType);
 
 		/// Destructor.
+		/**
+		 * Any complete bytes still in the block buffer are written to the parent
+		 * stream, but a partially written byte is lost unless flush() has been
+		 * called.
+		 */
 		~bitstream();
 
 		/// Read some bits in from the stream.
@@ -165,6 +262,64 @@ class CAMOTO_GAMECOMMON_API bitstream
 		 */
 		int write(unsigned int bits, unsigned int in);
 
+		/// Read a run of values that are all the same number of bits long.
+		/**
+		 * This gives the same result as calling read() \e count times, but the
+		 * values are unpacked straight out of the block buffer a whole block at
+		 * a time.  On x86 CPUs with AVX2, values of up to 25 bits are unpacked
+		 * eight at a time.
+		 *
+		 * @param bits
+		 *   Number of bits in each value, from 1 to 16.
+		 *
+		 * @param out
+		 *   Where to store the values.
+		 *
+		 * @param count
+		 *   Number of values to read.
+		 *
+		 * @return The number of values read.  This is only less than \e count if
+		 *   the end of the stream was reached, in which case any bits of the last,
+		 *   incomplete value are left unread.
+		 */
+		stream::len read_array(unsigned int bits, uint16_t *out,
+			stream::len count);
+
+		/// Read a run of values of up to 32 bits each.
+		/**
+		 * @copydetails read_array(unsigned int, uint16_t*, stream::len)
+		 *
+		 * @note This version accepts \e bits from 1 to 32.
+		 */
+		stream::len read_array(unsigned int bits, uint32_t *out,
+			stream::len count);
+
+		/// Write a run of values that are all the same number of bits long.
+		/**
+		 * This gives the same result as calling write() \e count times, but the
+		 * values are packed 32 bits at a time and stored in the block buffer in
+		 * runs of bytes.
+		 *
+		 * @param bits
+		 *   Number of bits in each value, from 1 to 16.
+		 *
+		 * @param in
+		 *   The values to write.  These must be small enough to fit in \e bits,
+		 *   otherwise an assertion failure will result.
+		 *
+		 * @param count
+		 *   Number of values to write.
+		 */
+		void write_array(unsigned int bits, const uint16_t *in, stream::len count);
+
+		/// Write a run of values of up to 32 bits each.
+		/**
+		 * @copydetails write_array(unsigned int, const uint16_t*, stream::len)
+		 *
+		 * @note This version accepts \e bits from 1 to 32.
+		 */
+		void write_array(unsigned int bits, const uint32_t *in, stream::len count);
+
 		/// Write some bits to a particular stream.
 		/**
 		 * This function is only intended to be used in custom iostream filters,
@@ -191,6 +346,154 @@ class CAMOTO_GAMECOMMON_API bitstream
 		 */
 		int write(fn_putnextchar fnNextChar, unsigned int bits, unsigned int in);
 
+		/// Read some bits from a memory buffer.
+		/**
+		 * This function is intended for filters, which are given their input in
+		 * a contiguous buffer.  It behaves the same as read(fn_getnextchar...)
+		 * with a callback returning the bytes from *in to inEnd, but while there
+		 * are at least eight bytes left in the buffer the value is extracted from
+		 * a single 64-bit load instead of one byte at a time.
+		 *
+		 * @param in
+		 *   Pointer to the next byte to read.  On return, this has been advanced
+		 *   past the bytes consumed.
+		 *
+		 * @param inEnd
+		 *   One past the last byte available in the buffer.
+		 *
+		 * @param bits
+		 *   Number of bits to read, 32 or less.
+		 *
+		 * @param out
+		 *   Where to store the value read.
+		 *
+		 * @return The number of bits read, which will be less than \e bits if
+		 *   the end of the buffer was reached.
+		 */
+		int read(const uint8_t **in, const uint8_t *inEnd, unsigned int bits,
+			unsigned int *out);
+
+		/// Read some bits from a memory buffer, with the endian type fixed at
+		/// compile time.
+		/**
+		 * This is the same as read(const uint8_t **...) but is expanded inline,
+		 * for decoders which are themselves specialised by endian type.
+		 *
+		 * @pre E must be the same as getEndian().
+		 */
+		template <endian E>
+		int read(const uint8_t **in, const uint8_t *inEnd, unsigned int bits,
+			unsigned int *out);
+
+		/// Look at the next bits in a memory buffer without consuming them.
+		/**
+		 * This is for decoders that need to see more bits than they will use,
+		 * such as table-driven Huffman decoders.  Follow it with consume() to
+		 * move past the bits that were actually used.
+		 *
+		 * @pre The last operation was a read, or flushByte() has been called
+		 *   since the last write.
+		 *
+		 * @param in
+		 *   Pointer to the next byte to read.  This is not changed.
+		 *
+		 * @param inEnd
+		 *   One past the last byte available in the buffer.
+		 *
+		 * @param bits
+		 *   Number of bits to look at, 32 or less.
+		 *
+		 * @param out
+		 *   Where to store the value.  If fewer than \e bits bits are left, the
+		 *   missing ones are zero, as though the data was padded with zero bytes.
+		 *
+		 * @return The number of bits available, which will be less than \e bits
+		 *   if the end of the buffer was reached.
+		 */
+		unsigned int peek(const uint8_t *in, const uint8_t *inEnd,
+			unsigned int bits, unsigned int *out) const;
+
+		/// Look at the next bits with the endian type fixed at compile time.
+		/**
+		 * @pre E must be the same as getEndian().
+		 */
+		template <endian E>
+		unsigned int peek(const uint8_t *in, const uint8_t *inEnd,
+			unsigned int bits, unsigned int *out) const;
+
+		/// Move past bits in a memory buffer that were examined with peek().
+		/**
+		 * @param in
+		 *   Pointer to the next byte to read.  On return, this has been advanced
+		 *   past the bytes consumed.
+		 *
+		 * @param inEnd
+		 *   One past the last byte available in the buffer.
+		 *
+		 * @param bits
+		 *   Number of bits to skip.  This must be no more than the value peek()
+		 *   returned.
+		 */
+		void consume(const uint8_t **in, const uint8_t *inEnd, unsigned int bits);
+
+		/// Move past peeked bits with the endian type fixed at compile time.
+		/**
+		 * @pre E must be the same as getEndian().
+		 */
+		template <endian E>
+		void consume(const uint8_t **in, const uint8_t *inEnd, unsigned int bits);
+
+		/// Write some bits into a memory buffer.
+		/**
+		 * This is the counterpart of read(const uint8_t **...), and is likewise
+		 * only intended for use in filters.  Completed bytes are stored in the
+		 * buffer, while the last partial byte is held until more bits are written
+		 * or flushByte() is called.
+		 *
+		 * @param out
+		 *   Pointer to where the next byte will be written.  On return, this has
+		 *   been advanced past the bytes written.
+		 *
+		 * @param outEnd
+		 *   One past the last byte available in the buffer.
+		 *
+		 * @param bits
+		 *   Number of bits to write, 32 or less.
+		 *
+		 * @param in
+		 *   The value to write.  This must be small enough to fit in the number of
+		 *   bits being written, otherwise an assertion failure will result.
+		 *
+		 * @return The number of bits written, which will be less than \e bits if
+		 *   the end of the buffer was reached.
+		 */
+		int write(uint8_t **out, uint8_t *outEnd, unsigned int bits,
+			unsigned int in);
+
+		/// Write the bits from another bitstream into a memory buffer.
+		/**
+		 * This joins separately encoded blocks of data together, continuing from
+		 * wherever the last write left off.  If that was on a byte boundary the
+		 * bytes are copied across as-is, otherwise they are shifted into place.
+		 *
+		 * @param out
+		 *   Pointer to where the next byte will be written.  On return, this has
+		 *   been advanced past the bytes written.
+		 *
+		 * @param outEnd
+		 *   One past the last byte available in the buffer.
+		 *
+		 * @param in
+		 *   Data to write, in the same endian order as this bitstream.
+		 *
+		 * @param bits
+		 *   Number of bits to take from \e in.  If this is not a multiple of
+		 *   eight, the last byte is only partially used, with the unused bits
+		 *   being the ones that would have been written last.
+		 */
+		void append(uint8_t **out, uint8_t *outEnd, const uint8_t *in,
+			uint64_t bits);
+
 		/// Seek to a given bit position within the stream.
 		/**
 		 * @note This only works with the read() and write() function which do NOT
@@ -209,6 +512,11 @@ class CAMOTO_GAMECOMMON_API bitstream
 
 		/// Write out any partially written byte to the underlying stream.
 		/**
+		 * Bytes written to a bitstream with a parent stream are kept in memory
+		 * until this is called, or until a read or write moves outside the block
+		 * that is currently held, so this must be called before accessing the
+		 * parent stream directly.
+		 *
 		 * @note Uses this->parent, so it only works with the read() and write()
 		 *   functions which do NOT take an fnNextChar parameter.
 		 */
@@ -225,12 +533,47 @@ class CAMOTO_GAMECOMMON_API bitstream
 		/**
 		 * @return Current endian type.
 		 */
-		endian getEndian();
+		endian getEndian() const;
+
+		/// Number of bits read from memory but not yet returned by read().
+		unsigned int bufferedBits() const
+		{
+			return (this->curBitPos >= 8) ? 0 : 8 - this->curBitPos;
+		}
+
+		/// Number of bits written to memory but still held in the last byte.
+		/**
+		 * This is how many bits of the byte flushByte() will write out are valid,
+		 * from 1 to 8, or 0 if there is no byte waiting.
+		 */
+		unsigned int pendingBits() const
+		{
+			return (this->origBufByte == WASNT_BUFFERED) ? this->curBitPos : 0;
+		}
+
+		/// Save the bits left over from the last byte read from memory.
+		/**
+		 * Filters reading from memory buffers keep part of the last byte they
+		 * were given.  This saves that partial byte, so that a filter can be
+		 * resumed later from the byte after it.
+		 *
+		 * @param s
+		 *   Stream to write the state to.
+		 */
+		void saveState(stream::output& s) const;
+
+		/// Restore the bits saved by saveState().
+		/**
+		 * @param s
+		 *   Stream to read the state from.
+		 */
+		void loadState(stream::input& s);
 
 		/// Flush the byte currently cached.
 		/**
 		 * This will cause the next read operation to start at the following byte
-		 * boundary.
+		 * boundary.  Any bytes held in the block buffer are also written to the
+		 * parent stream.
 		 */
 		void flushByte();
 
@@ -244,6 +587,17 @@ class CAMOTO_GAMECOMMON_API bitstream
 		 */
 		void flushByte(fn_putnextchar fnNextChar);
 
+		/// Flush the byte currently cached into a memory buffer.
+		/**
+		 * @param out
+		 *   Pointer to where the byte will be written.  On return, this has been
+		 *   advanced past it if it was written.
+		 *
+		 * @param outEnd
+		 *   One past the last byte available in the buffer.
+		 */
+		void flushByte(uint8_t **out, uint8_t *outEnd);
+
 		/// Write bufByte out to the parent stream if it has changed.
 		/**
 		 * @note Uses this->parent, so it only works with the read() and write()
@@ -263,6 +617,99 @@ class CAMOTO_GAMECOMMON_API bitstream
 		void peekByte(uint8_t *buf, uint8_t *mask);
 };
 
+template <bitstream::endian E>
+inline int bitstream::read(const uint8_t **in, const uint8_t *inEnd,
+	unsigned int bits, unsigned int *out)
+{
+	assert(E == this->endianType);
+	assert(bits <= 32);
+	if (
+		(inEnd - *in < 8)
+		|| (this->origBufByte == WASNT_BUFFERED)
+		|| (this->parent)
+	) {
+		// Close to the end of the buffer, or a read following a write, so do it
+		// one byte at a time.
+		return this->readSlow(in, inEnd, bits, out);
+	}
+
+	this->peek<E>(*in, inEnd, bits, out);
+	this->consume<E>(in, inEnd, bits);
+	return bits;
+}
+
+template <bitstream::endian E>
+inline unsigned int bitstream::peek(const uint8_t *in, const uint8_t *inEnd,
+	unsigned int bits, unsigned int *out) const
+{
+	assert(E == this->endianType);
+	assert(bits <= 32);
+	assert(this->origBufByte != WASNT_BUFFERED);
+	assert(!this->parent);
+
+	// Near the end of the buffer, pad the last few bytes out with zeroes so
+	// they can be loaded the same way.
+	const uint8_t *p = in;
+	uint8_t tail[8];
+	std::size_t lenIn = inEnd - in;
+	if (lenIn < 8) {
+		for (std::size_t i = 0; i < 8; i++) tail[i] = (i < lenIn) ? in[i] : 0;
+		p = tail;
+	}
+
+	// Number of unread bits left in bufByte
+	unsigned int avail = (this->curBitPos == 8) ? 0 : 8 - this->curBitPos;
+	if (E == littleEndian) {
+		uint64_t word = (uint64_t)p[0] | ((uint64_t)p[1] << 8)
+			| ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+			| ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40)
+			| ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+		uint64_t acc = (uint64_t)(this->bufByte >> (this->curBitPos & 7))
+			& ((1u << avail) - 1);
+		acc |= word << avail;
+		*out = acc & ((bits == 32) ? 0xFFFFFFFFu : ((1u << bits) - 1));
+	} else {
+		uint64_t acc = ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48)
+			| ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32)
+			| ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16)
+			| ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+		if (avail) {
+			acc = ((uint64_t)(this->bufByte & ((1u << avail) - 1)) << (64 - avail))
+				| (acc >> avail);
+		}
+		*out = bits ? (acc >> (64 - bits)) : 0;
+	}
+
+	if (lenIn < 8) {
+		unsigned int total = avail + lenIn * 8;
+		if (total < bits) return total;
+	}
+	return bits;
+}
+
+template <bitstream::endian E>
+inline void bitstream::consume(const uint8_t **in, const uint8_t *inEnd,
+	unsigned int bits)
+{
+	assert(E == this->endianType);
+	unsigned int avail = (this->curBitPos == 8) ? 0 : 8 - this->curBitPos;
+	if (bits <= avail) {
+		this->curBitPos += bits;
+	} else {
+		// Consume the bytes the value came from, keeping the last one in bufByte
+		// in case some of its bits are still unread.
+		unsigned int need = bits - avail;
+		unsigned int lenBytes = (need + 7) / 8;
+		assert(lenBytes <= (std::size_t)(inEnd - *in));
+		this->bufByte = (*in)[lenBytes - 1];
+		this->origBufByte = this->bufByte;
+		this->curBitPos = need - (lenBytes - 1) * 8;
+		this->offset += lenBytes;
+		*in += lenBytes;
+	}
+	return;
+}
+
 } // namespace camoto
 
 #endif // _CAMOTO_BITSTREAM_HPP_
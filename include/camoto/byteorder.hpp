@@ -44,6 +44,11 @@
  * uint32_t htole32(uint32_t x) - take host, return little-endian 32-bit
  * uint64_t htole64(uint64_t x) - take host, return little-endian 64-bit
  *
+ * Each of these also has an _array version that converts a whole array in
+ * place, e.g. le16toh_array(uint16_t *p, size_t n).  These do nothing when the
+ * host already uses the requested byte order, and otherwise use the compiler's
+ * vector extensions (if available) to swap several values at once.
+ *
  * Further #defines will provide additional functionality:
  *
  * #define BYTEORDER_USE_IOSTREAMS
@@ -63,23 +68,18 @@
  *   uint32_t var = host_from<uint32_t, little_endian>(123);
  *
  *   T var = host_from<T, E>(value);   // inside a template
+ *
+ *   host_from_array<T, E>(array, count); // convert in place
  */
 
 #ifndef _BYTEORDER_H_
 #define _BYTEORDER_H_
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h> // memcpy
 
-#if defined(linux) || defined(__posix) || defined(le16toh) || defined(_BSD_SOURCE)
-
-#ifndef _BSD_SOURCE
-#define _BSD_SOURCE
-#endif
-#include <endian.h>
-
-// Default OS (no specific functions)
-#else
-
+#ifndef ___swab16
 #define ___swab16(x) \
 	((uint16_t)( \
 		(((uint16_t)(x) & (uint16_t)0x00ffU) << 8) | \
@@ -102,6 +102,17 @@
 		(uint64_t)(((uint64_t)(x) & (uint64_t)0x0000ff0000000000ULL) >> 24) | \
 		(uint64_t)(((uint64_t)(x) & (uint64_t)0x00ff000000000000ULL) >> 40) | \
 		(uint64_t)(((uint64_t)(x) & (uint64_t)0xff00000000000000ULL) >> 56) ))
+#endif
+
+#if defined(linux) || defined(__posix) || defined(le16toh) || defined(_BSD_SOURCE)
+
+#ifndef _BSD_SOURCE
+#define _BSD_SOURCE
+#endif
+#include <endian.h>
+
+// Default OS (no specific functions)
+#else
 
 // Little endian
 #if defined(WIN32) || defined(__WIN32__) || defined(__CYGWIN32__) \
@@ -147,6 +158,118 @@
 
 #endif
 
+// Host byte order, for deciding when array conversions can be skipped.
+#if defined(WIN32) || defined(__WIN32__) || defined(__CYGWIN32__) \
+	|| defined(_WIN32) || defined(__LITTLE_ENDIAN__) \
+	|| (defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)) \
+	|| (defined(__BYTE_ORDER) && (__BYTE_ORDER == __LITTLE_ENDIAN))
+#define BYTEORDER_HOST_LITTLE_ENDIAN 1
+#else
+#define BYTEORDER_HOST_LITTLE_ENDIAN 0
+#endif
+
+// Array conversion.  With GCC and Clang a 16-byte vector type is used, which
+// becomes SSE2/AVX on x86 and NEON on ARM, without needing any of the
+// architecture-specific intrinsic headers.
+
+#if defined(__GNUC__) || defined(__clang__)
+#define BYTEORDER_VECTOR_SWAB
+typedef uint16_t byteorder_v16 __attribute__((vector_size(16)));
+typedef uint32_t byteorder_v32 __attribute__((vector_size(16)));
+typedef uint64_t byteorder_v64 __attribute__((vector_size(16)));
+#endif
+
+/// Reverse the byte order of every 16-bit value in an array.
+static inline void swab16_array(uint16_t *p, size_t n)
+{
+	size_t i = 0;
+#ifdef BYTEORDER_VECTOR_SWAB
+	for (; i + 8 <= n; i += 8) {
+		byteorder_v16 v;
+		memcpy(&v, p + i, sizeof(v));
+		v = (v << 8) | (v >> 8);
+		memcpy(p + i, &v, sizeof(v));
+	}
+#endif
+	for (; i < n; i++) p[i] = ___swab16(p[i]);
+	return;
+}
+
+/// Reverse the byte order of every 32-bit value in an array.
+static inline void swab32_array(uint32_t *p, size_t n)
+{
+	size_t i = 0;
+#ifdef BYTEORDER_VECTOR_SWAB
+	for (; i + 4 <= n; i += 4) {
+		byteorder_v32 v;
+		memcpy(&v, p + i, sizeof(v));
+		v = (v << 24) | ((v & 0xff00) << 8) | ((v >> 8) & 0xff00) | (v >> 24);
+		memcpy(p + i, &v, sizeof(v));
+	}
+#endif
+	for (; i < n; i++) p[i] = ___swab32(p[i]);
+	return;
+}
+
+/// Reverse the byte order of every 64-bit value in an array.
+static inline void swab64_array(uint64_t *p, size_t n)
+{
+	size_t i = 0;
+#ifdef BYTEORDER_VECTOR_SWAB
+	for (; i + 2 <= n; i += 2) {
+		// Swap the bytes in each 32-bit half, then swap the halves over.
+		byteorder_v32 h;
+		memcpy(&h, p + i, sizeof(h));
+		h = (h << 24) | ((h & 0xff00) << 8) | ((h >> 8) & 0xff00) | (h >> 24);
+		byteorder_v64 v = (byteorder_v64)h;
+		v = (v << 32) | (v >> 32);
+		memcpy(p + i, &v, sizeof(v));
+	}
+#endif
+	for (; i < n; i++) p[i] = ___swab64(p[i]);
+	return;
+}
+
+#define byteorder_array_nop(p, n) ((void)(p), (void)(n))
+
+#if BYTEORDER_HOST_LITTLE_ENDIAN
+
+#define le16toh_array(p, n)  byteorder_array_nop(p, n)
+#define le32toh_array(p, n)  byteorder_array_nop(p, n)
+#define le64toh_array(p, n)  byteorder_array_nop(p, n)
+
+#define htole16_array(p, n)  byteorder_array_nop(p, n)
+#define htole32_array(p, n)  byteorder_array_nop(p, n)
+#define htole64_array(p, n)  byteorder_array_nop(p, n)
+
+#define be16toh_array(p, n)  swab16_array(p, n)
+#define be32toh_array(p, n)  swab32_array(p, n)
+#define be64toh_array(p, n)  swab64_array(p, n)
+
+#define htobe16_array(p, n)  swab16_array(p, n)
+#define htobe32_array(p, n)  swab32_array(p, n)
+#define htobe64_array(p, n)  swab64_array(p, n)
+
+#else
+
+#define le16toh_array(p, n)  swab16_array(p, n)
+#define le32toh_array(p, n)  swab32_array(p, n)
+#define le64toh_array(p, n)  swab64_array(p, n)
+
+#define htole16_array(p, n)  swab16_array(p, n)
+#define htole32_array(p, n)  swab32_array(p, n)
+#define htole64_array(p, n)  swab64_array(p, n)
+
+#define be16toh_array(p, n)  byteorder_array_nop(p, n)
+#define be32toh_array(p, n)  byteorder_array_nop(p, n)
+#define be64toh_array(p, n)  byteorder_array_nop(p, n)
+
+#define htobe16_array(p, n)  byteorder_array_nop(p, n)
+#define htobe32_array(p, n)  byteorder_array_nop(p, n)
+#define htobe64_array(p, n)  byteorder_array_nop(p, n)
+
+#endif
+
 // Create some strongly-typed functions that call the correct endian conversion
 // routines based on the given C++ type.
 
@@ -194,6 +317,50 @@ template <> inline int32_t host_to  <int32_t, big_endian>(int32_t value) { retur
 template <> inline int64_t host_from<int64_t, big_endian>(int64_t value) { return (int64_t)be64toh((uint64_t)value); }
 template <> inline int64_t host_to  <int64_t, big_endian>(int64_t value) { return (int64_t)htobe64((uint64_t)value); }
 
+/// Is the given byte order the same as the host's?
+template <class E> struct is_host_endian;
+template <> struct is_host_endian<little_endian> { static const bool value = BYTEORDER_HOST_LITTLE_ENDIAN; };
+template <> struct is_host_endian<big_endian> { static const bool value = !BYTEORDER_HOST_LITTLE_ENDIAN; };
+
+template <typename T, class E> void host_from_array(T *p, size_t n);
+template <typename T, class E> void host_to_array(T *p, size_t n);
+
+template <> inline void host_from_array< uint8_t, little_endian>( uint8_t *p, size_t n) { byteorder_array_nop(p, n); }
+template <> inline void host_to_array  < uint8_t, little_endian>( uint8_t *p, size_t n) { byteorder_array_nop(p, n); }
+template <> inline void host_from_array<uint16_t, little_endian>(uint16_t *p, size_t n) { le16toh_array(p, n); }
+template <> inline void host_to_array  <uint16_t, little_endian>(uint16_t *p, size_t n) { htole16_array(p, n); }
+template <> inline void host_from_array<uint32_t, little_endian>(uint32_t *p, size_t n) { le32toh_array(p, n); }
+template <> inline void host_to_array  <uint32_t, little_endian>(uint32_t *p, size_t n) { htole32_array(p, n); }
+template <> inline void host_from_array<uint64_t, little_endian>(uint64_t *p, size_t n) { le64toh_array(p, n); }
+template <> inline void host_to_array  <uint64_t, little_endian>(uint64_t *p, size_t n) { htole64_array(p, n); }
+
+template <> inline void host_from_array< uint8_t, big_endian>( uint8_t *p, size_t n) { byteorder_array_nop(p, n); }
+template <> inline void host_to_array  < uint8_t, big_endian>( uint8_t *p, size_t n) { byteorder_array_nop(p, n); }
+template <> inline void host_from_array<uint16_t, big_endian>(uint16_t *p, size_t n) { be16toh_array(p, n); }
+template <> inline void host_to_array  <uint16_t, big_endian>(uint16_t *p, size_t n) { htobe16_array(p, n); }
+template <> inline void host_from_array<uint32_t, big_endian>(uint32_t *p, size_t n) { be32toh_array(p, n); }
+template <> inline void host_to_array  <uint32_t, big_endian>(uint32_t *p, size_t n) { htobe32_array(p, n); }
+template <> inline void host_from_array<uint64_t, big_endian>(uint64_t *p, size_t n) { be64toh_array(p, n); }
+template <> inline void host_to_array  <uint64_t, big_endian>(uint64_t *p, size_t n) { htobe64_array(p, n); }
+
+template <> inline void host_from_array< int8_t, little_endian>( int8_t *p, size_t n) { byteorder_array_nop(p, n); }
+template <> inline void host_to_array  < int8_t, little_endian>( int8_t *p, size_t n) { byteorder_array_nop(p, n); }
+template <> inline void host_from_array<int16_t, little_endian>(int16_t *p, size_t n) { le16toh_array((uint16_t *)p, n); }
+template <> inline void host_to_array  <int16_t, little_endian>(int16_t *p, size_t n) { htole16_array((uint16_t *)p, n); }
+template <> inline void host_from_array<int32_t, little_endian>(int32_t *p, size_t n) { le32toh_array((uint32_t *)p, n); }
+template <> inline void host_to_array  <int32_t, little_endian>(int32_t *p, size_t n) { htole32_array((uint32_t *)p, n); }
+template <> inline void host_from_array<int64_t, little_endian>(int64_t *p, size_t n) { le64toh_array((uint64_t *)p, n); }
+template <> inline void host_to_array  <int64_t, little_endian>(int64_t *p, size_t n) { htole64_array((uint64_t *)p, n); }
+
+template <> inline void host_from_array< int8_t, big_endian>( int8_t *p, size_t n) { byteorder_array_nop(p, n); }
+template <> inline void host_to_array  < int8_t, big_endian>( int8_t *p, size_t n) { byteorder_array_nop(p, n); }
+template <> inline void host_from_array<int16_t, big_endian>(int16_t *p, size_t n) { be16toh_array((uint16_t *)p, n); }
+template <> inline void host_to_array  <int16_t, big_endian>(int16_t *p, size_t n) { htobe16_array((uint16_t *)p, n); }
+template <> inline void host_from_array<int32_t, big_endian>(int32_t *p, size_t n) { be32toh_array((uint32_t *)p, n); }
+template <> inline void host_to_array  <int32_t, big_endian>(int32_t *p, size_t n) { htobe32_array((uint32_t *)p, n); }
+template <> inline void host_from_array<int64_t, big_endian>(int64_t *p, size_t n) { be64toh_array((uint64_t *)p, n); }
+template <> inline void host_to_array  <int64_t, big_endian>(int64_t *p, size_t n) { htobe64_array((uint64_t *)p, n); }
+
 #endif // BYTEORDER_PROVIDE_TYPED_FUNCTIONS || BYTEORDER_USE_IOSTREAMS
 
 #ifdef BYTEORDER_USE_IOSTREAMS
@@ -235,6 +402,26 @@ struct number_format: public number_format_read, public number_format_write {
 		return;
 	}
 
+	/// Number of bytes taken up in the stream.
+	static const unsigned int length = sizeof(T);
+
+	/// Convert the value from the stream representation held in a buffer.
+	void decode(const unsigned char *buf) const
+	{
+		T x;
+		memcpy(&x, buf, sizeof(T));
+		this->r = host_from<T, E>(x);
+		return;
+	}
+
+	/// Convert the value to the stream representation and put it in a buffer.
+	void encode(unsigned char *buf) const
+	{
+		T x = host_to<T, E>(this->r);
+		memcpy(buf, &x, sizeof(T));
+		return;
+	}
+
 	private:
 		I& r;
 };
@@ -253,6 +440,17 @@ struct number_format_const: public number_format_write {
 		return;
 	}
 
+	/// Number of bytes taken up in the stream.
+	static const unsigned int length = sizeof(T);
+
+	/// Convert the value to the stream representation and put it in a buffer.
+	void encode(unsigned char *buf) const
+	{
+		T x = host_to<T, E>(this->r);
+		memcpy(buf, &x, sizeof(T));
+		return;
+	}
+
 	private:
 		const I& r;
 };
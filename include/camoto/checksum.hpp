@@ -0,0 +1,106 @@
+/**
+ * @file  camoto/checksum.hpp
+ * @brief CRC32, Adler32 and XOR checksums.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_CHECKSUM_HPP_
+#define _CAMOTO_CHECKSUM_HPP_
+
+#include <cstddef>
+#include <stdint.h>
+#include <camoto/config.hpp>
+
+namespace camoto {
+
+/// Add some data to a CRC32.
+/**
+ * This is the CRC32 used by zip, gzip and PNG (polynomial 0xEDB88320, with
+ * the value inverted before and after.)  The value for no data is zero, and
+ * the value returned can be passed back in to continue with more data.
+ *
+ * PCLMULQDQ is used on x86 CPUs that have it, and the CRC32 instructions on
+ * ARMv8 CPUs built with them enabled.  Everywhere else it runs slice-by-8,
+ * looking up eight bytes at a time.
+ *
+ * @param crc
+ *   CRC of the data so far.
+ *
+ * @param data
+ *   Next block of data.
+ *
+ * @param len
+ *   Number of bytes in \e data.
+ *
+ * @return Updated CRC.
+ */
+CAMOTO_GAMECOMMON_API uint32_t crc32(uint32_t crc, const uint8_t *data,
+	std::size_t len);
+
+/// Add some data to an Adler32 checksum, as used by zlib.
+/**
+ * The value for no data is one, and the value returned can be passed back in
+ * to continue with more data.
+ */
+CAMOTO_GAMECOMMON_API uint32_t adler32(uint32_t adler, const uint8_t *data,
+	std::size_t len);
+
+/// Add some data to an eight-bit XOR checksum.
+/**
+ * The value for no data is zero.
+ */
+CAMOTO_GAMECOMMON_API uint8_t xor8(uint8_t x, const uint8_t *data,
+	std::size_t len);
+
+/// Checksum algorithms available through the checksum class.
+enum class checksum_type {
+	CRC32,    ///< crc32()
+	Adler32,  ///< adler32()
+	XOR8,     ///< xor8()
+};
+
+/// Checksum of data that arrives a block at a time.
+class CAMOTO_GAMECOMMON_API checksum
+{
+	public:
+		/// Start a new checksum.
+		/**
+		 * @param type
+		 *   Algorithm to use.
+		 */
+		checksum(checksum_type type);
+
+		/// Start again, as if no data had been added.
+		void reset();
+
+		/// Add the next block of data.
+		void update(const uint8_t *data, std::size_t len);
+
+		/// Checksum of all the data added since the last reset().
+		uint32_t value() const;
+
+		/// Algorithm in use.
+		checksum_type type() const;
+
+	protected:
+		checksum_type algo; ///< Algorithm in use
+		uint32_t current;   ///< Checksum so far
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_CHECKSUM_HPP_
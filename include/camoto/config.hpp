@@ -21,6 +21,10 @@
 #ifndef _CAMOTO_CONFIG_HPP_
 #define _CAMOTO_CONFIG_HPP_
 
+// Collect usage counters for camoto::stats::snapshot()?  This adds a little
+// overhead to every stream access, so it is off by default.
+//#define CAMOTO_STATS
+
 #ifdef _MSC_VER
 
 #ifndef DLL_IMPORT
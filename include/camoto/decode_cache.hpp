@@ -0,0 +1,148 @@
+/**
+ * @file  camoto/decode_cache.hpp
+ * @brief Process-wide cache of decoded data, shared between filtered streams.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_DECODE_CACHE_HPP_
+#define _CAMOTO_DECODE_CACHE_HPP_
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <camoto/config.hpp>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Decoded copies of filtered data, shared between streams.
+/**
+ * When the same compressed data is opened more than once (e.g. once to
+ * identify the file format and again to actually read it) every
+ * input_filtered would normally decode it all again.  With the cache enabled,
+ * the first stream to decode some data keeps it here, and later streams
+ * reading the same bytes of the same parent through a filter with the same
+ * filter::signature() just take another reference to it.
+ *
+ * Entries are only made for parents whose input::identify() identifies them,
+ * and filters that give a signature.  The decoded data is never changed once
+ * it is in the cache, so streams can keep reading it after it has been
+ * evicted.  Writing to a parent removes that parent's entries.
+ *
+ * The cache is disabled (with a budget of zero) until set_budget() is called.
+ * All functions are safe to call from any thread.
+ */
+class CAMOTO_GAMECOMMON_API decode_cache
+{
+	public:
+		/// Decoded data held by the cache.
+		typedef std::shared_ptr<const std::string> content;
+
+		/// The cache used by input_filtered.
+		static decode_cache& shared();
+
+		/// Create an empty cache, which is disabled until given a budget.
+		decode_cache();
+
+		/// Set how much decoded data may be kept.
+		/**
+		 * When the total goes over this, the least recently used entries are
+		 * dropped.  Data larger than the whole budget is never kept.
+		 *
+		 * @param bytes
+		 *   Memory budget in bytes.  Zero disables the cache and empties it.
+		 */
+		void set_budget(std::size_t bytes);
+
+		/// Current memory budget in bytes.
+		std::size_t budget() const;
+
+		/// Total size of the cached data in bytes.
+		std::size_t used() const;
+
+		/// Number of entries in the cache.
+		std::size_t count() const;
+
+		/// Look for data decoded earlier.
+		/**
+		 * @param source
+		 *   Where the undecoded data came from.
+		 *
+		 * @param signature
+		 *   filter::signature() of the filter that decoded it.
+		 *
+		 * @return The decoded data, or an empty pointer if it isn't cached.
+		 */
+		content find(const source_id& source, const std::string& signature);
+
+		/// Keep some decoded data.
+		/**
+		 * This replaces any entry with the same key.  Nothing is kept if the
+		 * cache is disabled or the data is larger than the budget.
+		 *
+		 * @param source
+		 *   Where the undecoded data came from.
+		 *
+		 * @param signature
+		 *   filter::signature() of the filter that decoded it.
+		 *
+		 * @param data
+		 *   The decoded data, which must not be changed from now on.
+		 */
+		void add(const source_id& source, const std::string& signature,
+			content data);
+
+		/// Drop every entry decoded from the given content number.
+		/**
+		 * This is called by source_tag when a stream is written to.
+		 *
+		 * @param contentNumber
+		 *   source_id::content value that is no longer valid.
+		 */
+		void invalidate(uint64_t contentNumber);
+
+		/// Drop every entry.
+		void clear();
+
+	protected:
+		/// (content number, offset, length, filter signature)
+		typedef std::tuple<uint64_t, stream::pos, stream::len, std::string> key;
+
+		/// Entries, most recently used first.
+		typedef std::list<std::pair<key, content>> lru_list;
+
+		mutable std::mutex lock;   ///< Protects the members below
+		std::size_t lenBudget;     ///< Most data to keep, in bytes
+		std::size_t lenUsed;       ///< Data currently kept, in bytes
+		lru_list entries;          ///< Cached data
+		std::map<key, lru_list::iterator> index; ///< Entries sorted by key
+
+		/// Remove the least recently used entries until within budget.
+		void evict();
+
+		/// Remove one entry.
+		void erase(std::map<key, lru_list::iterator>::iterator it);
+};
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_DECODE_CACHE_HPP_
@@ -0,0 +1,83 @@
+/**
+ * @file  camoto/filter-batch.hpp
+ * @brief Run many independent filter jobs at once on a thread pool.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_FILTER_BATCH_HPP_
+#define _CAMOTO_FILTER_BATCH_HPP_
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <camoto/filter.hpp>
+#include <camoto/thread_pool.hpp>
+
+namespace camoto {
+
+/// One block of data to be run through a filter by filter_many().
+struct CAMOTO_GAMECOMMON_API filter_job
+{
+	/// Data to filter, typically a stream::input_sub within an archive.
+	std::shared_ptr<stream::input> source;
+
+	/// Where to write the filtered data.
+	std::shared_ptr<stream::output> dest;
+
+	/// Set to the exception thrown if this job failed, otherwise empty.
+	std::exception_ptr error;
+};
+
+/// Function creating a new filter instance.
+/**
+ * This is called once per worker thread rather than once per job, and the
+ * filter is reset() before each job it runs.  It may be called from several
+ * threads at once.
+ */
+typedef std::function<std::shared_ptr<filter>()> fn_create_filter;
+
+/// Filter many independent blocks of data in parallel.
+/**
+ * Each job's source is read from the start with positional reads, passed
+ * through a filter, and written to the job's dest, which is flushed at the
+ * end.  Jobs are run across the threads in the pool, each thread reusing its
+ * own filter instance and buffers.
+ *
+ * Different jobs may share a parent stream (such as several substreams of the
+ * same archive file) since reading substreams concurrently is safe.  Each job
+ * must have its own destination stream.
+ *
+ * @param jobs
+ *   Jobs to run.  The error member of each job is set if it failed.
+ *
+ * @param create
+ *   Function returning a new filter, e.g. a filter_lzw_decompress with the
+ *   parameters for this archive format.
+ *
+ * @param pool
+ *   Thread pool to run the jobs on, or NULL to use a temporary pool with one
+ *   thread per CPU core.
+ *
+ * @return The number of jobs that failed.
+ */
+CAMOTO_GAMECOMMON_API unsigned int filter_many(std::vector<filter_job>& jobs,
+	fn_create_filter create, thread_pool *pool = nullptr);
+
+} // namespace camoto
+
+#endif // _CAMOTO_FILTER_BATCH_HPP_
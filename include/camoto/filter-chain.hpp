@@ -0,0 +1,109 @@
+/**
+ * @file  camoto/filter-chain.hpp
+ * @brief Filter object that runs data through several other filters in turn.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_FILTER_CHAIN_HPP_
+#define _CAMOTO_FILTER_CHAIN_HPP_
+
+#include <memory>
+#include <vector>
+#include <camoto/filter.hpp>
+
+namespace camoto {
+
+/// Filter passing data through a list of other filters, one after the other.
+/**
+ * This has the same effect as nesting one stream::filtered inside another, but
+ * the data is passed between the filters through small fixed-size buffers in
+ * a single pass, instead of each layer holding a complete copy of the data.
+ *
+ * @code
+ * auto chain = std::make_shared<filter_chain>();
+ * chain->add(std::make_shared<filter_lzw_decompress>(...));
+ * chain->add(std::make_shared<filter_crop>(4));
+ * @endcode
+ *
+ * Each filter in the chain is called in the same way stream::filtered calls
+ * a single filter, so filters need no changes to be used here.
+ */
+class CAMOTO_GAMECOMMON_API filter_chain: public filter
+{
+	public:
+		/// Create an empty chain, which passes data through unchanged.
+		filter_chain();
+
+		/// Create a chain from a list of filters.
+		/**
+		 * @param filters
+		 *   Filters to run, with the first one receiving the incoming data.
+		 */
+		filter_chain(std::vector<std::shared_ptr<filter>> filters);
+
+		/// Append a filter to the end of the chain.
+		/**
+		 * @param f
+		 *   Filter to run on the output of the previous filter in the chain.
+		 */
+		void add(std::shared_ptr<filter> f);
+
+		/// @copydoc filter::reset()
+		/**
+		 * @note Only the first filter in the chain knows the real size of its
+		 *   input.  The same value is passed to the other filters, since the size
+		 *   of each intermediate stage can't be known in advance.
+		 */
+		virtual void reset(stream::len lenInput);
+		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
+			stream::len *lenIn);
+
+		/// @copydoc filter::skip_leading_input()
+		/**
+		 * Only the first filter in the chain reads the incoming data, so this is
+		 * passed on to that filter.
+		 */
+		virtual stream::len skip_leading_input();
+
+		/// @copydoc filter::use_contiguous_output()
+		/**
+		 * Only the last filter in the chain writes to the caller's buffer, so
+		 * this is passed on to that filter.
+		 */
+		virtual void use_contiguous_output();
+
+		/// @copydoc filter::signature()
+		/**
+		 * The chain only has a signature if every filter in it does.
+		 */
+		virtual std::string signature() const;
+
+	protected:
+		/// Data waiting between one filter and the next.
+		struct stage {
+			std::shared_ptr<filter> algo;  ///< Filter producing this data
+			std::vector<uint8_t> buffer;   ///< Output of algo, input of next filter
+			stream::pos start;             ///< Offset of first unread byte in buffer
+			stream::len len;               ///< Number of unread bytes in buffer
+			bool done;                     ///< Has algo signalled end of data?
+		};
+		std::vector<stage> stages;
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_FILTER_CHAIN_HPP_
@@ -0,0 +1,68 @@
+/**
+ * @file  camoto/filter-checksum.hpp
+ * @brief Filter that passes data through unchanged, checksumming it on the way.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_FILTER_CHECKSUM_HPP_
+#define _CAMOTO_FILTER_CHECKSUM_HPP_
+
+#include <camoto/checksum.hpp>
+#include <camoto/config.hpp>
+#include <camoto/filter.hpp>
+
+namespace camoto {
+
+/// Pass data through unchanged, calculating its checksum.
+/**
+ * Putting this at the end of a filter_chain gives the checksum of the
+ * filtered data as it is produced, without reading it all over again
+ * afterwards.  For example a decompressor followed by a filter_checksum
+ * checks an archived file while it is being extracted.
+ *
+ * The value is complete once the filter has seen all the data, e.g. after
+ * stream::input_filtered has been read or stream::filtered has been flushed.
+ * reset() starts the checksum again, so it only covers the latest pass.
+ */
+class CAMOTO_GAMECOMMON_API filter_checksum: public filter
+{
+	public:
+		/// Constructor.
+		/**
+		 * @param type
+		 *   Checksum algorithm to use.
+		 */
+		filter_checksum(checksum_type type);
+
+		virtual void reset(stream::len lenInput);
+		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
+			stream::len *lenIn);
+
+		/// Checksum of the data that has passed through since the last reset().
+		uint32_t value() const;
+
+		/// Number of bytes that have passed through since the last reset().
+		stream::len length() const;
+
+	protected:
+		checksum sum;        ///< Checksum so far
+		stream::len lenSum;  ///< Number of bytes in sum
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_FILTER_CHECKSUM_HPP_
@@ -25,6 +25,11 @@
 
 namespace camoto {
 
+/// Filter that drops a number of bytes from the start of the data.
+/**
+ * When used with stream::filtered, the dropped bytes are skipped by seeking
+ * the underlying stream, so they are never read at all.
+ */
 class CAMOTO_GAMECOMMON_API filter_crop: public filter
 {
 	public:
@@ -33,10 +38,11 @@ class CAMOTO_GAMECOMMON_API filter_crop: public filter
 		virtual void reset(stream::len lenInput);
 		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
 			stream::len *lenIn);
+		virtual stream::len skip_leading_input();
 
 	protected:
 		stream::pos start;
-		bool cropped;
+		stream::len lenSkip; ///< Number of bytes still to be dropped
 };
 
 } // namespace camoto
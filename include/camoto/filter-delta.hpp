@@ -0,0 +1,84 @@
+/**
+ * @file  camoto/filter-delta.hpp
+ * @brief Filter that converts between samples and the differences between them.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_FILTER_DELTA_HPP_
+#define _CAMOTO_FILTER_DELTA_HPP_
+
+#include <camoto/config.hpp>
+#include <camoto/filter.hpp>
+
+namespace camoto {
+
+/// Size and byte order of each value in delta-coded data.
+enum class delta_type {
+	U8,     ///< One byte per value
+	U16LE,  ///< Two bytes per value, little endian
+	U16BE,  ///< Two bytes per value, big endian
+};
+
+/// Delta coding, as used for audio samples and heightmaps.
+/**
+ * Encoded data stores each value as the difference from the one before it,
+ * with the value before the first one taken as zero.  The arithmetic wraps
+ * around, so every value can be stored.  The previous value carries on from
+ * one call to transform() to the next, and goes back to zero on reset().
+ *
+ * Decoding is a running sum, which is worked out 16 bytes at a time with a
+ * parallel prefix sum when SSE2 is available.
+ *
+ * With 16-bit values, a byte left over at the end of the data is passed
+ * through unchanged, and the output buffer given to transform() must have
+ * room for at least one whole value.
+ */
+class CAMOTO_GAMECOMMON_API filter_delta: public filter
+{
+	public:
+		/// Which way the data is converted.
+		enum class Direction {
+			Decode,  ///< Differences in, values out
+			Encode,  ///< Values in, differences out
+		};
+
+		/// Constructor.
+		/**
+		 * @param type
+		 *   Size and byte order of each value.
+		 *
+		 * @param direction
+		 *   Whether to encode or decode.
+		 */
+		filter_delta(delta_type type, Direction direction);
+
+		virtual void reset(stream::len lenInput);
+		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
+			stream::len *lenIn);
+		virtual bool save_state(stream::output& s) const;
+		virtual void load_state(stream::input& s);
+		virtual std::string signature() const;
+
+	protected:
+		delta_type type;      ///< Size and byte order of each value
+		Direction direction;  ///< Encoding or decoding
+		uint16_t prev;        ///< Last value, before delta coding
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_FILTER_DELTA_HPP_
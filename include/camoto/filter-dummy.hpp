@@ -33,6 +33,7 @@ class CAMOTO_GAMECOMMON_API filter_dummy: public filter
 		virtual void reset(stream::len lenInput);
 		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
 			stream::len *lenIn);
+		virtual std::string signature() const;
 };
 
 } // namespace camoto
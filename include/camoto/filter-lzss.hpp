@@ -21,6 +21,7 @@
 #ifndef _CAMOTO_FILTER_LZSS_HPP_
 #define _CAMOTO_FILTER_LZSS_HPP_
 
+#include <string>
 #include <vector>
 #include <camoto/config.hpp>
 #include <camoto/bitstream.hpp>
@@ -28,6 +29,11 @@
 
 namespace camoto {
 
+class thread_pool;
+
+/// Default amount of input each thread compresses in lzss_compress_parallel().
+#define LZSS_PARALLEL_BLOCK_SIZE (256 * 1024)
+
 /// LZSS decompressor
 class CAMOTO_GAMECOMMON_API filter_lzss_decompress: public filter
 {
@@ -51,11 +57,36 @@ class CAMOTO_GAMECOMMON_API filter_lzss_decompress: public filter
 		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
 			stream::len *lenIn);
 
+		/// @copydoc filter::use_contiguous_output()
+		/**
+		 * Back-references are then copied straight from the earlier output, and
+		 * the sliding window is not used at all, saving a second copy of every
+		 * decoded byte.
+		 */
+		virtual void use_contiguous_output();
+
+		/// @copydoc filter::save_state()
+		/**
+		 * The state can't be saved after use_contiguous_output(), as the sliding
+		 * window is not kept up to date.
+		 */
+		virtual bool save_state(stream::output& s) const;
+
+		virtual void load_state(stream::input& s);
+		virtual std::string signature() const;
+
 	protected:
 		bitstream data;
 		unsigned int sizeLength;   ///< Size of the length field, in bits
 		unsigned int sizeDistance; ///< Size of the distance field, in bits
 
+		/// Is all the output in one buffer, so the window isn't needed?
+		bool contiguous;
+
+		/// Bytes written by earlier calls to transform() since reset().  Only
+		/// kept up to date when contiguous is true.
+		stream::len lenDone;
+
 		enum class State {
 			S0_READ_FLAG,  ///< Read the first code/flag
 			S1_COPY_BYTE,  ///< Copy a literal byte
@@ -64,23 +95,44 @@ class CAMOTO_GAMECOMMON_API filter_lzss_decompress: public filter
 			S4_COPY_REF,   ///< Copy the backreference to the end of the output data
 		} state;
 		const unsigned int maxDistance; ///< Size of sliding window, 1 << sizeDist
-		std::unique_ptr<uint8_t[]> window; ///< Sliding window, maxDistance-1 elements
+		/// Sliding window, maxDistance elements.  Data before the start of the
+		/// output is taken to be all zeroes.
+		std::unique_ptr<uint8_t[]> window;
 		unsigned int posWindow; ///< Current offset within window
 
 		unsigned int lzssLength;   ///< Last value of the length field
 		unsigned int lzssDistance; ///< Last value of the distance field
+
+		/// Append decompressed data to the sliding window.
+		void addToWindow(const uint8_t *data, stream::len len);
 };
 
 /// LZSS compressor
 class CAMOTO_GAMECOMMON_API filter_lzss_compress: public filter
 {
 	public:
+		/// How hard the compressor should look for back-references.
+		enum class Effort {
+			Store,   ///< No compression, every byte is written as a literal
+			Greedy,  ///< Always take the longest match at the current position
+			Lazy,    ///< Skip a match if a longer one starts at the next byte
+			Optimal, ///< Choose the smallest encoding for each block of input
+		};
+
 		/// LZSS compression constructor.
 		/**
-		 * This is currently just a dummy compressor.  It writes out LZSS-compatible
-		 * data that can be decompressed correctly, but it doesn't actually perform
-		 * any compression - so the output data will be slightly larger than the
-		 * input (as each 8-bit byte is written out as a 9-bit byte.)
+		 * Back-references are found by following hash chains through the last
+		 * 1 << sizeDistance bytes of input.  Every back-reference costs the same
+		 * number of bits regardless of its length or distance, so the only choice
+		 * the compressor has to make is where to use one.  The effort level
+		 * controls how much work is put into that choice:
+		 *
+		 * - Store writes only literals, the output will be 9/8 the input size.
+		 * - Greedy takes the longest match at each position.
+		 * - Lazy also checks the following position, and writes a literal instead
+		 *   if a longer match starts there.
+		 * - Optimal finds the smallest possible encoding for each 4 kB block of
+		 *   input, given the matches found by the hash chains.
 		 *
 		 * @param endian
 		 *   Endian-ness of the input data (from which end are the bytes split into
@@ -91,20 +143,183 @@ class CAMOTO_GAMECOMMON_API filter_lzss_compress: public filter
 		 *
 		 * @param sizeDistance
 		 *   Size of the LZSS distance field, in bits.
+		 *
+		 * @param effort
+		 *   Compression effort level.
 		 */
 		filter_lzss_compress(bitstream::endian endian, unsigned int sizeLength,
-			unsigned int sizeDistance);
+			unsigned int sizeDistance, Effort effort = Effort::Lazy);
 
 		virtual void reset(stream::len lenInput);
 		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
 			stream::len *lenIn);
+		virtual stream::len measure(const uint8_t *in, stream::len *lenIn);
+
+		/// Compress one block of a larger input by itself.
+		/**
+		 * The data before the block is loaded into the window first, without
+		 * being encoded, so back-references can reach back into it just as they
+		 * would if the whole input were compressed in one go.  The decompressor
+		 * will already have that data in its window when it reaches the block.
+		 *
+		 * @post The filter must be reset() before it is used again.
+		 *
+		 * @param in
+		 *   Data to compress.
+		 *
+		 * @param lenIn
+		 *   Length of \e in.
+		 *
+		 * @param lenHistory
+		 *   Number of bytes before \e in that come earlier in the same data, of
+		 *   which only the last 1 << sizeDistance are used.
+		 *
+		 * @param out
+		 *   On return, the compressed block.  The last byte may be padded out
+		 *   with unused bits.
+		 *
+		 * @return Number of bits in \e out, not counting the padding, ready to be
+		 *   passed to bitstream::append().
+		 */
+		uint64_t compressBlock(const uint8_t *in, stream::len lenIn,
+			stream::len lenHistory, std::vector<uint8_t> *out);
 
 	protected:
 		bitstream data;
 		unsigned int sizeLength;   ///< Size of the length field, in bits
 		unsigned int sizeDistance; ///< Size of the distance field, in bits
+		Effort effort;             ///< Selected compression effort
+		const unsigned int maxDistance; ///< Furthest back-reference, 1 << sizeDist
+		const unsigned int maxLength;   ///< Longest back-reference
+		const unsigned int sizeMatch;   ///< Size of a back-reference, in bits
+		unsigned int maxChain;     ///< Max hash chain entries to check per byte
+
+		/// Input data.  The encoder is at buf[posBuf], everything before it is
+		/// history available for back-references.
+		std::vector<uint8_t> buf;
+		stream::pos bufStart;      ///< Offset of buf[0] in the uncompressed data
+		std::size_t posBuf;        ///< Index in buf of the next byte to encode
+
+		/// Most recent offset (+1) for each hash value, or 0 if none.
+		std::vector<stream::pos> head;
+		/// Previous offset (+1) with the same hash, indexed by offset % maxDistance.
+		std::vector<stream::pos> prev;
+		stream::pos hashed;        ///< Offset of the next byte to add to the chains
+
+		bool haveNextMatch;        ///< Lazy mode: are nextLen/nextDist valid?
+		unsigned int nextLen;      ///< Lazy mode: match length at posBuf
+		unsigned int nextDist;     ///< Lazy mode: match distance at posBuf
+
+		/// Optimal mode: match lengths, distances and costs for the current block.
+		std::vector<unsigned int> optLen, optDist, optCost;
+
+		bool finished;             ///< Has the final byte been flushed?
+		/// Output waiting for space in out, big enough for one call to encode().
+		std::vector<uint8_t> pending;
+		std::size_t pendingPos;    ///< Next byte in pending to write
+		std::size_t lenPending;    ///< Number of valid bytes in pending
+
+		/// Add all bytes before buf[end] to the hash chains.
+		void insertUpTo(std::size_t end);
+
+		/// Find the longest back-reference for the data at buf[pos].
+		/**
+		 * All data before buf[pos] must have been passed to insertUpTo() first.
+		 *
+		 * @param pos
+		 *   Index of the first byte in buf to match.
+		 *
+		 * @param limit
+		 *   Maximum length of the match.  Will be reduced to maxLength if larger.
+		 *
+		 * @param dist
+		 *   On return, distance back to the start of the match.
+		 *
+		 * @return Length of the match, or 0 if no match of two bytes or more
+		 *   could be found.
+		 */
+		unsigned int findMatch(std::size_t pos, std::size_t limit,
+			unsigned int *dist);
+
+		/// Encode some of the buffered data.
+		/**
+		 * @param out
+		 *   Where to write the encoded data, advanced past it on return.
+		 *
+		 * @param outEnd
+		 *   One past the last byte available at \e out.
+		 *
+		 * @param eof
+		 *   true if there is no more input to come, so the data at the end of the
+		 *   buffer must be encoded.
+		 *
+		 * @return true if some data was encoded, false if there is not enough data
+		 *   in the buffer to continue.
+		 */
+		bool encode(uint8_t **out, uint8_t *outEnd, bool eof);
+
+		/// Take in more input and encode some of it, or finish off the data.
+		/**
+		 * This writes no more than fits in pending.
+		 *
+		 * @param out
+		 *   Where to write the encoded data, advanced past it on return.
+		 *
+		 * @param outEnd
+		 *   One past the last byte available at \e out.
+		 *
+		 * @param in
+		 *   Input data, as passed to transform().
+		 *
+		 * @param lenIn
+		 *   Length of \e in.
+		 *
+		 * @param r
+		 *   Offset of the next unread byte in \e in, advanced on return.
+		 *
+		 * @return false if nothing more can be done until more input arrives.
+		 */
+		bool step(uint8_t **out, uint8_t *outEnd, const uint8_t *in,
+			stream::len lenIn, stream::len *r);
+
+		/// Write out a literal byte.
+		void writeLiteral(uint8_t **out, uint8_t *outEnd, uint8_t val);
+
+		/// Write out a back-reference.
+		void writeMatch(uint8_t **out, uint8_t *outEnd, unsigned int len,
+			unsigned int dist);
 };
 
+/// Compress LZSS data on several threads at once.
+/**
+ * The input is split into blocks which are compressed in parallel with
+ * filter_lzss_compress::compressBlock(), then joined together bit for bit.
+ * Each block can refer back to the data before it, so the result is read by
+ * an ordinary filter_lzss_decompress, and is within a few bytes of the size
+ * filter_lzss_compress would produce.
+ *
+ * The parameters are the same as for filter_lzss_compress.
+ *
+ * @param in
+ *   Data to compress.
+ *
+ * @param lenIn
+ *   Length of \e in.
+ *
+ * @param pool
+ *   Threads to use, or nullptr to create a pool with one thread per core.
+ *
+ * @param lenBlock
+ *   Amount of input in each block.
+ *
+ * @return The compressed data.
+ */
+CAMOTO_GAMECOMMON_API std::string lzss_compress_parallel(const uint8_t *in,
+	stream::len lenIn, bitstream::endian endian, unsigned int sizeLength,
+	unsigned int sizeDistance,
+	filter_lzss_compress::Effort effort = filter_lzss_compress::Effort::Lazy,
+	thread_pool *pool = nullptr, stream::len lenBlock = LZSS_PARALLEL_BLOCK_SIZE);
+
 } // namespace camoto
 
 #endif // _CAMOTO_FILTER_LZSS_HPP_
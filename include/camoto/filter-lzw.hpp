@@ -22,13 +22,15 @@
 #define _CAMOTO_FILTER_LZW_HPP_
 
 #include <vector>
-#include <deque>
+#include <memory>
 #include <camoto/config.hpp>
 #include <camoto/bitstream.hpp>
 #include <camoto/filter.hpp>
 
 namespace camoto {
 
+class thread_pool;
+
 #define LZW_LITTLE_ENDIAN     0x00 ///< Read bytes in little-endian order
 #define LZW_BIG_ENDIAN        0x01 ///< Read bytes in big-endian order
 #define LZW_RESET_FULL_DICT   0x02 ///< Should the dict be wiped when it's full?
@@ -36,41 +38,106 @@ namespace camoto {
 #define LZW_EOF_PARAM_VALID   0x08 ///< Is the EOF parameter (to c'tor) valid?
 #define LZW_RESET_PARAM_VALID 0x10 ///< Is the reset parameter (to c'tor) valid?
 #define LZW_FLUSH_ON_RESET    0x20 ///< Jump to next word boundary on reset
+#define LZW_ADAPTIVE_RESET    0x40 ///< Compressor resets when compression worsens
 
-typedef char byte;
-// The string element:
-struct CAMOTO_GAMECOMMON_API CodeString
-{
-	unsigned prefixIndex;
-
-	// First CodeString using this CodeString as prefix:
-	unsigned first;
+/// Default number of input bytes between checks of the compression ratio.
+/**
+ * Only used by filter_lzw_compress with LZW_ADAPTIVE_RESET.
+ */
+#define LZW_ADAPTIVE_WINDOW 2048
 
-	// Next CodeStrings using the same prefixIndex as this one:
-	unsigned nextLeft, nextRight;
+/// Default percentage the compression ratio must worsen by to reset.
+/**
+ * Only used by filter_lzw_compress with LZW_ADAPTIVE_RESET.
+ */
+#define LZW_ADAPTIVE_PERCENT 20
 
-	byte k;
+/// Default amount of input each thread compresses in lzw_compress_parallel().
+#define LZW_PARALLEL_BLOCK_SIZE (256 * 1024)
 
-	CodeString(byte newByte = 0, unsigned pI = ~0U);
-};
+typedef char byte;
 
+/// Dictionary of strings for the LZW decompressor.
+/**
+ * Each entry records the length of its string and the first byte, so a
+ * string can be written out backwards, straight into its final position,
+ * by following the prefix codewords.
+ *
+ * The entries are stored as separate arrays rather than an array of structs,
+ * so following a prefix chain only touches the prefix and last-byte arrays,
+ * three bytes per entry.  Codewords are at most 16 bits, so even the largest
+ * dictionary's chains stay within a typical L2 cache.
+ */
 class CAMOTO_GAMECOMMON_API Dictionary
 {
-	std::vector<CodeString> table;
-	unsigned codeStart, newCodeStringIndex;
-	std::vector<byte> decodedString;
+	/// Codeword for each string without its last byte.  Unused for the
+	/// single-byte root entries.
+	std::vector<uint16_t> prefix;
+
+	/// Last byte in each string.
+	std::vector<uint8_t> last;
+
+	/// Number of bytes in each string.
+	std::vector<uint16_t> length;
 
-	void fillDecodedString(unsigned code);
+	/// First byte in each string.
+	std::vector<uint8_t> first;
+
+	unsigned codeStart, newCodeStringIndex;
 
 public:
 	Dictionary(unsigned maxBits, unsigned codeStart);
 
-	void decode(unsigned oldCode, unsigned code,
-		std::deque<byte>& outStream);
+	/// Write out the string for a codeword and add a new dictionary entry.
+	/**
+	 * @param oldCode
+	 *   Previous codeword, which is the prefix for the new entry.
+	 *
+	 * @param code
+	 *   Codeword to decode.  If it is not yet in the dictionary, the string for
+	 *   oldCode followed by its first byte is written instead.
+	 *
+	 * @param out
+	 *   Buffer where the string is written.
+	 *
+	 * @param lenOut
+	 *   Space available in \e out.
+	 *
+	 * @param overflow
+	 *   Where any part of the string that doesn't fit in \e out is written.
+	 *   Must be at least maxLength() bytes.
+	 *
+	 * @param lenOverflow
+	 *   On return, the number of bytes written to \e overflow.
+	 *
+	 * @return Number of bytes written to \e out.
+	 *
+	 * @throw filter_error
+	 *   The data is corrupted.
+	 */
+	stream::len decode(unsigned oldCode, unsigned code, uint8_t *out,
+		stream::len lenOut, uint8_t *overflow, stream::len *lenOverflow);
 
 	unsigned size() const;
 
+	/// Longest string decode() can write.
+	unsigned maxLength() const;
+
 	void reset();
+
+	/// Write the entries added since the last reset to a stream.
+	/**
+	 * Only the prefix and last byte of each entry are saved, so a dictionary
+	 * that was recently reset takes very little space.
+	 */
+	void save(stream::output& s) const;
+
+	/// Replace the dictionary with entries written by save().
+	/**
+	 * @throw filter_error
+	 *   The saved entries are invalid for this dictionary.
+	 */
+	void load(stream::input& s);
 };
 
 /// LZW decompressor
@@ -79,6 +146,7 @@ class CAMOTO_GAMECOMMON_API filter_lzw_decompress: public filter
 	protected:
 		const unsigned int maxBits;  ///< Maximum codeword size (dictionary size limit)
 		const unsigned int flags;
+		const unsigned int firstCode; ///< The first valid codeword
 
 		/// The codeword for end-of-data.  Only used if LZW_EOF_PARAM_VALID used.
 		/// Values < 1 are from the maximum possible codeword (so -1 means the EOF
@@ -103,8 +171,11 @@ class CAMOTO_GAMECOMMON_API filter_lzw_decompress: public filter
 		/// is unchanged after a dictionary reset.)
 		unsigned int initialBits;
 
-		std::deque<char> buffer;
 		Dictionary dictionary;
+		/// Decoded bytes that didn't fit in the output buffer.
+		std::unique_ptr<uint8_t[]> overflow;
+		stream::len lenOverflow; ///< Number of valid bytes in overflow
+		stream::len posOverflow; ///< Next byte in overflow to write
 		unsigned int currentBits;     ///< Current codeword size in bits
 		//unsigned int nextBitIncLimit; ///< Last codeword value before currentBits is next incremented
 
@@ -113,6 +184,26 @@ class CAMOTO_GAMECOMMON_API filter_lzw_decompress: public filter
 		unsigned int code;     ///< Curent codeword
 		unsigned int oldCode;  ///< Previous codeword
 
+		/// Signature of transform().
+		typedef void (filter_lzw_decompress::*fn_kernel)(uint8_t *out,
+			stream::len *lenOut, const uint8_t *in, stream::len *lenIn);
+
+		/// Decoding loop specialised for the flags given to the constructor.
+		fn_kernel kernel;
+
+		/// Decoding loop, with the endian type and flags fixed at compile time.
+		/**
+		 * @tparam F
+		 *   LZW_* flags, which must match this->flags for all the flags in
+		 *   LZW_KERNEL_FLAGS.
+		 */
+		template <unsigned int F>
+		void transformKernel(uint8_t *out, stream::len *lenOut,
+			const uint8_t *in, stream::len *lenIn);
+
+		/// Pick the transformKernel() instance to suit the given flags.
+		static fn_kernel selectKernel(unsigned int flags);
+
 	public:
 		/// LZW decompressor.
 		/**
@@ -148,6 +239,63 @@ class CAMOTO_GAMECOMMON_API filter_lzw_decompress: public filter
 		virtual void reset(stream::len lenInput);
 		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
 			stream::len *lenIn);
+		virtual bool save_state(stream::output& s) const;
+		virtual void load_state(stream::input& s);
+		virtual std::string signature() const;
+
+		/// Part of the data following a dictionary reset.
+		/**
+		 * Each segment starts with an empty dictionary, so it can be decoded
+		 * without decoding anything that came before it.
+		 */
+		struct segment {
+			stream::pos offset;      ///< Offset of the first byte with codeword bits
+			unsigned int skipBits;   ///< Bits in that byte belonging to earlier codes
+			unsigned int codeBits;   ///< Codeword length at the start of the segment
+			stream::pos outOffset;   ///< Offset of the segment in the decoded data
+			stream::len lenOut;      ///< Number of bytes the segment decodes to
+		};
+
+		/// Split the data into independent segments at each dictionary reset.
+		/**
+		 * This reads through all the codewords, working out the length of the
+		 * string each one decodes to, without actually decoding anything.
+		 *
+		 * @post The filter must be reset() before it is used again.
+		 *
+		 * @param in
+		 *   The complete compressed data.
+		 *
+		 * @param lenIn
+		 *   Length of \e in.
+		 *
+		 * @return The segments in order, or an empty list if the data is
+		 *   corrupted.  The segments cover all the decoded data.
+		 */
+		std::vector<segment> findSegments(const uint8_t *in, stream::len lenIn);
+
+		/// Decode one segment found by findSegments().
+		/**
+		 * @post The filter must be reset() before it is used again.
+		 *
+		 * @param in
+		 *   The same buffer passed to findSegments().
+		 *
+		 * @param lenIn
+		 *   Length of \e in.
+		 *
+		 * @param seg
+		 *   Segment to decode.
+		 *
+		 * @param out
+		 *   Where to write the segment's data, which must have room for
+		 *   seg.lenOut bytes.
+		 *
+		 * @throw filter_error
+		 *   The data is corrupted.
+		 */
+		void decodeSegment(const uint8_t *in, stream::len lenIn,
+			const segment& seg, uint8_t *out);
 
 		void resetDictionary();
 
@@ -155,6 +303,33 @@ class CAMOTO_GAMECOMMON_API filter_lzw_decompress: public filter
 		void recalcCodes();
 };
 
+/// Decompress LZW data on several threads at once.
+/**
+ * Data using LZW_RESET_FULL_DICT or a reset codeword is split at each
+ * dictionary reset with filter_lzw_decompress::findSegments(), and the
+ * segments are decoded in parallel, straight into their place in the output.
+ * Data without any resets is decoded on a single thread as usual.
+ *
+ * The parameters are the same as for filter_lzw_decompress.
+ *
+ * @param in
+ *   The complete compressed data.
+ *
+ * @param lenIn
+ *   Length of \e in.
+ *
+ * @param pool
+ *   Threads to use, or nullptr to create a pool with one thread per core.
+ *
+ * @return The decompressed data.
+ *
+ * @throw filter_error
+ *   The data is corrupted.
+ */
+CAMOTO_GAMECOMMON_API std::string lzw_decompress_parallel(const uint8_t *in,
+	stream::len lenIn, int initialBits, int maxBits, int firstCode, int eofCode,
+	int resetCode, int flags, thread_pool *pool = nullptr);
+
 /// LZW compressor
 class CAMOTO_GAMECOMMON_API filter_lzw_compress: public filter
 {
@@ -188,18 +363,132 @@ class CAMOTO_GAMECOMMON_API filter_lzw_compress: public filter
 		/// is unchanged after a dictionary reset.)
 		int initialBits;
 
+		/// Size of the decompressor's dictionary once it has read the codewords
+		/// written so far, which is also the next codeword to be assigned.
 		unsigned int dictSize;
 		unsigned int currentBits;     ///< Current codeword size in bits
 
 		bitstream data;
+		bool isDictReset;      ///< Has the dict been reset but no codeword written?
+
+		/// One entry in the string table, mapping a prefix codeword plus the
+		/// following byte to the codeword for the combined string.
+		struct HashEntry
+		{
+			uint32_t gen;   ///< Value of hashGen when this entry was last written
+			uint32_t key;   ///< (prefix codeword << 8) | next byte
+			uint32_t code;  ///< Codeword for the combined string
+		};
+
+		/// Open-addressed string table, at most half full.
+		std::vector<HashEntry> hashTable;
+		/// Entries whose gen differs from this value are empty.  Incrementing it
+		/// clears the whole table without having to touch it.
+		uint32_t hashGen;
+		uint32_t hashMask;     ///< hashTable.size() - 1
+
+		unsigned int curCode;  ///< Codeword for the string matched so far
+		bool haveCode;         ///< Is curCode valid?
+		bool finished;         ///< Has the final codeword (and EOF) been written?
+		/// Output waiting for space in out.  This must hold the most a single
+		/// step can write: three maximum-length codewords (the last codeword, a
+		/// dictionary reset and EOF) plus a flushed byte.
+		uint8_t pending[16];
+		std::size_t pendingPos; ///< Next byte in pending to write
+		std::size_t lenPending; ///< Number of valid bytes in pending
+
+		stream::len winIn;      ///< Input bytes since the ratio was last checked
+		uint64_t winBits;       ///< Output bits since the ratio was last checked
+		/// Fewest output bits per input byte in any window since the dictionary
+		/// was reset, in 1/256ths of a bit, or ~0 if not yet measured.  This is
+		/// scaled up whenever the codeword length grows, so a longer codeword on
+		/// its own doesn't look like the data compressing worse.
+		uint64_t bestRatio;
+		stream::len lenWindow;  ///< Input bytes between checks of the ratio
+		unsigned int percentWorse; ///< How much worse the ratio can get
+
+		/// Has the compression ratio got bad enough to reset the dictionary?
+		/**
+		 * Once at least lenWindow bytes have been read since the last check, the
+		 * ratio over those bytes is compared to the best seen so far.
+		 */
+		bool ratioDropped();
+
+		/// Find the codeword for a prefix codeword followed by a byte.
+		/**
+		 * @return Codeword, or ~0U if the string is not in the dictionary.
+		 */
+		unsigned int lookup(unsigned int prefix, uint8_t next) const;
+
+		/// Add a new string to the dictionary.
+		void insert(unsigned int prefix, uint8_t next, unsigned int code);
+
+		/// Write a codeword and update the dictionary the same way the
+		/// decompressor will when it reads it.
+		/**
+		 * @param out
+		 *   Where to write the output bytes, advanced past them on return.
+		 *
+		 * @param outEnd
+		 *   One past the last byte available at \e out.
+		 *
+		 * @param code
+		 *   Codeword to write.
+		 *
+		 * @param hasNext
+		 *   true if \e next is valid, false if this is the last codeword.
+		 *
+		 * @param next
+		 *   The byte following the string represented by \e code, which is
+		 *   combined with it to create the next dictionary entry.
+		 */
+		void writeCode(uint8_t **out, uint8_t *outEnd, unsigned int code,
+			bool hasNext, uint8_t next);
+
+		/// Compress the next string, or finish off the data.
+		/**
+		 * This writes no more than fits in pending.
+		 *
+		 * @param out
+		 *   Where to write the output bytes, advanced past them on return.
+		 *
+		 * @param outEnd
+		 *   One past the last byte available at \e out.
+		 *
+		 * @param in
+		 *   Input data, as passed to transform().
+		 *
+		 * @param lenIn
+		 *   Length of \e in.
+		 *
+		 * @param r
+		 *   Offset of the next unread byte in \e in, advanced on return.
+		 *
+		 * @return false if there was nothing to do.
+		 */
+		bool step(uint8_t **out, uint8_t *outEnd, const uint8_t *in,
+			stream::len lenIn, stream::len *r);
 
 	public:
 		/// LZW compression constructor.
 		/**
-		 * This is currently just a dummy compressor.  It writes out LZW-compatible
-		 * data that can be decompressed correctly, but it doesn't actually perform
-		 * any compression - so the output data will be slightly larger than the
-		 * input (as each 8-bit byte is written out as a 9-bit byte.)
+		 * Input data is matched against a dictionary of previously seen strings
+		 * in the usual LZW manner, and the dictionary is grown, reset and has its
+		 * codeword length changed at exactly the same points as
+		 * filter_lzw_decompress does, so the output can be read back by a
+		 * decompressor created with the same parameters.
+		 *
+		 * If LZW_RESET_PARAM_VALID is given but LZW_RESET_FULL_DICT is not, the
+		 * reset codeword is written each time the dictionary fills up.
+		 *
+		 * If LZW_ADAPTIVE_RESET is given as well as LZW_RESET_PARAM_VALID, the
+		 * reset codeword is instead written whenever the number of bits written
+		 * per input byte gets noticeably worse than the best seen since the last
+		 * reset, such as when the content changes from text to graphics.  A full
+		 * dictionary is kept rather than reset (unless LZW_RESET_FULL_DICT is
+		 * also given) so it can go on being used for as long as it still works
+		 * well.  The output can be read by filter_lzw_decompress as normal, with
+		 * or without the LZW_ADAPTIVE_RESET flag.
 		 *
 		 * @param initialBits
 		 *   Length of the codeword in bits, when the decompression first starts
@@ -233,6 +522,52 @@ class CAMOTO_GAMECOMMON_API filter_lzw_compress: public filter
 		virtual void reset(stream::len lenInput);
 		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
 			stream::len *lenIn);
+		virtual stream::len measure(const uint8_t *in, stream::len *lenIn);
+
+		/// Change when LZW_ADAPTIVE_RESET decides to reset the dictionary.
+		/**
+		 * @param lenWindow
+		 *   Number of input bytes to measure the compression ratio over.  Smaller
+		 *   windows react sooner to a change in content, but are more easily
+		 *   fooled by a short run of data that doesn't compress well.  Defaults
+		 *   to LZW_ADAPTIVE_WINDOW.
+		 *
+		 * @param percent
+		 *   How much worse the ratio over a window must be than the best window
+		 *   since the last reset, before the dictionary is reset again.  Defaults
+		 *   to LZW_ADAPTIVE_PERCENT.
+		 */
+		void setAdaptiveReset(stream::len lenWindow, unsigned int percent);
+
+		/// Compress one block of a larger input by itself.
+		/**
+		 * The block is compressed from an empty dictionary.  Unless it is the last
+		 * block, it ends with a reset codeword instead of EOF, which puts the
+		 * decompressor back into its starting state for the next block.
+		 *
+		 * @pre Unless \e last is true, LZW_RESET_PARAM_VALID must be in use and
+		 *   LZW_NO_BITSIZE_RESET must not.
+		 *
+		 * @post The filter must be reset() before it is used again.
+		 *
+		 * @param in
+		 *   Data to compress.
+		 *
+		 * @param lenIn
+		 *   Length of \e in.
+		 *
+		 * @param last
+		 *   true if this is the end of the data.
+		 *
+		 * @param out
+		 *   On return, the compressed block.  The last byte may be padded out
+		 *   with unused bits.
+		 *
+		 * @return Number of bits in \e out, not counting the padding, ready to be
+		 *   passed to bitstream::append().
+		 */
+		uint64_t compressBlock(const uint8_t *in, stream::len lenIn, bool last,
+			std::vector<uint8_t> *out);
 
 		void resetDictionary();
 
@@ -240,6 +575,41 @@ class CAMOTO_GAMECOMMON_API filter_lzw_compress: public filter
 		void recalcCodes();
 };
 
+/// Compress LZW data on several threads at once.
+/**
+ * The input is split into blocks which are compressed in parallel, each from
+ * an empty dictionary, with a reset codeword between them.  The blocks are
+ * then joined together bit for bit, so the result can be read by an ordinary
+ * filter_lzw_decompress with the same parameters (and by
+ * lzw_decompress_parallel(), which will split it at the same places.)
+ *
+ * This needs LZW_RESET_PARAM_VALID, without LZW_NO_BITSIZE_RESET.  Without
+ * them there is no way to tell the decompressor where a new block starts, so
+ * the data is compressed on a single thread exactly as filter_lzw_compress
+ * would.
+ *
+ * The parameters are the same as for filter_lzw_compress.
+ *
+ * @param in
+ *   Data to compress.
+ *
+ * @param lenIn
+ *   Length of \e in.
+ *
+ * @param pool
+ *   Threads to use, or nullptr to create a pool with one thread per core.
+ *
+ * @param lenBlock
+ *   Amount of input in each block.  The dictionary is reset this often, so
+ *   very small blocks will hurt compression.
+ *
+ * @return The compressed data.
+ */
+CAMOTO_GAMECOMMON_API std::string lzw_compress_parallel(const uint8_t *in,
+	stream::len lenIn, int initialBits, int maxBits, int firstCode, int eofCode,
+	int resetCode, int flags, thread_pool *pool = nullptr,
+	stream::len lenBlock = LZW_PARALLEL_BLOCK_SIZE);
+
 } // namespace camoto
 
 #endif // _CAMOTO_FILTER_LZW_HPP_
@@ -35,6 +35,7 @@ class CAMOTO_GAMECOMMON_API filter_pad: public filter
 		virtual void reset(stream::len lenInput);
 		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
 			stream::len *lenIn);
+		virtual stream::len measure(const uint8_t *in, stream::len *lenIn);
 
 		/// Data to insert at start of output upon flush()
 		stream::string pad;
@@ -0,0 +1,144 @@
+/**
+ * @file  camoto/filter-pool.hpp
+ * @brief Cache of filter instances, to avoid reallocating them for each stream.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_FILTER_POOL_HPP_
+#define _CAMOTO_FILTER_POOL_HPP_
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+#include <camoto/filter.hpp>
+
+namespace camoto {
+
+/// Hands out previously used filters instead of constructing new ones.
+/**
+ * Some filters allocate large tables when they are constructed (such as the
+ * LZW dictionary or the LZSS window), which can cost more than decoding a
+ * small file.  This pool keeps filters once they are no longer in use, and
+ * hands them out again to anyone asking for one with the same constructor
+ * parameters.
+ *
+ * @code
+ * filter_pool<filter_lzss_decompress, bitstream::endian, unsigned int,
+ *   unsigned int> pool;
+ * auto algo = pool.get(bitstream::littleEndian, 4, 12);
+ * stream::input_filtered s(parent, algo);
+ * @endcode
+ *
+ * A filter goes back into the pool when the last shared_ptr to it is
+ * released.  Only reset() is called on a reused filter, which is what
+ * stream::filtered does before using a filter anyway.
+ *
+ * @tparam T
+ *   Filter class to create.
+ *
+ * @tparam Args
+ *   Types of the parameters passed to the constructor of T.  Instances are
+ *   only shared between callers passing the same values, so these must be
+ *   copyable and comparable with operator<.
+ *
+ * The pool may be used from multiple threads at once.  It may also be
+ * destroyed while filters are still in use, in which case they are deleted
+ * normally once released.
+ */
+template <class T, typename... Args>
+class filter_pool
+{
+	public:
+		/// Create an empty pool.
+		/**
+		 * @param maxIdle
+		 *   Maximum number of unused filters to keep for each set of parameters.
+		 *   Filters released after this many are already waiting are deleted.
+		 */
+		filter_pool(std::size_t maxIdle = 16)
+			:	store(std::make_shared<idle_store>())
+		{
+			this->store->maxIdle = maxIdle;
+		}
+
+		/// Get a filter, reusing a previous one if possible.
+		/**
+		 * @param args
+		 *   Parameters to pass to the constructor of T, if a new instance is
+		 *   needed.
+		 *
+		 * @return Filter ready for reset() to be called.
+		 */
+		std::shared_ptr<T> get(Args... args)
+		{
+			key k(args...);
+			T *f = nullptr;
+			{
+				std::lock_guard<std::mutex> guard(this->store->lock);
+				auto i = this->store->idle.find(k);
+				if ((i != this->store->idle.end()) && !i->second.empty()) {
+					f = i->second.back().release();
+					i->second.pop_back();
+				}
+			}
+			if (!f) f = new T(args...);
+
+			std::weak_ptr<idle_store> owner = this->store;
+			return std::shared_ptr<T>(f, [owner, k](T *p) {
+				std::unique_ptr<T> inst(p);
+				auto s = owner.lock();
+				if (!s) return; // pool has gone, just delete it
+				std::lock_guard<std::mutex> guard(s->lock);
+				auto& list = s->idle[k];
+				if (list.size() < s->maxIdle) list.push_back(std::move(inst));
+			});
+		}
+
+		/// Number of unused filters waiting to be handed out.
+		std::size_t idle() const
+		{
+			std::lock_guard<std::mutex> guard(this->store->lock);
+			std::size_t n = 0;
+			for (auto& i : this->store->idle) n += i.second.size();
+			return n;
+		}
+
+		/// Delete all the unused filters.
+		void clear()
+		{
+			std::lock_guard<std::mutex> guard(this->store->lock);
+			this->store->idle.clear();
+			return;
+		}
+
+	protected:
+		typedef std::tuple<Args...> key;
+
+		/// Unused filters, shared with the deleters of the filters in use.
+		struct idle_store {
+			std::mutex lock;
+			std::size_t maxIdle;
+			std::map<key, std::vector<std::unique_ptr<T>>> idle;
+		};
+		std::shared_ptr<idle_store> store;
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_FILTER_POOL_HPP_
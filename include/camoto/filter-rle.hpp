@@ -0,0 +1,131 @@
+/**
+ * @file  camoto/filter-rle.hpp
+ * @brief Filters for the common byte-level run-length encoding schemes.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_FILTER_RLE_HPP_
+#define _CAMOTO_FILTER_RLE_HPP_
+
+#include <camoto/config.hpp>
+#include <camoto/filter.hpp>
+
+namespace camoto {
+
+/// How runs and literal bytes are told apart in RLE data.
+enum class rle_scheme {
+	/// A run is the escape byte, a count from 1 to 255, then the byte to repeat.
+	/**
+	 * Every other byte is a literal.  An escape byte in the data itself is
+	 * stored as a run of length one.  The filter's \e code parameter is the
+	 * escape byte.
+	 */
+	Escape,
+
+	/// A byte with all the flag bits set holds a count, and is followed by the
+	/// byte to repeat.
+	/**
+	 * The count is in the remaining low bits, so with flag bits of 0xC0 (as in
+	 * PCX images) runs are up to 63 bytes long.  Every other byte is a literal,
+	 * and a byte with the flag bits set in the data itself is stored as a run
+	 * of length one.  The filter's \e code parameter is the flag bits, which
+	 * must be the top bits of the byte.
+	 */
+	CountBits,
+
+	/// Apple PackBits, as used in TIFF and IFF ILBM images.
+	/**
+	 * A signed byte n from 0 to 127 is followed by n + 1 literal bytes, from
+	 * -1 to -127 it is followed by a byte to repeat 1 - n times, and -128 is
+	 * ignored.  The filter's \e code parameter is not used.
+	 */
+	PackBits,
+};
+
+/// Expand run-length encoded data.
+class CAMOTO_GAMECOMMON_API filter_rle_decompress: public filter
+{
+	public:
+		/// RLE decompressor.
+		/**
+		 * @param scheme
+		 *   Format of the compressed data.
+		 *
+		 * @param code
+		 *   Escape byte or flag bits, depending on \e scheme.
+		 */
+		filter_rle_decompress(rle_scheme scheme, uint8_t code = 0);
+
+		virtual void reset(stream::len lenInput);
+		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
+			stream::len *lenIn);
+		virtual bool save_state(stream::output& s) const;
+		virtual void load_state(stream::input& s);
+		virtual std::string signature() const;
+
+	protected:
+		rle_scheme scheme;   ///< Format of the compressed data
+		uint8_t code;        ///< Escape byte or flag bits
+		unsigned int runLeft; ///< Bytes of the current run still to write
+		uint8_t runValue;    ///< Byte being repeated by the current run
+		unsigned int litLeft; ///< Literal bytes still to copy (PackBits only)
+};
+
+/// Compress data with run-length encoding.
+/**
+ * Runs are only encoded where they make the output smaller, apart from bytes
+ * that can't be stored as literals in the chosen scheme.  A run that crosses
+ * the end of the input buffer given to transform() may be split in two.
+ */
+class CAMOTO_GAMECOMMON_API filter_rle_compress: public filter
+{
+	public:
+		/// RLE compressor.
+		/**
+		 * @param scheme
+		 *   Format of the compressed data.
+		 *
+		 * @param code
+		 *   Escape byte or flag bits, depending on \e scheme.
+		 */
+		filter_rle_compress(rle_scheme scheme, uint8_t code = 0);
+
+		virtual void reset(stream::len lenInput);
+		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
+			stream::len *lenIn);
+
+	protected:
+		rle_scheme scheme;    ///< Format of the compressed data
+		uint8_t code;         ///< Escape byte or flag bits
+		unsigned int maxRun;  ///< Longest run one code can hold
+		unsigned int minRun;  ///< Shortest run that is smaller encoded than not
+
+		/// Does this byte have to be written as a run?
+		bool isSpecial(uint8_t b) const;
+
+		/// Number of bytes at the start of \e p to write as literals.
+		/**
+		 * This stops before the first special byte, or the first run that is
+		 * worth encoding.
+		 */
+		std::size_t literalSpan(const uint8_t *p, std::size_t len,
+			std::size_t lenAvail) const;
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_FILTER_RLE_HPP_
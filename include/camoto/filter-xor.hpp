@@ -0,0 +1,100 @@
+/**
+ * @file  camoto/filter-xor.hpp
+ * @brief Filter that XORs data with a repeating key or a generated keystream.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_FILTER_XOR_HPP_
+#define _CAMOTO_FILTER_XOR_HPP_
+
+#include <vector>
+#include <camoto/config.hpp>
+#include <camoto/filter.hpp>
+
+namespace camoto {
+
+/// XOR data with a keystream.
+/**
+ * XOR is its own inverse, so the same filter both encrypts and decrypts.
+ * The position in the keystream carries on from one call to transform() to
+ * the next, and goes back to the start on reset().
+ *
+ * The keystream is generated (or for a repeating key, laid out) a block at a
+ * time and then XORed with the data 16 bytes at a time.
+ */
+class CAMOTO_GAMECOMMON_API filter_xor: public filter
+{
+	public:
+		/// Parameters for a keystream from a Galois linear feedback shift register.
+		/**
+		 * Each key byte is the low eight bits of the register, after which the
+		 * register is shifted right eight times.  On each shift, if the bit
+		 * shifted out was set, the register is XORed with \e taps.
+		 */
+		struct lfsr {
+			uint32_t seed;  ///< Initial value of the register
+			uint32_t taps;  ///< Feedback mask
+		};
+
+		/// XOR with a key that repeats.
+		/**
+		 * @param key
+		 *   Key bytes.  The first byte of data is XORed with key[0], and after
+		 *   the last key byte the key starts again.  Must not be empty.
+		 */
+		filter_xor(const std::vector<uint8_t>& key);
+
+		/// XOR with a key byte that changes by the same amount each time.
+		/**
+		 * @param seed
+		 *   Key for the first byte.
+		 *
+		 * @param step
+		 *   Amount added to the key after each byte, wrapping around at 256.
+		 */
+		filter_xor(uint8_t seed, uint8_t step);
+
+		/// XOR with the output of a linear feedback shift register.
+		filter_xor(lfsr keystream);
+
+		virtual void reset(stream::len lenInput);
+		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
+			stream::len *lenIn);
+
+	protected:
+		/// Repeating key, followed by enough of it again that a block starting
+		/// anywhere in the first period can be read straight through.
+		/**
+		 * When using an LFSR, this is where each block of keystream is put.
+		 */
+		std::vector<uint8_t> key;
+
+		std::size_t period;  ///< Length of repeating key, or 0 for an LFSR
+		std::size_t pos;     ///< Offset into the repeating key of the next byte
+		lfsr reg;            ///< LFSR parameters
+		uint32_t state;      ///< Current LFSR value
+
+		/// Effect of shifting each possible low byte out of the LFSR.
+		uint32_t lfsrTable[256];
+
+		/// Lay out the repeating key once its first period is in this->key.
+		void extendKey();
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_FILTER_XOR_HPP_
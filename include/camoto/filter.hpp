@@ -66,6 +66,10 @@ class CAMOTO_GAMECOMMON_API filter
 		 *   Length of the input data stream.  This value is often used when
 		 *   compressing data, and the length of the decompressed data must be
 		 *   written at the start of the output (compressed) stream.
+		 *
+		 * @note Any memory the filter needs should be allocated by the
+		 *   constructor and reused here, so that a filter_pool can hand the
+		 *   same instance out again without any allocations.
 		 */
 		virtual void reset(stream::len lenInput) = 0;
 
@@ -114,6 +118,112 @@ class CAMOTO_GAMECOMMON_API filter
 		 */
 		virtual void transform(uint8_t *out, stream::len *lenOut, const uint8_t *in,
 			stream::len *lenIn) = 0;
+
+		/// Work out how much output transform() would produce, without storing it.
+		/**
+		 * This behaves exactly like transform(), advancing the filter's state in
+		 * the same way, except that the output is only counted.  It allows the
+		 * filtered size of some data to be found (e.g. so an archive can decide
+		 * where a compressed file will go) without buffering the output.
+		 *
+		 * The default implementation runs transform() into a small scratch
+		 * buffer.  Filters where it's cheaper to count the output than to write
+		 * it can override this.
+		 *
+		 * @param in
+		 *   Data to process, as for transform().
+		 *
+		 * @param lenIn
+		 *   Initially, the size of \e in.  On return, this is set to the number
+		 *   of input bytes that were read.  Any unread bytes must be passed in
+		 *   again on the next call, as for transform().
+		 *
+		 * @return Number of bytes transform() would have written.  The end of
+		 *   the data is signalled by returning zero with \e lenIn set to zero.
+		 *
+		 * @throw filter_error
+		 *   The data was corrupted and could not be filtered.
+		 */
+		virtual stream::len measure(const uint8_t *in, stream::len *lenIn);
+
+		/// Hand any input the filter would ignore back to the caller to skip.
+		/**
+		 * Some filters throw away a fixed number of bytes at the start of their
+		 * input without looking at them.  This is called after reset() and
+		 * before the first call to transform(), and if the filter returns a
+		 * non-zero value, the caller must skip over that many bytes itself
+		 * (usually by seeking the underlying stream) and only pass in the data
+		 * that follows.  The filter then behaves as though it had already
+		 * consumed those bytes.
+		 *
+		 * Callers don't have to use this, as long as they never call it.  If it
+		 * isn't called, the filter will skip the data itself in transform().
+		 *
+		 * @return Number of bytes to skip.  The default implementation returns
+		 *   zero.
+		 */
+		virtual stream::len skip_leading_input();
+
+		/// Promise that all output is going into one block of memory.
+		/**
+		 * This is called after reset() and before the first call to transform(),
+		 * by callers that collect all the output in one contiguous buffer, and
+		 * pass each call to transform() a pointer just past the output from the
+		 * call before.  The buffer can be moved between calls (e.g. when a
+		 * std::string grows), as long as the earlier output moves with it.
+		 *
+		 * Filters that refer back to earlier output, like most decompressors, can
+		 * then read it from the buffer instead of keeping their own copy.  This
+		 * lasts until the next reset().
+		 *
+		 * Callers don't have to use this, and filters don't have to take any
+		 * notice of it.  The default implementation does nothing.
+		 */
+		virtual void use_contiguous_output();
+
+		/// Save the filter's internal state, so it can be resumed from here.
+		/**
+		 * This is called between calls to transform(), and allows a stream to
+		 * later continue filtering from the same place, instead of starting again
+		 * from the beginning of the data.  The state must include everything the
+		 * filter needs to carry on from the next unread input byte, such as any
+		 * output it is still holding back.
+		 *
+		 * Filters don't have to support this.
+		 *
+		 * @param s
+		 *   Stream to write the state to.
+		 *
+		 * @return true if the state was saved, false if this filter can't save
+		 *   its state.
+		 */
+		virtual bool save_state(stream::output& s) const;
+
+		/// Restore a state saved by save_state().
+		/**
+		 * This is called after reset(), with the filter constructed with the
+		 * same parameters as the one that saved the state.
+		 *
+		 * @param s
+		 *   Stream to read the state from.
+		 *
+		 * @throw filter_error
+		 *   The filter can't load states, or the state is invalid.
+		 */
+		virtual void load_state(stream::input& s);
+
+		/// Describe the filter and its parameters, for decode_cache.
+		/**
+		 * Two filters with the same signature must always produce the same
+		 * output from the same input, so that data decoded by one can be handed
+		 * out in place of running the other.  The usual form is the class name
+		 * followed by its constructor parameters.
+		 *
+		 * @return The signature, or an empty string if the filter's output
+		 *   shouldn't be shared.  The default implementation returns an empty
+		 *   string.
+		 */
+		virtual std::string signature() const;
 };
 
 } // namespace camoto
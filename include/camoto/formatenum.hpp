@@ -21,12 +21,117 @@
 #ifndef _CAMOTO_FORMATENUM_HPP_
 #define _CAMOTO_FORMATENUM_HPP_
 
+#include <algorithm>
+#include <cctype>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
+#include <camoto/config.hpp>
+#include <camoto/stream.hpp>
+#include <camoto/thread_pool.hpp>
 
 namespace camoto {
 
+/// Default amount of data read from the start of a file for probing, in bytes.
+#define PROBE_HEADER_SIZE 16384
+
+namespace stream {
+
+/// Read-only stream over another, with the start of the data held in memory.
+/**
+ * This is what format handlers are given to examine during
+ * FormatEnumerator::probe().  The first part of the file is read once and
+ * shared between every handler, so reads from there cost a memcpy().  Reads
+ * beyond it are passed through to the parent with try_read_at(), so any number
+ * of these streams can be read from different threads at the same time.
+ */
+class CAMOTO_GAMECOMMON_API input_probe: virtual public input
+{
+	public:
+		/// Read from a parent stream, with some of its data already in memory.
+		/**
+		 * @param parent
+		 *   Stream holding all the data.
+		 *
+		 * @param header
+		 *   Copy of the parent's data from offset 0 onwards.  It does not have to
+		 *   cover the whole parent.
+		 *
+		 * @param lenParent
+		 *   Size of the parent stream.
+		 */
+		input_probe(std::shared_ptr<input> parent,
+			std::shared_ptr<const std::string> header, stream::len lenParent);
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+		virtual const uint8_t *view(stream::pos pos, stream::len len,
+			stream::len *got, std::string& scratch);
+		virtual bool cheap_view() const;
+
+	protected:
+		std::shared_ptr<input> in_parent;          ///< Stream holding all the data
+		std::shared_ptr<const std::string> header; ///< Start of the parent's data
+		stream::len lenParent;                     ///< Size of the parent
+		stream::pos offset;                        ///< Current read position
+};
+
+} // namespace stream
+
+/// Bytes always found at a fixed place in files of one format.
+struct format_signature {
+	stream::pos offset; ///< Where the bytes appear, from the start of the file
+	std::string bytes;  ///< The bytes themselves
+};
+
+/// Signatures declared by a format handler, for FormatEnumerator::probe().
+/**
+ * By default a handler has no signatures, so it is always probed.  Libraries
+ * can specialise this for their handler type, returning the bytes each format
+ * is guaranteed to have.  A handler that declares any signatures is then only
+ * probed if one of them matches, or if the file has one of its extensions.
+ *
+ * @code
+ * template <>
+ * struct format_signatures<ArchiveType> {
+ *   static std::vector<format_signature> get(const ArchiveType& handler)
+ *   {
+ *     return handler.signatures();
+ *   }
+ * };
+ * @endcode
+ */
+template <class T>
+struct format_signatures {
+	static std::vector<format_signature> get(const T& handler)
+	{
+		return {};
+	}
+};
+
+/// Settings for FormatEnumerator::probe().
+struct probe_options {
+	/// How much of the start of the file to read into memory and share
+	/// between all the handlers.  Handlers can still read past this, it is just
+	/// slower.
+	stream::len lenHeader = PROBE_HEADER_SIZE;
+
+	/// Threads to run the probes on, or nullptr to run them one after the other
+	/// in the calling thread.  All the pool's tasks are waited for, so the pool
+	/// should not be shared with unrelated work.
+	thread_pool *pool = nullptr;
+
+	/// Probe every handler, ignoring signatures.  This is slower but finds
+	/// files whose signatures have been damaged or declared incorrectly.
+	bool all = false;
+};
+
 template <class T>
 class FormatEnumerator {
 	public:
@@ -38,16 +143,136 @@ class FormatEnumerator {
 		typedef typename std::shared_ptr<const T> handler_t;
 		typedef typename std::vector<handler_t> handler_list_t;
 
+		/// Value returned by the handler's isInstance() function.
+		/**
+		 * This is an enum ordered from least to most certain, where the lowest
+		 * value (zero) means the data is definitely not in the handler's format.
+		 */
+		typedef decltype(std::declval<const T&>().isInstance(
+			std::declval<stream::input&>())) certainty_t;
+
+		/// One handler that recognised the data, as returned by probe().
+		struct probe_result {
+			handler_t handler;     ///< Handler for the format
+			certainty_t certainty; ///< How sure the handler is
+			bool signature;        ///< Did one of the format's signatures match?
+			bool extension;        ///< Does the filename have the format's extension?
+		};
+
 		static const handler_list_t formats();
 
 		static std::shared_ptr<const T> byCode(const std::string& code)
 		{
-			for (const auto& i : FormatEnumerator<T>::formats()) {
-				if (code.compare(i->code()) == 0) return i;
-			}
-			return nullptr;
+			// Built the first time it's needed, as formats() creates new handlers
+			// each time it is called.
+			static const std::unordered_map<std::string, handler_t> index =
+				FormatEnumerator<T>::codeIndex();
+			auto it = index.find(code);
+			if (it == index.end()) return nullptr;
+			return it->second;
 		};
 
+		/// Work out which formats some data could be in.
+		/**
+		 * The start of the data is read into memory once and shared between all
+		 * the handlers.  Handlers that declare format_signatures are skipped
+		 * unless a signature matches or \e filename has one of their extensions,
+		 * and the rest have their isInstance() called, optionally in parallel.
+		 *
+		 * @param content
+		 *   Data to identify.  It must not be written to until this returns.
+		 *
+		 * @param filename
+		 *   Name of the file, used to match file extensions.  May be empty.
+		 *
+		 * @param opt
+		 *   Settings controlling the probe.
+		 *
+		 * @return Every handler that didn't rule the data out, most certain first.
+		 *   Ties are broken by signature matches, then extension matches, then
+		 *   the order of formats().
+		 *
+		 * @throw stream::error
+		 *   The data could not be read.  The first exception thrown by any
+		 *   handler is also passed on, once all the probes have finished.
+		 */
+		static std::vector<probe_result> probe(
+			std::shared_ptr<stream::input> content, const std::string& filename,
+			const probe_options& opt = probe_options())
+		{
+			// Handlers and their signatures never change, so only list them once
+			static const handler_list_t handlers = FormatEnumerator<T>::formats();
+			static const std::vector<std::vector<format_signature>> sigs =
+				FormatEnumerator<T>::signatureList(handlers);
+
+			stream::len lenContent = content->size();
+			std::string hdr(std::min(lenContent, opt.lenHeader), '\0');
+			if (!hdr.empty()) {
+				stream::len got = content->try_read_at(0, (uint8_t *)&hdr[0],
+					hdr.length());
+				hdr.resize(got);
+			}
+			auto header = std::make_shared<const std::string>(std::move(hdr));
+
+			std::string ext = FormatEnumerator<T>::extensionOf(filename);
+
+			// Pick out the handlers worth probing
+			std::vector<probe_result> candidates;
+			for (std::size_t i = 0; i < handlers.size(); i++) {
+				bool sigMatch = false;
+				for (const auto& s : sigs[i]) {
+					if (FormatEnumerator<T>::matches(s, *content, *header, lenContent)) {
+						sigMatch = true;
+						break;
+					}
+				}
+				bool extMatch = false;
+				if (!ext.empty()) {
+					for (const auto& e : handlers[i]->fileExtensions()) {
+						if (FormatEnumerator<T>::lower(e) == ext) {
+							extMatch = true;
+							break;
+						}
+					}
+				}
+				if (opt.all || sigs[i].empty() || sigMatch || extMatch) {
+					candidates.push_back(
+						probe_result{handlers[i], certainty_t(), sigMatch, extMatch});
+				}
+			}
+
+			auto run = [&content, &header, lenContent](probe_result *r) {
+				stream::input_probe s(content, header, lenContent);
+				r->certainty = r->handler->isInstance(s);
+			};
+			if (opt.pool && (candidates.size() > 1)) {
+				for (auto& c : candidates) {
+					probe_result *r = &c;
+					opt.pool->submit([&run, r](unsigned int) {
+						run(r);
+					});
+				}
+				opt.pool->wait();
+			} else {
+				for (auto& c : candidates) run(&c);
+			}
+
+			// Drop the handlers that ruled the data out, and rank the rest
+			candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+				[](const probe_result& r) {
+					return static_cast<int>(r.certainty) == 0;
+				}), candidates.end());
+			std::stable_sort(candidates.begin(), candidates.end(),
+				[](const probe_result& a, const probe_result& b) {
+					if (a.certainty != b.certainty) {
+						return static_cast<int>(a.certainty) > static_cast<int>(b.certainty);
+					}
+					if (a.signature != b.signature) return a.signature;
+					return a.extension && !b.extension;
+				});
+			return candidates;
+		}
+
 		template <class A>
 		static void addFormat(handler_list_t& list)
 		{
@@ -62,6 +287,64 @@ class FormatEnumerator {
 			FormatEnumerator<T>::addFormat<B, Args...>(list);
 			return;
 		}
+
+	protected:
+		/// Map each handler's code to the handler, for byCode().
+		static std::unordered_map<std::string, handler_t> codeIndex()
+		{
+			std::unordered_map<std::string, handler_t> index;
+			// emplace() won't replace an existing code, so the first one wins as
+			// it did with a linear search
+			for (const auto& i : FormatEnumerator<T>::formats()) {
+				index.emplace(i->code(), i);
+			}
+			return index;
+		}
+
+		/// Get the declared signatures for each handler.
+		static std::vector<std::vector<format_signature>> signatureList(
+			const handler_list_t& handlers)
+		{
+			std::vector<std::vector<format_signature>> list;
+			list.reserve(handlers.size());
+			for (const auto& i : handlers) {
+				list.push_back(format_signatures<T>::get(*i));
+			}
+			return list;
+		}
+
+		/// Does the data contain the signature?
+		static bool matches(const format_signature& sig, stream::input& content,
+			const std::string& header, stream::len lenContent)
+		{
+			if (sig.offset + sig.bytes.length() > lenContent) return false;
+			if (sig.offset + sig.bytes.length() <= header.length()) {
+				return header.compare(sig.offset, sig.bytes.length(), sig.bytes) == 0;
+			}
+			// Signature is past the data in memory, so read it from the stream
+			std::string buf(sig.bytes.length(), '\0');
+			if (buf.empty()) return true;
+			stream::len got = content.try_read_at(sig.offset, (uint8_t *)&buf[0],
+				buf.length());
+			return (got == buf.length()) && (buf == sig.bytes);
+		}
+
+		/// Get the lowercase extension of a filename, without the dot.
+		static std::string extensionOf(const std::string& filename)
+		{
+			std::string::size_type dot = filename.find_last_of('.');
+			if (dot == std::string::npos) return std::string();
+			// Ignore dots in directory names
+			std::string::size_type slash = filename.find_last_of("/\\");
+			if ((slash != std::string::npos) && (slash > dot)) return std::string();
+			return FormatEnumerator<T>::lower(filename.substr(dot + 1));
+		}
+
+		static std::string lower(std::string s)
+		{
+			for (auto& c : s) c = std::tolower((unsigned char)c);
+			return s;
+		}
 };
 
 } // namespace camoto
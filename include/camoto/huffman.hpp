@@ -0,0 +1,156 @@
+/**
+ * @file  camoto/huffman.hpp
+ * @brief Table-driven canonical Huffman decoder.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_HUFFMAN_HPP_
+#define _CAMOTO_HUFFMAN_HPP_
+
+#include <cstddef>
+#include <vector>
+#include <camoto/config.hpp>
+#include <camoto/bitstream.hpp>
+
+/// Default number of bits looked up in the first level of a huffman_decoder.
+#define HUFFMAN_ROOT_BITS 9
+
+/// Longest code a huffman_decoder will accept.
+#define HUFFMAN_MAX_BITS 24
+
+namespace camoto {
+
+/// Decode canonical Huffman codes from a memory buffer with lookup tables.
+/**
+ * Codes are assigned from a list of code lengths in the usual canonical way:
+ * shorter codes come first, and codes of the same length are given to symbols
+ * in increasing order.  The first bit of each code is the first bit read from
+ * the bitstream, so for a big-endian bitstream the code appears MSB-first, and
+ * for a little-endian one (as in Deflate) the first bit of the code is the
+ * LSB of the first byte.
+ *
+ * Rather than walking a tree one bit at a time, the decoder peeks at enough
+ * bits for the longest code and looks them up in a table.  Codes no longer
+ * than the root table's index are found in a single lookup, and longer codes
+ * use a second table belonging to their first few bits, so the tables stay
+ * small even when a few codes are very long.
+ *
+ * The decoder itself is never changed after it has been built, so it can be
+ * shared between threads, each with its own bitstream.
+ */
+class CAMOTO_GAMECOMMON_API huffman_decoder
+{
+	public:
+		/// Build the lookup tables for a set of code lengths.
+		/**
+		 * @param lengths
+		 *   Code length in bits for each symbol, with zero meaning the symbol is
+		 *   not used.  lengths[0] is for symbol 0, and so on.
+		 *
+		 * @param count
+		 *   Number of entries in \e lengths.
+		 *
+		 * @param endianType
+		 *   Endian of the bitstreams the codes will be read from.
+		 *
+		 * @param rootBits
+		 *   Number of bits in the first-level table.  Larger values use more
+		 *   memory but send fewer codes to the second level.
+		 *
+		 * @throw filter_error
+		 *   The lengths are longer than HUFFMAN_MAX_BITS or describe more codes
+		 *   than can exist.  A set of lengths with unused codes is accepted, but
+		 *   decoding one of the unused codes throws an exception.
+		 */
+		huffman_decoder(const uint8_t *lengths, unsigned int count,
+			bitstream::endian endianType, unsigned int rootBits = HUFFMAN_ROOT_BITS);
+
+		/// Decode one symbol.
+		/**
+		 * @param bit
+		 *   Bitstream holding any leftover bits from the previous byte.  It must
+		 *   have the same endian type the decoder was built for.
+		 *
+		 * @param in
+		 *   Pointer to the next byte to read.  On return, this has been advanced
+		 *   past the bytes consumed.
+		 *
+		 * @param inEnd
+		 *   One past the last byte available in the buffer.
+		 *
+		 * @return The decoded symbol, or -1 if the buffer ends before the next
+		 *   code does.  Nothing is consumed in the latter case, so the call can
+		 *   be repeated once more data is available.
+		 *
+		 * @throw filter_error
+		 *   The next code is not one of the codes in use.
+		 */
+		int decode(bitstream& bit, const uint8_t **in, const uint8_t *inEnd) const;
+
+		/// Decode a run of symbols.
+		/**
+		 * This is the same as calling decode() repeatedly, but the endian type is
+		 * only checked once and the lookups are expanded inline.
+		 *
+		 * @param out
+		 *   Where to store the decoded symbols.
+		 *
+		 * @param count
+		 *   Maximum number of symbols to decode.
+		 *
+		 * @return The number of symbols decoded, which will be less than
+		 *   \e count if the end of the buffer was reached.
+		 */
+		std::size_t decode_n(bitstream& bit, const uint8_t **in,
+			const uint8_t *inEnd, unsigned int *out, std::size_t count) const;
+
+		/// Length of the longest code, in bits.
+		unsigned int max_length() const;
+
+	private:
+		/// One slot in a lookup table.
+		struct entry {
+			uint32_t value;  ///< Symbol, or offset of the second-level table
+			uint8_t bits;    ///< Code length, or index bits of the second-level table
+			uint8_t kind;    ///< One of the KIND_* values
+		};
+
+		static const uint8_t KIND_INVALID = 0;  ///< Code is not in use
+		static const uint8_t KIND_SYMBOL = 1;   ///< Code is complete
+		static const uint8_t KIND_TABLE = 2;    ///< Look up more bits in a subtable
+
+		/// All the tables, the root table first followed by the subtables.
+		std::vector<entry> table;
+
+		/// Number of bits indexing the root table.
+		unsigned int rootBits;
+
+		/// Longest code length.
+		unsigned int maxLen;
+
+		/// Endian type the tables were built for.
+		bitstream::endian endianType;
+
+		/// Decode one symbol with the endian type fixed at compile time.
+		template <bitstream::endian E>
+		int decodeOne(bitstream& bit, const uint8_t **in, const uint8_t *inEnd)
+			const;
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_HUFFMAN_HPP_
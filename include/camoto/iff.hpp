@@ -21,17 +21,146 @@
 #ifndef _CAMOTO_IFF_HPP_
 #define _CAMOTO_IFF_HPP_
 
+#include <functional>
 #include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <camoto/config.hpp>
 #include <camoto/stream.hpp>
+#include <camoto/stream_string.hpp>
 
 namespace camoto {
 
+/// Four-character code packed into an integer, first character in the high byte.
+/**
+ * This is a distinct type rather than a plain integer, so it can't be mixed up
+ * with a chunk index.  Values are normally made with the _cc literal, and can
+ * be used as switch labels and template parameters.
+ *
+ * @code
+ * switch (name.id()) {
+ *   case "RIFF"_cc: ...
+ *   case "LIST"_cc: ...
+ * }
+ * @endcode
+ */
+enum class fourcc_t: uint32_t {};
+
+/// Pack up to \e n characters of a string, padding to four with nulls.
+/**
+ * Packing stops at the first null, so it can be used on null-terminated
+ * strings by passing \e n as 4.
+ */
+constexpr uint32_t fourcc_pack(const char *s, std::size_t n, unsigned int i = 0)
+{
+	return (i == 4) ? 0 :
+		(((uint32_t)((i < n) ? (uint8_t)s[0] : 0) << (8 * (3 - i)))
+		| fourcc_pack(((i < n) && s[0]) ? s + 1 : s,
+			((i < n) && s[0]) ? n : 0, i + 1));
+}
+
+/// Make a fourcc_t at compile time, e.g. "RIFF"_cc.
+constexpr fourcc_t operator"" _cc(const char *s, std::size_t len)
+{
+	return (fourcc_t)fourcc_pack(s, len);
+}
+
 class CAMOTO_GAMECOMMON_API IFF
 {
 	public:
-		typedef std::string fourcc;
+		/// Four-character code identifying a chunk.
+		/**
+		 * The four characters are packed into a 32-bit integer, first character
+		 * in the most significant byte, so comparing and hashing them is cheap.
+		 * Conversions to and from strings are provided so that names can still
+		 * be given as string literals, and from fourcc_t so they can be given as
+		 * compile-time constants like "RIFF"_cc.
+		 */
+		struct fourcc {
+			uint32_t code; ///< Packed characters, first in the high byte
+
+			/// Blank code consisting of four null bytes.
+			constexpr fourcc()
+				:	code(0)
+			{
+			}
+
+			/// Use an existing packed value.
+			explicit constexpr fourcc(uint32_t code)
+				:	code(code)
+			{
+			}
+
+			/// Use a compile-time code.
+			constexpr fourcc(fourcc_t code)
+				:	code((uint32_t)code)
+			{
+			}
+
+			/// Pack a string of up to four characters, padding with nulls.
+			constexpr fourcc(const char *name)
+				:	code(fourcc_pack(name, 4))
+			{
+			}
+
+			/// Pack a string of up to four characters, padding with nulls.
+			fourcc(const std::string& name)
+				:	code(0)
+			{
+				for (std::string::size_type i = 0; i < 4; i++) {
+					this->code <<= 8;
+					if (i < name.length()) this->code |= (uint8_t)name[i];
+				}
+			}
+
+			/// Unpack as a four-character string, including any null padding.
+			std::string str() const
+			{
+				char c[4] = {
+					(char)(this->code >> 24),
+					(char)(this->code >> 16),
+					(char)(this->code >> 8),
+					(char)this->code,
+				};
+				return std::string(c, 4);
+			}
+
+			operator std::string() const
+			{
+				return this->str();
+			}
+
+			/// Get the code for use in a switch statement.
+			constexpr fourcc_t id() const
+			{
+				return (fourcc_t)this->code;
+			}
+
+			constexpr bool operator == (const fourcc& b) const
+			{
+				return this->code == b.code;
+			}
+
+			constexpr bool operator != (const fourcc& b) const
+			{
+				return this->code != b.code;
+			}
+
+			constexpr bool operator < (const fourcc& b) const
+			{
+				return this->code < b.code;
+			}
+
+			/// Hash function for use in unordered containers.
+			struct hash {
+				std::size_t operator() (const fourcc& f) const
+				{
+					return std::hash<uint32_t>()(f.code);
+				}
+			};
+		};
 
 		enum Filetype {
 			/// Standard Microsoft RIFF file with length values in little-endian
@@ -91,8 +220,12 @@ class CAMOTO_GAMECOMMON_API IFFReader: public IFF
 
 		/// Seek to the start of the given chunk.
 		/**
+		 * Chunk headers are only read as far as needed to find the chunk, and are
+		 * remembered so later lookups at the same level don't read them again.
+		 *
 		 * @param name
-		 *   fourcc of the chunk to select.
+		 *   fourcc of the chunk to select.  If there is more than one chunk with
+		 *   this name, the first one is selected.
 		 *
 		 * @return The length of the selected chunk, in bytes.
 		 *
@@ -169,8 +302,34 @@ class CAMOTO_GAMECOMMON_API IFFReader: public IFF
 		};
 		std::vector<Chunk> chunks;
 
-		/// Populate chunk list.
-		void loadChunks(stream::len lenChunk);
+		/// Index into chunks of the first chunk with each name seen so far.
+		std::unordered_map<fourcc, unsigned int, fourcc::hash> index;
+
+		/// Offset of the next chunk header not yet read.
+		stream::pos nextChunk;
+
+		/// Bytes left in the current chunk from nextChunk onwards.
+		stream::len lenRemaining;
+
+		/// Start a new level, without reading any chunk headers yet.
+		/**
+		 * @param start
+		 *   Offset of the first chunk header in the level.
+		 *
+		 * @param lenChunk
+		 *   Number of bytes in the level from \e start onwards.
+		 */
+		void beginLevel(stream::pos start, stream::len lenChunk);
+
+		/// Read the next chunk header in the current level.
+		/**
+		 * @return true if a chunk was added to the list, false if there are no
+		 *   more chunks at this level.
+		 */
+		bool loadNextChunk();
+
+		/// Shared code for both open() functions.
+		stream::len openLevel(stream::len len, fourcc *type);
 };
 
 class CAMOTO_GAMECOMMON_API IFFWriter: public IFF
@@ -185,8 +344,17 @@ class CAMOTO_GAMECOMMON_API IFFWriter: public IFF
 		 *
 		 * @param filetype
 		 *   IFF/RIFF variant.
+		 *
+		 * @param streaming
+		 *   true to never seek in \e iff, so it can be a pipe or socket.  Chunk
+		 *   content must then be written to data() instead of \e iff.  Chunks
+		 *   whose length wasn't given to begin() are held in memory until they
+		 *   are finished, along with everything inside them.  Chunks given a
+		 *   length are written straight through, unless they are inside a chunk
+		 *   held in memory.
 		 */
-		IFFWriter(std::shared_ptr<stream::output> iff_ptr, Filetype filetype);
+		IFFWriter(std::shared_ptr<stream::output> iff_ptr, Filetype filetype,
+			bool streaming = false);
 
 		/// Create a new IFF reader without a shared pointer.
 		/**
@@ -199,8 +367,11 @@ class CAMOTO_GAMECOMMON_API IFFWriter: public IFF
 		 *
 		 * @param filetype
 		 *   IFF/RIFF variant.
+		 *
+		 * @param streaming
+		 *   true to never seek in \e iff.  See the shared_ptr constructor.
 		 */
-		IFFWriter(stream::output& iff, Filetype filetype);
+		IFFWriter(stream::output& iff, Filetype filetype, bool streaming = false);
 
 		/// Open a subchunk within the current one.
 		/**
@@ -223,6 +394,34 @@ class CAMOTO_GAMECOMMON_API IFFWriter: public IFF
 		 */
 		void begin(const fourcc& name, const fourcc& type);
 
+		/// Open a subchunk of a known size within the current one.
+		/**
+		 * The length is written straight away, so end() doesn't have to seek
+		 * back to fill it in, and in streaming mode the chunk doesn't have to be
+		 * held in memory.
+		 *
+		 * @param name
+		 *   fourcc of the chunk to create.
+		 *
+		 * @param len
+		 *   Length of the chunk's content in bytes, not including any padding.
+		 */
+		void begin(const fourcc& name, stream::len len);
+
+		/// Open a subchunk of a known size, with a type, within the current one.
+		/**
+		 * @param name
+		 *   fourcc of the chunk to create.
+		 *
+		 * @param type
+		 *   File type for RIFF or LIST chunks.
+		 *
+		 * @param len
+		 *   Length of the chunk's content in bytes, including the four bytes of
+		 *   \e type but not including any padding.
+		 */
+		void begin(const fourcc& name, const fourcc& type, stream::len len);
+
 		/// Finish the current chunk.
 		/**
 		 * From this point on a sibling chunk can be started with a call to begin()
@@ -230,10 +429,46 @@ class CAMOTO_GAMECOMMON_API IFFWriter: public IFF
 		 *
 		 * @post The length of the given chunk is updated, but the write pointer
 		 *   is returned to its original location.
+		 *
+		 * @throw stream::write_error
+		 *   The length given to begin() doesn't match the amount of data that was
+		 *   written.
 		 */
 		void end();
 
+		/// Get the stream to write chunk content to.
+		/**
+		 * @return The stream passed to the constructor, or in streaming mode, a
+		 *   stream that passes the data on to it or holds it in memory as
+		 *   needed.  The returned stream can't seek, truncate or be read from.
+		 */
+		stream::output& data();
+
 	protected:
+		/// Chunk that has been started but not finished.
+		struct open_chunk {
+			stream::pos start;  ///< Offset of the chunk header in its stream
+			stream::len len;    ///< Declared length, if declared is true
+			bool declared;      ///< Was the length given to begin()?
+			bool held;          ///< Did this chunk start holding data in memory?
+		};
+
+		/// Passes data written in streaming mode to the right place.
+		class CAMOTO_GAMECOMMON_API sink: virtual public stream::output
+		{
+			public:
+				sink(IFFWriter& writer);
+
+				virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+				virtual void seekp(stream::delta off, stream::seek_from from);
+				virtual stream::pos tellp() const;
+				virtual void truncate(stream::pos size);
+				virtual void flush();
+
+			protected:
+				IFFWriter& writer;
+		};
+
 		/// Shared pointer to iff, if one was passed to the constructor.
 		std::shared_ptr<stream::output> iff_ptr;
 
@@ -243,10 +478,51 @@ class CAMOTO_GAMECOMMON_API IFFWriter: public IFF
 		/// Type of file (RIFF, IFF, etc.)
 		Filetype filetype;
 
-		/// Offset of start of most recent chunk (where to write chunk length later)
-		std::vector<stream::pos> chunk;
+		/// Chunks that have been started but not finished, innermost last.
+		std::vector<open_chunk> chunk;
+
+		/// Never seek in iff?
+		bool streaming;
+
+		/// Data written to iff in streaming mode.
+		stream::len lenStreamed;
+
+		/// Chunks of unknown length held in memory, in streaming mode.
+		stream::string held;
+
+		/// Is held in use?
+		bool holding;
+
+		/// Where data() writes to in streaming mode.
+		sink out;
+
+		/// Stream chunk headers and content currently go to.
+		stream::output& target();
+
+		/// Offset of the next byte written, counted from the start of iff.
+		stream::pos tell();
+
+		/// Write a chunk header with the given length.
+		void beginChunk(const fourcc& name, const fourcc *type, stream::len len,
+			bool declared);
+
+		/// Write a chunk length in the file's byte order.
+		void writeLength(stream::output& s, stream::len len);
 };
 
+inline std::ostream& operator << (std::ostream& s, const IFF::fourcc& f)
+{
+	return s << f.str();
+}
+
 } // namespace camoto
 
+namespace std {
+
+template <>
+struct hash<camoto::IFF::fourcc>: public camoto::IFF::fourcc::hash {
+};
+
+} // namespace std
+
 #endif // _CAMOTO_IFF_HPP_
@@ -21,7 +21,9 @@
 #ifndef _CAMOTO_IOSTREAM_HELPERS_HPP_
 #define _CAMOTO_IOSTREAM_HELPERS_HPP_
 
+#include <algorithm>
 #include <string>
+#include <vector>
 #include <camoto/config.hpp>
 #include <camoto/stream.hpp>
 
@@ -136,6 +138,13 @@ struct CAMOTO_GAMECOMMON_API null_terminated_read {
 	void read(stream::input& s) const;
 
 	private:
+		/// Read in blocks and seek back past the null, for streams where
+		/// view() would have to seek.
+		void read_blocks(stream::input& s) const;
+
+		/// Read one byte at a time, for streams that can't be peeked at.
+		void read_bytes(stream::input& s, stream::len maxlen) const;
+
 		std::string& r;
 		stream::len maxlen;
 };
@@ -211,6 +220,10 @@ struct CAMOTO_GAMECOMMON_API number_format_u8: public number_format_read, public
 	void read(stream::input& s) const;
 	void write(stream::output& s) const;
 
+	static const unsigned int length = 1;
+	void decode(const uint8_t *buf) const { this->r = *buf; }
+	void encode(uint8_t *buf) const { *buf = this->r; }
+
 	private:
 		uint8_t& r;
 };
@@ -219,6 +232,9 @@ struct CAMOTO_GAMECOMMON_API number_format_const_u8: public number_format_write
 	number_format_const_u8(const uint8_t& r);
 	void write(stream::output& s) const;
 
+	static const unsigned int length = 1;
+	void encode(uint8_t *buf) const { *buf = this->r; }
+
 	private:
 		const uint8_t& r;
 };
@@ -232,6 +248,165 @@ inline number_format_const_u8 u8(const uint8_t& r)
 	return number_format_const_u8(r);
 }
 
+// Batched reads and writes
+
+/// Total number of bytes used by a list of number_format fields.
+template <typename... F>
+struct packed_length;
+
+template <>
+struct packed_length<> {
+	static const unsigned int value = 0;
+};
+
+template <typename F, typename... R>
+struct packed_length<F, R...> {
+	static const unsigned int value = F::length + packed_length<R...>::value;
+};
+
+inline void decode_packed(const uint8_t *)
+{
+	return;
+}
+
+/// Decode a list of fields from a buffer, in order.
+template <typename F, typename... R>
+inline void decode_packed(const uint8_t *buf, const F& f, const R&... r)
+{
+	f.decode(buf);
+	decode_packed(buf + F::length, r...);
+	return;
+}
+
+inline void encode_packed(uint8_t *)
+{
+	return;
+}
+
+/// Encode a list of fields into a buffer, in order.
+template <typename F, typename... R>
+inline void encode_packed(uint8_t *buf, const F& f, const R&... r)
+{
+	f.encode(buf);
+	encode_packed(buf + F::length, r...);
+	return;
+}
+
+/// Read a number of fields with a single call to stream::input::read().
+/**
+ * This is equivalent to chaining the fields with operator >>, however all the
+ * fields are read from the stream at once and then decoded from a local
+ * buffer, rather than one read() per field.  This is much faster when parsing
+ * large tables of fixed-size records.
+ *
+ * @code
+ * read_packed(file, u32le(offset), u16le(size), u8(type));
+ * @endcode
+ *
+ * @throw stream::incomplete_read
+ *   Not all fields could be read.  None of the variables are changed in this
+ *   case.
+ */
+template <typename F, typename... R>
+inline void read_packed(stream::input& s, const F& f, const R&... r)
+{
+	uint8_t buf[packed_length<F, R...>::value];
+	s.read(buf, sizeof(buf));
+	decode_packed(buf, f, r...);
+	return;
+}
+
+/// Write a number of fields with a single call to stream::output::write().
+/**
+ * @see read_packed()
+ *
+ * @code
+ * write_packed(file, u32le(offset), u16le(size), u8(type));
+ * @endcode
+ */
+template <typename F, typename... R>
+inline void write_packed(stream::output& s, const F& f, const R&... r)
+{
+	uint8_t buf[packed_length<F, R...>::value];
+	encode_packed(buf, f, r...);
+	s.write(buf, sizeof(buf));
+	return;
+}
+
+/// Read an array of numbers in one go, converting them to host byte order.
+/**
+ * This is the same as reading each element with e.g. u16le(), but the data is
+ * read with one call and converted in place, several values at a time.
+ *
+ * @code
+ * std::vector<uint16_t> tiles;
+ * read_array<uint16_t, little_endian>(file, tiles, width * height);
+ * @endcode
+ *
+ * @param s
+ *   Stream to read from.
+ *
+ * @param data
+ *   Destination array, with room for at least \e n elements.
+ *
+ * @param n
+ *   Number of elements to read.
+ *
+ * @throw stream::incomplete_read
+ *   Not all the elements could be read.  The content of \e data is undefined.
+ */
+template <typename T, typename E>
+inline void read_array(stream::input& s, T *data, std::size_t n)
+{
+	s.read((uint8_t *)data, n * sizeof(T));
+	host_from_array<T, E>(data, n);
+	return;
+}
+
+/// Read an array of numbers into a vector, resizing it to hold \e n elements.
+template <typename T, typename E>
+inline void read_array(stream::input& s, std::vector<T>& data, std::size_t n)
+{
+	data.resize(n);
+	if (n) read_array<T, E>(s, data.data(), n);
+	return;
+}
+
+/// Write an array of numbers in one go, converting them from host byte order.
+/**
+ * @see read_array()
+ *
+ * If the host byte order differs from \e E the data is converted in chunks
+ * through a local buffer, as the array itself is left unchanged.
+ */
+template <typename T, typename E>
+inline void write_array(stream::output& s, const T *data, std::size_t n)
+{
+	if (is_host_endian<E>::value || (sizeof(T) == 1)) {
+		s.write((const uint8_t *)data, n * sizeof(T));
+		return;
+	}
+	T buf[4096 / sizeof(T)];
+	const std::size_t lenChunk = sizeof(buf) / sizeof(T);
+	while (n) {
+		std::size_t len = std::min(n, lenChunk);
+		memcpy(buf, data, len * sizeof(T));
+		host_to_array<T, E>(buf, len);
+		s.write((const uint8_t *)buf, len * sizeof(T));
+		data += len;
+		n -= len;
+	}
+	return;
+}
+
+/// Write the content of a vector of numbers in one go.
+template <typename T, typename E>
+inline void write_array(stream::output& s, const std::vector<T>& data)
+{
+	write_array<T, E>(s, data.data(), data.size());
+	return;
+}
+
 } // namespace camoto
 
 #endif // _CAMOTO_IOSTREAM_HELPERS_HPP_
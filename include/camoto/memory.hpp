@@ -0,0 +1,160 @@
+/**
+ * @file  camoto/memory.hpp
+ * @brief Keep track of how much memory streams are holding on to.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_MEMORY_HPP_
+#define _CAMOTO_MEMORY_HPP_
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <camoto/config.hpp>
+
+namespace camoto {
+namespace memory {
+
+/// Stream classes that hold data in memory.
+enum class owner {
+	string,    ///< stream::string and friends
+	/// stream::filtered and friends, but not the streaming variants.  Decoded
+	/// data shared through decode_cache is limited by the cache's own budget
+	/// instead, and is not counted.
+	filtered,
+	seg,       ///< Data inserted into a stream::seg but not yet committed
+	paged,     ///< Pages of stream::paged, each counted once however shared
+};
+
+/// Number of values in owner.
+const unsigned int NUM_OWNERS = 4;
+
+/// Name of an owner, e.g. "seg".
+CAMOTO_GAMECOMMON_API const char *name(owner o);
+
+/// Memory in use across all threads.
+struct totals {
+	/// Bytes held by each owner, indexed by owner.
+	std::array<uint64_t, NUM_OWNERS> bytes;
+
+	/// Bytes held by all owners together.
+	uint64_t total;
+
+	/// Highest value total has reached.
+	uint64_t peak;
+
+	/// Bytes held by the given owner.
+	uint64_t operator[](owner o) const
+	{
+		return this->bytes[(unsigned int)o];
+	}
+};
+
+/// Get the amount of memory currently held by streams.
+/**
+ * Unlike the counters in camoto/stats.hpp, these are always collected.  Each
+ * total is updated with a single atomic operation whenever a stream's buffer
+ * changes size, so this is safe to call from any thread at any time.
+ */
+CAMOTO_GAMECOMMON_API totals snapshot();
+
+/// Function called when memory use goes over the soft limit.
+/**
+ * @param total
+ *   Bytes now held by all streams.
+ */
+typedef std::function<void(uint64_t total)> limit_fn;
+
+/// Ask to be told when streams are holding too much memory.
+/**
+ * Once the total held by all streams rises above \e bytes, \e fn is called so
+ * the application can flush, commit or close streams, or spill data elsewhere.
+ * It is called once each time the limit is crossed, so will not be called
+ * again until the total has dropped back down to the limit or below.
+ *
+ * Nothing is prevented from allocating memory, and the callback is never
+ * called recursively, so it may safely flush streams itself.  It runs on
+ * whichever thread happened to cross the limit, in the middle of that
+ * thread's read or write, so it should not use that same stream.
+ *
+ * @param bytes
+ *   Limit in bytes, or 0 to remove the limit.
+ *
+ * @param fn
+ *   Function to call.
+ */
+CAMOTO_GAMECOMMON_API void set_soft_limit(uint64_t bytes, limit_fn fn);
+
+/// Record that memory has been allocated.  For use by streams only.
+CAMOTO_GAMECOMMON_API void allocated(owner o, uint64_t len);
+
+/// Record that memory has been freed.  For use by streams only.
+CAMOTO_GAMECOMMON_API void freed(owner o, uint64_t len);
+
+/// Memory held by one object, added to the totals for its owner.
+/**
+ * The object calls set() whenever its buffer changes size, and the amount is
+ * removed from the totals again when the charge is destroyed.
+ */
+class CAMOTO_GAMECOMMON_API charge
+{
+	public:
+		/// Start with nothing charged.
+		charge(owner type);
+
+		/// Charge a copy of another object's memory.
+		charge(const charge& other);
+
+		~charge();
+
+		charge& operator=(const charge& other);
+
+		/// Change the amount of memory charged.
+		/**
+		 * @param len
+		 *   Bytes now held by the object.
+		 */
+		inline void set(uint64_t len)
+		{
+			if (len != this->bytes) this->change(len);
+			return;
+		}
+
+		/// Bytes currently charged.
+		inline uint64_t get() const
+		{
+			return this->bytes;
+		}
+
+		/// Owner the memory is charged to.
+		inline owner type() const
+		{
+			return this->o;
+		}
+
+	protected:
+		owner o;         ///< Owner to charge
+		uint64_t bytes;  ///< Amount currently charged
+
+		/// Update the totals with a new amount.
+		void change(uint64_t len);
+};
+
+} // namespace memory
+} // namespace camoto
+
+#endif // _CAMOTO_MEMORY_HPP_
@@ -0,0 +1,181 @@
+/**
+ * @file  camoto/repack.hpp
+ * @brief Rebuild a whole archive in one planned pass.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_REPACK_HPP_
+#define _CAMOTO_REPACK_HPP_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <camoto/filter.hpp>
+#include <camoto/stream.hpp>
+#include <camoto/thread_pool.hpp>
+
+/// Size of each of the two buffers used to copy data during a repack.
+#define REPACK_BUFFER_SIZE (1024 * 1024)
+
+/// Most input that filtered items may have waiting to be written.
+/**
+ * Filtered items are run on a thread pool ahead of the item being written, up
+ * to this many bytes of their input, so this limits the memory used to hold
+ * their output until it can be written.
+ */
+#define REPACK_AHEAD (64 * 1024 * 1024)
+
+/// repack_item::destOffset value placing an item straight after the last one.
+#define REPACK_NEXT ((camoto::stream::pos)-1)
+
+namespace camoto {
+namespace stream {
+
+/// One block of data in the layout of a rebuilt archive.
+struct CAMOTO_GAMECOMMON_API repack_item
+{
+	/// Stream holding the data.
+	/**
+	 * For repack_in_place() and repack_file(), nullptr means the data is
+	 * already in the archive being rebuilt.  Any other stream is only read
+	 * from, so it must not be the archive or part of it.
+	 */
+	std::shared_ptr<input> source;
+
+	stream::pos srcOffset;   ///< Offset of the data in source
+	stream::len srcLen;      ///< Number of bytes to take from source
+
+	/// Offset to put the data at in the rebuilt archive.
+	/**
+	 * Set this to REPACK_NEXT to put it straight after the item before it, or
+	 * at offset 0 for the first item.  On return this is the actual offset.
+	 */
+	stream::pos destOffset;
+
+	/// Filter to run the data through, or nullptr to copy it as-is.
+	/**
+	 * Each item must have its own filter instance, as they run in parallel.
+	 */
+	std::shared_ptr<filter> algo;
+
+	/// On return, the number of bytes written for this item.
+	stream::len destLen;
+};
+
+/// Build an archive from a list of items, in one pass.
+/**
+ * Each item is written to \e dest in turn.  Items without a filter are copied
+ * with large reads, reading the next block while the last one is written,
+ * and a run of items that follow on from each other in both their source and
+ * the output is copied as a single block.  Listing the items in the order
+ * they appear in their source therefore turns the whole rebuild into a few
+ * long sequential reads and writes.
+ *
+ * Filtered items (e.g. files being compressed) are run on the thread pool
+ * ahead of time, so they are ready by the time the writing reaches them.
+ * Their output size is only known once the filter has run, so items after
+ * them should normally use REPACK_NEXT.
+ *
+ * Space for the output is reserved up front, assuming filtered items come
+ * out the same size as they went in.
+ *
+ * @param layout
+ *   Items to write.  On return, destOffset and destLen are filled in, ready
+ *   for writing the archive's file table.  No item may have a null source.
+ *
+ * @param dest
+ *   Stream to write to, which must be able to grow.  Anything already in it
+ *   is discarded, and any gaps left between items are filled with zeros.  On
+ *   return it ends after the last byte of the last item.
+ *
+ * @param pool
+ *   Thread pool to run the filters on, or nullptr to create a temporary pool
+ *   with one thread per CPU core if any items are filtered.
+ *
+ * @throw read_error
+ *   An item's source is shorter than its srcLen.
+ *
+ * @throw write_error
+ *   The data could not be written.
+ *
+ * @throw filter_error
+ *   One of the filters failed.
+ */
+CAMOTO_GAMECOMMON_API void repack(std::vector<repack_item>& layout,
+	output& dest, thread_pool *pool = nullptr);
+
+/// Rebuild an archive in place.
+/**
+ * If no items are filtered, each item is moved to its new position within
+ * \e archive with stream::move().  The moves are done in an order where no
+ * data is overwritten before it has been moved itself, and neighbouring items
+ * being moved the same distance are moved together in one go.
+ *
+ * If there is no such order (such as when two items swap places), or some
+ * items are filtered, the archive is instead built with repack() in a
+ * temporary file and then copied back over the original.
+ *
+ * @param layout
+ *   Items to write, as for repack().  On return, destOffset and destLen are
+ *   filled in.
+ *
+ * @param archive
+ *   Archive to rebuild.  On return it ends after the last item.  Gaps left
+ *   between items may still hold old data.
+ *
+ * @param pool
+ *   Thread pool to run any filters on, or nullptr to create a temporary one.
+ *
+ * @return true if the archive was rebuilt in place, false if it went through
+ *   a temporary copy.
+ *
+ * @throw stream::error
+ *   Two items would overlap in the output.  Nothing has been changed.
+ *
+ * @copydetails repack()
+ */
+CAMOTO_GAMECOMMON_API bool repack_in_place(std::vector<repack_item>& layout,
+	inout& archive, thread_pool *pool = nullptr);
+
+/// Rebuild an archive file, replacing the file if it can't be done in place.
+/**
+ * This is the same as repack_in_place(), except that when the archive can't
+ * be rebuilt in place it is written to a new file next to the original, which
+ * is then renamed over the top of it.  This saves copying the whole archive
+ * back again, and the original is left untouched if anything fails.
+ *
+ * Any streams the caller has open on the file must have been flushed first,
+ * and must be reopened afterwards as they may refer to the old file.
+ *
+ * @param layout
+ *   Items to write, as for repack_in_place().
+ *
+ * @param filename
+ *   Archive file to rebuild.
+ *
+ * @param pool
+ *   Thread pool to run any filters on, or nullptr to create a temporary one.
+ *
+ * @return true if the archive was rebuilt in place, false if it was replaced.
+ */
+CAMOTO_GAMECOMMON_API bool repack_file(std::vector<repack_item>& layout,
+	const std::string& filename, thread_pool *pool = nullptr);
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_REPACK_HPP_
@@ -0,0 +1,169 @@
+/**
+ * @file  camoto/stats.hpp
+ * @brief Optional counters showing how streams and filters are used.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STATS_HPP_
+#define _CAMOTO_STATS_HPP_
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <typeinfo>
+#include <camoto/config.hpp>
+
+namespace camoto {
+namespace stats {
+
+/// Stream implementations with their own counters.
+enum class stream_type {
+	file,      ///< stream::file
+	sub,       ///< stream::sub
+	seg,       ///< stream::seg
+	filtered,  ///< stream::filtered and the streaming variants
+	string,    ///< stream::string and stream::paged
+};
+
+/// Number of values in stream_type.
+const unsigned int NUM_STREAM_TYPES = 5;
+
+/// Name of a stream type, e.g. "sub".
+CAMOTO_GAMECOMMON_API const char *name(stream_type t);
+
+/// Totals for one type of stream.
+struct stream_counters {
+	uint64_t reads;         ///< Calls to try_read() and try_read_at()
+	uint64_t writes;        ///< Calls to try_write() and try_write_at()
+	uint64_t bytesRead;     ///< Bytes returned by reads
+	uint64_t bytesWritten;  ///< Bytes accepted by writes
+	uint64_t seeks;         ///< Calls to seekg() and seekp()
+};
+
+/// Totals for one filter class.
+struct filter_counters {
+	uint64_t calls;         ///< Calls to filter::transform()
+	uint64_t bytesIn;       ///< Bytes consumed
+	uint64_t bytesOut;      ///< Bytes produced
+	uint64_t nanoseconds;   ///< Time spent inside transform()
+};
+
+/// All counters, totalled over every thread.
+struct totals {
+	/// Were the counters compiled in?  If not, everything else is zero.
+	bool enabled;
+
+	/// Counters for each stream type, indexed by stream_type.
+	std::array<stream_counters, NUM_STREAM_TYPES> streams;
+
+	/// Counters for each filter class that has been used, by class name.
+	std::map<std::string, filter_counters> filters;
+
+	/// Number of times stream::input_filtered ran its filter over the input.
+	uint64_t populates;
+
+	/// Number of calls to stream::seg::commit().
+	uint64_t commits;
+
+	/// Counters for the given stream type.
+	const stream_counters& operator[](stream_type t) const
+	{
+		return this->streams[(unsigned int)t];
+	}
+};
+
+/// Add up the counters from every thread.
+/**
+ * The counters only ever increase, so the activity over a period of time is
+ * the difference between two snapshots.
+ *
+ * Counters are only collected when the library is built with CAMOTO_STATS
+ * defined (see camoto/config.hpp).  Otherwise this returns zeroes, with
+ * totals::enabled set to false, so callers do not need to know how the
+ * library was built.
+ *
+ * Each thread updates its own set of counters without any locking, so a
+ * snapshot taken while other threads are busy may be slightly out of date.
+ *
+ * @note stream::filtered keeps its data in a stream::string, so accessing
+ *   a filtered stream also adds to the string counters.
+ */
+CAMOTO_GAMECOMMON_API totals snapshot();
+
+#ifdef CAMOTO_STATS
+
+/// Record a read of \e len bytes.  For use by stream implementations only.
+CAMOTO_GAMECOMMON_API void count_read(stream_type t, uint64_t len);
+
+/// Record a write of \e len bytes.  For use by stream implementations only.
+CAMOTO_GAMECOMMON_API void count_write(stream_type t, uint64_t len);
+
+/// Record a seek.  For use by stream implementations only.
+CAMOTO_GAMECOMMON_API void count_seek(stream_type t);
+
+/// Record a filter pass in stream::input_filtered.
+CAMOTO_GAMECOMMON_API void count_populate();
+
+/// Record a call to stream::seg::commit().
+CAMOTO_GAMECOMMON_API void count_commit();
+
+/// Record a call to filter::transform().
+CAMOTO_GAMECOMMON_API void count_transform(const std::type_info& type,
+	uint64_t lenIn, uint64_t lenOut, uint64_t ns);
+
+/// Current time in nanoseconds, for timing filter::transform().
+CAMOTO_GAMECOMMON_API uint64_t now();
+
+#define CAMOTO_STATS_READ(t, len) \
+	::camoto::stats::count_read(::camoto::stats::stream_type::t, len)
+#define CAMOTO_STATS_WRITE(t, len) \
+	::camoto::stats::count_write(::camoto::stats::stream_type::t, len)
+#define CAMOTO_STATS_SEEK(t) \
+	::camoto::stats::count_seek(::camoto::stats::stream_type::t)
+#define CAMOTO_STATS_POPULATE() ::camoto::stats::count_populate()
+#define CAMOTO_STATS_COMMIT() ::camoto::stats::count_commit()
+
+/// Call filter::transform(), recording how long it took.
+/**
+ * This is a macro rather than a function so that it doesn't need to include
+ * camoto/filter.hpp.  Without CAMOTO_STATS it is just the call itself.
+ */
+#define CAMOTO_STATS_TRANSFORM(f, out, lenOut, in, lenIn) \
+	do { \
+		uint64_t camoto_stats_start = ::camoto::stats::now(); \
+		(f).transform(out, lenOut, in, lenIn); \
+		::camoto::stats::count_transform(typeid(f), *(lenIn), *(lenOut), \
+			::camoto::stats::now() - camoto_stats_start); \
+	} while (0)
+
+#else // !CAMOTO_STATS
+
+#define CAMOTO_STATS_READ(t, len) do {} while (0)
+#define CAMOTO_STATS_WRITE(t, len) do {} while (0)
+#define CAMOTO_STATS_SEEK(t) do {} while (0)
+#define CAMOTO_STATS_POPULATE() do {} while (0)
+#define CAMOTO_STATS_COMMIT() do {} while (0)
+#define CAMOTO_STATS_TRANSFORM(f, out, lenOut, in, lenIn) \
+	(f).transform(out, lenOut, in, lenIn)
+
+#endif // CAMOTO_STATS
+
+} // namespace stats
+} // namespace camoto
+
+#endif // _CAMOTO_STATS_HPP_
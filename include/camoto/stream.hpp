@@ -21,7 +21,12 @@
 #ifndef _CAMOTO_STREAM_HPP_
 #define _CAMOTO_STREAM_HPP_
 
+#include <atomic>
 #include <cstring>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
 #include <stdint.h>
 #include <camoto/config.hpp>
 #include <camoto/error.hpp>
@@ -29,9 +34,18 @@
 namespace camoto {
 namespace stream {
 
-/// Buffer size to use in copy() and move().
+/// Buffer size to use when reading or writing blocks of data.
 #define BUFFER_SIZE 4096
 
+/// Buffer size to use in copy() and move() if the caller doesn't supply one.
+#define COPY_BUFFER_SIZE (256 * 1024)
+
+/// Largest gap between two ranges that read_ranges() will read through.
+#define RANGE_GAP (64 * 1024)
+
+/// Largest single read issued by read_ranges().
+#define RANGE_READ_SIZE (4 * 1024 * 1024)
+
 /// Signed integer data type.  Internal use only.
 typedef long long signed_int_type;
 
@@ -132,6 +146,54 @@ enum seek_from {
 	end    ///< Move from the end of the stream
 };
 
+/// How a stream is about to be read, passed to input::hint().
+enum class access_pattern {
+	normal,     ///< No particular pattern, or not known
+	sequential, ///< From start to end, with few or no seeks
+	random,     ///< Small reads all over the place
+};
+
+/// Where a stream's data comes from, as returned by input::identify().
+struct source_id {
+	uint64_t content;    ///< Number of the underlying stream's current content
+	stream::pos offset;  ///< Where the data starts in the underlying stream
+	stream::len length;  ///< Amount of data
+};
+
+/// Number given to a stream's content, for input::identify().
+/**
+ * Each stream that can identify its data keeps one of these.  A number is
+ * only handed out the first time it is asked for, and is dropped (along with
+ * any decoded copies in decode_cache) as soon as the content changes, so no
+ * two versions of any stream's data ever share a number.
+ */
+class CAMOTO_GAMECOMMON_API source_tag
+{
+	public:
+		source_tag();
+
+		/// Number for the current content, never zero.
+		uint64_t get() const;
+
+		/// Note that the content has changed.
+		/**
+		 * This must be called by every write, so it costs next to nothing unless
+		 * a number has been handed out since the last change.
+		 */
+		void changed()
+		{
+			if (this->value.load(std::memory_order_relaxed)) this->retire();
+			return;
+		}
+
+	private:
+		/// Current number, or zero if none has been handed out.
+		mutable std::atomic<uint64_t> value;
+
+		/// Drop the current number and its cached data.
+		void retire();
+};
+
 /// Base stream interface for reading data.
 /**
  * @post A newly created stream's seek pointer is always at the start (offset 0).
@@ -165,6 +227,73 @@ class CAMOTO_GAMECOMMON_API input
 		 */
 		virtual stream::len try_read(uint8_t *buffer, stream::len len) = 0;
 
+		/// Read data from a given offset without moving the read pointer.
+		/**
+		 * This behaves as if the read pointer were moved to \e pos, try_read()
+		 * called and the pointer moved back again, which is exactly what the
+		 * default implementation does.  Streams that can read from any position
+		 * directly, such as files or data in memory, override this to avoid the
+		 * seeks, and streams that sit on top of another stream pass the call on
+		 * to their parent without touching the parent's read pointer.
+		 *
+		 * @param pos
+		 *   Offset from the start of the stream of the first byte to read.
+		 *
+		 * @param buffer
+		 *   Pointer to memory where data will be stored.
+		 *
+		 * @param len
+		 *   Number of bytes to read from the stream.
+		 *
+		 * Any number of threads may call this function on the same stream at
+		 * the same time, as long as nothing else is using the stream.  The file,
+		 * string and mmap streams, and sub and seg streams over them, do this
+		 * without any locking.  The default implementation takes a lock around
+		 * the seek and read, so it is safe but the reads happen one at a time.
+		 *
+		 * @return Number of bytes read.  Always <= len, and 0 if \e pos is at or
+		 *   beyond the end of the stream.
+		 *
+		 * @throw read_error
+		 *   The data could not be read due to some reason other than EOF.
+		 *
+		 * @throw filter_error
+		 *   There was an error decoding the data required to perform this
+		 *   operation.
+		 */
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
+
+		/// Start reading data from a given offset, without waiting for it.
+		/**
+		 * This returns straight away, and the data is read in the background.
+		 * Many reads can be in progress at once, on the same stream or on
+		 * different ones.
+		 *
+		 * The default implementation calls try_read_at() repeatedly on a shared
+		 * pool of I/O threads.  Local files on Linux are read through io_uring
+		 * instead, so no thread is tied up waiting for each read, and substreams
+		 * and caches pass the request on to their parent.
+		 *
+		 * The stream and \e buffer must remain valid until the read has
+		 * finished, and nothing may write to the stream in the meantime.
+		 *
+		 * @param pos
+		 *   Offset from the start of the stream of the first byte to read.
+		 *
+		 * @param buffer
+		 *   Pointer to memory where data will be stored.
+		 *
+		 * @param len
+		 *   Number of bytes to read from the stream.
+		 *
+		 * @return A future giving the number of bytes read, which is only less
+		 *   than \e len if the end of the stream was reached.  If the read fails,
+		 *   getting the value throws the same exceptions as try_read_at().
+		 */
+		virtual std::future<stream::len> async_read_at(stream::pos pos,
+			uint8_t *buffer, stream::len len);
+
 		/// Read the given number of bytes from the stream.
 		/**
 		 * If not all the data could be read, an exception will be thrown.
@@ -270,6 +399,107 @@ class CAMOTO_GAMECOMMON_API input
 		 *   operation.
 		 */
 		virtual stream::len size() const = 0;
+
+		/// Get the file size if it can be found cheaply.
+		/**
+		 * This is for allocating space ahead of time, where guessing wrong
+		 * costs less than finding out.  Streams such as
+		 * input_filtered_streaming, which have to decode all their data to work
+		 * out the size, return 0 instead.
+		 *
+		 * @return The file size in bytes, or 0 if it is not known.  The default
+		 *   implementation returns size(), or 0 if that fails.
+		 */
+		virtual stream::len size_hint() const;
+
+		/// Borrow a pointer to some of the stream's data without copying it.
+		/**
+		 * Streams that keep their data in memory (such as stream::string) return
+		 * a pointer directly into their own storage, avoiding a memcpy().  Other
+		 * streams fall back to this default implementation, which reads the data
+		 * into \e scratch and returns a pointer to that instead.
+		 *
+		 * The read pointer is not moved, so this can be used to peek at data
+		 * anywhere in the stream.
+		 *
+		 * @param pos
+		 *   Offset from the start of the stream of the first byte to return.
+		 *
+		 * @param len
+		 *   Number of bytes wanted.
+		 *
+		 * @param got
+		 *   On return, set to the number of bytes available at the returned
+		 *   pointer.  Always <= len, and only less than len if EOF was reached.
+		 *
+		 * @param scratch
+		 *   Buffer owned by the caller, which the data is copied into if the
+		 *   stream can't return a pointer to its own storage.  Reusing the same
+		 *   buffer for each call avoids allocating a new one each time.
+		 *
+		 * @return Pointer to the data.  It remains valid until \e scratch is
+		 *   changed or destroyed, or until the stream is modified or destroyed,
+		 *   whichever comes first.
+		 *
+		 * @throw seek_error
+		 *   \e pos is past the end of the stream.
+		 *
+		 * @throw read_error
+		 *   The data could not be read.
+		 *
+		 * @throw filter_error
+		 *   There was an error decoding the data required to perform this
+		 *   operation.
+		 */
+		virtual const uint8_t *view(stream::pos pos, stream::len len,
+			stream::len *got, std::string& scratch);
+
+		/// Can view() return data without moving the read pointer?
+		/**
+		 * This is false for streams that use the default view(), which seeks to
+		 * the data and back again.  That is harmless for a file, but can be
+		 * slow for a stream such as input_filtered_streaming where seeking
+		 * backwards means decoding everything again, so code that would view
+		 * the same data several times can read it once instead.
+		 *
+		 * @return true if view() can normally return data without seeking.  The
+		 *   default implementation returns false.
+		 */
+		virtual bool cheap_view() const;
+
+		/// Say how the stream is about to be read.
+		/**
+		 * This is only advice, which streams may use to read ahead more or less
+		 * than they otherwise would.  It never changes the data returned.  The
+		 * default implementation does nothing.
+		 *
+		 * @param pattern
+		 *   The way the stream will be read from now on.
+		 */
+		virtual void hint(access_pattern pattern);
+
+		/// Identify the data this stream reads.
+		/**
+		 * This lets input_filtered share decoded data, through decode_cache,
+		 * between separate streams that read the same thing.  A stream that
+		 * returns true must give a different source_id::content number once its
+		 * data has been changed.
+		 *
+		 * Changes made to the underlying data by anything other than the
+		 * stream's own write functions (e.g. another process writing to the same
+		 * file, or code modifying stream::string::data directly) are not noticed.
+		 *
+		 * @param id
+		 *   On return, where the data comes from.  Unchanged if false is
+		 *   returned.
+		 *
+		 * @return true if the data could be identified, false if not.  The
+		 *   default implementation returns false.
+		 */
+		virtual bool identify(source_id *id) const;
+
+	private:
+		std::mutex lock_at; ///< Serialises the default try_read_at()
 };
 
 /// Base stream interface for writing data.
@@ -303,6 +533,41 @@ class CAMOTO_GAMECOMMON_API output
 		 */
 		virtual stream::len try_write(const uint8_t *buffer, stream::len len) = 0;
 
+		/// Write data at a given offset without moving the write pointer.
+		/**
+		 * This behaves as if the write pointer were moved to \e pos, try_write()
+		 * called and the pointer moved back again, which is exactly what the
+		 * default implementation does.  Streams that can write to any position
+		 * directly override this to avoid the seeks, and streams that sit on top
+		 * of another stream pass the call on to their parent without touching
+		 * the parent's write pointer.
+		 *
+		 * @param pos
+		 *   Offset from the start of the stream where the data will be written.
+		 *   This must not be past the end of the stream, but it may be at the end
+		 *   to append data.
+		 *
+		 * @param buffer
+		 *   Pointer to the data to write.
+		 *
+		 * @param len
+		 *   Number of bytes to write to the stream.
+		 *
+		 * @return Number of bytes written.  Always <= len, as for try_write().
+		 *
+		 * @throw seek_error
+		 *   \e pos is past the end of the stream.  Not all streams check this.
+		 *
+		 * @throw write_error
+		 *   The write failed due to something other than EOF/insufficient space.
+		 *
+		 * @throw filter_error
+		 *   There was an error decoding the data required to perform this
+		 *   operation.
+		 */
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len);
+
 		/// Write all the data to the stream or throw an exception.
 		/**
 		 * @param buffer
@@ -410,6 +675,23 @@ class CAMOTO_GAMECOMMON_API output
 		 */
 		virtual void truncate_here();
 
+		/// Set aside storage space for the stream to grow into.
+		/**
+		 * This is only a hint, used when the final size of the data is known in
+		 * advance (e.g. before copying a large file in) so that a file on disk
+		 * can be allocated in one piece, rather than growing a little with each
+		 * write and ending up fragmented.  The stream's size is not changed.
+		 *
+		 * The default implementation does nothing.  Local files allocate the
+		 * space with fallocate() on Linux, F_PREALLOCATE on macOS, or by setting
+		 * the allocation size on Windows.  Failures are ignored, as the writes
+		 * will still work without the space having been reserved.
+		 *
+		 * @param len
+		 *   Size in bytes the stream is expected to reach.
+		 */
+		virtual void reserve(stream::len len);
+
 		/// Commit all changes to the underlying storage medium.
 		/**
 		 * @throw write_error
@@ -470,6 +752,24 @@ class CAMOTO_GAMECOMMON_API expanding_inout: virtual public inout, virtual publi
  */
 void CAMOTO_GAMECOMMON_API copy(output& dest, input& src);
 
+/// Copy one stream into another using a caller-supplied buffer.
+/**
+ * @copydetails copy(output&, input&)
+ *
+ * @param buffer
+ *   Scratch space to hold data between the read and the write.  Larger
+ *   buffers mean fewer, larger I/O requests.
+ *
+ * @param lenBuffer
+ *   Size of \e buffer, in bytes.  Must be greater than zero.
+ *
+ * @note If both streams are local files, the data is copied directly between
+ *   the two files at the OS level, bypassing the stream buffers and possibly
+ *   \e buffer as well.
+ */
+void CAMOTO_GAMECOMMON_API copy(output& dest, input& src, uint8_t *buffer,
+	stream::len lenBuffer);
+
 /// Copy possibly overlapping data from one position in a stream to another.
 /**
  * @param data
@@ -503,6 +803,97 @@ void CAMOTO_GAMECOMMON_API copy(output& dest, input& src);
  */
 void CAMOTO_GAMECOMMON_API move(inout& data, pos from, pos to, len len);
 
+/// Copy possibly overlapping data within a stream using a caller-supplied
+/// buffer.
+/**
+ * @copydetails move(inout&, pos, pos, len)
+ *
+ * @param buffer
+ *   Scratch space to hold data between the read and the write.  Larger
+ *   buffers mean fewer seeks and fewer, larger I/O requests.
+ *
+ * @param lenBuffer
+ *   Size of \e buffer, in bytes.  Must be greater than zero.
+ *
+ * @note If \e data is a local file, positional I/O is used to read and write
+ *   the file directly, bypassing the stream's buffer and the seek calls.
+ */
+void CAMOTO_GAMECOMMON_API move(inout& data, pos from, pos to, len len,
+	uint8_t *buffer, stream::len lenBuffer);
+
+/// A future that is already finished, for quick paths in async_read_at().
+/**
+ * @param len
+ *   Value the future will return.
+ */
+std::future<stream::len> CAMOTO_GAMECOMMON_API ready_read(stream::len len);
+
+/// A block of data wanted from a stream, for read_ranges().
+struct read_range {
+	stream::pos pos;  ///< Offset of the first byte
+	stream::len len;  ///< Number of bytes
+};
+
+/// Callback receiving data for read_ranges().
+/**
+ * @param index
+ *   Index of the range in the list passed to read_ranges().
+ *
+ * @param offset
+ *   Offset of \e data within the range.
+ *
+ * @param data
+ *   The data.  It is only valid until the callback returns.
+ *
+ * @param len
+ *   Number of bytes at \e data.
+ */
+typedef std::function<void(std::size_t index, stream::len offset,
+	const uint8_t *data, stream::len len)> fn_range_data;
+
+/// Read many ranges of a stream in as few, large, in-order reads as possible.
+/**
+ * Extracting many files from an archive one at a time means a seek and a small
+ * read for each, in whatever order the caller happens to want them.  This
+ * sorts the ranges by offset instead, and reads any that are close together
+ * in one go, including the unwanted bytes between them, so the underlying
+ * device sees a few large sequential reads.
+ *
+ * The data is read with try_read_at(), so the read pointer of \e src is not
+ * changed.
+ *
+ * @param src
+ *   Stream to read from.
+ *
+ * @param ranges
+ *   Ranges to read.  They may be in any order and may overlap.
+ *
+ * @param count
+ *   Number of ranges.
+ *
+ * @param sink
+ *   Called with the data for each range.  Ranges are delivered in order of
+ *   \e pos, and the data for each one in order, in one or more pieces (more
+ *   than one only if the range is longer than \e maxRead.)  If the stream ends
+ *   part way through a range, the sink only receives the data before the end,
+ *   and ranges with no data at all are not passed to it.
+ *
+ * @param maxGap
+ *   Ranges with no more than this many unwanted bytes between them are read
+ *   together.
+ *
+ * @param maxRead
+ *   Largest amount of data to read at once, which is also the most memory
+ *   used.  Must be greater than zero.
+ *
+ * @throw read_error
+ *   Data could not be read from src.  Ranges before the failed read have
+ *   already been passed to \e sink.
+ */
+void CAMOTO_GAMECOMMON_API read_ranges(input& src, const read_range *ranges,
+	std::size_t count, fn_range_data sink, stream::len maxGap = RANGE_GAP,
+	stream::len maxRead = RANGE_READ_SIZE);
+
 /// iostream-style output function for char strings
 inline output& operator << (output& s, const char *d) {
 	s.write((const uint8_t *)d, strlen(d));
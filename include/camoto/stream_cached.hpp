@@ -0,0 +1,245 @@
+/**
+ * @file  camoto/stream_cached.hpp
+ * @brief Stream implementation keeping a block cache in front of another
+ *        stream.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_CACHED_HPP_
+#define _CAMOTO_STREAM_CACHED_HPP_
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Default size of each block in a stream::cached, in bytes.
+#define CACHE_BLOCK_SIZE 4096
+
+/// Default number of blocks held by a stream::cached.
+#define CACHE_BLOCK_COUNT 64
+
+/// Default number of blocks to read at once when reading sequentially.
+#define CACHE_READ_AHEAD 8
+
+/// Block cache parts in common with read and write.
+class CAMOTO_GAMECOMMON_API cached_core
+{
+	protected:
+		/// One slot in the cache, holding a single block.
+		struct block {
+			stream::pos index;               ///< Block number, or NO_BLOCK if unused
+			std::unique_ptr<uint8_t[]> data; ///< Block content, lenBlock bytes
+			stream::len len;                 ///< Number of valid bytes in data
+			bool dirty;                      ///< Has data been written but not saved?
+			bool used;                       ///< Accessed since the clock hand passed?
+			bool pinned;                     ///< Must not be evicted right now
+		};
+
+		/// Value of block::index for a slot not holding any block.
+		static const stream::pos NO_BLOCK = (stream::pos)-1;
+
+		std::shared_ptr<input> in_parent;    ///< Parent stream for reading
+		std::shared_ptr<output> out_parent;  ///< Parent for writing, or NULL
+		stream::len lenBlock;                ///< Size of each block in bytes
+		unsigned int readAhead;              ///< Max blocks read in sequence
+		std::vector<block> slots;            ///< The cache itself
+		std::unordered_map<stream::pos, std::size_t> lookup; ///< Index to slot
+		std::size_t hand;                    ///< CLOCK eviction position
+		std::size_t last;                    ///< Slot accessed most recently
+		stream::pos nextSeq;                 ///< Block to read ahead from
+		std::vector<uint8_t> scratch;        ///< Buffer for read-ahead
+		stream::pos offset;                  ///< Current read/write position
+		stream::len length;                  ///< Size including cached writes
+		stream::len lenParent;               ///< Size of the parent stream
+		std::mutex lock;                     ///< Serialises access to the cache
+
+		cached_core();
+		~cached_core();
+
+		/// Set up the cache.
+		/**
+		 * @param in_parent
+		 *   Parent stream supplying the data.
+		 *
+		 * @param out_parent
+		 *   Parent stream to write changes back to.  This is normally the same
+		 *   stream as \e in_parent, or NULL if the stream is read-only.
+		 *
+		 * @param lenBlock
+		 *   Size of each block, in bytes.
+		 *
+		 * @param numBlocks
+		 *   Maximum number of blocks to hold in memory at once.  Must be at least
+		 *   two.
+		 *
+		 * @param readAhead
+		 *   Maximum number of blocks to read from the parent at once, when the
+		 *   data is being read in order.  1 disables read-ahead.
+		 */
+		void init(std::shared_ptr<input> in_parent,
+			std::shared_ptr<output> out_parent, stream::len lenBlock,
+			unsigned int numBlocks, unsigned int readAhead);
+
+		/// Common seek function for reading and writing.
+		/**
+		 * @copydetails input::seekg()
+		 */
+		void seek(stream::delta off, seek_from from);
+
+		/// Copy data out of the cache, loading blocks as needed.
+		stream::len read_at(stream::pos pos, uint8_t *buffer, stream::len len);
+
+		/// Copy data into the cache, loading blocks as needed.
+		/**
+		 * @throw seek_error
+		 *   \e pos is past the end of the stream.
+		 */
+		stream::len write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len);
+
+		/// Get the slot holding the given block, loading it if needed.
+		/**
+		 * @param index
+		 *   Block number.
+		 *
+		 * @param fill
+		 *   true to read the block's existing data from the parent, false if the
+		 *   caller is about to overwrite all of it.
+		 */
+		block& get(stream::pos index, bool fill);
+
+		/// Find a slot to reuse, writing back its current block if needed.
+		std::size_t evict();
+
+		/// Write a dirty block back to the parent stream.
+		void write_back(block& b);
+
+		/// Write all dirty blocks back to the parent stream, in order.
+		void write_back_all();
+
+		/// Remove every block from the cache, after writing back dirty ones.
+		void clear();
+};
+
+/// Read-only stream caching blocks of another stream in memory.
+/**
+ * Data is read from the parent stream in whole blocks, and kept in memory so
+ * that small or repeated reads don't go back to the parent each time.  This
+ * makes a big difference when parsing formats with lots of tiny reads (as done
+ * by the iostream_helpers functions), especially when the parent is a file or
+ * is itself slow, such as a filtered stream or a substream of one.
+ *
+ * When a block is needed that isn't in the cache, the block least recently
+ * used (approximately, using CLOCK eviction) is replaced.  If the read comes
+ * straight after the last block read from the parent, the stream is assumed to
+ * be being read sequentially, and several blocks are read in one go.
+ *
+ * Changes made to the parent stream through other means are not seen if the
+ * affected data is already cached.
+ *
+ * A single lock is held during each call, so the stream may be used from
+ * multiple threads, but only one thread will be reading at any one time.
+ */
+class CAMOTO_GAMECOMMON_API input_cached: virtual public input,
+	virtual protected cached_core
+{
+	public:
+		/// Cache data from another stream.
+		/**
+		 * @param parent
+		 *   Parent stream supplying the data.
+		 *
+		 * @param lenBlock
+		 *   Size of each block, in bytes.
+		 *
+		 * @param numBlocks
+		 *   Maximum number of blocks to hold in memory at once.  Must be at least
+		 *   two.
+		 *
+		 * @param readAhead
+		 *   Maximum number of blocks to read from the parent at once, when the
+		 *   data is being read in order.  1 disables read-ahead.
+		 */
+		input_cached(std::shared_ptr<input> parent,
+			stream::len lenBlock = CACHE_BLOCK_SIZE,
+			unsigned int numBlocks = CACHE_BLOCK_COUNT,
+			unsigned int readAhead = CACHE_READ_AHEAD);
+		virtual ~input_cached();
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+
+		/// @copydoc input::async_read_at()
+		/**
+		 * If all the data is already cached, or some of it has been changed and
+		 * not yet written back, the read finishes straight away.  Otherwise it is
+		 * passed on to the parent stream, and the data is not added to the cache.
+		 */
+		virtual std::future<stream::len> async_read_at(stream::pos pos,
+			uint8_t *buffer, stream::len len);
+
+	protected:
+		input_cached();
+};
+
+/// Read/write stream caching blocks of another stream in memory.
+/**
+ * Writes go into the cached blocks and are only written back to the parent
+ * stream when a block is evicted, or when flush() is called.  Blocks are
+ * written back in whole, so the parent sees fewer, larger writes.
+ *
+ * @warning Like stream::seg, the data must be flushed before the stream is
+ *   destroyed, otherwise any unsaved changes are lost.
+ */
+class CAMOTO_GAMECOMMON_API cached: virtual public inout,
+	virtual public input_cached
+{
+	public:
+		cached() = delete;
+
+		/// Cache data from another stream, writing changes back to it.
+		/**
+		 * @copydetails input_cached::input_cached()
+		 */
+		cached(std::shared_ptr<inout> parent,
+			stream::len lenBlock = CACHE_BLOCK_SIZE,
+			unsigned int numBlocks = CACHE_BLOCK_COUNT,
+			unsigned int readAhead = CACHE_READ_AHEAD);
+		virtual ~cached();
+
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len);
+		virtual void seekp(stream::delta off, seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::pos size);
+		virtual void flush();
+};
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_CACHED_HPP_
@@ -0,0 +1,87 @@
+/**
+ * @file  camoto/stream_checksum.hpp
+ * @brief Stream wrapper that checksums data as it is read.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_CHECKSUM_HPP_
+#define _CAMOTO_STREAM_CHECKSUM_HPP_
+
+#include <memory>
+#include <mutex>
+#include <camoto/checksum.hpp>
+#include <camoto/config.hpp>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Read-only stream that calculates the checksum of another as it is read.
+/**
+ * Data is added to the checksum the first time it is read, as long as it
+ * follows on from the data already added.  Reading a stream from start to
+ * finish, in any size pieces, gives the checksum of the whole stream with no
+ * extra pass over the data.  Going back over data already read is fine, but
+ * skipping ahead leaves a gap, after which nothing more is added until the
+ * gap has been read.
+ *
+ * Like the other streams, try_read_at() may be called from several threads at
+ * once.
+ */
+class CAMOTO_GAMECOMMON_API input_checksum: virtual public input
+{
+	public:
+		/// Checksum the data in another stream.
+		/**
+		 * @param parent
+		 *   Stream supplying the data.
+		 *
+		 * @param type
+		 *   Checksum algorithm to use.
+		 */
+		input_checksum(std::shared_ptr<input> parent, checksum_type type);
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+
+		/// Checksum of the data from the start of the stream to length().
+		uint32_t value() const;
+
+		/// Number of bytes from the start of the stream in value().
+		stream::len length() const;
+
+		/// Has every byte in the stream been added to value()?
+		bool complete() const;
+
+	protected:
+		std::shared_ptr<input> in_parent; ///< Stream supplying the data
+		checksum sum;                     ///< Checksum so far
+		stream::len lenSum;               ///< Number of bytes in sum
+		mutable std::mutex lock;          ///< Protects sum and lenSum
+
+		/// Add any new data in a block that has just been read.
+		void add(stream::pos pos, const uint8_t *buffer, stream::len len);
+};
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_CHECKSUM_HPP_
@@ -21,6 +21,7 @@
 #ifndef _CAMOTO_STREAM_FILE_HPP_
 #define _CAMOTO_STREAM_FILE_HPP_
 
+#include <atomic>
 #include <memory>
 #include <stdio.h>
 #include <camoto/stream.hpp>
@@ -28,12 +29,87 @@
 namespace camoto {
 namespace stream {
 
+/// Default size of the buffer used by each file stream.
+/**
+ * This is large enough that reading or writing a file a few bytes at a time
+ * results in few, large system calls.
+ */
+#define FILE_BUFFER_SIZE (64 * 1024)
+
 /// Get an input stream reading from standard input.
 std::unique_ptr<stream::input> CAMOTO_GAMECOMMON_API open_stdin();
 
 /// Get an output stream writing to standard output.
 std::unique_ptr<stream::output> CAMOTO_GAMECOMMON_API open_stdout();
 
+/// Create a temporary file that is deleted as soon as it is closed.
+/**
+ * The file is created in the system's temporary directory (\c TMPDIR on
+ * POSIX systems), and has no name that other processes can open.
+ *
+ * @return The new, empty file.
+ *
+ * @throw open_error
+ *   The file could not be created.
+ */
+std::unique_ptr<stream::inout> CAMOTO_GAMECOMMON_API open_temp();
+
+/// Convert an errno value into a human-readable message.
+/**
+ * @param errno2
+ *   Value of errno to look up.
+ *
+ * @return Error message suitable for passing to an exception.
+ */
+std::string CAMOTO_GAMECOMMON_API strerror_str(int errno2);
+
+/// Replace one file with another by renaming it.
+/**
+ * The rename is atomic where the OS supports it, so \e to always holds either
+ * its old content or all of \e from, even if the program is interrupted.
+ * Both files must be on the same filesystem.
+ *
+ * @param from
+ *   File to rename.
+ *
+ * @param to
+ *   File to replace.  It is created if it does not already exist.
+ *
+ * @throw write_error
+ *   The file could not be renamed.
+ */
+void CAMOTO_GAMECOMMON_API replace_file(const std::string& from,
+	const std::string& to);
+
+/// Copy data between two local files without going through the stream buffers.
+/**
+ * This is used by stream::copy() when both streams are local files.  On Linux
+ * the data is copied by the kernel with copy_file_range(), otherwise the
+ * files are read and written with pread() and pwrite() using \e buffer.
+ *
+ * @return true if the data was copied, or false if either stream is not a
+ *   seekable local file, in which case nothing has been done and the caller
+ *   must copy the data itself.
+ *
+ * @copydetails stream::copy(output&, input&, uint8_t*, stream::len)
+ */
+bool CAMOTO_GAMECOMMON_API copy_file(output& dest, input& src, uint8_t *buffer,
+	stream::len lenBuffer);
+
+/// Move data within a local file without going through the stream buffer.
+/**
+ * This is used by stream::move() when the stream is a local file, reading and
+ * writing blocks with pread() and pwrite() so no seeks are needed.
+ *
+ * @return true if the data was moved, or false if the stream is not a
+ *   seekable local file, in which case nothing has been done and the caller
+ *   must move the data itself.
+ *
+ * @copydetails stream::move(inout&, pos, pos, len, uint8_t*, stream::len)
+ */
+bool CAMOTO_GAMECOMMON_API move_file(inout& data, pos from, pos to, len len,
+	uint8_t *buffer, stream::len lenBuffer);
+
 /// Exception thrown when a file could not be opened or created.
 class CAMOTO_GAMECOMMON_API open_error: public error
 {
@@ -50,14 +126,88 @@ class CAMOTO_GAMECOMMON_API open_error: public error
 };
 
 /// File stream parts in common with read and write
+/**
+ * The file is accessed directly through its file descriptor, with a single
+ * buffer shared between reading and writing.  Written data is kept in the
+ * buffer until it fills up, the stream moves to a different part of the file,
+ * or flush() is called.  Reads are served from the same buffer, so switching
+ * between reading and writing costs nothing, unlike stdio where every switch
+ * flushes the buffer.
+ */
 class CAMOTO_GAMECOMMON_API file_core
 {
 	protected:
-		FILE *handle;  ///< stdio file handle
-		bool close;    ///< Do we need to close \e handle ?
+		int fd;                 ///< File descriptor
+		bool close;             ///< Do we need to close \e fd ?
+		bool seekable;          ///< Can \e fd be used with pread() and pwrite()?
+		bool sync;              ///< Should flush() wait for the data to hit the disk?
+		stream::pos offset;     ///< Current read/write position
+
+		std::unique_ptr<uint8_t[]> bufferMem; ///< Memory for buffer, plus alignment
+		uint8_t *buffer;        ///< Data from the file around the current position
+		stream::len lenBuffer;  ///< Capacity of \e buffer
+		stream::pos bufStart;   ///< Offset in the file of the first byte in buffer
+		stream::len bufLen;     ///< Number of valid bytes in buffer
+		stream::len dirtyStart; ///< First byte in buffer not yet written to the file
+		stream::len dirtyEnd;   ///< One past last unwritten byte, same as dirtyStart if none
+		stream::len lenDisk;    ///< Size of the file, not counting unwritten data
+
+		/// How the file is being read, as given to input_file::hint().
+		access_pattern pattern;
+
+		/// Offset just past the end of the last read.
+		std::atomic<stream::pos> nextRead;
+
+		/// Number of reads in a row that started where the last one ended.
+		std::atomic<unsigned int> lenRun;
+
+		/// The kernel has been asked to read ahead up to this offset.
+		std::atomic<stream::pos> advisedEnd;
+
+		/// Identifies the current content for input_file::identify().
+		source_tag tag;
 
 		file_core();
 
+		/// Start using an open file descriptor.
+		/**
+		 * @param fd
+		 *   File descriptor to use.
+		 *
+		 * @param close
+		 *   true to close \e fd when the stream is destroyed.
+		 *
+		 * @param lenBuffer
+		 *   Size of the buffer in bytes, or 0 to read and write the file directly
+		 *   every time.  The buffer is aligned to a page boundary, which allows the
+		 *   kernel to copy data into it more efficiently.
+		 */
+		void attach(int fd, bool close, stream::len lenBuffer);
+
+		/// Read from the file, ignoring the buffer.
+		/**
+		 * @return Number of bytes read, which is only less than \e len at EOF.
+		 */
+		stream::len raw_read(stream::pos pos, uint8_t *out, stream::len len) const;
+
+		/// Write to the file, ignoring the buffer.
+		void raw_write(stream::pos pos, const uint8_t *in, stream::len len);
+
+		/// Write out any data waiting in the buffer.
+		/**
+		 * @throw write_error
+		 *   The buffered data could not be written.
+		 */
+		void flush_writes();
+
+		/// Write out and forget the buffered data.
+		/**
+		 * This must be called after the file descriptor has been written to
+		 * without going through raw_write(), so old data isn't returned from the
+		 * buffer.
+		 */
+		void drop_buffer();
+
 		/// Common seek function for reading and writing.
 		/**
 		 * @copydetails input::seekg()
@@ -66,6 +216,24 @@ class CAMOTO_GAMECOMMON_API file_core
 
 		/// Common function for obtaining current seek position.
 		stream::pos tell() const;
+
+		/// Size of the file, including data still in the buffer.
+		stream::len file_size() const;
+
+		/// Keep track of whether the file is being read sequentially.
+		/**
+		 * After a few reads in a row that each start where the last one finished,
+		 * or after a hint that the file will be read sequentially, the kernel is
+		 * told so with posix_fadvise(), and asked to read ahead of the current
+		 * position.
+		 *
+		 * @param pos
+		 *   Offset of the first byte read.
+		 *
+		 * @param len
+		 *   Number of bytes read.
+		 */
+		void track_read(stream::pos pos, stream::len len);
 };
 
 /// Read-only stream to access a local file.
@@ -78,18 +246,57 @@ class CAMOTO_GAMECOMMON_API input_file: virtual public input,
 		 * @param filename
 		 *   Name of file to open.
 		 *
+		 * @param lenBuffer
+		 *   Size of the buffer, or 0 to read the file directly every time.
+		 *
 		 * @throw open_error
 		 *   The file could not be read or does not exist.
 		 */
-		input_file(const std::string& filename);
+		input_file(const std::string& filename,
+			stream::len lenBuffer = FILE_BUFFER_SIZE);
 		virtual ~input_file();
 
 		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
+		/// @copydoc input::async_read_at()
+		/**
+		 * On Linux this uses io_uring where the kernel supports it.
+		 */
+		virtual std::future<stream::len> async_read_at(stream::pos pos,
+			uint8_t *buffer, stream::len len);
 		virtual void seekg(stream::delta off, seek_from from);
 		virtual stream::pos tellg() const;
+		/// @copydoc input::size()
+		/**
+		 * The size is read when the file is opened, and after that only changes
+		 * made through this stream are seen.
+		 */
 		virtual stream::len size() const;
 
+		/// @copydoc input::view()
+		/**
+		 * Pipes and terminals can't be peeked at without losing the data, so for
+		 * these seek_error is thrown before anything is read.
+		 */
+		virtual const uint8_t *view(stream::pos pos, stream::len len,
+			stream::len *got, std::string& scratch);
+
+		/// @copydoc input::hint()
+		/**
+		 * This is passed on to the kernel with posix_fadvise(), where available.
+		 */
+		virtual void hint(access_pattern pattern);
+
+		/// @copydoc input::identify()
+		/**
+		 * Pipes and other files that can't be seeked are not identified.
+		 */
+		virtual bool identify(source_id *id) const;
+
 		friend std::unique_ptr<stream::input> CAMOTO_GAMECOMMON_API open_stdin();
+		friend bool CAMOTO_GAMECOMMON_API copy_file(output& dest, input& src,
+			uint8_t *buffer, stream::len lenBuffer);
 
 	protected:
 		input_file();
@@ -111,22 +318,47 @@ class CAMOTO_GAMECOMMON_API output_file: virtual public output,
 		 *   (create it if it doesn't exist, or truncate/blank out the file if it
 		 *   does exist.)
 		 *
+		 * @param lenBuffer
+		 *   Size of the buffer, or 0 to write the file directly every time.
+		 *
 		 * @throw open_error
 		 *   The file could not be read or does not exist.
 		 */
-		output_file(const std::string& filename, bool create);
+		output_file(const std::string& filename, bool create,
+			stream::len lenBuffer = FILE_BUFFER_SIZE);
 		virtual ~output_file();
 
 		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len);
 		virtual void seekp(stream::delta off, seek_from from);
 		virtual stream::pos tellp() const;
 		virtual void truncate(stream::pos size);
+		virtual void reserve(stream::len len);
+
+		/// @copydoc output::flush()
+		/**
+		 * This writes out the buffered data.  If set_sync() has been turned on,
+		 * it also waits until the operating system has written the data to disk.
+		 */
 		virtual void flush();
 
+		/// Choose whether flush() waits for the data to reach the disk.
+		/**
+		 * @param sync
+		 *   true to call fsync() on every flush(), which is much slower but means
+		 *   the data will survive a power failure.  Defaults to false.
+		 */
+		void set_sync(bool sync);
+
 		/// Delete the file upon close.
 		void remove();
 
 		friend std::unique_ptr<stream::output> CAMOTO_GAMECOMMON_API open_stdout();
+		friend bool CAMOTO_GAMECOMMON_API copy_file(output& dest, input& src,
+			uint8_t *buffer, stream::len lenBuffer);
+		friend bool CAMOTO_GAMECOMMON_API move_file(inout& data, pos from, pos to,
+			len len, uint8_t *buffer, stream::len lenBuffer);
 
 	protected:
 		bool do_remove;        ///< Delete file on close?
@@ -143,8 +375,14 @@ class CAMOTO_GAMECOMMON_API file: virtual public inout,
 	virtual public output_file
 {
 	public:
-		file() = delete;
-		file(const std::string& filename, bool create);
+		/// @copydoc output_file::output_file(const std::string&, bool, stream::len)
+		file(const std::string& filename, bool create,
+			stream::len lenBuffer = FILE_BUFFER_SIZE);
+
+		friend std::unique_ptr<stream::inout> CAMOTO_GAMECOMMON_API open_temp();
+
+	protected:
+		file(); // used by open_temp()
 };
 
 } // namespace stream
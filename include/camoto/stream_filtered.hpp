@@ -23,6 +23,9 @@
 
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <vector>
+#include <camoto/decode_cache.hpp>
 #include <camoto/filter.hpp>
 #include <camoto/stream_string.hpp>
 
@@ -81,6 +84,13 @@ typedef std::function<void(stream::output_filtered*, stream::len)>
 	fn_notify_prefiltered_size;
 
 /// Read-only stream applying a filter to another read-only stream.
+/**
+ * The whole parent is decoded the first time the data is accessed.  If
+ * decode_cache has been enabled, the parent can be identified and the filter
+ * has a signature, the decoded data is shared with any other input_filtered
+ * reading the same data through the same kind of filter, so it only has to be
+ * decoded once.
+ */
 class CAMOTO_GAMECOMMON_API input_filtered: virtual public input_string
 {
 	public:
@@ -99,10 +109,31 @@ class CAMOTO_GAMECOMMON_API input_filtered: virtual public input_string
 		input_filtered(std::shared_ptr<input> parent,
 			std::shared_ptr<filter> read_filter);
 
+		/// Apply a filter to a stream owned by someone else.
+		/**
+		 * This avoids the cost of shared ownership when the parent is known to
+		 * outlive this stream.  get_stream() will return a pointer that does not
+		 * keep the parent alive.
+		 *
+		 * @copydetails input_filtered(std::shared_ptr<input>, std::shared_ptr<filter>)
+		 */
+		input_filtered(input& parent, std::shared_ptr<filter> read_filter);
+
 		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
 		virtual void seekg(stream::delta off, seek_from from);
 		virtual stream::pos tellg() const;
 		virtual stream::len size() const;
+		virtual const uint8_t *view(stream::pos pos, stream::len len,
+			stream::len *got, std::string& scratch);
+		virtual bool cheap_view() const;
+
+		/// @copydoc input::identify()
+		/**
+		 * Decoded data is not identified, so this always returns false.
+		 */
+		virtual bool identify(source_id *id) const;
 
 		/// A partial write is about to occur, ensure the unfiltered data is present.
 		/**
@@ -130,6 +161,222 @@ class CAMOTO_GAMECOMMON_API input_filtered: virtual public input_string
 
 		/// Has the input data been run through the filter yet?
 		bool populated;
+
+		/// Stops concurrent try_read_at() calls populating the data twice
+		std::mutex lock_populate;
+
+		/// Decoded data shared through decode_cache, used instead of this->data.
+		decode_cache::content shared;
+
+		/// Can the decoded data be shared?  Not for read/write streams, as their
+		/// data is changed in place.
+		bool shareable;
+
+		/// Copy from the shared data.
+		stream::len readShared(stream::pos pos, uint8_t *buffer, stream::len len)
+			const;
+};
+
+/// Saved filter states, allowing a filtered stream to seek quickly.
+/**
+ * When attached to an input_filtered_streaming, the filter's state is saved
+ * every \e interval bytes of decoded data.  Seeking can then resume decoding
+ * from the nearest checkpoint before the target, instead of from the start of
+ * the data.
+ *
+ * The index can be written to a stream and loaded again later (e.g. cached
+ * next to an archive), so that the data does not need to be decoded once
+ * just to fill in the checkpoints.  It is only valid for the same parent data
+ * and a filter constructed with the same parameters.
+ */
+class CAMOTO_GAMECOMMON_API checkpoint_index
+{
+	public:
+		/// One place where decoding can resume.
+		struct checkpoint {
+			stream::pos decoded; ///< Offset of the next byte in the filtered data
+			stream::pos parent;  ///< Offset of the next unread byte in the parent
+			std::string state;   ///< Filter state from filter::save_state()
+		};
+
+		/// Create an empty index.
+		/**
+		 * @param interval
+		 *   Number of decoded bytes between checkpoints.  Smaller values make
+		 *   seeking faster, at the cost of a larger index.
+		 */
+		checkpoint_index(stream::len interval);
+
+		/// Number of decoded bytes between checkpoints.
+		stream::len interval() const;
+
+		/// Number of checkpoints in the index.
+		std::size_t size() const;
+
+		/// Find the checkpoint closest to the given offset.
+		/**
+		 * @param decoded
+		 *   Offset in the filtered data.
+		 *
+		 * @return The last checkpoint at or before \e decoded, or nullptr if
+		 *   there are none.
+		 */
+		const checkpoint *find(stream::pos decoded) const;
+
+		/// Is the given offset far enough from the others to deserve a checkpoint?
+		bool wanted(stream::pos decoded) const;
+
+		/// Add a checkpoint, replacing any existing one at the same offset.
+		void add(checkpoint c);
+
+		/// Remove all the checkpoints.
+		void clear();
+
+		/// Write the index to a stream.
+		void write(stream::output& s) const;
+
+		/// Replace the index with one previously written by write().
+		/**
+		 * @throw stream::read_error
+		 *   The saved index is truncated or invalid.
+		 */
+		void read(stream::input& s);
+
+	protected:
+		stream::len lenInterval;        ///< Decoded bytes between checkpoints
+		std::vector<checkpoint> points; ///< Checkpoints in order of offset
+};
+
+/// Read-only stream applying a filter to another stream on demand.
+/**
+ * Unlike input_filtered, which runs the entire parent stream through the
+ * filter the first time it is accessed, this stream only runs the filter as
+ * far as the data that has been read so far.  Decoded data is held in a
+ * bounded buffer, so memory usage does not depend on the size of the data.
+ *
+ * Seeking forward decodes and discards the data in between.  Seeking backward
+ * past the start of the buffer resets the filter and decodes from the start of
+ * the parent stream again, so streams that are read backwards should use
+ * input_filtered instead.
+ *
+ * If the size of the decoded data is not supplied, calling size() or seeking
+ * relative to the end of the stream will decode the whole stream once in
+ * order to find out.
+ */
+class CAMOTO_GAMECOMMON_API input_filtered_streaming: virtual public input
+{
+	public:
+		/// Apply a filter to the given stream.
+		/**
+		 * @param parent
+		 *   Parent stream supplying the data.
+		 *
+		 * @param read_filter
+		 *   Filter to process data.
+		 */
+		input_filtered_streaming(std::shared_ptr<input> parent,
+			std::shared_ptr<filter> read_filter);
+
+		/// Apply a filter to the given stream, where the decoded size is known.
+		/**
+		 * @param parent
+		 *   Parent stream supplying the data.
+		 *
+		 * @param read_filter
+		 *   Filter to process data.
+		 *
+		 * @param lenDecoded
+		 *   Size of the data once it has been through the filter, usually taken
+		 *   from an archive's file table.  This is returned by size() without
+		 *   having to decode anything.
+		 */
+		input_filtered_streaming(std::shared_ptr<input> parent,
+			std::shared_ptr<filter> read_filter, stream::len lenDecoded);
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+		virtual stream::len size_hint() const;
+		virtual const uint8_t *view(stream::pos pos, stream::len len,
+			stream::len *got, std::string& scratch);
+		virtual bool cheap_view() const;
+
+		/// Get the parent stream.
+		std::shared_ptr<input> get_stream();
+
+		/// Save the filter's state as the data is decoded, to speed up seeking.
+		/**
+		 * The index is filled in as the data is decoded, and used by seekg() to
+		 * resume decoding from the nearest checkpoint.  Existing checkpoints,
+		 * such as ones loaded with checkpoint_index::read(), are used straight
+		 * away.
+		 *
+		 * The parent stream must be seekable.  If the filter does not support
+		 * filter::save_state(), no checkpoints are added.
+		 *
+		 * @param index
+		 *   Index to use, or nullptr to stop using checkpoints.
+		 */
+		void set_checkpoints(std::shared_ptr<checkpoint_index> index);
+
+	protected:
+		/// Parent stream for reading
+		std::shared_ptr<input> in_parent;
+
+		/// Filter to pass data through
+		std::shared_ptr<filter> read_filter;
+
+		/// Saved filter states, or nullptr if not in use
+		std::shared_ptr<checkpoint_index> checkpoints;
+
+		std::vector<uint8_t> bufIn;  ///< Data read from parent but not yet filtered
+		stream::len lenBufIn;        ///< Number of valid bytes in bufIn
+		std::vector<uint8_t> window; ///< Most recently decoded data
+		stream::pos winStart;        ///< Decoded offset of window[0]
+		stream::len winLen;          ///< Number of valid bytes in window
+		stream::pos decodedPos;      ///< Number of bytes the filter has produced
+		stream::pos posParent;       ///< Number of bytes read from the parent
+		stream::pos offset;          ///< Current read position
+		bool started;                ///< Has the filter been reset yet?
+		bool filterEOF;              ///< Has the filter signalled the end of data?
+		bool knownSize;              ///< Is lenDecoded valid?
+		stream::len lenDecoded;      ///< Size of the decoded data, if knownSize
+
+		/// Set the filter back to the start of the parent stream.
+		void restart();
+
+		/// Set the filter back to a saved checkpoint.
+		void resume(const checkpoint_index::checkpoint& c);
+
+		/// Move the filter to the best place to start decoding the given offset.
+		/**
+		 * This restarts the filter or resumes it from a checkpoint when the
+		 * target is behind the data decoded so far, or when there is a
+		 * checkpoint between the data decoded so far and the target.
+		 */
+		void rewindFor(stream::pos target);
+
+		/// Add a checkpoint for the current position to the index.
+		void saveCheckpoint();
+
+		/// Run the filter until some output has been produced.
+		/**
+		 * @param out
+		 *   Buffer to hold the output.
+		 *
+		 * @param lenOut
+		 *   Size of \e out.  Must be at least BUFFER_SIZE.
+		 *
+		 * @return Number of bytes written to \e out, only 0 at EOF.
+		 */
+		stream::len decode(uint8_t *out, stream::len lenOut);
+
+		/// Decode data into the window until it contains the given offset.
+		/**
+		 * @return true if the offset was reached, false if EOF came first.
+		 */
+		bool skipTo(stream::pos target);
 };
 
 /// Write-only stream applying a filter to another write-only stream.
@@ -161,10 +408,25 @@ class CAMOTO_GAMECOMMON_API output_filtered: virtual public output_string
 		virtual ~output_filtered();
 
 		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len);
 		virtual void seekp(stream::delta off, seek_from from);
 		virtual stream::pos tellp() const;
 		virtual void flush();
 
+		/// Work out how big the data will be once flush() has filtered it.
+		/**
+		 * This runs the filter with filter::measure(), so nothing is buffered or
+		 * written to the parent stream.  It lets a caller find out how much
+		 * space the filtered data will need before deciding where to put it.
+		 *
+		 * @return Number of bytes flush() would write to the parent.
+		 *
+		 * @throw write_error
+		 *   The filter could not process the data.
+		 */
+		stream::len filtered_size() const;
+
 		/// A partial write is about to occur, ensure the unfiltered data is present.
 		/**
 		 * When opening a read/write stream, the data is not populated
@@ -196,6 +458,134 @@ class CAMOTO_GAMECOMMON_API output_filtered: virtual public output_string
 		bool need_flush;
 };
 
+/// Work out how big some data would be after filtering, without storing it.
+/**
+ * The whole of \e content is read from the start and passed through
+ * filter::measure(), after resetting the filter.  Only one block of input is
+ * held in memory at a time, so this can size large data, or plan where a
+ * number of filtered files will go, without needing any output buffers.
+ *
+ * @param f
+ *   Filter to use.  It is left in an undefined state, and must be reset
+ *   before it is used again.
+ *
+ * @param content
+ *   Unfiltered data.  The read pointer is left at the end of the data.
+ *
+ * @return Number of bytes the filter would produce.
+ *
+ * @throw filter_error
+ *   The filter could not process the data.
+ */
+CAMOTO_GAMECOMMON_API stream::len filtered_size(filter& f, input& content);
+
+/// Write-only stream passing data through a filter as it is written.
+/**
+ * Unlike output_filtered, which keeps everything written in memory until
+ * flush() is called, this stream passes the data to the filter in blocks of
+ * BUFFER_SIZE as soon as enough has been written, and writes the filtered
+ * data straight to the parent stream.  Memory usage therefore does not depend
+ * on the size of the data.
+ *
+ * Only sequential writes are possible, from the start of the stream to the
+ * end.  Seeking anywhere other than the current write position throws
+ * seek_error.
+ *
+ * The filtered data is written to the parent from its current position, so
+ * the parent must be able to grow as needed (e.g. a file or string, rather
+ * than a fixed-size substream).  On flush() the last of the data is passed
+ * through the filter, the parent is truncated to the amount written (unless
+ * it can't seek, e.g. stdout), and the prefiltered size callback is notified.
+ * Once flushed no more data can be written.
+ */
+class CAMOTO_GAMECOMMON_API output_filtered_streaming: virtual public output
+{
+	public:
+		/// Apply a filter to the given stream.
+		/**
+		 * The filter is reset with an input length of zero, as the amount of
+		 * data to come is unknown.  Filters that need the real length up front
+		 * (e.g. to write it into a header) must use the other constructor.
+		 *
+		 * @param parent
+		 *   Parent stream to write the processed data to.
+		 *
+		 * @param write_filter
+		 *   Filter to process data.
+		 *
+		 * @param resize
+		 *   Notification function called during flush() with the number of
+		 *   bytes written to this stream.  Can be NULL.  As this is not an
+		 *   output_filtered, the first parameter passed to it is always NULL.
+		 */
+		output_filtered_streaming(std::shared_ptr<output> parent,
+			std::shared_ptr<filter> write_filter, fn_notify_prefiltered_size resize);
+
+		/// Apply a filter to the given stream, where the final size is known.
+		/**
+		 * @param parent
+		 *   Parent stream to write the processed data to.
+		 *
+		 * @param write_filter
+		 *   Filter to process data.
+		 *
+		 * @param resize
+		 *   Notification function called during flush() with the number of
+		 *   bytes written to this stream.  Can be NULL.  As this is not an
+		 *   output_filtered, the first parameter passed to it is always NULL.
+		 *
+		 * @param lenInput
+		 *   Number of bytes that will be written to this stream, passed to
+		 *   filter::reset().
+		 */
+		output_filtered_streaming(std::shared_ptr<output> parent,
+			std::shared_ptr<filter> write_filter, fn_notify_prefiltered_size resize,
+			stream::len lenInput);
+
+		virtual ~output_filtered_streaming();
+
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual void seekp(stream::delta off, seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::pos size);
+		virtual void flush();
+
+		/// Get the parent stream.
+		std::shared_ptr<output> get_stream();
+
+	protected:
+		/// Parent stream for writing
+		std::shared_ptr<output> out_parent;
+
+		/// Filter to pass data through
+		std::shared_ptr<filter> write_filter;
+
+		/// Size-change notification callback
+		fn_notify_prefiltered_size fn_set_orig_size;
+
+		std::vector<uint8_t> bufIn;  ///< Data written but not yet filtered
+		stream::len lenBufIn;        ///< Number of valid bytes in bufIn
+		std::vector<uint8_t> bufOut; ///< Filtered data on its way to the parent
+		stream::len lenInput;        ///< Value passed to filter::reset()
+		stream::pos offset;          ///< Number of bytes written to this stream
+		stream::len lenFiltered;     ///< Number of bytes written to the parent
+		bool started;                ///< Has the filter been reset yet?
+		bool finished;               ///< Has flush() been called?
+		bool seekable;               ///< Can the parent seek (and so truncate)?
+
+		/// Reset the filter, ready for the first block of data.
+		void start();
+
+		/// Pass the data in bufIn through the filter.
+		/**
+		 * @param final
+		 *   false to keep filtering until less than a full block remains in
+		 *   bufIn, true to keep going until the filter signals the end of the
+		 *   data.
+		 */
+		void process(bool final);
+};
+
 /// Read/write stream applying a filter to another read/write stream.
 class CAMOTO_GAMECOMMON_API filtered:
 	virtual public inout,
@@ -0,0 +1,240 @@
+/**
+ * @file  camoto/stream_mmap.hpp
+ * @brief Stream implementation for accessing memory-mapped local files.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_MMAP_HPP_
+#define _CAMOTO_STREAM_MMAP_HPP_
+
+#include <string>
+#include <camoto/stream.hpp>
+#include <camoto/stream_file.hpp> // open_error
+
+namespace camoto {
+namespace stream {
+
+/// Memory-mapped file parts in common with read and write.
+class CAMOTO_GAMECOMMON_API mmap_core
+{
+	protected:
+		uint8_t *base;         ///< Start of mapped memory, or NULL if empty
+		stream::len length;    ///< Size of the data in the file
+		stream::len lenMapped; ///< Size of the file on disk and mapped region
+		stream::pos offset;    ///< Current read/write position
+		bool writable;         ///< Was the file mapped read/write?
+#ifdef _WIN32
+		void *hFile;           ///< Win32 file HANDLE
+		void *hMapping;        ///< Win32 file mapping HANDLE
+#else
+		int fd;                ///< POSIX file descriptor
+#endif
+		source_tag tag;        ///< Identifies the current content for identify()
+
+		mmap_core();
+		~mmap_core();
+
+		/// Open the file and map it into memory.
+		/**
+		 * @param filename
+		 *   Name of file to open.
+		 *
+		 * @param write
+		 *   true to map the file read/write, false for read-only.
+		 *
+		 * @param create
+		 *   true to create the file or truncate an existing one.  Only valid when
+		 *   write is true.
+		 *
+		 * @throw open_error
+		 *   The file could not be opened or mapped.
+		 */
+		void open(const std::string& filename, bool write, bool create);
+
+		/// Change the size of the underlying file and map it again.
+		/**
+		 * Any pointers previously returned by data() are invalidated.
+		 *
+		 * @param newLength
+		 *   New size of the file, in bytes.
+		 *
+		 * @throw write_error
+		 *   The file could not be resized or mapped again.
+		 */
+		void resize(stream::len newLength);
+
+		/// Make the data longer, growing the file and mapping if needed.
+		/**
+		 * The file is grown to at least double its size each time, so a series
+		 * of appends only maps the file again a few times.  The extra space is
+		 * cut off again by trim().  Any pointers previously returned by data()
+		 * are invalidated if the file has to grow.
+		 *
+		 * @param newLength
+		 *   New size of the data, in bytes.  Must not be less than length.
+		 *
+		 * @throw write_error
+		 *   The file could not be resized or mapped again.
+		 */
+		void grow(stream::len newLength);
+
+		/// Cut off any space left at the end of the file by grow().
+		/**
+		 * Any pointers previously returned by data() are invalidated if there
+		 * was space to cut off.
+		 *
+		 * @throw write_error
+		 *   The file could not be resized or mapped again.
+		 */
+		void trim();
+
+		/// Resize the file and map it again, leaving length alone.
+		/**
+		 * If the new mapping can't be made, the file is put back to its old size
+		 * and mapping if possible, and length is cut down to fit.
+		 *
+		 * @param newMapped
+		 *   New size of the file and mapping, in bytes.
+		 *
+		 * @throw write_error
+		 *   The file could not be resized or mapped again.
+		 */
+		void remap(stream::len newMapped);
+
+		/// Set the size of the file on disk, which must not be mapped.
+		/**
+		 * @param newSize
+		 *   New size of the file, in bytes.
+		 *
+		 * @throw write_error
+		 *   The file could not be resized.
+		 */
+		void setFileSize(stream::len newSize);
+
+		/// Map lenMapped bytes of the file into memory.
+		void map();
+
+		/// Release the mapping, but leave the file open.
+		void unmap();
+
+		/// Common seek function for reading and writing.
+		/**
+		 * @copydetails input::seekg()
+		 */
+		void seek(stream::delta off, seek_from from);
+};
+
+/// Read-only stream accessing a local file through a memory mapping.
+/**
+ * The file is mapped once when it is opened, so reads are a plain memcpy()
+ * and seeks never make a system call.  Callers that only need to inspect the
+ * data can use data() to access it directly without copying at all.
+ *
+ * Changes made to the size of the file by other processes after it has been
+ * opened are not seen.
+ */
+class CAMOTO_GAMECOMMON_API input_mmap: virtual public input,
+	virtual protected mmap_core
+{
+	public:
+		/// Open an existing file.
+		/**
+		 * @param filename
+		 *   Name of file to open.
+		 *
+		 * @throw open_error
+		 *   The file could not be read, does not exist, or could not be mapped.
+		 */
+		input_mmap(const std::string& filename);
+		virtual ~input_mmap();
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+		virtual const uint8_t *view(stream::pos pos, stream::len len,
+			stream::len *got, std::string& scratch);
+		virtual bool cheap_view() const;
+		virtual bool identify(source_id *id) const;
+
+		/// Direct access to the file content.
+		/**
+		 * @return Pointer to the first byte in the file, valid for size() bytes.
+		 *   May be NULL if the file is empty.  The pointer remains valid until
+		 *   the stream is destroyed or (for read/write streams) resized.
+		 */
+		const uint8_t *data() const;
+
+	protected:
+		input_mmap();
+};
+
+/// Read/write stream accessing a local file through a memory mapping.
+/**
+ * Writing past the end of the file, or truncating it, changes the size of the
+ * underlying file and maps it again, which invalidates any pointers returned
+ * by data().  When writing past the end the file is grown by more than is
+ * needed, so that appending doesn't have to map it again every time, and the
+ * extra space is cut off again by flush() or when the stream is destroyed.
+ * flush() can therefore invalidate pointers from data() as well.
+ */
+class CAMOTO_GAMECOMMON_API mmap: virtual public inout,
+	virtual public input_mmap
+{
+	public:
+		mmap() = delete;
+
+		/// Open an existing file, create a new file, or overwrite (blank out) an
+		/// existing one.
+		/**
+		 * @param filename
+		 *   Name of file to open.
+		 *
+		 * @param create
+		 *   false to open an existing file for read/write, true to create the file
+		 *   (create it if it doesn't exist, or truncate/blank out the file if it
+		 *   does exist.)
+		 *
+		 * @throw open_error
+		 *   The file could not be opened or mapped.
+		 */
+		mmap(const std::string& filename, bool create);
+		virtual ~mmap();
+
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len);
+		virtual void seekp(stream::delta off, seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::pos size);
+		virtual void flush();
+
+		using input_mmap::data;
+
+		/// Direct read/write access to the file content.
+		/**
+		 * @copydetails input_mmap::data()
+		 */
+		uint8_t *data();
+};
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_MMAP_HPP_
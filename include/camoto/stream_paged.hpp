@@ -0,0 +1,179 @@
+/**
+ * @file  camoto/stream_paged.hpp
+ * @brief In-memory stream with cheap copy-on-write snapshots.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_PAGED_HPP_
+#define _CAMOTO_STREAM_PAGED_HPP_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Size of each block of data held by a stream::paged, in bytes.
+#define PAGED_PAGE_SIZE 65536
+
+/// Read/write in-memory stream that can take snapshots of itself.
+/**
+ * This can be used anywhere a stream::string would be, but the data is held
+ * in fixed-size pages instead of one contiguous string.  snapshot() makes a
+ * copy of the stream that shares all of its pages, so it costs the same no
+ * matter how large the stream is.  A page is only copied when it is written
+ * to while shared, so keeping many snapshots (e.g. as undo states) only uses
+ * memory for the parts that actually changed.
+ *
+ * Pages that have never been written to, such as those added by enlarging the
+ * stream with truncate(), take up no memory at all.
+ *
+ * Each stream, snapshot or not, must only be used by one thread at a time, but
+ * a snapshot can be handed to another thread and used there while the
+ * original continues to be modified.
+ *
+ * @code
+ * stream::paged level(content);
+ * std::vector<std::unique_ptr<stream::paged>> undo;
+ * undo.push_back(level.snapshot());
+ * level.seekp(100, stream::start);
+ * level.write(...);
+ * // Undo the write
+ * level.restore(*undo.back());
+ * @endcode
+ */
+class CAMOTO_GAMECOMMON_API paged: virtual public inout
+{
+	public:
+		/// Create an empty stream.
+		paged();
+
+		/// Create a stream holding a copy of the given data.
+		/**
+		 * @param content
+		 *   Initial content of the stream.
+		 */
+		paged(const std::string& content);
+
+		virtual ~paged();
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+
+		/// @copydoc input::view()
+		/**
+		 * A pointer into the stream's own storage is returned as long as the
+		 * requested data does not cross from one page to the next.  Otherwise
+		 * the data is copied into a buffer.
+		 */
+		virtual const uint8_t *view(stream::pos pos, stream::len len,
+			stream::len *got, std::string& scratch);
+		virtual bool cheap_view() const;
+
+		virtual bool identify(source_id *id) const;
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len);
+		virtual void seekp(stream::delta off, seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::pos size);
+		virtual void flush();
+
+		/// Make a copy of the stream without copying its data.
+		/**
+		 * The new stream has the same content as this one, and from then on the
+		 * two can be changed independently.  The copy's pointer starts at
+		 * offset 0.
+		 *
+		 * @return A new stream sharing this stream's pages.
+		 */
+		std::unique_ptr<paged> snapshot() const;
+
+		/// Replace the content of this stream with that of another.
+		/**
+		 * Like snapshot(), this shares the pages of \e from rather than copying
+		 * them, so it can be used to cheaply go back to an earlier snapshot.  The
+		 * pointer is moved back to the end of the stream if it would otherwise
+		 * be past it.
+		 *
+		 * @param from
+		 *   Stream to take the content from, usually one returned by snapshot().
+		 */
+		void restore(const paged& from);
+
+		/// Number of bytes of memory holding the stream's data.
+		/**
+		 * This includes pages shared with snapshots, so adding this up over a
+		 * stream and its snapshots will count some pages more than once.  The
+		 * totals returned by memory::snapshot() count each page only once.
+		 */
+		stream::len buffered_bytes() const;
+
+	protected:
+		/// One block of data, always PAGED_PAGE_SIZE bytes long.
+		typedef std::vector<uint8_t> page;
+
+		/// Every page in the stream, in order.  NULL entries are all zeroes.
+		typedef std::vector<std::shared_ptr<page> > page_table;
+
+		std::shared_ptr<page_table> pages; ///< Content, shared with snapshots
+		stream::len length;                ///< Size of the stream
+		stream::pos offset;                ///< Current pointer position
+		source_tag tag;                    ///< Identifies the current content
+
+		/// Get the page table so it can be changed.
+		/**
+		 * The table is copied first if a snapshot is still using it.
+		 */
+		page_table& table();
+
+		/// Get a page so it can be written to.
+		/**
+		 * The page is copied first if a snapshot is still using it, or allocated
+		 * if it has not been written to before.
+		 *
+		 * @param index
+		 *   Page number.  Must already be in the page table.
+		 *
+		 * @return Pointer to the start of the page.
+		 */
+		uint8_t *writable(std::size_t index);
+
+		/// Allocate a page, counting it in the memory totals until it is freed.
+		/**
+		 * @param copy
+		 *   Page to copy the content from, or NULL to fill the page with zeroes.
+		 */
+		static std::shared_ptr<page> newPage(const page *copy);
+
+		/// Common seek function for reading and writing.
+		/**
+		 * @copydetails input::seekg()
+		 */
+		void seek(stream::delta off, seek_from from);
+};
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_PAGED_HPP_
@@ -0,0 +1,291 @@
+/**
+ * @file  camoto/stream_reader.hpp
+ * @brief Fast parsing of values from a stream without a call per value.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_READER_HPP_
+#define _CAMOTO_STREAM_READER_HPP_
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <camoto/iostream_helpers.hpp>
+#include <camoto/stream.hpp>
+#include <camoto/stream_mmap.hpp>
+#include <camoto/stream_string.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Amount of data a reader gets from the stream at a time, in bytes.
+#define READER_WINDOW_SIZE 4096
+
+/// Whether a stream class holds all its data in one block of memory.
+/**
+ * For these streams, view() returns a pointer straight into the stream's
+ * storage, so a reader can take the whole stream at once instead of a window
+ * at a time.
+ */
+template <class S>
+struct is_contiguous: std::false_type { };
+
+template <> struct is_contiguous<input_string>: std::true_type { };
+template <> struct is_contiguous<string>: std::true_type { };
+template <> struct is_contiguous<input_span>: std::true_type { };
+template <> struct is_contiguous<input_mmap>: std::true_type { };
+template <> struct is_contiguous<mmap>: std::true_type { };
+
+/// Read values from a stream without going through it for each one.
+/**
+ * Reading a value with operator >> on a stream::input makes at least one
+ * virtual call, and usually a bounds check and memcpy() out of line as well.
+ * This is fine for reading a header, but adds up when parsing a table of
+ * thousands of small records.
+ *
+ * A reader gets a block of data from the stream with view() and then hands
+ * out values from that block with inline code, only going back to the stream
+ * when the block runs out.  If the stream's type is known to keep its data in
+ * memory (see is_contiguous) the whole stream is viewed at once, so no copy is
+ * made at all.
+ *
+ * The stream's read pointer is moved to the reader's position when the reader
+ * is destroyed or sync() is called.  The stream must not be written to,
+ * seeked, or read from by anything else while the reader is in use.
+ *
+ * @code
+ * stream::string content(...);
+ * stream::reader<stream::string> r(content);
+ * for (unsigned int i = 0; i < count; i++) {
+ *   r >> u32le(entry[i].offset) >> u16le(entry[i].size);
+ * }
+ * @endcode
+ *
+ * @tparam S
+ *   Type of stream to read from.  Using the most derived type lets
+ *   is_contiguous pick the fastest way of accessing the data.
+ */
+template <class S>
+class reader
+{
+	public:
+		/// Start reading at the stream's current read position.
+		/**
+		 * @param s
+		 *   Stream to read from.  It must stay valid for as long as the reader is
+		 *   in use.
+		 */
+		reader(S& s)
+			:	s(s),
+				start(s.tellg()),
+				buf(nullptr),
+				cur(nullptr),
+				end(nullptr)
+		{
+		}
+
+		// Copies would point into each other's scratch buffer
+		reader(const reader&) = delete;
+		reader& operator=(const reader&) = delete;
+
+		/// Move the stream's read pointer to where the reader got up to.
+		~reader()
+		{
+			try {
+				this->sync();
+			} catch (const stream::error&) {
+				// Nothing can be done about this here
+			}
+		}
+
+		/// Get the next \e len bytes and move past them.
+		/**
+		 * @param len
+		 *   Number of bytes needed.
+		 *
+		 * @return Pointer to \e len bytes of data, valid until the next call to
+		 *   any function of the reader.
+		 *
+		 * @throw incomplete_read
+		 *   There are fewer than \e len bytes left in the stream.  The position is
+		 *   not changed.
+		 */
+		const uint8_t *take(stream::len len)
+		{
+			if (((stream::len)(this->end - this->cur) < len) && !this->fill(len)) {
+				throw incomplete_read(this->end - this->cur);
+			}
+			const uint8_t *p = this->cur;
+			this->cur += len;
+			return p;
+		}
+
+		/// Copy data out of the stream.
+		/**
+		 * @param buffer
+		 *   Destination, with room for at least \e len bytes.
+		 *
+		 * @param len
+		 *   Number of bytes to read.
+		 *
+		 * @throw incomplete_read
+		 *   EOF was reached before \e len bytes could be read.  Any data before
+		 *   EOF has been copied into \e buffer and moved past.
+		 */
+		void read(uint8_t *buffer, stream::len len)
+		{
+			stream::len done = 0;
+			while (done < len) {
+				if ((this->cur == this->end) && !this->fill(1)) {
+					throw incomplete_read(done);
+				}
+				stream::len chunk = std::min<stream::len>(this->end - this->cur,
+					len - done);
+				memcpy(buffer + done, this->cur, chunk);
+				this->cur += chunk;
+				done += chunk;
+			}
+			return;
+		}
+
+		/// Current position in the stream.
+		stream::pos tell() const
+		{
+			return this->start + (this->cur - this->buf);
+		}
+
+		/// Move to a different position in the stream.
+		/**
+		 * Seeking within the data already viewed does not touch the stream.
+		 *
+		 * @param pos
+		 *   New position, relative to the start of the stream.
+		 */
+		void seek(stream::pos pos)
+		{
+			if ((pos >= this->start)
+				&& (pos <= this->start + (this->end - this->buf))
+			) {
+				this->cur = this->buf + (pos - this->start);
+				return;
+			}
+			this->start = pos;
+			this->buf = this->cur = this->end = nullptr;
+			return;
+		}
+
+		/// Move past some data without reading it.
+		void skip(stream::len len)
+		{
+			this->seek(this->tell() + len);
+			return;
+		}
+
+		/// Move the stream's read pointer to the reader's position.
+		/**
+		 * @throw seek_error
+		 *   The reader was moved past the end of the stream with seek().
+		 */
+		void sync()
+		{
+			this->s.seekg(this->tell(), stream::start);
+			return;
+		}
+
+	protected:
+		S& s;                ///< Stream supplying the data
+		stream::pos start;   ///< Stream offset of buf[0]
+		const uint8_t *buf;  ///< Data returned by the last view()
+		const uint8_t *cur;  ///< Next byte to hand out
+		const uint8_t *end;  ///< One past the last byte in buf
+		std::string scratch; ///< Copy of the data, if view() can't point at it
+
+		/// Get a new block of data from the stream, starting at the position.
+		/**
+		 * @param len
+		 *   Number of bytes needed.
+		 *
+		 * @return true if at least \e len bytes are now available, false if EOF
+		 *   was reached first.
+		 */
+		bool fill(stream::len len)
+		{
+			stream::pos pos = this->tell();
+			stream::len size = this->s.size();
+			if (pos > size) return false;
+			stream::len want = size - pos;
+			if (!is_contiguous<S>::value) {
+				want = std::min<stream::len>(want,
+					std::max<stream::len>(len, READER_WINDOW_SIZE));
+			}
+			stream::len got;
+			this->buf = this->cur = this->s.view(pos, want, &got, this->scratch);
+			this->end = this->buf + got;
+			this->start = pos;
+			return got >= len;
+		}
+};
+
+/// Read a number_format value, such as u16le(), from a reader.
+template <class S, typename F>
+inline auto operator >> (reader<S>& r, const F& f)
+	-> decltype(f.decode((const uint8_t *)nullptr), r)
+{
+	f.decode(r.take(F::length));
+	return r;
+}
+
+} // namespace stream
+
+/// Read a number of fields from a reader in one go.
+/**
+ * @see read_packed(stream::input&, const F&, const R&...)
+ */
+template <class S, typename F, typename... R>
+inline void read_packed(stream::reader<S>& s, const F& f, const R&... r)
+{
+	decode_packed(s.take(packed_length<F, R...>::value), f, r...);
+	return;
+}
+
+/// Read an array of numbers from a reader, converting them to host byte order.
+/**
+ * @see read_array(stream::input&, T *, std::size_t)
+ */
+template <typename T, typename E, class S>
+inline void read_array(stream::reader<S>& s, T *data, std::size_t n)
+{
+	s.read((uint8_t *)data, n * sizeof(T));
+	host_from_array<T, E>(data, n);
+	return;
+}
+
+/// Read an array of numbers from a reader into a vector.
+template <typename T, typename E, class S>
+inline void read_array(stream::reader<S>& s, std::vector<T>& data,
+	std::size_t n)
+{
+	data.resize(n);
+	if (n) read_array<T, E>(s, data.data(), n);
+	return;
+}
+
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_READER_HPP_
@@ -25,6 +25,7 @@
 
 #include <memory>
 #include <vector>
+#include <camoto/memory.hpp>
 #include <camoto/stream.hpp>
 
 namespace camoto {
@@ -39,6 +40,15 @@ class seg;
  * the underlying stream is only partially modified before flush() is called,
  * which performs the "heavy lifting" of relocating the data as necessary.
  *
+ * Internally the stream is a piece table, a list of extents that each refer
+ * to part of the parent stream or to newly inserted data.  The list is kept in
+ * a balanced tree, so seeking, reading, inserting and removing only take
+ * logarithmic time in the number of edits made since the last flush.
+ *
+ * Inserted data is held in memory until flush() is called.  When inserting
+ * large amounts of data, set_memory_budget() can be used to limit this, with
+ * any further inserts kept in a temporary file instead.
+ *
  * @see insert() and remove()
  */
 class CAMOTO_GAMECOMMON_API seg: virtual public inout
@@ -53,15 +63,26 @@ class CAMOTO_GAMECOMMON_API seg: virtual public inout
 		virtual ~seg();
 
 		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
 		virtual void seekg(stream::delta off, seek_from from);
 		virtual stream::pos tellg() const;
 		virtual stream::len size() const;
 		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len);
 		virtual void seekp(stream::delta off, seek_from from);
 		virtual stream::pos tellp() const;
 		virtual void truncate(stream::pos size);
 		virtual void flush();
 
+		/// @copydoc input::identify()
+		/**
+		 * Pending changes are part of the content, so the data is identified as
+		 * the segstream's own rather than as part of the parent's.
+		 */
+		virtual bool identify(source_id *id) const;
+
 		/// Insert a block of data at the pointer.
 		/**
 		 * The rest of the data is shifted forward, out of the way.  Seek position
@@ -106,46 +127,168 @@ class CAMOTO_GAMECOMMON_API seg: virtual public inout
 		 */
 		void remove(stream::len lenRemove);
 
+		/// Limit how much inserted data is held in memory.
+		/**
+		 * Once this much data is waiting to be written by flush(), each further
+		 * insert() puts its block in a temporary file instead, which is deleted
+		 * after the next flush().  Data already inserted stays where it is, so
+		 * access to data held in memory is not affected.
+		 *
+		 * @param bytes
+		 *   Most inserted data to hold in memory.  Defaults to no limit.
+		 */
+		void set_memory_budget(stream::len bytes);
+
+		/// Number of bytes of memory holding inserted data.
+		/**
+		 * This is data waiting to be written by flush(), not counting any that
+		 * went into the spill file.  The same amount is included in the totals
+		 * returned by memory::snapshot().
+		 */
+		stream::len buffered_bytes() const;
+
 	protected:
-		seg();
+		/// Where the data described by an extent is stored.
+		enum class source {
+			parent,  ///< Data is in the parent stream
+			added,   ///< Data is in seg::added, and has not been committed yet
+			spilled, ///< Data is in seg::spill, and has not been committed yet
+		};
+
+		/// One node in the piece table.
+		/**
+		 * Each node describes one contiguous run of data (an extent) and the nodes
+		 * are kept in a treap, ordered by their position in the segstream.  Every
+		 * node also stores the total length of all the extents in its subtree, so
+		 * the extent at any offset can be found by descending a single path from
+		 * the root, and the tree can be split or joined at any offset in
+		 * logarithmic time.
+		 */
+		struct extent {
+			source src;                   ///< Where the data is stored
+			stream::pos off;              ///< Offset of the data in src
+			stream::len len;              ///< Length of this extent, never zero
+			stream::len lenTree;          ///< Length of this extent and all children
+			unsigned int priority;        ///< Random heap order to keep tree balanced
+			std::unique_ptr<extent> left; ///< Extents before this one
+			std::unique_ptr<extent> right;///< Extents after this one
+		};
 
 		std::shared_ptr<inout> parent;      ///< Parent stream
-		stream::pos off_parent;             ///< Offset into parent stream
-		stream::pos off_endparent;          ///< Offset of vcSecond
-		std::vector<uint8_t> vcSecond;      ///< Data to place after parent stream
-		std::unique_ptr<seg> psegThird;     ///< Data to place after vcSecond
+		std::unique_ptr<extent> root;       ///< Piece table, NULL if empty
+		std::vector<uint8_t> added;         ///< Inserted data not yet committed
+		stream::len lenBudget;              ///< Most data to keep in added
+		std::unique_ptr<inout> spill;       ///< Inserted data over the budget
+		stream::len lenSpill;               ///< Amount of data in spill
+		stream::pos offset;                 ///< Offset into self (starts at 0)
+		unsigned int seed;                  ///< State for extent priorities
+		source_tag tag;                     ///< Identifies the current content
+		memory::charge mem;                 ///< Memory held by added
+
+		/// Create a new extent with a random priority.
+		std::unique_ptr<extent> newExtent(source src, stream::pos off,
+			stream::len len);
+
+		/// Split a piece table in two at the given offset.
+		/**
+		 * If the offset falls in the middle of an extent, that extent is split in
+		 * two so each half ends up in a different tree.
+		 *
+		 * @param tree
+		 *   Tree to split.
+		 *
+		 * @param at
+		 *   Offset relative to the start of \e tree.  Everything before this point
+		 *   ends up in \e before, and everything from this point on in \e after.
+		 *
+		 * @param before
+		 *   On return, the first part of the tree.  May be set to NULL.
+		 *
+		 * @param after
+		 *   On return, the remainder of the tree.  May be set to NULL.
+		 */
+		void splitTree(std::unique_ptr<extent> tree, stream::pos at,
+			std::unique_ptr<extent> *before, std::unique_ptr<extent> *after);
+
+		/// Join two piece tables, with all of \e before placed ahead of \e after.
+		static std::unique_ptr<extent> mergeTree(std::unique_ptr<extent> before,
+			std::unique_ptr<extent> after);
 
-		/// Offset into self (starts at 0)
+		/// Allocate space for a newly inserted block.
 		/**
-		 * When offset == 0, the parent stream file pointer is at off_parent.
+		 * @param lenInsert
+		 *   Size of the block.
+		 *
+		 * @return A new extent of zero bytes, held in memory or in the spill file
+		 *   depending on the memory budget.
 		 */
-		stream::pos offset;
+		std::unique_ptr<extent> allocate(stream::len lenInsert);
 
-		/// Split the segstream at the current seek position.
+		/// Read or write data spanning any number of extents.
 		/**
-		 * Upon return the first data source will only last until the current seek
-		 * position, the second data source will be empty and the third data source
-		 * will contain all the data that was originally after the current seek
-		 * position.
+		 * Only the extents overlapping the requested range are visited.
 		 *
-		 * @code
-		 * Before: AAAABBBB
-		 *             ^ seek position
-		 * After:  AAAABBBB
-		 * first --^   ^-- third (second is empty)
-		 * @endcode
+		 * @param e
+		 *   Tree to access.
+		 *
+		 * @param pos
+		 *   Offset relative to the start of \e e.
+		 *
+		 * @param buffer
+		 *   Data to write, or buffer to read into.
+		 *
+		 * @param len
+		 *   Number of bytes to transfer.
+		 *
+		 * @param write
+		 *   true to copy from \e buffer into the extents, false to copy from the
+		 *   extents into \e buffer.
+		 *
+		 * @return Number of bytes transferred.  This is only less than \e len if
+		 *   the parent stream came up short, or the range went past the end of the
+		 *   tree.
+		 */
+		stream::len transfer(extent *e, stream::pos pos, uint8_t *buffer,
+			stream::len len, bool write);
+
+		/// Add every extent in the tree to a list, in order.
+		void collect(const extent *e, std::vector<const extent *> *list) const;
+
+		/// One step in writing the piece table out to the parent stream.
+		struct commit_op {
+			source src;        ///< Where the data is now
+			stream::pos off;   ///< Offset of the data in src
+			stream::pos dest;  ///< Where the data goes in the parent stream
+			stream::len len;   ///< Number of bytes to move or write
+		};
+
+		/// Work out how to commit the data to the underlying stream.
+		/**
+		 * The final layout is calculated first, so each byte of parent data is
+		 * moved at most once.  Neighbouring extents that are contiguous in both
+		 * their source and destination are combined into a single step, and
+		 * parent data that is already in the right place is not touched at all.
+		 *
+		 * The parent extents are always in the same order as their data in the
+		 * parent stream, since data is only ever inserted or removed and never
+		 * reordered.  This means extents moving towards the start of the stream
+		 * can be moved in order from the front, as they only overwrite data that
+		 * has already been moved, and extents moving towards the end can likewise
+		 * be moved from the back, without ever needing a temporary copy.  The
+		 * inserted data, from memory or the spill file, is written last into the
+		 * gaps left behind.
+		 *
+		 * @return The steps to perform, in the order they must be run.
 		 */
-		void split();
+		std::vector<commit_op> plan() const;
 
 		/// Commit the data to the underlying stream.
 		/**
-		 * This is used by flush() to move the first segment around as necessary,
-		 * then write the third segment (which often shares the same underlying
-		 * stream as the first segment) and lastly writes out the second segment in
-		 * the middle.  It has to be done in this order so that no data we need gets
-		 * overwritten before it has been moved out of the way.
+		 * This is used by flush() to perform the steps returned by plan().  Upon
+		 * return the piece table holds a single extent covering the whole parent
+		 * stream.
 		 */
-		void commit(stream::pos poffWriteFirst);
+		void commit();
 };
 
 } // namespace stream
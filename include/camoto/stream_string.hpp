@@ -23,6 +23,7 @@
 
 #include <string>
 #include <memory>
+#include <camoto/memory.hpp>
 #include <camoto/stream.hpp>
 
 namespace camoto {
@@ -34,16 +35,55 @@ class CAMOTO_GAMECOMMON_API string_core
 	public:
 		std::string data;  ///< String data
 
+		/// Take the data out of the stream without copying it.
+		/**
+		 * The stream is left empty, with the pointer at the start.
+		 *
+		 * @return The stream content.
+		 */
+		std::string release();
+
+		/// Allocate memory in advance for data about to be written.
+		/**
+		 * This avoids repeatedly growing the string when the final size is known
+		 * (or can be estimated) before writing starts.  The size of the stream is
+		 * not changed.
+		 *
+		 * @param len
+		 *   Number of bytes to allocate in total.
+		 */
+		void reserve(stream::len len);
+
+		/// Number of bytes of memory holding the stream's data.
+		/**
+		 * This is the string's capacity, which may be more than its size.  The
+		 * same amount is included in the totals returned by memory::snapshot().
+		 * Changes made directly to \e data are only counted there once the
+		 * stream is next written to or truncated.
+		 */
+		virtual stream::len buffered_bytes() const;
+
 	protected:
 		stream::pos offset;  ///< Current pointer position
+		source_tag tag;      ///< Identifies the current content for identify()
+		memory::charge mem;  ///< Memory held, as counted by memory::snapshot()
+
+		string_core(std::string data,
+			memory::owner type = memory::owner::string);
 
-		string_core(std::string data);
+		virtual ~string_core();
+
+		/// Update the memory totals after data has changed size.
+		void account();
 
 		/// Common seek function for reading and writing.
 		/**
 		 * @copydetails input::seekg()
 		 */
 		void seek(stream::delta off, seek_from from);
+
+		/// Seek within data of the given size, which need not be this->data.
+		void seek(stream::delta off, seek_from from, stream::len size);
 };
 
 /// Read-only stream to access a C++ string.
@@ -60,9 +100,15 @@ class CAMOTO_GAMECOMMON_API input_string:
 		input_string(std::string content);
 
 		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
 		virtual void seekg(stream::delta off, seek_from from);
 		virtual stream::pos tellg() const;
 		virtual stream::len size() const;
+		virtual const uint8_t *view(stream::pos pos, stream::len len,
+			stream::len *got, std::string& scratch);
+		virtual bool cheap_view() const;
+		virtual bool identify(source_id *id) const;
 };
 
 /// Write-only stream to access a C++ string.
@@ -78,10 +124,18 @@ class CAMOTO_GAMECOMMON_API output_string:
 		output_string();
 
 		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len);
 		virtual void seekp(stream::delta off, seek_from from);
 		virtual stream::pos tellp() const;
 		virtual void truncate(stream::pos size);
 		virtual void flush();
+
+		/// @copydoc output::reserve()
+		/**
+		 * This is the same as string_core::reserve().
+		 */
+		virtual void reserve(stream::len len);
 };
 
 /// Read/write stream accessing a C++ string.
@@ -93,6 +147,43 @@ class CAMOTO_GAMECOMMON_API string:
 	public:
 		string();
 		string(std::string content);
+
+		using output_string::reserve;
+};
+
+/// Read-only stream accessing a block of memory owned by someone else.
+/**
+ * This is like input_string, but reads straight from the caller's memory
+ * instead of taking a copy of it.  The memory must remain valid and unchanged
+ * for as long as the stream is in use.
+ */
+class CAMOTO_GAMECOMMON_API input_span: virtual public input
+{
+	public:
+		/// Access existing memory as a stream.
+		/**
+		 * @param data
+		 *   First byte to make available.  May be NULL if \e len is zero.
+		 *
+		 * @param len
+		 *   Number of bytes available at \e data.
+		 */
+		input_span(const uint8_t *data, stream::len len);
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+		virtual const uint8_t *view(stream::pos pos, stream::len len,
+			stream::len *got, std::string& scratch);
+		virtual bool cheap_view() const;
+
+	protected:
+		const uint8_t *base;  ///< Start of the memory block
+		stream::len length;   ///< Size of the memory block
+		stream::pos offset;   ///< Current pointer position
 };
 
 } // namespace stream
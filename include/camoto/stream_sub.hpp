@@ -29,10 +29,101 @@ namespace camoto {
 namespace stream {
 
 class output_sub;
+class sub_core;
 
 /// Callback function for changing the size of an output substream.
 typedef std::function<void(output_sub*, len)> fn_truncate_sub;
 
+/// Keeps track of the start offsets of many substreams sharing one parent.
+/**
+ * An archive with thousands of files will typically have a substream open for
+ * each one.  When a file is inserted or removed, every substream after it has
+ * to be moved, which done one at a time with sub_core::relocate() makes a
+ * batch of edits quadratic in the number of files.
+ *
+ * Once substreams are added with sub_core::set_registry(), shift() moves every
+ * one of them after a given point at once, in logarithmic time.  The start
+ * offsets are kept in a treap ordered by offset, where a shift is recorded
+ * against a whole subtree and only added to each substream's own offset when
+ * it is next needed.
+ *
+ * The registry must not be changed (by shift(), or by adding, relocating or
+ * destroying one of its substreams) while another thread is reading from any
+ * of its substreams.
+ *
+ * @code
+ * auto reg = std::make_shared<stream::sub_registry>();
+ * auto file1 = std::make_shared<stream::sub>(archive, 100, 50, fnResize);
+ * file1->set_registry(reg);
+ * ...
+ * // 20 bytes inserted at offset 100, moving every file from there on
+ * reg->shift(100, 20);
+ * @endcode
+ */
+class CAMOTO_GAMECOMMON_API sub_registry
+{
+	public:
+		sub_registry();
+		~sub_registry();
+
+		/// Move every substream that starts at or after the given offset.
+		/**
+		 * Substreams starting before \e pos are not changed, even if they
+		 * extend past it.  Their size must be updated separately with
+		 * sub_core::resize() if need be.
+		 *
+		 * @param pos
+		 *   Offset in the parent stream.  Substreams whose sub_start() is at or
+		 *   after this point are moved.
+		 *
+		 * @param off
+		 *   Distance to move them.  If negative, this must not move any of them
+		 *   back past the start of a substream that isn't being moved.
+		 */
+		void shift(stream::pos pos, stream::delta off);
+
+		/// Number of substreams in the registry.
+		std::size_t size() const;
+
+	private:
+		/// One substream's start offset, in a treap ordered by offset.
+		struct node {
+			stream::pos start;          ///< Offset, not counting pending shifts
+			stream::delta shift;        ///< Pending shift for this whole subtree
+			unsigned int priority;      ///< Random heap order to keep tree balanced
+			std::unique_ptr<node> left; ///< Substreams starting earlier
+			std::unique_ptr<node> right;///< Substreams starting later
+			node *parent;               ///< NULL for the root
+		};
+
+		std::unique_ptr<node> root;   ///< Tree of start offsets, NULL if empty
+		std::size_t count;            ///< Number of nodes in the tree
+		unsigned int seed;            ///< State for node priorities
+		unsigned long version;        ///< Changes whenever any start might move
+
+		/// Add a substream starting at the given offset.
+		node *add(stream::pos start);
+
+		/// Remove a substream's node, destroying it.
+		void remove(node *n);
+
+		/// Current start offset of a node, including any pending shifts.
+		stream::pos start_of(const node *n) const;
+
+		/// Add a node's pending shift to itself and pass it on to its children.
+		static void push(node *n);
+
+		/// Split a tree into nodes starting before \e at and the rest.
+		static void splitTree(std::unique_ptr<node> tree, stream::pos at,
+			std::unique_ptr<node> *before, std::unique_ptr<node> *after);
+
+		/// Join two trees, with all of \e before starting ahead of \e after.
+		static std::unique_ptr<node> mergeTree(std::unique_ptr<node> before,
+			std::unique_ptr<node> after);
+
+		friend class sub_core;
+};
+
 /// Substream parts in common with read and write
 class CAMOTO_GAMECOMMON_API sub_core
 {
@@ -50,7 +141,11 @@ class CAMOTO_GAMECOMMON_API sub_core
 		/// Alter the size of the substream without affecting any data.
 		/**
 		 * This function should only be called by the creator of the stream if the
-		 * parent stream has been modified outside of the substream.
+		 * parent stream has been modified outside of the substream, or from
+		 * within the fn_resize callback.
+		 *
+		 * Any space reserved by output_sub::set_growth() is dropped, so the
+		 * substream's data will end at \e len.
 		 *
 		 * Normally output_sub::truncate() would be used to correctly resize the
 		 * substream.  If in doubt, don't use this function!
@@ -69,11 +164,26 @@ class CAMOTO_GAMECOMMON_API sub_core
 
 		/// Get the current size of the window into the parent stream.
 		/**
+		 * This includes any space reserved past the end of the data by
+		 * output_sub::set_growth(), which cannot be read until it has been
+		 * written to.
+		 *
 		 * @return Current size of substream, in bytes.  The last byte in the
 		 *   parent stream that can be read is at offset start() + size() - 1.
 		 */
 		virtual stream::len sub_size() const;
 
+		/// Let a sub_registry move this substream along with others.
+		/**
+		 * After this, sub_registry::shift() can move this substream, and
+		 * relocate() updates the registry.  The substream keeps the registry
+		 * alive until the substream is destroyed.
+		 *
+		 * @param registry
+		 *   Registry to join, or NULL to leave the current one.
+		 */
+		void set_registry(std::shared_ptr<sub_registry> registry);
+
 	protected:
 		sub_core(pos start, len len);
 
@@ -83,14 +193,40 @@ class CAMOTO_GAMECOMMON_API sub_core
 		 */
 		void seek(stream::delta off, seek_from from);
 
+		/// Size of the data in the substream, not counting reserved space.
+		stream::len data_size() const;
+
 		stream::pos offset;       ///< Current pointer position
+		stream::len slack;        ///< Space reserved past the end of the data
 
 	private:
-		stream::pos stream_start; ///< Offset into parent stream
+		stream::pos stream_start; ///< Offset into parent stream, if no registry
 		stream::len stream_len;   ///< Length of substream
+
+		std::shared_ptr<sub_registry> registry; ///< Optional shared offsets
+		sub_registry::node *entry;              ///< This stream in registry
+
+		mutable stream::pos cachedStart;        ///< Last start from registry
+		mutable unsigned long cachedVersion;    ///< Registry version of that
 };
 
 /// Read-only stream to access a section within another stream.
+/**
+ * All reads go through the parent's try_read_at(), so the parent's read
+ * pointer is never used or changed.
+ *
+ * Many substreams, each used by a different thread, can share a single parent
+ * and read from it at the same time, whether or not their ranges overlap.  No
+ * locking is needed as long as nothing writes to, seeks, or otherwise uses the
+ * parent during this time.  Each substream itself must only be used by one
+ * thread at a time, as it has its own read pointer, and view() is only safe if
+ * the parent's view() is (which it is for string and mmap parents.)
+ *
+ * When the parent stream is a local file, a string or a memory map (or a
+ * seg or sub on top of one of those) the reads happen in parallel.  Other
+ * parents fall back to the default try_read_at(), which is still safe but
+ * handles one read at a time.
+ */
 class CAMOTO_GAMECOMMON_API input_sub:
 	virtual public input,
 	virtual public sub_core
@@ -111,10 +247,44 @@ class CAMOTO_GAMECOMMON_API input_sub:
 		 */
 		input_sub(std::shared_ptr<input> parent, pos start, len len);
 
+		/// Map onto a subsection of a stream owned by someone else.
+		/**
+		 * This avoids the cost of shared ownership when the parent is known to
+		 * outlive the substream.
+		 *
+		 * @copydetails input_sub(std::shared_ptr<input>, pos, len)
+		 */
+		input_sub(input& parent, pos start, len len);
+
 		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
 		virtual void seekg(stream::delta off, seek_from from);
 		virtual stream::pos tellg() const;
 		virtual stream::len size() const;
+		virtual const uint8_t *view(stream::pos pos, stream::len len,
+			stream::len *got, std::string& scratch);
+		virtual bool cheap_view() const;
+
+		/// @copydoc input::async_read_at()
+		/**
+		 * This is passed on to the parent stream.
+		 */
+		virtual std::future<stream::len> async_read_at(stream::pos pos,
+			uint8_t *buffer, stream::len len);
+
+		/// @copydoc input::hint()
+		/**
+		 * This is passed on to the parent stream.
+		 */
+		virtual void hint(access_pattern pattern);
+
+		/// @copydoc input::identify()
+		/**
+		 * The substream's data is identified as part of the parent's, so
+		 * separate substreams over the same bytes share decoded data.
+		 */
+		virtual bool identify(source_id *id) const;
 
 	protected:
 		std::shared_ptr<input> in_parent; ///< Parent stream for reading
@@ -158,17 +328,68 @@ class CAMOTO_GAMECOMMON_API output_sub:
 			fn_truncate_sub fn_resize);
 
 		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len);
 		virtual void seekp(stream::delta off, seek_from from);
 		virtual stream::pos tellp() const;
 		virtual void truncate(stream::pos size);
+
+		/// @copydoc output::flush()
+		/**
+		 * Any space reserved by set_growth() and not used is handed back with a
+		 * final call to fn_resize.
+		 */
 		virtual void flush();
 
+		/// @copydoc output::reserve()
+		/**
+		 * The request is passed on to the parent, for the space up to the end of
+		 * the substream.
+		 */
+		virtual void reserve(stream::len len);
+
+		/// Enlarge the substream in large steps when writing past the end.
+		/**
+		 * Normally every write that goes past the end of the substream calls
+		 * fn_resize to make room for exactly that write.  When the parent is
+		 * a stream::seg, each of those calls is an insert, which makes writing
+		 * a large file in small blocks very slow.
+		 *
+		 * With growth enabled, fn_resize is instead asked for at least double
+		 * the current size each time, so the number of calls only grows with
+		 * the logarithm of the final size.  The extra space is hidden from
+		 * size() and reads, and whatever is left unused is trimmed off again by
+		 * flush() or truncate().  The owner will see sub_size() include the
+		 * extra space until then.
+		 *
+		 * @param enable
+		 *   true to reserve extra space, false to go back to resizing only as
+		 *   much as each write needs.  Disabling growth does not trim any space
+		 *   already reserved; call flush() for that.
+		 *
+		 * @param hint
+		 *   Expected final size of the substream if known, or 0 if not.  The
+		 *   first enlargement reserves at least this much.
+		 */
+		void set_growth(bool enable, stream::len hint = 0);
+
 	protected:
 		/// Parent stream for writing.
 		std::shared_ptr<output> out_parent;
 
 		/// Callback to alert parent stream we want to change size.
 		fn_truncate_sub fn_resize;
+
+		bool growth;          ///< Reserve extra space when enlarging
+		stream::len lenHint;  ///< Expected final size for growth, or 0
+
+		/// Ask fn_resize to make the substream at least \e len bytes long.
+		/**
+		 * If growth is enabled, more space than this is requested.  Errors are
+		 * ignored, so the caller must check sub_size() afterwards to see how much
+		 * space is actually available.
+		 */
+		void enlarge(stream::len len);
 };
 
 /// Read/write stream accessing a section within another stream.
@@ -184,6 +405,14 @@ class CAMOTO_GAMECOMMON_API sub:
 		 */
 		sub(std::shared_ptr<inout> parent, pos start, len len,
 			fn_truncate_sub fn_resize);
+
+		/// Map onto a subsection of a stream owned by someone else.
+		/**
+		 * The parent must outlive the substream.
+		 *
+		 * @copydetails output_sub::output_sub()
+		 */
+		sub(inout& parent, pos start, len len, fn_truncate_sub fn_resize);
 };
 
 } // namespace stream
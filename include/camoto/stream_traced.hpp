@@ -0,0 +1,200 @@
+/**
+ * @file  camoto/stream_traced.hpp
+ * @brief Record every access made to a stream, so it can be replayed later.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STREAM_TRACED_HPP_
+#define _CAMOTO_STREAM_TRACED_HPP_
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Type of operation recorded in a trace.
+enum class trace_type: uint8_t {
+	seekg = 1,     ///< seekg(), trace_op::pos is where the pointer ended up
+	seekp = 2,     ///< seekp(), trace_op::pos is where the pointer ended up
+	read = 3,      ///< try_read() or try_read_at()
+	write = 4,     ///< try_write() or try_write_at()
+	truncate = 5,  ///< truncate(), trace_op::pos is the new size
+	flush = 6,     ///< flush()
+};
+
+/// One operation recorded in a trace.
+struct trace_op {
+	trace_type type;      ///< Operation performed
+	bool positional;      ///< true for try_read_at() and try_write_at()
+	stream::pos pos;      ///< Offset the operation happened at
+	stream::len len;      ///< Bytes asked for by a read or write
+	stream::len done;     ///< Bytes actually read or written
+	uint64_t start;       ///< Nanoseconds from start of trace to start of op
+	uint64_t duration;    ///< Nanoseconds the operation took
+};
+
+/// Parts of a traced stream in common with read and write.
+/**
+ * The log starts with the four bytes "CTR1", followed by one record per
+ * operation.  Each record is a type byte (with 0x80 set for positional reads
+ * and writes) then a number of unsigned LEB128 values: the time since the
+ * previous record started, the time the operation took, and then the offset
+ * and lengths as appropriate for the type.  Times are in nanoseconds.  A
+ * typical record takes less than ten bytes.
+ */
+class CAMOTO_GAMECOMMON_API traced_core
+{
+	public:
+		virtual ~traced_core();
+
+	protected:
+		traced_core(std::shared_ptr<output> log);
+
+		/// Add a record to the log.
+		void record(const trace_op& op);
+
+		/// Current time, in nanoseconds from the start of the trace.
+		uint64_t now() const;
+
+		/// Write any buffered records out to the log.
+		void flush_log();
+
+	private:
+		std::shared_ptr<output> log;                ///< Destination for records
+		std::vector<uint8_t> buffer;                ///< Records not yet written
+		std::chrono::steady_clock::time_point base; ///< When tracing started
+		uint64_t lastStart;                         ///< Start of previous record
+		std::mutex lock;                            ///< Serialises records
+};
+
+/// Read-only stream recording every access made to another stream.
+/**
+ * All calls are passed straight through to the parent, with a record of each
+ * one written to a log.  The log can be read back with trace_reader, and is
+ * used by the replay tool to run the same sequence of operations against
+ * other kinds of stream.
+ *
+ * @code
+ * auto log = std::make_shared<stream::output_file>("game.trace", true);
+ * auto in = std::make_shared<stream::input_traced>(
+ *   std::make_shared<stream::input_file>("game.dat"), log);
+ * // Pass 'in' to the format handler as usual
+ * @endcode
+ */
+class CAMOTO_GAMECOMMON_API input_traced: virtual public input,
+	virtual protected traced_core
+{
+	public:
+		/// Trace reads from another stream.
+		/**
+		 * @param parent
+		 *   Stream to pass all calls on to.
+		 *
+		 * @param log
+		 *   Stream to write the trace to.
+		 */
+		input_traced(std::shared_ptr<input> parent, std::shared_ptr<output> log);
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
+		virtual void seekg(stream::delta off, seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+
+	protected:
+		std::shared_ptr<input> in_parent; ///< Parent stream for reading
+};
+
+/// Write-only stream recording every access made to another stream.
+class CAMOTO_GAMECOMMON_API output_traced: virtual public output,
+	virtual protected traced_core
+{
+	public:
+		/// @copydoc input_traced::input_traced()
+		output_traced(std::shared_ptr<output> parent, std::shared_ptr<output> log);
+
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len);
+		virtual void seekp(stream::delta off, seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::pos size);
+
+		/// @copydoc output::flush()
+		/**
+		 * The log is flushed as well as the parent.
+		 */
+		virtual void flush();
+
+	protected:
+		std::shared_ptr<output> out_parent; ///< Parent stream for writing
+};
+
+/// Read/write stream recording every access made to another stream.
+class CAMOTO_GAMECOMMON_API traced:
+	virtual public inout,
+	virtual public input_traced,
+	virtual public output_traced
+{
+	public:
+		/// @copydoc input_traced::input_traced()
+		traced(std::shared_ptr<inout> parent, std::shared_ptr<output> log);
+};
+
+/// Read back a log written by a traced stream.
+class CAMOTO_GAMECOMMON_API trace_reader
+{
+	public:
+		/// Start reading a log.
+		/**
+		 * @param log
+		 *   Stream containing the log, positioned at the start.
+		 *
+		 * @throw stream::error
+		 *   The log does not start with the right signature.
+		 */
+		trace_reader(std::shared_ptr<input> log);
+
+		/// Get the next operation from the log.
+		/**
+		 * @param op
+		 *   On return, the operation read.
+		 *
+		 * @return true if an operation was read, false at the end of the log.
+		 *
+		 * @throw stream::error
+		 *   The log is corrupted or cut short part way through a record.
+		 */
+		bool next(trace_op *op);
+
+	protected:
+		std::shared_ptr<input> log; ///< Log being read
+		uint64_t lastStart;         ///< Start of previous record
+
+		/// Read one LEB128 value from the log.
+		uint64_t read_value();
+};
+
+} // namespace stream
+} // namespace camoto
+
+#endif // _CAMOTO_STREAM_TRACED_HPP_
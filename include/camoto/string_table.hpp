@@ -0,0 +1,159 @@
+/**
+ * @file  camoto/string_table.hpp
+ * @brief Read whole tables of fixed-length records containing names at once.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_STRING_TABLE_HPP_
+#define _CAMOTO_STRING_TABLE_HPP_
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <camoto/config.hpp>
+#include <camoto/iostream_helpers.hpp>
+#include <camoto/stream.hpp>
+
+namespace camoto {
+
+/// A string kept in someone else's memory, such as a string_table.
+/**
+ * The characters are not null-terminated, as a name is allowed to fill its
+ * whole field.
+ */
+struct table_string {
+	const char *data;     ///< First character
+	std::size_t length;   ///< Number of characters
+
+	/// Copy the characters into a new string.
+	std::string str() const
+	{
+		return std::string(this->data, this->length);
+	}
+
+	bool operator == (const std::string& s) const
+	{
+		return s.compare(0, std::string::npos, this->data, this->length) == 0;
+	}
+
+	bool operator != (const std::string& s) const
+	{
+		return !(*this == s);
+	}
+};
+
+/// An array of fixed-length records, each starting with a null-padded name.
+/**
+ * Many archive formats store their file list as an array of records like
+ * nullPadded(name, 12) followed by u32le(offset) and u32le(size).  Reading
+ * these one field at a time through operator >> costs several stream calls and
+ * string allocations per file.  This class instead reads the entire table with
+ * one call, keeps it in a single block of memory, and gives access to the names
+ * in place.
+ *
+ * @code
+ * string_table dir;
+ * dir.read(file, numFiles, 20, 0, 12);
+ * for (std::size_t i = 0; i < dir.size(); i++) {
+ *   uint32_t offset, size;
+ *   dir.decode(i, 12, u32le(offset), u32le(size));
+ *   std::cout << dir.name(i).str() << " is " << size << " bytes\n";
+ * }
+ * @endcode
+ *
+ * The same object can be used to read another table, reusing its memory.
+ */
+class CAMOTO_GAMECOMMON_API string_table
+{
+	public:
+		string_table();
+
+		/// Read a table of records from the current position in a stream.
+		/**
+		 * @param s
+		 *   Stream to read from.  Exactly count * lenRecord bytes are read.
+		 *
+		 * @param count
+		 *   Number of records.
+		 *
+		 * @param lenRecord
+		 *   Size of each record in bytes, including the name.
+		 *
+		 * @param offName
+		 *   Offset of the name within each record.
+		 *
+		 * @param lenName
+		 *   Size of the name field.  The name ends at the first null, or at the
+		 *   end of the field if there is no null.
+		 *
+		 * @throw stream::incomplete_read
+		 *   The stream ended before the whole table was read.  The table is left
+		 *   empty.
+		 */
+		void read(stream::input& s, std::size_t count, unsigned int lenRecord,
+			unsigned int offName, unsigned int lenName);
+
+		/// Number of records read.
+		std::size_t size() const
+		{
+			return this->names.size();
+		}
+
+		/// Name in the given record.
+		/**
+		 * This remains valid until the next call to read(), or until the table
+		 * is destroyed.
+		 */
+		const table_string& name(std::size_t index) const
+		{
+			return this->names[index];
+		}
+
+		/// Raw bytes of the given record, lenRecord bytes long.
+		const uint8_t *record(std::size_t index) const
+		{
+			return &this->data[index * this->lenRecord];
+		}
+
+		/// Decode fields from a record.
+		/**
+		 * @param index
+		 *   Record to decode.
+		 *
+		 * @param offset
+		 *   Offset within the record of the first field.
+		 *
+		 * @param f
+		 *   Fields to decode, in order, e.g. u32le(size).
+		 */
+		template <typename... F>
+		void decode(std::size_t index, unsigned int offset, const F&... f) const
+		{
+			assert(offset + packed_length<F...>::value <= this->lenRecord);
+			decode_packed(this->record(index) + offset, f...);
+			return;
+		}
+
+	private:
+		std::vector<uint8_t> data;        ///< Raw content of every record
+		std::vector<table_string> names;  ///< Names, pointing into data
+		unsigned int lenRecord;           ///< Size of each record in data
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_STRING_TABLE_HPP_
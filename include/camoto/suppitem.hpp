@@ -21,8 +21,11 @@
 #ifndef _CAMOTO_SUPPITEM_HPP_
 #define _CAMOTO_SUPPITEM_HPP_
 
+#include <functional>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <camoto/stream.hpp>
 
 /// Main namespace
@@ -74,6 +77,153 @@ typedef std::map<SuppItem, std::string> SuppFilenames;
 /// A list of the supplemental file types mapped to open file streams.
 typedef std::map<SuppItem, std::unique_ptr<stream::inout> > SuppData;
 
+/// Default number of unused files kept open by a SuppCache.
+#define SUPP_CACHE_IDLE 16
+
+/// Supplementary files opened once and shared between many users.
+/**
+ * When converting a batch of files, the same palette or FAT is usually needed
+ * by every one of them.  Rather than opening and reading the file again each
+ * time, the cache hands out the same stream to everyone asking for the same
+ * file, no matter which path was used to get to it.
+ *
+ * Files stay open as long as someone is using them.  Up to a set number of
+ * files nobody is using are also kept open, in case they are needed again,
+ * with the least recently opened ones closed first.
+ *
+ * All functions are safe to call from any thread, however the streams
+ * returned are shared, so they must only be used by one thread at a time.
+ * SuppStream is the usual way of giving each user its own seek pointer.
+ */
+class CAMOTO_GAMECOMMON_API SuppCache
+{
+	public:
+		/// Function that opens a file.
+		/**
+		 * @param filename
+		 *   Filename to open, as given to open().
+		 *
+		 * @return The open file.
+		 */
+		typedef std::function<std::shared_ptr<stream::inout>(
+			const std::string& filename)> fn_open;
+
+		/// Create a cache.
+		/**
+		 * @param open
+		 *   Function to open each file.  If empty, files are opened as
+		 *   stream::file.
+		 *
+		 * @param maxIdle
+		 *   Most files to keep open when nobody is using them.
+		 */
+		SuppCache(fn_open open = fn_open(), unsigned int maxIdle = SUPP_CACHE_IDLE);
+
+		/// Get a file, opening it if it isn't already open.
+		/**
+		 * @param filename
+		 *   File to open.  Different paths to the same file give the same
+		 *   stream.
+		 *
+		 * @return The shared stream.
+		 *
+		 * @throw stream::open_error
+		 *   The file could not be opened.
+		 */
+		std::shared_ptr<stream::inout> open(const std::string& filename);
+
+		/// Number of files currently open.
+		std::size_t count() const;
+
+		/// Close every file that nobody else is using.
+		void trim();
+
+	protected:
+		/// An open file.
+		struct entry {
+			std::string path;                     ///< Canonical path of the file
+			std::shared_ptr<stream::inout> file;  ///< The file itself
+		};
+
+		mutable std::mutex lock;  ///< Protects the members below
+		fn_open fnOpen;           ///< Opens files
+		unsigned int maxIdle;     ///< Most unused files to keep open
+		std::list<entry> files;   ///< Open files, most recently opened first
+
+		/// Close unused files until there are no more than \e keep of them.
+		void closeIdle(unsigned int keep);
+};
+
+/// Supplementary file that isn't opened until it is first used.
+/**
+ * This lets a SuppData be filled in before it is known which of the files the
+ * format handler will actually use.  The file is opened the first time any
+ * data, or its size, is needed.
+ *
+ * Each SuppStream has its own seek pointer, even when the underlying file is
+ * shared through a SuppCache.
+ */
+class CAMOTO_GAMECOMMON_API SuppStream: virtual public stream::inout
+{
+	public:
+		/// Function that opens the file.
+		typedef std::function<std::shared_ptr<stream::inout>()> fn_open;
+
+		/// Set up a stream to be opened later.
+		/**
+		 * @param open
+		 *   Function called to open the file on first use.
+		 */
+		SuppStream(fn_open open);
+
+		/// Has the file been opened yet?
+		bool isOpen() const;
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len);
+		virtual void seekg(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+		virtual const uint8_t *view(stream::pos pos, stream::len len,
+			stream::len *got, std::string& scratch);
+		virtual bool cheap_view() const;
+		virtual bool identify(stream::source_id *id) const;
+
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len);
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len);
+		virtual void seekp(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellp() const;
+		virtual void truncate(stream::pos size);
+		virtual void flush();
+
+	protected:
+		fn_open fnOpen;                           ///< Opens the file
+		mutable std::shared_ptr<stream::inout> target; ///< File, once open
+		stream::pos offset;                       ///< Current read/write position
+
+		/// Get the file, opening it if needed.
+		stream::inout& get() const;
+
+		/// Move the seek pointer.
+		void seek(stream::delta off, stream::seek_from from);
+};
+
+/// Prepare supplementary files to be opened as they are needed.
+/**
+ * @param names
+ *   Files to make available.
+ *
+ * @param cache
+ *   Cache to share the open files through, or nullptr to have each stream
+ *   open its own copy of the file.
+ *
+ * @return A SuppStream for each file, none of which are open yet.
+ */
+SuppData CAMOTO_GAMECOMMON_API lazySuppData(const SuppFilenames& names,
+	std::shared_ptr<SuppCache> cache = nullptr);
+
 } // namespace camoto
 
 #endif // _CAMOTO_SUPPITEM_HPP_
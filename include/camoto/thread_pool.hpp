@@ -0,0 +1,107 @@
+/**
+ * @file  camoto/thread_pool.hpp
+ * @brief Simple work-stealing thread pool.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_THREAD_POOL_HPP_
+#define _CAMOTO_THREAD_POOL_HPP_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <camoto/config.hpp>
+
+namespace camoto {
+
+/// Fixed set of worker threads running queued tasks.
+/**
+ * Each worker has its own queue.  Tasks are handed out to the queues in turn,
+ * and a worker that runs out of tasks takes them from the back of another
+ * worker's queue, so uneven task lengths still keep every thread busy.
+ *
+ * Each task is told the index of the worker running it, so that it can reuse
+ * per-worker resources (such as buffers) without any locking.
+ */
+class CAMOTO_GAMECOMMON_API thread_pool
+{
+	public:
+		/// Function to run.
+		/**
+		 * @param worker
+		 *   Index of the worker running the task, from 0 to size() - 1.
+		 */
+		typedef std::function<void(unsigned int worker)> task;
+
+		/// Start the worker threads.
+		/**
+		 * @param numThreads
+		 *   Number of threads to start, or zero to use one per CPU core.
+		 */
+		thread_pool(unsigned int numThreads = 0);
+
+		/// Wait for all queued tasks to finish, then stop the threads.
+		~thread_pool();
+
+		/// Number of worker threads.
+		unsigned int size() const;
+
+		/// Queue a task to be run on one of the worker threads.
+		void submit(task t);
+
+		/// Wait until every task submitted so far has finished.
+		/**
+		 * @throw ...
+		 *   If any task threw an exception, the first one is rethrown here once
+		 *   all the tasks have finished.
+		 */
+		void wait();
+
+	protected:
+		/// Tasks waiting to run, belonging to one worker.
+		struct queue {
+			std::mutex lock;
+			std::deque<task> tasks;
+		};
+
+		std::vector<std::unique_ptr<queue>> queues; ///< One per worker
+		std::vector<std::thread> workers;  ///< Worker threads
+
+		std::mutex lock;                   ///< Protects the members below
+		std::condition_variable wake;      ///< Signalled when tasks are queued
+		std::condition_variable idle;      ///< Signalled when pending reaches 0
+		unsigned int queued;               ///< Tasks sitting in a queue
+		unsigned int pending;              ///< Tasks queued or running
+		unsigned int next;                 ///< Queue to put the next task in
+		bool stopping;                     ///< Set to tell workers to exit
+		std::exception_ptr failure;        ///< First exception thrown by a task
+
+		/// Main loop for each worker thread.
+		void run(unsigned int index);
+
+		/// Take a task from this worker's queue, or steal one from another.
+		bool take(unsigned int index, task *t);
+};
+
+} // namespace camoto
+
+#endif // _CAMOTO_THREAD_POOL_HPP_
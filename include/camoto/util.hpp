@@ -22,6 +22,7 @@
 #define _CAMOTO_UTIL_HPP_
 
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <vector> // for filesystem impl only
 
@@ -69,6 +70,25 @@ constexpr unsigned long toNearestMultiple(unsigned long value,
 	return value + ((multiple - (value % multiple)) % multiple);
 }
 
+/// Share an object that is owned elsewhere, without taking ownership of it.
+/**
+ * This returns a shared_ptr with no control block, so nothing is allocated
+ * and copying it never touches a reference count.  It can be passed to any
+ * function expecting a shared_ptr when the caller knows the object will
+ * outlive every copy, such as a stream stack that only exists for the length
+ * of a single function.
+ *
+ * @code
+ * stream::input_string content(...);
+ * stream::input_sub member(borrow<stream::input>(content), 100, 50);
+ * @endcode
+ */
+template <class T>
+inline std::shared_ptr<T> borrow(T& obj)
+{
+	return std::shared_ptr<T>(std::shared_ptr<T>(), &obj);
+}
+
 /// Case sensitive string comparison
 bool icasecmp(const std::string& l, const std::string& r);
 
@@ -117,32 +137,81 @@ files.
 
 <ul>
 	<li>
+		arena - allocates whole stacks of streams and filters from a few large
+		blocks of memory, freed all at once
+	</li><li>
 		stream - data stream (such as a file), which can also be truncated
 	</li><li>
 		stream::file - stream implementation where data is stored in a file
+	</li><li>
+		stream::mmap - stream implementation where data is stored in a
+		memory-mapped file
+	</li><li>
+		stream::cached - keeps blocks of another stream in memory to speed up
+		small or repeated reads and writes
 	</li><li>
 		stream::filtered - appears as a normal stream, but applies a filter to data
 		before reading/writing to the underlying stream
+	</li><li>
+		stream::decode_cache - lets filtered streams reading the same data share
+		one decoded copy of it
 	</li><li>
 		stream::seg - transparently add and remove chunks of data in the middle of
 		a stream
+	</li><li>
+		stream::repack - rebuild a whole archive from a list of members in one
+		planned pass, in place where possible
+	</li><li>
+		stream::paged - in-memory stream that can take cheap copy-on-write
+		snapshots of itself, e.g. for undo
+	</li><li>
+		stream::reader - parse values from a stream with inline code instead of
+		a call per value
 	</li><li>
 		stream::string - stream implementation where data is stored in a string
 	</li><li>
 		stream::sub - create a new stream that works on a section of data within
 		another larger stream
+	</li><li>
+		stream::traced - record every access made to a stream, for replaying
+		against other stream types with tests/replay
+	</li><li>
+		memory - how much memory in-memory streams are holding, with an optional
+		callback when a limit is exceeded
+	</li><li>
+		string_table - read a whole table of fixed-length records containing names
+		with a single call
 	</li><li>
 		bitstream - read/write/seek within a stream, but at the bit level
+	</li><li>
+		checksum - CRC32, Adler32 and XOR checksums, which stream::input_checksum
+		and filter-checksum calculate as data passes through
+	</li><li>
+		huffman_decoder - decode canonical Huffman codes from a bitstream using
+		lookup tables
 	</li><li>
 		IFFReader/IFFWriter - standard interfaces to read/write/walk data chunks
 		in IFF and RIFF files
+	</li><li>
+		thread_pool - fixed set of worker threads sharing a queue of tasks
+	</li><li>
+		stats - optional counters of stream and filter activity, compiled in by
+		defining CAMOTO_STATS in config.hpp
 	</li><li>
 		filter - standard interface to a stream filter, which changes data
 		on-the-fly, by compressing, decompressing, encrypting or changing the data
 		in another manner
+	</li><li>
+		filter-batch - run a filter over many independent blocks of data at once,
+		spread across a thread_pool
+	</li><li>
+		filter-chain - filter that runs data through several other filters in
+		turn, without storing the intermediate results
 	</li><li>
 		filter-crop - filter that drops/ignores a number of bytes from the start of
 		the stream
+	</li><li>
+		filter-delta - filter for 8 and 16-bit delta coding
 	</li><li>
 		filter-lzw - filter providing a number of various LZW compression and
 		decompression schemes
@@ -150,6 +219,15 @@ files.
 		filter-lzss - filter providing LZSS compression/decompression
 	</li><li>
 		filter-pad - filter that transparently inserts/removes padding bytes in data
+</li><li>
+		filter-pool - reuses filter instances instead of constructing a new one for
+		each stream
+	</li><li>
+		filter-rle - filters for escape-byte, flag-bit and PackBits run-length
+		encoding
+	</li><li>
+		filter-xor - filter that XORs data with a repeating, incrementing or LFSR
+		keystream
 	</li>
 </ul>
 
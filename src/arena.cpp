@@ -0,0 +1,63 @@
+/**
+ * @file   arena.cpp
+ * @brief  Allocate many short-lived objects from a few large blocks of memory.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <camoto/arena.hpp>
+
+namespace camoto {
+
+arena::arena(std::size_t lenBlock)
+	:	lenBlock(lenBlock),
+		next(nullptr),
+		end(nullptr)
+{
+}
+
+arena::~arena()
+{
+}
+
+void *arena::allocate(std::size_t len, std::size_t align)
+{
+	uintptr_t p = ((uintptr_t)this->next + align - 1) & ~(uintptr_t)(align - 1);
+	if (!this->next || (p + len > (uintptr_t)this->end)) {
+		// Out of room, start a new block.  Memory from new[] is aligned for any
+		// standard type, so only over-aligned requests need extra space.
+		std::size_t lenNew = std::max(this->lenBlock, len + align);
+		this->blocks.emplace_back(new char[lenNew]);
+		this->next = this->blocks.back().get();
+		this->end = this->next + lenNew;
+		p = ((uintptr_t)this->next + align - 1) & ~(uintptr_t)(align - 1);
+	}
+	this->next = (char *)(p + len);
+	return (void *)p;
+}
+
+void arena::release()
+{
+	if (this->blocks.empty()) return;
+	this->blocks.resize(1);
+	this->next = this->blocks[0].get();
+	this->end = this->next + this->lenBlock;
+	return;
+}
+
+} // namespace camoto
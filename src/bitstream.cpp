@@ -19,13 +19,18 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <string.h>
 #include <camoto/bitstream.hpp>
+#include <camoto/iostream_helpers.hpp> // also includes byteorder.hpp
 
-/// origBufByte value: The last operation was a write, so the bufByte wasn't updated
-#define WASNT_BUFFERED  -1
-/// origBufByte value: This is the first read operation, don't write out the bufByte
-#define INITIAL_VALUE   -2
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+// Compiled for any x86 CPU, with the AVX2 version only used if the CPU running
+// the code supports it.
+#define CAMOTO_BITS_AVX2
+#include <immintrin.h>
+#endif
 
 namespace camoto {
 
@@ -58,6 +63,10 @@ bitstream::bitstream(std::shared_ptr<stream::inout> parent,
 		curBitPos(8), // 8 means update bufByte on next operation
 		bufByte(0),
 		origBufByte(INITIAL_VALUE),
+		blockStart(0),
+		blockLen(0),
+		dirtyStart(0),
+		dirtyEnd(0),
 		endianType(endianType)
 {
 }
@@ -68,12 +77,24 @@ bitstream::bitstream(bitstream::endian endianType)
 		curBitPos(8), // 8 means update bufByte on next operation
 		bufByte(0),
 		origBufByte(INITIAL_VALUE),
+		blockStart(0),
+		blockLen(0),
+		dirtyStart(0),
+		dirtyEnd(0),
 		endianType(endianType)
 {
 }
 
 bitstream::~bitstream()
 {
+	if (this->parent) {
+		try {
+			this->writeBlock();
+		} catch (const stream::error&) {
+			// Can't throw from a destructor, and the caller should have used
+			// flush() if they wanted to know about this.
+		}
+	}
 }
 
 int bitstream::read(unsigned int bits, unsigned int *out)
@@ -98,8 +119,7 @@ int bitstream::read(fn_getnextchar fnNextChar, unsigned int bits, unsigned int *
 		stream::pos r;
 		uint8_t b;
 		if (fnNextChar == nullptr) {
-			this->parent->seekg(this->offset, stream::start);
-			r = this->parent->try_read(&b, 1);
+			r = this->readParentByte(this->offset, &b);
 		} else {
 			r = fnNextChar(&b);
 		}
@@ -134,8 +154,7 @@ int bitstream::read(fn_getnextchar fnNextChar, unsigned int bits, unsigned int *
 
 			stream::pos r;
 			if (fnNextChar == NULL) {
-				this->parent->seekg(this->offset, stream::start);
-				r = this->parent->try_read(&this->bufByte, 1);
+				r = this->readParentByte(this->offset, &this->bufByte);
 			} else {
 				r = fnNextChar(&this->bufByte);
 			}
@@ -236,7 +255,7 @@ int bitstream::write(fn_putnextchar fnNextChar, unsigned int bits, unsigned int
 		unsigned int bitsNow = (bits-bitswritten > bufBitsRemaining)
 			? bufBitsRemaining : bits-bitswritten;
 
-		int writeVal, writeMask;
+		unsigned int writeVal, writeMask;
 		if (this->endianType == bitstream::littleEndian) {
 			// Extract the next bits we will be writing.
 			writeMask = (~(0xff << bitsNow)) & 0xff;
@@ -247,7 +266,7 @@ int bitstream::write(fn_putnextchar fnNextChar, unsigned int bits, unsigned int
 		} else {
 			// Extract the next bits we will be writing.
 
-			unsigned int mask = (bits == 32) ? 0xFFFFFFFF : (1 << bits)-1; // could be up to sizeof(int)
+			unsigned int mask = (bits == 32) ? 0xFFFFFFFF : (1u << bits) - 1; // could be up to sizeof(int)
 			// Isolate the bits in the input data (in) that we are interested in.
 			// These might be the upper two bits in a 9-bit number, for instance.
 			writeMask = ~(mask >> bitsNow) & mask;
@@ -279,6 +298,465 @@ int bitstream::write(fn_putnextchar fnNextChar, unsigned int bits, unsigned int
 	return bitswritten;
 }
 
+/// Load eight bytes as a number, padding with zeroes past \e end.
+template <bitstream::endian E>
+static inline uint64_t loadWord(const uint8_t *p, const uint8_t *end)
+{
+	uint8_t tail[8];
+	std::size_t len = end - p;
+	if (len < 8) {
+		for (std::size_t i = 0; i < 8; i++) tail[i] = (i < len) ? p[i] : 0;
+		p = tail;
+	}
+	if (E == bitstream::littleEndian) {
+		return (uint64_t)p[0] | ((uint64_t)p[1] << 8)
+			| ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+			| ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40)
+			| ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+	}
+	return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48)
+		| ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32)
+		| ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16)
+		| ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+/// Unpack values from memory one at a time, each from a single 64-bit load.
+/**
+ * @param data
+ *   Byte holding the first bit of the first value.
+ *
+ * @param end
+ *   One past the last byte that may be read.
+ *
+ * @param shift
+ *   Bit within \e data where the first value starts, 0 to 7.
+ */
+template <bitstream::endian E, typename T>
+static void unpackScalar(const uint8_t *data, const uint8_t *end,
+	unsigned int shift, unsigned int bits, T *out, stream::len count)
+{
+	uint64_t mask = ((uint64_t)1 << bits) - 1;
+	uint64_t pos = shift;
+	for (stream::len i = 0; i < count; i++) {
+		uint64_t word = loadWord<E>(data + (pos >> 3), end);
+		if (E == bitstream::littleEndian) {
+			out[i] = (T)((word >> (pos & 7)) & mask);
+		} else {
+			out[i] = (T)((word << (pos & 7)) >> (64 - bits));
+		}
+		pos += bits;
+	}
+	return;
+}
+
+#ifdef CAMOTO_BITS_AVX2
+/// Does the CPU running this code have AVX2?
+static bool haveAvx2()
+{
+	static const bool have = __builtin_cpu_supports("avx2");
+	return have;
+}
+
+/// Store eight 32-bit values.
+__attribute__((target("avx2")))
+static inline void store8(uint32_t *out, __m256i v)
+{
+	_mm256_storeu_si256((__m256i *)out, v);
+	return;
+}
+
+/// Store eight 32-bit values as 16-bit values.
+__attribute__((target("avx2")))
+static inline void store8(uint16_t *out, __m256i v)
+{
+	// Packing works within each 128-bit half, so bring the halves together
+	v = _mm256_packus_epi32(v, v);
+	v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+	_mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(v));
+	return;
+}
+
+/// Unpack values eight at a time with AVX2.
+/**
+ * Eight values take up exactly \e bits bytes, so every group of eight starts
+ * at the same bit within its first byte and the same shuffle works for all
+ * of them.  The four bytes holding each value are shuffled into a 32-bit lane
+ * in the order that makes them a native number, then each lane is shifted by
+ * its own amount and masked.  The first four values come from a 16-byte load
+ * at the start of the group and the last four from a second load part way
+ * through, as the shuffle can't cross between the two halves.
+ *
+ * @pre bits is 25 or less, so each value fits in the four bytes it starts in.
+ *
+ * @return The number of values unpacked, a multiple of eight.  The loads read
+ *   up to 29 bytes ahead, so the last few values are left for unpackScalar().
+ */
+template <bitstream::endian E, typename T>
+__attribute__((target("avx2")))
+static stream::len unpackAvx2(const uint8_t *data, const uint8_t *end,
+	unsigned int shift, unsigned int bits, T *out, stream::len count)
+{
+	assert(bits <= 25);
+	alignas(32) uint8_t shuffle[32];
+	alignas(32) uint32_t shifts[8];
+	unsigned int upper = (shift + 4 * bits) / 8;
+	for (unsigned int j = 0; j < 8; j++) {
+		unsigned int pos = shift + j * bits;
+		unsigned int idx = pos / 8 - ((j < 4) ? 0 : upper);
+		for (unsigned int k = 0; k < 4; k++) {
+			shuffle[j * 4 + k] = (uint8_t)(idx
+				+ ((E == bitstream::littleEndian) ? k : 3 - k));
+		}
+		shifts[j] = (E == bitstream::littleEndian)
+			? pos % 8 : 32 - pos % 8 - bits;
+	}
+	__m256i vShuffle = _mm256_load_si256((const __m256i *)shuffle);
+	__m256i vShift = _mm256_load_si256((const __m256i *)shifts);
+	__m256i vMask = _mm256_set1_epi32((1u << bits) - 1);
+
+	stream::len done = 0;
+	while ((count - done >= 8) && (end - data >= (std::ptrdiff_t)upper + 16)) {
+		__m128i lo = _mm_loadu_si128((const __m128i *)data);
+		__m128i hi = _mm_loadu_si128((const __m128i *)(data + upper));
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		v = _mm256_shuffle_epi8(v, vShuffle);
+		v = _mm256_and_si256(_mm256_srlv_epi32(v, vShift), vMask);
+		store8(out + done, v);
+		data += bits;
+		done += 8;
+	}
+	return done;
+}
+#endif // CAMOTO_BITS_AVX2
+
+/// Unpack values from memory, using the fastest method available.
+/**
+ * @copydetails unpackScalar()
+ *
+ * @pre All \e count values end at or before \e end.
+ */
+template <bitstream::endian E, typename T>
+static void unpack(const uint8_t *data, const uint8_t *end,
+	unsigned int shift, unsigned int bits, T *out, stream::len count)
+{
+#ifdef CAMOTO_BITS_AVX2
+	if ((bits <= 25) && (count >= 8) && haveAvx2()) {
+		stream::len done = unpackAvx2<E>(data, end, shift, bits, out, count);
+		data += done / 8 * bits;
+		out += done;
+		count -= done;
+	}
+#endif
+	unpackScalar<E>(data, end, shift, bits, out, count);
+	return;
+}
+
+template <typename T>
+stream::len bitstream::readValues(unsigned int bits, T *out,
+	stream::len count)
+{
+	assert(this->parent);
+	assert((bits > 0) && (bits <= sizeof(T) * 8));
+
+	// Merge in the rest of a byte that was part way through being written, and
+	// put back any changes, so the block buffer holds everything from here on.
+	if ((this->origBufByte == WASNT_BUFFERED) && (this->curBitPos < 8)) {
+		unsigned int dummy;
+		this->read(0, &dummy);
+		if (this->origBufByte == WASNT_BUFFERED) return 0; // EOF
+	}
+	this->writeBufByte();
+
+	uint64_t pos = (this->curBitPos == 8)
+		? this->offset * 8
+		: (this->offset - 1) * 8 + this->curBitPos;
+
+	stream::len done = 0;
+	while (done < count) {
+		stream::pos byte = pos / 8;
+		if ((byte < this->blockStart) || (byte >= this->blockStart + this->blockLen)) {
+			this->loadBlock(byte);
+			if (this->blockLen == 0) break; // EOF
+		}
+		const uint8_t *data = this->block.data() + (byte - this->blockStart);
+		const uint8_t *end = this->block.data() + this->blockLen;
+		uint64_t lenBits = (end - data) * 8 - pos % 8;
+		stream::len n = std::min<stream::len>(count - done, lenBits / bits);
+		if (n == 0) {
+			// The next value runs off the end of the block
+			if (this->blockStart == byte) break; // EOF
+			this->loadBlock(byte);
+			continue;
+		}
+		if (this->endianType == bitstream::littleEndian) {
+			unpack<bitstream::littleEndian>(data, end, pos % 8, bits, out + done, n);
+		} else {
+			unpack<bitstream::bigEndian>(data, end, pos % 8, bits, out + done, n);
+		}
+		done += n;
+		pos += n * bits;
+	}
+
+	// Leave things as read() would have
+	this->offset = pos / 8;
+	if (pos % 8) {
+		this->readParentByte(this->offset, &this->bufByte);
+		this->origBufByte = this->bufByte;
+		this->curBitPos = pos % 8;
+		this->offset++;
+	} else {
+		this->origBufByte = INITIAL_VALUE;
+		this->curBitPos = 8;
+		this->bufByte = 0;
+	}
+	return done;
+}
+
+stream::len bitstream::read_array(unsigned int bits, uint16_t *out,
+	stream::len count)
+{
+	return this->readValues(bits, out, count);
+}
+
+stream::len bitstream::read_array(unsigned int bits, uint32_t *out,
+	stream::len count)
+{
+	return this->readValues(bits, out, count);
+}
+
+template <typename T>
+void bitstream::writeValues(unsigned int bits, const T *in, stream::len count)
+{
+	assert(this->parent);
+	assert((bits > 0) && (bits <= sizeof(T) * 8));
+
+	// Bits already in the current byte, in the order they will be written out
+	uint64_t acc = 0;
+	unsigned int lenAcc = 0;
+	stream::pos byte;
+	if (this->curBitPos == 8) {
+		this->writeBufByte();
+		byte = this->offset;
+	} else {
+		if ((uint64_t)count * bits < 8u - this->curBitPos) {
+			// Not enough to finish the byte, so the bits after it must be kept
+			for (stream::len i = 0; i < count; i++) this->write(bits, in[i]);
+			return;
+		}
+		lenAcc = this->curBitPos;
+		if (this->endianType == bitstream::littleEndian) {
+			acc = this->bufByte & ((1u << lenAcc) - 1);
+		} else {
+			acc = this->bufByte >> (8 - lenAcc);
+		}
+		byte = (this->origBufByte >= 0) ? this->offset - 1 : this->offset;
+	}
+
+	uint8_t chunk[1024];
+	std::size_t lenChunk = 0;
+	bool little = this->endianType == bitstream::littleEndian;
+	for (stream::len i = 0; i < count; i++) {
+		assert((bits == 32) || (in[i] < (1u << bits)));
+		if (little) {
+			acc |= (uint64_t)in[i] << lenAcc;
+		} else {
+			acc = (acc << bits) | in[i];
+		}
+		lenAcc += bits;
+		if (lenAcc >= 32) {
+			lenAcc -= 32;
+			uint32_t v;
+			if (little) {
+				v = (uint32_t)acc;
+				acc >>= 32;
+				chunk[lenChunk++] = v;
+				chunk[lenChunk++] = v >> 8;
+				chunk[lenChunk++] = v >> 16;
+				chunk[lenChunk++] = v >> 24;
+			} else {
+				v = (uint32_t)(acc >> lenAcc);
+				acc &= ((uint64_t)1 << lenAcc) - 1;
+				chunk[lenChunk++] = v >> 24;
+				chunk[lenChunk++] = v >> 16;
+				chunk[lenChunk++] = v >> 8;
+				chunk[lenChunk++] = v;
+			}
+			if (lenChunk == sizeof(chunk)) {
+				this->writeParentBytes(byte, chunk, lenChunk);
+				byte += lenChunk;
+				lenChunk = 0;
+			}
+		}
+	}
+	while (lenAcc >= 8) {
+		lenAcc -= 8;
+		if (little) {
+			chunk[lenChunk++] = (uint8_t)acc;
+			acc >>= 8;
+		} else {
+			chunk[lenChunk++] = (uint8_t)(acc >> lenAcc);
+		}
+	}
+	this->writeParentBytes(byte, chunk, lenChunk);
+	byte += lenChunk;
+
+	// Leave any last partial byte as write() would have
+	this->offset = byte;
+	if (lenAcc) {
+		this->bufByte = little ? (uint8_t)acc : (uint8_t)(acc << (8 - lenAcc));
+		this->origBufByte = WASNT_BUFFERED;
+		this->curBitPos = lenAcc;
+	} else {
+		this->bufByte = 0;
+		this->origBufByte = INITIAL_VALUE;
+		this->curBitPos = 8;
+	}
+	return;
+}
+
+void bitstream::write_array(unsigned int bits, const uint16_t *in,
+	stream::len count)
+{
+	this->writeValues(bits, in, count);
+	return;
+}
+
+void bitstream::write_array(unsigned int bits, const uint32_t *in,
+	stream::len count)
+{
+	this->writeValues(bits, in, count);
+	return;
+}
+
+int bitstream::read(const uint8_t **in, const uint8_t *inEnd,
+	unsigned int bits, unsigned int *out)
+{
+	if (this->endianType == bitstream::littleEndian) {
+		return this->read<bitstream::littleEndian>(in, inEnd, bits, out);
+	}
+	return this->read<bitstream::bigEndian>(in, inEnd, bits, out);
+}
+
+unsigned int bitstream::peek(const uint8_t *in, const uint8_t *inEnd,
+	unsigned int bits, unsigned int *out) const
+{
+	if (this->endianType == bitstream::littleEndian) {
+		return this->peek<bitstream::littleEndian>(in, inEnd, bits, out);
+	}
+	return this->peek<bitstream::bigEndian>(in, inEnd, bits, out);
+}
+
+void bitstream::consume(const uint8_t **in, const uint8_t *inEnd,
+	unsigned int bits)
+{
+	if (this->endianType == bitstream::littleEndian) {
+		this->consume<bitstream::littleEndian>(in, inEnd, bits);
+	} else {
+		this->consume<bitstream::bigEndian>(in, inEnd, bits);
+	}
+	return;
+}
+
+int bitstream::readSlow(const uint8_t **in, const uint8_t *inEnd,
+	unsigned int bits, unsigned int *out)
+{
+	return this->read([in, inEnd](uint8_t *b) {
+		if (*in >= inEnd) return 0;
+		*b = *(*in)++;
+		return 1;
+	}, bits, out);
+}
+
+int bitstream::write(uint8_t **out, uint8_t *outEnd, unsigned int bits,
+	unsigned int in)
+{
+	assert((bits == 32) || (in < (1u << bits)));
+	if (
+		(outEnd - *out < 8)
+		|| (this->origBufByte >= 0)
+		|| (this->parent)
+		|| (bits == 0)
+	) {
+		// Close to the end of the buffer, or a write following a read, so do it
+		// one byte at a time.
+		return this->write([out, outEnd](uint8_t b) {
+			if (*out >= outEnd) return 0;
+			*(*out)++ = b;
+			return 1;
+		}, bits, in);
+	}
+
+	// Number of bits already written into bufByte.  The byte is only written
+	// out when the next bit arrives, so a full byte may still be waiting.
+	unsigned int used = (this->origBufByte == INITIAL_VALUE) ? 0 : this->curBitPos;
+	unsigned int total = used + bits;
+	// Write out every byte that has been completed, except the last one
+	unsigned int lenBytes = (total - 1) / 8;
+	unsigned int left = total - lenBytes * 8;
+	uint64_t word;
+	if (this->endianType == bitstream::littleEndian) {
+		uint64_t acc = (uint64_t)(this->bufByte & ((1u << used) - 1))
+			| ((uint64_t)in << used);
+		word = htole64(acc);
+		this->bufByte = acc >> (lenBytes * 8);
+	} else {
+		uint64_t acc = ((uint64_t)(this->bufByte >> (8 - used)) << bits) | in;
+		acc <<= 64 - total; // align to MSB
+		word = htobe64(acc);
+		this->bufByte = acc >> (56 - lenBytes * 8);
+	}
+	memcpy(*out, &word, sizeof(word));
+	*out += lenBytes;
+	this->curBitPos = left;
+	this->origBufByte = WASNT_BUFFERED;
+	return bits;
+}
+
+void bitstream::append(uint8_t **out, uint8_t *outEnd, const uint8_t *in,
+	uint64_t bits)
+{
+	assert(!this->parent);
+	assert(this->origBufByte < 0);
+	uint64_t lenBytes = bits / 8;
+	unsigned int lenTail = bits % 8;
+
+	if (
+		(this->origBufByte == INITIAL_VALUE)
+		|| (this->curBitPos == 8)
+	) {
+		// On a byte boundary, so the bytes can be copied straight across once
+		// any completed byte still being held has been written
+		this->flushByte(out, outEnd);
+		uint64_t len = std::min<uint64_t>(lenBytes, outEnd - *out);
+		memcpy(*out, in, len);
+		*out += len;
+		in += lenBytes;
+	} else {
+		// Shift the data into place, four bytes at a time
+		const uint8_t *inEnd = in + lenBytes;
+		while (inEnd - in >= 4) {
+			uint32_t val;
+			if (this->endianType == bitstream::littleEndian) {
+				val = in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+			} else {
+				val = ((uint32_t)in[0] << 24) | (in[1] << 16) | (in[2] << 8) | in[3];
+			}
+			this->write(out, outEnd, 32, val);
+			in += 4;
+		}
+		while (in < inEnd) this->write(out, outEnd, 8, *in++);
+	}
+
+	if (lenTail) {
+		if (this->endianType == bitstream::littleEndian) {
+			this->write(out, outEnd, lenTail, *in & ((1 << lenTail) - 1));
+		} else {
+			this->write(out, outEnd, lenTail, *in >> (8 - lenTail));
+		}
+	}
+	return;
+}
+
 stream::pos bitstream::seek(stream::delta off, stream::seek_from way)
 {
 	assert(this->parent);
@@ -329,7 +807,11 @@ void bitstream::flush()
 {
 	assert(this->parent);
 
-	if (this->origBufByte == INITIAL_VALUE) return; // nothing to flush
+	if (this->origBufByte == INITIAL_VALUE) {
+		// No partial byte, but there may be whole ones still in the block buffer
+		if (this->writeBlock()) this->parent->flush();
+		return;
+	}
 
 	if (this->curBitPos < 8) {
 		// Partial byte.  Read the rest of the byte to trigger a merge.
@@ -339,6 +821,7 @@ void bitstream::flush()
 
 	// Write out the buf byte (if it has been changed)
 	this->writeBufByte();
+	this->writeBlock();
 	this->parent->flush();
 	return;
 }
@@ -349,11 +832,26 @@ void bitstream::changeEndian(bitstream::endian endianType)
 	return;
 }
 
-bitstream::endian bitstream::getEndian()
+bitstream::endian bitstream::getEndian() const
 {
 	return this->endianType;
 }
 
+void bitstream::saveState(stream::output& s) const
+{
+	write_packed(s, u8(this->curBitPos), u8(this->bufByte),
+		s32le(this->origBufByte));
+	return;
+}
+
+void bitstream::loadState(stream::input& s)
+{
+	read_packed(s, u8(this->curBitPos), u8(this->bufByte),
+		s32le(this->origBufByte));
+	if (this->curBitPos > 8) throw stream::read_error("Invalid bitstream state");
+	return;
+}
+
 void bitstream::flushByte()
 {
 	this->flushByte(nullptr);
@@ -363,8 +861,10 @@ void bitstream::flushByte()
 void bitstream::flushByte(fn_putnextchar fnNextChar)
 {
 	// Write out the buf byte (if it has been changed)
-	if (this->parent) this->writeBufByte();
-	else {
+	if (this->parent) {
+		this->writeBufByte();
+		this->writeBlock();
+	} else {
 		if (
 			(this->origBufByte != INITIAL_VALUE) && // if not first read
 			(this->bufByte != this->origBufByte)    // and bufbyte has been modified
@@ -381,6 +881,16 @@ void bitstream::flushByte(fn_putnextchar fnNextChar)
 	return;
 }
 
+void bitstream::flushByte(uint8_t **out, uint8_t *outEnd)
+{
+	this->flushByte([out, outEnd](uint8_t b) {
+		if (*out >= outEnd) return 0;
+		*(*out)++ = b;
+		return 1;
+	});
+	return;
+}
+
 void bitstream::writeBufByte()
 {
 	assert(this->parent);
@@ -405,14 +915,101 @@ void bitstream::writeBufByte()
 		// between read and write operations on the same stream.)
 
 		// Write the updated byte to the parent stream
-		this->parent->seekp(this->offset, stream::start);
-		this->parent->write(&this->bufByte, 1);
+		this->writeParentByte(this->offset, this->bufByte);
 		this->offset++;
 		this->origBufByte = this->bufByte; // bufByte now matches on-disk version
 	} // else no modification, or the prev byte hadn't been cached
 	return;
 }
 
+int bitstream::readParentByte(stream::pos pos, uint8_t *b)
+{
+	if ((pos < this->blockStart) || (pos >= this->blockStart + this->blockLen)) {
+		this->loadBlock(pos);
+		if (this->blockLen == 0) return 0; // EOF
+	}
+	*b = this->block[pos - this->blockStart];
+	return 1;
+}
+
+void bitstream::writeParentByte(stream::pos pos, uint8_t b)
+{
+	if (
+		(pos < this->blockStart)
+		|| (pos > this->blockStart + this->blockLen)
+		|| (pos - this->blockStart >= this->block.size())
+	) {
+		this->loadBlock(pos);
+		// If pos is past the end of the parent the block will be empty, and the
+		// write below will extend it.
+	}
+	stream::len i = pos - this->blockStart;
+	this->block[i] = b;
+	if (i == this->blockLen) this->blockLen++;
+	if (this->dirtyEnd == 0) {
+		this->dirtyStart = i;
+		this->dirtyEnd = i + 1;
+	} else {
+		if (i < this->dirtyStart) this->dirtyStart = i;
+		if (i >= this->dirtyEnd) this->dirtyEnd = i + 1;
+	}
+	return;
+}
+
+void bitstream::writeParentBytes(stream::pos pos, const uint8_t *data,
+	stream::len len)
+{
+	while (len) {
+		if (
+			(pos < this->blockStart)
+			|| (pos > this->blockStart + this->blockLen)
+			|| (pos - this->blockStart >= this->block.size())
+		) {
+			this->loadBlock(pos);
+		}
+		stream::len i = pos - this->blockStart;
+		stream::len n = std::min<stream::len>(len, this->block.size() - i);
+		memcpy(&this->block[i], data, n);
+		if (i + n > this->blockLen) this->blockLen = i + n;
+		if (this->dirtyEnd == 0) {
+			this->dirtyStart = i;
+			this->dirtyEnd = i + n;
+		} else {
+			if (i < this->dirtyStart) this->dirtyStart = i;
+			if (i + n > this->dirtyEnd) this->dirtyEnd = i + n;
+		}
+		pos += n;
+		data += n;
+		len -= n;
+	}
+	return;
+}
+
+void bitstream::loadBlock(stream::pos pos)
+{
+	this->writeBlock();
+	if (this->block.empty()) this->block.resize(BITSTREAM_BUFFER_SIZE);
+	this->blockStart = pos;
+	this->blockLen = this->parent->try_read_at(pos, this->block.data(),
+		this->block.size());
+	return;
+}
+
+bool bitstream::writeBlock()
+{
+	if (this->dirtyEnd == 0) return false;
+	stream::len len = this->dirtyEnd - this->dirtyStart;
+	if (
+		this->parent->try_write_at(this->blockStart + this->dirtyStart,
+			this->block.data() + this->dirtyStart, len) != len
+	) {
+		throw stream::incomplete_write(0);
+	}
+	this->dirtyStart = 0;
+	this->dirtyEnd = 0;
+	return true;
+}
+
 void bitstream::peekByte(uint8_t *buf, uint8_t *mask)
 {
 	*buf = (this->curBitPos == 8) ? 0x00 : this->bufByte;
@@ -0,0 +1,311 @@
+/**
+ * @file  checksum.cpp
+ * @brief CRC32, Adler32 and XOR checksums.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <camoto/checksum.hpp>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+// Compiled for any x86 CPU, with the PCLMULQDQ version only used if the CPU
+// running the code supports it.
+#define CAMOTO_CRC_PCLMUL
+#include <immintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#define CAMOTO_CRC_ARM
+#include <arm_acle.h>
+#endif
+
+namespace camoto {
+
+/// Lookup tables for slice-by-8 CRC32.
+struct crc_tables {
+	uint32_t t[8][256];
+
+	crc_tables()
+	{
+		for (unsigned int i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+			this->t[0][i] = c;
+		}
+		for (unsigned int i = 0; i < 256; i++) {
+			for (int k = 1; k < 8; k++) {
+				uint32_t prev = this->t[k - 1][i];
+				this->t[k][i] = (prev >> 8) ^ this->t[0][prev & 0xFF];
+			}
+		}
+	}
+};
+
+static const crc_tables& crcTables()
+{
+	static const crc_tables tables;
+	return tables;
+}
+
+static inline uint32_t load32le(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16)
+		| ((uint32_t)p[3] << 24);
+}
+
+/// CRC32 without the inversion at either end, eight bytes at a time.
+static uint32_t crc32Slice8(uint32_t crc, const uint8_t *data, std::size_t len)
+{
+	const crc_tables& tab = crcTables();
+	const uint32_t (*t)[256] = tab.t;
+	while (len >= 8) {
+		uint32_t a = load32le(data) ^ crc;
+		uint32_t b = load32le(data + 4);
+		crc = t[7][a & 0xFF] ^ t[6][(a >> 8) & 0xFF] ^ t[5][(a >> 16) & 0xFF]
+			^ t[4][a >> 24] ^ t[3][b & 0xFF] ^ t[2][(b >> 8) & 0xFF]
+			^ t[1][(b >> 16) & 0xFF] ^ t[0][b >> 24];
+		data += 8;
+		len -= 8;
+	}
+	while (len--) crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#ifdef CAMOTO_CRC_PCLMUL
+/// Does the CPU running this code have PCLMULQDQ and SSE4.1?
+static bool havePclmul()
+{
+	static const bool have = __builtin_cpu_supports("pclmul")
+		&& __builtin_cpu_supports("sse4.1");
+	return have;
+}
+
+/// CRC32 without the inversion at either end, folding 64 bytes at a time.
+/**
+ * This is the carry-less multiplication method from Intel's paper "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+ *
+ * @pre len is at least 64 and a multiple of 16.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32Pclmul(uint32_t crc, const uint8_t *buf, std::size_t len)
+{
+	// Folding constants and Barrett reduction values for the bit-reflected
+	// polynomial, from the paper.
+	alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+	alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+	alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+	alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	buf += 64;
+	len -= 64;
+
+	// Fold four blocks of 16 bytes at once
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		buf += 64;
+		len -= 64;
+	}
+
+	// Fold the four blocks into one
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// Fold in any remaining blocks of 16 bytes
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)buf);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		buf += 16;
+		len -= 16;
+	}
+
+	// Fold 128 bits down to 64
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction down to 32 bits
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return _mm_extract_epi32(x1, 1);
+}
+#endif // CAMOTO_CRC_PCLMUL
+
+#ifdef CAMOTO_CRC_ARM
+/// CRC32 without the inversion at either end, using the ARMv8 instructions.
+static uint32_t crc32Arm(uint32_t crc, const uint8_t *data, std::size_t len)
+{
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, data, sizeof(v));
+		crc = __crc32d(crc, v);
+		data += 8;
+		len -= 8;
+	}
+	while (len--) crc = __crc32b(crc, *data++);
+	return crc;
+}
+#endif // CAMOTO_CRC_ARM
+
+uint32_t crc32(uint32_t crc, const uint8_t *data, std::size_t len)
+{
+	crc = ~crc;
+#if defined(CAMOTO_CRC_PCLMUL)
+	if ((len >= 64) && havePclmul()) {
+		std::size_t lenBlocks = len & ~(std::size_t)15;
+		crc = crc32Pclmul(crc, data, lenBlocks);
+		data += lenBlocks;
+		len -= lenBlocks;
+	}
+	crc = crc32Slice8(crc, data, len);
+#elif defined(CAMOTO_CRC_ARM)
+	crc = crc32Arm(crc, data, len);
+#else
+	crc = crc32Slice8(crc, data, len);
+#endif
+	return ~crc;
+}
+
+uint32_t adler32(uint32_t adler, const uint8_t *data, std::size_t len)
+{
+	// Largest number of bytes that can be summed before b could overflow
+	const std::size_t NMAX = 5552;
+	uint32_t a = adler & 0xFFFF, b = adler >> 16;
+	while (len) {
+		std::size_t n = (len < NMAX) ? len : NMAX;
+		len -= n;
+		while (n >= 8) {
+			a += data[0]; b += a;
+			a += data[1]; b += a;
+			a += data[2]; b += a;
+			a += data[3]; b += a;
+			a += data[4]; b += a;
+			a += data[5]; b += a;
+			a += data[6]; b += a;
+			a += data[7]; b += a;
+			data += 8;
+			n -= 8;
+		}
+		while (n--) {
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+uint8_t xor8(uint8_t x, const uint8_t *data, std::size_t len)
+{
+	// XOR eight bytes at a time, then combine the lanes at the end
+	uint64_t acc = 0;
+	while (len >= 8) {
+		uint64_t v;
+		memcpy(&v, data, sizeof(v));
+		acc ^= v;
+		data += 8;
+		len -= 8;
+	}
+	acc ^= acc >> 32;
+	acc ^= acc >> 16;
+	acc ^= acc >> 8;
+	x ^= (uint8_t)acc;
+	while (len--) x ^= *data++;
+	return x;
+}
+
+checksum::checksum(checksum_type type)
+	:	algo(type)
+{
+	this->reset();
+}
+
+void checksum::reset()
+{
+	this->current = (this->algo == checksum_type::Adler32) ? 1 : 0;
+	return;
+}
+
+void checksum::update(const uint8_t *data, std::size_t len)
+{
+	switch (this->algo) {
+		case checksum_type::CRC32:
+			this->current = crc32(this->current, data, len);
+			break;
+		case checksum_type::Adler32:
+			this->current = adler32(this->current, data, len);
+			break;
+		case checksum_type::XOR8:
+			this->current = xor8(this->current, data, len);
+			break;
+	}
+	return;
+}
+
+uint32_t checksum::value() const
+{
+	return this->current;
+}
+
+checksum_type checksum::type() const
+{
+	return this->algo;
+}
+
+} // namespace camoto
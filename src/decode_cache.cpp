@@ -0,0 +1,160 @@
+/**
+ * @file  decode_cache.cpp
+ * @brief Process-wide cache of decoded data, shared between filtered streams.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <camoto/decode_cache.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Last content number handed out by a source_tag.
+static std::atomic<uint64_t> lastContentNumber(0);
+
+source_tag::source_tag()
+	:	value(0)
+{
+}
+
+uint64_t source_tag::get() const
+{
+	uint64_t v = this->value.load(std::memory_order_relaxed);
+	if (v) return v;
+	uint64_t next = ++lastContentNumber;
+	// Another thread may have got in first, in which case use its number
+	if (this->value.compare_exchange_strong(v, next)) return next;
+	return v;
+}
+
+void source_tag::retire()
+{
+	uint64_t old = this->value.exchange(0);
+	if (old) decode_cache::shared().invalidate(old);
+	return;
+}
+
+decode_cache& decode_cache::shared()
+{
+	// Never destroyed, so streams can still be written to during shutdown
+	static decode_cache *c = new decode_cache();
+	return *c;
+}
+
+decode_cache::decode_cache()
+	:	lenBudget(0),
+		lenUsed(0)
+{
+}
+
+void decode_cache::set_budget(std::size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->lenBudget = bytes;
+	this->evict();
+	return;
+}
+
+std::size_t decode_cache::budget() const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->lenBudget;
+}
+
+std::size_t decode_cache::used() const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->lenUsed;
+}
+
+std::size_t decode_cache::count() const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->index.size();
+}
+
+decode_cache::content decode_cache::find(const source_id& source,
+	const std::string& signature)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	auto it = this->index.find(
+		key(source.content, source.offset, source.length, signature));
+	if (it == this->index.end()) return content();
+	// Move to the front of the list, as it has just been used
+	this->entries.splice(this->entries.begin(), this->entries, it->second);
+	return it->second->second;
+}
+
+void decode_cache::add(const source_id& source, const std::string& signature,
+	content data)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (data->size() > this->lenBudget) return;
+
+	key k(source.content, source.offset, source.length, signature);
+	auto it = this->index.find(k);
+	if (it != this->index.end()) this->erase(it);
+
+	this->lenUsed += data->size();
+	this->entries.emplace_front(k, std::move(data));
+	this->index[k] = this->entries.begin();
+	this->evict();
+	return;
+}
+
+void decode_cache::invalidate(uint64_t contentNumber)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	// Keys are sorted by content number first, so its entries are together
+	auto it = this->index.lower_bound(
+		key(contentNumber, 0, 0, std::string()));
+	while ((it != this->index.end()) && (std::get<0>(it->first) == contentNumber)) {
+		auto next = std::next(it);
+		this->erase(it);
+		it = next;
+	}
+	return;
+}
+
+void decode_cache::clear()
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->index.clear();
+	this->entries.clear();
+	this->lenUsed = 0;
+	return;
+}
+
+void decode_cache::evict()
+{
+	while ((this->lenUsed > this->lenBudget) && (!this->entries.empty())) {
+		auto& last = this->entries.back();
+		this->erase(this->index.find(last.first));
+	}
+	return;
+}
+
+void decode_cache::erase(std::map<key, lru_list::iterator>::iterator it)
+{
+	this->lenUsed -= it->second->second->size();
+	this->entries.erase(it->second);
+	this->index.erase(it);
+	return;
+}
+
+} // namespace stream
+} // namespace camoto
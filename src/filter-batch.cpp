@@ -0,0 +1,108 @@
+/**
+ * @file  filter-batch.cpp
+ * @brief Run many independent filter jobs at once on a thread pool.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cassert>
+#include <string.h>
+#include <camoto/filter-batch.hpp>
+#include <camoto/stats.hpp>
+
+namespace camoto {
+
+/// Resources kept by each worker thread between jobs.
+struct filter_worker {
+	std::shared_ptr<filter> algo;  ///< Filter instance, created on first use
+	std::vector<uint8_t> bufIn;    ///< Data read from the source
+	std::vector<uint8_t> bufOut;   ///< Filtered data waiting to be written
+};
+
+/// Run one job on a worker.
+static void filter_one(filter_job& job, filter_worker& w,
+	const fn_create_filter& create)
+{
+	if (!w.algo) {
+		w.algo = create();
+		w.bufIn.resize(BUFFER_SIZE);
+		w.bufOut.resize(COPY_BUFFER_SIZE);
+	}
+	w.algo->reset(job.source->size());
+
+	// Data the filter would throw away is never read
+	stream::pos posIn = w.algo->skip_leading_input();
+	stream::len lenLeftover = 0, lenPending = 0;
+	stream::len lenIn, lenOut;
+	do {
+		stream::len lenRead = job.source->try_read_at(posIn,
+			w.bufIn.data() + lenLeftover, BUFFER_SIZE - lenLeftover);
+		posIn += lenRead;
+		lenRead += lenLeftover;
+
+		// Make sure there is always a full block of room for the filter
+		if (lenPending + BUFFER_SIZE > w.bufOut.size()) {
+			job.dest->write(w.bufOut.data(), lenPending);
+			lenPending = 0;
+		}
+
+		lenIn = lenRead;
+		lenOut = BUFFER_SIZE;
+		CAMOTO_STATS_TRANSFORM(*w.algo, w.bufOut.data() + lenPending, &lenOut,
+			w.bufIn.data(), &lenIn);
+		assert(lenIn <= lenRead);
+		assert(lenOut <= BUFFER_SIZE);
+		lenPending += lenOut;
+
+		lenLeftover = lenRead - lenIn;
+		if (lenLeftover) {
+			memmove(w.bufIn.data(), w.bufIn.data() + lenIn, lenLeftover);
+		}
+	} while ((lenIn != 0) || (lenOut != 0));
+
+	if (lenPending) job.dest->write(w.bufOut.data(), lenPending);
+	job.dest->flush();
+	return;
+}
+
+unsigned int filter_many(std::vector<filter_job>& jobs,
+	fn_create_filter create, thread_pool *pool)
+{
+	std::unique_ptr<thread_pool> localPool;
+	if (!pool) {
+		localPool.reset(new thread_pool());
+		pool = localPool.get();
+	}
+
+	std::vector<filter_worker> workers(pool->size());
+	std::atomic<unsigned int> failures(0);
+	for (auto& job : jobs) {
+		job.error = nullptr;
+		pool->submit([&job, &workers, &create, &failures](unsigned int index) {
+			try {
+				filter_one(job, workers[index], create);
+			} catch (...) {
+				job.error = std::current_exception();
+				failures++;
+			}
+		});
+	}
+	pool->wait();
+	return failures;
+}
+
+} // namespace camoto
@@ -0,0 +1,193 @@
+/**
+ * @file  filter-chain.cpp
+ * @brief Filter object that runs data through several other filters in turn.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <string.h>
+#include <camoto/filter-chain.hpp>
+#include <camoto/stats.hpp>
+
+namespace camoto {
+
+/// Size of each buffer between filters.
+/**
+ * This is twice the amount given to each filter call, so a filter always has
+ * a full BUFFER_SIZE of space to write into, even if the next filter has not
+ * yet read everything from the previous call.
+ */
+#define CHAIN_BUFFER_SIZE (BUFFER_SIZE * 2)
+
+filter_chain::filter_chain()
+{
+}
+
+filter_chain::filter_chain(std::vector<std::shared_ptr<filter>> filters)
+{
+	for (auto& f : filters) this->add(f);
+}
+
+void filter_chain::add(std::shared_ptr<filter> f)
+{
+	stage s;
+	s.algo = f;
+	s.start = 0;
+	s.len = 0;
+	s.done = false;
+	this->stages.push_back(std::move(s));
+	return;
+}
+
+void filter_chain::reset(stream::len lenInput)
+{
+	for (auto& s : this->stages) {
+		s.algo->reset(lenInput);
+		s.start = 0;
+		s.len = 0;
+		s.done = false;
+	}
+	return;
+}
+
+stream::len filter_chain::skip_leading_input()
+{
+	if (this->stages.empty()) return 0;
+	return this->stages.front().algo->skip_leading_input();
+}
+
+void filter_chain::use_contiguous_output()
+{
+	if (!this->stages.empty()) this->stages.back().algo->use_contiguous_output();
+	return;
+}
+
+std::string filter_chain::signature() const
+{
+	std::string sig = "filter_chain(";
+	for (auto& s : this->stages) {
+		std::string part = s.algo->signature();
+		if (part.empty()) return std::string();
+		if (&s != &this->stages.front()) sig += ",";
+		sig += part;
+	}
+	return sig + ")";
+}
+
+void filter_chain::transform(uint8_t *out, stream::len *lenOut,
+	const uint8_t *in, stream::len *lenIn)
+{
+	std::size_t num = this->stages.size();
+	if (num == 0) {
+		stream::len amt = std::min(*lenIn, *lenOut);
+		memcpy(out, in, amt);
+		*lenIn = *lenOut = amt;
+		return;
+	}
+	if (num == 1) {
+		CAMOTO_STATS_TRANSFORM(*this->stages[0].algo, out, lenOut, in, lenIn);
+		return;
+	}
+
+	bool inputEnded = (*lenIn == 0);
+	bool firstRan = false;
+	stream::len consumed = 0, produced = 0;
+
+	// Keep running the filters until something comes out the end, or until
+	// nothing more can happen without more input.
+	for (;;) {
+		bool progress = false;
+		for (std::size_t k = 0; k < num; k++) {
+			stage& s = this->stages[k];
+			if (s.done) continue;
+
+			// Work out where this filter reads from
+			const uint8_t *src;
+			stream::len lenSrc;
+			stage *prev = (k > 0) ? &this->stages[k - 1] : nullptr;
+			if (prev) {
+				// Wait for a full block unless the previous filter has finished
+				if ((prev->len < BUFFER_SIZE) && !prev->done) continue;
+				src = prev->buffer.data() + prev->start;
+				lenSrc = std::min<stream::len>(prev->len, BUFFER_SIZE);
+			} else {
+				// Only run the first filter once per call while there is input, so
+				// it always sees the caller's whole buffer.  Running it again on
+				// what it left over would hand it a few stray bytes in the middle
+				// of the data, which it would take to be the end of the input.
+				// Once the input has ended it can be run as often as needed to
+				// flush it.
+				if (firstRan && !inputEnded) continue;
+				src = in;
+				lenSrc = *lenIn;
+			}
+
+			// Work out where this filter writes to
+			uint8_t *dst;
+			stream::len lenDst;
+			bool last = (k == num - 1);
+			if (last) {
+				if (produced > 0) continue; // caller will call again
+				dst = out;
+				lenDst = *lenOut;
+			} else {
+				if (s.start + s.len + BUFFER_SIZE > CHAIN_BUFFER_SIZE) {
+					if (s.len > BUFFER_SIZE) continue; // next filter must read first
+					memmove(s.buffer.data(), s.buffer.data() + s.start, s.len);
+					s.start = 0;
+				}
+				if (s.buffer.size() < CHAIN_BUFFER_SIZE) {
+					s.buffer.resize(CHAIN_BUFFER_SIZE);
+				}
+				dst = s.buffer.data() + s.start + s.len;
+				lenDst = BUFFER_SIZE;
+			}
+
+			if (!prev) firstRan = true;
+			stream::len r = lenSrc, w = lenDst;
+			CAMOTO_STATS_TRANSFORM(*s.algo, dst, &w, src, &r);
+			if ((r == 0) && (w == 0)) {
+				s.done = true;
+			}
+			if (prev) {
+				prev->start += r;
+				prev->len -= r;
+				if (prev->len == 0) prev->start = 0;
+			} else {
+				consumed += r;
+			}
+			if (last) {
+				produced += w;
+			} else {
+				s.len += w;
+			}
+			progress = true;
+		}
+		if ((produced > 0) || !progress) break;
+	}
+
+	if ((consumed == 0) && (produced == 0) && !this->stages[num - 1].done) {
+		// Returning nothing would be taken as the end of the data
+		throw filter_error("Filter chain stalled: a filter neither read nor "
+			"wrote any data");
+	}
+	*lenIn = consumed;
+	*lenOut = produced;
+	return;
+}
+
+} // namespace camoto
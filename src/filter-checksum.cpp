@@ -0,0 +1,61 @@
+/**
+ * @file  filter-checksum.cpp
+ * @brief Filter that passes data through unchanged, checksumming it on the way.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <camoto/filter-checksum.hpp>
+
+namespace camoto {
+
+filter_checksum::filter_checksum(checksum_type type)
+	:	sum(type),
+		lenSum(0)
+{
+}
+
+void filter_checksum::reset(stream::len lenInput)
+{
+	this->sum.reset();
+	this->lenSum = 0;
+	return;
+}
+
+void filter_checksum::transform(uint8_t *out, stream::len *lenOut,
+	const uint8_t *in, stream::len *lenIn)
+{
+	stream::len len = (*lenOut > *lenIn) ? *lenIn : *lenOut;
+	memcpy(out, in, len);
+	this->sum.update(in, len);
+	this->lenSum += len;
+	*lenIn = len;
+	*lenOut = len;
+	return;
+}
+
+uint32_t filter_checksum::value() const
+{
+	return this->sum.value();
+}
+
+stream::len filter_checksum::length() const
+{
+	return this->lenSum;
+}
+
+} // namespace camoto
@@ -18,41 +18,35 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstring>
 #include <camoto/filter-crop.hpp>
 
 namespace camoto {
 
 filter_crop::filter_crop(stream::pos start)
 	:	start(start),
-		cropped(false)
+		lenSkip(start)
 {
 }
 
 void filter_crop::reset(stream::len lenInput)
 {
-	this->cropped = false;
+	this->lenSkip = this->start;
 	return;
 }
 
 void filter_crop::transform(uint8_t *out, stream::len *lenOut,
 	const uint8_t *in, stream::len *lenIn)
 {
-	stream::len r = 0;
-	if (!this->cropped) {
-		if (*lenIn < this->start) {
-			// Not enough space to read
-			*lenOut = 0;
-			*lenIn = 0;
-			return;
-		}
-		*lenIn -= this->start;
-		in += this->start;
-		r += this->start;
-		this->cropped = true;
-	}
+	// Drop as much of the start as has arrived so far
+	stream::len r = std::min(this->lenSkip, *lenIn);
+	this->lenSkip -= r;
+	in += r;
+	stream::len lenAvail = *lenIn - r;
 
 	// Copy as much data as will fit in the smallest buffer
-	stream::len minAmt = (*lenOut > *lenIn) ? *lenIn : *lenOut;
+	stream::len minAmt = std::min(*lenOut, lenAvail);
 	memcpy(out, in, minAmt);
 
 	*lenIn = minAmt + r;
@@ -60,4 +54,11 @@ void filter_crop::transform(uint8_t *out, stream::len *lenOut,
 	return;
 }
 
+stream::len filter_crop::skip_leading_input()
+{
+	stream::len r = this->lenSkip;
+	this->lenSkip = 0;
+	return r;
+}
+
 } // namespace camoto
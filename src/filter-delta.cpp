@@ -0,0 +1,215 @@
+/**
+ * @file  filter-delta.cpp
+ * @brief Filter that converts between samples and the differences between them.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <string.h>
+#include <camoto/filter-delta.hpp>
+#include <camoto/iostream_helpers.hpp> // also includes byteorder.hpp
+#include <camoto/util.hpp> // createString
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CAMOTO_DELTA_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace camoto {
+
+#ifdef CAMOTO_DELTA_SSE2
+/// Swap the bytes in each 16-bit lane.
+static inline __m128i swap16(__m128i x)
+{
+	return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+#endif
+
+/// Running sum of bytes.
+static uint8_t decode8(uint8_t *out, const uint8_t *in, std::size_t len,
+	uint8_t prev)
+{
+	std::size_t i = 0;
+#ifdef CAMOTO_DELTA_SSE2
+	__m128i p = _mm_set1_epi8((char)prev);
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		// Each step adds in the bytes twice as far back as the last one
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi8(x, p);
+		_mm_storeu_si128((__m128i *)(out + i), x);
+		// Copy the last byte into every lane, for the next block
+		x = _mm_unpackhi_epi8(x, x);
+		x = _mm_unpackhi_epi16(x, x);
+		p = _mm_shuffle_epi32(x, 0xFF);
+	}
+	if (i) prev = out[i - 1];
+#endif
+	for (; i < len; i++) {
+		prev += in[i];
+		out[i] = prev;
+	}
+	return prev;
+}
+
+/// Difference between each byte and the one before it.
+static uint8_t encode8(uint8_t *out, const uint8_t *in, std::size_t len,
+	uint8_t prev)
+{
+	std::size_t i = 0;
+#ifdef CAMOTO_DELTA_SSE2
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i before = _mm_or_si128(_mm_slli_si128(x, 1),
+			_mm_cvtsi32_si128(prev));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_sub_epi8(x, before));
+		prev = in[i + 15];
+	}
+#endif
+	for (; i < len; i++) {
+		out[i] = in[i] - prev;
+		prev = in[i];
+	}
+	return prev;
+}
+
+/// Running sum of 16-bit values, \e len bytes long.
+static uint16_t decode16(uint8_t *out, const uint8_t *in, std::size_t len,
+	uint16_t prev, bool big)
+{
+	std::size_t i = 0;
+#ifdef CAMOTO_DELTA_SSE2
+	// SSE2 is only on little-endian CPUs, so only big-endian data needs swapping
+	__m128i p = _mm_set1_epi16((short)prev);
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		if (big) x = swap16(x);
+		x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+		x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi16(x, p);
+		p = _mm_shufflehi_epi16(x, 0xFF);
+		p = _mm_shuffle_epi32(p, 0xFF);
+		if (big) x = swap16(x);
+		_mm_storeu_si128((__m128i *)(out + i), x);
+	}
+	if (i) prev = _mm_cvtsi128_si32(p) & 0xFFFF;
+#endif
+	for (; i + 2 <= len; i += 2) {
+		uint16_t v;
+		memcpy(&v, in + i, 2);
+		prev += big ? be16toh(v) : le16toh(v);
+		v = big ? htobe16(prev) : htole16(prev);
+		memcpy(out + i, &v, 2);
+	}
+	return prev;
+}
+
+/// Difference between each 16-bit value and the one before it.
+static uint16_t encode16(uint8_t *out, const uint8_t *in, std::size_t len,
+	uint16_t prev, bool big)
+{
+	std::size_t i = 0;
+#ifdef CAMOTO_DELTA_SSE2
+	for (; i + 16 <= len; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		if (big) x = swap16(x);
+		__m128i before = _mm_or_si128(_mm_slli_si128(x, 2),
+			_mm_cvtsi32_si128(prev));
+		prev = _mm_extract_epi16(x, 7);
+		x = _mm_sub_epi16(x, before);
+		if (big) x = swap16(x);
+		_mm_storeu_si128((__m128i *)(out + i), x);
+	}
+#endif
+	for (; i + 2 <= len; i += 2) {
+		uint16_t v;
+		memcpy(&v, in + i, 2);
+		uint16_t cur = big ? be16toh(v) : le16toh(v);
+		uint16_t d = cur - prev;
+		prev = cur;
+		v = big ? htobe16(d) : htole16(d);
+		memcpy(out + i, &v, 2);
+	}
+	return prev;
+}
+
+filter_delta::filter_delta(delta_type type, Direction direction)
+	:	type(type),
+		direction(direction),
+		prev(0)
+{
+}
+
+void filter_delta::reset(stream::len lenInput)
+{
+	this->prev = 0;
+	return;
+}
+
+void filter_delta::transform(uint8_t *out, stream::len *lenOut,
+	const uint8_t *in, stream::len *lenIn)
+{
+	stream::len len = std::min(*lenIn, *lenOut);
+	bool decode = (this->direction == Direction::Decode);
+	if (this->type == delta_type::U8) {
+		this->prev = decode
+			? decode8(out, in, len, this->prev)
+			: encode8(out, in, len, this->prev);
+	} else {
+		if ((*lenIn == 1) && (len == 1)) {
+			// Half a value at the end of the data
+			*out = *in;
+		} else {
+			len &= ~(stream::len)1;
+			bool big = (this->type == delta_type::U16BE);
+			this->prev = decode
+				? decode16(out, in, len, this->prev, big)
+				: encode16(out, in, len, this->prev, big);
+		}
+	}
+	*lenIn = len;
+	*lenOut = len;
+	return;
+}
+
+bool filter_delta::save_state(stream::output& s) const
+{
+	write_packed(s, u16le(this->prev));
+	return true;
+}
+
+void filter_delta::load_state(stream::input& s)
+{
+	try {
+		read_packed(s, u16le(this->prev));
+	} catch (const stream::read_error& e) {
+		throw filter_error("Saved delta state is invalid: " + e.get_message());
+	}
+	return;
+}
+
+std::string filter_delta::signature() const
+{
+	return createString("filter_delta(" << (int)this->type << ","
+		<< (int)this->direction << ")");
+}
+
+} // namespace camoto
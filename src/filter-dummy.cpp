@@ -41,4 +41,9 @@ void filter_dummy::transform(uint8_t *out, stream::len *lenOut,
 	return;
 }
 
+std::string filter_dummy::signature() const
+{
+	return "filter_dummy";
+}
+
 } // namespace camoto
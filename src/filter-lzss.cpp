@@ -21,20 +21,26 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <camoto/filter-lzss.hpp>
+#include <camoto/iostream_helpers.hpp>
+#include <camoto/thread_pool.hpp>
+#include <camoto/util.hpp> // createString
 
-/// How many bytes should be left in reserve
-/**
- * This is required to avoid trying to read or write the next codeword, and
- * running out of space in the middle of it, truncating the codeword.  Setting
- * this to 2 means there will always be enough room for a 16-bit codeword.
- * Since all the LZW code so far only goes up to 12-bit codewords this should
- * cover everything.
- */
-#define LZSS_LEFTOVER_BYTES 2
+/// Size of the hash table used to find matches, in bits.
+#define LZSS_HASH_BITS 12
+
+/// Hash the first two bytes of a possible match.
+#define LZSS_HASH(a, b) \
+	(((((uint32_t)(a) << 8) | (b)) * 2654435761u) >> (32 - LZSS_HASH_BITS))
+
+/// Number of bytes encoded at once in optimal mode.
+#define LZSS_BLOCK_SIZE 4096
 
 namespace camoto {
 
@@ -43,20 +49,27 @@ filter_lzss_decompress::filter_lzss_decompress(bitstream::endian endian, unsigne
 	:	data(endian),
 		sizeLength(sizeLength),
 		sizeDistance(sizeDistance),
+		contiguous(false),
+		lenDone(0),
 		state(State::S0_READ_FLAG),
 		maxDistance(1 << sizeDistance),
-		window(new uint8_t[maxDistance]),
+		window(new uint8_t[maxDistance]()),
 		posWindow(0),
-		lzssLength(0)
+		lzssLength(0),
+		lzssDistance(0)
 {
 }
 
 void filter_lzss_decompress::reset(stream::len lenInput)
 {
-	this->data.flushByte();
+	this->data = bitstream(this->data.getEndian());
+	this->contiguous = false;
+	this->lenDone = 0;
 	this->state = State::S0_READ_FLAG;
+	memset(this->window.get(), 0, this->maxDistance);
 	this->posWindow = 0;
 	this->lzssLength = 0;
+	this->lzssDistance = 0;
 	return;
 }
 
@@ -64,8 +77,17 @@ void filter_lzss_decompress::transform(uint8_t *out, stream::len *lenOut,
 	const uint8_t *in, stream::len *lenIn)
 {
 	stream::len r = 0, w = 0;
-	fn_getnextchar cbNext = std::bind(bitstreamFilterNextChar, &in, lenIn, &r,
-		std::placeholders::_1);
+	const uint8_t *inStart = in, *inEnd = in + *lenIn;
+	// Output before this point has been copied into the window.  Literals are
+	// only copied in when a back-reference needs them, so a run of them can be
+	// copied in one go.
+	stream::len wSynced = 0;
+
+	// Don't start reading a field that is cut off by the end of the buffer, as
+	// the bits already read would be lost.
+	auto available = [&in, inEnd, this](unsigned int bits) {
+		return (stream::len)(inEnd - in) * 8 + this->data.bufferedBits() >= bits;
+	};
 
 	// While there's more space to write, and either more data to read or
 	// more data to write
@@ -73,7 +95,8 @@ void filter_lzss_decompress::transform(uint8_t *out, stream::len *lenOut,
 		(w < *lenOut)      // more space to write into, and
 		&& (
 			(r < *lenIn)     // more data to read, or
-			|| (this->lzssLength) // more data to write, and
+			|| (this->data.bufferedBits()) // codes left in the last byte read, or
+			|| (this->lzssLength) // more data to write
 		)
 	) {
 		bool needMoreData = false;
@@ -82,7 +105,12 @@ void filter_lzss_decompress::transform(uint8_t *out, stream::len *lenOut,
 		switch (this->state) {
 
 			case State::S0_READ_FLAG:
-				bitsRead = this->data.read(cbNext, 1, &code);
+				if (!available(1)) {
+					needMoreData = true;
+					break;
+				}
+				bitsRead = this->data.read(&in, inEnd, 1, &code);
+				r = in - inStart;
 				if (bitsRead == 0) {
 					needMoreData = true;
 					break;
@@ -91,24 +119,34 @@ void filter_lzss_decompress::transform(uint8_t *out, stream::len *lenOut,
 					this->state = State::S1_COPY_BYTE;
 				} else {
 					this->state = State::S2_READ_LEN;
+					break;
 				}
-				break;
+				// Go straight on to the literal byte, unless it might be cut off
+				if (r >= *lenIn) break;
+				// fall through
 
 			case State::S1_COPY_BYTE:
-				bitsRead = this->data.read(cbNext, 8, &code);
+				if (!available(8)) {
+					needMoreData = true;
+					break;
+				}
+				bitsRead = this->data.read(&in, inEnd, 8, &code);
+				r = in - inStart;
 				if (bitsRead != 8) {
 					needMoreData = true;
 					break;
 				}
-				*out++ = code;
-				w++;
-				this->window[this->posWindow++] = code;
-				this->posWindow %= this->maxDistance;
+				out[w++] = code;
 				this->state = State::S0_READ_FLAG;
 				break;
 
 			case State::S2_READ_LEN:
-				bitsRead = this->data.read(cbNext, this->sizeLength, &code);
+				if (!available(this->sizeLength)) {
+					needMoreData = true;
+					break;
+				}
+				bitsRead = this->data.read(&in, inEnd, this->sizeLength, &code);
+				r = in - inStart;
 				if (bitsRead != this->sizeLength) {
 					needMoreData = true;
 					break;
@@ -118,50 +156,189 @@ void filter_lzss_decompress::transform(uint8_t *out, stream::len *lenOut,
 				break;
 
 			case State::S3_READ_DIST:
-				bitsRead = this->data.read(cbNext, this->sizeDistance, &code);
+				if (!available(this->sizeDistance)) {
+					needMoreData = true;
+					break;
+				}
+				bitsRead = this->data.read(&in, inEnd, this->sizeDistance, &code);
+				r = in - inStart;
 				if (bitsRead != this->sizeDistance) {
 					needMoreData = true;
 					break;
 				}
 				this->lzssDistance = 1 + code;
 				this->state = State::S4_COPY_REF;
-				break;
+				// fall through
 
-			case State::S4_COPY_REF:
-				if (this->lzssLength == 0) {
-					// Copy complete
-					this->state = State::S0_READ_FLAG;
-					break;
+			case State::S4_COPY_REF: {
+				stream::len len = std::min<stream::len>(this->lzssLength,
+					*lenOut - w);
+				uint8_t *dst = out + w;
+				stream::len lenFromWindow = std::min<stream::len>(len,
+					this->lzssDistance);
+
+				if (this->contiguous) {
+					// The first lzssDistance bytes are earlier output, apart from any
+					// that would come from before the start of the data.
+					stream::len lenBefore = this->lenDone + w;
+					stream::len lenZero = 0;
+					if (this->lzssDistance > lenBefore) {
+						lenZero = std::min<stream::len>(lenFromWindow,
+							this->lzssDistance - lenBefore);
+						memset(dst, 0, lenZero);
+					}
+					memcpy(dst + lenZero, dst - this->lzssDistance + lenZero,
+						lenFromWindow - lenZero);
+				} else {
+					// The back-reference may point at literals still waiting to go
+					// into the window.
+					this->addToWindow(out + wSynced, w - wSynced);
+
+					// The first lzssDistance bytes come from the window, which may
+					// mean wrapping around the end of it.
+					unsigned int src = (this->maxDistance + this->posWindow
+						- this->lzssDistance) % this->maxDistance;
+					stream::len lenFirst = std::min<stream::len>(lenFromWindow,
+						this->maxDistance - src);
+					memcpy(dst, &this->window[src], lenFirst);
+					memcpy(dst + lenFirst, &this->window[0], lenFromWindow - lenFirst);
+				}
+
+				// Anything more is a repeat of the bytes just written.  Copying longer
+				// and longer runs keeps each copy a whole number of repeats, and
+				// never overlapping.
+				for (stream::len done = lenFromWindow; done < len; ) {
+					stream::len lenChunk = std::min(done, len - done);
+					memcpy(dst + done, dst, lenChunk);
+					done += lenChunk;
 				}
 
-				*out = this->window[(this->maxDistance + this->posWindow - this->lzssDistance) % this->maxDistance];
-				this->window[this->posWindow++] = *out++;
-				this->posWindow %= this->maxDistance;
-				w++;
-				this->lzssLength--;
+				w += len;
+				if (!this->contiguous) {
+					this->addToWindow(dst, len);
+					wSynced = w;
+				}
+				this->lzssLength -= len;
+				if (this->lzssLength == 0) this->state = State::S0_READ_FLAG;
 				break;
+			}
 
 		}
 		if (needMoreData) break;
 	}
+	if (this->contiguous) {
+		this->lenDone += w;
+	} else {
+		this->addToWindow(out + wSynced, w - wSynced);
+	}
 
 	*lenIn = r;
 	*lenOut = w;
 	return;
 }
 
+void filter_lzss_decompress::use_contiguous_output()
+{
+	this->contiguous = true;
+	return;
+}
+
+bool filter_lzss_decompress::save_state(stream::output& s) const
+{
+	if (this->contiguous) return false;
+	this->data.saveState(s);
+	write_packed(s, u8((uint8_t)this->state), u32le(this->posWindow),
+		u32le(this->lzssLength), u32le(this->lzssDistance));
+	s.write(this->window.get(), this->maxDistance);
+	return true;
+}
 
-filter_lzss_compress::filter_lzss_compress(bitstream::endian endian, unsigned int sizeLength,
-			unsigned int sizeDistance)
+void filter_lzss_decompress::load_state(stream::input& s)
+{
+	uint8_t st;
+	try {
+		this->data.loadState(s);
+		read_packed(s, u8(st), u32le(this->posWindow), u32le(this->lzssLength),
+			u32le(this->lzssDistance));
+		s.read(this->window.get(), this->maxDistance);
+	} catch (const stream::read_error& e) {
+		throw filter_error("Saved LZSS state is invalid: " + e.get_message());
+	}
+	if (
+		(st > (uint8_t)State::S4_COPY_REF)
+		|| (this->posWindow >= this->maxDistance)
+		|| (this->lzssDistance > this->maxDistance)
+	) {
+		throw filter_error("Saved LZSS state is invalid");
+	}
+	this->state = (State)st;
+	return;
+}
+
+std::string filter_lzss_decompress::signature() const
+{
+	return createString("filter_lzss_decompress("
+		<< (this->data.getEndian() == bitstream::bigEndian ? "be" : "le") << ","
+		<< this->sizeLength << "," << this->sizeDistance << ")");
+}
+
+void filter_lzss_decompress::addToWindow(const uint8_t *data, stream::len len)
+{
+	if (len >= this->maxDistance) {
+		// Only the last maxDistance bytes will ever be referred to again
+		data += len - this->maxDistance;
+		len = this->maxDistance;
+	}
+	stream::len lenFirst = std::min<stream::len>(len,
+		this->maxDistance - this->posWindow);
+	memcpy(&this->window[this->posWindow], data, lenFirst);
+	memcpy(&this->window[0], data + lenFirst, len - lenFirst);
+	this->posWindow = (this->posWindow + len) % this->maxDistance;
+	return;
+}
+
+
+filter_lzss_compress::filter_lzss_compress(bitstream::endian endian,
+	unsigned int sizeLength, unsigned int sizeDistance, Effort effort)
 	:	data(endian),
 		sizeLength(sizeLength),
-		sizeDistance(sizeDistance)
+		sizeDistance(sizeDistance),
+		effort(effort),
+		maxDistance(1 << sizeDistance),
+		maxLength((1 << sizeLength) + 1),
+		sizeMatch(1 + sizeLength + sizeDistance),
+		bufStart(0),
+		posBuf(0),
+		head(1 << LZSS_HASH_BITS, 0),
+		prev(maxDistance, 0),
+		hashed(0),
+		haveNextMatch(false),
+		finished(false),
+		pending((effort == Effort::Optimal) ? LZSS_BLOCK_SIZE * 9 / 8 + 16 : 16),
+		pendingPos(0),
+		lenPending(0)
 {
+	assert(this->sizeMatch <= 32);
+	switch (effort) {
+		case Effort::Store: this->maxChain = 0; break;
+		case Effort::Greedy: this->maxChain = 16; break;
+		case Effort::Lazy: this->maxChain = 64; break;
+		case Effort::Optimal: this->maxChain = 256; break;
+	}
 }
 
 void filter_lzss_compress::reset(stream::len lenInput)
 {
-	this->data.flushByte();
+	this->data = bitstream(this->data.getEndian());
+	this->buf.clear();
+	this->bufStart = 0;
+	this->posBuf = 0;
+	std::fill(this->head.begin(), this->head.end(), 0);
+	this->hashed = 0;
+	this->haveNextMatch = false;
+	this->finished = false;
+	this->pendingPos = 0;
+	this->lenPending = 0;
 	return;
 }
 
@@ -169,33 +346,360 @@ void filter_lzss_compress::transform(uint8_t *out, stream::len *lenOut,
 	const uint8_t *in, stream::len *lenIn)
 {
 	stream::len r = 0, w = 0;
-	fn_putnextchar cbNext = std::bind(bitstreamFilterPutChar, &out, lenOut, &w,
-		std::placeholders::_1);
-	while (
-		(w + LZSS_LEFTOVER_BYTES < *lenOut) && ( // leave some leftover bytes to guarantee the codeword will be written
-			(
-				(r + 1 < *lenIn) || // Make sure there's at least one leftover byte
-				((r < *lenIn) && (*lenIn < 2)) // unless it's the last incoming byte
-			)
-		)
-	) {
-		unsigned int bitsWritten = this->data.write(cbNext, 9, *in);
+	for (;;) {
+		while ((this->pendingPos < this->lenPending) && (w < *lenOut)) {
+			out[w++] = this->pending[this->pendingPos++];
+		}
+		if (this->pendingPos < this->lenPending) break; // out is full
+		this->pendingPos = this->lenPending = 0;
 
-		in++;
-		r++;
-		if (bitsWritten < 9) {
-			// EOF
-			break;
+		// Codewords are written straight into out if there's room for the most
+		// one step can produce, otherwise they are collected in pending first so
+		// a codeword is never cut off.
+		uint8_t *dst, *dstEnd;
+		bool direct = *lenOut - w >= this->pending.size();
+		if (direct) {
+			dst = out + w;
+			dstEnd = out + *lenOut;
+		} else {
+			dst = this->pending.data();
+			dstEnd = dst + this->pending.size();
 		}
-	}
+		uint8_t *dstStart = dst;
 
-	// Do the flush separately, in case we just ran out of output space
-	if ((w < *lenOut) && (*lenIn == 0)) {
-		this->data.flushByte(cbNext);
+		if (!this->step(&dst, dstEnd, in, *lenIn, &r)) break;
+
+		if (direct) w += dst - dstStart;
+		else this->lenPending = dst - dstStart;
 	}
 	*lenIn = r;
 	*lenOut = w;
 	return;
 }
 
+stream::len filter_lzss_compress::measure(const uint8_t *in,
+	stream::len *lenIn)
+{
+	stream::len r = 0;
+	stream::len w = this->lenPending - this->pendingPos;
+	this->pendingPos = this->lenPending = 0;
+
+	// Each step's codewords are packed into pending and then dropped
+	uint8_t *scratch = this->pending.data();
+	for (;;) {
+		uint8_t *dst = scratch;
+		if (!this->step(&dst, scratch + this->pending.size(), in, *lenIn, &r)) {
+			break;
+		}
+		w += dst - scratch;
+	}
+	*lenIn = r;
+	return w;
+}
+
+uint64_t filter_lzss_compress::compressBlock(const uint8_t *in,
+	stream::len lenIn, stream::len lenHistory, std::vector<uint8_t> *out)
+{
+	this->reset(lenIn);
+
+	// Prime the window with the data the decompressor will already have
+	stream::len lenPrime = std::min<stream::len>(lenHistory, this->maxDistance);
+	this->buf.assign(in - lenPrime, in);
+	this->posBuf = lenPrime;
+
+	out->resize(lenIn * 9 / 8 + this->pending.size() * 2);
+	uint8_t *dst = out->data();
+
+	// Each step writes no more than fits in pending, so make sure there is
+	// always that much room left.
+	const std::ptrdiff_t lenStep = this->pending.size();
+	auto makeRoom = [out, &dst, lenStep]() {
+		if (out->data() + out->size() - dst < lenStep) {
+			std::size_t pos = dst - out->data();
+			out->resize(out->size() * 2);
+			dst = out->data() + pos;
+		}
+		return out->data() + out->size();
+	};
+
+	stream::len r = 0;
+	while ((r < lenIn) && this->step(&dst, makeRoom(), in, lenIn, &r));
+	while (this->encode(&dst, makeRoom(), true));
+
+	uint8_t *dstEnd = makeRoom();
+	unsigned int lenTail = this->data.pendingBits();
+	this->data.flushByte(&dst, dstEnd);
+	this->finished = true;
+
+	out->resize(dst - out->data());
+	return out->size() * 8 - (lenTail ? 8 - lenTail : 0);
+}
+
+std::string lzss_compress_parallel(const uint8_t *in, stream::len lenIn,
+	bitstream::endian endian, unsigned int sizeLength, unsigned int sizeDistance,
+	filter_lzss_compress::Effort effort, thread_pool *pool, stream::len lenBlock)
+{
+	if (lenBlock == 0) lenBlock = lenIn;
+	std::size_t numBlocks = std::max<stream::len>(1,
+		(lenIn + lenBlock - 1) / lenBlock);
+
+	std::vector<std::vector<uint8_t>> blocks(numBlocks);
+	std::vector<uint64_t> bits(numBlocks);
+
+	std::unique_ptr<thread_pool> localPool;
+	if (!pool && (numBlocks > 1)) {
+		localPool.reset(new thread_pool());
+		pool = localPool.get();
+	}
+	if (!pool) {
+		filter_lzss_compress f(endian, sizeLength, sizeDistance, effort);
+		bits[0] = f.compressBlock(in, lenIn, 0, &blocks[0]);
+	} else {
+		std::vector<std::unique_ptr<filter_lzss_compress>> workers(pool->size());
+		for (std::size_t i = 0; i < numBlocks; i++) {
+			pool->submit([=, &workers, &blocks, &bits](unsigned int index) {
+				auto& f = workers[index];
+				if (!f) {
+					f.reset(new filter_lzss_compress(endian, sizeLength, sizeDistance,
+						effort));
+				}
+				stream::pos start = i * lenBlock;
+				bits[i] = f->compressBlock(in + start,
+					std::min<stream::len>(lenBlock, lenIn - start), start, &blocks[i]);
+			});
+		}
+		pool->wait();
+	}
+	if (numBlocks == 1) {
+		return std::string(blocks[0].begin(), blocks[0].end());
+	}
+
+	// Join the blocks up, shifting each one to start where the last one ended
+	uint64_t totalBits = 0;
+	for (auto b : bits) totalBits += b;
+	std::string result((totalBits + 7) / 8 + 8, '\0');
+	uint8_t *out = (uint8_t *)&result[0], *outEnd = out + result.size();
+	bitstream join(endian);
+	for (std::size_t i = 0; i < numBlocks; i++) {
+		join.append(&out, outEnd, blocks[i].data(), bits[i]);
+	}
+	join.flushByte(&out, outEnd);
+	result.resize(out - (uint8_t *)&result[0]);
+	return result;
+}
+
+bool filter_lzss_compress::step(uint8_t **out, uint8_t *outEnd,
+	const uint8_t *in, stream::len lenIn, stream::len *r)
+{
+	// Enough input to encode a whole block, plus a full-length match after it.
+	const std::size_t lenLookahead = LZSS_BLOCK_SIZE + this->maxLength + 1;
+
+	// Top up the lookahead buffer
+	std::size_t avail = this->buf.size() - this->posBuf;
+	if ((*r < lenIn) && (avail < lenLookahead)) {
+		std::size_t lenCopy = std::min<stream::len>(lenIn - *r,
+			lenLookahead - avail);
+		this->buf.insert(this->buf.end(), in + *r, in + *r + lenCopy);
+		*r += lenCopy;
+	}
+
+	if (this->encode(out, outEnd, lenIn == 0)) return true;
+	if ((lenIn == 0) && (!this->finished)) {
+		// No more data to read, write out whatever is left
+		this->data.flushByte(out, outEnd);
+		this->finished = true;
+		return true;
+	}
+	return false;
+}
+
+void filter_lzss_compress::insertUpTo(std::size_t end)
+{
+	if (this->buf.size() < 2) return;
+	std::size_t i = this->hashed - this->bufStart;
+	// The last byte can't be hashed until the one after it arrives
+	if (end > this->buf.size() - 1) end = this->buf.size() - 1;
+	for (; i < end; i++) {
+		uint32_t h = LZSS_HASH(this->buf[i], this->buf[i + 1]);
+		stream::pos abs = this->bufStart + i;
+		this->prev[abs % this->maxDistance] = this->head[h];
+		this->head[h] = abs + 1;
+	}
+	if (i > this->hashed - this->bufStart) this->hashed = this->bufStart + i;
+	return;
+}
+
+unsigned int filter_lzss_compress::findMatch(std::size_t pos,
+	std::size_t limit, unsigned int *dist)
+{
+	if (limit > this->maxLength) limit = this->maxLength;
+	if (limit > this->buf.size() - pos) limit = this->buf.size() - pos;
+	if (limit < 2) return 0;
+
+	const uint8_t *cur = &this->buf[pos];
+	const stream::pos abs = this->bufStart + pos;
+	unsigned int bestLen = 1;
+	stream::pos next = this->head[LZSS_HASH(cur[0], cur[1])];
+	for (unsigned int chain = this->maxChain; next && chain; chain--) {
+		stream::pos cand = next - 1;
+		if (abs - cand > this->maxDistance) break; // beyond the window
+		next = this->prev[cand % this->maxDistance];
+
+		// Overlapping matches are fine, as the decompressor copies the data one
+		// byte at a time.
+		const uint8_t *match = &this->buf[cand - this->bufStart];
+		if (match[bestLen] != cur[bestLen]) continue; // can't be any longer
+		unsigned int len = 0;
+		while ((len < limit) && (match[len] == cur[len])) len++;
+		if (len > bestLen) {
+			bestLen = len;
+			*dist = abs - cand;
+			if (len == limit) break;
+		}
+	}
+	return (bestLen >= 2) ? bestLen : 0;
+}
+
+bool filter_lzss_compress::encode(uint8_t **out, uint8_t *outEnd, bool eof)
+{
+	// Drop history that has fallen out of the window
+	if (this->posBuf > this->maxDistance + LZSS_BLOCK_SIZE) {
+		this->insertUpTo(this->posBuf);
+		std::size_t lenDrop = this->posBuf - this->maxDistance;
+		this->buf.erase(this->buf.begin(), this->buf.begin() + lenDrop);
+		this->bufStart += lenDrop;
+		this->posBuf -= lenDrop;
+	}
+
+	std::size_t avail = this->buf.size() - this->posBuf;
+	if (avail == 0) return false;
+
+	switch (this->effort) {
+		case Effort::Store:
+			this->writeLiteral(out, outEnd, this->buf[this->posBuf++]);
+			return true;
+
+		case Effort::Greedy:
+		case Effort::Lazy: {
+			// Wait until a full-length match could be found at the next byte as
+			// well as this one, unless there's no more data to come.
+			if ((!eof) && (avail < this->maxLength + 1)) return false;
+			unsigned int len, dist = 0;
+			if (this->haveNextMatch) {
+				len = this->nextLen;
+				dist = this->nextDist;
+				this->haveNextMatch = false;
+			} else {
+				this->insertUpTo(this->posBuf);
+				len = this->findMatch(this->posBuf, avail, &dist);
+			}
+			if (len && (this->effort == Effort::Lazy) && (len < this->maxLength)) {
+				this->insertUpTo(this->posBuf + 1);
+				unsigned int nextDist = 0;
+				unsigned int nextLen = this->findMatch(this->posBuf + 1, avail - 1,
+					&nextDist);
+				if (nextLen > len) {
+					// A literal followed by the longer match is better
+					this->writeLiteral(out, outEnd, this->buf[this->posBuf++]);
+					this->haveNextMatch = true;
+					this->nextLen = nextLen;
+					this->nextDist = nextDist;
+					return true;
+				}
+			}
+			if (len) {
+				this->writeMatch(out, outEnd, len, dist);
+				this->posBuf += len;
+			} else {
+				this->writeLiteral(out, outEnd, this->buf[this->posBuf++]);
+			}
+			return true;
+		}
+
+		case Effort::Optimal: {
+			if ((!eof) && (avail < LZSS_BLOCK_SIZE)) return false;
+			std::size_t lenBlock = std::min<std::size_t>(avail, LZSS_BLOCK_SIZE);
+			this->optLen.resize(lenBlock);
+			this->optDist.resize(lenBlock);
+			this->optCost.resize(lenBlock + 1);
+
+			// Find the longest match at every position in the block.  Matches
+			// don't extend past the end of the block, to keep the costs below
+			// within it.
+			for (std::size_t i = 0; i < lenBlock; i++) {
+				this->insertUpTo(this->posBuf + i);
+				this->optLen[i] = this->findMatch(this->posBuf + i, lenBlock - i,
+					&this->optDist[i]);
+			}
+			this->insertUpTo(this->posBuf + lenBlock);
+
+			// Work backwards to find the cheapest way of encoding the rest of the
+			// block from each position.  A match costs the same number of bits
+			// whatever its length, so every length up to the longest is a
+			// candidate, and the distance of the longest match works for all of
+			// them.  optLen is reused to store the chosen length, 1 for a literal.
+			this->optCost[lenBlock] = 0;
+			for (std::size_t i = lenBlock; i-- > 0; ) {
+				unsigned int bestCost = 9 + this->optCost[i + 1];
+				unsigned int bestLen = 1;
+				for (unsigned int l = 2; l <= this->optLen[i]; l++) {
+					unsigned int cost = this->sizeMatch + this->optCost[i + l];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestLen = l;
+					}
+				}
+				this->optCost[i] = bestCost;
+				this->optLen[i] = bestLen;
+			}
+
+			for (std::size_t i = 0; i < lenBlock; ) {
+				unsigned int len = this->optLen[i];
+				if (len == 1) {
+					this->writeLiteral(out, outEnd, this->buf[this->posBuf + i]);
+				} else {
+					this->writeMatch(out, outEnd, len, this->optDist[i]);
+				}
+				i += len;
+			}
+			this->posBuf += lenBlock;
+			return true;
+		}
+	}
+	return false;
+}
+
+void filter_lzss_compress::writeLiteral(uint8_t **out, uint8_t *outEnd,
+	uint8_t val)
+{
+	// The flag bit is read first, so it is the MSB of the codeword in big endian
+	// and the LSB in little endian.
+	if (this->data.getEndian() == bitstream::bigEndian) {
+		this->data.write(out, outEnd, 9, val);
+	} else {
+		this->data.write(out, outEnd, 9, val << 1);
+	}
+	return;
+}
+
+void filter_lzss_compress::writeMatch(uint8_t **out, uint8_t *outEnd,
+	unsigned int len, unsigned int dist)
+{
+	assert(len >= 2);
+	assert(len <= this->maxLength);
+	assert((dist >= 1) && (dist <= this->maxDistance));
+	unsigned int code;
+	if (this->data.getEndian() == bitstream::bigEndian) {
+		code = (1 << (this->sizeLength + this->sizeDistance))
+			| ((len - 2) << this->sizeDistance)
+			| (dist - 1);
+	} else {
+		code = 1
+			| ((len - 2) << 1)
+			| ((dist - 1) << (1 + this->sizeLength));
+	}
+	this->data.write(out, outEnd, this->sizeMatch, code);
+	return;
+}
+
 } // namespace camoto
@@ -21,86 +21,112 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <camoto/filter-lzw.hpp>
+#include <camoto/iostream_helpers.hpp>
+#include <camoto/thread_pool.hpp>
+#include <camoto/util.hpp> // createString
 
 /// How many bytes should be left in reserve
 /**
  * This is required to avoid trying to read or write the next codeword, and
- * running out of space in the middle of it, truncating the codeword.  Setting
- * this to 2 means there will always be enough room for a 16-bit codeword.
- * Since all the LZW code so far only goes up to 12-bit codewords this should
- * cover everything.
+ * running out of space in the middle of it, truncating the codeword.  It
+ * limits the codeword length, as maxBits must be <= LZW_LEFTOVER_BYTES * 8.
+ * Setting this to 2 allows codewords of up to 16 bits, which is also the
+ * largest that fits in the dictionary's prefix array.
  */
 #define LZW_LEFTOVER_BYTES 2
 
-namespace camoto {
-
-CodeString::CodeString(byte newByte, unsigned pI)
-	:	prefixIndex(pI), first(~0U),
-		nextLeft(~0U), nextRight(~0U),
-		k(newByte)
-{
-}
+/// Flags the decompressor has specialised kernels for.
+/**
+ * LZW_NO_BITSIZE_RESET is left out as it is only checked when the dictionary
+ * is reset, so it doesn't need its own copies of the decoding loop.
+ */
+#define LZW_KERNEL_FLAGS (LZW_BIG_ENDIAN | LZW_RESET_FULL_DICT \
+	| LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID | LZW_FLUSH_ON_RESET)
 
-void Dictionary::fillDecodedString(unsigned code)
-{
-	decodedString.clear();
-	unsigned int safety = 0;
-	auto tableSize = table.size();
-	while (code != ~0U) {
-		if (code >= tableSize) throw filter_error("LZW data is corrupted - "
-			"codeword was larger than the number of entries in the dictionary!");
-		const CodeString& cs = table[code];
-		decodedString.push_back(cs.k);
-
-		// Make sure this codeword's prefix is not itself, otherwise we'll get
-		// stuck in an infinite loop!
-		if (cs.prefixIndex == code) throw filter_error("LZW data is corrupted - "
-			"codeword's prefix is itself, cannot continue as this would cause an "
-			"infinite loop!");
-		code = cs.prefixIndex;
-
-		if (++safety > tableSize * 2) {
-			throw filter_error("LZW data is corrupted - searched through the "
-				"dictionary twice but the code never mapped to a byte value!");
-		}
-	}
-}
+namespace camoto {
 
 Dictionary::Dictionary(unsigned maxBits, unsigned codeStart)
-	:	table(1<<maxBits),
+	:	prefix(1<<maxBits),
+		last(1<<maxBits),
+		length(1<<maxBits),
+		first(1<<maxBits),
 		codeStart(codeStart), newCodeStringIndex(codeStart)
 {
-	for(unsigned i = 0; i < codeStart; ++i)
-		table[i].k = i;
+	// Codewords must fit in the 16-bit prefix array
+	assert(maxBits <= LZW_LEFTOVER_BYTES * 8);
+	for (unsigned i = 0; i < codeStart; ++i) {
+		prefix[i] = 0;
+		last[i] = first[i] = i;
+		length[i] = 1;
+	}
 }
 
-void Dictionary::decode(unsigned oldCode, unsigned code,
-	std::deque<byte>& outStream)
+stream::len Dictionary::decode(unsigned oldCode, unsigned code, uint8_t *out,
+	stream::len lenOut, uint8_t *overflow, stream::len *lenOverflow)
 {
+	const auto tableSize = prefix.size();
 	const bool exists = code < newCodeStringIndex;
-
-	if (exists) fillDecodedString(code);
-	else fillDecodedString(oldCode);
-
-	for (size_t i = decodedString.size(); i > 0;) {
-		outStream.push_back(decodedString[--i]);
+	unsigned src = exists ? code : oldCode;
+	if (src >= tableSize) throw filter_error("LZW data is corrupted - "
+		"codeword was larger than the number of entries in the dictionary!");
+
+	const stream::len lenString = length[src] + (exists ? 0 : 1);
+	const uint8_t firstByte = first[src];
+	const uint16_t *pfx = prefix.data();
+	const uint8_t *k = last.data();
+	stream::len lenDirect;
+
+	if (lenString <= lenOut) {
+		// The whole string fits, so write it from the end backwards
+		lenDirect = lenString;
+		*lenOverflow = 0;
+		uint8_t *p = out + lenString;
+		if (!exists) *--p = firstByte;
+		for (unsigned c = src; p > out; ) {
+			if (c >= tableSize) throw filter_error("LZW data is corrupted - "
+				"codeword's prefix chain is shorter than its length!");
+			*--p = k[c];
+			c = pfx[c];
+		}
+	} else {
+		// Split the string between the output buffer and the overflow area
+		lenDirect = lenOut;
+		*lenOverflow = lenString - lenOut;
+		stream::len pos = lenString;
+		if (!exists) overflow[--pos - lenOut] = firstByte;
+		for (unsigned c = src; pos > 0; ) {
+			if (c >= tableSize) throw filter_error("LZW data is corrupted - "
+				"codeword's prefix chain is shorter than its length!");
+			--pos;
+			if (pos >= lenOut) overflow[pos - lenOut] = k[c];
+			else out[pos] = k[c];
+			c = pfx[c];
+		}
 	}
-	if (!exists) outStream.push_back(decodedString.back());
 
-	if (newCodeStringIndex < table.size()) {
-		if (newCodeStringIndex == oldCode) {
-			std::cerr << "LZW Warning: Tried to set prefix for codeword 0x"
-				<< std::hex << newCodeStringIndex << " to itself!  This "
-				"will cause an error if this codeword is ever used."
-				<< std::endl;
+	if (newCodeStringIndex < tableSize) {
+		if (oldCode >= tableSize) throw filter_error("LZW data is corrupted - "
+			"codeword was larger than the number of entries in the dictionary!");
+		const unsigned lenPrefix = length[oldCode];
+		if ((lenPrefix >= tableSize) || (lenPrefix >= 0xFFFF)) {
+			throw filter_error("LZW data is corrupted - "
+				"decoded string is longer than the dictionary allows!");
 		}
-		table[newCodeStringIndex].prefixIndex = oldCode;
-		table[newCodeStringIndex++].k = decodedString.back();
+		unsigned i = newCodeStringIndex++;
+		prefix[i] = oldCode;
+		last[i] = firstByte;
+		length[i] = lenPrefix + 1;
+		first[i] = first[oldCode];
 	} // else dictionary is full, don't add anything to it
+
+	return lenDirect;
 }
 
 unsigned Dictionary::size() const
@@ -108,11 +134,43 @@ unsigned Dictionary::size() const
 	return newCodeStringIndex;
 }
 
+unsigned Dictionary::maxLength() const
+{
+	// Entries are at most as long as the table, plus one byte for a codeword
+	// that isn't in the dictionary yet.
+	return prefix.size() + 1;
+}
+
 void Dictionary::reset()
 {
 	newCodeStringIndex = codeStart;
-	for(unsigned i = 0; i < codeStart; ++i)
-		table[i] = CodeString(i);
+}
+
+void Dictionary::save(stream::output& s) const
+{
+	s << u32le(newCodeStringIndex - codeStart);
+	for (unsigned i = codeStart; i < newCodeStringIndex; ++i) {
+		write_packed(s, u16le(prefix[i]), u8(last[i]));
+	}
+}
+
+void Dictionary::load(stream::input& s)
+{
+	uint32_t num;
+	s >> u32le(num);
+	if (num > prefix.size() - codeStart) throw filter_error("Saved LZW "
+		"dictionary has more entries than the dictionary can hold");
+	newCodeStringIndex = codeStart;
+	for (uint32_t n = 0; n < num; ++n) {
+		unsigned i = newCodeStringIndex;
+		read_packed(s, u16le(prefix[i]), u8(last[i]));
+		// Entries only ever refer to earlier ones, so the rest can be rebuilt
+		if (prefix[i] >= i) throw filter_error("Saved LZW dictionary entry refers "
+			"to a later entry");
+		length[i] = length[prefix[i]] + 1;
+		first[i] = first[prefix[i]];
+		newCodeStringIndex++;
+	}
 }
 
 
@@ -120,18 +178,28 @@ filter_lzw_decompress::filter_lzw_decompress(int initialBits, int maxBits,
 	int firstCode, int eofCode, int resetCode, int flags)
 	:	maxBits(maxBits),
 		flags(flags),
+		firstCode(firstCode),
 		eofCode(eofCode),
 		resetCode(resetCode),
 		initialBits(initialBits),
 		dictionary(maxBits, firstCode),
+		overflow(new uint8_t[dictionary.maxLength()]),
+		lenOverflow(0),
+		posOverflow(0),
 		data(((flags & LZW_BIG_ENDIAN) != LZW_BIG_ENDIAN) ? bitstream::littleEndian : bitstream::bigEndian),
-		code(0)
+		code(0),
+		oldCode(0),
+		kernel(selectKernel(flags))
 {
 }
 
 void filter_lzw_decompress::reset(stream::len lenInput)
 {
-	this->data.flushByte();
+	this->data = bitstream(this->data.getEndian());
+	this->lenOverflow = 0;
+	this->posOverflow = 0;
+	this->code = 0; // don't stop straight away on the last run's EOF code
+	this->oldCode = 0;
 	this->currentBits = this->initialBits;
 	this->recalcCodes();
 	this->resetDictionary();
@@ -141,25 +209,325 @@ void filter_lzw_decompress::reset(stream::len lenInput)
 void filter_lzw_decompress::transform(uint8_t *out, stream::len *lenOut,
 	const uint8_t *in, stream::len *lenIn)
 {
+	(this->*(this->kernel))(out, lenOut, in, lenIn);
+	return;
+}
+
+bool filter_lzw_decompress::save_state(stream::output& s) const
+{
+	this->data.saveState(s);
+	stream::len lenPending = this->lenOverflow - this->posOverflow;
+	write_packed(s, u8(this->currentBits), u8(this->isDictReset),
+		u32le(this->code), u32le(this->oldCode), u32le(lenPending));
+	s.write(&this->overflow[this->posOverflow], lenPending);
+	this->dictionary.save(s);
+	return true;
+}
+
+void filter_lzw_decompress::load_state(stream::input& s)
+{
+	uint8_t bits, dictReset;
+	uint32_t lenPending;
+	try {
+		this->data.loadState(s);
+		read_packed(s, u8(bits), u8(dictReset), u32le(this->code),
+			u32le(this->oldCode), u32le(lenPending));
+		if ((bits == 0) || (bits > this->maxBits)
+			|| (lenPending > this->dictionary.maxLength())) {
+			throw filter_error("Saved LZW state is invalid");
+		}
+		s.read(this->overflow.get(), lenPending);
+		this->dictionary.load(s);
+	} catch (const stream::read_error& e) {
+		throw filter_error("Saved LZW state is invalid: " + e.get_message());
+	}
+	this->currentBits = bits;
+	this->recalcCodes();
+	this->isDictReset = dictReset;
+	this->posOverflow = 0;
+	this->lenOverflow = lenPending;
+	return;
+}
+
+std::string filter_lzw_decompress::signature() const
+{
+	return createString("filter_lzw_decompress(" << this->initialBits << ","
+		<< this->maxBits << "," << this->firstCode << "," << this->eofCode << ","
+		<< this->resetCode << "," << this->flags << ")");
+}
+
+std::vector<filter_lzw_decompress::segment> filter_lzw_decompress::findSegments(
+	const uint8_t *in, stream::len lenIn)
+{
+	std::vector<segment> segs;
+	this->reset(0);
+	const unsigned int codeStart = this->dictionary.size();
+	const unsigned int tableSize = 1 << this->maxBits;
+	// Only the length of each dictionary entry matters here
+	std::vector<uint32_t> length(tableSize, 1);
+	unsigned int dictSize = codeStart;
+	const uint8_t *p = in, *inEnd = in + lenIn;
+	stream::pos outPos = 0;
+
+	// Record the start of a new segment at the current read position
+	auto begin = [&]() {
+		if (!segs.empty()) segs.back().lenOut = outPos - segs.back().outOffset;
+		segment seg;
+		unsigned int buffered = this->data.bufferedBits();
+		seg.offset = (p - in) - (buffered ? 1 : 0);
+		seg.skipBits = buffered ? 8 - buffered : 0;
+		seg.codeBits = this->currentBits;
+		seg.outOffset = outPos;
+		seg.lenOut = 0;
+		segs.push_back(seg);
+	};
+	auto resetDict = [&]() {
+		this->resetDictionary();
+		dictSize = codeStart;
+	};
+
+	// This follows the same steps as transformKernel()
+	begin();
+	for (;;) {
+		if (
+			(this->flags & LZW_EOF_PARAM_VALID)
+			&& (this->code == this->curEOFCode)
+		) break;
+		// Like transformKernel(), stop once every byte has been used, as the
+		// bitstream would otherwise pad out the last codeword with zeroes.
+		if (p >= inEnd) break;
+		unsigned int bitsRead = this->data.read(&p, inEnd, this->currentBits,
+			&this->code);
+		if (bitsRead < this->currentBits) break;
+
+		if (
+			(this->flags & LZW_EOF_PARAM_VALID)
+			&& (this->code == this->curEOFCode)
+		) continue;
+
+		if (this->isDictReset) {
+			outPos++;
+			this->oldCode = this->code;
+			this->isDictReset = false;
+			continue;
+		}
+
+		if (
+			(this->flags & LZW_RESET_PARAM_VALID)
+			&& (this->code == this->curResetCode)
+		) {
+			resetDict();
+			if (this->flags & LZW_FLUSH_ON_RESET) this->data.flushByte();
+			begin();
+			continue;
+		}
+
+		const bool exists = this->code < dictSize;
+		unsigned int src = exists ? this->code : this->oldCode;
+		if ((src >= tableSize) || (this->oldCode >= tableSize)) return {};
+		outPos += length[src] + (exists ? 0 : 1);
+		if (dictSize < tableSize) {
+			if (length[this->oldCode] >= std::min(tableSize, 0xFFFFu)) return {};
+			length[dictSize++] = length[this->oldCode] + 1;
+		}
+
+		if (dictSize > this->maxCode) {
+			if (this->currentBits == this->maxBits) {
+				if (this->flags & LZW_RESET_FULL_DICT) {
+					resetDict();
+					begin();
+				}
+			} else {
+				++this->currentBits;
+				this->recalcCodes();
+			}
+		}
+		this->oldCode = this->code;
+	}
+	segs.back().lenOut = outPos - segs.back().outOffset;
+	return segs;
+}
+
+void filter_lzw_decompress::decodeSegment(const uint8_t *in, stream::len lenIn,
+	const segment& seg, uint8_t *out)
+{
+	this->reset(0);
+	this->currentBits = seg.codeBits;
+	this->recalcCodes();
+
+	const uint8_t *p = in + seg.offset, *inEnd = in + lenIn;
+	if (seg.skipBits) {
+		unsigned int dummy;
+		this->data.read(&p, inEnd, seg.skipBits, &dummy);
+	}
+
+	stream::len w = 0;
+	while (w < seg.lenOut) {
+		stream::len lenOut = seg.lenOut - w;
+		stream::len lenRemaining = inEnd - p;
+		this->transform(out + w, &lenOut, p, &lenRemaining);
+		if ((lenOut == 0) && (lenRemaining == 0)) {
+			throw filter_error("LZW data is corrupted - segment ended early");
+		}
+		w += lenOut;
+		p += lenRemaining;
+	}
+	return;
+}
+
+std::string lzw_decompress_parallel(const uint8_t *in, stream::len lenIn,
+	int initialBits, int maxBits, int firstCode, int eofCode, int resetCode,
+	int flags, thread_pool *pool)
+{
+	filter_lzw_decompress scan(initialBits, maxBits, firstCode, eofCode,
+		resetCode, flags);
+	auto segs = scan.findSegments(in, lenIn);
+
+	if (segs.empty()) {
+		// Corrupted data, decode it as usual so the error is reported at the
+		// right place.
+		std::string result;
+		scan.reset(lenIn);
+		stream::len r = 0;
+		for (;;) {
+			stream::len lenOut = BUFFER_SIZE, lenRead = lenIn - r;
+			result.resize(result.size() + lenOut);
+			scan.transform((uint8_t *)&result[result.size() - BUFFER_SIZE], &lenOut,
+				in + r, &lenRead);
+			result.resize(result.size() - BUFFER_SIZE + lenOut);
+			r += lenRead;
+			if ((lenOut == 0) && (lenRead == 0)) break;
+		}
+		return result;
+	}
+
+	std::string result(segs.back().outOffset + segs.back().lenOut, '\0');
+	uint8_t *out = (uint8_t *)&result[0];
+
+	std::unique_ptr<thread_pool> localPool;
+	if (!pool && (segs.size() > 1)) {
+		localPool.reset(new thread_pool());
+		pool = localPool.get();
+	}
+	if (!pool) {
+		scan.decodeSegment(in, lenIn, segs[0], out);
+		return result;
+	}
+
+	// Give each task a run of segments large enough to be worth the overhead,
+	// while still leaving a few tasks per thread to even out the load.
+	const stream::len lenTask = std::max<stream::len>(65536,
+		result.size() / (pool->size() * 4));
+	for (std::size_t i = 0; i < segs.size(); ) {
+		std::size_t first = i;
+		stream::len lenRun = 0;
+		while ((i < segs.size()) && (lenRun < lenTask)) lenRun += segs[i++].lenOut;
+		std::size_t last = i;
+		pool->submit([=, &segs](unsigned int) {
+			filter_lzw_decompress f(initialBits, maxBits, firstCode, eofCode,
+				resetCode, flags);
+			for (std::size_t n = first; n < last; n++) {
+				f.decodeSegment(in, lenIn, segs[n], out + segs[n].outOffset);
+			}
+		});
+	}
+	pool->wait();
+	return result;
+}
+
+std::string lzw_compress_parallel(const uint8_t *in, stream::len lenIn,
+	int initialBits, int maxBits, int firstCode, int eofCode, int resetCode,
+	int flags, thread_pool *pool, stream::len lenBlock)
+{
+	// Blocks can only be joined if a reset codeword puts the decompressor back
+	// into the same state it started in.
+	std::size_t numBlocks = 1;
+	if (
+		(flags & LZW_RESET_PARAM_VALID)
+		&& !(flags & LZW_NO_BITSIZE_RESET)
+		&& (lenBlock > 0)
+	) {
+		numBlocks = std::max<stream::len>(1, (lenIn + lenBlock - 1) / lenBlock);
+	} else {
+		lenBlock = lenIn;
+	}
+
+	std::vector<std::vector<uint8_t>> blocks(numBlocks);
+	std::vector<uint64_t> bits(numBlocks);
+
+	std::unique_ptr<thread_pool> localPool;
+	if (!pool && (numBlocks > 1)) {
+		localPool.reset(new thread_pool());
+		pool = localPool.get();
+	}
+	if (!pool) {
+		filter_lzw_compress f(initialBits, maxBits, firstCode, eofCode, resetCode,
+			flags);
+		bits[0] = f.compressBlock(in, lenIn, true, &blocks[0]);
+	} else {
+		// Each worker keeps its own compressor, as the string table is large
+		std::vector<std::unique_ptr<filter_lzw_compress>> workers(pool->size());
+		for (std::size_t i = 0; i < numBlocks; i++) {
+			pool->submit([=, &workers, &blocks, &bits](unsigned int index) {
+				auto& f = workers[index];
+				if (!f) {
+					f.reset(new filter_lzw_compress(initialBits, maxBits, firstCode,
+						eofCode, resetCode, flags));
+				}
+				stream::pos start = i * lenBlock;
+				bits[i] = f->compressBlock(in + start,
+					std::min<stream::len>(lenBlock, lenIn - start),
+					i == numBlocks - 1, &blocks[i]);
+			});
+		}
+		pool->wait();
+	}
+	if (numBlocks == 1) {
+		return std::string(blocks[0].begin(), blocks[0].end());
+	}
+
+	// Join the blocks up, shifting each one to start where the last one ended
+	uint64_t totalBits = 0;
+	for (auto b : bits) totalBits += b;
+	std::string result((totalBits + 7) / 8 + 8, '\0');
+	uint8_t *out = (uint8_t *)&result[0], *outEnd = out + result.size();
+	bitstream join((flags & LZW_BIG_ENDIAN)
+		? bitstream::bigEndian : bitstream::littleEndian);
+	for (std::size_t i = 0; i < numBlocks; i++) {
+		join.append(&out, outEnd, blocks[i].data(), bits[i]);
+	}
+	join.flushByte(&out, outEnd);
+	result.resize(out - (uint8_t *)&result[0]);
+	return result;
+}
+
+template <unsigned int F>
+void filter_lzw_decompress::transformKernel(uint8_t *out, stream::len *lenOut,
+	const uint8_t *in, stream::len *lenIn)
+{
+	const bitstream::endian E = (F & LZW_BIG_ENDIAN)
+		? bitstream::bigEndian : bitstream::littleEndian;
 	stream::len r = 0, w = 0;
-	fn_getnextchar cbNext = std::bind(bitstreamFilterNextChar, &in, lenIn, &r,
-		std::placeholders::_1);
+	const uint8_t *inStart = in, *inEnd = in + *lenIn;
 	while (
 		(w < *lenOut) && (
 			(
 				(r + LZW_LEFTOVER_BYTES < *lenIn) || // Make sure there's at least some leftover bytes (for the longest codeword)
 				((r < *lenIn) && (*lenIn <= LZW_LEFTOVER_BYTES)) // unless it's the last incoming byte
-			) || (!this->buffer.empty())
+			) || (this->posOverflow < this->lenOverflow)
 		)
 	) {
-		if (!this->buffer.empty()) {
-			*out++ = this->buffer.front();
-			this->buffer.pop_front();
-			w++;
+		if (this->posOverflow < this->lenOverflow) {
+			stream::len len = std::min(this->lenOverflow - this->posOverflow,
+				*lenOut - w);
+			memcpy(out + w, &this->overflow[this->posOverflow], len);
+			this->posOverflow += len;
+			w += len;
 		} else {
-			if ((this->flags & LZW_EOF_PARAM_VALID) && (this->code == this->curEOFCode)) break;
+			if ((F & LZW_EOF_PARAM_VALID) && (this->code == this->curEOFCode)) break;
 
-			unsigned int bitsRead = this->data.read(cbNext, this->currentBits, &this->code);
+			unsigned int bitsRead = this->data.read<E>(&in, inEnd, this->currentBits, &this->code);
+			r = in - inStart;
 			if (this->currentBits > LZW_LEFTOVER_BYTES * 8) {
 				std::cerr << "WARNING: libgamecommon/lzw.cpp needs bit width increased "
 					"to avoid data corruption." << std::endl;
@@ -175,35 +543,36 @@ void filter_lzw_decompress::transform(uint8_t *out, stream::len *lenOut,
 			}
 			assert(bitsRead > 0);
 
-			if ((this->flags & LZW_EOF_PARAM_VALID) && (this->code == this->curEOFCode)) continue;
+			if ((F & LZW_EOF_PARAM_VALID) && (this->code == this->curEOFCode)) continue;
 
 			if (this->isDictReset) {
 				// When the dictionary is empty, the next "codeword" is always the first
 				// byte for the first dictionary entry, which also means it's the first
 				// output byte too (once it's truncated to eight bits.)
-				this->buffer.push_back(this->code);
+				out[w++] = this->code;
 				this->oldCode = this->code;
 				this->isDictReset = false;
 				continue;
 			}
 
 			// See if the code we just got is a special one that will reset the dictionary
-			if ((this->flags & LZW_RESET_PARAM_VALID) && (this->code == this->curResetCode)) {
+			if ((F & LZW_RESET_PARAM_VALID) && (this->code == this->curResetCode)) {
 				this->resetDictionary();
-				if (this->flags & LZW_FLUSH_ON_RESET) {
+				if (F & LZW_FLUSH_ON_RESET) {
 					this->data.flushByte();
-					// We can't use seek here because cbNext might not be from the stream
-					//this->data.read(cbNext, num*8, &dummy);
+					// We can't use seek here because the data isn't from a stream
 				}
 				continue;
 			}
 
-			this->dictionary.decode(this->oldCode, this->code, this->buffer);
+			w += this->dictionary.decode(this->oldCode, this->code, out + w,
+				*lenOut - w, this->overflow.get(), &this->lenOverflow);
+			this->posOverflow = 0;
 
 
 			if (this->dictionary.size() > this->maxCode) {
 				if (this->currentBits == this->maxBits) {
-					if (this->flags & LZW_RESET_FULL_DICT) this->resetDictionary();
+					if (F & LZW_RESET_FULL_DICT) this->resetDictionary();
 				} else {
 					++this->currentBits;
 					this->recalcCodes();
@@ -211,12 +580,6 @@ void filter_lzw_decompress::transform(uint8_t *out, stream::len *lenOut,
 			}
 
 			this->oldCode = this->code;
-
-
-			if (this->buffer.empty()) {
-				//if (r == 0) r = -1; // EOF
-				break;
-			}
 		}
 	}
 	*lenIn = r;
@@ -224,6 +587,38 @@ void filter_lzw_decompress::transform(uint8_t *out, stream::len *lenOut,
 	return;
 }
 
+filter_lzw_decompress::fn_kernel filter_lzw_decompress::selectKernel(
+	unsigned int flags)
+{
+	// Flushing on reset only matters if there is a reset codeword
+	if (!(flags & LZW_RESET_PARAM_VALID)) flags &= ~LZW_FLUSH_ON_RESET;
+
+#define LZW_KERNEL(f) \
+	case (f): return &filter_lzw_decompress::transformKernel<(f)>; \
+	case (f) | LZW_BIG_ENDIAN: \
+		return &filter_lzw_decompress::transformKernel<(f) | LZW_BIG_ENDIAN>;
+
+	switch (flags & LZW_KERNEL_FLAGS) {
+		LZW_KERNEL(0)
+		LZW_KERNEL(LZW_RESET_FULL_DICT)
+		LZW_KERNEL(LZW_EOF_PARAM_VALID)
+		LZW_KERNEL(LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT)
+		LZW_KERNEL(LZW_RESET_PARAM_VALID)
+		LZW_KERNEL(LZW_RESET_PARAM_VALID | LZW_RESET_FULL_DICT)
+		LZW_KERNEL(LZW_RESET_PARAM_VALID | LZW_EOF_PARAM_VALID)
+		LZW_KERNEL(LZW_RESET_PARAM_VALID | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT)
+		LZW_KERNEL(LZW_RESET_PARAM_VALID | LZW_FLUSH_ON_RESET)
+		LZW_KERNEL(LZW_RESET_PARAM_VALID | LZW_FLUSH_ON_RESET | LZW_RESET_FULL_DICT)
+		LZW_KERNEL(LZW_RESET_PARAM_VALID | LZW_FLUSH_ON_RESET | LZW_EOF_PARAM_VALID)
+		LZW_KERNEL(LZW_RESET_PARAM_VALID | LZW_FLUSH_ON_RESET | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT)
+	}
+#undef LZW_KERNEL
+
+	// All combinations are covered above
+	assert(false);
+	return &filter_lzw_decompress::transformKernel<0>;
+}
+
 void filter_lzw_decompress::resetDictionary()
 {
 	this->dictionary.reset();
@@ -273,19 +668,38 @@ filter_lzw_compress::filter_lzw_compress(int initialBits, int maxBits,
 		resetCode(resetCode),
 		firstCode(firstCode),
 		initialBits(initialBits),
-		dictSize(256),
+		dictSize(firstCode),
 		currentBits(initialBits),
-		data(((flags & LZW_BIG_ENDIAN) != LZW_BIG_ENDIAN) ? bitstream::littleEndian : bitstream::bigEndian)
+		data(((flags & LZW_BIG_ENDIAN) != LZW_BIG_ENDIAN) ? bitstream::littleEndian : bitstream::bigEndian),
+		isDictReset(true),
+		hashTable(2u << maxBits),
+		hashGen(0),
+		hashMask((2u << maxBits) - 1),
+		curCode(0),
+		haveCode(false),
+		finished(false),
+		pendingPos(0),
+		lenPending(0),
+		winIn(0),
+		winBits(0),
+		bestRatio(~(uint64_t)0),
+		lenWindow(LZW_ADAPTIVE_WINDOW),
+		percentWorse(LZW_ADAPTIVE_PERCENT)
 {
 	assert(initialBits > 0);
+	assert(maxBits <= LZW_LEFTOVER_BYTES * 8);
 }
 
 void filter_lzw_compress::reset(stream::len lenInput)
 {
-	this->data.flushByte();
+	this->data = bitstream(this->data.getEndian());
 	this->currentBits = this->initialBits;
 	this->recalcCodes();
 	this->resetDictionary();
+	this->haveCode = false;
+	this->finished = false;
+	this->pendingPos = 0;
+	this->lenPending = 0;
 	return;
 }
 
@@ -293,66 +707,258 @@ void filter_lzw_compress::transform(uint8_t *out, stream::len *lenOut,
 	const uint8_t *in, stream::len *lenIn)
 {
 	stream::len r = 0, w = 0;
-	fn_putnextchar cbNext = std::bind(bitstreamFilterPutChar, &out, lenOut, &w,
-		std::placeholders::_1);
-	while (
-		(w + LZW_LEFTOVER_BYTES < *lenOut) && ( // leave some leftover bytes to guarantee the codeword will be written
-			(
-				(r + 1 < *lenIn) || // Make sure there's at least one leftover byte
-				((r < *lenIn) && (*lenIn < 2)) // unless it's the last incoming byte
-			)
-		)
-	) {
-		if (this->currentBits > LZW_LEFTOVER_BYTES * 8) {
-			std::cerr << "WARNING: libgamecommon/lzw.cpp needs bit width increased "
-				"to avoid data corruption." << std::endl;
+	for (;;) {
+		while ((this->pendingPos < this->lenPending) && (w < *lenOut)) {
+			out[w++] = this->pending[this->pendingPos++];
+		}
+		if (this->pendingPos < this->lenPending) break; // out is full
+		this->pendingPos = this->lenPending = 0;
+
+		// A single input byte can produce more than one codeword (e.g. a
+		// dictionary reset), so unless there is enough space left in out for all
+		// of them, they are collected in pending first.
+		uint8_t *dst, *dstEnd;
+		bool direct = *lenOut - w >= sizeof(this->pending);
+		if (direct) {
+			dst = out + w;
+			dstEnd = out + *lenOut;
+		} else {
+			dst = this->pending;
+			dstEnd = this->pending + sizeof(this->pending);
 		}
-		unsigned int bitsWritten = this->data.write(cbNext, this->currentBits, *in);
-
-		in++;
-		r++;
-		if (bitsWritten < this->currentBits) {
-			std::cerr << "Couldn't write all bits this iteration (tried to write "
-				<< this->currentBits << " but only wrote " << bitsWritten << ".  "
-				<< *lenIn - r << " bytes left to read, " << *lenOut - w
-				<< " bytes left to write into.)" << std::endl;
-			// EOF
-			break;
+		uint8_t *dstStart = dst;
+
+		if (!this->step(&dst, dstEnd, in, *lenIn, &r)) break;
+
+		if (direct) w += dst - dstStart;
+		else this->lenPending = dst - dstStart;
+	}
+	*lenIn = r;
+	*lenOut = w;
+	return;
+}
+
+stream::len filter_lzw_compress::measure(const uint8_t *in,
+	stream::len *lenIn)
+{
+	stream::len r = 0;
+	stream::len w = this->lenPending - this->pendingPos;
+	this->pendingPos = this->lenPending = 0;
+
+	// Each step's codewords are packed into pending and then dropped
+	for (;;) {
+		uint8_t *dst = this->pending;
+		if (!this->step(&dst, this->pending + sizeof(this->pending), in, *lenIn,
+			&r)) break;
+		w += dst - this->pending;
+	}
+	*lenIn = r;
+	return w;
+}
+
+bool filter_lzw_compress::step(uint8_t **dst, uint8_t *dstEnd,
+	const uint8_t *in, stream::len lenIn, stream::len *r)
+{
+	if (*r < lenIn) {
+		stream::len start = *r;
+		// Extend the current string for as long as it is in the dictionary
+		while (*r < lenIn) {
+			uint8_t next = in[(*r)++];
+			if (!this->haveCode) {
+				this->curCode = next;
+				this->haveCode = true;
+				continue;
+			}
+			unsigned int code = this->lookup(this->curCode, next);
+			if (code != ~0U) {
+				this->curCode = code;
+				continue;
+			}
+			this->winIn += *r - start;
+			this->writeCode(dst, dstEnd, this->curCode, true, next);
+			this->curCode = next;
+			return true;
 		}
+		this->winIn += *r - start;
+	} else if ((lenIn == 0) && (!this->finished)) {
+		// No more data to read, write out whatever is left
+		if (this->haveCode) {
+			this->writeCode(dst, dstEnd, this->curCode, false, 0);
+			this->haveCode = false;
+		}
+		if (this->flags & LZW_EOF_PARAM_VALID) {
+			this->data.write(dst, dstEnd, this->currentBits, this->curEOFCode);
+		}
+		this->data.flushByte(dst, dstEnd);
+		this->finished = true;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+unsigned int filter_lzw_compress::lookup(unsigned int prefix, uint8_t next)
+	const
+{
+	uint32_t key = (prefix << 8) | next;
+	uint32_t i = (key * 2654435761u) & this->hashMask;
+	for (;;) {
+		const HashEntry& e = this->hashTable[i];
+		if (e.gen != this->hashGen) return ~0U;
+		if (e.key == key) return e.code;
+		i = (i + 1) & this->hashMask;
+	}
+}
+
+void filter_lzw_compress::insert(unsigned int prefix, uint8_t next,
+	unsigned int code)
+{
+	uint32_t key = (prefix << 8) | next;
+	uint32_t i = (key * 2654435761u) & this->hashMask;
+	while (this->hashTable[i].gen == this->hashGen) {
+		i = (i + 1) & this->hashMask;
+	}
+	HashEntry& e = this->hashTable[i];
+	e.gen = this->hashGen;
+	e.key = key;
+	e.code = code;
+	return;
+}
 
+void filter_lzw_compress::writeCode(uint8_t **out, uint8_t *outEnd,
+	unsigned int code, bool hasNext, uint8_t next)
+{
+	this->data.write(out, outEnd, this->currentBits, code);
+	this->winBits += this->currentBits;
+
+	if (this->isDictReset) {
+		// The first codeword after a reset is a literal, and the decompressor
+		// doesn't add anything to its dictionary for it.
+		this->isDictReset = false;
+	} else {
+		if (this->dictSize < (1u << this->maxBits)) this->dictSize++;
 		if (this->dictSize > this->maxCode) {
 			if (this->currentBits == this->maxBits) {
-				if (this->flags & LZW_RESET_FULL_DICT) this->resetDictionary();
+				if (this->flags & LZW_RESET_FULL_DICT) {
+					this->resetDictionary();
+					return;
+				}
 			} else {
 				++this->currentBits;
 				this->recalcCodes();
+				if (this->bestRatio != ~(uint64_t)0) {
+					this->bestRatio = this->bestRatio * this->currentBits
+						/ (this->currentBits - 1);
+				}
 			}
-		} else {
-			this->dictSize++;
-		}
-		assert(bitsWritten > 0);
-	}
-	if ((w < *lenOut) && (*lenIn == 0)) {
-		// No more data to read, but more space to write
-		if ((this->flags & LZW_EOF_PARAM_VALID) && (this->curEOFCode > 0)) {
-			// Add the EOF parameter
-			this->data.write(cbNext, this->currentBits, this->curEOFCode);
-			// Don't write this again
-			this->curEOFCode = 0;
 		}
 	}
-	// Do the flush separately, in case we just ran out of output space
-	if ((w < *lenOut) && (*lenIn == 0)) {
-		this->data.flushByte(cbNext);
+
+	if (!hasNext) return;
+
+	bool full = this->dictSize > this->maxCode;
+	if (
+		(this->flags & LZW_RESET_PARAM_VALID)
+		&& ((this->flags & LZW_ADAPTIVE_RESET) ? this->ratioDropped() : full)
+	) {
+		this->data.write(out, outEnd, this->currentBits, this->curResetCode);
+		if (this->flags & LZW_FLUSH_ON_RESET) this->data.flushByte(out, outEnd);
+		this->resetDictionary();
+		return;
 	}
-	*lenIn = r;
-	*lenOut = w;
+	if (full) return;
+
+	// Don't create a string the decompressor would mistake for a control code
+	if (
+		((this->flags & LZW_EOF_PARAM_VALID) && (this->dictSize == (unsigned int)this->curEOFCode))
+		|| ((this->flags & LZW_RESET_PARAM_VALID) && (this->dictSize == (unsigned int)this->curResetCode))
+	) {
+		return;
+	}
+
+	this->insert(code, next, this->dictSize);
+	return;
+}
+
+bool filter_lzw_compress::ratioDropped()
+{
+	if (this->winIn < this->lenWindow) return false;
+	uint64_t ratio = (this->winBits << 8) / this->winIn;
+	this->winIn = 0;
+	this->winBits = 0;
+	if (ratio < this->bestRatio) {
+		this->bestRatio = ratio;
+		return false;
+	}
+	return ratio * 100 > this->bestRatio * (100 + this->percentWorse);
+}
+
+void filter_lzw_compress::setAdaptiveReset(stream::len lenWindow,
+	unsigned int percent)
+{
+	this->lenWindow = lenWindow;
+	this->percentWorse = percent;
 	return;
 }
 
+uint64_t filter_lzw_compress::compressBlock(const uint8_t *in,
+	stream::len lenIn, bool last, std::vector<uint8_t> *out)
+{
+	this->reset(lenIn);
+	out->resize(lenIn / 2 + sizeof(this->pending) * 2);
+	uint8_t *dst = out->data();
+
+	// Each step writes no more than fits in pending, so make sure there is
+	// always that much room left.
+	const std::ptrdiff_t lenStep = sizeof(this->pending);
+	auto makeRoom = [out, &dst, lenStep]() {
+		if (out->data() + out->size() - dst < lenStep) {
+			std::size_t pos = dst - out->data();
+			out->resize(out->size() * 2);
+			dst = out->data() + pos;
+		}
+		return out->data() + out->size();
+	};
+
+	stream::len r = 0;
+	while ((r < lenIn) && this->step(&dst, makeRoom(), in, lenIn, &r));
+
+	uint8_t *dstEnd = makeRoom();
+	if (this->haveCode) {
+		this->writeCode(&dst, dstEnd, this->curCode, false, 0);
+		this->haveCode = false;
+	}
+	if (last) {
+		if (this->flags & LZW_EOF_PARAM_VALID) {
+			this->data.write(&dst, dstEnd, this->currentBits, this->curEOFCode);
+		}
+	} else if (!this->isDictReset) {
+		// The dictionary wasn't reset by the last codeword filling it up, so
+		// reset it explicitly ready for the next block.
+		assert(this->flags & LZW_RESET_PARAM_VALID);
+		this->data.write(&dst, dstEnd, this->currentBits, this->curResetCode);
+		if (this->flags & LZW_FLUSH_ON_RESET) this->data.flushByte(&dst, dstEnd);
+	}
+	unsigned int lenTail = this->data.pendingBits();
+	this->data.flushByte(&dst, dstEnd);
+	this->finished = true;
+
+	out->resize(dst - out->data());
+	return out->size() * 8 - (lenTail ? 8 - lenTail : 0);
+}
+
 void filter_lzw_compress::resetDictionary()
 {
-	this->dictSize = 256;
+	this->dictSize = this->firstCode;
+	this->isDictReset = true;
+	this->winIn = 0;
+	this->winBits = 0;
+	this->bestRatio = ~(uint64_t)0;
+	if (++this->hashGen == 0) {
+		// Generation counter wrapped, really clear the table this time
+		for (auto& i : this->hashTable) i.gen = 0;
+		this->hashGen = 1;
+	}
 	if (!(this->flags & LZW_NO_BITSIZE_RESET)) {
 		// Only reset the bit length with the dictionary if wanted
 		this->currentBits = this->initialBits;
@@ -376,10 +982,7 @@ void filter_lzw_compress::recalcCodes()
 			// the last codeword, with 0 being the largest possible codeword.
 			this->curEOFCode = actualMaxCode + this->eofCode;
 			this->maxCode--;
-		} else {
-			this->curEOFCode = this->eofCode;
-			this->dictSize++; // this assumes the code is at the start
-		}
+		} else this->curEOFCode = this->eofCode;
 	}
 
 	if (this->flags & LZW_RESET_PARAM_VALID) {
@@ -388,12 +991,7 @@ void filter_lzw_compress::recalcCodes()
 			// the last codeword, with 0 being the largest possible codeword.
 			this->curResetCode = actualMaxCode + this->resetCode;
 			this->maxCode--;
-		} else {
-			this->curResetCode = this->resetCode;
-			if (this->curEOFCode != this->curResetCode) {
-				this->dictSize++; // this assumes the code is at the start
-			}
-		}
+		} else this->curResetCode = this->resetCode;
 	}
 	return;
 }
@@ -57,4 +57,12 @@ void filter_pad::transform(uint8_t *out, stream::len *lenOut,
 	return;
 }
 
+stream::len filter_pad::measure(const uint8_t *in, stream::len *lenIn)
+{
+	// All the input is passed through, after whatever padding is left
+	stream::len w = this->pad.data.size() - this->posPadding;
+	this->posPadding = this->pad.data.size();
+	return w + *lenIn;
+}
+
 } // namespace camoto
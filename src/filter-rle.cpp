@@ -0,0 +1,349 @@
+/**
+ * @file  filter-rle.cpp
+ * @brief Filters for the common byte-level run-length encoding schemes.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <string.h>
+#include <camoto/filter-rle.hpp>
+#include <camoto/iostream_helpers.hpp>
+#include <camoto/util.hpp> // createString
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CAMOTO_RLE_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace camoto {
+
+#ifdef CAMOTO_RLE_SSE2
+/// Index of the lowest set bit, which must exist.
+static inline unsigned int lowestBit(unsigned int m)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, m);
+	return i;
+#else
+	return __builtin_ctz(m);
+#endif
+}
+#endif
+
+/// Number of bytes at the start of \e p that are the same as p[0], up to max.
+static std::size_t runLength(const uint8_t *p, std::size_t max)
+{
+	std::size_t n = 1;
+#ifdef CAMOTO_RLE_SSE2
+	__m128i v = _mm_set1_epi8((char)p[0]);
+	while (n + 16 <= max) {
+		unsigned int m = _mm_movemask_epi8(_mm_cmpeq_epi8(v,
+			_mm_loadu_si128((const __m128i *)(p + n))));
+		if (m != 0xFFFF) return n + lowestBit(~m);
+		n += 16;
+	}
+#endif
+	while ((n < max) && (p[n] == p[0])) n++;
+	return n;
+}
+
+/// Index of the first byte in \e p that is the same as the byte after it.
+/**
+ * @return The index, or \e len if there are no two bytes the same in a row.
+ */
+static std::size_t findPair(const uint8_t *p, std::size_t len)
+{
+	std::size_t i = 0;
+#ifdef CAMOTO_RLE_SSE2
+	while (i + 17 <= len) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(p + i + 1));
+		unsigned int m = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+		if (m) return i + lowestBit(m);
+		i += 16;
+	}
+#endif
+	for (; i + 1 < len; i++) {
+		if (p[i] == p[i + 1]) return i;
+	}
+	return len;
+}
+
+filter_rle_decompress::filter_rle_decompress(rle_scheme scheme, uint8_t code)
+	:	scheme(scheme),
+		code(code),
+		runLeft(0),
+		runValue(0),
+		litLeft(0)
+{
+}
+
+void filter_rle_decompress::reset(stream::len lenInput)
+{
+	this->runLeft = 0;
+	this->runValue = 0;
+	this->litLeft = 0;
+	return;
+}
+
+void filter_rle_decompress::transform(uint8_t *out, stream::len *lenOut,
+	const uint8_t *in, stream::len *lenIn)
+{
+	stream::len r = 0, w = 0;
+	const stream::len maxIn = *lenIn, maxOut = *lenOut;
+
+	while (w < maxOut) {
+		if (this->runLeft) {
+			stream::len n = std::min<stream::len>(this->runLeft, maxOut - w);
+			memset(out + w, this->runValue, n);
+			w += n;
+			this->runLeft -= n;
+			continue;
+		}
+		if (this->litLeft) {
+			stream::len n = std::min<stream::len>(this->litLeft,
+				std::min(maxOut - w, maxIn - r));
+			if (n == 0) break; // need more input
+			memcpy(out + w, in + r, n);
+			w += n;
+			r += n;
+			this->litLeft -= n;
+			continue;
+		}
+		if (r >= maxIn) break;
+
+		// Codes are at most three bytes, and a code split across the end of the
+		// buffer is left for the next call, when the rest will have arrived.
+		const uint8_t *p = in + r;
+		stream::len left = maxIn - r;
+		switch (this->scheme) {
+			case rle_scheme::Escape:
+				if (p[0] == this->code) {
+					if (left < 3) goto done;
+					this->runLeft = p[1];
+					this->runValue = p[2];
+					r += 3;
+				} else {
+					// Copy everything up to the next escape byte in one go
+					stream::len n = std::min(left, maxOut - w);
+					const void *esc = memchr(p, this->code, n);
+					if (esc) n = (const uint8_t *)esc - p;
+					memcpy(out + w, p, n);
+					w += n;
+					r += n;
+				}
+				break;
+			case rle_scheme::CountBits:
+				if ((p[0] & this->code) == this->code) {
+					if (left < 2) goto done;
+					this->runLeft = p[0] & ~this->code;
+					this->runValue = p[1];
+					r += 2;
+				} else {
+					stream::len n = 1, max = std::min(left, maxOut - w);
+					while ((n < max) && ((p[n] & this->code) != this->code)) n++;
+					memcpy(out + w, p, n);
+					w += n;
+					r += n;
+				}
+				break;
+			case rle_scheme::PackBits: {
+				int8_t h = (int8_t)p[0];
+				if (h >= 0) {
+					this->litLeft = h + 1;
+					r++;
+				} else if (h != -128) {
+					if (left < 2) goto done;
+					this->runLeft = 1 - h;
+					this->runValue = p[1];
+					r += 2;
+				} else {
+					r++; // no-op
+				}
+				break;
+			}
+		}
+	}
+done:
+	*lenIn = r;
+	*lenOut = w;
+	return;
+}
+
+bool filter_rle_decompress::save_state(stream::output& s) const
+{
+	write_packed(s, u16le(this->runLeft), u8(this->runValue),
+		u16le(this->litLeft));
+	return true;
+}
+
+void filter_rle_decompress::load_state(stream::input& s)
+{
+	try {
+		read_packed(s, u16le(this->runLeft), u8(this->runValue),
+			u16le(this->litLeft));
+	} catch (const stream::read_error& e) {
+		throw filter_error("Saved RLE state is invalid: " + e.get_message());
+	}
+	if ((this->runLeft > 255) || (this->litLeft > 128)) {
+		throw filter_error("Saved RLE state is invalid");
+	}
+	return;
+}
+
+std::string filter_rle_decompress::signature() const
+{
+	return createString("filter_rle_decompress(" << (int)this->scheme << ","
+		<< (int)this->code << ")");
+}
+
+
+filter_rle_compress::filter_rle_compress(rle_scheme scheme, uint8_t code)
+	:	scheme(scheme),
+		code(code)
+{
+	switch (scheme) {
+		case rle_scheme::Escape:
+			this->maxRun = 255;
+			this->minRun = 4; // a run takes three bytes
+			break;
+		case rle_scheme::CountBits:
+			// The flag bits have to be at the top, leaving the count below them
+			assert((((uint8_t)~code + 1) & (uint8_t)~code) == 0);
+			assert(code != 0xFF);
+			this->maxRun = (uint8_t)~code;
+			this->minRun = 3; // a run takes two bytes
+			break;
+		case rle_scheme::PackBits:
+			this->maxRun = 128;
+			this->minRun = 3; // a run of two would split up the literals around it
+			break;
+	}
+}
+
+void filter_rle_compress::reset(stream::len lenInput)
+{
+	return;
+}
+
+bool filter_rle_compress::isSpecial(uint8_t b) const
+{
+	switch (this->scheme) {
+		case rle_scheme::Escape: return b == this->code;
+		case rle_scheme::CountBits: return (b & this->code) == this->code;
+		case rle_scheme::PackBits: break;
+	}
+	return false;
+}
+
+std::size_t filter_rle_compress::literalSpan(const uint8_t *p, std::size_t len,
+	std::size_t lenAvail) const
+{
+	// Special bytes can't go in a literal
+	switch (this->scheme) {
+		case rle_scheme::Escape: {
+			const void *esc = memchr(p, this->code, len);
+			if (esc) len = (const uint8_t *)esc - p;
+			break;
+		}
+		case rle_scheme::CountBits:
+			for (std::size_t i = 0; i < len; i++) {
+				if (this->isSpecial(p[i])) {
+					len = i;
+					break;
+				}
+			}
+			break;
+		case rle_scheme::PackBits:
+			break;
+	}
+
+	// Stop at the first run long enough to be worth encoding.  The run may
+	// continue past len, so it is measured against all the available input.
+	std::size_t i = 0;
+	while (i < len) {
+		i += findPair(p + i, len - i);
+		if (i >= len) break;
+		if (runLength(p + i, std::min<std::size_t>(this->minRun, lenAvail - i))
+			>= this->minRun) break;
+		i++;
+	}
+	return std::min(i, len);
+}
+
+void filter_rle_compress::transform(uint8_t *out, stream::len *lenOut,
+	const uint8_t *in, stream::len *lenIn)
+{
+	stream::len r = 0, w = 0;
+	const stream::len maxIn = *lenIn, maxOut = *lenOut;
+
+	while (r < maxIn) {
+		const uint8_t *p = in + r;
+		std::size_t left = maxIn - r;
+		std::size_t run = runLength(p, std::min<std::size_t>(left, this->maxRun));
+		if ((run >= this->minRun) || this->isSpecial(p[0])) {
+			switch (this->scheme) {
+				case rle_scheme::Escape:
+					if (w + 3 > maxOut) goto done;
+					out[w++] = this->code;
+					out[w++] = run;
+					out[w++] = p[0];
+					break;
+				case rle_scheme::CountBits:
+					if (w + 2 > maxOut) goto done;
+					out[w++] = this->code | run;
+					out[w++] = p[0];
+					break;
+				case rle_scheme::PackBits:
+					if (w + 2 > maxOut) goto done;
+					out[w++] = (uint8_t)(1 - (int)run);
+					out[w++] = p[0];
+					break;
+			}
+			r += run;
+			continue;
+		}
+
+		std::size_t maxLit = left;
+		if (this->scheme == rle_scheme::PackBits) {
+			// One header byte, then up to 128 literals
+			if (w + 2 > maxOut) break;
+			maxLit = std::min<std::size_t>(maxLit, std::min<stream::len>(128,
+				maxOut - w - 1));
+		} else {
+			maxLit = std::min<std::size_t>(maxLit, maxOut - w);
+		}
+		if (maxLit == 0) break;
+		std::size_t lit = this->literalSpan(p, maxLit, left);
+		assert(lit > 0);
+		if (this->scheme == rle_scheme::PackBits) out[w++] = lit - 1;
+		memcpy(out + w, p, lit);
+		w += lit;
+		r += lit;
+	}
+done:
+	*lenIn = r;
+	*lenOut = w;
+	return;
+}
+
+} // namespace camoto
@@ -0,0 +1,137 @@
+/**
+ * @file  filter-xor.cpp
+ * @brief Filter that XORs data with a repeating key or a generated keystream.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <camoto/filter-xor.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CAMOTO_XOR_SSE2
+#include <emmintrin.h>
+#endif
+
+/// Number of bytes processed with each block of keystream.
+#define XOR_BLOCK_SIZE 4096
+
+namespace camoto {
+
+/// out = in ^ key, for len bytes.
+static void xorBlock(uint8_t *out, const uint8_t *in, const uint8_t *key,
+	std::size_t len)
+{
+	std::size_t i = 0;
+#ifdef CAMOTO_XOR_SSE2
+	for (; i + 16 <= len; i += 16) {
+		__m128i d = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i k = _mm_loadu_si128((const __m128i *)(key + i));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(d, k));
+	}
+#endif
+	for (; i < len; i++) out[i] = in[i] ^ key[i];
+	return;
+}
+
+filter_xor::filter_xor(const std::vector<uint8_t>& key)
+	:	key(key),
+		period(key.size()),
+		pos(0),
+		reg(),
+		state(0)
+{
+	assert(!key.empty());
+	this->extendKey();
+}
+
+filter_xor::filter_xor(uint8_t seed, uint8_t step)
+	:	period(256),
+		pos(0),
+		reg(),
+		state(0)
+{
+	this->key.resize(256);
+	uint8_t k = seed;
+	for (auto& b : this->key) {
+		b = k;
+		k += step;
+	}
+	this->extendKey();
+}
+
+filter_xor::filter_xor(lfsr keystream)
+	:	key(XOR_BLOCK_SIZE),
+		period(0),
+		pos(0),
+		reg(keystream),
+		state(keystream.seed)
+{
+	// Shifting the register right eight times only ever feeds back from the
+	// bottom eight bits, so the effect of those shifts can be looked up.
+	for (unsigned int i = 0; i < 256; i++) {
+		uint32_t s = i;
+		for (int b = 0; b < 8; b++) s = (s >> 1) ^ ((s & 1) ? keystream.taps : 0);
+		this->lfsrTable[i] = s;
+	}
+}
+
+void filter_xor::extendKey()
+{
+	this->key.resize(this->period + XOR_BLOCK_SIZE);
+	for (std::size_t i = this->period; i < this->key.size(); i++) {
+		this->key[i] = this->key[i - this->period];
+	}
+	return;
+}
+
+void filter_xor::reset(stream::len lenInput)
+{
+	this->pos = 0;
+	this->state = this->reg.seed;
+	return;
+}
+
+void filter_xor::transform(uint8_t *out, stream::len *lenOut,
+	const uint8_t *in, stream::len *lenIn)
+{
+	stream::len len = std::min(*lenIn, *lenOut);
+	stream::len done = 0;
+	while (done < len) {
+		std::size_t n = std::min<stream::len>(len - done, XOR_BLOCK_SIZE);
+		const uint8_t *k;
+		if (this->period) {
+			k = &this->key[this->pos];
+			this->pos = (this->pos + n) % this->period;
+		} else {
+			uint32_t s = this->state;
+			for (std::size_t i = 0; i < n; i++) {
+				this->key[i] = s;
+				s = (s >> 8) ^ this->lfsrTable[s & 0xFF];
+			}
+			this->state = s;
+			k = this->key.data();
+		}
+		xorBlock(out + done, in + done, k, n);
+		done += n;
+	}
+	*lenIn = len;
+	*lenOut = len;
+	return;
+}
+
+} // namespace camoto
@@ -27,4 +27,37 @@ filter_error::filter_error(const std::string& msg)
 {
 }
 
+stream::len filter::measure(const uint8_t *in, stream::len *lenIn)
+{
+	uint8_t scratch[BUFFER_SIZE];
+	stream::len lenOut = sizeof(scratch);
+	this->transform(scratch, &lenOut, in, lenIn);
+	return lenOut;
+}
+
+stream::len filter::skip_leading_input()
+{
+	return 0;
+}
+
+void filter::use_contiguous_output()
+{
+	return;
+}
+
+bool filter::save_state(stream::output& s) const
+{
+	return false;
+}
+
+void filter::load_state(stream::input& s)
+{
+	throw filter_error("This filter can't resume from a saved state");
+}
+
+std::string filter::signature() const
+{
+	return std::string();
+}
+
 } // namespace camoto
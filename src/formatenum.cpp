@@ -0,0 +1,126 @@
+/**
+ * @file   formatenum.cpp
+ * @brief  Stream used by format handlers while probing.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <camoto/formatenum.hpp>
+#include <camoto/util.hpp>
+
+namespace camoto {
+namespace stream {
+
+input_probe::input_probe(std::shared_ptr<input> parent,
+	std::shared_ptr<const std::string> header, stream::len lenParent)
+	:	in_parent(parent),
+		header(header),
+		lenParent(lenParent),
+		offset(0)
+{
+}
+
+stream::len input_probe::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::len r = this->input_probe::try_read_at(this->offset, buffer, len);
+	this->offset += r;
+	return r;
+}
+
+stream::len input_probe::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	if (pos >= this->lenParent) return 0; // EOF
+	if (len > this->lenParent - pos) len = this->lenParent - pos;
+
+	stream::len done = 0;
+	if (pos < this->header->length()) {
+		done = std::min(len, this->header->length() - pos);
+		memcpy(buffer, this->header->data() + pos, done);
+	}
+	while (done < len) {
+		stream::len r = this->in_parent->try_read_at(pos + done, buffer + done,
+			len - done);
+		if (r == 0) break;
+		done += r;
+	}
+	return done;
+}
+
+void input_probe::seekg(stream::delta off, seek_from from)
+{
+	stream::pos baseOffset;
+	switch (from) {
+		case cur:
+			baseOffset = this->offset;
+			break;
+		case end:
+			baseOffset = this->lenParent;
+			break;
+		default:
+			baseOffset = 0;
+			break;
+	}
+	if ((off < 0) && (baseOffset < (unsigned)(off * -1))) {
+		throw seek_error("Cannot seek back past start of stream");
+	}
+	baseOffset += off;
+	if (baseOffset > this->lenParent) {
+		throw seek_error(createString("Cannot seek beyond end of stream (offset "
+			<< baseOffset << " > length " << this->lenParent << ")"));
+	}
+	this->offset = baseOffset;
+	return;
+}
+
+stream::pos input_probe::tellg() const
+{
+	return this->offset;
+}
+
+stream::len input_probe::size() const
+{
+	return this->lenParent;
+}
+
+const uint8_t *input_probe::view(stream::pos pos, stream::len len,
+	stream::len *got, std::string& scratch)
+{
+	if (pos > this->lenParent) {
+		throw seek_error(createString("Cannot view beyond end of stream (offset "
+			<< pos << " > length " << this->lenParent << ")"));
+	}
+	if (len > this->lenParent - pos) len = this->lenParent - pos;
+	if (pos + len <= this->header->length()) {
+		*got = len;
+		return (const uint8_t *)this->header->data() + pos;
+	}
+	// Copy through try_read_at() rather than passing the view on to the
+	// parent, as the parent's view() may seek, which isn't safe while other
+	// handlers are reading it from other threads.
+	scratch.resize(len);
+	*got = this->input_probe::try_read_at(pos, (uint8_t *)&scratch[0], len);
+	return (const uint8_t *)scratch.data();
+}
+
+bool input_probe::cheap_view() const
+{
+	return true;
+}
+
+} // namespace stream
+} // namespace camoto
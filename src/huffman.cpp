@@ -0,0 +1,207 @@
+/**
+ * @file  huffman.cpp
+ * @brief Table-driven canonical Huffman decoder.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <camoto/filter.hpp>
+#include <camoto/huffman.hpp>
+#include <camoto/util.hpp> // createString
+
+namespace camoto {
+
+/// Reverse the order of the lowest \e len bits in \e code.
+static uint32_t reverseBits(uint32_t code, unsigned int len)
+{
+	uint32_t r = 0;
+	for (unsigned int i = 0; i < len; i++) {
+		r = (r << 1) | (code & 1);
+		code >>= 1;
+	}
+	return r;
+}
+
+huffman_decoder::huffman_decoder(const uint8_t *lengths, unsigned int count,
+	bitstream::endian endianType, unsigned int rootBits)
+	:	rootBits(rootBits),
+		maxLen(0),
+		endianType(endianType)
+{
+	unsigned int lenCount[HUFFMAN_MAX_BITS + 1] = {0};
+	for (unsigned int i = 0; i < count; i++) {
+		if (lengths[i] > HUFFMAN_MAX_BITS) {
+			throw filter_error(createString("Huffman code for symbol " << i
+				<< " is " << (int)lengths[i] << " bits long, but the limit is "
+				<< HUFFMAN_MAX_BITS << " bits"));
+		}
+		lenCount[lengths[i]]++;
+		if (lengths[i] > this->maxLen) this->maxLen = lengths[i];
+	}
+	lenCount[0] = 0;
+	// With no codes at all there is still one bit to look at, so that decoding
+	// reports an invalid code rather than never consuming anything.
+	if (this->maxLen == 0) this->maxLen = 1;
+	if (this->rootBits == 0) this->rootBits = 1;
+	if (this->rootBits > this->maxLen) this->rootBits = this->maxLen;
+
+	// Make sure the lengths don't describe more codes than there are
+	int64_t left = 1;
+	for (unsigned int l = 1; l <= this->maxLen; l++) {
+		left = (left << 1) - lenCount[l];
+		if (left < 0) {
+			throw filter_error(createString("Huffman code lengths are invalid - "
+				"there are too many " << l << "-bit codes"));
+		}
+	}
+
+	// First canonical code of each length
+	uint32_t nextCode[HUFFMAN_MAX_BITS + 1];
+	uint32_t code = 0;
+	nextCode[0] = 0;
+	for (unsigned int l = 1; l <= this->maxLen; l++) {
+		code = (code + lenCount[l - 1]) << 1;
+		nextCode[l] = code;
+	}
+
+	// Each code with its bits in the order they are read, i.e. the first bit is
+	// the MSB for big endian and the LSB for little endian.
+	bool big = (endianType == bitstream::bigEndian);
+	std::vector<uint32_t> keys(count);
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int l = lengths[i];
+		if (l == 0) continue;
+		uint32_t c = nextCode[l]++;
+		keys[i] = big ? c : reverseBits(c, l);
+	}
+
+	const entry invalid = {0, 0, KIND_INVALID};
+	unsigned int root = this->rootBits;
+	uint32_t rootMask = (1u << root) - 1;
+	this->table.assign(1u << root, invalid);
+
+	// Codes longer than the root table go into a subtable for their first
+	// rootBits bits, big enough for the longest code sharing that prefix.
+	std::vector<unsigned int> subBits(1u << root, 0);
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int l = lengths[i];
+		if (l <= root) continue;
+		uint32_t prefix = big ? (keys[i] >> (l - root)) : (keys[i] & rootMask);
+		if (l - root > subBits[prefix]) subBits[prefix] = l - root;
+	}
+	for (uint32_t prefix = 0; prefix <= rootMask; prefix++) {
+		if (subBits[prefix] == 0) continue;
+		uint32_t offset = this->table.size();
+		this->table.resize(offset + (1u << subBits[prefix]), invalid);
+		this->table[prefix].value = offset;
+		this->table[prefix].bits = subBits[prefix];
+		this->table[prefix].kind = KIND_TABLE;
+	}
+
+	// Fill in every slot whose index starts with each code.  A code of len
+	// bits in a table of width bits fills 2^(width - len) slots, which are
+	// next to each other for big endian but spread out for little endian, where
+	// the unused bits are at the top of the index.
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int l = lengths[i];
+		if (l == 0) continue;
+		uint32_t offset = 0, key = keys[i];
+		unsigned int width = root, len = l;
+		if (l > root) {
+			uint32_t prefix = big ? (key >> (l - root)) : (key & rootMask);
+			offset = this->table[prefix].value;
+			width = this->table[prefix].bits;
+			len = l - root;
+			key = big ? (key & ((1u << len) - 1)) : (key >> root);
+		}
+		entry e = {i, (uint8_t)l, KIND_SYMBOL};
+		uint32_t fill = 1u << (width - len);
+		for (uint32_t k = 0; k < fill; k++) {
+			uint32_t index = big ? ((key << (width - len)) | k) : (key | (k << len));
+			this->table[offset + index] = e;
+		}
+	}
+}
+
+template <bitstream::endian E>
+inline int huffman_decoder::decodeOne(bitstream& bit, const uint8_t **in,
+	const uint8_t *inEnd) const
+{
+	unsigned int v;
+	unsigned int got = bit.peek<E>(*in, inEnd, this->maxLen, &v);
+
+	unsigned int index;
+	if (E == bitstream::bigEndian) {
+		index = v >> (this->maxLen - this->rootBits);
+	} else {
+		index = v & ((1u << this->rootBits) - 1);
+	}
+	const entry *e = &this->table[index];
+	if (e->kind == KIND_TABLE) {
+		unsigned int sub;
+		if (E == bitstream::bigEndian) {
+			sub = v >> (this->maxLen - this->rootBits - e->bits);
+		} else {
+			sub = v >> this->rootBits;
+		}
+		e = &this->table[e->value + (sub & ((1u << e->bits) - 1))];
+	}
+
+	if ((e->kind != KIND_SYMBOL) || (e->bits > got)) {
+		// If some of the bits looked at were padding, the code may just be
+		// incomplete rather than invalid.
+		if (got < this->maxLen) return -1;
+		throw filter_error("Huffman data is corrupted - invalid code");
+	}
+	bit.consume<E>(in, inEnd, e->bits);
+	return e->value;
+}
+
+int huffman_decoder::decode(bitstream& bit, const uint8_t **in,
+	const uint8_t *inEnd) const
+{
+	if (this->endianType == bitstream::littleEndian) {
+		return this->decodeOne<bitstream::littleEndian>(bit, in, inEnd);
+	}
+	return this->decodeOne<bitstream::bigEndian>(bit, in, inEnd);
+}
+
+std::size_t huffman_decoder::decode_n(bitstream& bit, const uint8_t **in,
+	const uint8_t *inEnd, unsigned int *out, std::size_t count) const
+{
+	std::size_t i = 0;
+	if (this->endianType == bitstream::littleEndian) {
+		for (; i < count; i++) {
+			int s = this->decodeOne<bitstream::littleEndian>(bit, in, inEnd);
+			if (s < 0) break;
+			out[i] = s;
+		}
+	} else {
+		for (; i < count; i++) {
+			int s = this->decodeOne<bitstream::bigEndian>(bit, in, inEnd);
+			if (s < 0) break;
+			out[i] = s;
+		}
+	}
+	return i;
+}
+
+unsigned int huffman_decoder::max_length() const
+{
+	return this->maxLen;
+}
+
+} // namespace camoto
@@ -42,14 +42,16 @@ IFFReader::IFFReader(stream::input& iff, Filetype filetype)
 
 void IFFReader::root()
 {
+	this->beginLevel(0, this->iff.size());
 	this->iff.seekg(0, stream::start);
-	this->loadChunks(this->iff.size());
 	return;
 }
 
 std::vector<IFFReader::fourcc> IFFReader::list()
 {
+	while (this->loadNextChunk());
 	std::vector<fourcc> names;
+	names.reserve(this->chunks.size());
 	for (const auto& i : this->chunks) {
 		names.push_back(i.name);
 	}
@@ -58,17 +60,24 @@ std::vector<IFFReader::fourcc> IFFReader::list()
 
 stream::len IFFReader::seek(const fourcc& name)
 {
-	for (const auto& i : this->chunks) {
-		if (name.compare(i.name) == 0) {
-			this->iff.seekg(i.start, stream::start);
-			return i.len;
+	auto found = this->index.find(name);
+	while (found == this->index.end()) {
+		if (!this->loadNextChunk()) {
+			throw stream::error(createString("IFF: Could not find chunk " << name));
+		}
+		// Only the chunk just read can be a new match
+		if (this->chunks.back().name == name) {
+			found = this->index.find(name);
 		}
 	}
-	throw stream::error(createString("IFF: Could not find chunk " << name));
+	Chunk& chunk = this->chunks[found->second];
+	this->iff.seekg(chunk.start, stream::start);
+	return chunk.len;
 }
 
 stream::len IFFReader::seek(unsigned int index)
 {
+	while ((index >= this->chunks.size()) && this->loadNextChunk());
 	if (index >= this->chunks.size()) {
 		throw stream::error(createString("IFF: Chunk #" << index
 			<< " is out of range (max chunk is #" << this->chunks.size() << ")"));
@@ -80,105 +89,139 @@ stream::len IFFReader::seek(unsigned int index)
 
 stream::len IFFReader::open(const fourcc& name, fourcc *type)
 {
-	stream::len len = this->seek(name);
-	this->iff >> fixedLength(*type, 4);
-	this->loadChunks(len - 4);
-	return len;
+	return this->openLevel(this->seek(name), type);
 }
 
 stream::len IFFReader::open(unsigned int index, fourcc *type)
 {
-	stream::len len = this->seek(index);
-	this->iff >> fixedLength(*type, 4);
-	this->loadChunks(len - 4);
+	return this->openLevel(this->seek(index), type);
+}
+
+stream::len IFFReader::openLevel(stream::len len, fourcc *type)
+{
+	stream::len lenContent = len;
+	if (type) {
+		if (len < 4) {
+			throw stream::error("IFF: Chunk is too short to contain a type code");
+		}
+		this->iff >> u32be(type->code);
+		lenContent -= 4;
+	}
+	this->beginLevel(this->iff.tellg(), lenContent);
 	return len;
 }
 
-void IFFReader::loadChunks(stream::len lenChunk)
+void IFFReader::beginLevel(stream::pos start, stream::len lenChunk)
 {
 	this->chunks.clear();
-	while (lenChunk > 8) {
-		lenChunk -= 8; // ID and chunk size fields
-		Chunk c;
-		c.start = this->iff.tellg() + 8;
-		this->iff >> fixedLength(c.name, 4);
-		switch (this->filetype) {
-			case Filetype_RIFF_Unpadded:
-			case Filetype_RIFF:
-				this->iff >> u32le(c.len);
-				break;
-			case Filetype_IFF_Unpadded:
-			case Filetype_IFF:
-			default:
-				this->iff >> u32be(c.len);
-				break;
-		}
+	this->index.clear();
+	this->nextChunk = start;
+	this->lenRemaining = lenChunk;
+	return;
+}
 
-		unsigned int pad;
-		switch (this->filetype) {
-			case Filetype_RIFF:
-			case Filetype_IFF:
-				pad = (c.len % 2) ? 1 : 0;
-				break;
-			case Filetype_RIFF_Unpadded:
-			case Filetype_IFF_Unpadded:
-			default:
-				pad = 0;
-				break;
-		}
+bool IFFReader::loadNextChunk()
+{
+	if (this->lenRemaining <= 8) return false;
+	this->lenRemaining -= 8; // ID and chunk size fields
+
+	Chunk c;
+	c.start = this->nextChunk + 8;
+	this->iff.seekg(this->nextChunk, stream::start);
+	switch (this->filetype) {
+		case Filetype_RIFF_Unpadded:
+		case Filetype_RIFF:
+			read_packed(this->iff, u32be(c.name.code), u32le(c.len));
+			break;
+		case Filetype_IFF_Unpadded:
+		case Filetype_IFF:
+		default:
+			read_packed(this->iff, u32be(c.name.code), u32be(c.len));
+			break;
+	}
 
-		stream::len lenPaddedSub = c.len + pad;
-		if (lenChunk < c.len) c.len = lenChunk; // truncated
-		if (lenChunk < lenPaddedSub) lenPaddedSub = lenChunk; // final pad truncated
-		this->chunks.push_back(c);
-		lenChunk -= lenPaddedSub;
-		this->iff.seekg(lenPaddedSub, stream::cur);
+	unsigned int pad;
+	switch (this->filetype) {
+		case Filetype_RIFF:
+		case Filetype_IFF:
+			pad = (c.len % 2) ? 1 : 0;
+			break;
+		case Filetype_RIFF_Unpadded:
+		case Filetype_IFF_Unpadded:
+		default:
+			pad = 0;
+			break;
 	}
-	return;
+
+	stream::len lenPaddedSub = c.len + pad;
+	if (this->lenRemaining < c.len) c.len = this->lenRemaining; // truncated
+	if (this->lenRemaining < lenPaddedSub) lenPaddedSub = this->lenRemaining; // final pad truncated
+	this->index.emplace(c.name, this->chunks.size());
+	this->chunks.push_back(c);
+	this->lenRemaining -= lenPaddedSub;
+	this->nextChunk = c.start + lenPaddedSub;
+	return true;
 }
 
 
-IFFWriter::IFFWriter(std::shared_ptr<stream::output> iff_ptr, Filetype filetype)
+IFFWriter::IFFWriter(std::shared_ptr<stream::output> iff_ptr, Filetype filetype,
+	bool streaming)
 	:	iff_ptr(iff_ptr),
 		iff(*iff_ptr),
-		filetype(filetype)
+		filetype(filetype),
+		streaming(streaming),
+		lenStreamed(0),
+		holding(false),
+		out(*this)
 {
 }
 
-IFFWriter::IFFWriter(stream::output& iff, Filetype filetype)
+IFFWriter::IFFWriter(stream::output& iff, Filetype filetype, bool streaming)
 	:	iff_ptr(),
 		iff(iff),
-		filetype(filetype)
+		filetype(filetype),
+		streaming(streaming),
+		lenStreamed(0),
+		holding(false),
+		out(*this)
 {
 }
 
 void IFFWriter::begin(const fourcc& name)
 {
-	this->chunk.push_back(this->iff.tellp());
-	this->iff
-		<< nullPadded(name, 4)
-		<< nullPadded("", 4)
-	;
+	this->beginChunk(name, nullptr, 0, false);
 	return;
 }
 
 void IFFWriter::begin(const fourcc& name, const fourcc& type)
 {
-	this->chunk.push_back(this->iff.tellp());
-	this->iff
-		<< nullPadded(name, 4)
-		<< nullPadded("", 4)
-		<< nullPadded(type, 4)
-	;
+	this->beginChunk(name, &type, 0, false);
+	return;
+}
+
+void IFFWriter::begin(const fourcc& name, stream::len len)
+{
+	this->beginChunk(name, nullptr, len, true);
+	return;
+}
+
+void IFFWriter::begin(const fourcc& name, const fourcc& type, stream::len len)
+{
+	this->beginChunk(name, &type, len, true);
 	return;
 }
 
 void IFFWriter::end()
 {
-	stream::pos orig = this->iff.tellp();
-	stream::pos start = this->chunk.back();
+	open_chunk c = this->chunk.back();
 	this->chunk.pop_back();
-	stream::len lenChunk = orig - (start + 8);
+	stream::pos orig = this->tell();
+	stream::len lenChunk = orig - (c.start + 8);
+
+	if (c.declared && (lenChunk != c.len)) {
+		throw stream::write_error(createString("IFF chunk was declared as "
+			<< c.len << " bytes but " << lenChunk << " bytes were written"));
+	}
 
 	switch (this->filetype) {
 		case Filetype_RIFF_Unpadded:
@@ -188,24 +231,125 @@ void IFFWriter::end()
 		case Filetype_IFF:
 			if (orig % 2) {
 				// Pad to even byte boundary
-				this->iff.write("", 1);
+				this->target().write("", 1);
+				if (this->streaming && !this->holding) this->lenStreamed++;
 				orig++;
 			}
 			break;
 	}
 
-	this->iff.seekp(start + 4, stream::start);
+	if (!c.declared) {
+		if (this->streaming) {
+			// Fill in the length in memory, where seeking is free
+			stream::pos startHeld = c.start - this->lenStreamed;
+			this->held.seekp(startHeld + 4, stream::start);
+			this->writeLength(this->held, lenChunk);
+			this->held.seekp(0, stream::end);
+		} else {
+			this->iff.seekp(c.start + 4, stream::start);
+			this->writeLength(this->iff, lenChunk);
+			this->iff.seekp(orig, stream::start);
+		}
+	}
+
+	if (c.held) {
+		// Outermost chunk held in memory is finished, so send it on
+		this->holding = false;
+		this->iff.write(this->held.data);
+		this->lenStreamed += this->held.data.length();
+		this->held.truncate(0);
+	}
+	return;
+}
+
+stream::output& IFFWriter::data()
+{
+	if (this->streaming) return this->out;
+	return this->iff;
+}
+
+stream::output& IFFWriter::target()
+{
+	if (this->holding) return this->held;
+	return this->iff;
+}
+
+stream::pos IFFWriter::tell()
+{
+	if (!this->streaming) return this->iff.tellp();
+	if (this->holding) return this->lenStreamed + this->held.tellp();
+	return this->lenStreamed;
+}
+
+void IFFWriter::beginChunk(const fourcc& name, const fourcc *type,
+	stream::len len, bool declared)
+{
+	bool startHolding = this->streaming && !declared && !this->holding;
+	if (startHolding) this->holding = true;
+
+	this->chunk.push_back(open_chunk{this->tell(), len, declared, startHolding});
+	stream::output& dest = this->target();
+	dest << u32be(name.code);
+	this->writeLength(dest, len);
+	if (type) dest << u32be(type->code);
+	if (!this->holding) this->lenStreamed += type ? 12 : 8;
+	return;
+}
+
+void IFFWriter::writeLength(stream::output& s, stream::len len)
+{
 	switch (this->filetype) {
 		case Filetype_RIFF_Unpadded:
 		case Filetype_RIFF:
-			this->iff << u32le(lenChunk);
+			s << u32le(len);
 			break;
 		case Filetype_IFF_Unpadded:
 		case Filetype_IFF:
-			this->iff << u32be(lenChunk);
+			s << u32be(len);
 			break;
 	}
-	this->iff.seekp(orig, stream::start);
+	return;
+}
+
+
+IFFWriter::sink::sink(IFFWriter& writer)
+	:	writer(writer)
+{
+}
+
+stream::len IFFWriter::sink::try_write(const uint8_t *buffer, stream::len len)
+{
+	stream::len w = this->writer.target().try_write(buffer, len);
+	if (!this->writer.holding) this->writer.lenStreamed += w;
+	return w;
+}
+
+void IFFWriter::sink::seekp(stream::delta off, stream::seek_from from)
+{
+	// Only allow seeks that don't go anywhere
+	stream::pos pos = this->tellp();
+	if (((from == stream::cur) && (off == 0))
+		|| ((from == stream::start) && ((stream::pos)off == pos))
+	) {
+		return;
+	}
+	throw stream::seek_error("Cannot seek while streaming an IFF file");
+}
+
+stream::pos IFFWriter::sink::tellp() const
+{
+	return this->writer.tell();
+}
+
+void IFFWriter::sink::truncate(stream::pos size)
+{
+	throw stream::write_error("Cannot truncate while streaming an IFF file");
+}
+
+void IFFWriter::sink::flush()
+{
+	// Data held in memory can't be written until its chunk is finished
+	if (!this->writer.holding) this->writer.iff.flush();
 	return;
 }
 
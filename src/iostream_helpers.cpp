@@ -18,7 +18,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <camoto/iostream_helpers.hpp>
 
 #ifdef DEBUG
@@ -29,6 +31,9 @@
 
 #define ZEROPAD_BLOCK_SIZE  16
 
+/// Number of bytes to look at in one go when searching for a terminating null.
+#define NULL_SCAN_CHUNK 256
+
 namespace camoto {
 
 null_padded_read::null_padded_read(std::string& r, stream::len len, bool chop)
@@ -47,11 +52,11 @@ void null_padded_read::read(stream::input& s) const
 		// Read in the whole data
 		stream::len lenRead = s.try_read((uint8_t *)&this->r[0], this->len);
 
-		// Shorten the string if not all the data was read
-		this->r.resize(lenRead);
-
-		// Shrink the string back to the first null
-		this->r.resize(strlen(this->r.c_str()));
+		// Shrink the string back to the first null, or to the amount read if
+		// there was no null
+		const char *data = this->r.data();
+		const char *end = (const char *)memchr(data, 0, lenRead);
+		this->r.resize(end ? end - data : lenRead);
 	} else {
 		// Make the buffer the length of the whole operation
 		this->r.resize(this->len);
@@ -110,9 +115,85 @@ null_terminated_read::null_terminated_read(std::string& r, stream::len maxlen)
 }
 
 void null_terminated_read::read(stream::input& s) const
+{
+	if (!s.cheap_view()) {
+		this->read_blocks(s);
+		return;
+	}
+
+	stream::pos start = s.tellg();
+	stream::pos pos = start;
+	stream::len remaining = this->maxlen;
+	std::string scratch;
+	while (remaining) {
+		stream::len lenChunk = std::min(remaining, (stream::len)NULL_SCAN_CHUNK);
+		stream::len got;
+		const uint8_t *data;
+		try {
+			data = s.view(pos, lenChunk, &got, scratch);
+		} catch (const stream::seek_error&) {
+			// The stream can't be peeked at (e.g. stdin is a pipe) so fall back to
+			// reading one byte at a time.
+			if (pos != start) s.seekg(pos, stream::start);
+			this->read_bytes(s, remaining);
+			return;
+		}
+		const uint8_t *end = (const uint8_t *)memchr(data, 0, got);
+		if (end) {
+			this->r.append((const char *)data, end - data);
+			s.seekg(pos + (end - data) + 1, stream::start); // skip the null too
+			return;
+		}
+		this->r.append((const char *)data, got);
+		pos += got;
+		remaining -= got;
+		if (got < lenChunk) {
+			// Hit EOF before the null, like read() would
+			s.seekg(pos, stream::start);
+			throw stream::incomplete_read(0);
+		}
+	}
+	s.seekg(pos, stream::start);
+	return;
+}
+
+void null_terminated_read::read_blocks(stream::input& s) const
+{
+	std::string scratch;
+	stream::len got;
+	try {
+		// A zero-length view copies nothing, but still fails on a stream that
+		// can't seek back over whatever is read past the null.
+		s.view(s.tellg(), 0, &got, scratch);
+	} catch (const stream::seek_error&) {
+		this->read_bytes(s, this->maxlen);
+		return;
+	}
+
+	uint8_t buf[NULL_SCAN_CHUNK];
+	stream::len remaining = this->maxlen;
+	while (remaining) {
+		stream::len lenChunk = std::min(remaining, (stream::len)NULL_SCAN_CHUNK);
+		got = s.try_read(buf, lenChunk);
+		if (got == 0) throw stream::incomplete_read(0); // EOF before the null
+		const uint8_t *end = (const uint8_t *)memchr(buf, 0, got);
+		if (end) {
+			this->r.append((const char *)buf, end - buf);
+			stream::len unused = got - (end - buf) - 1; // skip the null too
+			if (unused) s.seekg(-(stream::delta)unused, stream::cur);
+			return;
+		}
+		this->r.append((const char *)buf, got);
+		remaining -= got;
+	}
+	return;
+}
+
+void null_terminated_read::read_bytes(stream::input& s, stream::len maxlen)
+	const
 {
 	uint8_t buf;
-	for (stream::len i = 0; i < this->maxlen; i++) {
+	for (stream::len i = 0; i < maxlen; i++) {
 		s.read(&buf, 1);
 		if (buf == 0) break;
 		this->r += (char)buf;
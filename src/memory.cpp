@@ -0,0 +1,174 @@
+/**
+ * @file   memory.cpp
+ * @brief  Keep track of how much memory streams are holding on to.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <camoto/memory.hpp>
+
+namespace camoto {
+namespace memory {
+
+const char *name(owner o)
+{
+	switch (o) {
+		case owner::string: return "string";
+		case owner::filtered: return "filtered";
+		case owner::seg: return "seg";
+		case owner::paged: return "paged";
+	}
+	return "unknown";
+}
+
+/// Bytes held by each owner.
+static std::atomic<uint64_t> held[NUM_OWNERS];
+
+/// Bytes held by all owners.
+static std::atomic<uint64_t> total;
+
+/// Highest value of total.
+static std::atomic<uint64_t> peak;
+
+/// Soft limit, or 0 for none.
+static std::atomic<uint64_t> limit;
+
+/// Has the limit been crossed without total dropping back below it?
+static std::atomic<bool> over;
+
+/// Function to call when the limit is crossed.
+/**
+ * The function is kept in a shared_ptr so it can be called without holding
+ * the lock, and safely replaced while another thread is calling it.
+ */
+struct limit_handler {
+	std::mutex lock;
+	std::shared_ptr<limit_fn> fn;
+};
+
+/// Shared state, which is never destroyed so it can be used during shutdown.
+static limit_handler& handler()
+{
+	static limit_handler *h = new limit_handler();
+	return *h;
+}
+
+totals snapshot()
+{
+	totals t;
+	for (unsigned int i = 0; i < NUM_OWNERS; i++) {
+		t.bytes[i] = held[i].load(std::memory_order_relaxed);
+	}
+	t.total = total.load(std::memory_order_relaxed);
+	t.peak = peak.load(std::memory_order_relaxed);
+	return t;
+}
+
+void set_soft_limit(uint64_t bytes, limit_fn fn)
+{
+	limit_handler& h = handler();
+	std::lock_guard<std::mutex> guard(h.lock);
+	h.fn = fn ? std::make_shared<limit_fn>(std::move(fn)) : nullptr;
+	limit.store(h.fn ? bytes : 0);
+	over.store(false);
+	return;
+}
+
+void allocated(owner o, uint64_t len)
+{
+	held[(unsigned int)o].fetch_add(len, std::memory_order_relaxed);
+	uint64_t now = total.fetch_add(len, std::memory_order_relaxed) + len;
+
+	uint64_t high = peak.load(std::memory_order_relaxed);
+	while ((now > high) && !peak.compare_exchange_weak(high, now,
+		std::memory_order_relaxed));
+
+	uint64_t lim = limit.load(std::memory_order_relaxed);
+	if (lim && (now > lim) && !over.exchange(true)) {
+		// Stop the callback running again if it allocates memory itself
+		static thread_local bool busy = false;
+		if (busy) return;
+
+		std::shared_ptr<limit_fn> fn;
+		{
+			limit_handler& h = handler();
+			std::lock_guard<std::mutex> guard(h.lock);
+			fn = h.fn;
+		}
+		if (fn) {
+			busy = true;
+			try {
+				(*fn)(now);
+			} catch (...) {
+				busy = false;
+				throw;
+			}
+			busy = false;
+		}
+	}
+	return;
+}
+
+void freed(owner o, uint64_t len)
+{
+	held[(unsigned int)o].fetch_sub(len, std::memory_order_relaxed);
+	uint64_t now = total.fetch_sub(len, std::memory_order_relaxed) - len;
+	if (now <= limit.load(std::memory_order_relaxed)) {
+		over.store(false, std::memory_order_relaxed);
+	}
+	return;
+}
+
+
+charge::charge(owner type)
+	:	o(type),
+		bytes(0)
+{
+}
+
+charge::charge(const charge& other)
+	:	o(other.o),
+		bytes(other.bytes)
+{
+	if (this->bytes) allocated(this->o, this->bytes);
+}
+
+charge::~charge()
+{
+	if (this->bytes) freed(this->o, this->bytes);
+}
+
+charge& charge::operator=(const charge& other)
+{
+	this->set(other.bytes);
+	return *this;
+}
+
+void charge::change(uint64_t len)
+{
+	// Update the charge first, in case the limit callback looks at it
+	uint64_t old = this->bytes;
+	this->bytes = len;
+	if (len > old) allocated(this->o, len - old);
+	else freed(this->o, old - len);
+	return;
+}
+
+} // namespace memory
+} // namespace camoto
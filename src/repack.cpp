@@ -0,0 +1,427 @@
+/**
+ * @file  repack.cpp
+ * @brief Rebuild a whole archive in one planned pass.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <future>
+#include <iterator>
+#include <map>
+#include <camoto/repack.hpp>
+#include <camoto/stats.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/util.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Copy a block between two streams, reading each block while the last is
+/// being written.
+/**
+ * @param buf
+ *   Scratch space of at least twice REPACK_BUFFER_SIZE.
+ */
+static void copy_range(output& dest, stream::pos to, input& src,
+	stream::pos from, stream::len len, std::vector<uint8_t>& buf)
+{
+	uint8_t *block[2] = {buf.data(), buf.data() + REPACK_BUFFER_SIZE};
+	unsigned int cur = 0;
+	stream::len lenDone = 0;
+	stream::len lenNext = std::min<stream::len>(len, REPACK_BUFFER_SIZE);
+	std::future<stream::len> pending;
+	if (lenNext) pending = src.async_read_at(from, block[cur], lenNext);
+	try {
+		while (lenDone < len) {
+			stream::len lenBlock = lenNext;
+			stream::len r = pending.get();
+			if (r < lenBlock) throw incomplete_read(lenDone + r);
+
+			lenNext = std::min<stream::len>(len - lenDone - lenBlock,
+				REPACK_BUFFER_SIZE);
+			if (lenNext) {
+				pending = src.async_read_at(from + lenDone + lenBlock,
+					block[cur ^ 1], lenNext);
+			}
+
+			stream::len w = dest.try_write_at(to + lenDone, block[cur], lenBlock);
+			if (w < lenBlock) throw incomplete_write(lenDone + w);
+			lenDone += lenBlock;
+			cur ^= 1;
+		}
+	} catch (...) {
+		// The read must not carry on into the buffer once it has been freed
+		if (pending.valid()) pending.wait();
+		throw;
+	}
+	return;
+}
+
+/// Run an item's data through its filter, keeping the result in memory.
+static std::string filter_range(const repack_item& item)
+{
+	std::vector<uint8_t> in(item.srcLen);
+	stream::len r = 0;
+	while (r < item.srcLen) {
+		stream::len n = item.source->try_read_at(item.srcOffset + r,
+			in.data() + r, item.srcLen - r);
+		if (n == 0) throw incomplete_read(r);
+		r += n;
+	}
+
+	filter& algo = *item.algo;
+	algo.reset(item.srcLen);
+	stream::pos posIn = std::min<stream::pos>(algo.skip_leading_input(),
+		item.srcLen);
+	// Everything is decoded into one block, so back-references can be copied
+	// straight out of the earlier output
+	algo.use_contiguous_output();
+
+	std::string out;
+	stream::len lenDone = 0;
+	stream::len lenIn, lenOut;
+	do {
+		if (out.size() - lenDone < BUFFER_SIZE) {
+			out.resize(std::max<stream::len>(out.size() * 2, lenDone + BUFFER_SIZE));
+		}
+		lenIn = item.srcLen - posIn;
+		lenOut = out.size() - lenDone;
+		CAMOTO_STATS_TRANSFORM(algo, (uint8_t *)&out[lenDone], &lenOut,
+			in.data() + posIn, &lenIn);
+		assert(posIn + lenIn <= item.srcLen);
+		posIn += lenIn;
+		lenDone += lenOut;
+	} while ((lenIn != 0) || (lenOut != 0));
+	out.resize(lenDone);
+	return out;
+}
+
+void repack(std::vector<repack_item>& layout, output& dest, thread_pool *pool)
+{
+	stream::pos lenEstimate = 0, next = 0;
+	bool filtered = false;
+	for (const auto& i : layout) {
+		if (!i.source) {
+			throw error("repack() was given an item with no source stream.");
+		}
+		if (i.algo) filtered = true;
+		stream::pos start = (i.destOffset == REPACK_NEXT) ? next : i.destOffset;
+		next = start + i.srcLen;
+		lenEstimate = std::max(lenEstimate, next);
+	}
+
+	std::unique_ptr<thread_pool> localPool;
+	if (filtered && !pool) {
+		localPool.reset(new thread_pool());
+		pool = localPool.get();
+	}
+
+	dest.truncate(0);
+	dest.reserve(lenEstimate);
+
+	// Filtered data, waiting to be written
+	std::vector<std::future<std::string>> results(layout.size());
+	std::size_t nextQueued = 0;
+	stream::len lenAhead = 0;
+
+	// Start filtering items up to REPACK_AHEAD beyond the one being written
+	auto queue = [&](std::size_t current) {
+		while (nextQueued < layout.size()) {
+			repack_item *item = &layout[nextQueued];
+			if (item->algo) {
+				if ((nextQueued > current) && (lenAhead + item->srcLen > REPACK_AHEAD)) {
+					break;
+				}
+				// The task has to be copyable, so the promise is shared
+				auto done = std::make_shared<std::promise<std::string>>();
+				results[nextQueued] = done->get_future();
+				lenAhead += item->srcLen;
+				pool->submit([item, done](unsigned int) {
+					try {
+						done->set_value(filter_range(*item));
+					} catch (...) {
+						done->set_exception(std::current_exception());
+					}
+				});
+			}
+			nextQueued++;
+		}
+	};
+
+	std::vector<uint8_t> buf(2 * REPACK_BUFFER_SIZE);
+	stream::pos lenDest = 0;
+	next = 0;
+	try {
+		std::size_t i = 0;
+		while (i < layout.size()) {
+			queue(i);
+			repack_item& item = layout[i];
+			if (item.destOffset == REPACK_NEXT) item.destOffset = next;
+
+			// Writes can't start past the end of every type of stream
+			if (item.destOffset > lenDest) {
+				dest.truncate(item.destOffset);
+				lenDest = item.destOffset;
+			}
+
+			if (item.algo) {
+				std::string data = results[i].get();
+				lenAhead -= item.srcLen;
+				item.destLen = data.length();
+				if (item.destLen) {
+					stream::len w = dest.try_write_at(item.destOffset,
+						(const uint8_t *)data.data(), item.destLen);
+					if (w < item.destLen) throw incomplete_write(w);
+				}
+				i++;
+			} else {
+				// Copy items that follow on from each other in one go
+				item.destLen = item.srcLen;
+				stream::len lenRun = item.srcLen;
+				std::size_t j = i + 1;
+				for (; j < layout.size(); j++) {
+					repack_item& n = layout[j];
+					if (n.algo
+						|| (n.source != item.source)
+						|| (n.srcOffset != item.srcOffset + lenRun)
+						|| ((n.destOffset != REPACK_NEXT)
+							&& (n.destOffset != item.destOffset + lenRun))
+					) {
+						break;
+					}
+					n.destOffset = item.destOffset + lenRun;
+					n.destLen = n.srcLen;
+					lenRun += n.srcLen;
+				}
+				copy_range(dest, item.destOffset, *item.source, item.srcOffset, lenRun,
+					buf);
+				i = j;
+			}
+			const repack_item& last = layout[i - 1];
+			next = last.destOffset + last.destLen;
+			lenDest = std::max(lenDest, next);
+		}
+	} catch (...) {
+		// Filters still running refer to the layout
+		if (pool) {
+			try {
+				pool->wait();
+			} catch (...) {
+			}
+		}
+		throw;
+	}
+
+	dest.truncate(lenDest);
+	dest.flush();
+	return;
+}
+
+/// One item being moved within the archive.
+struct repack_move {
+	stream::pos from;  ///< Current offset of the data
+	stream::pos to;    ///< New offset of the data
+	stream::len len;   ///< Length of the data
+};
+
+/// Check whether the moves can be done in order without losing any data.
+/**
+ * Each move must not write over data that is yet to be moved.
+ */
+static bool moves_safe(const std::vector<repack_move>& moves)
+{
+	// Data still to be moved, as start -> end
+	std::map<stream::pos, stream::pos> pending;
+	for (const auto& m : moves) {
+		auto it = pending.lower_bound(m.from);
+		// Two items sharing data would need to read it after it was moved
+		if ((it != pending.end()) && (it->first < m.from + m.len)) return false;
+		if ((it != pending.begin()) && (std::prev(it)->second > m.from)) {
+			return false;
+		}
+		pending.emplace_hint(it, m.from, m.from + m.len);
+	}
+	for (const auto& m : moves) {
+		pending.erase(m.from);
+		auto it = pending.lower_bound(m.to);
+		if ((it != pending.end()) && (it->first < m.to + m.len)) return false;
+		if ((it != pending.begin()) && (std::prev(it)->second > m.to)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Rebuild an archive by moving each item within it, if that is possible.
+/**
+ * @return true if the archive was rebuilt, false if nothing has been done
+ *   because an item is filtered or the items can't be moved without
+ *   overwriting each other.
+ */
+static bool move_in_place(std::vector<repack_item>& layout, inout& archive)
+{
+	for (const auto& i : layout) {
+		if (i.algo) return false;
+	}
+
+	// Work out where everything will go
+	std::vector<stream::pos> dest(layout.size());
+	std::vector<std::size_t> byDest;
+	stream::pos next = 0, lenFinal = 0;
+	for (std::size_t k = 0; k < layout.size(); k++) {
+		const repack_item& i = layout[k];
+		dest[k] = (i.destOffset == REPACK_NEXT) ? next : i.destOffset;
+		next = dest[k] + i.srcLen;
+		lenFinal = std::max(lenFinal, next);
+		if (i.srcLen) byDest.push_back(k);
+	}
+	std::sort(byDest.begin(), byDest.end(), [&dest](std::size_t a, std::size_t b) {
+		return dest[a] < dest[b];
+	});
+	for (std::size_t k = 1; k < byDest.size(); k++) {
+		const repack_item& prev = layout[byDest[k - 1]];
+		if (dest[byDest[k - 1]] + prev.srcLen > dest[byDest[k]]) {
+			throw error(createString("Items in the repack layout overlap (at offset "
+				<< dest[byDest[k]] << ")"));
+		}
+	}
+
+	// Items moving down are done from the start of the archive, and items
+	// moving up from the end, so neither runs over the other's source data
+	std::vector<repack_move> down, up;
+	for (std::size_t k : byDest) {
+		const repack_item& i = layout[k];
+		if (i.source || (i.srcOffset == dest[k])) continue;
+		repack_move m = {i.srcOffset, dest[k], i.srcLen};
+		if (m.to < m.from) down.push_back(m);
+		else up.push_back(m);
+	}
+	std::reverse(up.begin(), up.end());
+	std::vector<repack_move> moves = down;
+	moves.insert(moves.end(), up.begin(), up.end());
+	if (!moves_safe(moves)) return false;
+
+	stream::len lenOrig = archive.size();
+	if (lenFinal > lenOrig) archive.truncate(lenFinal);
+
+	std::vector<uint8_t> buf(2 * REPACK_BUFFER_SIZE);
+	std::size_t k = 0;
+	while (k < moves.size()) {
+		// Neighbouring items moving the same distance are moved together
+		repack_move run = moves[k];
+		bool up = run.to > run.from;
+		for (k++; k < moves.size(); k++) {
+			const repack_move& m = moves[k];
+			if (m.to - m.from != run.to - run.from) break;
+			if (up) {
+				// Moves up are listed from the end of the archive backwards
+				if (m.from + m.len != run.from) break;
+				run.from = m.from;
+				run.to = m.to;
+			} else {
+				if (run.from + run.len != m.from) break;
+			}
+			run.len += m.len;
+		}
+		stream::move(archive, run.from, run.to, run.len, buf.data(), buf.size());
+	}
+
+	// New data goes in last, once the space it needs has been cleared
+	for (std::size_t k : byDest) {
+		repack_item& i = layout[k];
+		if (!i.source) continue;
+		copy_range(archive, dest[k], *i.source, i.srcOffset, i.srcLen, buf);
+	}
+
+	for (std::size_t k = 0; k < layout.size(); k++) {
+		layout[k].destOffset = dest[k];
+		layout[k].destLen = layout[k].srcLen;
+	}
+	if (lenFinal < lenOrig) archive.truncate(lenFinal);
+	archive.flush();
+	return true;
+}
+
+/// Copy of the layout with every item in the archive reading from \e archive.
+static std::vector<repack_item> resolve_sources(
+	const std::vector<repack_item>& layout, std::shared_ptr<input> archive)
+{
+	std::vector<repack_item> items = layout;
+	for (auto& i : items) {
+		if (!i.source) i.source = archive;
+	}
+	return items;
+}
+
+/// Copy the final positions back into the caller's layout.
+static void copy_positions(std::vector<repack_item>& layout,
+	const std::vector<repack_item>& items)
+{
+	for (std::size_t k = 0; k < layout.size(); k++) {
+		layout[k].destOffset = items[k].destOffset;
+		layout[k].destLen = items[k].destLen;
+	}
+	return;
+}
+
+bool repack_in_place(std::vector<repack_item>& layout, inout& archive,
+	thread_pool *pool)
+{
+	if (move_in_place(layout, archive)) return true;
+
+	auto temp = open_temp();
+	std::vector<repack_item> items = resolve_sources(layout,
+		borrow<input>(archive));
+	repack(items, *temp, pool);
+	copy_positions(layout, items);
+
+	archive.truncate(temp->size());
+	archive.seekp(0, stream::start);
+	temp->seekg(0, stream::start);
+	stream::copy(archive, *temp);
+	archive.flush();
+	return false;
+}
+
+bool repack_file(std::vector<repack_item>& layout,
+	const std::string& filename, thread_pool *pool)
+{
+	{
+		stream::file archive(filename, false);
+		if (move_in_place(layout, archive)) return true;
+	}
+
+	std::string tempName = filename + ".repack";
+	{
+		std::vector<repack_item> items = resolve_sources(layout,
+			std::make_shared<input_file>(filename));
+		stream::file out(tempName, true);
+		try {
+			repack(items, out, pool);
+		} catch (...) {
+			out.remove();
+			throw;
+		}
+		copy_positions(layout, items);
+	}
+	replace_file(tempName, filename);
+	return false;
+}
+
+} // namespace stream
+} // namespace camoto
@@ -0,0 +1,298 @@
+/**
+ * @file  stats.cpp
+ * @brief Optional counters showing how streams and filters are used.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <set>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+#ifdef __GNUC__
+#include <cxxabi.h>
+#endif
+#include <camoto/stats.hpp>
+
+namespace camoto {
+namespace stats {
+
+const char *name(stream_type t)
+{
+	switch (t) {
+		case stream_type::file: return "file";
+		case stream_type::sub: return "sub";
+		case stream_type::seg: return "seg";
+		case stream_type::filtered: return "filtered";
+		case stream_type::string: return "string";
+	}
+	return "unknown";
+}
+
+#ifndef CAMOTO_STATS
+
+totals snapshot()
+{
+	totals t = totals();
+	t.enabled = false;
+	return t;
+}
+
+#else // CAMOTO_STATS
+
+/// Number of different filter classes that get their own counters.
+/**
+ * Any more than this are all added to the last one, called "other".
+ */
+#define MAX_FILTER_TYPES 64
+
+/// Fields in each stream's counters.
+enum {
+	S_READS, S_WRITES, S_BYTES_READ, S_BYTES_WRITTEN, S_SEEKS, NUM_STREAM_FIELDS
+};
+
+/// Fields in each filter's counters.
+enum {
+	F_CALLS, F_BYTES_IN, F_BYTES_OUT, F_NANOSECONDS, NUM_FILTER_FIELDS
+};
+
+typedef std::atomic<uint64_t> counter;
+
+/// Counters belonging to a single thread.
+/**
+ * Only the owning thread ever changes these, so it can add to them with a
+ * plain load and store rather than a locked instruction.  The atomic type only
+ * makes sure snapshot() sees each value whole.
+ */
+struct thread_block {
+	counter streams[NUM_STREAM_TYPES][NUM_STREAM_FIELDS];
+	counter filters[MAX_FILTER_TYPES][NUM_FILTER_FIELDS];
+	counter populates;
+	counter commits;
+
+	/// Filter class to index in filters, only used by the owning thread.
+	std::unordered_map<std::type_index, unsigned int> filterIndex;
+
+	thread_block()
+	{
+		for (auto& s : this->streams) for (auto& c : s) c.store(0);
+		for (auto& f : this->filters) for (auto& c : f) c.store(0);
+		this->populates.store(0);
+		this->commits.store(0);
+	}
+};
+
+/// Everything shared between threads.
+struct registry {
+	std::mutex lock;                   ///< Protects the members below
+	std::set<thread_block *> live;     ///< Blocks of running threads
+	totals retired;                    ///< Counts from threads that have exited
+	std::vector<std::string> filterNames; ///< Class name for each filter index
+	std::unordered_map<std::type_index, unsigned int> filterIndex;
+
+	registry()
+		:	retired()
+	{
+	}
+};
+
+/// Shared state, which is never destroyed so threads can exit in any order.
+static registry& reg()
+{
+	static registry *r = new registry();
+	return *r;
+}
+
+/// Readable name of a class.
+static std::string className(const std::type_info& type)
+{
+#ifdef __GNUC__
+	int status;
+	char *n = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+	if (n) {
+		std::string s(n);
+		free(n);
+		return s;
+	}
+#endif
+	// MSVC names are already readable, apart from a "class " prefix
+	std::string s(type.name());
+	if (s.compare(0, 6, "class ") == 0) s.erase(0, 6);
+	return s;
+}
+
+/// Add the counters in a block to a set of totals.
+static void add(totals *t, const thread_block& b)
+{
+	for (unsigned int i = 0; i < NUM_STREAM_TYPES; i++) {
+		auto& s = t->streams[i];
+		auto& c = b.streams[i];
+		s.reads += c[S_READS].load(std::memory_order_relaxed);
+		s.writes += c[S_WRITES].load(std::memory_order_relaxed);
+		s.bytesRead += c[S_BYTES_READ].load(std::memory_order_relaxed);
+		s.bytesWritten += c[S_BYTES_WRITTEN].load(std::memory_order_relaxed);
+		s.seeks += c[S_SEEKS].load(std::memory_order_relaxed);
+	}
+	auto& names = reg().filterNames;
+	for (unsigned int i = 0; i < names.size(); i++) {
+		auto& c = b.filters[i];
+		uint64_t calls = c[F_CALLS].load(std::memory_order_relaxed);
+		if (calls == 0) continue;
+		auto& f = t->filters[names[i]];
+		f.calls += calls;
+		f.bytesIn += c[F_BYTES_IN].load(std::memory_order_relaxed);
+		f.bytesOut += c[F_BYTES_OUT].load(std::memory_order_relaxed);
+		f.nanoseconds += c[F_NANOSECONDS].load(std::memory_order_relaxed);
+	}
+	t->populates += b.populates.load(std::memory_order_relaxed);
+	t->commits += b.commits.load(std::memory_order_relaxed);
+	return;
+}
+
+/// Registers a thread's counters on first use, and retires them on exit.
+struct thread_owner {
+	thread_block *block;
+
+	thread_owner()
+		:	block(new thread_block())
+	{
+		registry& r = reg();
+		std::lock_guard<std::mutex> guard(r.lock);
+		r.live.insert(this->block);
+	}
+
+	~thread_owner()
+	{
+		registry& r = reg();
+		{
+			std::lock_guard<std::mutex> guard(r.lock);
+			add(&r.retired, *this->block);
+			r.live.erase(this->block);
+		}
+		delete this->block;
+	}
+};
+
+/// This thread's counters.
+static thread_block& local()
+{
+	static thread_local thread_owner owner;
+	return *owner.block;
+}
+
+/// Add to a counter only ever changed by the current thread.
+static inline void bump(counter& c, uint64_t n)
+{
+	c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	return;
+}
+
+void count_read(stream_type t, uint64_t len)
+{
+	auto& c = local().streams[(unsigned int)t];
+	bump(c[S_READS], 1);
+	bump(c[S_BYTES_READ], len);
+	return;
+}
+
+void count_write(stream_type t, uint64_t len)
+{
+	auto& c = local().streams[(unsigned int)t];
+	bump(c[S_WRITES], 1);
+	bump(c[S_BYTES_WRITTEN], len);
+	return;
+}
+
+void count_seek(stream_type t)
+{
+	bump(local().streams[(unsigned int)t][S_SEEKS], 1);
+	return;
+}
+
+void count_populate()
+{
+	bump(local().populates, 1);
+	return;
+}
+
+void count_commit()
+{
+	bump(local().commits, 1);
+	return;
+}
+
+void count_transform(const std::type_info& type, uint64_t lenIn,
+	uint64_t lenOut, uint64_t ns)
+{
+	thread_block& b = local();
+	unsigned int index;
+	auto it = b.filterIndex.find(type);
+	if (it != b.filterIndex.end()) {
+		index = it->second;
+	} else {
+		// First time this thread has seen this filter, look up or assign its
+		// index in the shared list.
+		registry& r = reg();
+		std::lock_guard<std::mutex> guard(r.lock);
+		auto shared = r.filterIndex.find(type);
+		if (shared != r.filterIndex.end()) {
+			index = shared->second;
+		} else {
+			if (r.filterNames.size() < MAX_FILTER_TYPES - 1) {
+				index = r.filterNames.size();
+				r.filterNames.push_back(className(type));
+			} else {
+				index = MAX_FILTER_TYPES - 1;
+				if (r.filterNames.size() < MAX_FILTER_TYPES) {
+					r.filterNames.push_back("other");
+				}
+			}
+			r.filterIndex[type] = index;
+		}
+		b.filterIndex[type] = index;
+	}
+	auto& c = b.filters[index];
+	bump(c[F_CALLS], 1);
+	bump(c[F_BYTES_IN], lenIn);
+	bump(c[F_BYTES_OUT], lenOut);
+	bump(c[F_NANOSECONDS], ns);
+	return;
+}
+
+uint64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+totals snapshot()
+{
+	registry& r = reg();
+	std::lock_guard<std::mutex> guard(r.lock);
+	totals t = r.retired;
+	for (auto b : r.live) add(&t, *b);
+	t.enabled = true;
+	return t;
+}
+
+#endif // CAMOTO_STATS
+
+} // namespace stats
+} // namespace camoto
@@ -18,8 +18,17 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
+#include <vector>
 #include <camoto/stream.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/thread_pool.hpp>
+
+/// Number of threads running async_read_at() requests for streams that can't
+/// do it any other way.  These mostly sit waiting for I/O, so there are more of
+/// them than there are CPU cores.
+#define ASYNC_THREADS 16
 
 namespace camoto {
 namespace stream {
@@ -80,6 +89,121 @@ std::string input::read(stream::len len)
 	return d;
 }
 
+stream::len input::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	std::lock_guard<std::mutex> guard(this->lock_at);
+	stream::pos orig = this->tellg();
+	try {
+		this->seekg(pos, stream::start);
+	} catch (const seek_error&) {
+		return 0; // past EOF
+	}
+	stream::len r;
+	try {
+		r = this->try_read(buffer, len);
+	} catch (...) {
+		this->seekg(orig, stream::start);
+		throw;
+	}
+	this->seekg(orig, stream::start);
+	return r;
+}
+
+/// Threads shared by every default async_read_at().
+static thread_pool& async_pool()
+{
+	static thread_pool pool(ASYNC_THREADS);
+	return pool;
+}
+
+std::future<stream::len> input::async_read_at(stream::pos pos,
+	uint8_t *buffer, stream::len len)
+{
+	// The task has to be copyable, so the promise is shared
+	auto done = std::make_shared<std::promise<stream::len>>();
+	std::future<stream::len> result = done->get_future();
+	async_pool().submit([this, pos, buffer, len, done](unsigned int) {
+		try {
+			stream::len total = 0;
+			while (total < len) {
+				stream::len r = this->try_read_at(pos + total, buffer + total,
+					len - total);
+				if (r == 0) break;
+				total += r;
+			}
+			done->set_value(total);
+		} catch (...) {
+			done->set_exception(std::current_exception());
+		}
+	});
+	return result;
+}
+
+const uint8_t *input::view(stream::pos pos, stream::len len, stream::len *got,
+	std::string& scratch)
+{
+	stream::pos orig = this->tellg();
+	this->seekg(pos, stream::start);
+	scratch.resize(len);
+	stream::len total = 0;
+	try {
+		while (total < len) {
+			stream::len r = this->try_read(
+				(uint8_t *)&scratch[total], len - total);
+			if (r == 0) break;
+			total += r;
+		}
+	} catch (...) {
+		this->seekg(orig, stream::start);
+		throw;
+	}
+	this->seekg(orig, stream::start);
+	*got = total;
+	return (const uint8_t *)scratch.data();
+}
+
+bool input::cheap_view() const
+{
+	return false;
+}
+
+void input::hint(access_pattern pattern)
+{
+	return;
+}
+
+stream::len input::size_hint() const
+{
+	try {
+		return this->size();
+	} catch (const stream::error&) {
+		// Pipes and other streams that can't seek don't know their size
+		return 0;
+	}
+}
+
+bool input::identify(source_id *id) const
+{
+	return false;
+}
+
+stream::len output::try_write_at(stream::pos pos, const uint8_t *buffer,
+	stream::len len)
+{
+	stream::pos orig = this->tellp();
+	this->seekp(pos, stream::start);
+	stream::len w;
+	try {
+		w = this->try_write(buffer, len);
+	} catch (...) {
+		this->seekp(orig, stream::start);
+		throw;
+	}
+	this->seekp(orig, stream::start);
+	return w;
+}
+
 void output::write(const uint8_t *buffer, stream::len len)
 {
 	stream::len w = this->try_write(buffer, len);
@@ -114,13 +238,37 @@ void output::truncate_here()
 	return;
 }
 
+void output::reserve(stream::len len)
+{
+	return;
+}
+
 void copy(output& dest, input& src)
 {
-	uint8_t buffer[BUFFER_SIZE];
+	std::vector<uint8_t> buffer(COPY_BUFFER_SIZE);
+	copy(dest, src, buffer.data(), buffer.size());
+	return;
+}
+
+void copy(output& dest, input& src, uint8_t *buffer, stream::len lenBuffer)
+{
+	assert(lenBuffer > 0);
+	try {
+		// Let the destination allocate space for all the data in one go
+		stream::len srcSize = src.size_hint();
+		if (srcSize) {
+			stream::pos srcPos = src.tellg();
+			if (srcSize > srcPos) dest.reserve(dest.tellp() + (srcSize - srcPos));
+		}
+	} catch (const stream::error&) {
+		// Not knowing where the streams are up to isn't fatal either
+	}
+	if (copy_file(dest, src, buffer, lenBuffer)) return;
+
 	stream::len total_written = 0;
 	stream::len r;
 	do {
-		r = src.try_read(buffer, sizeof(buffer));
+		r = src.try_read(buffer, lenBuffer);
 		if (r == 0) break;
 		stream::len w = dest.try_write(buffer, r);
 		total_written += w;
@@ -128,15 +276,28 @@ void copy(output& dest, input& src)
 			// Did not write the full buffer
 			throw incomplete_write(total_written);
 		}
-	} while (r == sizeof(buffer));
+	} while (r == lenBuffer);
 	return;
 }
 
 void move(inout& data, pos from, pos to, len len)
+{
+	if ((from == to) || (len == 0)) return; // job done, that was easy
+
+	std::vector<uint8_t> buffer(std::min<stream::len>(len, COPY_BUFFER_SIZE));
+	move(data, from, to, len, buffer.data(), buffer.size());
+	return;
+}
+
+void move(inout& data, pos from, pos to, len len, uint8_t *buffer,
+	stream::len lenBuffer)
 {
 	if (from == to) return; // job done, that was easy
+	assert(lenBuffer > 0);
+	// The destination may be in a sparse part of the file after a truncate()
+	if (to > from) data.reserve(to + len);
+	if (move_file(data, from, to, len, buffer, lenBuffer)) return;
 
-	uint8_t buffer[BUFFER_SIZE];
 	stream::len r, w, total_written = 0;
 	stream::len szNext;
 
@@ -159,26 +320,17 @@ void move(inout& data, pos from, pos to, len len)
 		// and work towards the last block.
 		do {
 			// Figure out how much to read next (a full block or the last partial one)
-			if (BUFFER_SIZE <= len) {
-				szNext = BUFFER_SIZE;
+			if (lenBuffer <= len) {
+				szNext = lenBuffer;
 			} else {
 				szNext = len;
 			}
 
-			// Despite having separate read and write pointers, moving one affects
-			// the other so we have to keep seeking all the time.
+			r = data.try_read_at(from, buffer, szNext);
 			try {
-				data.seekg(from, stream::start);
-				r = data.try_read(buffer, szNext);
+				w = data.try_write_at(to, buffer, r);
 			} catch (seek_error& e) {
-				throw read_error(e.get_message());
-			}
-
-			try {
-				data.seekp(to, stream::start);
-				w = data.try_write(buffer, r);
-			} catch (seek_error& e) {
-				throw read_error(e.get_message());
+				throw write_error(e.get_message());
 			}
 
 			from += r; to += w;
@@ -188,12 +340,12 @@ void move(inout& data, pos from, pos to, len len)
 			if (r != w) {
 				throw incomplete_write(total_written);
 			}
-		} while ((r) && (szNext == BUFFER_SIZE));
+		} while ((r) && (szNext == lenBuffer));
 	} else {
 		// Moving data forwards towards the end of the stream, start at the end
 		// and work back towards the first block.
 
-		szNext = BUFFER_SIZE;
+		szNext = lenBuffer;
 /*
 		// Check to see if we'll be moving data out past the end of the stream
 		if (size < toEnd) {
@@ -212,27 +364,20 @@ void move(inout& data, pos from, pos to, len len)
 */
 		do {
 			if (
-				(fromEnd < BUFFER_SIZE)
-				|| (fromEnd - BUFFER_SIZE < from)
+				(fromEnd < lenBuffer)
+				|| (fromEnd - lenBuffer < from)
 			) {
 				szNext = fromEnd - from;
 				fromEnd = from;
 				toEnd = to;
 			} else {
-				fromEnd -= BUFFER_SIZE;
-				toEnd -= BUFFER_SIZE;
+				fromEnd -= lenBuffer;
+				toEnd -= lenBuffer;
 			}
 
+			r = data.try_read_at(fromEnd, buffer, szNext);
 			try {
-				data.seekg(fromEnd, stream::start);
-				r = data.try_read(buffer, szNext);
-			} catch (seek_error& e) {
-				throw read_error(e.get_message());
-			}
-
-			try {
-				data.seekp(toEnd, stream::start);
-				w = data.try_write(buffer, r);
+				w = data.try_write_at(toEnd, buffer, r);
 			} catch (seek_error& e) {
 				throw write_error(e.get_message());
 			}
@@ -247,5 +392,85 @@ void move(inout& data, pos from, pos to, len len)
 	return;
 }
 
+std::future<stream::len> ready_read(stream::len len)
+{
+	std::promise<stream::len> p;
+	p.set_value(len);
+	return p.get_future();
+}
+
+/// Read as much as possible at the given offset, stopping only at EOF.
+static stream::len read_fully_at(input& src, stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	stream::len total = 0;
+	while (total < len) {
+		stream::len r = src.try_read_at(pos + total, buffer + total, len - total);
+		if (r == 0) break;
+		total += r;
+	}
+	return total;
+}
+
+void read_ranges(input& src, const read_range *ranges, std::size_t count,
+	fn_range_data sink, stream::len maxGap, stream::len maxRead)
+{
+	assert(maxRead > 0);
+
+	std::vector<std::size_t> order;
+	order.reserve(count);
+	for (std::size_t i = 0; i < count; i++) {
+		if (ranges[i].len) order.push_back(i);
+	}
+	std::stable_sort(order.begin(), order.end(),
+		[ranges](std::size_t a, std::size_t b) {
+			return ranges[a].pos < ranges[b].pos;
+		});
+
+	std::vector<uint8_t> buffer;
+	std::size_t i = 0;
+	while (i < order.size()) {
+		const read_range& first = ranges[order[i]];
+		stream::pos start = first.pos;
+		stream::pos end = first.pos + first.len;
+
+		if (first.len > maxRead) {
+			// Too big to read at once, so hand it over a piece at a time
+			buffer.resize(maxRead);
+			for (stream::len off = 0; off < first.len; ) {
+				stream::len want = std::min(maxRead, first.len - off);
+				stream::len r = read_fully_at(src, start + off, buffer.data(), want);
+				if (r) sink(order[i], off, buffer.data(), r);
+				if (r < want) break; // EOF
+				off += r;
+			}
+			i++;
+			continue;
+		}
+
+		// Gather up the following ranges while they're close enough
+		std::size_t j = i + 1;
+		while (j < order.size()) {
+			const read_range& next = ranges[order[j]];
+			if (next.pos > end + maxGap) break;
+			stream::pos nextEnd = std::max(end, next.pos + next.len);
+			if (nextEnd - start > maxRead) break;
+			end = nextEnd;
+			j++;
+		}
+
+		buffer.resize(end - start);
+		stream::len r = read_fully_at(src, start, buffer.data(), end - start);
+		stream::pos got = start + r;
+		for (; i < j; i++) {
+			const read_range& rg = ranges[order[i]];
+			if (rg.pos >= got) continue; // past EOF
+			sink(order[i], 0, &buffer[rg.pos - start],
+				std::min(rg.len, got - rg.pos));
+		}
+	}
+	return;
+}
+
 } // namespace stream
 } // namespace camoto
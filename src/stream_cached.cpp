@@ -0,0 +1,465 @@
+/**
+ * @file   stream_cached.cpp
+ * @brief  Stream implementation keeping a block cache in front of another
+ *         stream.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+#include <camoto/stream_cached.hpp>
+#include <camoto/util.hpp> // createString
+
+namespace camoto {
+namespace stream {
+
+cached_core::cached_core()
+	:	lenBlock(0),
+		readAhead(1),
+		hand(0),
+		last(0),
+		nextSeq(0),
+		offset(0),
+		length(0),
+		lenParent(0)
+{
+}
+
+cached_core::~cached_core()
+{
+}
+
+void cached_core::init(std::shared_ptr<input> in_parent,
+	std::shared_ptr<output> out_parent, stream::len lenBlock,
+	unsigned int numBlocks, unsigned int readAhead)
+{
+	if (lenBlock == 0) lenBlock = CACHE_BLOCK_SIZE;
+	if (numBlocks < 2) numBlocks = 2;
+	// Always leave one slot free of a read-ahead batch, so there is somewhere
+	// to put the next block without evicting the one just read.
+	if (readAhead < 1) readAhead = 1;
+	if (readAhead > numBlocks - 1) readAhead = numBlocks - 1;
+
+	this->in_parent = in_parent;
+	this->out_parent = out_parent;
+	this->lenBlock = lenBlock;
+	this->readAhead = readAhead;
+	this->slots.resize(numBlocks);
+	for (auto& b : this->slots) {
+		b.index = NO_BLOCK;
+		b.len = 0;
+		b.dirty = false;
+		b.used = false;
+		b.pinned = false;
+	}
+	this->lookup.reserve(numBlocks);
+	this->lenParent = this->length = this->in_parent->size();
+	return;
+}
+
+void cached_core::seek(stream::delta off, seek_from from)
+{
+	stream::pos baseOffset;
+	switch (from) {
+		case cur:
+			baseOffset = this->offset;
+			break;
+		case end:
+			baseOffset = this->length;
+			break;
+		default:
+			baseOffset = 0;
+			break;
+	}
+	if ((off < 0) && (baseOffset < (unsigned)(off * -1))) {
+		throw seek_error("Cannot seek back past start of stream");
+	}
+	baseOffset += off;
+	if (baseOffset > this->length) {
+		throw seek_error(createString("Cannot seek beyond end of stream (offset "
+			<< baseOffset << " > length " << this->length << ")"));
+	}
+	this->offset = baseOffset;
+	return;
+}
+
+stream::len cached_core::read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	if (pos >= this->length) return 0;
+	len = std::min(len, this->length - pos);
+
+	stream::len done = 0;
+	while (done < len) {
+		stream::pos index = pos / this->lenBlock;
+		stream::len within = pos % this->lenBlock;
+		block& b = this->get(index, true);
+		if (within >= b.len) break; // parent was shorter than expected
+		stream::len amt = std::min(len - done, b.len - within);
+		memcpy(buffer + done, b.data.get() + within, amt);
+		done += amt;
+		pos += amt;
+	}
+	return done;
+}
+
+stream::len cached_core::write_at(stream::pos pos, const uint8_t *buffer,
+	stream::len len)
+{
+	if (pos > this->length) {
+		throw seek_error(createString("Cannot write beyond end of stream (offset "
+			<< pos << " > length " << this->length << ")"));
+	}
+
+	stream::len done = 0;
+	while (done < len) {
+		stream::pos index = pos / this->lenBlock;
+		stream::len within = pos % this->lenBlock;
+		stream::pos start = pos - within;
+		stream::len amt = std::min(len - done, this->lenBlock - within);
+		// No need to read the block first if every byte of it the parent has
+		// is about to be overwritten.
+		bool fill = !(
+			(within == 0)
+			&& ((amt == this->lenBlock) || (start + amt >= this->lenParent))
+		);
+		block& b = this->get(index, fill);
+		memcpy(b.data.get() + within, buffer + done, amt);
+		if (within + amt > b.len) b.len = within + amt;
+		b.dirty = true;
+		done += amt;
+		pos += amt;
+		if (pos > this->length) this->length = pos;
+	}
+	return done;
+}
+
+cached_core::block& cached_core::get(stream::pos index, bool fill)
+{
+	// Repeated small reads usually hit the same block as last time.
+	block& prev = this->slots[this->last];
+	if (prev.index == index) {
+		prev.used = true;
+		return prev;
+	}
+
+	auto found = this->lookup.find(index);
+	if (found != this->lookup.end()) {
+		this->last = found->second;
+		block& b = this->slots[this->last];
+		b.used = true;
+		return b;
+	}
+
+	stream::pos start = index * this->lenBlock;
+	if (!fill || (start >= this->lenParent)) {
+		// Block has no data in the parent, or it's all about to be replaced.
+		std::size_t s = this->evict();
+		block& b = this->slots[s];
+		b.index = index;
+		b.len = 0;
+		b.dirty = false;
+		b.used = true;
+		this->lookup[index] = s;
+		this->last = s;
+		return b;
+	}
+
+	// Work out how many blocks to read.  If this block follows on from the last
+	// one read from the parent then the data is probably being read in order,
+	// so read the next few blocks in the same request.
+	unsigned int count = 1;
+	if (index == this->nextSeq) {
+		while (
+			(count < this->readAhead)
+			&& ((index + count) * this->lenBlock < this->lenParent)
+			&& (this->lookup.find(index + count) == this->lookup.end())
+		) {
+			count++;
+		}
+	}
+	stream::len lenRead = std::min((stream::len)count * this->lenBlock,
+		this->lenParent - start);
+	uint8_t *dest;
+	if (count > 1) {
+		this->scratch.resize(lenRead);
+		dest = this->scratch.data();
+	} else {
+		// Single block, read it straight into place.
+		std::size_t s = this->evict();
+		if (!this->slots[s].data) {
+			this->slots[s].data.reset(new uint8_t[this->lenBlock]);
+		}
+		this->last = s;
+		dest = this->slots[s].data.get();
+	}
+
+	stream::len got = 0;
+	while (got < lenRead) {
+		stream::len r = this->in_parent->try_read_at(start + got, dest + got,
+			lenRead - got);
+		if (r == 0) break;
+		got += r;
+	}
+
+	if (count == 1) {
+		block& b = this->slots[this->last];
+		b.index = index;
+		b.len = got;
+		b.dirty = false;
+		b.used = true;
+		this->lookup[index] = this->last;
+	} else {
+		// Pin each block as it's added so a later one can't evict it.
+		std::vector<std::size_t> added;
+		added.reserve(count);
+		for (unsigned int i = 0; i < count; i++) {
+			stream::len off = (stream::len)i * this->lenBlock;
+			if ((i > 0) && (off >= got)) break;
+			std::size_t s = this->evict();
+			block& b = this->slots[s];
+			b.index = index + i;
+			b.len = (off < got) ? std::min(this->lenBlock, got - off) : 0;
+			memcpy(b.data.get(), dest + off, b.len);
+			b.dirty = false;
+			b.used = true;
+			b.pinned = true;
+			this->lookup[b.index] = s;
+			added.push_back(s);
+		}
+		for (auto s : added) this->slots[s].pinned = false;
+		this->last = added[0];
+	}
+	this->nextSeq = index + count;
+	return this->slots[this->last];
+}
+
+std::size_t cached_core::evict()
+{
+	std::size_t num = this->slots.size();
+	for (;;) {
+		std::size_t s = this->hand;
+		this->hand = (this->hand + 1) % num;
+		block& b = this->slots[s];
+		if (b.pinned) continue;
+		if (b.index != NO_BLOCK) {
+			if (b.used) {
+				// Give it a second chance
+				b.used = false;
+				continue;
+			}
+			this->write_back(b);
+			this->lookup.erase(b.index);
+			b.index = NO_BLOCK;
+		}
+		if (!b.data) b.data.reset(new uint8_t[this->lenBlock]);
+		return s;
+	}
+}
+
+void cached_core::write_back(block& b)
+{
+	if (!b.dirty) return;
+	stream::pos start = b.index * this->lenBlock;
+	if (start > this->lenParent) {
+		// The blocks in between haven't been written yet, and the parent can't
+		// be extended past its end, so write everything out in order.
+		this->write_back_all();
+		return;
+	}
+	stream::len done = 0;
+	while (done < b.len) {
+		stream::len w = this->out_parent->try_write_at(start + done,
+			b.data.get() + done, b.len - done);
+		if (w == 0) {
+			throw incomplete_write(done);
+		}
+		done += w;
+	}
+	b.dirty = false;
+	if (start + b.len > this->lenParent) this->lenParent = start + b.len;
+	return;
+}
+
+void cached_core::write_back_all()
+{
+	std::vector<block *> dirty;
+	for (auto& b : this->slots) {
+		if ((b.index != NO_BLOCK) && b.dirty) dirty.push_back(&b);
+	}
+	std::sort(dirty.begin(), dirty.end(), [](const block *a, const block *b) {
+		return a->index < b->index;
+	});
+	for (auto b : dirty) this->write_back(*b);
+	return;
+}
+
+void cached_core::clear()
+{
+	this->write_back_all();
+	for (auto& b : this->slots) {
+		b.index = NO_BLOCK;
+		b.len = 0;
+		b.used = false;
+	}
+	this->lookup.clear();
+	this->nextSeq = 0;
+	return;
+}
+
+
+input_cached::input_cached()
+{
+}
+
+input_cached::input_cached(std::shared_ptr<input> parent,
+	stream::len lenBlock, unsigned int numBlocks, unsigned int readAhead)
+{
+	this->init(parent, nullptr, lenBlock, numBlocks, readAhead);
+}
+
+input_cached::~input_cached()
+{
+}
+
+stream::len input_cached::try_read(uint8_t *buffer, stream::len len)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	stream::len r = this->read_at(this->offset, buffer, len);
+	this->offset += r;
+	return r;
+}
+
+stream::len input_cached::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->read_at(pos, buffer, len);
+}
+
+std::future<stream::len> input_cached::async_read_at(stream::pos pos,
+	uint8_t *buffer, stream::len len)
+{
+	std::unique_lock<std::mutex> guard(this->lock);
+	if (pos >= this->length) return ready_read(0); // EOF
+	if (len > this->length - pos) len = this->length - pos;
+	if (len == 0) return ready_read(0);
+
+	bool all = true, dirty = false;
+	stream::pos last = (pos + len - 1) / this->lenBlock;
+	for (stream::pos i = pos / this->lenBlock; i <= last; i++) {
+		auto found = this->lookup.find(i);
+		if (found == this->lookup.end()) all = false;
+		else if (this->slots[found->second].dirty) dirty = true;
+	}
+	if (all || dirty || (pos + len > this->lenParent)) {
+		// The cache has the data, or the parent doesn't have all of it
+		return ready_read(this->read_at(pos, buffer, len));
+	}
+	guard.unlock();
+	return this->in_parent->async_read_at(pos, buffer, len);
+}
+
+void input_cached::seekg(stream::delta off, seek_from from)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->seek(off, from);
+	return;
+}
+
+stream::pos input_cached::tellg() const
+{
+	return this->offset;
+}
+
+stream::len input_cached::size() const
+{
+	return this->length;
+}
+
+
+cached::cached(std::shared_ptr<inout> parent, stream::len lenBlock,
+	unsigned int numBlocks, unsigned int readAhead)
+{
+	this->init(parent, parent, lenBlock, numBlocks, readAhead);
+}
+
+cached::~cached()
+{
+	for (auto& b : this->slots) {
+		if ((b.index != NO_BLOCK) && b.dirty) {
+			std::cerr << "Warning: stream::cached destroyed without flushing changes first!\n";
+			break;
+		}
+	}
+}
+
+stream::len cached::try_write(const uint8_t *buffer, stream::len len)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	stream::len w = this->write_at(this->offset, buffer, len);
+	this->offset += w;
+	return w;
+}
+
+stream::len cached::try_write_at(stream::pos pos, const uint8_t *buffer,
+	stream::len len)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->write_at(pos, buffer, len);
+}
+
+void cached::seekp(stream::delta off, seek_from from)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->seek(off, from);
+	return;
+}
+
+stream::pos cached::tellp() const
+{
+	return this->offset;
+}
+
+void cached::truncate(stream::pos size)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (size == this->length) {
+		this->offset = size;
+		return;
+	}
+	// Write everything out first so the parent can extend the data itself if
+	// needed, then start afresh since some blocks may now be partially or
+	// entirely beyond the end.
+	this->clear();
+	this->out_parent->truncate(size);
+	this->lenParent = this->length = size;
+	this->offset = size;
+	return;
+}
+
+void cached::flush()
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->write_back_all();
+	this->out_parent->flush();
+	return;
+}
+
+} // namespace stream
+} // namespace camoto
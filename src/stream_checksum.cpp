@@ -0,0 +1,97 @@
+/**
+ * @file  stream_checksum.cpp
+ * @brief Stream wrapper that checksums data as it is read.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <camoto/stream_checksum.hpp>
+
+namespace camoto {
+namespace stream {
+
+input_checksum::input_checksum(std::shared_ptr<input> parent,
+	checksum_type type)
+	:	in_parent(parent),
+		sum(type),
+		lenSum(0)
+{
+}
+
+stream::len input_checksum::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::pos pos = this->in_parent->tellg();
+	stream::len r = this->in_parent->try_read(buffer, len);
+	this->add(pos, buffer, r);
+	return r;
+}
+
+stream::len input_checksum::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	stream::len r = this->in_parent->try_read_at(pos, buffer, len);
+	this->add(pos, buffer, r);
+	return r;
+}
+
+void input_checksum::seekg(stream::delta off, seek_from from)
+{
+	this->in_parent->seekg(off, from);
+	return;
+}
+
+stream::pos input_checksum::tellg() const
+{
+	return this->in_parent->tellg();
+}
+
+stream::len input_checksum::size() const
+{
+	return this->in_parent->size();
+}
+
+uint32_t input_checksum::value() const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->sum.value();
+}
+
+stream::len input_checksum::length() const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->lenSum;
+}
+
+bool input_checksum::complete() const
+{
+	return this->length() == this->in_parent->size();
+}
+
+void input_checksum::add(stream::pos pos, const uint8_t *buffer,
+	stream::len len)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	// Only data that starts at or before the end of the checksummed part and
+	// carries on past it is new.
+	if ((pos > this->lenSum) || (pos + len <= this->lenSum)) return;
+	stream::len skip = this->lenSum - pos;
+	this->sum.update(buffer + skip, len - skip);
+	this->lenSum += len - skip;
+	return;
+}
+
+} // namespace stream
+} // namespace camoto
@@ -18,13 +18,34 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <iostream>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #ifndef _WIN32
 #include <unistd.h>
 #else
 #include <io.h>
+#include <windows.h>
 #endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define CAMOTO_IO_URING
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+#include <camoto/stats.hpp>
 #include <camoto/stream_file.hpp>
 #include <camoto/util.hpp> // createString
 
@@ -39,7 +60,46 @@ char* handle_strerror_r(char* result, char*) {
 	return result;
 }
 
-inline std::string strerror_str(int errno2)
+#ifdef _WIN32
+#define unlink(x) _unlink(x)
+#define fileno _fileno
+#define O_BINARY_FLAG _O_BINARY
+#define fsync _commit
+typedef long long ssize_t;
+
+// Windows has no positional I/O on file descriptors, so seek first.  This
+// means try_read_at() is not safe to call from multiple threads here.
+static ssize_t pread(int fd, void *buf, size_t len, long long pos)
+{
+	if (_lseeki64(fd, pos, SEEK_SET) < 0) return -1;
+	return _read(fd, buf, (unsigned int)std::min<size_t>(len, 1 << 30));
+}
+
+static ssize_t pwrite(int fd, const void *buf, size_t len, long long pos)
+{
+	if (_lseeki64(fd, pos, SEEK_SET) < 0) return -1;
+	return _write(fd, buf, (unsigned int)std::min<size_t>(len, 1 << 30));
+}
+#else
+#define O_BINARY_FLAG 0
+#endif
+
+/// Alignment of the file buffer.
+#define FILE_BUFFER_ALIGN 4096
+
+/// Reads in a row that must follow on from each other to count as sequential.
+#define SEQUENTIAL_READS 4
+
+/// How far ahead of a sequential read to ask the kernel to read.
+#define FILE_READAHEAD (1024 * 1024)
+
+/// Number of submission queue entries in the io_uring used for async reads.
+#define RING_ENTRIES 256
+
+namespace camoto {
+namespace stream {
+
+std::string strerror_str(int errno2)
 {
 	char buf[256];
 	buf[0] = 0;
@@ -64,57 +124,609 @@ inline std::string strerror_str(int errno2)
 	return std::string(pbuf) + ".";
 }
 
-#ifdef _WIN32
-#define unlink(x) _unlink(x)
-#define fileno _fileno
+#ifdef CAMOTO_IO_URING
+/// Reads files in the background with io_uring.
+/**
+ * One ring is shared by every input_file.  Requests are submitted straight
+ * away by the calling thread, and a single thread waits for them to complete
+ * and fills in their promises.  If the kernel doesn't support io_uring (or it
+ * has been disabled) get() returns NULL and the thread pool is used instead.
+ */
+class io_ring
+{
+	public:
+		/// The shared ring, or NULL if io_uring isn't available.
+		static io_ring *get()
+		{
+			static io_ring ring;
+			return ring.fd >= 0 ? &ring : nullptr;
+		}
+
+		/// Start reading a file.
+		/**
+		 * @return false if the ring is too busy and the caller should read the
+		 *   data some other way.
+		 */
+		bool read(int fd, stream::pos pos, uint8_t *buffer, stream::len len,
+			std::promise<stream::len> *done)
+		{
+			if (this->inflight.fetch_add(1) >= this->maxInflight) {
+				// Not enough room to be sure the completion won't be lost
+				this->inflight--;
+				return false;
+			}
+			request *r = new request;
+			r->fd = fd;
+			r->pos = pos;
+			r->buffer = buffer;
+			r->len = len;
+			r->total = 0;
+			r->done = std::move(*done);
+			this->submit(r);
+			return true;
+		}
+
+	private:
+		/// One read in progress.
+		struct request {
+			int fd;                          ///< File being read
+			stream::pos pos;                 ///< Offset of first byte wanted
+			uint8_t *buffer;                 ///< Where the data goes
+			stream::len len;                 ///< Number of bytes wanted
+			stream::len total;               ///< Number of bytes read so far
+			struct iovec iov;                ///< Remainder still to be read
+			std::promise<stream::len> done;  ///< Set once the read finishes
+		};
+
+		int fd;                       ///< Ring descriptor, -1 if not available
+		unsigned int maxInflight;     ///< Completion queue size
+		std::atomic<unsigned int> inflight; ///< Requests not yet finished
+		std::mutex lock;              ///< Serialises the submission queue
+		bool stopping;                ///< Set to tell the reaper to exit
+		std::thread reaper;           ///< Waits for completions
+
+		void *sqRing, *cqRing;        ///< Mapped queue memory
+		std::size_t lenSqRing, lenCqRing;
+		struct io_uring_sqe *sqes;    ///< Submission queue entries
+		std::size_t lenSqes;
+		unsigned *sqTail, *sqMask, *sqArray;
+		unsigned *cqHead, *cqTail, *cqMask;
+		struct io_uring_cqe *cqes;
+
+		io_ring()
+			:	fd(-1),
+				maxInflight(0),
+				inflight(0),
+				stopping(false)
+		{
+			struct io_uring_params p;
+			memset(&p, 0, sizeof(p));
+			int ringFd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+			if (ringFd < 0) return;
+
+			this->lenSqRing = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+			this->lenCqRing = p.cq_off.cqes
+				+ p.cq_entries * sizeof(struct io_uring_cqe);
+			bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+			if (single) {
+				this->lenSqRing = this->lenCqRing =
+					std::max(this->lenSqRing, this->lenCqRing);
+			}
+			this->sqRing = mmap(nullptr, this->lenSqRing, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+			if (this->sqRing == MAP_FAILED) {
+				::close(ringFd);
+				return;
+			}
+			if (single) {
+				this->cqRing = this->sqRing;
+			} else {
+				this->cqRing = mmap(nullptr, this->lenCqRing, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+				if (this->cqRing == MAP_FAILED) {
+					munmap(this->sqRing, this->lenSqRing);
+					::close(ringFd);
+					return;
+				}
+			}
+			this->lenSqes = p.sq_entries * sizeof(struct io_uring_sqe);
+			this->sqes = (struct io_uring_sqe *)mmap(nullptr, this->lenSqes,
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+				IORING_OFF_SQES);
+			if (this->sqes == MAP_FAILED) {
+				if (!single) munmap(this->cqRing, this->lenCqRing);
+				munmap(this->sqRing, this->lenSqRing);
+				::close(ringFd);
+				return;
+			}
+
+			uint8_t *sq = (uint8_t *)this->sqRing;
+			this->sqTail = (unsigned *)(sq + p.sq_off.tail);
+			this->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+			this->sqArray = (unsigned *)(sq + p.sq_off.array);
+			uint8_t *cq = (uint8_t *)this->cqRing;
+			this->cqHead = (unsigned *)(cq + p.cq_off.head);
+			this->cqTail = (unsigned *)(cq + p.cq_off.tail);
+			this->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+			this->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+			// Leave room for the NOP sent to stop the reaper
+			this->maxInflight = p.cq_entries - 1;
+			this->fd = ringFd;
+			this->reaper = std::thread(&io_ring::reap, this);
+		}
+
+		~io_ring()
+		{
+			if (this->fd < 0) return;
+			bool queued;
+			{
+				std::lock_guard<std::mutex> guard(this->lock);
+				this->stopping = true;
+				queued = this->queue(IORING_OP_NOP, -1, nullptr, 0, 0);
+			}
+			if (!queued) {
+				// The reaper can't be woken, so leave it and the ring alone
+				this->reaper.detach();
+				return;
+			}
+			this->reaper.join();
+			munmap(this->sqes, this->lenSqes);
+			if (this->cqRing != this->sqRing) munmap(this->cqRing, this->lenCqRing);
+			munmap(this->sqRing, this->lenSqRing);
+			::close(this->fd);
+		}
+
+		/// Add an entry to the submission queue and hand it to the kernel.
+		/**
+		 * Must be called with the lock held.
+		 *
+		 * @return false if the kernel refused the entry, in which case it has
+		 *   been taken off the queue again.
+		 */
+		bool queue(uint8_t opcode, int fd, const struct iovec *iov,
+			stream::pos pos, uint64_t userData)
+		{
+			unsigned tail = *this->sqTail;
+			unsigned index = tail & *this->sqMask;
+			struct io_uring_sqe *sqe = &this->sqes[index];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = opcode;
+			sqe->fd = fd;
+			sqe->off = pos;
+			sqe->addr = (uint64_t)(uintptr_t)iov;
+			sqe->len = iov ? 1 : 0;
+			sqe->user_data = userData;
+			this->sqArray[index] = index;
+			__atomic_store_n(this->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+			// Without SQPOLL the kernel takes the entry during this call, so the
+			// queue never fills up.
+			while (syscall(__NR_io_uring_enter, this->fd, 1, 0, 0, nullptr, 0) < 0) {
+				if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+					// Nothing was submitted, so take the entry back rather than let a
+					// later call submit it too
+					__atomic_store_n(this->sqTail, tail, __ATOMIC_RELEASE);
+					return false;
+				}
+				std::this_thread::yield();
+			}
+			return true;
+		}
+
+		/// Submit (or resubmit) the rest of a request.
+		void submit(request *r)
+		{
+			r->iov.iov_base = r->buffer + r->total;
+			r->iov.iov_len = r->len - r->total;
+			{
+				std::lock_guard<std::mutex> guard(this->lock);
+				if (this->queue(IORING_OP_READV, r->fd, &r->iov, r->pos + r->total,
+					(uint64_t)(uintptr_t)r)) return;
+			}
+
+			// The kernel wouldn't take it, so finish the read here instead of
+			// leaving the caller waiting for a completion that will never come
+			for (;;) {
+				if (r->total == r->len) {
+					r->done.set_value(r->total);
+					break;
+				}
+				ssize_t res = pread(r->fd, r->buffer + r->total, r->len - r->total,
+					r->pos + r->total);
+				if (res < 0) {
+					if (errno == EINTR) continue;
+					r->done.set_exception(std::make_exception_ptr(
+						read_error(strerror_str(errno))));
+					break;
+				}
+				if (res == 0) { // EOF
+					r->done.set_value(r->total);
+					break;
+				}
+				r->total += res;
+			}
+			delete r;
+			this->inflight--;
+			return;
+		}
+
+		/// Handle one completed read.
+		void complete(request *r, int res)
+		{
+			if ((res == -EINTR) || (res == -EAGAIN)) {
+				this->submit(r);
+				return;
+			}
+			if (res < 0) {
+				r->done.set_exception(std::make_exception_ptr(
+					read_error(strerror_str(-res))));
+			} else {
+				r->total += res;
+				if ((res > 0) && (r->total < r->len)) {
+					// Short read before EOF, carry on from there
+					this->submit(r);
+					return;
+				}
+				r->done.set_value(r->total);
+			}
+			delete r;
+			this->inflight--;
+			return;
+		}
+
+		/// Main loop for the thread waiting on completions.
+		void reap()
+		{
+			for (;;) {
+				syscall(__NR_io_uring_enter, this->fd, 0, 1, IORING_ENTER_GETEVENTS,
+					nullptr, 0);
+				unsigned head = *this->cqHead;
+				unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+				bool stop = false;
+				while (head != tail) {
+					struct io_uring_cqe *cqe = &this->cqes[head & *this->cqMask];
+					uint64_t userData = cqe->user_data;
+					int res = cqe->res;
+					head++;
+					__atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+					if (userData == 0) stop = true; // shutdown NOP
+					else this->complete((request *)(uintptr_t)userData, res);
+				}
+				if (stop) break;
+			}
+			return;
+		}
+};
+#endif // CAMOTO_IO_URING
+
+/// Read and write a whole block with positional I/O.
+/**
+ * @return Number of bytes copied, which is less than \e len only at EOF.
+ */
+static stream::len copy_block(int fdIn, stream::pos offIn, int fdOut,
+	stream::pos offOut, uint8_t *buffer, stream::len len)
+{
+	ssize_t r;
+	do {
+		r = pread(fdIn, buffer, len, offIn);
+	} while ((r < 0) && (errno == EINTR));
+	if (r < 0) throw read_error(strerror_str(errno));
+
+	ssize_t done = 0;
+	while (done < r) {
+		ssize_t w = pwrite(fdOut, buffer + done, r - done, offOut + done);
+		if (w < 0) {
+			if (errno == EINTR) continue;
+			throw write_error(strerror_str(errno));
+		}
+		done += w;
+	}
+	return r;
+}
+
+bool copy_file(output& dest, input& src, uint8_t *buffer,
+	stream::len lenBuffer)
+{
+	input_file *fsrc = dynamic_cast<input_file *>(&src);
+	output_file *fdest = dynamic_cast<output_file *>(&dest);
+	if (!fsrc || !fdest) return false;
+
+	// Pipes and terminals can't be used with positional I/O
+	if (!fsrc->seekable || !fdest->seekable) return false;
+
+	// Make sure the file descriptors see the same data as the streams
+	fsrc->flush_writes();
+	fdest->drop_buffer();
+
+	stream::pos offIn = fsrc->offset;
+	stream::pos offOut = fdest->offset;
+	stream::len lenSrc = fsrc->file_size();
+	stream::len remaining = (lenSrc > offIn) ? lenSrc - offIn : 0;
+
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 27))
+	// Let the kernel copy the data (or share the blocks, on filesystems that
+	// support it.)  If it can't, fall back to copying it ourselves.
+	while (remaining) {
+		off_t in = offIn, out = offOut;
+		ssize_t n = copy_file_range(fsrc->fd, &in, fdest->fd, &out,
+			std::min<stream::len>(remaining, 1 << 30), 0);
+		if (n <= 0) break;
+		offIn += n;
+		offOut += n;
+		remaining -= n;
+	}
 #endif
 
-namespace camoto {
-namespace stream {
+	while (remaining) {
+		stream::len n = copy_block(fsrc->fd, offIn, fdest->fd, offOut, buffer,
+			std::min(remaining, lenBuffer));
+		if (n == 0) break;
+		offIn += n;
+		offOut += n;
+		remaining -= n;
+	}
+
+	fsrc->offset = offIn;
+	fdest->offset = offOut;
+	fdest->lenDisk = std::max(fdest->lenDisk, offOut);
+	return true;
+}
+
+bool move_file(inout& data, pos from, pos to, len len, uint8_t *buffer,
+	stream::len lenBuffer)
+{
+	output_file *f = dynamic_cast<output_file *>(&data);
+	if (!f) return false;
+
+	if (!f->seekable) return false;
+	f->drop_buffer();
+
+	int fd = f->fd;
+	stream::len total_written = 0;
+	if ((from > to) || (from + len <= to)) {
+		// Moving data back towards the start of the file, or not overlapping, so
+		// start at the beginning and work towards the last block.
+		while (total_written < len) {
+			stream::len n = std::min(len - total_written, lenBuffer);
+			stream::len r = copy_block(fd, from + total_written, fd,
+				to + total_written, buffer, n);
+			total_written += r;
+			if (r < n) throw incomplete_write(total_written);
+		}
+	} else {
+		// Moving data forwards with overlap, so start at the end and work back
+		// towards the first block.
+		stream::len left = len;
+		while (left > 0) {
+			stream::len n = std::min(left, lenBuffer);
+			left -= n;
+			stream::len r = copy_block(fd, from + left, fd, to + left, buffer, n);
+			total_written += r;
+			if (r < n) throw incomplete_write(total_written);
+		}
+	}
+
+	f->lenDisk = std::max(f->lenDisk, to + len);
+	return true;
+}
 
 std::unique_ptr<input> open_stdin()
 {
 	auto f = std::unique_ptr<input_file>(new input_file());
-	f->handle = stdin;
-	f->close = false;
+	f->attach(fileno(stdin), false, FILE_BUFFER_SIZE);
 	return std::move(f);
 }
 
 std::unique_ptr<output> open_stdout()
 {
+	// Anything already printed through stdio must come out first
+	fflush(stdout);
 	auto f = std::unique_ptr<output_file>(new output_file());
-	f->handle = stdout;
-	f->close = false;
+	f->attach(fileno(stdout), false, FILE_BUFFER_SIZE);
 	return std::move(f);
 }
 
+std::unique_ptr<inout> open_temp()
+{
+#ifndef _WIN32
+	const char *dir = getenv("TMPDIR");
+	std::string path = std::string((dir && *dir) ? dir : "/tmp")
+		+ "/camoto-XXXXXX";
+	int fd = mkstemp(&path[0]);
+	if (fd < 0) throw open_error(strerror_str(errno));
+	// Nothing else can open it now, and the space is freed when fd is closed
+	unlink(path.c_str());
+#else
+	char *name = _tempnam(NULL, "camoto");
+	if (!name) throw open_error("Unable to choose a temporary filename");
+	int fd = _open(name, _O_CREAT | _O_EXCL | _O_RDWR | _O_BINARY
+		| _O_TEMPORARY, _S_IREAD | _S_IWRITE);
+	int err = errno;
+	free(name);
+	if (fd < 0) throw open_error(strerror_str(err));
+#endif
+	auto f = std::unique_ptr<file>(new file());
+	f->attach(fd, true, FILE_BUFFER_SIZE);
+	return f;
+}
+
+void replace_file(const std::string& from, const std::string& to)
+{
+#ifndef _WIN32
+	if (::rename(from.c_str(), to.c_str()) < 0) {
+		throw write_error(strerror_str(errno));
+	}
+#else
+	if (!MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+		throw write_error(createString("Unable to rename " << from << " to "
+			<< to << " (error " << GetLastError() << ")"));
+	}
+#endif
+	return;
+}
+
 file_core::file_core()
-	:	handle(NULL),
-		close(false)
+	:	fd(-1),
+		close(false),
+		seekable(false),
+		sync(false),
+		offset(0),
+		buffer(nullptr),
+		lenBuffer(0),
+		bufStart(0),
+		bufLen(0),
+		dirtyStart(0),
+		dirtyEnd(0),
+		lenDisk(0),
+		pattern(access_pattern::normal),
+		nextRead(0),
+		lenRun(0),
+		advisedEnd(0)
 {
 }
 
+void file_core::attach(int fd, bool close, stream::len lenBuffer)
+{
+	this->fd = fd;
+	this->close = close;
+
+#ifdef _WIN32
+	long long cur = _lseeki64(fd, 0, SEEK_CUR);
+#else
+	off_t cur = lseek(fd, 0, SEEK_CUR);
+#endif
+	this->seekable = (cur >= 0);
+	this->offset = this->seekable ? cur : 0;
+
+	struct stat st;
+	if ((fstat(fd, &st) == 0) && (st.st_mode & S_IFREG)) {
+		this->lenDisk = st.st_size;
+	}
+
+	if (lenBuffer) {
+		this->bufferMem.reset(new uint8_t[lenBuffer + FILE_BUFFER_ALIGN]);
+		uintptr_t p = (uintptr_t)this->bufferMem.get();
+		p = (p + FILE_BUFFER_ALIGN - 1) & ~(uintptr_t)(FILE_BUFFER_ALIGN - 1);
+		this->buffer = (uint8_t *)p;
+	}
+	this->lenBuffer = lenBuffer;
+	this->bufStart = this->offset;
+	return;
+}
+
+stream::len file_core::raw_read(stream::pos pos, uint8_t *out,
+	stream::len len) const
+{
+	stream::len done = 0;
+	while (done < len) {
+		ssize_t r;
+		if (this->seekable) {
+			r = pread(this->fd, out + done, len - done, pos + done);
+		} else {
+			r = ::read(this->fd, out + done, len - done);
+		}
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			throw read_error(strerror_str(errno));
+		}
+		if (r == 0) break; // EOF
+		done += r;
+	}
+	return done;
+}
+
+void file_core::raw_write(stream::pos pos, const uint8_t *in,
+	stream::len len)
+{
+	stream::len done = 0;
+	while (done < len) {
+		ssize_t w;
+		if (this->seekable) {
+			w = pwrite(this->fd, in + done, len - done, pos + done);
+		} else {
+			w = ::write(this->fd, in + done, len - done);
+		}
+		if (w < 0) {
+			if (errno == EINTR) continue;
+			throw write_error(strerror_str(errno));
+		}
+		done += w;
+	}
+	this->lenDisk = std::max(this->lenDisk, pos + len);
+	return;
+}
+
+void file_core::flush_writes()
+{
+	if (this->dirtyEnd > this->dirtyStart) {
+		this->raw_write(this->bufStart + this->dirtyStart,
+			this->buffer + this->dirtyStart, this->dirtyEnd - this->dirtyStart);
+		this->dirtyStart = this->dirtyEnd = 0;
+	}
+	return;
+}
+
+void file_core::drop_buffer()
+{
+	this->flush_writes();
+	this->bufStart = this->offset;
+	this->bufLen = 0;
+	return;
+}
+
 void file_core::seek(stream::delta off, seek_from from)
 {
-	int whence;
+	CAMOTO_STATS_SEEK(file);
+	stream::pos baseOffset;
 	switch (from) {
-		case cur: whence = SEEK_CUR; break;
-		case end: whence = SEEK_END; break;
-		default: whence = SEEK_SET; break;
+		case cur: baseOffset = this->offset; break;
+		case end: baseOffset = this->file_size(); break;
+		default: baseOffset = 0; break;
+	}
+	if ((off < 0) && (baseOffset < (unsigned)(off * -1))) {
+		throw seek_error("Cannot seek back past start of file");
 	}
-	if (fseek(this->handle, off, whence) < 0) {
-		throw seek_error(strerror_str(errno));
+	baseOffset += off;
+	if ((!this->seekable) && (baseOffset != this->offset)) {
+		throw seek_error(strerror_str(ESPIPE));
 	}
+	this->offset = baseOffset;
 	return;
 }
 
 stream::pos file_core::tell() const
 {
-	long p = ftell(this->handle);
-	if (p < 0) {
-		throw seek_error(strerror_str(errno));
+	return this->offset;
+}
+
+stream::len file_core::file_size() const
+{
+	return std::max(this->lenDisk, this->bufStart + this->bufLen);
+}
+
+void file_core::track_read(stream::pos pos, stream::len len)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+	if ((this->pattern == access_pattern::random) || !this->seekable) return;
+	stream::pos end = pos + len;
+	bool follows = (this->nextRead.exchange(end) == pos);
+	unsigned int run = follows ? this->lenRun + 1 : 0;
+	this->lenRun = run;
+
+	if (this->pattern != access_pattern::sequential) {
+		if (run < SEQUENTIAL_READS) return;
+		if (run == SEQUENTIAL_READS) {
+			posix_fadvise(this->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		}
+	}
+	// Ask for the next block once we're half way through the last one
+	if (end + FILE_READAHEAD / 2 > this->advisedEnd) {
+		posix_fadvise(this->fd, end, FILE_READAHEAD, POSIX_FADV_WILLNEED);
+		this->advisedEnd = end + FILE_READAHEAD;
 	}
-	return p;
+#endif
+	return;
 }
 
 
@@ -122,26 +734,95 @@ input_file::input_file()
 {
 }
 
-input_file::input_file(const std::string& filename)
+input_file::input_file(const std::string& filename, stream::len lenBuffer)
 {
-	this->handle = fopen(filename.c_str(), "rb");
-	if (this->handle == NULL) throw open_error(strerror_str(errno));
-	// no need to seek, fopen("rb") positions file pointer at start
-	this->close = true;
+	int fd = ::open(filename.c_str(), O_RDONLY | O_BINARY_FLAG);
+	if (fd < 0) throw open_error(strerror_str(errno));
+	this->attach(fd, true, lenBuffer);
 	return;
 }
 
 input_file::~input_file()
 {
 	if (this->close) {
-		fclose(this->handle);
+		::close(this->fd);
 		this->close = false; // prevent double-close in ~output_file()
 	}
 }
 
 stream::len input_file::try_read(uint8_t *buffer, stream::len len)
 {
-	return fread(buffer, 1, len, this->handle);
+	stream::pos pos = this->offset;
+	stream::len done = 0;
+	while (done < len) {
+		stream::pos bufEnd = this->bufStart + this->bufLen;
+		if ((this->offset >= this->bufStart) && (this->offset < bufEnd)) {
+			stream::len amt = std::min(len - done, bufEnd - this->offset);
+			memcpy(buffer + done, this->buffer + (this->offset - this->bufStart),
+				amt);
+			done += amt;
+			this->offset += amt;
+			continue;
+		}
+
+		// Moving on to a different part of the file
+		this->flush_writes();
+		if (len - done >= this->lenBuffer) {
+			// Large read, skip the buffer
+			stream::len r = this->raw_read(this->offset, buffer + done, len - done);
+			done += r;
+			this->offset += r;
+			break;
+		}
+		stream::len r = this->raw_read(this->offset, this->buffer,
+			this->lenBuffer);
+		this->bufStart = this->offset;
+		this->bufLen = r;
+		if (r == 0) break; // EOF
+	}
+	this->track_read(pos, done);
+	CAMOTO_STATS_READ(file, done);
+	return done;
+}
+
+stream::len input_file::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	if (!this->seekable) return this->input::try_read_at(pos, buffer, len);
+
+	stream::len r = this->raw_read(pos, buffer, len);
+
+	// Anything not yet written out is newer than what's in the file
+	if (this->dirtyEnd > this->dirtyStart) {
+		stream::pos start = std::max(pos, this->bufStart + this->dirtyStart);
+		stream::pos end = std::min(pos + len, this->bufStart + this->dirtyEnd);
+		if (start < end) {
+			memcpy(buffer + (start - pos), this->buffer + (start - this->bufStart),
+				end - start);
+			r = std::max(r, end - pos);
+		}
+	}
+	this->track_read(pos, r);
+	CAMOTO_STATS_READ(file, r);
+	return r;
+}
+
+std::future<stream::len> input_file::async_read_at(stream::pos pos,
+	uint8_t *buffer, stream::len len)
+{
+#ifdef CAMOTO_IO_URING
+	io_ring *ring = this->seekable ? io_ring::get() : nullptr;
+	if (ring) {
+		// The kernel only sees what's in the file, so write out any changes
+		this->flush_writes();
+		std::promise<stream::len> done;
+		std::future<stream::len> result = done.get_future();
+		if (ring->read(this->fd, pos, buffer, len, &done)) {
+			return result;
+		}
+	}
+#endif
+	return this->input::async_read_at(pos, buffer, len);
 }
 
 void input_file::seekg(stream::delta off, seek_from from)
@@ -157,13 +838,41 @@ stream::pos input_file::tellg() const
 
 stream::len input_file::size() const
 {
-	long start = ftell(this->handle);
+	return this->file_size();
+}
 
-	fseek(this->handle, 0, SEEK_END);
-	stream::pos len = ftell(this->handle);
+bool input_file::identify(source_id *id) const
+{
+	if (!this->seekable) return false;
+	id->content = this->tag.get();
+	id->offset = 0;
+	id->length = this->file_size();
+	return true;
+}
 
-	fseek(this->handle, start, SEEK_SET);
-	return len;
+const uint8_t *input_file::view(stream::pos pos, stream::len len,
+	stream::len *got, std::string& scratch)
+{
+	if (!this->seekable) throw seek_error(strerror_str(ESPIPE));
+	return this->input::view(pos, len, got, scratch);
+}
+
+void input_file::hint(access_pattern pattern)
+{
+	this->pattern = pattern;
+	this->lenRun = 0;
+	this->advisedEnd = 0;
+#ifdef POSIX_FADV_SEQUENTIAL
+	if (!this->seekable) return;
+	int advice;
+	switch (pattern) {
+		case access_pattern::sequential: advice = POSIX_FADV_SEQUENTIAL; break;
+		case access_pattern::random: advice = POSIX_FADV_RANDOM; break;
+		default: advice = POSIX_FADV_NORMAL; break;
+	}
+	posix_fadvise(this->fd, 0, 0, advice);
+#endif
+	return;
 }
 
 
@@ -172,31 +881,36 @@ output_file::output_file()
 {
 }
 
-output_file::output_file(const std::string& filename, bool create)
+output_file::output_file(const std::string& filename, bool create,
+	stream::len lenBuffer)
 	:	do_remove(false),
 		filename(filename)
 {
 	// We have to open the file in read/write even though we aren't reading,
-	// because none of the other options allow us to seek around and overwrite
-	// arbitrary points in the file.
-	//
-	// We also use this function as file::open() which *must* open in
+	// because this is also used as file::open() which *must* open in
 	// read+write.
-	this->handle = fopen(this->filename.c_str(), create ? "w+b" : "r+b");
-	if ((!this->handle) && (errno == EACCES)) {
+	int flags = O_RDWR | O_BINARY_FLAG;
+	if (create) flags |= O_CREAT | O_TRUNC;
+	int fd = ::open(this->filename.c_str(), flags, 0666);
+	if ((fd < 0) && (errno == EACCES) && !create) {
 		// Access denied, try read-only
-		this->handle = fopen(this->filename.c_str(), "rb");
+		fd = ::open(this->filename.c_str(), O_RDONLY | O_BINARY_FLAG);
 	}
-	if (!this->handle) throw open_error(strerror_str(errno));
-	this->close = true;
-	this->seek(0, stream::start);
+	if (fd < 0) throw open_error(strerror_str(errno));
+	this->attach(fd, true, lenBuffer);
 	return;
 }
 
 output_file::~output_file()
 {
+	try {
+		this->flush_writes();
+	} catch (const write_error& e) {
+		std::cerr << "Warning: stream::file lost data when it was closed: "
+			<< e.get_message() << std::endl;
+	}
 	if (this->close) {
-		fclose(this->handle);
+		::close(this->fd);
 		this->close = false; // prevent double-close in ~input_file()
 
 		// Can only delete the file if it's a real file
@@ -208,7 +922,66 @@ output_file::~output_file()
 
 stream::len output_file::try_write(const uint8_t *buffer, stream::len len)
 {
-	return fwrite(buffer, 1, len, this->handle);
+	this->tag.changed();
+	stream::len done = 0;
+	while (done < len) {
+		if (
+			(this->offset >= this->bufStart)
+			&& (this->offset <= this->bufStart + this->bufLen)
+			&& (this->offset < this->bufStart + this->lenBuffer)
+		) {
+			// Within the buffered data, or carrying on from the end of it
+			stream::len at = this->offset - this->bufStart;
+			stream::len amt = std::min(len - done, this->lenBuffer - at);
+			memcpy(this->buffer + at, buffer + done, amt);
+			if (this->dirtyEnd > this->dirtyStart) {
+				this->dirtyStart = std::min(this->dirtyStart, at);
+				this->dirtyEnd = std::max(this->dirtyEnd, at + amt);
+			} else {
+				this->dirtyStart = at;
+				this->dirtyEnd = at + amt;
+			}
+			this->bufLen = std::max(this->bufLen, at + amt);
+			done += amt;
+			this->offset += amt;
+			continue;
+		}
+
+		// Moving on to a different part of the file
+		this->flush_writes();
+		if (len - done >= this->lenBuffer) {
+			// Large write, skip the buffer
+			this->raw_write(this->offset, buffer + done, len - done);
+			this->offset += len - done;
+			done = len;
+			this->bufStart = this->offset;
+			this->bufLen = 0;
+			break;
+		}
+		this->bufStart = this->offset;
+		this->bufLen = 0;
+	}
+	CAMOTO_STATS_WRITE(file, done);
+	return done;
+}
+
+stream::len output_file::try_write_at(stream::pos pos, const uint8_t *buffer,
+	stream::len len)
+{
+	if (!this->seekable) return this->output::try_write_at(pos, buffer, len);
+	this->tag.changed();
+
+	this->raw_write(pos, buffer, len);
+
+	// Update any copy of the same data in the buffer
+	stream::pos start = std::max(pos, this->bufStart);
+	stream::pos end = std::min(pos + len, this->bufStart + this->bufLen);
+	if (start < end) {
+		memcpy(this->buffer + (start - this->bufStart), buffer + (start - pos),
+			end - start);
+	}
+	CAMOTO_STATS_WRITE(file, len);
+	return len;
 }
 
 void output_file::seekp(stream::delta off, seek_from from)
@@ -224,32 +997,67 @@ stream::pos output_file::tellp() const
 
 void output_file::truncate(stream::pos size)
 {
-	int fd = fileno(this->handle);
+	this->tag.changed();
+	this->flush_writes();
 #ifndef _WIN32
-	if (ftruncate(fd, size) < 0) {
+	if (ftruncate(this->fd, size) < 0) {
 #else
-	if (_chsize(fd, size) < 0) {
+	if (_chsize_s(this->fd, size) != 0) {
 #endif
 		throw write_error(strerror_str(errno));
 	}
-
-	// Have to seek last as the file might not have been large enough earlier
-	try {
-		this->seekp(size, stream::start);
-	} catch (const seek_error& e) {
-		throw write_error("Unable to seek to EOF after truncate: " + e.get_message());
+	this->lenDisk = size;
+	if (this->bufStart + this->bufLen > size) {
+		this->bufLen = (size > this->bufStart) ? size - this->bufStart : 0;
 	}
+	this->offset = size;
 	return;
 }
 
 void output_file::flush()
 {
-	if (fflush(this->handle) < 0) {
+	this->flush_writes();
+	if (this->sync && this->seekable && (fsync(this->fd) < 0)) {
 		throw write_error(strerror_str(errno));
 	}
 	return;
 }
 
+void output_file::reserve(stream::len len)
+{
+	if (!this->seekable) return;
+#if defined(__linux__)
+	// Allocate the space without changing the file size.  Any holes in the
+	// file are also filled in.  Not all filesystems support this, which is fine.
+	fallocate(this->fd, FALLOC_FL_KEEP_SIZE, 0, len);
+#elif defined(__APPLE__)
+	if (len <= this->lenDisk) return;
+	fstore_t store;
+	store.fst_flags = F_ALLOCATECONTIG | F_ALLOCATEALL;
+	store.fst_posmode = F_PEOFPOSMODE;
+	store.fst_offset = 0;
+	store.fst_length = len - this->lenDisk;
+	if (fcntl(this->fd, F_PREALLOCATE, &store) < 0) {
+		// Couldn't get contiguous space, so take whatever is available
+		store.fst_flags = F_ALLOCATEALL;
+		fcntl(this->fd, F_PREALLOCATE, &store);
+	}
+#elif defined(_WIN32)
+	if (len <= this->lenDisk) return;
+	FILE_ALLOCATION_INFO info;
+	info.AllocationSize.QuadPart = len;
+	SetFileInformationByHandle((HANDLE)_get_osfhandle(this->fd),
+		FileAllocationInfo, &info, sizeof(info));
+#endif
+	return;
+}
+
+void output_file::set_sync(bool sync)
+{
+	this->sync = sync;
+	return;
+}
+
 void output_file::remove()
 {
 	this->do_remove = true;
@@ -257,9 +1065,13 @@ void output_file::remove()
 }
 
 
-file::file(const std::string& filename, bool create)
+file::file()
+{
+}
+
+file::file(const std::string& filename, bool create, stream::len lenBuffer)
 	: input_file(),
-		output_file(filename, create)
+		output_file(filename, create, lenBuffer)
 {
 }
 
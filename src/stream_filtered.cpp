@@ -18,35 +18,100 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <string.h>
 #include <vector>
+#include <camoto/iostream_helpers.hpp>
+#include <camoto/stats.hpp>
 #include <camoto/stream_filtered.hpp>
+#include <camoto/util.hpp> // createString
 
 namespace camoto {
 namespace stream {
 
+/// Skip over any data at the start of the parent that the filter won't use.
+/**
+ * @return Number of bytes skipped, which is only less than the filter asked
+ *   for if the parent is shorter than that.
+ */
+static stream::len skipLeadingInput(input& parent, filter& f)
+{
+	stream::len lenSkip = f.skip_leading_input();
+	if (lenSkip == 0) return 0;
+	try {
+		parent.seekg(lenSkip, stream::cur);
+		return lenSkip;
+	} catch (const seek_error&) {
+		// Not seekable, or not that much data, so read and discard it instead
+	}
+	uint8_t buf[BUFFER_SIZE];
+	stream::len left = lenSkip;
+	while (left) {
+		stream::len r = parent.try_read(buf, std::min<stream::len>(left,
+			sizeof(buf)));
+		if (r == 0) break;
+		left -= r;
+	}
+	return lenSkip - left;
+}
+
 input_filtered::input_filtered(std::shared_ptr<input> parent,
 	std::shared_ptr<filter> read_filter)
-	:	string_core(std::string()),
-		in_parent(parent),
-		read_filter(read_filter),
-		populated(false)
+	:	string_core(std::string(), memory::owner::filtered),
+		in_parent(std::move(parent)),
+		read_filter(std::move(read_filter)),
+		populated(false),
+		shareable(true)
 {
-	assert(parent);
-	assert(read_filter);
+	assert(this->in_parent);
+	assert(this->read_filter);
 	assert(this->data.size() == 0);
 }
 
+input_filtered::input_filtered(input& parent,
+	std::shared_ptr<filter> read_filter)
+	:	input_filtered(borrow(parent), std::move(read_filter))
+{
+}
+
 stream::len input_filtered::try_read(uint8_t *buffer, stream::len len)
 {
 	this->populate();
-	return this->input_string::try_read(buffer, len);
+	stream::len r;
+	if (this->shared) {
+		r = this->readShared(this->offset, buffer, len);
+		this->offset += r;
+	} else {
+		r = this->input_string::try_read(buffer, len);
+	}
+	CAMOTO_STATS_READ(filtered, r);
+	return r;
+}
+
+stream::len input_filtered::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	{
+		std::lock_guard<std::mutex> guard(this->lock_populate);
+		this->populate();
+	}
+	stream::len r = this->shared
+		? this->readShared(pos, buffer, len)
+		: this->input_string::try_read_at(pos, buffer, len);
+	CAMOTO_STATS_READ(filtered, r);
+	return r;
 }
 
 void input_filtered::seekg(stream::delta off, seek_from from)
 {
 	this->populate();
+	CAMOTO_STATS_SEEK(filtered);
+	if (this->shared) {
+		this->seek(off, from, this->shared->length());
+		return;
+	}
 	return this->input_string::seekg(off, from);
 }
 
@@ -59,9 +124,35 @@ stream::pos input_filtered::tellg() const
 stream::len input_filtered::size() const
 {
 	this->populate();
+	if (this->shared) return this->shared->length();
 	return this->input_string::size();
 }
 
+const uint8_t *input_filtered::view(stream::pos pos, stream::len len,
+	stream::len *got, std::string& scratch)
+{
+	this->populate();
+	if (!this->shared) return this->input_string::view(pos, len, got, scratch);
+
+	stream::len size = this->shared->length();
+	if (pos > size) {
+		throw seek_error(createString("Cannot view beyond end of filtered data "
+			"(offset " << pos << " > length " << size << ")"));
+	}
+	*got = std::min(len, size - pos);
+	return (const uint8_t *)this->shared->data() + pos;
+}
+
+bool input_filtered::cheap_view() const
+{
+	return true;
+}
+
+bool input_filtered::identify(source_id *id) const
+{
+	return false;
+}
+
 void input_filtered::populate() const
 {
 	if (this->populated) return;
@@ -74,6 +165,28 @@ void input_filtered::realPopulate()
 {
 	this->populated = true;
 
+	// See if another stream has already decoded the same data
+	decode_cache& cache = decode_cache::shared();
+	source_id src;
+	std::string sig;
+	bool cacheable = (cache.budget() > 0)
+		&& this->in_parent->identify(&src)
+		&& !(sig = this->read_filter->signature()).empty();
+	if (cacheable) {
+		decode_cache::content hit = cache.find(src, sig);
+		if (hit) {
+			if (this->shareable) {
+				this->shared = std::move(hit);
+			} else {
+				this->data = *hit;
+				this->account();
+			}
+			return;
+		}
+	}
+
+	CAMOTO_STATS_POPULATE();
+
 	// Seek to the start here, because we will have to do the same when the time
 	// comes to write the change, so seeking here will make it obvious if the
 	// offset is wrong.
@@ -84,11 +197,18 @@ void input_filtered::realPopulate()
 	}
 
 	// Read and filter the entire input into an in-memory buffer
+	this->in_parent->hint(access_pattern::sequential);
 	uint8_t bufIn[BUFFER_SIZE];
 	stream::len lenIn, lenOut;
 	stream::len lenRead, lenLeftover = 0;
 	stream::len lenTotalOut = 0;
-	this->read_filter->reset(this->in_parent->size());
+	stream::len lenParent = this->in_parent->size();
+	this->read_filter->reset(lenParent);
+	skipLeadingInput(*this->in_parent, *this->read_filter);
+	this->read_filter->use_contiguous_output();
+	// Most filters produce at least as much data as they consume, so allocate
+	// that much up front rather than growing the buffer bit by bit.
+	this->reserve(lenParent + BUFFER_SIZE);
 	do {
 		lenOut = BUFFER_SIZE;
 		lenRead = this->in_parent->try_read(bufIn + lenLeftover, BUFFER_SIZE - lenLeftover);
@@ -96,7 +216,8 @@ void input_filtered::realPopulate()
 		lenRead += lenLeftover;
 		lenIn = lenRead;
 		this->data.resize(lenTotalOut + lenOut);
-		read_filter->transform((uint8_t *)(&this->data[lenTotalOut]), &lenOut, bufIn, &lenIn);
+		CAMOTO_STATS_TRANSFORM(*this->read_filter,
+			(uint8_t *)(&this->data[lenTotalOut]), &lenOut, bufIn, &lenIn);
 		assert(lenIn <= BUFFER_SIZE);  // sanity check
 		assert(lenOut <= BUFFER_SIZE); // sanity check
 		lenTotalOut += lenOut;
@@ -109,27 +230,450 @@ void input_filtered::realPopulate()
 
 	// Cut off any excess from the last read
 	this->data.resize(lenTotalOut);
+	this->account();
 
+	if (cacheable && this->shareable) {
+		// Hand the data over to the cache, and read it from there from now on
+		this->data.shrink_to_fit();
+		this->shared = std::make_shared<const std::string>(this->release());
+		cache.add(src, sig, this->shared);
+	}
 	return;
 }
 
+stream::len input_filtered::readShared(stream::pos pos, uint8_t *buffer,
+	stream::len len) const
+{
+	stream::pos size = this->shared->length();
+	if (pos >= size) return 0;
+	stream::len amt = std::min(len, size - pos);
+	memcpy(buffer, this->shared->data() + pos, amt);
+	return amt;
+}
+
 std::shared_ptr<input> input_filtered::get_stream()
 {
 	return this->in_parent;
 }
 
 
+checkpoint_index::checkpoint_index(stream::len interval)
+	:	lenInterval(interval)
+{
+	assert(interval > 0);
+}
+
+stream::len checkpoint_index::interval() const
+{
+	return this->lenInterval;
+}
+
+std::size_t checkpoint_index::size() const
+{
+	return this->points.size();
+}
+
+const checkpoint_index::checkpoint *checkpoint_index::find(
+	stream::pos decoded) const
+{
+	auto i = std::upper_bound(this->points.begin(), this->points.end(), decoded,
+		[](stream::pos d, const checkpoint& c) { return d < c.decoded; });
+	if (i == this->points.begin()) return nullptr;
+	return &*--i;
+}
+
+bool checkpoint_index::wanted(stream::pos decoded) const
+{
+	// Aim for one checkpoint in each interval, wherever in it the filter
+	// happened to stop.
+	auto c = this->find(decoded);
+	return decoded / this->lenInterval
+		> (c ? c->decoded : 0) / this->lenInterval;
+}
+
+void checkpoint_index::add(checkpoint c)
+{
+	auto i = std::lower_bound(this->points.begin(), this->points.end(),
+		c.decoded,
+		[](const checkpoint& a, stream::pos d) { return a.decoded < d; });
+	if ((i != this->points.end()) && (i->decoded == c.decoded)) {
+		*i = std::move(c);
+	} else {
+		this->points.insert(i, std::move(c));
+	}
+	return;
+}
+
+void checkpoint_index::clear()
+{
+	this->points.clear();
+	return;
+}
+
+void checkpoint_index::write(stream::output& s) const
+{
+	write_packed(s, u32le(this->points.size()), u64le(this->lenInterval));
+	for (auto& c : this->points) {
+		write_packed(s, u64le(c.decoded), u64le(c.parent),
+			u32le(c.state.length()));
+		s.write(c.state);
+	}
+	return;
+}
+
+void checkpoint_index::read(stream::input& s)
+{
+	uint32_t num;
+	uint64_t interval;
+	read_packed(s, u32le(num), u64le(interval));
+	if (interval == 0) throw read_error("Checkpoint index has a zero interval");
+
+	std::vector<checkpoint> loaded;
+	for (uint32_t i = 0; i < num; i++) {
+		checkpoint c;
+		uint64_t decoded, parent;
+		uint32_t lenState;
+		read_packed(s, u64le(decoded), u64le(parent), u32le(lenState));
+		if (!loaded.empty() && (decoded <= loaded.back().decoded)) {
+			throw read_error("Checkpoint index is out of order");
+		}
+		c.decoded = decoded;
+		c.parent = parent;
+		c.state = s.read(lenState);
+		if (c.state.length() != lenState) throw incomplete_read(c.state.length());
+		loaded.push_back(std::move(c));
+	}
+	this->lenInterval = interval;
+	this->points = std::move(loaded);
+	return;
+}
+
+
+input_filtered_streaming::input_filtered_streaming(
+	std::shared_ptr<input> parent, std::shared_ptr<filter> read_filter)
+	:	in_parent(std::move(parent)),
+		read_filter(std::move(read_filter)),
+		bufIn(BUFFER_SIZE),
+		lenBufIn(0),
+		window(BUFFER_SIZE),
+		winStart(0),
+		winLen(0),
+		decodedPos(0),
+		posParent(0),
+		offset(0),
+		started(false),
+		filterEOF(false),
+		knownSize(false),
+		lenDecoded(0)
+{
+	assert(this->in_parent);
+	assert(this->read_filter);
+}
+
+input_filtered_streaming::input_filtered_streaming(
+	std::shared_ptr<input> parent, std::shared_ptr<filter> read_filter,
+	stream::len lenDecoded)
+	:	input_filtered_streaming(std::move(parent), std::move(read_filter))
+{
+	this->knownSize = true;
+	this->lenDecoded = lenDecoded;
+}
+
+stream::len input_filtered_streaming::try_read(uint8_t *buffer,
+	stream::len len)
+{
+	stream::len total = 0;
+	while (len) {
+		stream::pos winEnd = this->winStart + this->winLen;
+		if ((this->offset >= this->winStart) && (this->offset < winEnd)) {
+			// Serve as much as possible from already decoded data
+			stream::len amt = std::min(len, winEnd - this->offset);
+			memcpy(buffer, &this->window[this->offset - this->winStart], amt);
+			buffer += amt;
+			len -= amt;
+			total += amt;
+			this->offset += amt;
+			continue;
+		}
+		if (this->offset != this->decodedPos) {
+			// A view() further on skipped past the read position
+			stream::pos target = this->offset;
+			this->rewindFor(target);
+			bool reached = this->skipTo(target);
+			this->offset = target;
+			if (!reached) break;
+			continue;
+		}
+
+		stream::len r;
+		if (len >= this->window.size()) {
+			// Large read, decode straight into the caller's buffer
+			r = this->decode(buffer, len);
+			if (r == 0) break;
+			buffer += r;
+			len -= r;
+			total += r;
+			this->offset += r;
+			this->winStart = this->decodedPos;
+			this->winLen = 0;
+		} else {
+			r = this->decode(this->window.data(), this->window.size());
+			if (r == 0) break;
+			this->winStart = this->decodedPos - r;
+			this->winLen = r;
+		}
+	}
+	CAMOTO_STATS_READ(filtered, total);
+	return total;
+}
+
+void input_filtered_streaming::seekg(stream::delta off, seek_from from)
+{
+	CAMOTO_STATS_SEEK(filtered);
+	stream::pos baseOffset;
+	switch (from) {
+		case cur:
+			baseOffset = this->offset;
+			break;
+		case end:
+			baseOffset = this->size();
+			break;
+		default:
+			baseOffset = 0;
+			break;
+	}
+	if ((off < 0) && (baseOffset < (unsigned)(off * -1))) {
+		throw seek_error("Cannot seek back past start of filtered stream");
+	}
+	baseOffset += off;
+	if (this->knownSize && (baseOffset > this->lenDecoded)) {
+		throw seek_error(createString("Cannot seek beyond end of filtered stream "
+			"(offset " << baseOffset << " > length " << this->lenDecoded << ")"));
+	}
+
+	this->rewindFor(baseOffset);
+	if (!this->skipTo(baseOffset)) {
+		throw seek_error(createString("Cannot seek beyond end of filtered stream "
+			"(offset " << baseOffset << " > length " << this->decodedPos << ")"));
+	}
+	this->offset = baseOffset;
+	return;
+}
+
+stream::pos input_filtered_streaming::tellg() const
+{
+	return this->offset;
+}
+
+stream::len input_filtered_streaming::size() const
+{
+	if (this->knownSize) return this->lenDecoded;
+
+	// Decode everything once to find the size, then go back to where we were.
+	input_filtered_streaming *self = const_cast<input_filtered_streaming *>(this);
+	stream::pos orig = this->offset;
+	while (self->skipTo(self->decodedPos + 1));
+	self->knownSize = true;
+	self->lenDecoded = self->decodedPos;
+	self->offset = self->decodedPos;
+	self->seekg(orig, stream::start);
+	return this->lenDecoded;
+}
+
+stream::len input_filtered_streaming::size_hint() const
+{
+	// Unlike size(), don't decode everything to find out
+	return this->knownSize ? this->lenDecoded : 0;
+}
+
+const uint8_t *input_filtered_streaming::view(stream::pos pos,
+	stream::len len, stream::len *got, std::string& scratch)
+{
+	if (pos < this->winStart) {
+		// Already decoded and discarded, so the filter has to be restarted
+		return this->input::view(pos, len, got, scratch);
+	}
+	if (pos > this->decodedPos) {
+		// Skip ahead to the start of the view.  This drops the data at the read
+		// position, which try_read() will decode again if it gets there.
+		this->skipTo(pos);
+	}
+
+	// Decode forward from where the filter is up to, growing the window to
+	// cover the view.  Data from the read position onwards is kept, so
+	// reading or seeking within the view afterwards does not have to restart
+	// the filter.
+	stream::pos keep = std::max(this->winStart,
+		std::min(this->offset, pos));
+	if (keep > this->winStart) {
+		stream::len drop = keep - this->winStart;
+		this->winLen -= std::min(drop, this->winLen);
+		memmove(this->window.data(), &this->window[drop], this->winLen);
+		this->winStart = keep;
+	}
+	while (this->winStart + this->winLen < pos + len) {
+		if (this->window.size() < this->winLen + BUFFER_SIZE) {
+			this->window.resize(this->winLen + BUFFER_SIZE);
+		}
+		stream::len r = this->decode(&this->window[this->winLen], BUFFER_SIZE);
+		if (r == 0) break;
+		this->winLen += r;
+	}
+
+	stream::pos winEnd = this->winStart + this->winLen;
+	*got = (pos < winEnd) ? std::min(len, winEnd - pos) : 0;
+	return this->window.data() + std::min(pos, winEnd) - this->winStart;
+}
+
+bool input_filtered_streaming::cheap_view() const
+{
+	return true;
+}
+
+std::shared_ptr<input> input_filtered_streaming::get_stream()
+{
+	return this->in_parent;
+}
+
+void input_filtered_streaming::set_checkpoints(
+	std::shared_ptr<checkpoint_index> index)
+{
+	this->checkpoints = index;
+	return;
+}
+
+void input_filtered_streaming::restart()
+{
+	try {
+		this->in_parent->seekg(0, stream::start);
+	} catch (const seek_error&) {
+		// Just ignore it, the stream might not be seekable (e.g. stdin)
+	}
+	this->read_filter->reset(this->in_parent->size());
+	this->started = true;
+	this->lenBufIn = 0;
+	this->winStart = 0;
+	this->winLen = 0;
+	this->decodedPos = 0;
+	this->posParent = skipLeadingInput(*this->in_parent, *this->read_filter);
+	this->offset = 0;
+	this->filterEOF = false;
+	return;
+}
+
+void input_filtered_streaming::resume(const checkpoint_index::checkpoint& c)
+{
+	this->in_parent->seekg(c.parent, stream::start);
+	this->read_filter->reset(this->in_parent->size());
+	input_span state(reinterpret_cast<const uint8_t *>(c.state.data()),
+		c.state.length());
+	this->read_filter->load_state(state);
+	this->started = true;
+	this->lenBufIn = 0;
+	this->winStart = c.decoded;
+	this->winLen = 0;
+	this->decodedPos = c.decoded;
+	this->posParent = c.parent;
+	this->offset = c.decoded;
+	this->filterEOF = false;
+	return;
+}
+
+void input_filtered_streaming::rewindFor(stream::pos target)
+{
+	auto c = this->checkpoints ? this->checkpoints->find(target) : nullptr;
+	if (target < this->winStart) {
+		// Going backwards, so we have to start again from somewhere before target
+		if (c) this->resume(*c);
+		else this->restart();
+	} else if (c && (c->decoded > this->decodedPos)) {
+		// Going forwards, past a checkpoint
+		this->resume(*c);
+	}
+	return;
+}
+
+stream::len input_filtered_streaming::decode(uint8_t *out, stream::len lenOut)
+{
+	if (!this->started) this->restart();
+	if (this->checkpoints) {
+		// Don't let large reads skip over several checkpoints at once
+		lenOut = std::min(lenOut, std::max<stream::len>(BUFFER_SIZE,
+			this->checkpoints->interval()));
+	}
+	while (!this->filterEOF) {
+		stream::len lenRead = this->in_parent->try_read(
+			&this->bufIn[this->lenBufIn], this->bufIn.size() - this->lenBufIn);
+		assert(lenRead <= this->bufIn.size() - this->lenBufIn);
+		this->lenBufIn += lenRead;
+		this->posParent += lenRead;
+
+		stream::len lenIn = this->lenBufIn;
+		stream::len lenProduced = lenOut;
+		CAMOTO_STATS_TRANSFORM(*this->read_filter, out, &lenProduced,
+			this->bufIn.data(), &lenIn);
+		assert(lenIn <= this->lenBufIn);
+		assert(lenProduced <= lenOut);
+
+		this->lenBufIn -= lenIn;
+		if (this->lenBufIn) {
+			// Not all input data was processed, keep the leftovers
+			memmove(this->bufIn.data(), &this->bufIn[lenIn], this->lenBufIn);
+		}
+		if ((lenIn == 0) && (lenProduced == 0)) {
+			this->filterEOF = true;
+			break;
+		}
+		if (lenProduced) {
+			this->decodedPos += lenProduced;
+			if (this->checkpoints && this->checkpoints->wanted(this->decodedPos)) {
+				this->saveCheckpoint();
+			}
+			return lenProduced;
+		}
+	}
+	return 0;
+}
+
+void input_filtered_streaming::saveCheckpoint()
+{
+	stream::string state;
+	if (!this->read_filter->save_state(state)) {
+		// Filter can't do it, so don't keep trying
+		this->checkpoints.reset();
+		return;
+	}
+	checkpoint_index::checkpoint c;
+	c.decoded = this->decodedPos;
+	c.parent = this->posParent - this->lenBufIn;
+	c.state = state.release();
+	this->checkpoints->add(std::move(c));
+	return;
+}
+
+bool input_filtered_streaming::skipTo(stream::pos target)
+{
+	while (this->decodedPos < target) {
+		stream::len r = this->decode(this->window.data(), this->window.size());
+		if (r == 0) return false;
+		this->winStart = this->decodedPos - r;
+		this->winLen = r;
+	}
+	return true;
+}
+
+
 output_filtered::output_filtered(std::shared_ptr<output> parent,
 	std::shared_ptr<filter> write_filter, fn_notify_prefiltered_size set_orig_size)
-	:	string_core(std::string()),
-		out_parent(parent),
-		write_filter(write_filter),
-		fn_set_orig_size(set_orig_size),
+	:	string_core(std::string(), memory::owner::filtered),
+		out_parent(std::move(parent)),
+		write_filter(std::move(write_filter)),
+		fn_set_orig_size(std::move(set_orig_size)),
 		done_filter(false),
 		need_flush(false)
 {
-	assert(parent);
-	assert(write_filter);
+	assert(this->out_parent);
+	assert(this->write_filter);
 	return;
 }
 
@@ -149,12 +693,29 @@ stream::len output_filtered::try_write(const uint8_t *buffer, stream::len len)
 	this->done_filter = false;
 	this->need_flush = true;
 
-	return this->output_string::try_write(buffer, len);
+	stream::len w = this->output_string::try_write(buffer, len);
+	CAMOTO_STATS_WRITE(filtered, w);
+	return w;
+}
+
+stream::len output_filtered::try_write_at(stream::pos pos,
+	const uint8_t *buffer, stream::len len)
+{
+	this->populate();
+
+	// Data has changed, make sure we flush it
+	this->done_filter = false;
+	this->need_flush = true;
+
+	stream::len w = this->output_string::try_write_at(pos, buffer, len);
+	CAMOTO_STATS_WRITE(filtered, w);
+	return w;
 }
 
 void output_filtered::seekp(stream::delta off, seek_from from)
 {
 	this->populate();
+	CAMOTO_STATS_SEEK(filtered);
 	return this->output_string::seekp(off, from);
 }
 
@@ -195,7 +756,8 @@ void output_filtered::flush()
 		bufOut.resize(lenFinal + lenOut);
 
 		try {
-			this->write_filter->transform(&bufOut[lenFinal], &lenOut, bufIn, &lenIn);
+			CAMOTO_STATS_TRANSFORM(*this->write_filter, &bufOut[lenFinal], &lenOut,
+				bufIn, &lenIn);
 		} catch (const filter_error& e) {
 			throw write_error("Filter error: " + e.get_message());
 		}
@@ -228,6 +790,32 @@ void output_filtered::flush()
 	return;
 }
 
+stream::len output_filtered::filtered_size() const
+{
+	this->populate();
+
+	auto bufIn = reinterpret_cast<const uint8_t *>(this->data.data());
+	stream::len lenRemaining = this->data.size();
+	stream::len lenFinal = 0;
+	stream::len lenIn, lenOut;
+
+	this->write_filter->reset(lenRemaining);
+	do {
+		lenIn = lenRemaining;
+		try {
+			lenOut = this->write_filter->measure(bufIn, &lenIn);
+		} catch (const filter_error& e) {
+			throw write_error("Filter error: " + e.get_message());
+		}
+		assert(lenIn <= lenRemaining);
+		lenFinal += lenOut;
+		bufIn += lenIn;
+		lenRemaining -= lenIn;
+	} while ((lenIn != 0) || (lenOut != 0));
+
+	return lenFinal;
+}
+
 void output_filtered::populate() const
 {
 	return;
@@ -239,13 +827,188 @@ std::shared_ptr<output> output_filtered::get_stream()
 }
 
 
+output_filtered_streaming::output_filtered_streaming(
+	std::shared_ptr<output> parent, std::shared_ptr<filter> write_filter,
+	fn_notify_prefiltered_size set_orig_size)
+	:	output_filtered_streaming(std::move(parent), std::move(write_filter),
+			std::move(set_orig_size), 0)
+{
+}
+
+output_filtered_streaming::output_filtered_streaming(
+	std::shared_ptr<output> parent, std::shared_ptr<filter> write_filter,
+	fn_notify_prefiltered_size set_orig_size, stream::len lenInput)
+	:	out_parent(std::move(parent)),
+		write_filter(std::move(write_filter)),
+		fn_set_orig_size(std::move(set_orig_size)),
+		bufIn(BUFFER_SIZE),
+		lenBufIn(0),
+		bufOut(BUFFER_SIZE),
+		lenInput(lenInput),
+		offset(0),
+		lenFiltered(0),
+		started(false),
+		finished(false),
+		seekable(true)
+{
+	assert(this->out_parent);
+	assert(this->write_filter);
+}
+
+output_filtered_streaming::~output_filtered_streaming()
+{
+	if (this->started && !this->finished) {
+		std::cerr << "Warning: stream::output_filtered_streaming destroyed with "
+			"unflushed data." << std::endl;
+	}
+}
+
+stream::len output_filtered_streaming::try_write(const uint8_t *buffer,
+	stream::len len)
+{
+	if (this->finished) {
+		throw write_error("Cannot write to a streaming filtered stream after it "
+			"has been flushed");
+	}
+	if (!this->started) this->start();
+
+	stream::len total = 0;
+	while (len) {
+		stream::len amt = std::min(len, this->bufIn.size() - this->lenBufIn);
+		memcpy(&this->bufIn[this->lenBufIn], buffer, amt);
+		this->lenBufIn += amt;
+		buffer += amt;
+		len -= amt;
+		total += amt;
+		this->offset += amt;
+		if (this->lenBufIn == this->bufIn.size()) this->process(false);
+	}
+	CAMOTO_STATS_WRITE(filtered, total);
+	return total;
+}
+
+void output_filtered_streaming::seekp(stream::delta off, seek_from from)
+{
+	CAMOTO_STATS_SEEK(filtered);
+	stream::pos baseOffset = (from == stream::start) ? 0 : this->offset;
+	if ((off < 0) && (baseOffset < (unsigned)(off * -1))) {
+		throw seek_error("Cannot seek back past start of filtered stream");
+	}
+	baseOffset += off;
+	if (baseOffset != this->offset) {
+		throw seek_error(createString("Streaming filtered streams can only be "
+			"written sequentially (tried to seek to offset " << baseOffset
+			<< " while at offset " << this->offset << ")"));
+	}
+	return;
+}
+
+stream::pos output_filtered_streaming::tellp() const
+{
+	return this->offset;
+}
+
+void output_filtered_streaming::truncate(stream::pos size)
+{
+	if (size != this->offset) {
+		throw write_error(createString("Streaming filtered streams cannot be "
+			"resized (tried to truncate to " << size << " bytes after writing "
+			<< this->offset << ")"));
+	}
+	return;
+}
+
+void output_filtered_streaming::flush()
+{
+	if (!this->started || this->finished) return;
+	this->finished = true;
+
+	this->process(true);
+
+	// Cut off any old data past the end of what was written.  A pipe such as
+	// stdout can't be truncated, but then it can't have any old data either,
+	// so only truncate when the parent can seek to show there is some.
+	bool excess = false;
+	if (this->seekable) {
+		try {
+			this->out_parent->seekp(0, stream::end);
+			excess = this->out_parent->tellp() > this->lenFiltered;
+			this->out_parent->seekp(this->lenFiltered, stream::start);
+		} catch (const seek_error&) {
+			excess = false;
+		}
+	}
+	if (excess) this->out_parent->truncate(this->lenFiltered);
+
+	// As for output_filtered, this has to come after truncate().  There is no
+	// output_filtered to pass, so the callback gets NULL as documented.
+	if (this->fn_set_orig_size) this->fn_set_orig_size(nullptr, this->offset);
+	this->out_parent->flush();
+	return;
+}
+
+std::shared_ptr<output> output_filtered_streaming::get_stream()
+{
+	return this->out_parent;
+}
+
+void output_filtered_streaming::start()
+{
+	try {
+		this->out_parent->seekp(0, stream::start);
+	} catch (const seek_error&) {
+		// Just ignore it, the stream might not be seekable (e.g. stdout)
+		this->seekable = false;
+	}
+	this->write_filter->reset(this->lenInput);
+	this->started = true;
+	return;
+}
+
+void output_filtered_streaming::process(bool final)
+{
+	while (final || (this->lenBufIn == this->bufIn.size())) {
+		stream::len lenIn = this->lenBufIn;
+		stream::len lenOut = this->bufOut.size();
+		try {
+			CAMOTO_STATS_TRANSFORM(*this->write_filter, this->bufOut.data(), &lenOut,
+				this->bufIn.data(), &lenIn);
+		} catch (const filter_error& e) {
+			throw write_error("Filter error: " + e.get_message());
+		}
+		assert(lenIn <= this->lenBufIn);
+		assert(lenOut <= this->bufOut.size());
+
+		if (lenOut) {
+			this->out_parent->write(this->bufOut.data(), lenOut);
+			this->lenFiltered += lenOut;
+		}
+		this->lenBufIn -= lenIn;
+		if (this->lenBufIn) {
+			// Not all input data was processed, keep the leftovers
+			memmove(this->bufIn.data(), &this->bufIn[lenIn], this->lenBufIn);
+		}
+		if ((lenIn == 0) && (lenOut == 0)) {
+			if (!final) {
+				throw write_error("Filter signalled the end of the data before all "
+					"the data had been written to it");
+			}
+			break;
+		}
+	}
+	return;
+}
+
+
 filtered::filtered(std::shared_ptr<inout> parent,
 	std::shared_ptr<filter> read_filter, std::shared_ptr<filter> write_filter,
 	fn_notify_prefiltered_size set_orig_size)
-	:	string_core(std::string()),
-		input_filtered(parent, read_filter),
-		output_filtered(parent, write_filter, set_orig_size)
+	:	string_core(std::string(), memory::owner::filtered),
+		input_filtered(parent, std::move(read_filter)),
+		output_filtered(std::move(parent), std::move(write_filter),
+			std::move(set_orig_size))
 {
+	this->shareable = false;
 }
 
 void filtered::truncate(stream::pos size)
@@ -266,5 +1029,27 @@ std::shared_ptr<inout> filtered::get_stream()
 	return std::dynamic_pointer_cast<inout>(this->out_parent);
 }
 
+stream::len filtered_size(filter& f, input& content)
+{
+	content.seekg(0, stream::start);
+	f.reset(content.size());
+
+	uint8_t buf[BUFFER_SIZE];
+	stream::len lenBuf = 0, lenFinal = 0;
+	stream::len lenIn, lenOut;
+	do {
+		// Keep the buffer full, as filters only expect a short input at the end
+		lenBuf += content.try_read(buf + lenBuf, BUFFER_SIZE - lenBuf);
+		lenIn = lenBuf;
+		lenOut = f.measure(buf, &lenIn);
+		assert(lenIn <= lenBuf);
+		lenFinal += lenOut;
+		lenBuf -= lenIn;
+		memmove(buf, buf + lenIn, lenBuf);
+	} while ((lenIn != 0) || (lenOut != 0));
+
+	return lenFinal;
+}
+
 } // namespace stream
 } // namespace camoto
@@ -0,0 +1,438 @@
+/**
+ * @file   stream_mmap.cpp
+ * @brief  Stream implementation for accessing memory-mapped local files.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+#include <camoto/stream_mmap.hpp>
+#include <camoto/util.hpp> // createString
+
+namespace camoto {
+namespace stream {
+
+mmap_core::mmap_core()
+	:	base(NULL),
+		length(0),
+		lenMapped(0),
+		offset(0),
+		writable(false),
+#ifdef _WIN32
+		hFile(INVALID_HANDLE_VALUE),
+		hMapping(NULL)
+#else
+		fd(-1)
+#endif
+{
+}
+
+mmap_core::~mmap_core()
+{
+	this->unmap();
+	if (this->lenMapped > this->length) {
+		// Cut off the extra space left by grow()
+		try {
+			this->setFileSize(this->length);
+		} catch (const write_error&) {
+			// Too late to report it, the file is just left longer
+		}
+	}
+#ifdef _WIN32
+	if (this->hFile != INVALID_HANDLE_VALUE) {
+		CloseHandle(this->hFile);
+		this->hFile = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (this->fd >= 0) {
+		::close(this->fd);
+		this->fd = -1;
+	}
+#endif
+}
+
+void mmap_core::open(const std::string& filename, bool write, bool create)
+{
+	this->writable = write;
+#ifdef _WIN32
+	this->hFile = CreateFileA(filename.c_str(),
+		write ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+		FILE_SHARE_READ | (write ? 0 : FILE_SHARE_WRITE),
+		NULL,
+		create ? CREATE_ALWAYS : OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL
+	);
+	if (this->hFile == INVALID_HANDLE_VALUE) {
+		throw open_error(createString("Unable to open file (Win32 error "
+			<< GetLastError() << ")"));
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(this->hFile, &fileSize)) {
+		throw open_error(createString("Unable to get file size (Win32 error "
+			<< GetLastError() << ")"));
+	}
+	this->length = this->lenMapped = fileSize.QuadPart;
+#else
+	int flags = write ? O_RDWR : O_RDONLY;
+	if (create) flags |= O_CREAT | O_TRUNC;
+	this->fd = ::open(filename.c_str(), flags, 0666);
+	if (this->fd < 0) throw open_error(strerror_str(errno));
+
+	struct stat st;
+	if (fstat(this->fd, &st) < 0) throw open_error(strerror_str(errno));
+	this->length = this->lenMapped = st.st_size;
+#endif
+	try {
+		this->map();
+	} catch (const error& e) {
+		throw open_error(e.get_message());
+	}
+	return;
+}
+
+void mmap_core::map()
+{
+	// Zero-length mappings are not permitted, so an empty file has no mapping.
+	if (this->lenMapped == 0) return;
+
+#ifdef _WIN32
+	this->hMapping = CreateFileMappingA(this->hFile, NULL,
+		this->writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+	if (this->hMapping == NULL) {
+		throw error(createString("Unable to map file (Win32 error "
+			<< GetLastError() << ")"));
+	}
+	this->base = (uint8_t *)MapViewOfFile(this->hMapping,
+		this->writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+	if (this->base == NULL) {
+		DWORD code = GetLastError();
+		CloseHandle(this->hMapping);
+		this->hMapping = NULL;
+		throw error(createString("Unable to map file (Win32 error "
+			<< code << ")"));
+	}
+#else
+	void *p = ::mmap(NULL, this->lenMapped,
+		this->writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+		MAP_SHARED, this->fd, 0);
+	if (p == MAP_FAILED) throw error(strerror_str(errno));
+	this->base = (uint8_t *)p;
+#endif
+	return;
+}
+
+void mmap_core::unmap()
+{
+#ifdef _WIN32
+	if (this->base) {
+		UnmapViewOfFile(this->base);
+		this->base = NULL;
+	}
+	if (this->hMapping) {
+		CloseHandle(this->hMapping);
+		this->hMapping = NULL;
+	}
+#else
+	if (this->base) {
+		munmap(this->base, this->lenMapped);
+		this->base = NULL;
+	}
+#endif
+	return;
+}
+
+void mmap_core::resize(stream::len newLength)
+{
+	this->remap(newLength);
+	this->length = newLength;
+	if (this->offset > this->length) this->offset = this->length;
+	return;
+}
+
+void mmap_core::grow(stream::len newLength)
+{
+	if (newLength > this->lenMapped) {
+		try {
+			this->remap(std::max(newLength, this->lenMapped * 2));
+		} catch (const write_error&) {
+			// There may still be room for just what is needed
+			this->remap(newLength);
+		}
+	}
+	this->length = newLength;
+	return;
+}
+
+void mmap_core::trim()
+{
+	if (this->lenMapped > this->length) this->remap(this->length);
+	return;
+}
+
+void mmap_core::remap(stream::len newMapped)
+{
+	stream::len oldMapped = this->lenMapped;
+	this->unmap();
+	try {
+		this->setFileSize(newMapped);
+	} catch (const write_error&) {
+		this->map(); // restore the previous mapping
+		throw;
+	}
+	this->lenMapped = newMapped;
+	try {
+		this->map();
+	} catch (const error& e) {
+		// Put the file back how it was, so the data already there can still be
+		// reached.
+		this->lenMapped = 0;
+		try {
+			this->setFileSize(oldMapped);
+			this->lenMapped = oldMapped;
+			this->map();
+		} catch (const error&) {
+			this->lenMapped = 0;
+		}
+		if (this->length > this->lenMapped) this->length = this->lenMapped;
+		if (this->offset > this->length) this->offset = this->length;
+		throw write_error(e.get_message());
+	}
+	return;
+}
+
+void mmap_core::setFileSize(stream::len newSize)
+{
+#ifdef _WIN32
+	LARGE_INTEGER li;
+	li.QuadPart = newSize;
+	if (
+		!SetFilePointerEx(this->hFile, li, NULL, FILE_BEGIN)
+		|| !SetEndOfFile(this->hFile)
+	) {
+		throw write_error(createString("Unable to resize file (Win32 error "
+			<< GetLastError() << ")"));
+	}
+#else
+	if (ftruncate(this->fd, newSize) < 0) {
+		throw write_error(strerror_str(errno));
+	}
+#endif
+	return;
+}
+
+void mmap_core::seek(stream::delta off, seek_from from)
+{
+	stream::pos baseOffset;
+	switch (from) {
+		case cur:
+			baseOffset = this->offset;
+			break;
+		case end:
+			baseOffset = this->length;
+			break;
+		default:
+			baseOffset = 0;
+			break;
+	}
+	if ((off < 0) && (baseOffset < (unsigned)(off * -1))) {
+		throw seek_error("Cannot seek back past start of file");
+	}
+	baseOffset += off;
+	if (baseOffset > this->length) {
+		throw seek_error(createString("Cannot seek beyond end of file (offset "
+			<< baseOffset << " > length " << this->length << ")"));
+	}
+	this->offset = baseOffset;
+	return;
+}
+
+
+input_mmap::input_mmap()
+{
+}
+
+input_mmap::input_mmap(const std::string& filename)
+{
+	this->open(filename, false, false);
+}
+
+input_mmap::~input_mmap()
+{
+}
+
+stream::len input_mmap::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::len amt = this->input_mmap::try_read_at(this->offset, buffer, len);
+	this->offset += amt;
+	return amt;
+}
+
+stream::len input_mmap::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	if (pos >= this->length) return 0;
+	stream::len amt = std::min(len, this->length - pos);
+	memcpy(buffer, this->base + pos, amt);
+	return amt;
+}
+
+void input_mmap::seekg(stream::delta off, seek_from from)
+{
+	this->seek(off, from);
+	return;
+}
+
+stream::pos input_mmap::tellg() const
+{
+	return this->offset;
+}
+
+stream::len input_mmap::size() const
+{
+	return this->length;
+}
+
+bool input_mmap::identify(source_id *id) const
+{
+	id->content = this->tag.get();
+	id->offset = 0;
+	id->length = this->length;
+	return true;
+}
+
+const uint8_t *input_mmap::view(stream::pos pos, stream::len len,
+	stream::len *got, std::string& scratch)
+{
+	if (pos > this->length) {
+		throw seek_error(createString("Cannot view beyond end of file (offset "
+			<< pos << " > length " << this->length << ")"));
+	}
+	*got = std::min(len, this->length - pos);
+	return this->base + pos;
+}
+
+bool input_mmap::cheap_view() const
+{
+	return true;
+}
+
+const uint8_t *input_mmap::data() const
+{
+	return this->base;
+}
+
+
+mmap::mmap(const std::string& filename, bool create)
+{
+	this->open(filename, true, create);
+}
+
+mmap::~mmap()
+{
+	// Changes to a shared mapping reach the file when it is unmapped, so there
+	// is no need to flush here.
+}
+
+stream::len mmap::try_write(const uint8_t *buffer, stream::len len)
+{
+	stream::len w = this->mmap::try_write_at(this->offset, buffer, len);
+	this->offset += w;
+	return w;
+}
+
+stream::len mmap::try_write_at(stream::pos pos, const uint8_t *buffer,
+	stream::len len)
+{
+	this->tag.changed();
+	if (pos > this->length) {
+		throw seek_error(createString("Cannot write beyond end of file (offset "
+			<< pos << " > length " << this->length << ")"));
+	}
+	if (len == 0) return 0;
+	stream::pos done = pos + len;
+	if (done > this->length) {
+		try {
+			this->grow(done);
+		} catch (const write_error&) {
+			// Write as much as will fit in the existing file.  If the file could
+			// be resized but not mapped again, there is nothing left to write to.
+			if (pos >= this->length) return 0;
+			len = this->length - pos;
+		}
+	}
+	memcpy(this->base + pos, buffer, len);
+	return len;
+}
+
+void mmap::seekp(stream::delta off, seek_from from)
+{
+	this->seek(off, from);
+	return;
+}
+
+stream::pos mmap::tellp() const
+{
+	return this->offset;
+}
+
+void mmap::truncate(stream::pos size)
+{
+	this->tag.changed();
+	this->resize(size);
+	try {
+		this->seek(size, stream::start);
+	} catch (const seek_error& e) {
+		throw write_error("Unable to seek to EOF after truncate: " + e.get_message());
+	}
+	return;
+}
+
+void mmap::flush()
+{
+	this->trim();
+	if (!this->base) return;
+#ifdef _WIN32
+	if (!FlushViewOfFile(this->base, 0)) {
+		throw write_error(createString("Unable to flush file (Win32 error "
+			<< GetLastError() << ")"));
+	}
+#else
+	if (msync(this->base, this->length, MS_SYNC) < 0) {
+		throw write_error(strerror_str(errno));
+	}
+#endif
+	return;
+}
+
+uint8_t *mmap::data()
+{
+	return this->base;
+}
+
+} // namespace stream
+} // namespace camoto
@@ -0,0 +1,307 @@
+/**
+ * @file   stream_paged.cpp
+ * @brief  In-memory stream with cheap copy-on-write snapshots.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <string.h>
+#include <camoto/memory.hpp>
+#include <camoto/stats.hpp>
+#include <camoto/stream_paged.hpp>
+#include <camoto/util.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Content of a page that has never been written to.
+static const uint8_t zeroPage[PAGED_PAGE_SIZE] = {};
+
+paged::paged()
+	:	pages(std::make_shared<page_table>()),
+		length(0),
+		offset(0)
+{
+}
+
+paged::paged(const std::string& content)
+	:	pages(std::make_shared<page_table>()),
+		length(content.length()),
+		offset(0)
+{
+	const uint8_t *src = (const uint8_t *)content.data();
+	this->pages->reserve((this->length + PAGED_PAGE_SIZE - 1) / PAGED_PAGE_SIZE);
+	for (stream::pos p = 0; p < this->length; p += PAGED_PAGE_SIZE) {
+		auto pg = newPage(nullptr);
+		stream::len amt = std::min<stream::len>(PAGED_PAGE_SIZE, this->length - p);
+		memcpy(pg->data(), src + p, amt);
+		this->pages->push_back(std::move(pg));
+	}
+}
+
+paged::~paged()
+{
+}
+
+stream::len paged::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::len amt = this->paged::try_read_at(this->offset, buffer, len);
+	this->offset += amt;
+	return amt;
+}
+
+stream::len paged::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	if (pos >= this->length) return 0;
+	stream::len amt = std::min(len, this->length - pos);
+	stream::len done = 0;
+	while (done < amt) {
+		std::size_t index = (pos + done) / PAGED_PAGE_SIZE;
+		stream::pos off = (pos + done) % PAGED_PAGE_SIZE;
+		stream::len chunk = std::min<stream::len>(PAGED_PAGE_SIZE - off,
+			amt - done);
+		const page *pg = (*this->pages)[index].get();
+		if (pg) {
+			memcpy(buffer + done, pg->data() + off, chunk);
+		} else {
+			memset(buffer + done, 0, chunk);
+		}
+		done += chunk;
+	}
+	CAMOTO_STATS_READ(string, amt);
+	return amt;
+}
+
+void paged::seekg(stream::delta off, seek_from from)
+{
+	this->seek(off, from);
+	return;
+}
+
+stream::pos paged::tellg() const
+{
+	return this->offset;
+}
+
+stream::len paged::size() const
+{
+	return this->length;
+}
+
+const uint8_t *paged::view(stream::pos pos, stream::len len,
+	stream::len *got, std::string& scratch)
+{
+	if (pos > this->length) {
+		throw seek_error(createString("Cannot view beyond end of stream (offset "
+			<< pos << " > length " << this->length << ")"));
+	}
+	stream::len amt = std::min(len, this->length - pos);
+	if (amt == 0) {
+		*got = 0;
+		return zeroPage;
+	}
+	std::size_t index = pos / PAGED_PAGE_SIZE;
+	stream::pos off = pos % PAGED_PAGE_SIZE;
+	if (off + amt > PAGED_PAGE_SIZE) {
+		// Data crosses into the next page, so it has to be copied
+		return this->input::view(pos, len, got, scratch);
+	}
+	*got = amt;
+	const page *pg = (*this->pages)[index].get();
+	if (!pg) return zeroPage + off;
+	return pg->data() + off;
+}
+
+bool paged::cheap_view() const
+{
+	return true;
+}
+
+bool paged::identify(source_id *id) const
+{
+	id->content = this->tag.get();
+	id->offset = 0;
+	id->length = this->length;
+	return true;
+}
+
+stream::len paged::try_write(const uint8_t *buffer, stream::len len)
+{
+	stream::len w = this->paged::try_write_at(this->offset, buffer, len);
+	this->offset += w;
+	return w;
+}
+
+stream::len paged::try_write_at(stream::pos pos, const uint8_t *buffer,
+	stream::len len)
+{
+	if (pos > this->length) {
+		throw seek_error(createString("Cannot write beyond end of stream (offset "
+			<< pos << " > length " << this->length << ")"));
+	}
+	if (len == 0) return 0;
+
+	this->tag.changed();
+	stream::pos end = pos + len;
+	if (end > this->length) {
+		this->table().resize((end + PAGED_PAGE_SIZE - 1) / PAGED_PAGE_SIZE);
+		this->length = end;
+	}
+	stream::len done = 0;
+	while (done < len) {
+		std::size_t index = (pos + done) / PAGED_PAGE_SIZE;
+		stream::pos off = (pos + done) % PAGED_PAGE_SIZE;
+		stream::len chunk = std::min<stream::len>(PAGED_PAGE_SIZE - off,
+			len - done);
+		memcpy(this->writable(index) + off, buffer + done, chunk);
+		done += chunk;
+	}
+	CAMOTO_STATS_WRITE(string, len);
+	return len;
+}
+
+void paged::seekp(stream::delta off, seek_from from)
+{
+	this->seek(off, from);
+	return;
+}
+
+stream::pos paged::tellp() const
+{
+	return this->offset;
+}
+
+void paged::truncate(stream::pos size)
+{
+	this->tag.changed();
+	if (size > this->length) {
+		// Clear out anything left over in the last page from before an earlier
+		// truncate, as the stream is about to grow over the top of it.
+		stream::pos off = this->length % PAGED_PAGE_SIZE;
+		std::size_t index = this->length / PAGED_PAGE_SIZE;
+		if (off && (*this->pages)[index]) {
+			stream::len clear = std::min<stream::len>(PAGED_PAGE_SIZE - off,
+				size - this->length);
+			memset(this->writable(index) + off, 0, clear);
+		}
+	}
+	// Any new pages are left NULL, so they take up no memory
+	this->table().resize((size + PAGED_PAGE_SIZE - 1) / PAGED_PAGE_SIZE);
+	this->length = size;
+	try {
+		this->seek(size, stream::start);
+	} catch (const seek_error& e) {
+		throw write_error("Unable to seek to EOF after truncate: " + e.get_message());
+	}
+	return;
+}
+
+void paged::flush()
+{
+	return;
+}
+
+std::unique_ptr<paged> paged::snapshot() const
+{
+	std::unique_ptr<paged> copy(new paged());
+	copy->restore(*this);
+	return copy;
+}
+
+void paged::restore(const paged& from)
+{
+	if (&from == this) return;
+	this->tag.changed();
+	this->pages = from.pages;
+	this->length = from.length;
+	if (this->offset > this->length) this->offset = this->length;
+	return;
+}
+
+stream::len paged::buffered_bytes() const
+{
+	stream::len total = 0;
+	for (const auto& pg : *this->pages) {
+		if (pg) total += PAGED_PAGE_SIZE;
+	}
+	return total;
+}
+
+paged::page_table& paged::table()
+{
+	// If no other stream is using the table then no other stream can start
+	// using it either, since only this stream can make a snapshot of it.
+	if (this->pages.use_count() > 1) {
+		this->pages = std::make_shared<page_table>(*this->pages);
+	}
+	return *this->pages;
+}
+
+uint8_t *paged::writable(std::size_t index)
+{
+	std::shared_ptr<page>& pg = this->table()[index];
+	if (!pg) {
+		pg = newPage(nullptr);
+	} else if (pg.use_count() > 1) {
+		pg = newPage(pg.get());
+	}
+	return pg->data();
+}
+
+std::shared_ptr<paged::page> paged::newPage(const page *copy)
+{
+	std::shared_ptr<page> pg(
+		copy ? new page(*copy) : new page(PAGED_PAGE_SIZE),
+		[](page *p) {
+			memory::freed(memory::owner::paged, PAGED_PAGE_SIZE);
+			delete p;
+		}
+	);
+	memory::allocated(memory::owner::paged, PAGED_PAGE_SIZE);
+	return pg;
+}
+
+void paged::seek(stream::delta off, seek_from from)
+{
+	CAMOTO_STATS_SEEK(string);
+	stream::pos baseOffset;
+	switch (from) {
+		case cur:
+			baseOffset = this->offset;
+			break;
+		case end:
+			baseOffset = this->length;
+			break;
+		default:
+			baseOffset = 0;
+			break;
+	}
+	if ((off < 0) && (baseOffset < (unsigned)(off * -1))) {
+		throw seek_error("Cannot seek back past start of stream");
+	}
+	baseOffset += off;
+	if (baseOffset > this->length) {
+		throw seek_error(createString("Cannot seek beyond end of stream (offset "
+			<< baseOffset << " > length " << this->length << ")"));
+	}
+	this->offset = baseOffset;
+	return;
+}
+
+} // namespace stream
+} // namespace camoto
@@ -20,35 +20,48 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <errno.h>
+#include <camoto/stats.hpp>
+#include <camoto/stream_file.hpp>
 #include <camoto/stream_seg.hpp>
 #include <camoto/util.hpp>
 
 namespace camoto {
 namespace stream {
 
-seg::seg()
-{
-}
+/// Length of all the data in a piece table, which may be NULL.
+#define TREE_LEN(e)  ((e) ? (e)->lenTree : 0)
 
 seg::seg(std::unique_ptr<inout> parent)
 	:	parent(std::move(parent)),
-		off_parent(0),
-		off_endparent(this->parent->size()),
-		offset(0)
+		lenBudget((stream::len)-1),
+		lenSpill(0),
+		offset(0),
+		seed(2463534242u),
+		mem(memory::owner::seg)
 {
 	assert(this->parent);
+	stream::len lenParent = this->parent->size();
+	if (lenParent) this->root = this->newExtent(source::parent, 0, lenParent);
 	this->parent->seekp(0, stream::start);
 }
 
 seg::~seg()
 {
 	if (
-		(this->off_parent != 0)
-		|| (!this->vcSecond.empty())
-		|| (this->psegThird)
+		(!this->added.empty())
+		|| (this->lenSpill != 0)
+		|| (
+			this->root && (
+				this->root->left
+				|| this->root->right
+				|| (this->root->src != source::parent)
+				|| (this->root->off != 0)
+			)
+		)
 	) {
 		std::cerr << "Warning: stream::seg destroyed without flushing changes first!\n";
 	}
@@ -56,84 +69,23 @@ seg::~seg()
 
 stream::len seg::try_read(uint8_t *buffer, stream::len len)
 {
-	// Read the first stream
-	stream::pos lenReadFirst; // How much we read from the first stream
-	stream::pos lenRemaining = len; // How much left to read from second/third streams
-
-	// This is the "reported" end of the stream (what we tell anyone using this
-	// class.)
-	stream::pos lenEntireFirst = this->off_endparent - this->off_parent;
-
-	if (this->offset < lenEntireFirst) {
-		// Some of the read will happen in the first stream
-		stream::pos lenFirst;
-		if (this->offset + len > lenEntireFirst) {
-			lenFirst = lenEntireFirst - this->offset;
-			lenRemaining -= lenFirst;
-		} else {
-			lenFirst = lenRemaining;
-			lenRemaining = 0;
-		}
-		this->parent->seekg(this->offset + this->off_parent, stream::start);
-		lenReadFirst = this->parent->try_read(buffer, lenFirst);
-		this->offset += lenReadFirst;
-		if (lenReadFirst < lenFirst) {
-			// Didn't read the full amount from the first stream for some reason,
-			// this shouldn't happen unless there's a major problem with the
-			// underlying stream.
-			return lenReadFirst;
-		}
-		buffer += lenReadFirst;
-	} else {
-		lenReadFirst = 0;
-	}
-
-	// Read the second stream (the vector)
-	stream::pos lenReadSecond;
-	stream::len offSecondEnd = lenEntireFirst + this->vcSecond.size();
-	if ((lenRemaining > 0) && (this->offset < offSecondEnd)) {
-		// Some of the read will happen in the second stream
-		stream::pos lenSecond;
-		if (this->offset + lenRemaining > offSecondEnd) {
-			lenSecond = offSecondEnd - this->offset;
-		} else {
-			lenSecond = lenRemaining;
-		}
-		stream::pos offSecond = this->offset - lenEntireFirst;
-		assert(offSecond < this->vcSecond.size());
-		memcpy(buffer, &this->vcSecond[offSecond], lenSecond);
-		this->offset += lenSecond;
-		buffer += lenSecond;
-		lenReadSecond = lenSecond;
-		lenRemaining -= lenSecond;
-	} else {
-		lenReadSecond = 0;
-		// lenRemaining remains unchanged as == len
-	}
-
-	// Read the third stream (the child segmented_stream_device)
-	stream::pos lenReadThird;
-	if ((lenRemaining > 0) && (this->psegThird)) {
-		// Some of the read will happen in the third stream
-		lenReadThird = this->psegThird->try_read(buffer, lenRemaining);
-		this->offset += lenReadThird;
-	} else {
-		lenReadThird = 0;
-		// lenRemaining remains unchanged
-	}
+	stream::len r = this->seg::try_read_at(this->offset, buffer, len);
+	this->offset += r;
+	return r;
+}
 
-	// Return the number of bytes read
-	return lenReadFirst + lenReadSecond + lenReadThird;
+stream::len seg::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	stream::len r = this->transfer(this->root.get(), pos, buffer, len, false);
+	CAMOTO_STATS_READ(seg, r);
+	return r;
 }
 
 void seg::seekg(stream::delta off, seek_from from)
 {
-	// Calculate stream size
-	stream::pos lenFirst = this->off_endparent - this->off_parent;
-	stream::pos lenTotal = lenFirst;
-	lenTotal += this->vcSecond.size();
-	stream::pos offSecondEnd = lenTotal;
-	if (this->psegThird) lenTotal += this->psegThird->size();
+	CAMOTO_STATS_SEEK(seg);
+	stream::len lenTotal = this->size();
 
 	stream::pos baseOffset;
 	switch (from) {
@@ -156,19 +108,6 @@ void seg::seekg(stream::delta off, seek_from from)
 			<< baseOffset << " > length " << lenTotal << ")."));
 	}
 	this->offset = baseOffset;
-
-	// The seek pointer can't be updated here, because it's shared by all the
-	// descendent psegThird elements.
-
-	// But we can let the third source know where we'll come in when we read
-	// straight through later.
-	if (this->psegThird) {
-		if (this->offset >= offSecondEnd) {
-			this->psegThird->seekg(this->offset - offSecondEnd, stream::start);
-		} else {
-			this->psegThird->seekg(0, stream::start);
-		}
-	}
 	return;
 }
 
@@ -179,81 +118,38 @@ stream::pos seg::tellg() const
 
 stream::len seg::size() const
 {
-	std::streamsize lenTotal = this->off_endparent - this->off_parent
-		+ this->vcSecond.size();
-	if (this->psegThird) lenTotal += this->psegThird->size();
-	return lenTotal;
+	return TREE_LEN(this->root);
 }
 
-stream::len seg::try_write(const uint8_t *buffer, stream::len len)
+bool seg::identify(source_id *id) const
 {
-	// Write to the first stream
-	stream::pos lenWroteFirst; // How much we wrote to the first source
-	stream::pos lenRemaining = len; // How much left to write to the second/third sources
-	stream::pos lenEntireFirst = this->off_endparent - this->off_parent;
-
-	if (this->offset < lenEntireFirst) {
-		// Some of the write will happen in the first source
-		stream::pos lenFirst;
-		if (this->offset + len > lenEntireFirst) {
-			lenFirst = lenEntireFirst - this->offset;
-			lenRemaining -= lenFirst;
-		} else {
-			lenFirst = lenRemaining;
-			lenRemaining = 0;
-		}
-		this->parent->seekp(this->offset + this->off_parent, stream::start);
-		lenWroteFirst = this->parent->try_write(buffer, lenFirst);
-		this->offset += lenWroteFirst;
-		buffer += lenWroteFirst;
-		if (lenWroteFirst < lenFirst) {
-			// Didn't write the full amount from the first source for some reason
-			return lenWroteFirst;
-		}
-	} else {
-		lenWroteFirst = 0;
-	}
+	id->content = this->tag.get();
+	id->offset = 0;
+	id->length = this->size();
+	return true;
+}
 
-	// Write to the second stream (the vector)
-	stream::pos lenWroteSecond;
-	stream::len offSecondEnd = lenEntireFirst + this->vcSecond.size();
-	if ((lenRemaining > 0) && (this->offset < offSecondEnd)) {
-		// Some of the write will happen in the second source
-		stream::pos lenSecond;
-		if (this->offset + lenRemaining > offSecondEnd) {
-			// The write will go past the end of the second source
-			lenSecond = offSecondEnd - this->offset;
-			lenRemaining -= lenSecond;
-		} else {
-			lenSecond = lenRemaining;
-			lenRemaining = 0;
-		}
-		stream::pos offSecond = this->offset - lenEntireFirst;
-		assert(offSecond + lenSecond <= this->vcSecond.size());
-		memcpy(&this->vcSecond[offSecond], buffer, lenSecond);
-		this->offset += lenSecond;
-		buffer += lenSecond;
-		lenWroteSecond = lenSecond;
-	} else {
-		lenWroteSecond = 0;
-		// lenRemaining remains unchanged as == len
-	}
+stream::len seg::try_write(const uint8_t *buffer, stream::len len)
+{
+	stream::len w = this->seg::try_write_at(this->offset, buffer, len);
+	this->offset += w;
+	return w;
+}
 
-	// Write to the third source (the child segmented_stream_device)
-	stream::len lenWroteThird;
-	if ((lenRemaining > 0) && (this->psegThird)) {
-		// Some of the write will happen in the third stream
-		// No need to seek here, the segstream will do it when it realises the
-		// write is in its own first data source.
-		lenWroteThird = this->psegThird->try_write(buffer, lenRemaining);
-		this->offset += lenWroteThird;
-	} else {
-		lenWroteThird = 0;
-		// lenRemaining remains unchanged
+stream::len seg::try_write_at(stream::pos pos, const uint8_t *buffer,
+	stream::len len)
+{
+	if (pos > this->size()) {
+		throw seek_error(createString("Cannot write beyond end of segstream "
+			"(offset " << pos << " > length " << this->size() << ")."));
 	}
-
-	// Return the number of bytes written
-	return lenWroteFirst + lenWroteSecond + lenWroteThird;
+	this->tag.changed();
+	// Writes to data in the parent stream go straight through, as each byte in
+	// the parent appears at most once in the piece table.
+	stream::len w = this->transfer(this->root.get(), pos,
+		const_cast<uint8_t *>(buffer), len, true);
+	CAMOTO_STATS_WRITE(seg, w);
+	return w;
 }
 
 void seg::seekp(stream::delta off, seek_from from)
@@ -290,15 +186,16 @@ void seg::flush()
 	stream::len lenTotal = this->size();
 	if (plenStream < lenTotal) {
 		// When we're finished the underlying stream will be larger, so make sure
-		// it's big enough to hold the extra data.
+		// it's big enough to hold the extra data.  Reserving the space first lets
+		// a file be allocated in one go, instead of bit by bit as holes are
+		// filled in by commit().
+		this->parent->reserve(lenTotal);
 		this->parent->truncate(lenTotal);
 
 		// Make sure the stream expanded
 		// TODO: Should this be replaced by an exception?  Running out of disk
 		// space could trigger it.
 		plenStream = this->parent->size();
-		//this->parent->seekp(0, std::ios::end);
-		//stream::pos plenStream = this->parent->tellp();
 
 		// Ensure this isn't a broken stringstream
 		assert(plenStream > 0);
@@ -307,34 +204,23 @@ void seg::flush()
 		assert(plenStream == lenTotal);
 	}
 
-	// Call private commit()
-	this->commit(0);
-
-	// Safety checks
-	assert(this->off_parent == 0);
-	assert(this->vcSecond.empty());
-	assert(this->psegThird == NULL);
+	this->commit();
 
 	// Make sure the original calculation of the final size matches what we've
 	// ended up with after the 'flattening' operation.
-	assert(this->off_endparent == lenTotal);
+	assert(this->size() == lenTotal);
 
-	// Now that the data has been committed to the underlying stream, we only
-	// have a single source (confirmed above), which should hold all our data.
 	// This check makes sure the stream isn't too small, because if it is we've
 	// lost some data off the end!
-	// This can also happen (in the testing code) when something tries to seek
-	// past the end of a stringstream and then perform a write.
-	assert(plenStream >= this->off_endparent);
+	assert(plenStream >= lenTotal);
 
-	if (plenStream > this->off_endparent) {
+	if (plenStream > lenTotal) {
 		// Cut any excess off the end
-		this->parent->truncate(this->off_endparent);
+		this->parent->truncate(lenTotal);
 	}
 
 	// Sanity check to make sure the truncate worked
-	plenStream = this->parent->size();
-	assert(plenStream == this->off_endparent);
+	assert(this->parent->size() == lenTotal);
 
 	this->parent->flush();
 	return;
@@ -342,221 +228,283 @@ void seg::flush()
 
 void seg::insert(stream::len lenInsert)
 {
-	stream::pos lenFirst = this->off_endparent - this->off_parent;
-	if (this->offset < lenFirst) {
-		// The extra data is to be inserted within the first source
-		// TESTED BY: segstream_insert_c01
-
-		this->split();
-		// Make our second source lenInsert bytes long so it will become the newly
-		// inserted block of data.
-		this->vcSecond.resize(lenInsert);
-		assert(this->vcSecond.size() == lenInsert);
-	} else {
-		stream::len offSecondEnd = lenFirst + this->vcSecond.size();
-		if (this->offset <= offSecondEnd) {
-			// Extra data is to be inserted in the middle of the second source
-			// TESTED BY: segstream_insert_c02
+	if (lenInsert == 0) return;
+	this->tag.changed();
 
-			this->vcSecond.insert(this->vcSecond.begin() + (this->offset
-				- lenFirst), lenInsert, '\0');
-		} else {
-			// Extra data is to be inserted in the third source
-			// TESTED BY: segstream_insert_c03
+	std::unique_ptr<extent> block = this->allocate(lenInsert);
 
-			// Rebase the offset so that zero is the start of the child segstream
-			assert(this->psegThird);
-			this->psegThird->insert(lenInsert);
-		}
-	}
+	std::unique_ptr<extent> before, after;
+	this->splitTree(std::move(this->root), this->offset, &before, &after);
+	this->root = mergeTree(
+		mergeTree(std::move(before), std::move(block)),
+		std::move(after)
+	);
 	return;
 }
 
-void seg::remove(stream::len lenRemove)
+void seg::set_memory_budget(stream::len bytes)
 {
-	if (lenRemove == 0) return;
-
-	stream::pos lenFirst = this->off_endparent - this->off_parent;
-	if (this->offset < lenFirst) {
-		// The data to be removed is contained (or at least starts) in the first
-		// source.
-		if (this->offset + lenRemove >= lenFirst) {
-			// The block to remove goes past the end of the first data source, so
-			// we can just trim the first block, leaving the remainder to be handled
-			// below.
-			// TESTED BY: segstream_remove_c04
-			lenRemove -= lenFirst - this->offset;
-			lenFirst = this->offset;
-			this->off_endparent = this->off_parent + lenFirst;
-
-		} else if (this->offset == 0) {
-			// The remove is contained entirely within the first block, starting
-			// at the beginning.  So cut data off the start of the block.
-			// TESTED BY: segstream_remove_c01
-			this->off_parent += lenRemove;
-			assert(this->off_parent <= this->off_endparent);
-			return;
-		} else {
-			// The remove is contained entirely within the first block, so we'll have
-			// to split the first block and remove the data from the front of the
-			// new third block.
-			// TESTED BY: segstream_remove_c02
-			this->split();
-			this->psegThird->off_parent += lenRemove;
-			assert(this->psegThird->off_parent < this->psegThird->off_endparent);
-			return;
-		}
-	} // else none of the remove is contained in the first source
-
-	if (lenRemove == 0) return; // No more data to remove
-
-	// This can't be possible, otherwise we haven't removed data from the first
-	// source when we should have.
-	assert(this->offset >= lenFirst);
-
-	stream::len lenSecond = this->vcSecond.size();
-	stream::pos offSecondEnd = lenFirst + lenSecond;
-	if (this->offset < offSecondEnd) {
-		// There is some data to remove from the second source
-
-		if (this->offset == lenFirst) {
-			// The block to remove crosses the start of the second source, so we can
-			// just truncate data off the front.
-			if (lenRemove >= lenSecond) {
-				// The block to remove also reaches or crosses the end of the second
-				// source, i.e. the entire second source is to be removed.
-				// TESTED BY: segstream_remove_c05
-				this->vcSecond.clear();
-				lenRemove -= lenSecond;  // in case there's any leftovers
-			} else {
-				// Just some data off the front is to go
-				// TESTED BY: segstream_remove_c06
-				this->vcSecond.erase(this->vcSecond.begin(),
-					this->vcSecond.begin() + lenRemove);
-				lenRemove = 0;
-			}
-		} else {
-			// The remove doesn't start until somewhere in the middle of the second
-			// source.
-			stream::pos offCropStart = this->offset - lenFirst;
-			auto itCropStart = this->vcSecond.begin() + offCropStart;
-			auto itCropEnd = [&] {
-				if (offCropStart + lenRemove >= lenSecond) {
-					// It goes past the end though, so truncate some data off the end of
-					// the second source
-					// TESTED BY: segstream_remove_c07
-					lenRemove -= lenSecond - offCropStart;
-					return this->vcSecond.end();
-				} else {
-					// Removal is contained entirely within the second source
-					// TESTED BY: segstream_remove_c08
-					auto ret = itCropStart + lenRemove;
-					lenRemove = 0;
-					return ret;
-				}
-			}();
-			this->vcSecond.erase(itCropStart, itCropEnd);
-		}
-	}
-
-	// TESTED BY: segstream_remove_from_eof
-	if (lenRemove == 0) return; // No more data to remove
-
-	// If we've gotten this far there's still some data to remove from
-	// the third source.  We must have a third source, otherwise the caller is
-	// trying to remove too much data.
-	// TESTED BY: segstream_remove_c03
-	assert(this->psegThird);
-	this->psegThird->remove(lenRemove);
-
+	this->lenBudget = bytes;
 	return;
 }
 
-void seg::split()
+stream::len seg::buffered_bytes() const
 {
-	assert(this->offset < (this->off_endparent - this->off_parent));
-
-	// Create child segstream
-	std::unique_ptr<seg> psegNew(new seg);
-
-	psegNew->offset = 0;
-	// Copy parent to segstream's parent
-	psegNew->parent = parent;
-	// The new one ends where we used to end
-	psegNew->off_endparent = this->off_endparent;
-	// It starts at the current file pointer
-	psegNew->off_parent = this->off_parent + this->offset;
-	// And we now end at the current file pointer
-	this->off_endparent = psegNew->off_parent;
-	// Move our vcSecond to child segstream's vcSecond
-	psegNew->vcSecond = this->vcSecond;
-	this->vcSecond.clear();
-	// Move our psegThird to child segstream's psegThird
-	psegNew->psegThird = std::move(this->psegThird); // possibly NULL
-
-	// Make child segstream our psegThird, assuming no exceptions have been thrown
-	this->psegThird = std::move(psegNew);
-	return;
+	return this->added.capacity();
 }
 
-void seg::commit(stream::pos poffWriteFirst)
+std::unique_ptr<seg::extent> seg::allocate(stream::len lenInsert)
 {
-	assert(this->off_parent <= this->off_endparent);
+	// The new block refers to a run of zero bytes, which will be overwritten by
+	// the caller.
+	if (lenInsert <= this->lenBudget - std::min(this->lenBudget,
+		(stream::len)this->added.size()))
+	{
+		std::unique_ptr<extent> block = this->newExtent(source::added,
+			this->added.size(), lenInsert);
+		this->added.resize(this->added.size() + lenInsert, 0);
+		this->mem.set(this->added.capacity());
+		return block;
+	}
 
-	stream::pos lenFirst = this->off_endparent - this->off_parent;
-	stream::len lenSecond = this->vcSecond.size();
-	stream::pos poffWriteSecond = poffWriteFirst + lenFirst;
-	stream::pos poffWriteThird = poffWriteSecond + lenSecond;
+	// Over budget, so extend the spill file instead
+	if (!this->spill) this->spill = open_temp();
+	this->spill->truncate(this->lenSpill + lenInsert);
+	std::unique_ptr<extent> block = this->newExtent(source::spilled,
+		this->lenSpill, lenInsert);
+	this->lenSpill += lenInsert;
+	return block;
+}
 
-	if (this->off_parent > poffWriteFirst) {
-		// There's data off the front that needs to be trimmed, so move the
-		// first source back a bit.
-		stream::move(*this->parent, this->off_parent, poffWriteFirst, lenFirst);
+void seg::remove(stream::len lenRemove)
+{
+	if (lenRemove == 0) return;
+	this->tag.changed();
 
-		this->off_parent = poffWriteFirst;
-		this->off_endparent = poffWriteFirst + lenFirst;
+	stream::len lenTotal = this->size();
+	if (lenRemove > lenTotal - this->offset) {
+		throw write_error(createString("Cannot remove beyond end of segstream "
+			"(removing " << lenRemove << " bytes at offset " << this->offset
+			<< " from length " << lenTotal << ")."));
+	}
 
-		if (this->psegThird) this->psegThird->commit(poffWriteThird);
+	std::unique_ptr<extent> before, middle, after;
+	this->splitTree(std::move(this->root), this->offset, &before, &after);
+	this->splitTree(std::move(after), lenRemove, &middle, &after);
+	// Any added data in middle is left in the added buffer until the next flush
+	this->root = mergeTree(std::move(before), std::move(after));
+	return;
+}
 
-	} else if (this->off_parent < poffWriteFirst) {
-		// Data has been inserted before us, so we need to push the first source
-		// further into the file a bit.
+std::unique_ptr<seg::extent> seg::newExtent(source src, stream::pos off,
+	stream::len len)
+{
+	assert(len > 0);
+
+	// xorshift32, so the tree shape is the same on every run
+	this->seed ^= this->seed << 13;
+	this->seed ^= this->seed >> 17;
+	this->seed ^= this->seed << 5;
+
+	std::unique_ptr<extent> e(new extent);
+	e->src = src;
+	e->off = off;
+	e->len = len;
+	e->lenTree = len;
+	e->priority = this->seed;
+	return e;
+}
 
-		// Before we do that, we need to make sure the third source has been
-		// moved out of the way or we'll overwrite it!
-		if (this->psegThird) this->psegThird->commit(poffWriteThird);
+void seg::splitTree(std::unique_ptr<extent> tree, stream::pos at,
+	std::unique_ptr<extent> *before, std::unique_ptr<extent> *after)
+{
+	if (!tree) {
+		before->reset();
+		after->reset();
+		return;
+	}
+	stream::len lenLeft = TREE_LEN(tree->left);
+	if (at <= lenLeft) {
+		this->splitTree(std::move(tree->left), at, before, &tree->left);
+		tree->lenTree = TREE_LEN(tree->left) + tree->len + TREE_LEN(tree->right);
+		*after = std::move(tree);
+	} else if (at >= lenLeft + tree->len) {
+		this->splitTree(std::move(tree->right), at - lenLeft - tree->len,
+			&tree->right, after);
+		tree->lenTree = TREE_LEN(tree->left) + tree->len + TREE_LEN(tree->right);
+		*before = std::move(tree);
+	} else {
+		// The split point is inside this extent, so cut it in two
+		stream::pos within = at - lenLeft;
+		std::unique_ptr<extent> tail = this->newExtent(tree->src,
+			tree->off + within, tree->len - within);
+		tree->len = within;
+		*after = mergeTree(std::move(tail), std::move(tree->right));
+		tree->lenTree = TREE_LEN(tree->left) + tree->len;
+		*before = std::move(tree);
+	}
+	return;
+}
 
-		// Then move the first source forward a bit
-		stream::move(*this->parent, this->off_parent, poffWriteFirst, lenFirst);
+std::unique_ptr<seg::extent> seg::mergeTree(std::unique_ptr<extent> before,
+	std::unique_ptr<extent> after)
+{
+	if (!before) return after;
+	if (!after) return before;
+	if (before->priority > after->priority) {
+		before->right = mergeTree(std::move(before->right), std::move(after));
+		before->lenTree = TREE_LEN(before->left) + before->len
+			+ TREE_LEN(before->right);
+		return before;
+	}
+	after->left = mergeTree(std::move(before), std::move(after->left));
+	after->lenTree = TREE_LEN(after->left) + after->len + TREE_LEN(after->right);
+	return after;
+}
 
-		this->off_parent = poffWriteFirst;
-		this->off_endparent = poffWriteFirst + lenFirst;
+stream::len seg::transfer(extent *e, stream::pos pos, uint8_t *buffer,
+	stream::len len, bool write)
+{
+	if (!e || (len == 0)) return 0;
+
+	stream::len done = 0;
+	stream::len lenLeft = TREE_LEN(e->left);
+	if (pos < lenLeft) {
+		// Some of the data is in the extents before this one
+		stream::len lenWant = std::min(len, lenLeft - pos);
+		stream::len lenDone = this->transfer(e->left.get(), pos, buffer, lenWant,
+			write);
+		done += lenDone;
+		if (lenDone < lenWant) return done;
+		buffer += lenDone;
+		len -= lenDone;
+		pos = lenLeft;
+	}
 
-	} else {
-		// First source isn't moving, so (possibly) make room for the second
-		// source and commit the third source.
+	if ((len > 0) && (pos < lenLeft + e->len)) {
+		// Some of the data is in this extent
+		stream::pos within = pos - lenLeft;
+		stream::len lenWant = std::min(len, e->len - within);
+		stream::len lenDone;
+		if (e->src == source::parent) {
+			if (write) {
+				lenDone = this->parent->try_write_at(e->off + within, buffer,
+					lenWant);
+			} else {
+				lenDone = this->parent->try_read_at(e->off + within, buffer, lenWant);
+			}
+		} else if (e->src == source::added) {
+			uint8_t *data = &this->added[e->off + within];
+			if (write) memcpy(data, buffer, lenWant);
+			else memcpy(buffer, data, lenWant);
+			lenDone = lenWant;
+		} else {
+			if (write) {
+				lenDone = this->spill->try_write_at(e->off + within, buffer, lenWant);
+			} else {
+				lenDone = this->spill->try_read_at(e->off + within, buffer, lenWant);
+			}
+		}
+		done += lenDone;
+		if (lenDone < lenWant) {
+			// Didn't transfer the full amount from the parent for some reason,
+			// this shouldn't happen unless there's a major problem with the
+			// underlying stream.
+			return done;
+		}
+		buffer += lenDone;
+		len -= lenDone;
+		pos += lenDone;
+	}
 
-		// poffWriteSecond doesn't need to change
+	if (len > 0) {
+		// The rest of the data is in the extents after this one
+		done += this->transfer(e->right.get(), pos - lenLeft - e->len, buffer,
+			len, write);
+	}
+	return done;
+}
 
-		// Write out the third source straight after where the second one will end.
-		if (this->psegThird) this->psegThird->commit(poffWriteThird);
+void seg::collect(const extent *e, std::vector<const extent *> *list) const
+{
+	if (!e) return;
+	this->collect(e->left.get(), list);
+	list->push_back(e);
+	this->collect(e->right.get(), list);
+	return;
+}
 
+std::vector<seg::commit_op> seg::plan() const
+{
+	std::vector<const extent *> list;
+	this->collect(this->root.get(), &list);
+
+	// Work out where each extent will end up once everything is flattened,
+	// combining neighbours that can be copied in one go.
+	std::vector<commit_op> steps;
+	stream::pos poffWrite = 0;
+	for (auto& e : list) {
+		if (
+			!steps.empty()
+			&& (steps.back().src == e->src)
+			&& (steps.back().off + steps.back().len == e->off)
+		) {
+			steps.back().len += e->len;
+		} else {
+			steps.push_back({e->src, e->off, poffWrite, e->len});
+		}
+		poffWrite += e->len;
 	}
 
-	// Write out the second source to the underlying stream
-	if (lenSecond) {
-		this->parent->seekp(poffWriteSecond, stream::start);
-		this->parent->try_write(&this->vcSecond[0], lenSecond);
-		this->vcSecond.clear();
-		this->off_endparent += lenSecond;
+	std::vector<commit_op> ops;
+	ops.reserve(steps.size());
+	for (auto& s : steps) {
+		if ((s.src == source::parent) && (s.off > s.dest)) ops.push_back(s);
+	}
+	for (auto s = steps.rbegin(); s != steps.rend(); s++) {
+		if ((s->src == source::parent) && (s->off < s->dest)) ops.push_back(*s);
+	}
+	for (auto& s : steps) {
+		if (s.src != source::parent) ops.push_back(s);
 	}
+	return ops;
+}
 
-	if (this->psegThird) {
-		this->off_endparent += this->psegThird->size();
-		this->psegThird->off_parent = 0; // prevent warning in destructor
-		this->psegThird.reset();
+void seg::commit()
+{
+	CAMOTO_STATS_COMMIT();
+	stream::len lenTotal = this->size();
+	std::vector<uint8_t> buffer;
+	for (auto& op : this->plan()) {
+		if (op.src == source::parent) {
+			stream::move(*this->parent, op.off, op.dest, op.len);
+		} else if (op.src == source::added) {
+			stream::len w = this->parent->try_write_at(op.dest,
+				&this->added[op.off], op.len);
+			if (w < op.len) throw incomplete_write(w);
+		} else {
+			// Stream the spilled data back a block at a time
+			if (buffer.empty()) buffer.resize(FILE_BUFFER_SIZE);
+			stream::len done = 0;
+			while (done < op.len) {
+				stream::len amt = std::min(op.len - done, (stream::len)buffer.size());
+				stream::len r = this->spill->try_read_at(op.off + done, &buffer[0],
+					amt);
+				if (r < amt) throw incomplete_read(done + r);
+				stream::len w = this->parent->try_write_at(op.dest + done, &buffer[0],
+					amt);
+				if (w < amt) throw incomplete_write(done + w);
+				done += amt;
+			}
+		}
 	}
 
+	this->root.reset();
+	if (lenTotal) this->root = this->newExtent(source::parent, 0, lenTotal);
+	std::vector<uint8_t>().swap(this->added);
+	this->mem.set(0);
+	this->spill.reset();
+	this->lenSpill = 0;
 	return;
 }
 
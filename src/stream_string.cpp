@@ -18,24 +18,68 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <errno.h>
 #include <string.h>
+#include <utility>
+#include <camoto/stats.hpp>
 #include <camoto/stream_string.hpp>
 #include <camoto/util.hpp>
 
 namespace camoto {
 namespace stream {
 
-string_core::string_core(std::string data)
-	:	data(data),
-		offset(0)
+string_core::string_core(std::string data, memory::owner type)
+	:	data(std::move(data)),
+		offset(0),
+		mem(type)
+{
+	this->account();
+}
+
+string_core::~string_core()
+{
+}
+
+std::string string_core::release()
 {
+	std::string content(std::move(this->data));
+	this->data.clear();
+	this->tag.changed();
+	this->offset = 0;
+	this->account();
+	return content;
+}
+
+void string_core::reserve(stream::len len)
+{
+	this->data.reserve(len);
+	this->account();
+	return;
+}
+
+stream::len string_core::buffered_bytes() const
+{
+	return this->data.capacity();
+}
+
+void string_core::account()
+{
+	this->mem.set(this->buffered_bytes());
+	return;
 }
 
 void string_core::seek(stream::delta off, seek_from from)
 {
+	this->seek(off, from, this->data.length());
+	return;
+}
+
+void string_core::seek(stream::delta off, seek_from from, stream::len size)
+{
+	CAMOTO_STATS_SEEK(string);
 	stream::pos baseOffset;
-	std::string::size_type stringSize = this->data.length();
+	stream::len stringSize = size;
 	switch (from) {
 		case cur:
 			baseOffset = this->offset;
@@ -66,22 +110,29 @@ input_string::input_string()
 }
 
 input_string::input_string(std::string content)
-	:	string_core(content)
+	:	string_core(std::move(content))
 {
 }
 
 stream::len input_string::try_read(uint8_t *buffer, stream::len len)
 {
-	stream::pos done = this->offset + len;
-	stream::pos size = this->data.length();
-	stream::len amt;
-	if (done > size) amt = size - this->offset;
-	else amt = len;
-	memcpy(buffer, this->data.data() + this->offset, amt);
+	stream::len amt = this->input_string::try_read_at(this->offset, buffer,
+		len);
 	this->offset += amt;
 	return amt;
 }
 
+stream::len input_string::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	stream::pos size = this->data.length();
+	if (pos >= size) return 0;
+	stream::len amt = std::min(len, size - pos);
+	memcpy(buffer, this->data.data() + pos, amt);
+	CAMOTO_STATS_READ(string, amt);
+	return amt;
+}
+
 void input_string::seekg(stream::delta off, seek_from from)
 {
 	this->seek(off, from);
@@ -98,6 +149,31 @@ stream::len input_string::size() const
 	return this->data.length();
 }
 
+const uint8_t *input_string::view(stream::pos pos, stream::len len,
+	stream::len *got, std::string& scratch)
+{
+	stream::len size = this->data.length();
+	if (pos > size) {
+		throw seek_error(createString("Cannot view beyond end of string (offset "
+			<< pos << " > length " << size << ")"));
+	}
+	*got = std::min(len, size - pos);
+	return (const uint8_t *)this->data.data() + pos;
+}
+
+bool input_string::cheap_view() const
+{
+	return true;
+}
+
+bool input_string::identify(source_id *id) const
+{
+	id->content = this->tag.get();
+	id->offset = 0;
+	id->length = this->data.length();
+	return true;
+}
+
 
 output_string::output_string()
 	: string_core(std::string())
@@ -106,20 +182,30 @@ output_string::output_string()
 
 stream::len output_string::try_write(const uint8_t *buffer, stream::len len)
 {
-	stream::pos done = this->offset + len;
+	stream::len w = this->output_string::try_write_at(this->offset, buffer,
+		len);
+	this->offset += w;
+	return w;
+}
+
+stream::len output_string::try_write_at(stream::pos pos,
+	const uint8_t *buffer, stream::len len)
+{
 	stream::pos size = this->data.length();
+	if (pos > size) {
+		throw seek_error(createString("Cannot write beyond end of string (offset "
+			<< pos << " > length " << size << ")"));
+	}
+	if (len == 0) return 0;
+
+	this->tag.changed();
+	stream::pos done = pos + len;
 	if (done > size) {
 		this->data.resize(done);
-	} else if (size == 0) {
-		// Empty write to an empty string
-		return 0;
+		this->account();
 	}
-
-	// Make sure our final assumed memory at least matches the real one.
-	//assert(this->data.data() + done - 1 == &this->data.at(done - 1));
-
-	memcpy(&this->data.at(0) + this->offset, buffer, len);
-	this->offset += len;
+	memcpy(&this->data[0] + pos, buffer, len);
+	CAMOTO_STATS_WRITE(string, len);
 	return len;
 }
 
@@ -136,8 +222,10 @@ stream::pos output_string::tellp() const
 
 void output_string::truncate(stream::pos size)
 {
+	this->tag.changed();
 	try {
 		this->data.resize(size);
+		this->account();
 		this->seek(size, stream::start);
 	} catch (const seek_error& e) {
 		throw write_error("Unable to seek to EOF after truncate: " + e.get_message());
@@ -150,6 +238,12 @@ void output_string::flush()
 	return;
 }
 
+void output_string::reserve(stream::len len)
+{
+	this->string_core::reserve(len);
+	return;
+}
+
 
 string::string()
 	: string_core(std::string())
@@ -157,8 +251,84 @@ string::string()
 }
 
 string::string(std::string content)
-	:	string_core(content)
+	:	string_core(std::move(content))
+{
+}
+
+
+input_span::input_span(const uint8_t *data, stream::len len)
+	:	base(data),
+		length(len),
+		offset(0)
+{
+}
+
+stream::len input_span::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::len amt = this->input_span::try_read_at(this->offset, buffer, len);
+	this->offset += amt;
+	return amt;
+}
+
+stream::len input_span::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	if (pos >= this->length) return 0;
+	stream::len amt = std::min(len, this->length - pos);
+	memcpy(buffer, this->base + pos, amt);
+	return amt;
+}
+
+void input_span::seekg(stream::delta off, seek_from from)
+{
+	stream::pos baseOffset;
+	switch (from) {
+		case cur:
+			baseOffset = this->offset;
+			break;
+		case end:
+			baseOffset = this->length;
+			break;
+		default:
+			baseOffset = 0;
+			break;
+	}
+	if ((off < 0) && (baseOffset < (unsigned)(off * -1))) {
+		throw seek_error("Cannot seek back past start of memory block");
+	}
+	baseOffset += off;
+	if (baseOffset > this->length) {
+		throw seek_error(createString("Cannot seek beyond end of memory block "
+			"(offset " << baseOffset << " > length " << this->length << ")"));
+	}
+	this->offset = baseOffset;
+	return;
+}
+
+stream::pos input_span::tellg() const
+{
+	return this->offset;
+}
+
+stream::len input_span::size() const
+{
+	return this->length;
+}
+
+const uint8_t *input_span::view(stream::pos pos, stream::len len,
+	stream::len *got, std::string& scratch)
+{
+	if (pos > this->length) {
+		throw seek_error(createString("Cannot view beyond end of memory block "
+			"(offset " << pos << " > length " << this->length << ")"));
+	}
+	*got = std::min(len, this->length - pos);
+	return this->base + pos;
+}
+
+bool input_span::cheap_view() const
 {
+	return true;
 }
 
 } // namespace stream
@@ -18,35 +18,178 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <errno.h>
+#include <vector>
+#include <camoto/stats.hpp>
 #include <camoto/stream_sub.hpp>
 #include <camoto/util.hpp>
 
 namespace camoto {
 namespace stream {
 
+sub_registry::sub_registry()
+	:	count(0),
+		seed(2463534242u),
+		version(1)
+{
+}
+
+sub_registry::~sub_registry()
+{
+}
+
+void sub_registry::shift(stream::pos pos, stream::delta off)
+{
+	if (off == 0) return;
+	std::unique_ptr<node> before, after;
+	splitTree(std::move(this->root), pos, &before, &after);
+	if (after) {
+		if (off < 0) assert(pos >= (unsigned)(off * -1));
+		after->shift += off;
+	}
+	this->root = mergeTree(std::move(before), std::move(after));
+	if (this->root) this->root->parent = nullptr;
+	this->version++;
+	return;
+}
+
+std::size_t sub_registry::size() const
+{
+	return this->count;
+}
+
+sub_registry::node *sub_registry::add(stream::pos start)
+{
+	// xorshift32, so the tree shape is the same on every run
+	this->seed ^= this->seed << 13;
+	this->seed ^= this->seed >> 17;
+	this->seed ^= this->seed << 5;
+
+	std::unique_ptr<node> n(new node);
+	n->start = start;
+	n->shift = 0;
+	n->priority = this->seed;
+	n->parent = nullptr;
+	node *ret = n.get();
+
+	std::unique_ptr<node> before, after;
+	splitTree(std::move(this->root), start, &before, &after);
+	this->root = mergeTree(mergeTree(std::move(before), std::move(n)),
+		std::move(after));
+	this->root->parent = nullptr;
+	this->count++;
+	return ret;
+}
+
+void sub_registry::remove(node *n)
+{
+	// Apply pending shifts from the root down, so nothing is lost when the
+	// node's children are moved up the tree.
+	std::vector<node *> path;
+	for (node *p = n; p; p = p->parent) path.push_back(p);
+	for (auto i = path.rbegin(); i != path.rend(); i++) push(*i);
+
+	std::unique_ptr<node> *slot;
+	if (!n->parent) slot = &this->root;
+	else if (n->parent->left.get() == n) slot = &n->parent->left;
+	else slot = &n->parent->right;
+
+	node *parent = n->parent;
+	std::unique_ptr<node> replacement = mergeTree(std::move(n->left),
+		std::move(n->right));
+	if (replacement) replacement->parent = parent;
+	*slot = std::move(replacement); // destroys n
+	this->count--;
+	this->version++;
+	return;
+}
+
+stream::pos sub_registry::start_of(const node *n) const
+{
+	stream::delta total = 0;
+	for (const node *p = n; p; p = p->parent) total += p->shift;
+	return n->start + total;
+}
+
+void sub_registry::push(node *n)
+{
+	if (n->shift == 0) return;
+	n->start += n->shift;
+	if (n->left) n->left->shift += n->shift;
+	if (n->right) n->right->shift += n->shift;
+	n->shift = 0;
+	return;
+}
+
+void sub_registry::splitTree(std::unique_ptr<node> tree, stream::pos at,
+	std::unique_ptr<node> *before, std::unique_ptr<node> *after)
+{
+	if (!tree) {
+		before->reset();
+		after->reset();
+		return;
+	}
+	// Pending shifts above this node have already been pushed down to here
+	push(tree.get());
+	if (tree->start >= at) {
+		splitTree(std::move(tree->left), at, before, &tree->left);
+		if (tree->left) tree->left->parent = tree.get();
+		*after = std::move(tree);
+	} else {
+		splitTree(std::move(tree->right), at, &tree->right, after);
+		if (tree->right) tree->right->parent = tree.get();
+		*before = std::move(tree);
+	}
+	return;
+}
+
+std::unique_ptr<sub_registry::node> sub_registry::mergeTree(
+	std::unique_ptr<node> before, std::unique_ptr<node> after)
+{
+	if (!before) return after;
+	if (!after) return before;
+	if (before->priority > after->priority) {
+		push(before.get());
+		before->right = mergeTree(std::move(before->right), std::move(after));
+		before->right->parent = before.get();
+		return before;
+	}
+	push(after.get());
+	after->left = mergeTree(std::move(before), std::move(after->left));
+	after->left->parent = after.get();
+	return after;
+}
+
+
 sub_core::sub_core(pos start, len len)
 	:	offset(0),
+		slack(0),
 		stream_start(start),
-		stream_len(len)
+		stream_len(len),
+		entry(nullptr),
+		cachedStart(0),
+		cachedVersion(0)
 {
 }
 
 sub_core::~sub_core()
 {
+	if (this->entry) this->registry->remove(this->entry);
 }
 
 void sub_core::seek(stream::delta off, seek_from from)
 {
+	CAMOTO_STATS_SEEK(sub);
 	stream::pos baseOffset;
 	switch (from) {
 		case cur:
 			baseOffset = this->offset;
 			break;
 		case end:
-			baseOffset = this->sub_size();
+			baseOffset = this->data_size();
 			break;
 		default:
 			baseOffset = 0;
@@ -56,9 +199,9 @@ void sub_core::seek(stream::delta off, seek_from from)
 		throw seek_error("Cannot seek back past start of substream");
 	}
 	baseOffset += off;
-	if (baseOffset > this->sub_size()) {
+	if (baseOffset > this->data_size()) {
 		throw seek_error(createString("Cannot seek beyond end of substream (offset "
-			<< baseOffset << " > length " << this->sub_size() << ")"));
+			<< baseOffset << " > length " << this->data_size() << ")"));
 	}
 	this->offset = baseOffset;
 	return;
@@ -67,12 +210,20 @@ void sub_core::seek(stream::delta off, seek_from from)
 void sub_core::relocate(stream::delta off)
 {
 	// Don't seek past the start of the parent stream
-	if (off < 0) assert(this->stream_start >= (unsigned)(off * -1));
+	if (off < 0) assert(this->sub_start() >= (unsigned)(off * -1));
 
 	// Don't seek beyond the end of the parent stream
 	//assert(this->stream_start + off + this->stream_len < this->parent->size());
 	// Can't do this as we don't have access to any parent stream here
 
+	if (this->entry) {
+		// Take this stream out of the registry and put it back in its new place
+		stream::pos start = this->registry->start_of(this->entry);
+		this->registry->remove(this->entry);
+		this->entry = this->registry->add(start + off);
+		return;
+	}
+
 	this->stream_start += off;
 	return;
 }
@@ -80,6 +231,7 @@ void sub_core::relocate(stream::delta off)
 void sub_core::resize(stream::len len)
 {
 	this->stream_len = len;
+	this->slack = 0;
 
 	// Clip pointer if the resize has made it go past EOF
 	if (this->offset > this->stream_len) this->offset = this->stream_len;
@@ -88,7 +240,25 @@ void sub_core::resize(stream::len len)
 
 stream::pos sub_core::sub_start() const
 {
-	return this->stream_start;
+	if (!this->entry) return this->stream_start;
+	if (this->cachedVersion != this->registry->version) {
+		this->cachedStart = this->registry->start_of(this->entry);
+		this->cachedVersion = this->registry->version;
+	}
+	return this->cachedStart;
+}
+
+void sub_core::set_registry(std::shared_ptr<sub_registry> registry)
+{
+	stream::pos start = this->sub_start();
+	if (this->entry) {
+		this->registry->remove(this->entry);
+		this->entry = nullptr;
+	}
+	this->stream_start = start;
+	this->registry = registry;
+	if (this->registry) this->entry = this->registry->add(start);
+	return;
 }
 
 stream::len sub_core::sub_size() const
@@ -96,46 +266,61 @@ stream::len sub_core::sub_size() const
 	return this->stream_len;
 }
 
+stream::len sub_core::data_size() const
+{
+	return this->sub_size() - this->slack;
+}
+
 
 input_sub::input_sub(std::shared_ptr<input> parent, pos start, len len)
 	:	sub_core(start, len),
-		in_parent(parent)
+		in_parent(std::move(parent))
+{
+}
+
+input_sub::input_sub(input& parent, pos start, len len)
+	:	input_sub(borrow(parent), start, len)
 {
 }
 
 stream::len input_sub::try_read(uint8_t *buffer, stream::len len)
 {
 	// Make sure we didn't somehow end up past the end of the stream
-	assert(this->offset <= this->sub_size());
+	assert(this->offset <= this->data_size());
 
-	if (this->offset >= this->sub_size()) return 0; // EOF
+	stream::len r = this->input_sub::try_read_at(this->offset, buffer, len);
+	this->offset += r;
 
-	// Make sure we can't read past the end of the file
-	if ((this->offset + len) > this->sub_size()) {
-		len = this->sub_size() - this->offset;
-	}
+	// Make sure we didn't somehow end up past the end of the stream
+	assert(this->offset <= this->data_size());
 
-	this->in_parent->seekg(this->sub_start() + this->offset, stream::start);
+	return r;
+}
 
-	stream::len r = this->in_parent->try_read(buffer, len);
-	assert(r <= len);
-	this->offset += r;
+stream::len input_sub::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	if (pos >= this->data_size()) return 0; // EOF
 
-	// Make sure we didn't somehow end up past the end of the stream
-	assert(this->offset <= this->sub_size());
+	// Make sure we can't read past the end of the file
+	if (len > this->data_size() - pos) len = this->data_size() - pos;
 
+	stream::len r = this->in_parent->try_read_at(this->sub_start() + pos,
+		buffer, len);
+	assert(r <= len);
+	CAMOTO_STATS_READ(sub, r);
 	return r;
 }
 
 void input_sub::seekg(stream::delta off, seek_from from)
 {
 	// Make sure we didn't somehow end up past the end of the stream
-	assert(this->offset <= this->sub_size());
+	assert(this->offset <= this->data_size());
 
 	this->seek(off, from);
 
 	// Make sure we didn't somehow end up past the end of the stream
-	assert(this->offset <= this->sub_size());
+	assert(this->offset <= this->data_size());
 	return;
 }
 
@@ -146,66 +331,118 @@ stream::pos input_sub::tellg() const
 
 stream::len input_sub::size() const
 {
-	return this->sub_size();
+	return this->data_size();
+}
+
+bool input_sub::identify(source_id *id) const
+{
+	source_id parent;
+	if (!this->in_parent->identify(&parent)) return false;
+	id->content = parent.content;
+	id->offset = parent.offset + this->sub_start();
+	id->length = this->data_size();
+	return true;
+}
+
+const uint8_t *input_sub::view(stream::pos pos, stream::len len,
+	stream::len *got, std::string& scratch)
+{
+	if (pos > this->data_size()) {
+		throw seek_error(createString("Cannot view beyond end of substream (offset "
+			<< pos << " > length " << this->data_size() << ")"));
+	}
+	if (len > this->data_size() - pos) len = this->data_size() - pos;
+	return this->in_parent->view(this->sub_start() + pos, len, got, scratch);
+}
+
+bool input_sub::cheap_view() const
+{
+	return this->in_parent->cheap_view();
+}
+
+std::future<stream::len> input_sub::async_read_at(stream::pos pos,
+	uint8_t *buffer, stream::len len)
+{
+	if (pos >= this->data_size()) return ready_read(0); // EOF
+	if (len > this->data_size() - pos) len = this->data_size() - pos;
+	return this->in_parent->async_read_at(this->sub_start() + pos, buffer, len);
+}
+
+void input_sub::hint(access_pattern pattern)
+{
+	this->in_parent->hint(pattern);
+	return;
 }
 
 
 output_sub::output_sub(std::shared_ptr<output> parent, pos start, len len,
 	fn_truncate_sub fn_resize)
 	:	sub_core(start, len),
-		out_parent(parent),
-		fn_resize(fn_resize)
+		out_parent(std::move(parent)),
+		fn_resize(std::move(fn_resize)),
+		growth(false),
+		lenHint(0)
 {
 }
 
 stream::len output_sub::try_write(const uint8_t *buffer, stream::len len)
 {
 	// Make sure we didn't somehow end up past the end of the stream
-	assert(this->offset <= this->sub_size());
-
-	if ((this->offset + len) > this->sub_size()) {
-		// Stream is too small to accommodate entire write, attempt to enlarge
-		// Don't call truncate() because we don't want the pointer moved
-		try {
-			if (this->fn_resize) {
-				this->fn_resize(this, this->offset + len);
-				if ((this->offset + len) > this->sub_size()) {
-					// Truncate failed, reduce write to available space
-					len = this->sub_size() - this->offset;
-				}
-			} else {
-				std::cerr << "[stream::sub::try_write] No truncate function, cannot "
-					"enlarge substream.  Doing a partial write." << std::endl;
-			}
-		} catch (const write_error&) {
-			// Truncate failed, reduce write to available space
-			len = this->sub_size() - this->offset;
-		}
-	}
+	assert(this->offset <= this->data_size());
 
+	stream::len w;
 	try {
-		this->out_parent->seekp(this->sub_start() + this->offset, stream::start);
+		w = this->output_sub::try_write_at(this->offset, buffer, len);
 	} catch (const seek_error&) {
 		return 0;
 	}
-	stream::pos w = this->out_parent->try_write(buffer, len);
 	this->offset += w;
 
 	// Make sure we didn't somehow end up past the end of the stream
-	assert(this->offset <= this->sub_size());
+	assert(this->offset <= this->data_size());
 
 	return w;
 }
 
+stream::len output_sub::try_write_at(stream::pos pos, const uint8_t *buffer,
+	stream::len len)
+{
+	if (pos > this->data_size()) {
+		throw seek_error(createString("Cannot write beyond end of substream "
+			"(offset " << pos << " > length " << this->data_size() << ")"));
+	}
+
+	if ((pos + len) > this->data_size()) {
+		stream::pos end = pos + len;
+		if (end > this->sub_size()) {
+			// Stream is too small to accommodate entire write, attempt to enlarge
+			// Don't call truncate() because we don't want the pointer moved
+			this->enlarge(end);
+			if (end > this->sub_size()) {
+				// Truncate failed, reduce write to available space
+				end = this->sub_size();
+				len = end - pos;
+			}
+		}
+		// Anything past the end of this write is space reserved for later
+		this->slack = this->sub_size() - end;
+	}
+
+	stream::len w = this->out_parent->try_write_at(this->sub_start() + pos,
+		buffer, len);
+	CAMOTO_STATS_WRITE(sub, w);
+	return w;
+}
+
 void output_sub::seekp(stream::delta off, seek_from from)
 {
 	// Make sure we didn't somehow end up past the end of the stream
-	assert(this->offset <= this->sub_size());
+	assert(this->offset <= this->data_size());
 
 	this->seek(off, from);
 
 	// Make sure we didn't somehow end up past the end of the stream
-	assert(this->offset <= this->sub_size());
+	assert(this->offset <= this->data_size());
 	return;
 }
 
@@ -216,7 +453,7 @@ stream::pos output_sub::tellp() const
 
 void output_sub::truncate(stream::pos size)
 {
-	if (this->sub_size() == size) return; // nothing to do
+	if ((this->data_size() == size) && (this->slack == 0)) return; // nothing to do
 	if (!this->fn_resize) {
 		throw write_error("Cannot truncate substream, no callback function was "
 			"provided to notify the substream owner.");
@@ -232,18 +469,67 @@ void output_sub::truncate(stream::pos size)
 	return;
 }
 
+void output_sub::reserve(stream::len len)
+{
+	this->out_parent->reserve(this->sub_start() + len);
+	return;
+}
+
 void output_sub::flush()
 {
+	if (this->slack && this->fn_resize) {
+		// Give back any reserved space that wasn't used
+		this->fn_resize(this, this->data_size());
+	}
 	this->out_parent->flush();
 	return;
 }
 
+void output_sub::set_growth(bool enable, stream::len hint)
+{
+	this->growth = enable;
+	this->lenHint = hint;
+	return;
+}
+
+void output_sub::enlarge(stream::len len)
+{
+	if (!this->fn_resize) {
+		std::cerr << "[stream::sub::try_write] No truncate function, cannot "
+			"enlarge substream.  Doing a partial write." << std::endl;
+		return;
+	}
+	if (this->growth) {
+		stream::len want = std::max(len,
+			std::max(this->sub_size() * 2, this->lenHint));
+		if (want > len) {
+			try {
+				this->fn_resize(this, want);
+				if (this->sub_size() >= len) return;
+			} catch (const write_error&) {
+				// Couldn't get the extra space, so just ask for what's needed
+			}
+		}
+	}
+	try {
+		this->fn_resize(this, len);
+	} catch (const write_error&) {
+		// Caller will reduce write to available space
+	}
+	return;
+}
+
 
 sub::sub(std::shared_ptr<inout> parent, pos start, len len,
 	fn_truncate_sub fn_resize)
 	:	sub_core(start, len),
 		input_sub(parent, start, len),
-		output_sub(parent, start, len, fn_resize)
+		output_sub(std::move(parent), start, len, std::move(fn_resize))
+{
+}
+
+sub::sub(inout& parent, pos start, len len, fn_truncate_sub fn_resize)
+	:	sub(borrow(parent), start, len, std::move(fn_resize))
 {
 }
 
@@ -0,0 +1,302 @@
+/**
+ * @file   stream_traced.cpp
+ * @brief  Record every access made to a stream, so it can be replayed later.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <camoto/stream_traced.hpp>
+#include <camoto/util.hpp>
+
+namespace camoto {
+namespace stream {
+
+/// Signature at the start of every trace log.
+static const char TRACE_SIGNATURE[] = "CTR1";
+
+/// Number of signature bytes.
+static const unsigned int TRACE_SIGNATURE_LEN = 4;
+
+/// Bit set in the type byte of positional reads and writes.
+static const uint8_t TRACE_POSITIONAL = 0x80;
+
+/// Amount of log data to buffer before writing it out, in bytes.
+static const std::size_t TRACE_BUFFER_SIZE = 16384;
+
+/// Add an unsigned LEB128 value to a buffer.
+static void put_value(std::vector<uint8_t>& buf, uint64_t v)
+{
+	while (v >= 0x80) {
+		buf.push_back((uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	buf.push_back((uint8_t)v);
+	return;
+}
+
+traced_core::traced_core(std::shared_ptr<output> log)
+	:	log(log),
+		base(std::chrono::steady_clock::now()),
+		lastStart(0)
+{
+	this->buffer.reserve(TRACE_BUFFER_SIZE + 64);
+	this->buffer.insert(this->buffer.end(), TRACE_SIGNATURE,
+		TRACE_SIGNATURE + TRACE_SIGNATURE_LEN);
+}
+
+traced_core::~traced_core()
+{
+	try {
+		this->flush_log();
+	} catch (const stream::error& e) {
+		std::cerr << "Error writing stream trace log: " << e.what() << std::endl;
+	}
+}
+
+void traced_core::record(const trace_op& op)
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	uint8_t type = (uint8_t)op.type;
+	if (op.positional) type |= TRACE_POSITIONAL;
+	this->buffer.push_back(type);
+	// Ops run at the same time from different threads may finish out of order
+	uint64_t start = std::max(op.start, this->lastStart);
+	put_value(this->buffer, start - this->lastStart);
+	put_value(this->buffer, op.duration);
+	this->lastStart = start;
+	switch (op.type) {
+		case trace_type::seekg:
+		case trace_type::seekp:
+		case trace_type::truncate:
+			put_value(this->buffer, op.pos);
+			break;
+		case trace_type::read:
+		case trace_type::write:
+			put_value(this->buffer, op.pos);
+			put_value(this->buffer, op.len);
+			put_value(this->buffer, op.done);
+			break;
+		case trace_type::flush:
+			break;
+	}
+	if (this->buffer.size() >= TRACE_BUFFER_SIZE) {
+		this->log->write(this->buffer.data(), this->buffer.size());
+		this->buffer.clear();
+	}
+	return;
+}
+
+uint64_t traced_core::now() const
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - this->base).count();
+}
+
+void traced_core::flush_log()
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (!this->buffer.empty()) {
+		this->log->write(this->buffer.data(), this->buffer.size());
+		this->buffer.clear();
+	}
+	this->log->flush();
+	return;
+}
+
+
+input_traced::input_traced(std::shared_ptr<input> parent,
+	std::shared_ptr<output> log)
+	:	traced_core(log),
+		in_parent(parent)
+{
+}
+
+stream::len input_traced::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::pos pos = this->in_parent->tellg();
+	uint64_t start = this->now();
+	stream::len r = this->in_parent->try_read(buffer, len);
+	this->record({trace_type::read, false, pos, len, r, start,
+		this->now() - start});
+	return r;
+}
+
+stream::len input_traced::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	uint64_t start = this->now();
+	stream::len r = this->in_parent->try_read_at(pos, buffer, len);
+	this->record({trace_type::read, true, pos, len, r, start,
+		this->now() - start});
+	return r;
+}
+
+void input_traced::seekg(stream::delta off, seek_from from)
+{
+	uint64_t start = this->now();
+	this->in_parent->seekg(off, from);
+	uint64_t end = this->now();
+	this->record({trace_type::seekg, false, this->in_parent->tellg(), 0, 0,
+		start, end - start});
+	return;
+}
+
+stream::pos input_traced::tellg() const
+{
+	return this->in_parent->tellg();
+}
+
+stream::len input_traced::size() const
+{
+	return this->in_parent->size();
+}
+
+
+output_traced::output_traced(std::shared_ptr<output> parent,
+	std::shared_ptr<output> log)
+	:	traced_core(log),
+		out_parent(parent)
+{
+}
+
+stream::len output_traced::try_write(const uint8_t *buffer, stream::len len)
+{
+	stream::pos pos = this->out_parent->tellp();
+	uint64_t start = this->now();
+	stream::len w = this->out_parent->try_write(buffer, len);
+	this->record({trace_type::write, false, pos, len, w, start,
+		this->now() - start});
+	return w;
+}
+
+stream::len output_traced::try_write_at(stream::pos pos,
+	const uint8_t *buffer, stream::len len)
+{
+	uint64_t start = this->now();
+	stream::len w = this->out_parent->try_write_at(pos, buffer, len);
+	this->record({trace_type::write, true, pos, len, w, start,
+		this->now() - start});
+	return w;
+}
+
+void output_traced::seekp(stream::delta off, seek_from from)
+{
+	uint64_t start = this->now();
+	this->out_parent->seekp(off, from);
+	uint64_t end = this->now();
+	this->record({trace_type::seekp, false, this->out_parent->tellp(), 0, 0,
+		start, end - start});
+	return;
+}
+
+stream::pos output_traced::tellp() const
+{
+	return this->out_parent->tellp();
+}
+
+void output_traced::truncate(stream::pos size)
+{
+	uint64_t start = this->now();
+	this->out_parent->truncate(size);
+	this->record({trace_type::truncate, false, size, 0, 0, start,
+		this->now() - start});
+	return;
+}
+
+void output_traced::flush()
+{
+	uint64_t start = this->now();
+	this->out_parent->flush();
+	this->record({trace_type::flush, false, 0, 0, 0, start,
+		this->now() - start});
+	this->flush_log();
+	return;
+}
+
+
+traced::traced(std::shared_ptr<inout> parent, std::shared_ptr<output> log)
+	:	traced_core(log),
+		input_traced(parent, log),
+		output_traced(parent, log)
+{
+}
+
+
+trace_reader::trace_reader(std::shared_ptr<input> log)
+	:	log(log),
+		lastStart(0)
+{
+	char sig[TRACE_SIGNATURE_LEN];
+	if ((this->log->try_read((uint8_t *)sig, TRACE_SIGNATURE_LEN)
+			!= TRACE_SIGNATURE_LEN)
+		|| (memcmp(sig, TRACE_SIGNATURE, TRACE_SIGNATURE_LEN) != 0)
+	) {
+		throw stream::error("This is not a stream trace log.");
+	}
+}
+
+bool trace_reader::next(trace_op *op)
+{
+	uint8_t type;
+	if (this->log->try_read(&type, 1) != 1) return false;
+	op->positional = type & TRACE_POSITIONAL;
+	op->type = (trace_type)(type & ~TRACE_POSITIONAL);
+	this->lastStart += this->read_value();
+	op->start = this->lastStart;
+	op->duration = this->read_value();
+	op->pos = 0;
+	op->len = 0;
+	op->done = 0;
+	switch (op->type) {
+		case trace_type::seekg:
+		case trace_type::seekp:
+		case trace_type::truncate:
+			op->pos = this->read_value();
+			break;
+		case trace_type::read:
+		case trace_type::write:
+			op->pos = this->read_value();
+			op->len = this->read_value();
+			op->done = this->read_value();
+			break;
+		case trace_type::flush:
+			break;
+		default:
+			throw stream::error(createString("Unknown operation " << (int)type
+				<< " in stream trace log."));
+	}
+	return true;
+}
+
+uint64_t trace_reader::read_value()
+{
+	uint64_t v = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		uint8_t b;
+		if (this->log->try_read(&b, 1) != 1) {
+			throw stream::error("Stream trace log ends part way through a record.");
+		}
+		v |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80)) return v;
+	}
+	throw stream::error("Corrupted value in stream trace log.");
+}
+
+} // namespace stream
+} // namespace camoto
@@ -0,0 +1,58 @@
+/**
+ * @file  string_table.cpp
+ * @brief Read whole tables of fixed-length records containing names at once.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <camoto/string_table.hpp>
+
+namespace camoto {
+
+string_table::string_table()
+	:	lenRecord(0)
+{
+}
+
+void string_table::read(stream::input& s, std::size_t count,
+	unsigned int lenRecord, unsigned int offName, unsigned int lenName)
+{
+	assert(offName + lenName <= lenRecord);
+	this->names.clear();
+	this->lenRecord = lenRecord;
+	this->data.resize(count * lenRecord);
+	if (count == 0) return;
+
+	try {
+		s.read(this->data.data(), this->data.size());
+	} catch (const stream::incomplete_read&) {
+		this->data.clear();
+		throw;
+	}
+
+	this->names.resize(count);
+	const char *p = (const char *)this->data.data() + offName;
+	for (auto& n : this->names) {
+		const char *end = (const char *)memchr(p, 0, lenName);
+		n.data = p;
+		n.length = end ? end - p : lenName;
+		p += lenRecord;
+	}
+	return;
+}
+
+} // namespace camoto
@@ -18,7 +18,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <camoto/stream_file.hpp>
 #include <camoto/suppitem.hpp>
+#include <camoto/util.hpp>
 
 namespace camoto {
 
@@ -42,4 +45,222 @@ std::string suppToString(SuppItem s)
 	return "<SuppItem out of range>";
 }
 
+/// Get the full path to a file, so different paths to it compare equal.
+static std::string canonicalPath(const std::string& filename)
+{
+#ifdef _WIN32
+	char *full = _fullpath(NULL, filename.c_str(), 0);
+#else
+	char *full = realpath(filename.c_str(), NULL);
+#endif
+	// If the file doesn't exist, leave it for the open to report the error
+	if (!full) return filename;
+	std::string path(full);
+	free(full);
+	return path;
+}
+
+SuppCache::SuppCache(fn_open open, unsigned int maxIdle)
+	:	fnOpen(open),
+		maxIdle(maxIdle)
+{
+	if (!this->fnOpen) {
+		this->fnOpen = [](const std::string& filename) {
+			return std::make_shared<stream::file>(filename, false);
+		};
+	}
+}
+
+std::shared_ptr<stream::inout> SuppCache::open(const std::string& filename)
+{
+	std::string path = canonicalPath(filename);
+	std::lock_guard<std::mutex> guard(this->lock);
+	for (auto& i : this->files) {
+		if (i.path.compare(path) == 0) return i.file;
+	}
+	auto file = this->fnOpen(filename);
+	this->files.push_front(entry{path, file});
+	this->closeIdle(this->maxIdle);
+	return file;
+}
+
+std::size_t SuppCache::count() const
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->files.size();
+}
+
+void SuppCache::trim()
+{
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->closeIdle(0);
+	return;
+}
+
+void SuppCache::closeIdle(unsigned int keep)
+{
+	unsigned int idle = 0;
+	for (auto i = this->files.begin(); i != this->files.end(); ) {
+		// Nobody else has a copy, so it isn't being used
+		if (i->file.use_count() == 1) {
+			if (idle >= keep) {
+				i = this->files.erase(i);
+				continue;
+			}
+			idle++;
+		}
+		i++;
+	}
+	return;
+}
+
+
+SuppStream::SuppStream(fn_open open)
+	:	fnOpen(open),
+		offset(0)
+{
+}
+
+bool SuppStream::isOpen() const
+{
+	return (bool)this->target;
+}
+
+stream::len SuppStream::try_read(uint8_t *buffer, stream::len len)
+{
+	stream::len r = this->get().try_read_at(this->offset, buffer, len);
+	this->offset += r;
+	return r;
+}
+
+stream::len SuppStream::try_read_at(stream::pos pos, uint8_t *buffer,
+	stream::len len)
+{
+	return this->get().try_read_at(pos, buffer, len);
+}
+
+void SuppStream::seekg(stream::delta off, stream::seek_from from)
+{
+	this->seek(off, from);
+	return;
+}
+
+stream::pos SuppStream::tellg() const
+{
+	return this->offset;
+}
+
+stream::len SuppStream::size() const
+{
+	return this->get().size();
+}
+
+const uint8_t *SuppStream::view(stream::pos pos, stream::len len,
+	stream::len *got, std::string& scratch)
+{
+	return this->get().view(pos, len, got, scratch);
+}
+
+bool SuppStream::cheap_view() const
+{
+	return this->get().cheap_view();
+}
+
+bool SuppStream::identify(stream::source_id *id) const
+{
+	return this->get().identify(id);
+}
+
+stream::len SuppStream::try_write(const uint8_t *buffer, stream::len len)
+{
+	stream::len w = this->get().try_write_at(this->offset, buffer, len);
+	this->offset += w;
+	return w;
+}
+
+stream::len SuppStream::try_write_at(stream::pos pos, const uint8_t *buffer,
+	stream::len len)
+{
+	return this->get().try_write_at(pos, buffer, len);
+}
+
+void SuppStream::seekp(stream::delta off, stream::seek_from from)
+{
+	this->seek(off, from);
+	return;
+}
+
+stream::pos SuppStream::tellp() const
+{
+	return this->offset;
+}
+
+void SuppStream::truncate(stream::pos size)
+{
+	this->get().truncate(size);
+	this->offset = size;
+	return;
+}
+
+void SuppStream::flush()
+{
+	// Nothing can have been written if the file was never opened
+	if (this->target) this->target->flush();
+	return;
+}
+
+stream::inout& SuppStream::get() const
+{
+	if (!this->target) this->target = this->fnOpen();
+	return *this->target;
+}
+
+void SuppStream::seek(stream::delta off, stream::seek_from from)
+{
+	stream::pos baseOffset;
+	switch (from) {
+		case stream::cur:
+			baseOffset = this->offset;
+			break;
+		case stream::end:
+			baseOffset = this->size();
+			break;
+		default:
+			baseOffset = 0;
+			break;
+	}
+	if ((off < 0) && (baseOffset < (unsigned)(off * -1))) {
+		throw stream::seek_error("Cannot seek back past start of stream");
+	}
+	baseOffset += off;
+	// Seeking back to the start is common and doesn't need the file opened
+	if ((baseOffset != 0) && (baseOffset > this->size())) {
+		throw stream::seek_error(createString("Cannot seek beyond end of stream "
+			"(offset " << baseOffset << " > length " << this->size() << ")"));
+	}
+	this->offset = baseOffset;
+	return;
+}
+
+SuppData lazySuppData(const SuppFilenames& names,
+	std::shared_ptr<SuppCache> cache)
+{
+	SuppData supps;
+	for (const auto& i : names) {
+		std::string filename = i.second;
+		SuppStream::fn_open fnOpen;
+		if (cache) {
+			fnOpen = [cache, filename]() {
+				return cache->open(filename);
+			};
+		} else {
+			fnOpen = [filename]() {
+				return std::make_shared<stream::file>(filename, false);
+			};
+		}
+		supps[i.first].reset(new SuppStream(fnOpen));
+	}
+	return supps;
+}
+
 } // namespace camoto
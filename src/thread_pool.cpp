@@ -0,0 +1,140 @@
+/**
+ * @file  thread_pool.cpp
+ * @brief Simple work-stealing thread pool.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <camoto/thread_pool.hpp>
+
+namespace camoto {
+
+thread_pool::thread_pool(unsigned int numThreads)
+	:	queued(0),
+		pending(0),
+		next(0),
+		stopping(false)
+{
+	if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+	if (numThreads == 0) numThreads = 1; // unknown core count
+
+	for (unsigned int i = 0; i < numThreads; i++) {
+		this->queues.emplace_back(new queue());
+	}
+	for (unsigned int i = 0; i < numThreads; i++) {
+		this->workers.emplace_back(&thread_pool::run, this, i);
+	}
+}
+
+thread_pool::~thread_pool()
+{
+	{
+		std::unique_lock<std::mutex> guard(this->lock);
+		this->idle.wait(guard, [this]() { return this->pending == 0; });
+		this->stopping = true;
+	}
+	this->wake.notify_all();
+	for (auto& t : this->workers) t.join();
+}
+
+unsigned int thread_pool::size() const
+{
+	return this->workers.size();
+}
+
+void thread_pool::submit(task t)
+{
+	unsigned int index;
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		index = this->next;
+		this->next = (this->next + 1) % this->queues.size();
+		this->pending++;
+		// Counted before it's visible in the queue, so a worker taking it
+		// straight away can never take the count below zero.
+		this->queued++;
+	}
+	{
+		queue& q = *this->queues[index];
+		std::lock_guard<std::mutex> guard(q.lock);
+		q.tasks.push_back(std::move(t));
+	}
+	this->wake.notify_one();
+	return;
+}
+
+void thread_pool::wait()
+{
+	std::exception_ptr e;
+	{
+		std::unique_lock<std::mutex> guard(this->lock);
+		this->idle.wait(guard, [this]() { return this->pending == 0; });
+		std::swap(e, this->failure);
+	}
+	if (e) std::rethrow_exception(e);
+	return;
+}
+
+void thread_pool::run(unsigned int index)
+{
+	for (;;) {
+		task t;
+		if (this->take(index, &t)) {
+			try {
+				t(index);
+			} catch (...) {
+				std::lock_guard<std::mutex> guard(this->lock);
+				if (!this->failure) this->failure = std::current_exception();
+			}
+			std::lock_guard<std::mutex> guard(this->lock);
+			if (--this->pending == 0) this->idle.notify_all();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guard(this->lock);
+		this->wake.wait(guard, [this]() {
+			return this->stopping || (this->queued > 0);
+		});
+		if (this->stopping && (this->queued == 0)) break;
+	}
+	return;
+}
+
+bool thread_pool::take(unsigned int index, task *t)
+{
+	std::size_t num = this->queues.size();
+	for (std::size_t i = 0; i < num; i++) {
+		queue& q = *this->queues[(index + i) % num];
+		std::unique_lock<std::mutex> guard(q.lock);
+		if (q.tasks.empty()) continue;
+		if (i == 0) {
+			// Own queue, oldest task first
+			*t = std::move(q.tasks.front());
+			q.tasks.pop_front();
+		} else {
+			// Someone else's queue, steal from the end they'll reach last
+			*t = std::move(q.tasks.back());
+			q.tasks.pop_back();
+		}
+		guard.unlock();
+		std::lock_guard<std::mutex> g(this->lock);
+		this->queued--;
+		return true;
+	}
+	return false;
+}
+
+} // namespace camoto
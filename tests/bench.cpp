@@ -0,0 +1,506 @@
+/**
+ * @file   bench.cpp
+ * @brief  Throughput benchmarks for streams, filters and bitstream.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include <camoto/bitstream.hpp>
+#include <camoto/filter-lzss.hpp>
+#include <camoto/filter-lzw.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_reader.hpp>
+#include <camoto/stream_seg.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/thread_pool.hpp>
+#include <camoto/util.hpp> // std::make_unique
+
+#include "corpus.hpp"
+
+using namespace camoto;
+
+/// Number of heap allocations made so far, by anything in the process.
+static std::atomic<unsigned long> allocCount(0);
+
+void *operator new(std::size_t size)
+{
+	allocCount++;
+	void *p = std::malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+/// Output format for the results.
+enum class Format {
+	Text, ///< Aligned columns for reading
+	CSV,  ///< One comma-separated line per result, with a header line
+	JSON, ///< One JSON object per line
+};
+
+/// Settings from the command line.
+struct Options {
+	Format format = Format::Text;
+	std::size_t lenCorpus = 1024 * 1024; ///< Size of each sample, in bytes
+	double minTime = 0.5;                ///< Minimum seconds to run each test
+	std::string match;                   ///< Only run tests containing this
+};
+
+static Options opt;
+
+/// Results of calculations are stored here so they aren't optimised out.
+static volatile unsigned int sink;
+
+/// Random numbers that are the same on every platform.
+struct Random {
+	uint32_t seed;
+
+	Random(uint32_t seed)
+		:	seed(seed)
+	{
+	}
+
+	uint32_t next()
+	{
+		return next_random(this->seed) >> 8;
+	}
+};
+
+/// Bytes with no structure at all, the worst case for compression.
+std::string corpus_random(std::size_t len)
+{
+	return make_corpus(len, 1);
+}
+
+/// Words and punctuation, like the text files and scripts in game archives.
+std::string corpus_text(std::size_t len)
+{
+	static const char *words[] = {
+		"the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ", "dog ",
+		"level ", "score ", "player ", "enemy ", "door ", "key ", "you ", "a ",
+		"found ", "secret ", "press ", "any ", "to ", "continue", ".\n", ", ",
+	};
+	Random rnd(2);
+	std::string s;
+	while (s.length() < len) {
+		s += words[rnd.next() % (sizeof(words) / sizeof(words[0]))];
+	}
+	s.resize(len);
+	return s;
+}
+
+/// 16x16 8bpp tiles, many of them repeated with small variations, like the
+/// tilesets and backgrounds of a typical game.
+std::string corpus_tiles(std::size_t len)
+{
+	Random rnd(3);
+	const unsigned int lenTile = 16 * 16;
+	std::vector<std::string> tiles;
+	for (unsigned int t = 0; t < 32; t++) {
+		std::string tile(lenTile, '\0');
+		uint8_t base = rnd.next() & 0xF0;
+		for (unsigned int y = 0; y < 16; y++) {
+			// Horizontal runs of a few colours from the same part of the palette
+			uint8_t colour = base + (rnd.next() & 0x0F);
+			for (unsigned int x = 0; x < 16; x++) {
+				if ((rnd.next() & 7) == 0) colour = base + (rnd.next() & 0x0F);
+				tile[y * 16 + x] = colour;
+			}
+		}
+		tiles.push_back(tile);
+	}
+	std::string s;
+	while (s.length() < len) {
+		std::string tile = tiles[rnd.next() % tiles.size()];
+		// Occasionally change a few pixels so tiles don't always match exactly
+		if ((rnd.next() & 3) == 0) {
+			for (int i = 0; i < 4; i++) tile[rnd.next() % lenTile] = rnd.next();
+		}
+		s += tile;
+	}
+	s.resize(len);
+	return s;
+}
+
+/// Run a filter over all of in and return the result.
+std::string apply_filter(const std::string& in, std::shared_ptr<filter> f)
+{
+	auto src = std::make_shared<stream::string>(in);
+	stream::input_filtered filt(src, f);
+	stream::string dst;
+	stream::copy(dst, filt);
+	return std::move(dst.data);
+}
+
+/// Time an operation and print the result.
+/**
+ * @param group
+ *   Type of test, e.g. "lzw".
+ *
+ * @param name
+ *   Test name, e.g. "decompress".
+ *
+ * @param corpus
+ *   Name of the corpus the test is processing.
+ *
+ * @param lenData
+ *   Number of bytes processed by one call to fn, used to calculate MB/s.
+ *
+ * @param fn
+ *   Operation to time.
+ */
+void run(const std::string& group, const std::string& name,
+	const std::string& corpus, std::size_t lenData, std::function<void()> fn)
+{
+	std::string id = group + "/" + name + "/" + corpus;
+	if (!opt.match.empty() && (id.find(opt.match) == std::string::npos)) return;
+
+	// Once to warm up the caches
+	fn();
+
+	unsigned long iterations = 0;
+	unsigned long allocStart = allocCount;
+	auto start = std::chrono::steady_clock::now();
+	double elapsed;
+	do {
+		fn();
+		iterations++;
+		elapsed = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < opt.minTime);
+	unsigned long allocs = allocCount - allocStart;
+
+	double mbps = (double)lenData * iterations / elapsed / (1024 * 1024);
+	double allocsPerOp = (double)allocs / iterations;
+
+	switch (opt.format) {
+		case Format::Text:
+			std::cout << std::left << std::setw(36) << id << std::right
+				<< std::fixed << std::setprecision(2)
+				<< std::setw(10) << mbps << " MB/s"
+				<< std::setw(12) << allocsPerOp << " allocs/op"
+				<< std::setw(8) << iterations << " iterations" << std::endl;
+			break;
+		case Format::CSV:
+			std::cout << group << ',' << name << ',' << corpus << ','
+				<< lenData << ',' << iterations << ',' << elapsed << ','
+				<< mbps << ',' << allocsPerOp << std::endl;
+			break;
+		case Format::JSON:
+			std::cout << "{\"group\":\"" << group << "\",\"name\":\"" << name
+				<< "\",\"corpus\":\"" << corpus << "\",\"bytes\":" << lenData
+				<< ",\"iterations\":" << iterations << ",\"seconds\":" << elapsed
+				<< ",\"mb_per_sec\":" << mbps << ",\"allocs_per_op\":"
+				<< allocsPerOp << "}" << std::endl;
+			break;
+	}
+	return;
+}
+
+void bench_lzw(const std::string& corpus, const std::string& data)
+{
+	auto comp = [] {
+		return std::make_shared<filter_lzw_compress>(9, 12, 0x101, 0x100, 0,
+			LZW_BIG_ENDIAN | LZW_RESET_PARAM_VALID | LZW_EOF_PARAM_VALID);
+	};
+	auto decomp = [] {
+		return std::make_shared<filter_lzw_decompress>(9, 12, 0x101, 0x100, 0,
+			LZW_BIG_ENDIAN | LZW_RESET_PARAM_VALID | LZW_EOF_PARAM_VALID);
+	};
+	std::string compressed = apply_filter(data, comp());
+
+	run("lzw", "compress", corpus, data.length(), [&] {
+		apply_filter(data, comp());
+	});
+	run("lzw", "compress_parallel", corpus, data.length(), [&] {
+		static thread_pool pool;
+		lzw_compress_parallel((const uint8_t *)data.data(), data.length(), 9, 12,
+			0x101, 0x100, 0,
+			LZW_BIG_ENDIAN | LZW_RESET_PARAM_VALID | LZW_EOF_PARAM_VALID, &pool);
+	});
+	run("lzw", "decompress", corpus, data.length(), [&] {
+		apply_filter(compressed, decomp());
+	});
+	return;
+}
+
+void bench_lzss(const std::string& corpus, const std::string& data)
+{
+	static const struct {
+		const char *name;
+		filter_lzss_compress::Effort effort;
+	} efforts[] = {
+		{"compress_greedy", filter_lzss_compress::Effort::Greedy},
+		{"compress_lazy", filter_lzss_compress::Effort::Lazy},
+		{"compress_optimal", filter_lzss_compress::Effort::Optimal},
+	};
+	for (const auto& e : efforts) {
+		run("lzss", e.name, corpus, data.length(), [&] {
+			apply_filter(data, std::make_shared<filter_lzss_compress>(
+				bitstream::bigEndian, 4, 12, e.effort));
+		});
+	}
+	run("lzss", "compress_lazy_parallel", corpus, data.length(), [&] {
+		static thread_pool pool;
+		lzss_compress_parallel((const uint8_t *)data.data(), data.length(),
+			bitstream::bigEndian, 4, 12, filter_lzss_compress::Effort::Lazy, &pool);
+	});
+
+	std::string compressed = apply_filter(data,
+		std::make_shared<filter_lzss_compress>(bitstream::bigEndian, 4, 12));
+	run("lzss", "decompress", corpus, data.length(), [&] {
+		apply_filter(compressed,
+			std::make_shared<filter_lzss_decompress>(bitstream::bigEndian, 4, 12));
+	});
+	return;
+}
+
+void bench_bitstream(const std::string& corpus, const std::string& data)
+{
+	// Treat the corpus as a series of 9, 10, 11 and 12-bit codes
+	const std::size_t numCodes = data.length() * 8 / 11;
+	std::vector<unsigned int> codes(numCodes);
+	for (std::size_t i = 0; i < numCodes; i++) {
+		unsigned int bits = 9 + (i & 3);
+		codes[i] = ((uint8_t)data[i % data.length()]
+			| ((uint8_t)data[(i * 7) % data.length()] << 8)) & ((1u << bits) - 1);
+	}
+	std::vector<uint8_t> buf(data.length() + 16);
+
+	// Also treat it as an array of 12-bit values, read from a parent stream
+	const std::size_t numValues = data.length() * 8 / 12;
+	auto packed = std::make_shared<stream::string>(data);
+	std::vector<uint16_t> values(numValues);
+
+	for (auto endian : {bitstream::littleEndian, bitstream::bigEndian}) {
+		std::string suffix = (endian == bitstream::littleEndian) ? "_le" : "_be";
+		std::size_t lenBytes = 0;
+
+		run("bitstream", "write" + suffix, corpus, data.length(), [&] {
+			bitstream bits(endian);
+			uint8_t *out = buf.data(), *outEnd = buf.data() + buf.size();
+			for (std::size_t i = 0; i < numCodes; i++) {
+				bits.write(&out, outEnd, 9 + (i & 3), codes[i]);
+			}
+			bits.flushByte(&out, outEnd);
+			lenBytes = out - buf.data();
+		});
+
+		run("bitstream", "read" + suffix, corpus, data.length(), [&] {
+			bitstream bits(endian);
+			const uint8_t *in = buf.data(), *inEnd = buf.data() + lenBytes;
+			unsigned int val, sum = 0;
+			for (std::size_t i = 0; i < numCodes; i++) {
+				bits.read(&in, inEnd, 9 + (i & 3), &val);
+				sum += val;
+			}
+			sink = sum;
+		});
+
+		run("bitstream", "read_callback" + suffix, corpus, data.length(), [&] {
+			bitstream bits(endian);
+			const uint8_t *in = buf.data();
+			stream::len lenIn = lenBytes, r = 0;
+			fn_getnextchar cbNext = std::bind(bitstreamFilterNextChar, &in, &lenIn,
+				&r, std::placeholders::_1);
+			unsigned int val, sum = 0;
+			for (std::size_t i = 0; i < numCodes; i++) {
+				bits.read(cbNext, 9 + (i & 3), &val);
+				sum += val;
+			}
+			sink = sum;
+		});
+
+		run("bitstream", "read_stream" + suffix, corpus, data.length(), [&] {
+			bitstream bits(packed, endian);
+			unsigned int val, sum = 0;
+			for (std::size_t i = 0; i < numValues; i++) {
+				bits.read(12, &val);
+				sum += val;
+			}
+			sink = sum;
+		});
+
+		run("bitstream", "read_array" + suffix, corpus, data.length(), [&] {
+			bitstream bits(packed, endian);
+			bits.read_array(12, values.data(), numValues);
+			sink = numValues ? values[numValues - 1] : 0;
+		});
+
+		run("bitstream", "write_array" + suffix, corpus, data.length(), [&] {
+			bitstream bits(packed, endian);
+			bits.write_array(12, values.data(), numValues);
+			bits.flush();
+		});
+	}
+	return;
+}
+
+void bench_stream(const std::string& corpus, const std::string& data)
+{
+	run("stream", "copy", corpus, data.length(), [&] {
+		stream::input_string src(data);
+		stream::string dst;
+		stream::copy(dst, src);
+	});
+
+	run("stream", "parse_u16", corpus, data.length(), [&] {
+		stream::input_string src(data);
+		uint16_t val;
+		unsigned int sum = 0;
+		for (std::size_t i = 0; i < data.length() / 2; i++) {
+			src >> u16le(val);
+			sum += val;
+		}
+		sink = sum;
+	});
+
+	run("stream", "parse_u16_reader", corpus, data.length(), [&] {
+		stream::input_string src(data);
+		stream::reader<stream::input_string> r(src);
+		uint16_t val;
+		unsigned int sum = 0;
+		for (std::size_t i = 0; i < data.length() / 2; i++) {
+			r >> u16le(val);
+			sum += val;
+		}
+		sink = sum;
+	});
+
+	stream::string moveData(data);
+	run("stream", "move", corpus, data.length() / 2, [&] {
+		// Shift the second half down to the start, then back again
+		stream::move(moveData, data.length() / 2, 0, data.length() / 2);
+		stream::move(moveData, 0, data.length() / 2, data.length() / 2);
+	});
+
+	// Insert and remove blocks all through the data, then write it out
+	run("stream", "seg", corpus, data.length(), [&] {
+		auto seg = std::make_unique<stream::seg>(
+			std::make_unique<stream::string>(data));
+		Random rnd(4);
+		uint8_t block[64];
+		memset(block, 0x55, sizeof(block));
+		for (int i = 0; i < 64; i++) {
+			stream::pos pos = rnd.next() % (seg->size() - sizeof(block));
+			seg->seekp(pos, stream::start);
+			if (i & 1) {
+				seg->remove(sizeof(block));
+			} else {
+				seg->insert(sizeof(block));
+				seg->write(block, sizeof(block));
+			}
+		}
+		seg->flush();
+	});
+	return;
+}
+
+void usage()
+{
+	std::cout << "Usage: bench [options] [filter]\n"
+		"\n"
+		"Options:\n"
+		"  --csv        Print results as comma-separated values\n"
+		"  --json       Print results as one JSON object per line\n"
+		"  --size=N     Size of each sample corpus in kB (default 1024)\n"
+		"  --time=N     Minimum seconds to run each test (default 0.5)\n"
+		"\n"
+		"Only tests whose name (group/name/corpus) contains filter are run.\n";
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--csv") {
+			opt.format = Format::CSV;
+		} else if (arg == "--json") {
+			opt.format = Format::JSON;
+		} else if (arg.compare(0, 7, "--size=") == 0) {
+			opt.lenCorpus = strtoul(arg.c_str() + 7, NULL, 10) * 1024;
+		} else if (arg.compare(0, 7, "--time=") == 0) {
+			opt.minTime = strtod(arg.c_str() + 7, NULL);
+		} else if ((arg == "--help") || (arg == "-h")) {
+			usage();
+			return 0;
+		} else if (arg[0] == '-') {
+			std::cerr << "Unknown option: " << arg << "\n";
+			usage();
+			return 1;
+		} else {
+			opt.match = arg;
+		}
+	}
+	if (opt.lenCorpus < 1024) opt.lenCorpus = 1024;
+
+	if (opt.format == Format::CSV) {
+		std::cout << "group,name,corpus,bytes,iterations,seconds,mb_per_sec,"
+			"allocs_per_op" << std::endl;
+	}
+
+	const struct {
+		const char *name;
+		std::string (*generate)(std::size_t len);
+	} corpora[] = {
+		{"random", corpus_random},
+		{"text", corpus_text},
+		{"tiles", corpus_tiles},
+	};
+	for (const auto& c : corpora) {
+		std::string data = c.generate(opt.lenCorpus);
+		bench_lzw(c.name, data);
+		bench_lzss(c.name, data);
+		bench_bitstream(c.name, data);
+		bench_stream(c.name, data);
+	}
+	return 0;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file  corpus.hpp
+ * @brief Pseudorandom data shared by the tests and benchmarks.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_TESTS_CORPUS_HPP_
+#define _CAMOTO_TESTS_CORPUS_HPP_
+
+#include <cstddef>
+#include <string>
+#include <stdint.h>
+
+/// Step a simple LCG, so generated test data is the same on every platform.
+/**
+ * @return The new seed.  The low bits are the least random, so values should
+ *   be taken from the upper bits.
+ */
+inline uint32_t next_random(uint32_t& seed)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed;
+}
+
+/// Pseudorandom bytes with no structure, for data that only needs to vary.
+inline std::string make_corpus(std::size_t len, uint32_t seed)
+{
+	std::string data(len, '\0');
+	for (auto& c : data) c = next_random(seed) >> 24;
+	return data;
+}
+
+#endif // _CAMOTO_TESTS_CORPUS_HPP_
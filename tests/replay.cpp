@@ -0,0 +1,214 @@
+/**
+ * @file   replay.cpp
+ * @brief  Run a recorded stream trace against different stream types.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <camoto/stream_cached.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/stream_mmap.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/stream_traced.hpp>
+
+using namespace camoto;
+
+/// Names of the stream types a trace can be replayed against.
+static const char *backends[] = {"string", "file", "mmap", "cached"};
+
+/// Totals for one type of operation.
+struct op_totals {
+	unsigned long count = 0;   ///< Number of operations
+	unsigned long failed = 0;  ///< Operations that threw an exception
+	uint64_t bytes = 0;        ///< Bytes read or written
+	uint64_t ns = 0;           ///< Total time taken, in nanoseconds
+};
+
+/// Open the scratch copy of the data with the given stream type.
+std::shared_ptr<stream::inout> open_backend(const std::string& backend,
+	const std::string& filename)
+{
+	if (backend == "string") {
+		stream::input_file in(filename);
+		auto s = std::make_shared<stream::string>();
+		stream::copy(*s, in);
+		s->seekp(0, stream::start);
+		return s;
+	} else if (backend == "file") {
+		return std::make_shared<stream::file>(filename, false);
+	} else if (backend == "mmap") {
+		return std::make_shared<stream::mmap>(filename, false);
+	} else if (backend == "cached") {
+		return std::make_shared<stream::cached>(
+			std::make_shared<stream::file>(filename, false));
+	}
+	throw stream::error("Unknown stream type: " + backend);
+}
+
+/// Run every operation in the trace against one stream.
+void replay(const std::string& backend, const std::vector<stream::trace_op>& ops,
+	const std::string& filename, uint64_t recorded)
+{
+	op_totals totals[7];
+	stream::len lenBuffer = 0;
+	for (const auto& op : ops) lenBuffer = std::max(lenBuffer, op.len);
+	std::vector<uint8_t> buffer(lenBuffer);
+
+	// Work on a copy so writes don't change the original data
+	std::string scratch = filename + ".replay";
+	{
+		stream::input_file in(filename);
+		stream::file out(scratch, true);
+		stream::copy(out, in);
+		out.flush();
+	}
+	auto s = open_backend(backend, scratch);
+
+	auto start = std::chrono::steady_clock::now();
+	for (const auto& op : ops) {
+		op_totals& t = totals[(int)op.type];
+		auto opStart = std::chrono::steady_clock::now();
+		try {
+			switch (op.type) {
+				case stream::trace_type::seekg:
+					s->seekg(op.pos, stream::start);
+					break;
+				case stream::trace_type::seekp:
+					s->seekp(op.pos, stream::start);
+					break;
+				case stream::trace_type::read:
+					if (op.positional) {
+						t.bytes += s->try_read_at(op.pos, buffer.data(), op.len);
+					} else {
+						t.bytes += s->try_read(buffer.data(), op.len);
+					}
+					break;
+				case stream::trace_type::write:
+					if (op.positional) {
+						t.bytes += s->try_write_at(op.pos, buffer.data(), op.len);
+					} else {
+						t.bytes += s->try_write(buffer.data(), op.len);
+					}
+					break;
+				case stream::trace_type::truncate:
+					s->truncate(op.pos);
+					break;
+				case stream::trace_type::flush:
+					s->flush();
+					break;
+			}
+		} catch (const stream::error&) {
+			t.failed++;
+		}
+		t.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - opStart).count();
+		t.count++;
+	}
+	s->flush();
+	double elapsed = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+	s.reset();
+	std::remove(scratch.c_str());
+
+	static const char *names[] = {"", "seekg", "seekp", "read", "write",
+		"truncate", "flush"};
+	std::cout << backend << ": " << std::fixed << std::setprecision(3)
+		<< elapsed * 1000 << " ms (recorded " << recorded / 1000000.0 << " ms)\n";
+	for (int i = 1; i < 7; i++) {
+		const op_totals& t = totals[i];
+		if (!t.count) continue;
+		std::cout << "  " << std::left << std::setw(10) << names[i] << std::right
+			<< std::setw(10) << t.count << " ops"
+			<< std::setw(12) << std::setprecision(3) << t.ns / 1000.0 / t.count
+			<< " us/op";
+		if (t.bytes) {
+			std::cout << std::setw(12) << std::setprecision(2)
+				<< t.bytes / (t.ns / 1e9) / (1024 * 1024) << " MB/s";
+		}
+		if (t.failed) std::cout << "  (" << t.failed << " failed)";
+		std::cout << "\n";
+	}
+	return;
+}
+
+void usage()
+{
+	std::cout << "Usage: replay [options] <trace> <data>\n"
+		"\n"
+		"Runs the operations recorded by stream::traced in <trace> against a\n"
+		"copy of <data>, using each type of stream in turn.\n"
+		"\n"
+		"Options:\n"
+		"  --type=T     Only use stream type T: string, file, mmap or cached\n";
+	return;
+}
+
+int main(int argc, char *argv[])
+{
+	std::string only, traceFile, dataFile;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 7, "--type=") == 0) {
+			only = arg.substr(7);
+		} else if ((arg == "--help") || (arg == "-h")) {
+			usage();
+			return 0;
+		} else if (arg[0] == '-') {
+			std::cerr << "Unknown option: " << arg << "\n";
+			usage();
+			return 1;
+		} else if (traceFile.empty()) {
+			traceFile = arg;
+		} else {
+			dataFile = arg;
+		}
+	}
+	if (dataFile.empty()) {
+		usage();
+		return 1;
+	}
+
+	try {
+		// Load the whole trace first, so parsing it isn't part of the timing
+		std::vector<stream::trace_op> ops;
+		stream::trace_reader log(std::make_shared<stream::input_cached>(
+			std::make_shared<stream::input_file>(traceFile)));
+		stream::trace_op op;
+		uint64_t recorded = 0;
+		while (log.next(&op)) {
+			ops.push_back(op);
+			recorded += op.duration;
+		}
+		std::cout << ops.size() << " operations in trace\n";
+
+		for (const char *b : backends) {
+			if (!only.empty() && (only != b)) continue;
+			replay(b, ops, dataFile, recorded);
+		}
+	} catch (const stream::error& e) {
+		std::cerr << "Error: " << e.get_message() << std::endl;
+		return 2;
+	}
+	return 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file   test-arena.cpp
+ * @brief  Test code for arena allocation of stream stacks.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/arena.hpp>
+#include <camoto/filter-xor.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_sub.hpp>
+#include <camoto/util.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+/// Object that counts how many copies of itself exist.
+struct counted
+{
+	counted(int *live)
+		:	live(live)
+	{
+		(*this->live)++;
+	}
+
+	~counted()
+	{
+		(*this->live)--;
+	}
+
+	int *live;
+	double align; ///< Make sure alignment is respected
+};
+
+BOOST_FIXTURE_TEST_SUITE(arena_suite, default_sample)
+
+BOOST_AUTO_TEST_CASE(allocate)
+{
+	BOOST_TEST_MESSAGE("Allocate memory from an arena");
+
+	arena a(64);
+	char *p1 = (char *)a.allocate(3, 1);
+	char *p2 = (char *)a.allocate(8, 8);
+	BOOST_CHECK_EQUAL((uintptr_t)p2 % 8, 0);
+	BOOST_CHECK(p2 > p1);
+	BOOST_CHECK(p2 < p1 + 16);
+
+	// Larger than a block
+	char *big = (char *)a.allocate(1000, 16);
+	BOOST_CHECK_EQUAL((uintptr_t)big % 16, 0);
+	memset(big, 0, 1000);
+
+	// First block is used again after a release
+	a.release();
+	BOOST_CHECK((char *)a.allocate(3, 1) == p1);
+}
+
+BOOST_AUTO_TEST_CASE(objects)
+{
+	BOOST_TEST_MESSAGE("Objects in an arena are destroyed normally");
+
+	int live = 0;
+	arena a;
+	{
+		auto o1 = a.make_shared<counted>(&live);
+		auto o2 = a.make_shared<counted>(&live);
+		BOOST_CHECK_EQUAL(live, 2);
+		BOOST_CHECK_EQUAL((uintptr_t)o2.get() % alignof(counted), 0);
+		o1.reset();
+		BOOST_CHECK_EQUAL(live, 1);
+	}
+	BOOST_CHECK_EQUAL(live, 0);
+	a.release();
+}
+
+BOOST_AUTO_TEST_CASE(stream_stack)
+{
+	BOOST_TEST_MESSAGE("Build a stream stack in an arena on a borrowed parent");
+
+	stream::input_string content(makeString("..\x61\x6c\x65\x65\x66.."));
+	arena a;
+	for (int i = 0; i < 3; i++) {
+		auto sub = a.make_shared<stream::input_sub>(content, 2, 5);
+		auto dec = a.make_shared<stream::input_filtered>(sub,
+			a.make_shared<filter_xor>(9, 0));
+		BOOST_CHECK_MESSAGE(is_equal("hello", dec->read(5)),
+			"Error reading through stream stack in arena");
+		dec.reset();
+		sub.reset();
+		a.release();
+	}
+
+	// Borrowed pointers work the same as owned ones
+	stream::input_filtered dec(borrow<stream::input>(content),
+		std::make_shared<filter_xor>(9, 0));
+	BOOST_CHECK_EQUAL(dec.size(), 9);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
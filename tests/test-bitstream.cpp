@@ -20,6 +20,7 @@
 
 #include <boost/test/unit_test.hpp>
 #include <boost/algorithm/string.hpp> // for case-insensitive string compare
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include <iomanip>
@@ -746,6 +747,80 @@ BOOST_AUTO_TEST_CASE(bitstream_rwseek_1bit)
 		"Read/write/seek in 1-bit stream failed");
 }
 
+/// stream::string that counts how often it is accessed.
+class counted_string: public stream::string
+{
+	public:
+		counted_string(std::string content)
+			:	string_core(content),
+				string(content),
+				reads(0),
+				writes(0)
+		{
+		}
+
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len)
+		{
+			this->reads++;
+			return this->string::try_read_at(pos, buffer, len);
+		}
+
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len)
+		{
+			this->writes++;
+			return this->string::try_write_at(pos, buffer, len);
+		}
+
+		unsigned int reads;
+		unsigned int writes;
+};
+
+BOOST_AUTO_TEST_CASE(bitstream_block_buffer)
+{
+	BOOST_TEST_MESSAGE("Read/write across block boundaries in the parent stream");
+
+	// 0xAA is 10101010, so every even bit (MSB first) is set
+	stream::len lenData = BITSTREAM_BUFFER_SIZE * 3 + 100;
+	auto base = std::make_shared<counted_string>(std::string(lenData, '\xAA'));
+	bitstream bit(base, bitstream::bigEndian);
+
+	// Start part way through the first byte, and write enough 9-bit values to
+	// cross two block boundaries, ending part way through a byte.
+	const unsigned int count = BITSTREAM_BUFFER_SIZE * 2 * 8 / 9 + 5;
+	bit.seek(4, stream::start);
+	for (unsigned int i = 0; i < count; i++) {
+		BOOST_REQUIRE_EQUAL(bit.write(9, (i * 37) & 0x1FF), 9);
+	}
+	// Read a few bits past the end of the write, in the same byte
+	unsigned int val;
+	bit.read(3, &val);
+	stream::pos lenBits = 4 + count * 9 + 3;
+	BOOST_CHECK_EQUAL(val, (lenBits % 2) ? 0x5 : 0x2);
+
+	// Whole blocks were read and written, not one byte at a time
+	BOOST_CHECK_LT(base->reads, 10);
+	BOOST_CHECK_LT(base->writes, 10);
+
+	bit.flush();
+	BOOST_REQUIRE_EQUAL(base->data.length(), lenData);
+
+	bitstream check(base, bitstream::bigEndian);
+	check.read(4, &val);
+	BOOST_REQUIRE_EQUAL(val, 0xA);
+	for (unsigned int i = 0; i < count; i++) {
+		check.read(9, &val);
+		BOOST_REQUIRE_EQUAL(val, (i * 37) & 0x1FF);
+	}
+	// Everything after the written values must be untouched
+	for (stream::pos p = 4 + count * 9; p < lenData * 8; p++) {
+		BOOST_REQUIRE_EQUAL(check.read(1, &val), 1);
+		BOOST_REQUIRE_EQUAL(val, (p % 2) ? 0 : 1);
+	}
+	BOOST_CHECK_EQUAL(check.read(1, &val), 0);
+}
+
 // This is a shared pointer because conceivably the main function could release
 // the underlying stream pointer as it has finished using it, but this bound
 // function still needs a reference to it.  So this function isn't a generic
@@ -820,4 +895,250 @@ BOOST_AUTO_TEST_CASE(bitstream_write_partial)
 		"Write partial without stream failed");
 }
 
+/// Write a sequence of codes of varying lengths through the buffer and
+/// callback interfaces, and read them back with both.
+void bitstream_buffer_check(bitstream::endian endian)
+{
+	std::vector<unsigned int> bits, vals;
+	uint32_t seed = 1;
+	for (int i = 0; i < 500; i++) {
+		unsigned int b = 1 + (next_random(seed) >> 16) % 32;
+		next_random(seed);
+		unsigned int v = seed ^ (seed << 7);
+		if (b < 32) v &= (1u << b) - 1;
+		bits.push_back(b);
+		vals.push_back(v);
+	}
+
+	// Slow path, one byte at a time
+	std::string expected;
+	bitstream slow(endian);
+	fn_putnextchar cbPut = [&expected](uint8_t b) {
+		expected.push_back(b);
+		return 1;
+	};
+	for (std::size_t i = 0; i < bits.size(); i++) {
+		slow.write(cbPut, bits[i], vals[i]);
+	}
+	slow.flushByte(cbPut);
+
+	// Fast path, into a buffer
+	std::vector<uint8_t> buf(expected.length() + 16);
+	bitstream fast(endian);
+	uint8_t *out = buf.data(), *outEnd = buf.data() + buf.size();
+	for (std::size_t i = 0; i < bits.size(); i++) {
+		BOOST_REQUIRE_EQUAL(fast.write(&out, outEnd, bits[i], vals[i]), bits[i]);
+	}
+	fast.flushByte(&out, outEnd);
+	BOOST_REQUIRE_EQUAL(out - buf.data(), expected.length());
+	BOOST_CHECK_MESSAGE(
+		default_sample().is_equal(expected,
+			std::string((char *)buf.data(), out - buf.data())),
+		"Buffered bitstream write produced different data");
+
+	// Read it back from the buffer, which uses the fast path until the last few
+	// bytes.
+	bitstream reader(endian);
+	const uint8_t *in = buf.data(), *inEnd = out;
+	for (std::size_t i = 0; i < bits.size(); i++) {
+		unsigned int val;
+		BOOST_REQUIRE_EQUAL(reader.read(&in, inEnd, bits[i], &val), bits[i]);
+		BOOST_REQUIRE_EQUAL(val, vals[i]);
+	}
+	BOOST_CHECK(in == inEnd);
+}
+
+BOOST_AUTO_TEST_CASE(bitstream_peek_consume)
+{
+	BOOST_TEST_MESSAGE("Peek at bits in a memory buffer, then consume some");
+
+	const uint8_t data[] = {0x12, 0x34, 0x56};
+	const uint8_t *in = data, *inEnd = data + sizeof(data);
+	unsigned int val;
+
+	bitstream be(bitstream::bigEndian);
+	BOOST_CHECK_EQUAL(be.peek(in, inEnd, 12, &val), 12);
+	BOOST_CHECK_EQUAL(val, 0x123);
+	be.consume(&in, inEnd, 4);
+	BOOST_CHECK_EQUAL(be.peek(in, inEnd, 12, &val), 12);
+	BOOST_CHECK_EQUAL(val, 0x234);
+	// Past the end, the missing bits are zero
+	BOOST_CHECK_EQUAL(be.peek(in, inEnd, 24, &val), 20);
+	BOOST_CHECK_EQUAL(val, 0x234560);
+	be.consume(&in, inEnd, 20);
+	BOOST_CHECK(in == inEnd);
+	BOOST_CHECK_EQUAL(be.peek(in, inEnd, 8, &val), 0);
+
+	in = data;
+	bitstream le(bitstream::littleEndian);
+	BOOST_CHECK_EQUAL(le.peek(in, inEnd, 12, &val), 12);
+	BOOST_CHECK_EQUAL(val, 0x412);
+	le.consume(&in, inEnd, 12);
+	BOOST_CHECK_EQUAL(le.read(&in, inEnd, 12, &val), 12);
+	BOOST_CHECK_EQUAL(val, 0x563);
+}
+
+BOOST_AUTO_TEST_CASE(bitstream_buffer_le)
+{
+	BOOST_TEST_MESSAGE("Little endian read/write through a memory buffer");
+	bitstream_buffer_check(bitstream::littleEndian);
+}
+
+BOOST_AUTO_TEST_CASE(bitstream_buffer_be)
+{
+	BOOST_TEST_MESSAGE("Big endian read/write through a memory buffer");
+	bitstream_buffer_check(bitstream::bigEndian);
+}
+
+/// Write codes split across separate bitstreams, join them with append() and
+/// make sure the result is the same as writing them all to one bitstream.
+void bitstream_append_check(bitstream::endian endian)
+{
+	std::vector<uint8_t> whole(256);
+	uint8_t *wholeOut = whole.data();
+	bitstream all(endian);
+
+	std::vector<uint8_t> joined(256);
+	uint8_t *joinedOut = joined.data();
+	bitstream join(endian);
+
+	uint32_t seed = 1;
+	// Block sizes chosen to leave the join at every bit position, including a
+	// whole number of bytes and an empty block
+	const unsigned int lenBlocks[] = {9, 16, 0, 7, 13, 40, 1, 3, 8, 29};
+	for (unsigned int lenBlock : lenBlocks) {
+		std::vector<uint8_t> block(16);
+		uint8_t *blockOut = block.data();
+		bitstream part(endian);
+		for (unsigned int i = 0; i < lenBlock; i++) {
+			unsigned int bit = (next_random(seed) >> 16) & 1;
+			all.write(&wholeOut, whole.data() + whole.size(), 1, bit);
+			part.write(&blockOut, block.data() + block.size(), 1, bit);
+		}
+		BOOST_CHECK_EQUAL(part.pendingBits(), lenBlock ? (lenBlock - 1) % 8 + 1 : 0);
+		part.flushByte(&blockOut, block.data() + block.size());
+		join.append(&joinedOut, joined.data() + joined.size(), block.data(),
+			lenBlock);
+	}
+	all.flushByte(&wholeOut, whole.data() + whole.size());
+	join.flushByte(&joinedOut, joined.data() + joined.size());
+
+	BOOST_CHECK_MESSAGE(
+		default_sample().is_equal(
+			std::string((char *)whole.data(), wholeOut - whole.data()),
+			std::string((char *)joined.data(), joinedOut - joined.data())),
+		"Appending bitstreams produced different data");
+}
+
+BOOST_AUTO_TEST_CASE(bitstream_append_le)
+{
+	BOOST_TEST_MESSAGE("Join little endian bitstreams together");
+	bitstream_append_check(bitstream::littleEndian);
+}
+
+BOOST_AUTO_TEST_CASE(bitstream_append_be)
+{
+	BOOST_TEST_MESSAGE("Join big endian bitstreams together");
+	bitstream_append_check(bitstream::bigEndian);
+}
+
+/// Read and write runs of same-sized values with read_array() and
+/// write_array(), and make sure they match read() and write().
+void bitstream_array_check(bitstream::endian endian)
+{
+	// Long enough to cross block boundaries in the parent stream
+	std::string content = make_corpus(BITSTREAM_BUFFER_SIZE * 2 + 37, 1);
+
+	const unsigned int widths[] = {1, 2, 3, 4, 5, 6, 8, 9, 12, 16, 17, 24, 25,
+		31, 32};
+	for (unsigned int bits : widths) {
+		for (unsigned int start : {0, 3}) {
+			stream::len count = (content.length() * 8 - start) / bits;
+
+			// Read everything one value at a time
+			std::vector<uint32_t> expected(count);
+			{
+				auto base = std::make_shared<stream::string>(content);
+				bitstream ref(base, endian);
+				ref.seek(start, stream::start);
+				for (auto& v : expected) {
+					unsigned int val;
+					BOOST_REQUIRE_EQUAL(ref.read(bits, &val), bits);
+					v = val;
+				}
+			}
+
+			// Read the same values in two runs, with a read() in between, and ask
+			// for more than there are to make sure it stops at EOF
+			auto base = std::make_shared<stream::string>(content);
+			bitstream bit(base, endian);
+			bit.seek(start, stream::start);
+			std::vector<uint32_t> actual(count + 2);
+			stream::len half = count / 2;
+			BOOST_REQUIRE_EQUAL(bit.read_array(bits, actual.data(), half), half);
+			unsigned int val;
+			BOOST_REQUIRE_EQUAL(bit.read(bits, &val), bits);
+			actual[half] = val;
+			BOOST_REQUIRE_EQUAL(
+				bit.read_array(bits, actual.data() + half + 1, count + 1 - half),
+				count - half - 1);
+			for (stream::len i = 0; i < count; i++) {
+				BOOST_REQUIRE_MESSAGE(actual[i] == expected[i], "Value " << i
+					<< " of " << bits << "-bit array at offset " << start
+					<< " was " << actual[i] << ", expected " << expected[i]);
+			}
+
+			if (bits <= 16) {
+				bit.seek(start, stream::start);
+				std::vector<uint16_t> actual16(count);
+				BOOST_REQUIRE_EQUAL(bit.read_array(bits, actual16.data(), count),
+					count);
+				for (stream::len i = 0; i < count; i++) {
+					BOOST_REQUIRE_EQUAL(actual16[i], expected[i]);
+				}
+			}
+
+			// Write the values back in a different order, ending part way through
+			// a byte, and between some single writes.
+			std::reverse(expected.begin(), expected.end());
+			stream::len lenWrite = std::min<stream::len>(count - 2, 3001);
+			auto refBase = std::make_shared<stream::string>(content);
+			{
+				bitstream ref(refBase, endian);
+				ref.seek(start, stream::start);
+				ref.write(bits, expected[0]);
+				for (stream::len i = 1; i <= lenWrite; i++) {
+					ref.write(bits, expected[i]);
+				}
+				ref.write(bits, expected[lenWrite + 1]);
+				ref.flush();
+			}
+			auto arrBase = std::make_shared<stream::string>(content);
+			{
+				bitstream arr(arrBase, endian);
+				arr.seek(start, stream::start);
+				arr.write(bits, expected[0]);
+				arr.write_array(bits, expected.data() + 1, lenWrite);
+				arr.write(bits, expected[lenWrite + 1]);
+				arr.flush();
+			}
+			BOOST_REQUIRE_MESSAGE(arrBase->data == refBase->data, "Writing "
+				<< bits << "-bit array at offset " << start
+				<< " produced different data");
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(bitstream_array_le)
+{
+	BOOST_TEST_MESSAGE("Read/write little endian arrays of fixed-width values");
+	bitstream_array_check(bitstream::littleEndian);
+}
+
+BOOST_AUTO_TEST_CASE(bitstream_array_be)
+{
+	BOOST_TEST_MESSAGE("Read/write big endian arrays of fixed-width values");
+	bitstream_array_check(bitstream::bigEndian);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
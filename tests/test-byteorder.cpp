@@ -199,6 +199,43 @@ BOOST_AUTO_TEST_CASE(iostream_read)
 	}
 }
 
+BOOST_AUTO_TEST_CASE(functions_array)
+{
+	// Odd lengths so both the vector and the leftover paths are used
+	const unsigned int n = 19;
+	uint16_t a16[n], e16[n];
+	uint32_t a32[n], e32[n];
+	uint64_t a64[n], e64[n];
+	for (unsigned int i = 0; i < n; i++) {
+		a16[i] = 0x0102 + i * 0x1111;
+		a32[i] = 0x01020304 + i * 0x11111111;
+		a64[i] = 0x0102030405060708ULL + i * 0x1111111111111111ULL;
+		e16[i] = be16toh(a16[i]);
+		e32[i] = be32toh(a32[i]);
+		e64[i] = be64toh(a64[i]);
+	}
+	be16toh_array(a16, n);
+	be32toh_array(a32, n);
+	be64toh_array(a64, n);
+	for (unsigned int i = 0; i < n; i++) {
+		BOOST_CHECK_EQUAL(a16[i], e16[i]);
+		BOOST_CHECK_EQUAL(a32[i], e32[i]);
+		BOOST_CHECK_EQUAL(a64[i], e64[i]);
+	}
+
+	swab32_array(a32, n);
+	swab32_array(a32, n);
+	for (unsigned int i = 0; i < n; i++) BOOST_CHECK_EQUAL(a32[i], e32[i]);
+
+	int16_t s16[] = {0x0102, -2, 0x7FFE};
+	host_from_array<int16_t, big_endian>(s16, 3);
+	BOOST_CHECK_EQUAL(s16[0], (int16_t)be16toh(0x0102));
+	BOOST_CHECK_EQUAL(s16[1], (int16_t)be16toh((uint16_t)-2));
+	host_to_array<int16_t, big_endian>(s16, 3);
+	BOOST_CHECK_EQUAL(s16[1], -2);
+	BOOST_CHECK_EQUAL(s16[2], 0x7FFE);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace test_std_stream
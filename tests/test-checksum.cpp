@@ -0,0 +1,141 @@
+/**
+ * @file   test-checksum.cpp
+ * @brief  Test code for the checksum functions, filter and stream.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <camoto/checksum.hpp>
+#include <camoto/filter-chain.hpp>
+#include <camoto/filter-checksum.hpp>
+#include <camoto/filter-rle.hpp>
+#include <camoto/stream_checksum.hpp>
+#include <camoto/stream_filtered.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+BOOST_AUTO_TEST_SUITE(checksum_suite)
+
+BOOST_AUTO_TEST_CASE(known_values)
+{
+	BOOST_TEST_MESSAGE("Compare checksums against published values");
+
+	const uint8_t *digits = (const uint8_t *)"123456789";
+	BOOST_CHECK_EQUAL(crc32(0, digits, 9), 0xCBF43926);
+	BOOST_CHECK_EQUAL(crc32(0, nullptr, 0), 0);
+	BOOST_CHECK_EQUAL(adler32(1, (const uint8_t *)"Wikipedia", 9), 0x11E60398);
+	BOOST_CHECK_EQUAL(xor8(0, digits, 9), 0x31);
+}
+
+BOOST_AUTO_TEST_CASE(crc32_pieces)
+{
+	BOOST_TEST_MESSAGE("CRC32 gives the same result whatever size the "
+		"pieces are");
+
+	// Large blocks go through the fastest method the CPU has, and small ones
+	// through the lookup tables, so this checks one against the other.
+	std::string data = make_corpus(100000, 5);
+	const uint8_t *p = (const uint8_t *)data.data();
+	uint32_t whole = crc32(0, p, data.length());
+	uint32_t pieces = 0;
+	std::size_t pos = 0, n = 1;
+	while (pos < data.length()) {
+		std::size_t len = std::min(n, data.length() - pos);
+		pieces = crc32(pieces, p + pos, len);
+		pos += len;
+		n = (n * 7 + 3) % 61 + 1;
+	}
+	BOOST_CHECK_EQUAL(whole, pieces);
+
+	// Every length and alignment near the size where the fast path starts
+	for (std::size_t start = 0; start < 16; start++) {
+		for (std::size_t len = 48; len < 160; len++) {
+			uint32_t slow = 0;
+			for (std::size_t i = 0; i < len; i++) slow = crc32(slow, p + start + i, 1);
+			BOOST_REQUIRE_EQUAL(crc32(0, p + start, len), slow);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(adler32_long)
+{
+	BOOST_TEST_MESSAGE("Adler32 over enough data to need reducing");
+
+	// All 0xFF is the worst case for overflow
+	std::string data(100000, '\xFF');
+	const uint8_t *p = (const uint8_t *)data.data();
+	uint32_t a = 1, b = 0;
+	for (std::size_t i = 0; i < data.length(); i++) {
+		a = (a + 0xFF) % 65521;
+		b = (b + a) % 65521;
+	}
+	BOOST_CHECK_EQUAL(adler32(1, p, data.length()), (b << 16) | a);
+}
+
+BOOST_AUTO_TEST_CASE(checksum_filter)
+{
+	BOOST_TEST_MESSAGE("Checksum data as it comes out of another filter");
+
+	std::string data = make_corpus(50000, 5) + std::string(5000, 'x');
+	auto compressed = std::make_shared<stream::string>();
+	{
+		stream::input_filtered comp(std::make_shared<stream::string>(data),
+			std::make_shared<filter_rle_compress>(rle_scheme::PackBits));
+		stream::copy(*compressed, comp);
+	}
+
+	auto sum = std::make_shared<filter_checksum>(checksum_type::CRC32);
+	auto chain = std::make_shared<filter_chain>(
+		std::vector<std::shared_ptr<camoto::filter>>{
+			std::make_shared<filter_rle_decompress>(rle_scheme::PackBits),
+			sum,
+		});
+	stream::input_filtered decomp(compressed, chain);
+	BOOST_REQUIRE_EQUAL(decomp.size(), data.length());
+	BOOST_CHECK_EQUAL(sum->length(), data.length());
+	BOOST_CHECK_EQUAL(sum->value(),
+		crc32(0, (const uint8_t *)data.data(), data.length()));
+}
+
+BOOST_AUTO_TEST_CASE(checksum_stream)
+{
+	BOOST_TEST_MESSAGE("Checksum a stream as it is read");
+
+	std::string data = make_corpus(10000, 5);
+	auto src = std::make_shared<stream::string>(data);
+	stream::input_checksum s(src, checksum_type::Adler32);
+
+	s.read(100);
+	s.seekg(50, stream::start);
+	s.read(200); // overlaps what has already been read
+	BOOST_CHECK_EQUAL(s.length(), 250);
+
+	s.seekg(1000, stream::start);
+	s.read(100); // gap, so not added
+	BOOST_CHECK_EQUAL(s.length(), 250);
+	BOOST_CHECK(!s.complete());
+
+	s.seekg(250, stream::start);
+	s.read(data.length() - 250);
+	BOOST_CHECK(s.complete());
+	BOOST_CHECK_EQUAL(s.value(),
+		adler32(1, (const uint8_t *)data.data(), data.length()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,252 @@
+/**
+ * @file   test-decode_cache.cpp
+ * @brief  Test code for sharing decoded data between filtered streams.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/decode_cache.hpp>
+#include <camoto/filter-dummy.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_seg.hpp>
+#include <camoto/stream_sub.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+/// Filter that counts how many times it has been run over the data.
+class counted_filter: public filter_dummy
+{
+	public:
+		counted_filter(unsigned int *runs)
+			:	runs(runs)
+		{
+		}
+
+		virtual void reset(stream::len lenInput)
+		{
+			(*this->runs)++;
+			this->filter_dummy::reset(lenInput);
+			return;
+		}
+
+	protected:
+		unsigned int *runs;
+};
+
+/// Filter without a signature, so its output is never shared.
+class unsigned_filter: public counted_filter
+{
+	public:
+		unsigned_filter(unsigned int *runs)
+			:	counted_filter(runs)
+		{
+		}
+
+		virtual std::string signature() const
+		{
+			return std::string();
+		}
+};
+
+struct decode_cache_sample: public default_sample
+{
+	unsigned int runs;
+	stream::decode_cache& cache;
+
+	decode_cache_sample()
+		:	runs(0),
+			cache(stream::decode_cache::shared())
+	{
+		this->cache.clear();
+		this->cache.set_budget(1024 * 1024);
+	}
+
+	~decode_cache_sample()
+	{
+		this->cache.set_budget(0);
+	}
+
+	/// Open a filtered stream on the parent and read all of it.
+	std::string open(std::shared_ptr<stream::input> parent)
+	{
+		stream::input_filtered f(parent, std::make_shared<counted_filter>(
+			&this->runs));
+		return f.read(f.size());
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(decode_cache_suite, decode_cache_sample)
+
+BOOST_AUTO_TEST_CASE(repeat_open)
+{
+	BOOST_TEST_MESSAGE("Opening the same data twice only decodes it once");
+
+	auto parent = std::make_shared<stream::string>(std::string("0123456789"));
+	BOOST_CHECK_EQUAL(this->open(parent), "0123456789");
+	BOOST_CHECK_EQUAL(this->runs, 1);
+	BOOST_CHECK_EQUAL(this->cache.count(), 1);
+	BOOST_CHECK_EQUAL(this->cache.used(), 10);
+
+	// Held open while the second one reads, using seeks and views as well
+	stream::input_filtered f(parent, std::make_shared<counted_filter>(
+		&this->runs));
+	f.seekg(3, stream::start);
+	BOOST_CHECK_EQUAL(f.read(4), "3456");
+	BOOST_CHECK_EQUAL(f.tellg(), 7);
+	BOOST_CHECK_EQUAL(f.size(), 10);
+	uint8_t buf[3];
+	BOOST_CHECK_EQUAL(f.try_read_at(8, buf, 3), 2);
+	BOOST_CHECK_EQUAL(buf[0], '8');
+	stream::len got;
+	std::string scratch;
+	const uint8_t *v = f.view(1, 100, &got, scratch);
+	BOOST_CHECK_EQUAL(got, 9);
+	BOOST_CHECK_EQUAL(v[0], '1');
+	BOOST_CHECK_THROW(f.seekg(11, stream::start), stream::seek_error);
+	BOOST_CHECK_EQUAL(this->runs, 1);
+}
+
+BOOST_AUTO_TEST_CASE(write_invalidates)
+{
+	BOOST_TEST_MESSAGE("Writing to the parent drops its cached data");
+
+	auto parent = std::make_shared<stream::string>(std::string("abcdef"));
+	BOOST_CHECK_EQUAL(this->open(parent), "abcdef");
+	BOOST_CHECK_EQUAL(this->cache.count(), 1);
+
+	// A stream still reading the old data keeps it
+	stream::input_filtered old(parent, std::make_shared<counted_filter>(
+		&this->runs));
+	BOOST_CHECK_EQUAL(this->runs, 1);
+	BOOST_CHECK_EQUAL(old.size(), 6);
+
+	parent->seekp(0, stream::start);
+	parent->write("X");
+	BOOST_CHECK_EQUAL(this->cache.count(), 0);
+	BOOST_CHECK_EQUAL(this->open(parent), "Xbcdef");
+	BOOST_CHECK_EQUAL(this->runs, 2);
+	BOOST_CHECK_EQUAL(old.read(6), "abcdef");
+
+	parent->truncate(3);
+	BOOST_CHECK_EQUAL(this->open(parent), "Xbc");
+	BOOST_CHECK_EQUAL(this->runs, 3);
+}
+
+BOOST_AUTO_TEST_CASE(substreams)
+{
+	BOOST_TEST_MESSAGE("Substreams over the same bytes share decoded data");
+
+	auto base = std::make_shared<stream::seg>(std::unique_ptr<stream::inout>(
+		new stream::string(std::string("aaaaabbbbbccccc"))));
+	BOOST_CHECK_EQUAL(this->open(std::make_shared<stream::input_sub>(base, 5, 5)),
+		"bbbbb");
+	BOOST_CHECK_EQUAL(this->open(std::make_shared<stream::input_sub>(base, 5, 5)),
+		"bbbbb");
+	BOOST_CHECK_EQUAL(this->runs, 1);
+
+	// A different range is a different entry
+	BOOST_CHECK_EQUAL(this->open(std::make_shared<stream::input_sub>(base, 5, 6)),
+		"bbbbbc");
+	BOOST_CHECK_EQUAL(this->runs, 2);
+
+	// Inserting data into the segstream changes what the substream sees
+	base->seekp(5, stream::start);
+	base->insert(1);
+	base->write("Z");
+	BOOST_CHECK_EQUAL(this->open(std::make_shared<stream::input_sub>(base, 5, 5)),
+		"Zbbbb");
+	BOOST_CHECK_EQUAL(this->runs, 3);
+}
+
+BOOST_AUTO_TEST_CASE(not_shared)
+{
+	BOOST_TEST_MESSAGE("Data is decoded every time when it can't be shared");
+
+	auto parent = std::make_shared<stream::string>(std::string("data"));
+	for (int i = 0; i < 2; i++) {
+		stream::input_filtered f(parent, std::make_shared<unsigned_filter>(
+			&this->runs));
+		BOOST_CHECK_EQUAL(f.read(4), "data");
+	}
+	BOOST_CHECK_EQUAL(this->runs, 2);
+
+	// Disabled cache
+	this->cache.set_budget(0);
+	this->open(parent);
+	this->open(parent);
+	BOOST_CHECK_EQUAL(this->runs, 4);
+	BOOST_CHECK_EQUAL(this->cache.count(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(budget)
+{
+	BOOST_TEST_MESSAGE("Least recently used data is dropped to stay in budget");
+
+	this->cache.set_budget(250);
+	auto a = std::make_shared<stream::string>(std::string(100, 'a'));
+	auto b = std::make_shared<stream::string>(std::string(100, 'b'));
+	auto c = std::make_shared<stream::string>(std::string(100, 'c'));
+	auto big = std::make_shared<stream::string>(std::string(300, 'd'));
+
+	this->open(a);
+	this->open(b);
+	this->open(a); // now b is the least recently used
+	BOOST_CHECK_EQUAL(this->runs, 2);
+	this->open(c);
+	BOOST_CHECK_EQUAL(this->cache.count(), 2);
+	BOOST_CHECK_EQUAL(this->cache.used(), 200);
+
+	this->open(a);
+	BOOST_CHECK_EQUAL(this->runs, 3);
+	this->open(b);
+	BOOST_CHECK_EQUAL(this->runs, 4);
+
+	// Too big to keep at all
+	this->open(big);
+	BOOST_CHECK_LE(this->cache.used(), 250);
+	BOOST_CHECK_EQUAL(this->open(big), std::string(300, 'd'));
+	BOOST_CHECK_EQUAL(this->runs, 6);
+}
+
+BOOST_AUTO_TEST_CASE(read_write)
+{
+	BOOST_TEST_MESSAGE("Read/write filtered streams copy shared data");
+
+	auto parent = std::make_shared<stream::string>(std::string("hello"));
+	BOOST_CHECK_EQUAL(this->open(parent), "hello");
+
+	auto algo = std::make_shared<counted_filter>(&this->runs);
+	stream::input_filtered reader(parent, algo);
+	{
+		stream::filtered f(parent, algo, algo,
+			stream::fn_notify_prefiltered_size());
+		f.seekp(0, stream::start);
+		f.write("J");
+		BOOST_CHECK_EQUAL(this->runs, 1);
+		f.seekg(0, stream::start);
+		BOOST_CHECK_EQUAL(f.read(5), "Jello");
+
+		// The change isn't seen by anyone else until it is flushed
+		BOOST_CHECK_EQUAL(reader.read(5), "hello");
+		f.flush();
+	}
+	BOOST_CHECK_EQUAL(parent->data, "Jello");
+	BOOST_CHECK_EQUAL(this->open(parent), "Jello");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
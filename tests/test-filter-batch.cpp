@@ -0,0 +1,109 @@
+/**
+ * @file   test-filter-batch.cpp
+ * @brief  Test code for filtering many blocks of data in parallel.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/stream_sub.hpp>
+#include <camoto/filter-batch.hpp>
+#include <camoto/filter-lzw.hpp>
+
+#include "tests.hpp"
+
+using namespace camoto;
+
+#define LZW_PARAMS 9, 12, 0x101, 0x100, 0, \
+	LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT
+
+/// Stream that fails every read.
+class broken_input: public stream::string
+{
+	public:
+		broken_input()
+			:	stream::string_core(std::string())
+		{
+		}
+
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len)
+		{
+			throw stream::read_error("Simulated read failure");
+		}
+};
+
+BOOST_AUTO_TEST_SUITE(filter_batch_suite)
+
+BOOST_AUTO_TEST_CASE(decompress_many)
+{
+	BOOST_TEST_MESSAGE("Decompress many resources from one archive in parallel");
+
+	// Build an "archive" of LZW-compressed resources of different sizes
+	auto archive = std::make_shared<stream::string>();
+	std::vector<std::string> originals;
+	std::vector<std::pair<stream::pos, stream::len>> ranges;
+	for (unsigned int i = 0; i < 40; i++) {
+		std::string content = sample_text(100 + i * 997);
+		auto orig = std::make_shared<stream::string>(content);
+		stream::input_filtered comp(orig,
+			std::make_shared<filter_lzw_compress>(LZW_PARAMS));
+		stream::pos start = archive->size();
+		archive->seekp(0, stream::end);
+		stream::copy(*archive, comp);
+		ranges.emplace_back(start, archive->size() - start);
+		originals.push_back(content);
+	}
+
+	std::vector<filter_job> jobs;
+	std::vector<std::shared_ptr<stream::string>> results;
+	for (auto& r : ranges) {
+		auto dest = std::make_shared<stream::string>();
+		filter_job job;
+		job.source = std::make_shared<stream::input_sub>(archive, r.first,
+			r.second);
+		job.dest = dest;
+		jobs.push_back(job);
+		results.push_back(dest);
+	}
+	// Make one of them fail
+	jobs[5].source = std::make_shared<broken_input>();
+
+	thread_pool pool(4);
+	unsigned int numCreated = 0;
+	std::mutex lockCreated;
+	unsigned int failures = filter_many(jobs, [&numCreated, &lockCreated]() {
+		std::lock_guard<std::mutex> guard(lockCreated);
+		numCreated++;
+		return std::make_shared<filter_lzw_decompress>(LZW_PARAMS);
+	}, &pool);
+
+	BOOST_CHECK_EQUAL(failures, 1);
+	BOOST_CHECK(jobs[5].error);
+	BOOST_CHECK_THROW(std::rethrow_exception(jobs[5].error), stream::read_error);
+	BOOST_CHECK_LE(numCreated, pool.size());
+	for (unsigned int i = 0; i < jobs.size(); i++) {
+		if (i == 5) continue;
+		BOOST_CHECK(!jobs[i].error);
+		BOOST_CHECK_MESSAGE(results[i]->data == originals[i],
+			"Resource #" << i << " was not decompressed correctly");
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,161 @@
+/**
+ * @file   test-filter-chain.cpp
+ * @brief  Test code for running several filters in a chain.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <camoto/stream_filtered.hpp>
+#include <camoto/util.hpp>
+#include <camoto/filter-chain.hpp>
+#include <camoto/filter-crop.hpp>
+#include <camoto/filter-dummy.hpp>
+#include <camoto/filter-lzw.hpp>
+
+#include "tests.hpp"
+
+using namespace camoto;
+
+/// Some data that is long enough to need several buffers in each stage.
+static std::string chain_sample_text(unsigned int len)
+{
+	std::string s;
+	uint32_t r = 1;
+	while (s.length() < len) {
+		s += "Hello hello ";
+		s += (char)('a' + ((next_random(r) >> 16) % 26));
+	}
+	s.resize(len);
+	return s;
+}
+
+#define LZW_PARAMS 9, 12, 0x101, 0x100, 0, \
+	LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT
+
+BOOST_FIXTURE_TEST_SUITE(filter_chain_suite, string_sample)
+
+BOOST_AUTO_TEST_CASE(chain_empty)
+{
+	BOOST_TEST_MESSAGE("Empty chain passes data through unchanged");
+
+	std::string content = chain_sample_text(10000);
+	*this->in << content;
+	this->in->seekg(0, stream::start);
+
+	stream::input_filtered f(this->in, std::make_shared<filter_chain>());
+	stream::copy(this->out, f);
+	BOOST_CHECK_MESSAGE(is_equal(content), "Empty filter chain changed data");
+}
+
+BOOST_AUTO_TEST_CASE(chain_crop)
+{
+	BOOST_TEST_MESSAGE("Two filters in a chain");
+
+	std::string content = chain_sample_text(20000);
+	*this->in << content;
+	this->in->seekg(0, stream::start);
+
+	auto chain = std::make_shared<filter_chain>();
+	chain->add(std::make_shared<filter_crop>(2));
+	chain->add(std::make_shared<filter_crop>(3));
+	stream::input_filtered f(this->in, chain);
+	stream::copy(this->out, f);
+	BOOST_CHECK_MESSAGE(is_equal(content.substr(5)),
+		"Chain of crop filters failed");
+}
+
+BOOST_AUTO_TEST_CASE(chain_lzw_roundtrip)
+{
+	BOOST_TEST_MESSAGE("Compress and decompress in one chain");
+
+	std::string content = chain_sample_text(50000);
+	*this->in << content;
+	this->in->seekg(0, stream::start);
+
+	// The compressed data is smaller than a chain buffer at each step, and
+	// the decompressor produces more than it consumes, so this exercises
+	// partial reads and writes between stages.
+	stream::input_filtered f(this->in, std::make_shared<filter_chain>(
+		std::vector<std::shared_ptr<filter>>{
+			std::make_shared<filter_lzw_compress>(LZW_PARAMS),
+			std::make_shared<filter_lzw_decompress>(LZW_PARAMS),
+			std::make_shared<filter_crop>(1),
+		}
+	));
+	stream::copy(this->out, f);
+	BOOST_CHECK_MESSAGE(is_equal(content.substr(1)),
+		"LZW round trip through a filter chain failed");
+}
+
+BOOST_AUTO_TEST_CASE(chain_matches_nested)
+{
+	BOOST_TEST_MESSAGE("Chain gives the same result as nested filtered streams");
+
+	std::string content = chain_sample_text(30000);
+	*this->in << content;
+	this->in->seekg(0, stream::start);
+
+	auto nested = std::make_shared<stream::input_filtered>(this->in,
+		std::make_shared<filter_lzw_compress>(LZW_PARAMS));
+	stream::input_filtered outer(nested, std::make_shared<filter_crop>(7));
+	stream::string expected;
+	stream::copy(expected, outer);
+
+	this->in->seekg(0, stream::start);
+	stream::input_filtered f(this->in, std::make_shared<filter_chain>(
+		std::vector<std::shared_ptr<filter>>{
+			std::make_shared<filter_lzw_compress>(LZW_PARAMS),
+			std::make_shared<filter_crop>(7),
+		}
+	));
+	stream::copy(this->out, f);
+	BOOST_CHECK_MESSAGE(is_equal(expected.data),
+		"Filter chain output differs from nested filters");
+}
+
+BOOST_AUTO_TEST_CASE(chain_decompress_first)
+{
+	BOOST_TEST_MESSAGE("Decompressor at the start of a chain gets whole blocks");
+
+	// Random data barely compresses, so the decompressor consumes its input
+	// almost as fast as it produces output, and is often left with only a
+	// few bytes of the caller's buffer.
+	std::string content = make_corpus(100000, 5);
+	*this->in << content;
+	this->in->seekg(0, stream::start);
+	stream::string compressed;
+	stream::input_filtered comp(this->in,
+		std::make_shared<filter_lzw_compress>(LZW_PARAMS));
+	stream::copy(compressed, comp);
+	BOOST_REQUIRE_GT(compressed.data.length(), 8192);
+
+	stream::input_filtered f(
+		std::make_shared<stream::string>(std::move(compressed.data)),
+		std::make_shared<filter_chain>(
+			std::vector<std::shared_ptr<filter>>{
+				std::make_shared<filter_lzw_decompress>(LZW_PARAMS),
+				std::make_shared<filter_dummy>(),
+			}
+		)
+	);
+	stream::copy(this->out, f);
+	BOOST_CHECK_MESSAGE(is_equal(content),
+		"Decompressing at the start of a filter chain lost data");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -48,4 +48,69 @@ BOOST_AUTO_TEST_CASE(crop_comp_write)
 		"Reading data with unfiltered size at start failed");
 }
 
+/// String stream that remembers the lowest offset anything was read from.
+class watched_string: public stream::input_string
+{
+	public:
+		watched_string(std::string content)
+			:	string_core(content),
+				input_string(content),
+				lowest(-1)
+		{
+		}
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len)
+		{
+			stream::pos pos = this->tellg();
+			stream::len r = this->input_string::try_read(buffer, len);
+			if (r) this->lowest = std::min(this->lowest, pos);
+			return r;
+		}
+
+		stream::pos lowest;
+};
+
+BOOST_AUTO_TEST_CASE(crop_skip_read)
+{
+	BOOST_TEST_MESSAGE("Cropped data is skipped without being read");
+
+	auto parent = std::make_shared<watched_string>(
+		std::string(100000, 'x') + "Hello");
+	stream::input_filtered f(parent, std::make_shared<filter_crop>(100000));
+	BOOST_CHECK_EQUAL(f.read(f.size()), "Hello");
+	BOOST_CHECK_EQUAL(parent->lowest, 100000);
+
+	auto parent2 = std::make_shared<watched_string>(
+		std::string(100000, 'x') + "World");
+	stream::input_filtered_streaming fs(parent2,
+		std::make_shared<filter_crop>(100000));
+	BOOST_CHECK_EQUAL(fs.read(5), "World");
+	BOOST_CHECK_EQUAL(parent2->lowest, 100000);
+}
+
+BOOST_AUTO_TEST_CASE(crop_short_input)
+{
+	BOOST_TEST_MESSAGE("Crop more data than arrives in the first block");
+
+	filter_crop algo(10);
+	algo.reset(0);
+	uint8_t out[16];
+	stream::len lenOut = sizeof(out), lenIn = 6;
+	algo.transform(out, &lenOut, (const uint8_t *)"abcdef", &lenIn);
+	BOOST_CHECK_EQUAL(lenIn, 6);
+	BOOST_CHECK_EQUAL(lenOut, 0);
+
+	lenOut = sizeof(out);
+	lenIn = 6;
+	algo.transform(out, &lenOut, (const uint8_t *)"ghijkl", &lenIn);
+	BOOST_CHECK_EQUAL(lenIn, 6);
+	BOOST_REQUIRE_EQUAL(lenOut, 2);
+	BOOST_CHECK_EQUAL(std::string((char *)out, 2), "kl");
+
+	// Crop past the end of the data
+	auto parent = std::make_shared<stream::input_string>("short");
+	stream::input_filtered f(parent, std::make_shared<filter_crop>(10));
+	BOOST_CHECK_EQUAL(f.size(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,130 @@
+/**
+ * @file   test-filter-delta.cpp
+ * @brief  Test code for the delta coding filter.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/filter-delta.hpp>
+#include <camoto/stream_filtered.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+struct delta_sample: public filter_sample
+{
+	/// Delta-encode one value at a time, to compare against the filter.
+	std::string encodeSlowly(delta_type type, const std::string& data)
+	{
+		std::string out = data;
+		if (type == delta_type::U8) {
+			uint8_t prev = 0;
+			for (auto& c : out) {
+				uint8_t cur = c;
+				c = cur - prev;
+				prev = cur;
+			}
+			return out;
+		}
+		unsigned int lo = (type == delta_type::U16LE) ? 0 : 1;
+		uint16_t prev = 0;
+		for (std::size_t i = 0; i + 2 <= out.length(); i += 2) {
+			uint16_t cur = (uint8_t)out[i + lo] | ((uint8_t)out[i + 1 - lo] << 8);
+			uint16_t d = cur - prev;
+			prev = cur;
+			out[i + lo] = d & 0xFF;
+			out[i + 1 - lo] = d >> 8;
+		}
+		return out;
+	}
+
+	void roundtrip(delta_type type)
+	{
+		// Odd length, so 16-bit values leave a byte over
+		std::string data = make_corpus(10001, 11);
+		std::string encoded = this->encodeSlowly(type, data);
+
+		BOOST_CHECK_MESSAGE(this->is_equal(encoded, this->apply(
+			std::make_shared<filter_delta>(type, filter_delta::Direction::Encode),
+			data)), "Delta encoding failed");
+		BOOST_CHECK_MESSAGE(this->is_equal(data, this->apply(
+			std::make_shared<filter_delta>(type, filter_delta::Direction::Decode),
+			encoded)), "Delta decoding failed");
+
+		// Through small buffers, so the previous value is carried over between
+		// calls.  Chunks are a few values long but not a multiple of 16.
+		filter_delta enc(type, filter_delta::Direction::Encode);
+		filter_delta dec(type, filter_delta::Direction::Decode);
+		std::string small = data.substr(0, 999);
+		std::string smallEncoded = this->encodeSlowly(type, small);
+		BOOST_CHECK_MESSAGE(this->is_equal(smallEncoded,
+			this->applySmall(enc, small, 6)),
+			"Delta encoding through small buffers failed");
+		BOOST_CHECK_MESSAGE(this->is_equal(small,
+			this->applySmall(dec, smallEncoded, 34)),
+			"Delta decoding through small buffers failed");
+		return;
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(delta_suite, delta_sample)
+
+BOOST_AUTO_TEST_CASE(decode_u8)
+{
+	BOOST_TEST_MESSAGE("Decode 8-bit delta values");
+	auto f = std::make_shared<filter_delta>(delta_type::U8,
+		filter_delta::Direction::Decode);
+	BOOST_CHECK_MESSAGE(is_equal(makeString("\x01\x03\x06\x05\xFF"),
+		this->apply(f, makeString("\x01\x02\x03\xFF\xFA"))),
+		"Decoding 8-bit delta values failed");
+}
+
+BOOST_AUTO_TEST_CASE(decode_u16)
+{
+	BOOST_TEST_MESSAGE("Decode 16-bit delta values");
+	auto le = std::make_shared<filter_delta>(delta_type::U16LE,
+		filter_delta::Direction::Decode);
+	BOOST_CHECK_MESSAGE(is_equal(makeString("\xFF\x00\x00\x01\xFF\x00"),
+		this->apply(le, makeString("\xFF\x00\x01\x00\xFF\xFF"))),
+		"Decoding little-endian 16-bit delta values failed");
+
+	auto be = std::make_shared<filter_delta>(delta_type::U16BE,
+		filter_delta::Direction::Decode);
+	BOOST_CHECK_MESSAGE(is_equal(makeString("\x00\xFF\x01\x00\x00\xFF"),
+		this->apply(be, makeString("\x00\xFF\x00\x01\xFF\xFF"))),
+		"Decoding big-endian 16-bit delta values failed");
+}
+
+BOOST_AUTO_TEST_CASE(roundtrip_u8)
+{
+	BOOST_TEST_MESSAGE("8-bit delta round trip");
+	this->roundtrip(delta_type::U8);
+}
+
+BOOST_AUTO_TEST_CASE(roundtrip_u16le)
+{
+	BOOST_TEST_MESSAGE("Little-endian 16-bit delta round trip");
+	this->roundtrip(delta_type::U16LE);
+}
+
+BOOST_AUTO_TEST_CASE(roundtrip_u16be)
+{
+	BOOST_TEST_MESSAGE("Big-endian 16-bit delta round trip");
+	this->roundtrip(delta_type::U16BE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -23,6 +23,7 @@
 #include <camoto/filter-lzss.hpp>
 #include <camoto/bitstream.hpp>
 #include <camoto/stream_filtered.hpp>
+#include <camoto/thread_pool.hpp>
 #include <camoto/util.hpp>
 
 #include "tests.hpp"
@@ -94,9 +95,111 @@ BOOST_AUTO_TEST_CASE(lzss_decomp_read_overlap)
 		"Decompressing LZSS data with overlapping reads failed");
 }
 
+BOOST_AUTO_TEST_CASE(lzss_decomp_read_wrap)
+{
+	BOOST_TEST_MESSAGE("Decompress LZSS back-references that wrap around the "
+		"window");
+
+	bitstream bit_in(this->in, bitstream::bigEndian);
+	bit_in.write(9, 'A');
+	bit_in.write(1, 1);      // Code
+	bit_in.write(8, 255);    // len=255(+2)
+	bit_in.write(4, 0);      // dist=0(+1) "A" -> 258 * "A"
+	for (int i = 0; i < 5; i++) bit_in.write(9, 'B' + i);
+	bit_in.write(1, 1);      // Code
+	bit_in.write(8, 8);      // len=8(+2)
+	bit_in.write(4, 15);     // dist=15(+1) "AAAAAAAAAAABCDEF" (wrapped window)
+	bit_in.flush();
+
+	auto processed = std::make_shared<stream::input_filtered>(
+		this->in,
+		std::make_shared<filter_lzss_decompress>(
+			bitstream::bigEndian, 8, 4
+		)
+	);
+
+	stream::copy(this->out, *processed);
+
+	BOOST_CHECK_MESSAGE(is_equal(std::string(258, 'A') + "BCDEF" + "AAAAAAAAAA"),
+		"Decompressing LZSS data wrapping around the window failed");
+}
+
+BOOST_AUTO_TEST_CASE(lzss_decomp_split_input)
+{
+	BOOST_TEST_MESSAGE("Decompress LZSS data given one byte at a time");
+
+	bitstream bit_in(this->in, bitstream::bigEndian);
+	bit_in.write(9, 'H');
+	bit_in.write(9, 'e');
+	bit_in.write(9, 'l');
+	bit_in.write(9, 'l');
+	bit_in.write(9, 'o');
+	bit_in.write(9, ' ');
+	bit_in.write(1, 1);      // Code
+	bit_in.write(2, 3);      // len=3(+2)
+	bit_in.write(8, 5);      // dist=5(+1) "[Hello] "
+	bit_in.write(9, '.');
+	bit_in.flush();
+
+	filter_lzss_decompress algo(bitstream::bigEndian, 2, 8);
+	algo.reset(this->in->data.length());
+
+	// Nearly every field is split across two bytes, so each call runs out of
+	// input part way through one.  Input that isn't used is passed in again
+	// with the next byte, as input_filtered would.
+	std::string pending, result;
+	for (stream::pos i = 0; i <= this->in->data.length(); i++) {
+		if (i < this->in->data.length()) pending += this->in->data[i];
+		for (;;) {
+			uint8_t buf[16];
+			stream::len lenOut = sizeof(buf);
+			stream::len lenIn = pending.length();
+			algo.transform(buf, &lenOut, (const uint8_t *)pending.c_str(), &lenIn);
+			pending.erase(0, lenIn);
+			result.append((const char *)buf, lenOut);
+			if ((lenIn == 0) && (lenOut == 0)) break;
+		}
+	}
+
+	BOOST_CHECK_MESSAGE(is_equal("Hello Hello.", result),
+		"Decompressing LZSS data split into single bytes failed");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
-BOOST_FIXTURE_TEST_SUITE(lzss_comp_suite, string_sample)
+struct lzss_comp_sample: public string_sample
+{
+	/// Compress and then decompress some data and compare it to the original.
+	boost::test_tools::predicate_result roundtrip(const std::string& content,
+		bitstream::endian endian, unsigned int sizeLength,
+		unsigned int sizeDistance, filter_lzss_compress::Effort effort,
+		stream::len *lenCompressed = nullptr)
+	{
+		auto orig = std::make_shared<stream::string>(content);
+		auto compressed = std::make_shared<stream::string>();
+		{
+			stream::input_filtered filt(orig,
+				std::make_shared<filter_lzss_compress>(
+					endian, sizeLength, sizeDistance, effort
+				)
+			);
+			stream::copy(*compressed, filt);
+		}
+		if (lenCompressed) *lenCompressed = compressed->data.length();
+
+		compressed->seekg(0, stream::start);
+		stream::input_filtered filt(compressed,
+			std::make_shared<filter_lzss_decompress>(
+				endian, sizeLength, sizeDistance
+			)
+		);
+		stream::string result;
+		stream::copy(result, filt);
+		return this->default_sample::is_equal(content, result.data);
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(lzss_comp_suite, lzss_comp_sample)
 
 BOOST_AUTO_TEST_CASE(lzss_comp_write)
 {
@@ -111,16 +214,12 @@ BOOST_AUTO_TEST_CASE(lzss_comp_write)
 	bit_exp.write(9, 'o');
 	bit_exp.write(9, ' ');
 	bit_exp.write(9, 'h');
-	bit_exp.write(9, 'e');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'o');
-	bit_exp.write(9, ' ');
-	bit_exp.write(9, 'h');
-	bit_exp.write(9, 'e');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'o');
+	bit_exp.write(1, 1);      // Code
+	bit_exp.write(2, 3);      // len=3(+2)
+	bit_exp.write(8, 5);      // dist=5(+1) "H[ello ]h"
+	bit_exp.write(1, 1);      // Code
+	bit_exp.write(2, 3);      // len=3(+2)
+	bit_exp.write(8, 5);      // dist=5(+1) "Hello [hello] "
 	bit_exp.write(9, '.');
 	bit_exp.flush();
 
@@ -140,4 +239,279 @@ BOOST_AUTO_TEST_CASE(lzss_comp_write)
 		"Compressing LZSS data failed");
 }
 
+BOOST_AUTO_TEST_CASE(lzss_comp_write_store)
+{
+	BOOST_TEST_MESSAGE("Store data as LZSS literals");
+
+	std::shared_ptr<stream::string> exp(new stream::string());
+	bitstream bit_exp(exp, bitstream::bigEndian);
+	for (auto c : std::string("Hello hello.")) bit_exp.write(9, c);
+	bit_exp.flush();
+
+	this->in->write("Hello hello.");
+	this->in->flush();
+
+	auto processed = std::make_shared<stream::input_filtered>(
+		this->in,
+		std::make_shared<filter_lzss_compress>(
+			bitstream::bigEndian, 2, 8, filter_lzss_compress::Effort::Store
+		)
+	);
+
+	stream::copy(this->out, *processed);
+
+	BOOST_CHECK_MESSAGE(is_equal(exp->data),
+		"Storing LZSS data failed");
+}
+
+BOOST_AUTO_TEST_CASE(lzss_comp_write_overlap)
+{
+	BOOST_TEST_MESSAGE("Compress a run using an overlapping back-reference");
+
+	std::shared_ptr<stream::string> exp(new stream::string());
+	bitstream bit_exp(exp, bitstream::bigEndian);
+	bit_exp.write(9, 'A');
+	bit_exp.write(9, 'B');
+	bit_exp.write(1, 1);      // Code
+	bit_exp.write(4, 8);      // len=8(+2)
+	bit_exp.write(8, 1);      // dist=1(+1) "[AB"_"_"_"_"_] -> "ABABABABABAB"
+	bit_exp.flush();
+
+	this->in->write("ABABABABABAB");
+	this->in->flush();
+
+	auto processed = std::make_shared<stream::input_filtered>(
+		this->in,
+		std::make_shared<filter_lzss_compress>(
+			bitstream::bigEndian, 4, 8
+		)
+	);
+
+	stream::copy(this->out, *processed);
+
+	BOOST_CHECK_MESSAGE(is_equal(exp->data),
+		"Compressing LZSS data with an overlapping back-reference failed");
+}
+
+BOOST_AUTO_TEST_CASE(lzss_comp_ratio)
+{
+	BOOST_TEST_MESSAGE("Make sure each effort level compresses at least as well "
+		"as the one before it");
+
+	std::string content = sample_text(20000);
+	stream::len lenStore, lenGreedy, lenLazy, lenOptimal;
+	BOOST_CHECK(roundtrip(content, bitstream::bigEndian, 4, 12,
+		filter_lzss_compress::Effort::Store, &lenStore));
+	BOOST_CHECK(roundtrip(content, bitstream::bigEndian, 4, 12,
+		filter_lzss_compress::Effort::Greedy, &lenGreedy));
+	BOOST_CHECK(roundtrip(content, bitstream::bigEndian, 4, 12,
+		filter_lzss_compress::Effort::Lazy, &lenLazy));
+	BOOST_CHECK(roundtrip(content, bitstream::bigEndian, 4, 12,
+		filter_lzss_compress::Effort::Optimal, &lenOptimal));
+
+	BOOST_CHECK_EQUAL(lenStore, (content.length() * 9 + 7) / 8);
+	BOOST_CHECK_LT(lenGreedy, content.length() / 2);
+	BOOST_CHECK_LE(lenLazy, lenGreedy);
+	BOOST_CHECK_LE(lenOptimal, lenLazy);
+}
+
+BOOST_AUTO_TEST_CASE(lzss_comp_roundtrip)
+{
+	BOOST_TEST_MESSAGE("Compress and decompress with various settings");
+
+	std::string content = sample_text(50000);
+	// Runs longer than the window, to test matches at the maximum distance
+	content += std::string(1000, 'x');
+	content += sample_text(300);
+
+	for (auto effort : {
+		filter_lzss_compress::Effort::Store,
+		filter_lzss_compress::Effort::Greedy,
+		filter_lzss_compress::Effort::Lazy,
+		filter_lzss_compress::Effort::Optimal,
+	}) {
+		BOOST_CHECK(roundtrip(content, bitstream::bigEndian, 2, 8, effort));
+		BOOST_CHECK(roundtrip(content, bitstream::littleEndian, 4, 12, effort));
+		BOOST_CHECK(roundtrip(content, bitstream::bigEndian, 8, 4, effort));
+		BOOST_CHECK(roundtrip(std::string(), bitstream::bigEndian, 4, 12,
+			effort));
+		BOOST_CHECK(roundtrip("a", bitstream::bigEndian, 4, 12, effort));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(lzss_comp_roundtrip_smallest)
+{
+	BOOST_TEST_MESSAGE("Compress and decompress with the smallest field sizes");
+
+	// With one-bit lengths and distances a match is only three bits, so the
+	// last byte of the data can hold several codes.
+	std::string content = sample_text(5000);
+	content += std::string(100, 'x');
+	content += "aabb";
+
+	for (auto effort : {
+		filter_lzss_compress::Effort::Store,
+		filter_lzss_compress::Effort::Greedy,
+		filter_lzss_compress::Effort::Lazy,
+		filter_lzss_compress::Effort::Optimal,
+	}) {
+		for (auto endian : {bitstream::bigEndian, bitstream::littleEndian}) {
+			BOOST_CHECK(roundtrip(content, endian, 1, 1, effort));
+			BOOST_CHECK(roundtrip("xxxxxxx", endian, 1, 1, effort));
+			BOOST_CHECK(roundtrip("aaab", endian, 1, 1, effort));
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(lzss_comp_parallel)
+{
+	BOOST_TEST_MESSAGE("Compress LZSS data in parallel blocks");
+
+	std::string content = sample_text(200000);
+	const uint8_t *in = (const uint8_t *)content.data();
+	thread_pool pool(4);
+
+	for (auto effort : {filter_lzss_compress::Effort::Store,
+		filter_lzss_compress::Effort::Greedy, filter_lzss_compress::Effort::Lazy,
+		filter_lzss_compress::Effort::Optimal}
+	) {
+		for (auto endian : {bitstream::bigEndian, bitstream::littleEndian}) {
+			// Odd block sizes so the blocks join up part way through a byte
+			for (stream::len lenBlock : {3001, 65536}) {
+				auto compressed = std::make_shared<stream::string>(
+					lzss_compress_parallel(in, content.length(), endian, 4, 12, effort,
+						&pool, lenBlock)
+				);
+				stream::len lenParallel = compressed->data.length();
+				stream::input_filtered filt(compressed,
+					std::make_shared<filter_lzss_decompress>(endian, 4, 12)
+				);
+				stream::string result;
+				stream::copy(result, filt);
+				BOOST_CHECK_MESSAGE(
+					this->default_sample::is_equal(content, result.data),
+					"Compressing LZSS data in parallel failed (effort "
+					<< (int)effort << ", block size " << lenBlock << ")");
+
+				// Each block can refer back into the one before, so splitting the
+				// data up should barely make a difference.
+				stream::len lenSerial;
+				BOOST_CHECK(roundtrip(content, endian, 4, 12, effort, &lenSerial));
+				BOOST_CHECK_LE(lenParallel, lenSerial + lenSerial / 100);
+			}
+		}
+	}
+
+	// A single block must match the normal compressor exactly
+	auto compressed = std::make_shared<stream::string>();
+	{
+		stream::input_filtered filt(std::make_shared<stream::string>(content),
+			std::make_shared<filter_lzss_compress>(bitstream::littleEndian, 4, 12)
+		);
+		stream::copy(*compressed, filt);
+	}
+	BOOST_CHECK_MESSAGE(this->default_sample::is_equal(compressed->data,
+		lzss_compress_parallel(in, content.length(), bitstream::littleEndian, 4,
+			12, filter_lzss_compress::Effort::Lazy, &pool, content.length())),
+		"Compressing LZSS data as a single block didn't match "
+		"filter_lzss_compress");
+
+	BOOST_CHECK(lzss_compress_parallel(in, 0, bitstream::bigEndian, 4, 12,
+		filter_lzss_compress::Effort::Lazy, &pool).empty());
+}
+
+BOOST_AUTO_TEST_CASE(lzss_decomp_fragmented)
+{
+	BOOST_TEST_MESSAGE("Decompress into small separate buffers as well as one "
+		"contiguous buffer");
+
+	std::string content = sample_text(20000);
+	auto orig = std::make_shared<stream::string>(content);
+	auto compressed = std::make_shared<stream::string>();
+	{
+		stream::input_filtered filt(orig,
+			std::make_shared<filter_lzss_compress>(
+				bitstream::bigEndian, 4, 12, filter_lzss_compress::Effort::Lazy
+			)
+		);
+		stream::copy(*compressed, filt);
+	}
+
+	// Decode a few bytes at a time into a buffer that is reused each time, so
+	// back-references have to come from the window.
+	filter_lzss_decompress fragmented(bitstream::bigEndian, 4, 12);
+	fragmented.reset(compressed->data.length());
+	std::string result;
+	const uint8_t *in = (const uint8_t *)compressed->data.data();
+	stream::len lenRemaining = compressed->data.length();
+	uint8_t buf[7];
+	for (;;) {
+		stream::len lenIn = lenRemaining, lenOut = sizeof(buf);
+		fragmented.transform(buf, &lenOut, in, &lenIn);
+		if ((lenIn == 0) && (lenOut == 0)) break;
+		result.append((const char *)buf, lenOut);
+		in += lenIn;
+		lenRemaining -= lenIn;
+	}
+	BOOST_CHECK_MESSAGE(this->default_sample::is_equal(content, result),
+		"Decompressing LZSS data into fragmented buffers failed");
+
+	// Same again in contiguous mode, with back-references spanning calls.
+	filter_lzss_decompress contiguous(bitstream::bigEndian, 4, 12);
+	contiguous.reset(compressed->data.length());
+	contiguous.use_contiguous_output();
+	BOOST_CHECK(!contiguous.save_state(this->out));
+	result.assign(content.length() + 16, '\0');
+	uint8_t *out = (uint8_t *)&result[0];
+	in = (const uint8_t *)compressed->data.data();
+	lenRemaining = compressed->data.length();
+	for (;;) {
+		stream::len lenIn = std::min<stream::len>(lenRemaining, 5);
+		stream::len lenOut = 7;
+		contiguous.transform(out, &lenOut, in, &lenIn);
+		if ((lenIn == 0) && (lenOut == 0)) break;
+		out += lenOut;
+		in += lenIn;
+		lenRemaining -= lenIn;
+	}
+	result.resize(out - (uint8_t *)&result[0]);
+	BOOST_CHECK_MESSAGE(this->default_sample::is_equal(content, result),
+		"Decompressing LZSS data into a contiguous buffer failed");
+}
+
+BOOST_AUTO_TEST_CASE(lzss_decomp_before_start)
+{
+	BOOST_TEST_MESSAGE("Back-references from before the start of the data give "
+		"zeroes in both modes");
+
+	bitstream bit_in(this->in, bitstream::bigEndian);
+	bit_in.write(9, 'A');
+	bit_in.write(1, 1);      // Code
+	bit_in.write(2, 2);      // len=2(+2)
+	bit_in.write(8, 2);      // dist=2(+1) "??A" -> "\0\0A\0"
+	bit_in.flush();
+
+	auto processed = std::make_shared<stream::input_filtered>(
+		this->in,
+		std::make_shared<filter_lzss_decompress>(
+			bitstream::bigEndian, 2, 8
+		)
+	);
+	stream::copy(this->out, *processed);
+	BOOST_CHECK_MESSAGE(is_equal(std::string("A\0\0A\0", 5)),
+		"Back-reference from before the start in contiguous mode failed");
+
+	this->in->seekg(0, stream::start);
+	filter_lzss_decompress fragmented(bitstream::bigEndian, 2, 8);
+	fragmented.reset(this->in->size());
+	std::string content = this->in->data;
+	stream::len lenIn = content.length();
+	uint8_t buf[16];
+	stream::len lenOut = sizeof(buf);
+	fragmented.transform(buf, &lenOut, (const uint8_t *)content.data(), &lenIn);
+	BOOST_CHECK_MESSAGE(this->default_sample::is_equal(
+		std::string("A\0\0A\0", 5), std::string((char *)buf, lenOut)),
+		"Back-reference from before the start in fragmented mode failed");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -23,6 +23,7 @@
 #include <camoto/filter-lzw.hpp>
 #include <camoto/bitstream.hpp>
 #include <camoto/stream_filtered.hpp>
+#include <camoto/thread_pool.hpp>
 #include <camoto/util.hpp>
 
 #include "tests.hpp"
@@ -81,6 +82,7 @@ BOOST_AUTO_TEST_CASE(lzw_decomp_codeword_length)
 	bit_in.write(10, 'B');
 	bit_in.write(10, 'B');
 	bit_in.write(10, 0x3ff);  // EOF is max possible code
+	bit_in.flush();
 
 	auto processed = std::make_shared<stream::input_filtered>(
 		this->in,
@@ -129,6 +131,7 @@ BOOST_AUTO_TEST_CASE(lzw_decomp_bitlength_expand)
 	// Codeword will have just expanded to 10 bits
 	bit_in.write(10, 'B'); // 257th char
 	bit_in.write(10, 0x100);
+	bit_in.flush();
 
 	auto processed = std::make_shared<stream::input_filtered>(
 		this->in,
@@ -159,6 +162,7 @@ BOOST_AUTO_TEST_CASE(lzw_decomp_reset)
 	bit_in.write(9, 'C');
 	bit_in.write(9, 'C');
 	bit_in.write(9, 0x100);
+	bit_in.flush();
 
 	auto processed = std::make_shared<stream::input_filtered>(
 		this->in,
@@ -173,6 +177,40 @@ BOOST_AUTO_TEST_CASE(lzw_decomp_reset)
 		"Dictionary reset shared with EOF codeword when LZW decompressing failed");
 }
 
+BOOST_AUTO_TEST_CASE(lzw_decomp_reuse)
+{
+	BOOST_TEST_MESSAGE("Reuse an LZW decompressor after reset()");
+
+	bitstream bit_in(this->in, bitstream::bigEndian);
+	bit_in.write(9, 'H');
+	bit_in.write(9, 'i');
+	bit_in.write(9, 0x100);
+	bit_in.flush();
+
+	filter_lzw_decompress algo(9, 9, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID);
+
+	// Decode the same data twice with the one instance, the way a filter_pool
+	// or thread_pool worker would.
+	for (int run = 0; run < 2; run++) {
+		algo.reset(this->in->data.length());
+		std::string result;
+		stream::len posIn = 0;
+		for (;;) {
+			uint8_t buf[16];
+			stream::len lenOut = sizeof(buf);
+			stream::len lenIn = this->in->data.length() - posIn;
+			algo.transform(buf, &lenOut,
+				(const uint8_t *)this->in->data.c_str() + posIn, &lenIn);
+			if ((lenIn == 0) && (lenOut == 0)) break;
+			posIn += lenIn;
+			result.append((const char *)buf, lenOut);
+		}
+		BOOST_CHECK_MESSAGE(is_equal("Hi", result),
+			"Decompressing LZW data after reset() failed on run " << run + 1);
+	}
+}
+
 BOOST_AUTO_TEST_CASE(lzw_decomp_dict_overflow)
 {
 	BOOST_TEST_MESSAGE("Decompress some LZW data with a dictionary overflow");
@@ -185,6 +223,7 @@ BOOST_AUTO_TEST_CASE(lzw_decomp_dict_overflow)
 	bit_in.write(12, 'e');
 	bit_in.write(12, 'e');
 	bit_in.write(12, 0x100);
+	bit_in.flush();
 
 	auto processed = std::make_shared<stream::input_filtered>(
 		this->in,
@@ -207,7 +246,56 @@ BOOST_AUTO_TEST_CASE(lzw_decomp_dict_overflow)
 
 BOOST_AUTO_TEST_SUITE_END()
 
-BOOST_FIXTURE_TEST_SUITE(lzw_comp_suite, string_sample)
+/// Sequence of bytes where no two consecutive bytes appear together twice.
+/**
+ * This means the LZW compressor can never find a match longer than a single
+ * byte, so each input byte is written out as its own codeword.
+ */
+std::string lzw_unmatched_sequence(unsigned int len)
+{
+	std::string s;
+	for (unsigned int b = 0; s.length() < len; b++) {
+		for (unsigned int k = b + 1; (k < 256) && (s.length() < len); k++) {
+			s += (char)b;
+			s += (char)k;
+		}
+	}
+	s.resize(len);
+	return s;
+}
+
+struct lzw_comp_sample: public string_sample
+{
+	/// Compress and then decompress some data and compare it to the original.
+	boost::test_tools::predicate_result roundtrip(const std::string& content,
+		int initialBits, int maxBits, int firstCode, int eofCode, int resetCode,
+		int flags, stream::len *lenCompressed = nullptr)
+	{
+		auto orig = std::make_shared<stream::string>(content);
+		auto compressed = std::make_shared<stream::string>();
+		{
+			stream::input_filtered filt(orig,
+				std::make_shared<filter_lzw_compress>(
+					initialBits, maxBits, firstCode, eofCode, resetCode, flags
+				)
+			);
+			stream::copy(*compressed, filt);
+		}
+		if (lenCompressed) *lenCompressed = compressed->data.length();
+
+		compressed->seekg(0, stream::start);
+		stream::input_filtered filt(compressed,
+			std::make_shared<filter_lzw_decompress>(
+				initialBits, maxBits, firstCode, eofCode, resetCode, flags
+			)
+		);
+		stream::string result;
+		stream::copy(result, filt);
+		return this->default_sample::is_equal(content, result.data);
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(lzw_comp_suite, lzw_comp_sample)
 
 BOOST_AUTO_TEST_CASE(lzw_comp_write)
 {
@@ -216,23 +304,18 @@ BOOST_AUTO_TEST_CASE(lzw_comp_write)
 	std::shared_ptr<stream::string> exp(new stream::string());
 	bitstream bit_exp(exp, bitstream::bigEndian);
 	bit_exp.write(9, 'H');
-	bit_exp.write(9, 'e');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'o');
-	bit_exp.write(9, ' ');
-	bit_exp.write(9, 'h');
-	bit_exp.write(9, 'e');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'o');
-	bit_exp.write(9, ' ');
-	bit_exp.write(9, 'h');
-	bit_exp.write(9, 'e');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'o');
-	bit_exp.write(9, '.');
+	bit_exp.write(9, 'e');    // 0x101 -> He
+	bit_exp.write(9, 'l');    // 0x102 -> el
+	bit_exp.write(9, 'l');    // 0x103 -> ll
+	bit_exp.write(9, 'o');    // 0x104 -> lo
+	bit_exp.write(9, ' ');    // 0x105 -> o 
+	bit_exp.write(9, 'h');    // 0x106 ->  h
+	bit_exp.write(9, 0x102);  // 0x107 -> he
+	bit_exp.write(9, 0x104);  // 0x108 -> ell
+	bit_exp.write(9, 0x106);  // 0x109 -> lo 
+	bit_exp.write(9, 0x108);  // 0x10a ->  he
+	bit_exp.write(9, 'o');    // 0x10b -> ello
+	bit_exp.write(9, '.');    // 0x10c -> o.
 	bit_exp.write(9, 0x100);
 	bit_exp.flushByte();
 
@@ -258,23 +341,18 @@ BOOST_AUTO_TEST_CASE(lzw_comp_write_neg_eof)
 	std::shared_ptr<stream::string> exp(new stream::string());
 	bitstream bit_exp(exp, bitstream::bigEndian);
 	bit_exp.write(9, 'H');
-	bit_exp.write(9, 'e');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'o');
-	bit_exp.write(9, ' ');
-	bit_exp.write(9, 'h');
-	bit_exp.write(9, 'e');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'o');
-	bit_exp.write(9, ' ');
-	bit_exp.write(9, 'h');
-	bit_exp.write(9, 'e');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'l');
-	bit_exp.write(9, 'o');
-	bit_exp.write(9, '.');
+	bit_exp.write(9, 'e');    // 0x100 -> He
+	bit_exp.write(9, 'l');    // 0x101 -> el
+	bit_exp.write(9, 'l');    // 0x102 -> ll
+	bit_exp.write(9, 'o');    // 0x103 -> lo
+	bit_exp.write(9, ' ');    // 0x104 -> o 
+	bit_exp.write(9, 'h');    // 0x105 ->  h
+	bit_exp.write(9, 0x101);  // 0x106 -> he
+	bit_exp.write(9, 0x103);  // 0x107 -> ell
+	bit_exp.write(9, 0x105);  // 0x108 -> lo 
+	bit_exp.write(9, 0x107);  // 0x109 ->  he
+	bit_exp.write(9, 'o');    // 0x10a -> ello
+	bit_exp.write(9, '.');    // 0x10b -> o.
 	bit_exp.write(9, 0x1fe);
 	bit_exp.flushByte();
 
@@ -293,23 +371,50 @@ BOOST_AUTO_TEST_CASE(lzw_comp_write_neg_eof)
 		"Compressing LZW data failed");
 }
 
+BOOST_AUTO_TEST_CASE(lzw_comp_write_repeat)
+{
+	BOOST_TEST_MESSAGE("Compress a run of the same byte with LZW");
+
+	std::shared_ptr<stream::string> exp(new stream::string());
+	bitstream bit_exp(exp, bitstream::littleEndian);
+	bit_exp.write(9, 'a');
+	bit_exp.write(9, 0x101);  // 0x101 -> aa, uses the codeword being defined
+	bit_exp.write(9, 0x102);  // 0x102 -> aaa
+	bit_exp.write(9, 0x101);  // 0x103 -> aaaa
+	bit_exp.write(9, 0x100);
+	bit_exp.flushByte();
+
+	this->in->write("aaaaaaaa");
+
+	auto processed = std::make_shared<stream::input_filtered>(
+		this->in,
+		std::make_shared<filter_lzw_compress>(
+			9, 12, 0x101, 0x100, 0, LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID
+		)
+	);
+
+	stream::copy(this->out, *processed);
+
+	BOOST_CHECK_MESSAGE(is_equal(exp->data),
+		"Compressing a run of the same byte with LZW failed");
+}
+
 BOOST_AUTO_TEST_CASE(lzw_comp_write_dict_grow)
 {
 	BOOST_TEST_MESSAGE("Compress some LZW data with a growing dictionary");
 
+	std::string content = lzw_unmatched_sequence(257);
+
 	std::shared_ptr<stream::string> exp(new stream::string());
 	bitstream bit_exp(exp, bitstream::bigEndian);
 	for (int i = 0; i < 256; i++) {
-		bit_exp.write(9, 'a');
+		bit_exp.write(9, (uint8_t)content[i]);
 	}
-	bit_exp.write(10, 'b');
+	bit_exp.write(10, (uint8_t)content[256]);
 	bit_exp.write(10, 0x100);
 	bit_exp.flushByte();
 
-	for (int i = 0; i < 256; i++) {
-		this->in->write("a");
-	}
-	this->in->write("b");
+	this->in->write(content);
 
 	auto processed = std::make_shared<stream::input_filtered>(
 		this->in,
@@ -328,22 +433,22 @@ BOOST_AUTO_TEST_CASE(lzw_comp_write_dict_overflow)
 {
 	BOOST_TEST_MESSAGE("Compress some LZW data with an overflowing dictionary");
 
+	std::string content = lzw_unmatched_sequence((1<<8) + (1<<9) + (1<<10)
+		+ (1<<11) + 2);
+
 	std::shared_ptr<stream::string> exp(new stream::string());
 	bitstream bit_exp(exp, bitstream::bigEndian);
-	for (int i = 0; i < (1<<8); i++) bit_exp.write(9, 'a');
-	for (int i = 0; i < (1<<9); i++) bit_exp.write(10, 'b');
-	for (int i = 0; i < (1<<10); i++) bit_exp.write(11, 'c');
-	for (int i = 0; i < (1<<11); i++) bit_exp.write(12, 'd');
-	bit_exp.write(12, 'e');
-	bit_exp.write(12, 'e');
+	unsigned int pos = 0;
+	for (int i = 0; i < (1<<8); i++) bit_exp.write(9, (uint8_t)content[pos++]);
+	for (int i = 0; i < (1<<9); i++) bit_exp.write(10, (uint8_t)content[pos++]);
+	for (int i = 0; i < (1<<10); i++) bit_exp.write(11, (uint8_t)content[pos++]);
+	for (int i = 0; i < (1<<11); i++) bit_exp.write(12, (uint8_t)content[pos++]);
+	bit_exp.write(12, (uint8_t)content[pos++]);
+	bit_exp.write(12, (uint8_t)content[pos++]);
 	bit_exp.write(12, 0x100);
 	bit_exp.flushByte();
 
-	for (int i = 0; i < (1<<8); i++) this->in->write("a");
-	for (int i = 0; i < (1<<9); i++) this->in->write("b");
-	for (int i = 0; i < (1<<10); i++) this->in->write("c");
-	for (int i = 0; i < (1<<11); i++) this->in->write("d");
-	this->in->write("ee");
+	this->in->write(content);
 
 	auto processed = std::make_shared<stream::input_filtered>(
 		this->in,
@@ -362,22 +467,22 @@ BOOST_AUTO_TEST_CASE(lzw_comp_write_dict_overflow_reset)
 {
 	BOOST_TEST_MESSAGE("Compress some LZW data with an autoreset dictionary");
 
+	std::string content = lzw_unmatched_sequence((1<<8) + (1<<9) + (1<<10)
+		+ (1<<11) + 2);
+
 	std::shared_ptr<stream::string> exp(new stream::string());
 	bitstream bit_exp(exp, bitstream::bigEndian);
-	for (int i = 0; i < (1<<8); i++) bit_exp.write(9, 'a');
-	for (int i = 0; i < (1<<9); i++) bit_exp.write(10, 'b');
-	for (int i = 0; i < (1<<10); i++) bit_exp.write(11, 'c');
-	for (int i = 0; i < (1<<11); i++) bit_exp.write(12, 'd');
-	bit_exp.write(9, 'e');
-	bit_exp.write(9, 'e');
+	unsigned int pos = 0;
+	for (int i = 0; i < (1<<8); i++) bit_exp.write(9, (uint8_t)content[pos++]);
+	for (int i = 0; i < (1<<9); i++) bit_exp.write(10, (uint8_t)content[pos++]);
+	for (int i = 0; i < (1<<10); i++) bit_exp.write(11, (uint8_t)content[pos++]);
+	for (int i = 0; i < (1<<11); i++) bit_exp.write(12, (uint8_t)content[pos++]);
+	bit_exp.write(9, (uint8_t)content[pos++]);
+	bit_exp.write(9, (uint8_t)content[pos++]);
 	bit_exp.write(9, 0x100);
 	bit_exp.flushByte();
 
-	for (int i = 0; i < (1<<8); i++) this->in->write("a");
-	for (int i = 0; i < (1<<9); i++) this->in->write("b");
-	for (int i = 0; i < (1<<10); i++) this->in->write("c");
-	for (int i = 0; i < (1<<11); i++) this->in->write("d");
-	this->in->write("ee");
+	this->in->write(content);
 
 	auto processed = std::make_shared<stream::input_filtered>(
 		this->in,
@@ -393,6 +498,170 @@ BOOST_AUTO_TEST_CASE(lzw_comp_write_dict_overflow_reset)
 		"Compressing LZW data with an autoreset dictionary failed");
 }
 
+BOOST_AUTO_TEST_CASE(lzw_comp_write_dict_overflow_reset_code)
+{
+	BOOST_TEST_MESSAGE("Compress some LZW data with a reset codeword");
+
+	std::string content = lzw_unmatched_sequence((1<<8) - 1 + (1<<9) + 4);
+
+	std::shared_ptr<stream::string> exp(new stream::string());
+	bitstream bit_exp(exp, bitstream::bigEndian);
+	unsigned int pos = 0;
+	// 0x1fe is the reset code and 0x1ff is EOF at 9 bits, so the codeword
+	// grows after 255 codewords instead of 256.
+	for (int i = 0; i < (1<<8) - 1; i++) bit_exp.write(9, (uint8_t)content[pos++]);
+	for (int i = 0; i < (1<<9); i++) bit_exp.write(10, (uint8_t)content[pos++]);
+	bit_exp.write(10, 0x3fe); // dictionary full, reset
+	bit_exp.flushByte();
+	for (int i = 0; i < 4; i++) bit_exp.write(9, (uint8_t)content[pos++]);
+	bit_exp.write(9, 0x1ff);
+	bit_exp.flushByte();
+
+	this->in->write(content);
+
+	auto processed = std::make_shared<stream::input_filtered>(
+		this->in,
+		std::make_shared<filter_lzw_compress>(
+			9, 10, 0x100, 0, -1,
+			LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+			| LZW_FLUSH_ON_RESET
+		)
+	);
+
+	stream::copy(this->out, *processed);
+
+	BOOST_CHECK_MESSAGE(is_equal(exp->data),
+		"Compressing LZW data with a reset codeword failed");
+}
+
+BOOST_AUTO_TEST_CASE(lzw_comp_ratio)
+{
+	BOOST_TEST_MESSAGE("Confirm LZW compression makes repetitive data smaller");
+
+	std::string content = sample_text(20000);
+	stream::len lenCompressed = 0;
+	BOOST_CHECK_MESSAGE(roundtrip(content, 9, 12, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT, &lenCompressed),
+		"LZW round trip failed");
+	BOOST_CHECK_LT(lenCompressed, content.length() / 2);
+}
+
+BOOST_AUTO_TEST_CASE(lzw_comp_roundtrip)
+{
+	BOOST_TEST_MESSAGE("Compress and decompress LZW data with various settings");
+
+	std::string content = sample_text(50000);
+
+	BOOST_CHECK_MESSAGE(roundtrip(content, 9, 12, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID),
+		"LZW round trip with no dictionary reset failed");
+
+	BOOST_CHECK_MESSAGE(roundtrip(content, 9, 12, 0x101, 0x100, 0,
+		LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT),
+		"LZW round trip with full dictionary reset failed");
+
+	BOOST_CHECK_MESSAGE(roundtrip(content, 9, 14, 0x102, 0x101, 0x100,
+		LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID),
+		"LZW round trip with reset codeword failed");
+
+	BOOST_CHECK_MESSAGE(roundtrip(content, 9, 12, 0x100, 0, -1,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+		| LZW_FLUSH_ON_RESET),
+		"LZW round trip with relative reset codeword and flush failed");
+
+	BOOST_CHECK_MESSAGE(roundtrip(content, 9, 12, 0x101, 0, 0x100,
+		LZW_BIG_ENDIAN | LZW_RESET_PARAM_VALID | LZW_NO_BITSIZE_RESET),
+		"LZW round trip with no bitsize reset failed");
+
+	BOOST_CHECK_MESSAGE(roundtrip(content, 12, 12, 0x100, 0, 0,
+		LZW_LITTLE_ENDIAN | LZW_RESET_FULL_DICT),
+		"LZW round trip with fixed codeword length failed");
+
+	// Largest dictionary, where every prefix index uses all 16 bits
+	BOOST_CHECK_MESSAGE(roundtrip(sample_text(400000), 9, 16, 0x101, 0x100,
+		0, LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT),
+		"LZW round trip with 16-bit codewords failed");
+
+	BOOST_CHECK_MESSAGE(roundtrip(std::string(), 9, 12, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID),
+		"LZW round trip with empty input failed");
+}
+
+BOOST_AUTO_TEST_CASE(lzw_comp_adaptive_reset)
+{
+	BOOST_TEST_MESSAGE("Reset the LZW dictionary early when the content changes");
+
+	// Text, then something that looks more like tiles, then text again
+	std::string tiles;
+	uint32_t seed = 54321;
+	while (tiles.length() < 60000) {
+		next_random(seed);
+		for (int i = 0; i < 8; i++) {
+			tiles += (char)(0x80 + ((seed >> (i * 3)) & 0x07));
+		}
+	}
+	std::string content = sample_text(60000) + tiles + sample_text(60000);
+
+	int flags = LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID;
+	stream::len lenFull = 0, lenFrozen = 0, lenAdaptive = 0;
+	BOOST_CHECK_MESSAGE(roundtrip(content, 9, 12, 0x102, 0x101, 0x100, flags,
+		&lenFull),
+		"LZW round trip resetting on a full dictionary failed");
+	BOOST_CHECK_MESSAGE(roundtrip(content, 9, 12, 0x102, 0x101, 0x100,
+		flags & ~LZW_RESET_PARAM_VALID, &lenFrozen),
+		"LZW round trip without resets failed");
+	BOOST_CHECK_MESSAGE(roundtrip(content, 9, 12, 0x102, 0x101, 0x100,
+		flags | LZW_ADAPTIVE_RESET, &lenAdaptive),
+		"LZW round trip with adaptive reset failed");
+	BOOST_TEST_MESSAGE("Full reset: " << lenFull << ", no reset: " << lenFrozen
+		<< ", adaptive: " << lenAdaptive);
+	BOOST_CHECK_LT(lenAdaptive, lenFull);
+	BOOST_CHECK_LT(lenAdaptive, lenFrozen);
+
+	// Resets can also come before the dictionary is full
+	BOOST_CHECK_MESSAGE(roundtrip(content, 9, 14, 0x100, 0, -1,
+		LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+		| LZW_RESET_FULL_DICT | LZW_FLUSH_ON_RESET | LZW_ADAPTIVE_RESET),
+		"LZW round trip with adaptive and full dictionary reset failed");
+}
+
+BOOST_AUTO_TEST_CASE(lzw_decomp_small_output)
+{
+	BOOST_TEST_MESSAGE("Decompress long LZW strings into a tiny output buffer");
+
+	// A long run produces strings much longer than the output buffer
+	std::string content = std::string(5000, 'a') + sample_text(5000);
+	auto orig = std::make_shared<stream::string>(content);
+	stream::string compressed;
+	{
+		stream::input_filtered filt(orig,
+			std::make_shared<filter_lzw_compress>(9, 12, 0x101, 0x100, 0,
+				LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID)
+		);
+		stream::copy(compressed, filt);
+	}
+
+	filter_lzw_decompress filt(9, 12, 0x101, 0x100, 0,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID);
+	filt.reset(compressed.data.length());
+	std::string result;
+	const uint8_t *in = (const uint8_t *)compressed.data.data();
+	stream::len lenRemaining = compressed.data.length();
+	for (;;) {
+		uint8_t buf[3];
+		stream::len lenOut = sizeof(buf);
+		stream::len lenIn = lenRemaining;
+		filt.transform(buf, &lenOut, in, &lenIn);
+		in += lenIn;
+		lenRemaining -= lenIn;
+		result.append((char *)buf, lenOut);
+		if ((lenIn == 0) && (lenOut == 0)) break;
+	}
+
+	BOOST_CHECK_MESSAGE(default_sample::is_equal(content, result),
+		"Decompressing LZW data into a small buffer failed");
+}
+
 BOOST_AUTO_TEST_CASE(lzw_comp_end_write_midbyte)
 {
 	BOOST_TEST_MESSAGE("Compress some LZW data and ensure it ends mid-byte");
@@ -412,4 +681,128 @@ BOOST_AUTO_TEST_CASE(lzw_comp_end_write_midbyte)
 		"Compressing LZW data ensuring it ends mid-byte failed");
 }
 
+BOOST_AUTO_TEST_CASE(lzw_decomp_parallel)
+{
+	BOOST_TEST_MESSAGE("Decompress LZW data in parallel between dictionary resets");
+
+	std::string content = sample_text(300000);
+	thread_pool pool(4);
+
+	struct {
+		int initialBits, maxBits, firstCode, eofCode, resetCode, flags;
+		bool resets;
+	} settings[] = {
+		{9, 12, 0x101, 0x100, 0,
+			LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT, true},
+		{9, 14, 0x102, 0x101, 0x100,
+			LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID, true},
+		{9, 12, 0x100, 0, -1,
+			LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+			| LZW_FLUSH_ON_RESET, true},
+		{9, 12, 0x101, 0, 0x100,
+			LZW_BIG_ENDIAN | LZW_RESET_PARAM_VALID | LZW_NO_BITSIZE_RESET, true},
+		// No resets at all, so the whole thing is one segment
+		{9, 12, 0x101, 0x100, 0, LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID, false},
+	};
+	for (auto& t : settings) {
+		auto orig = std::make_shared<stream::string>(content);
+		stream::string compressed;
+		{
+			stream::input_filtered filt(orig,
+				std::make_shared<filter_lzw_compress>(t.initialBits, t.maxBits,
+					t.firstCode, t.eofCode, t.resetCode, t.flags)
+			);
+			stream::copy(compressed, filt);
+		}
+		const uint8_t *in = (const uint8_t *)compressed.data.data();
+		stream::len lenIn = compressed.data.length();
+
+		filter_lzw_decompress scan(t.initialBits, t.maxBits, t.firstCode,
+			t.eofCode, t.resetCode, t.flags);
+		auto segs = scan.findSegments(in, lenIn);
+		BOOST_REQUIRE(!segs.empty());
+		if (t.resets) {
+			BOOST_CHECK_GT(segs.size(), 1);
+		} else {
+			BOOST_CHECK_EQUAL(segs.size(), 1);
+		}
+		BOOST_CHECK_EQUAL(segs.back().outOffset + segs.back().lenOut,
+			content.length());
+
+		std::string result = lzw_decompress_parallel(in, lenIn, t.initialBits,
+			t.maxBits, t.firstCode, t.eofCode, t.resetCode, t.flags, &pool);
+		BOOST_CHECK_MESSAGE(default_sample::is_equal(content, result),
+			"Decompressing LZW data in parallel failed (flags "
+			<< std::hex << t.flags << ")");
+	}
+}
+
+BOOST_AUTO_TEST_CASE(lzw_comp_parallel)
+{
+	BOOST_TEST_MESSAGE("Compress LZW data in parallel blocks");
+
+	std::string content = sample_text(300000);
+	const uint8_t *in = (const uint8_t *)content.data();
+	thread_pool pool(4);
+
+	struct {
+		int initialBits, maxBits, firstCode, eofCode, resetCode, flags;
+	} settings[] = {
+		{9, 14, 0x102, 0x101, 0x100,
+			LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID},
+		{9, 12, 0x101, 0, 0x100, LZW_BIG_ENDIAN | LZW_RESET_PARAM_VALID},
+		{9, 12, 0x100, 0, -1,
+			LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+			| LZW_FLUSH_ON_RESET},
+		{9, 12, 0x102, 0x101, 0x100,
+			LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+			| LZW_RESET_FULL_DICT | LZW_ADAPTIVE_RESET},
+		// No way to mark a new block, so done in one go
+		{9, 12, 0x101, 0x100, 0,
+			LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT},
+		{9, 12, 0x101, 0, 0x100,
+			LZW_BIG_ENDIAN | LZW_RESET_PARAM_VALID | LZW_NO_BITSIZE_RESET},
+	};
+	for (auto& t : settings) {
+		// Odd block sizes so the blocks join up part way through a byte
+		for (stream::len lenBlock : {7777, 65536, 1000000}) {
+			auto compressed = std::make_shared<stream::string>(
+				lzw_compress_parallel(in, content.length(), t.initialBits,
+					t.maxBits, t.firstCode, t.eofCode, t.resetCode, t.flags, &pool,
+					lenBlock)
+			);
+			stream::input_filtered filt(compressed,
+				std::make_shared<filter_lzw_decompress>(t.initialBits, t.maxBits,
+					t.firstCode, t.eofCode, t.resetCode, t.flags)
+			);
+			stream::string result;
+			stream::copy(result, filt);
+			BOOST_CHECK_MESSAGE(default_sample::is_equal(content, result.data),
+				"Compressing LZW data in parallel failed (flags " << std::hex
+				<< t.flags << std::dec << ", block size " << lenBlock << ")");
+		}
+	}
+
+	// A single block must match the normal compressor exactly
+	std::string serial;
+	{
+		stream::input_filtered filt(std::make_shared<stream::string>(content),
+			std::make_shared<filter_lzw_compress>(9, 12, 0x102, 0x101, 0x100,
+				LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID)
+		);
+		stream::string out;
+		stream::copy(out, filt);
+		serial = out.data;
+	}
+	BOOST_CHECK_MESSAGE(default_sample::is_equal(serial,
+		lzw_compress_parallel(in, content.length(), 9, 12, 0x102, 0x101, 0x100,
+			LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID, &pool,
+			content.length())),
+		"Compressing LZW data as a single block didn't match filter_lzw_compress");
+
+	BOOST_CHECK_EQUAL(lzw_compress_parallel(in, 0, 9, 12, 0x101, 0x100, 0x102,
+		LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID, &pool),
+		std::string("\x80\x00", 2));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
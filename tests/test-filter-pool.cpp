@@ -0,0 +1,109 @@
+/**
+ * @file   test-filter-pool.cpp
+ * @brief  Test code for reusing filter instances.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <camoto/filter-pool.hpp>
+#include <camoto/filter-lzw.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_string.hpp>
+
+#include "tests.hpp"
+
+using namespace camoto;
+
+typedef filter_pool<filter_lzw_decompress, int, int, int, int, int, int>
+	lzw_pool;
+
+#define LZW_PARAMS 9, 12, 0x101, 0x100, 0, \
+	LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT
+
+BOOST_AUTO_TEST_SUITE(filter_pool_suite)
+
+BOOST_AUTO_TEST_CASE(reuse)
+{
+	BOOST_TEST_MESSAGE("Released filters are handed out again");
+
+	lzw_pool pool;
+	filter_lzw_decompress *first;
+	{
+		auto f = pool.get(LZW_PARAMS);
+		first = f.get();
+		BOOST_CHECK_EQUAL(pool.idle(), 0);
+	}
+	BOOST_CHECK_EQUAL(pool.idle(), 1);
+
+	auto again = pool.get(LZW_PARAMS);
+	BOOST_CHECK_EQUAL(again.get(), first);
+	BOOST_CHECK_EQUAL(pool.idle(), 0);
+
+	// Different parameters get a different instance
+	auto other = pool.get(9, 12, 0x101, 0x100, 0, LZW_BIG_ENDIAN);
+	BOOST_CHECK(other.get() != first);
+
+	again.reset();
+	other.reset();
+	BOOST_CHECK_EQUAL(pool.idle(), 2);
+	pool.clear();
+	BOOST_CHECK_EQUAL(pool.idle(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(decode_twice)
+{
+	BOOST_TEST_MESSAGE("A reused filter decodes as well as a new one");
+
+	std::string content = sample_text(20000);
+	auto orig = std::make_shared<stream::string>(content);
+	auto compressed = std::make_shared<stream::string>();
+	{
+		stream::input_filtered comp(orig,
+			std::make_shared<filter_lzw_compress>(LZW_PARAMS));
+		stream::copy(*compressed, comp);
+	}
+
+	lzw_pool pool;
+	for (int i = 0; i < 3; i++) {
+		stream::input_filtered s(compressed, pool.get(LZW_PARAMS));
+		stream::string result;
+		stream::copy(result, s);
+		BOOST_REQUIRE_MESSAGE(result.data == content,
+			"Decoding with pooled filter failed on pass " << i);
+	}
+	BOOST_CHECK_EQUAL(pool.idle(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(limits)
+{
+	BOOST_TEST_MESSAGE("Pool keeps a limited number of filters");
+
+	std::shared_ptr<filter_lzw_decompress> f[3];
+	{
+		lzw_pool pool(2);
+		for (auto& i : f) i = pool.get(LZW_PARAMS);
+		for (auto& i : f) i.reset();
+		BOOST_CHECK_EQUAL(pool.idle(), 2);
+
+		// Outlive the pool
+		f[0] = pool.get(LZW_PARAMS);
+	}
+	f[0].reset();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,144 @@
+/**
+ * @file   test-filter-rle.cpp
+ * @brief  Test code for the RLE filters.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/filter-rle.hpp>
+#include <camoto/stream_filtered.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+struct rle_sample: public filter_sample
+{
+	/// Data with short and long runs, and bytes that need escaping.
+	std::string sample()
+	{
+		std::string data;
+		uint32_t seed = 3;
+		while (data.length() < 100000) {
+			next_random(seed);
+			unsigned int len = (seed >> 16) % 300;
+			uint8_t c = seed >> 8;
+			if ((seed >> 24) & 1) {
+				data.append(len, c);
+			} else {
+				for (unsigned int i = 0; i < len; i++) {
+					data.push_back(next_random(seed) >> 24);
+				}
+			}
+		}
+		return data;
+	}
+
+	void roundtrip(rle_scheme scheme, uint8_t code)
+	{
+		std::string data = this->sample();
+		std::string compressed = this->apply(
+			std::make_shared<filter_rle_compress>(scheme, code), data);
+		BOOST_CHECK_LT(compressed.length(), data.length());
+		std::string result = this->apply(
+			std::make_shared<filter_rle_decompress>(scheme, code), compressed);
+		BOOST_CHECK_MESSAGE(this->is_equal(data, result),
+			"RLE round trip failed");
+
+		// Same again through tiny output buffers, so codes are split up
+		filter_rle_compress comp(scheme, code);
+		filter_rle_decompress decomp(scheme, code);
+		std::string small = data.substr(0, 5000);
+		BOOST_CHECK_MESSAGE(this->is_equal(small,
+			this->applySmall(decomp, this->applySmall(comp, small, 5), 3)),
+			"RLE round trip through small buffers failed");
+		return;
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(rle_suite, rle_sample)
+
+BOOST_AUTO_TEST_CASE(decompress_escape)
+{
+	BOOST_TEST_MESSAGE("Expand escape-byte RLE data");
+	auto f = std::make_shared<filter_rle_decompress>(rle_scheme::Escape, 0x90);
+	BOOST_CHECK_MESSAGE(is_equal(makeString("ABBBBBC\x90" "D"),
+		this->apply(f, makeString("A\x90\x05" "BC\x90\x01\x90" "D"))),
+		"Expanding escape-byte RLE data failed");
+}
+
+BOOST_AUTO_TEST_CASE(decompress_countbits)
+{
+	BOOST_TEST_MESSAGE("Expand flag-bit RLE data");
+	auto f = std::make_shared<filter_rle_decompress>(rle_scheme::CountBits,
+		0xC0);
+	BOOST_CHECK_MESSAGE(is_equal(makeString("AAAB\xC5"),
+		this->apply(f, makeString("\xC3" "AB\xC1\xC5"))),
+		"Expanding flag-bit RLE data failed");
+}
+
+BOOST_AUTO_TEST_CASE(decompress_packbits)
+{
+	BOOST_TEST_MESSAGE("Expand PackBits data");
+	// Example from Apple's technical note TN1023
+	auto f = std::make_shared<filter_rle_decompress>(rle_scheme::PackBits);
+	BOOST_CHECK_MESSAGE(is_equal(makeString(
+			"\xAA\xAA\xAA\x80\x00\x2A\xAA\xAA\xAA\xAA\x80\x00\x2A\x22\xAA\xAA\xAA"
+			"\xAA\xAA\xAA\xAA\xAA\xAA\xAA"),
+		this->apply(f, makeString(
+			"\xFE\xAA\x02\x80\x00\x2A\xFD\xAA\x03\x80\x00\x2A\x22\xF7\xAA"))),
+		"Expanding PackBits data failed");
+}
+
+BOOST_AUTO_TEST_CASE(compress_escape)
+{
+	BOOST_TEST_MESSAGE("Compress with escape-byte RLE");
+	auto f = std::make_shared<filter_rle_compress>(rle_scheme::Escape, 0x90);
+	// A run of three is left alone, as encoding it would not save anything
+	BOOST_CHECK_MESSAGE(is_equal(makeString("A\x90\x05" "BCCC\x90\x01\x90"),
+		this->apply(f, makeString("ABBBBBCCC\x90"))),
+		"Compressing with escape-byte RLE failed");
+}
+
+BOOST_AUTO_TEST_CASE(compress_packbits)
+{
+	BOOST_TEST_MESSAGE("Compress with PackBits");
+	auto f = std::make_shared<filter_rle_compress>(rle_scheme::PackBits);
+	BOOST_CHECK_MESSAGE(is_equal(makeString("\x01" "AB\xFD" "C\x00" "D"),
+		this->apply(f, makeString("ABCCCCD"))),
+		"Compressing with PackBits failed");
+}
+
+BOOST_AUTO_TEST_CASE(roundtrip_escape)
+{
+	BOOST_TEST_MESSAGE("Escape-byte RLE round trip");
+	this->roundtrip(rle_scheme::Escape, 0x90);
+}
+
+BOOST_AUTO_TEST_CASE(roundtrip_countbits)
+{
+	BOOST_TEST_MESSAGE("Flag-bit RLE round trip");
+	this->roundtrip(rle_scheme::CountBits, 0xC0);
+	this->roundtrip(rle_scheme::CountBits, 0x80);
+}
+
+BOOST_AUTO_TEST_CASE(roundtrip_packbits)
+{
+	BOOST_TEST_MESSAGE("PackBits round trip");
+	this->roundtrip(rle_scheme::PackBits, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,109 @@
+/**
+ * @file   test-filter-xor.cpp
+ * @brief  Test code for the XOR filter.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <functional>
+#include <boost/test/unit_test.hpp>
+#include <camoto/filter-xor.hpp>
+#include <camoto/stream_filtered.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+struct xor_sample: public filter_sample
+{
+	/// Data long enough to cross a few keystream blocks.
+	std::string sample()
+	{
+		return make_corpus(10007, 7);
+	}
+
+	/// Check a filter against the expected keystream, in one go and in pieces.
+	void check(std::function<std::shared_ptr<filter>()> make,
+		std::function<uint8_t(std::size_t)> keyAt)
+	{
+		std::string data = this->sample();
+		std::string expected = data;
+		for (std::size_t i = 0; i < expected.length(); i++) {
+			expected[i] ^= keyAt(i);
+		}
+		BOOST_CHECK_MESSAGE(this->is_equal(expected, this->apply(make(), data)),
+			"XOR with whole buffers failed");
+
+		auto f = make();
+		BOOST_CHECK_MESSAGE(this->is_equal(expected.substr(0, 1000),
+			this->applySmall(*f, data.substr(0, 1000), 7)),
+			"XOR with small buffers failed");
+
+		// Same filter again, to make sure reset() goes back to the start
+		BOOST_CHECK_MESSAGE(this->is_equal(expected.substr(0, 100),
+			this->applySmall(*f, data.substr(0, 100), 33)),
+			"XOR after reset failed");
+
+		// XOR undoes itself
+		BOOST_CHECK_MESSAGE(this->is_equal(data, this->apply(make(), expected)),
+			"XOR round trip failed");
+		return;
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(xor_suite, xor_sample)
+
+BOOST_AUTO_TEST_CASE(key)
+{
+	BOOST_TEST_MESSAGE("XOR with a repeating key");
+	BOOST_CHECK_MESSAGE(is_equal(makeString("\x11\x22\x33\x10\x20"),
+		this->apply(std::make_shared<filter_xor>(std::vector<uint8_t>{0x10, 0x20, 0x30}),
+			makeString("\x01\x02\x03\x00\x00"))),
+		"XOR with a short key failed");
+
+	std::vector<uint8_t> k{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13};
+	this->check([&k]() { return std::make_shared<filter_xor>(k); },
+		[&k](std::size_t i) { return k[i % k.size()]; });
+}
+
+BOOST_AUTO_TEST_CASE(incrementing)
+{
+	BOOST_TEST_MESSAGE("XOR with an incrementing key");
+	BOOST_CHECK_MESSAGE(is_equal(makeString("\xFE\x01\x04\x07"),
+		this->apply(std::make_shared<filter_xor>(0xFE, 3),
+			makeString("\x00\x00\x00\x00"))),
+		"XOR with an incrementing key failed");
+
+	this->check([]() { return std::make_shared<filter_xor>(0x55, 7); },
+		[](std::size_t i) { return (uint8_t)(0x55 + 7 * i); });
+}
+
+BOOST_AUTO_TEST_CASE(lfsr)
+{
+	BOOST_TEST_MESSAGE("XOR with an LFSR keystream");
+	filter_xor::lfsr p = {0x12345678, 0xA3000000};
+
+	// Work out the keystream one bit at a time
+	std::vector<uint8_t> ks;
+	uint32_t s = p.seed;
+	while (ks.size() < 10007) {
+		ks.push_back(s & 0xFF);
+		for (int b = 0; b < 8; b++) s = (s >> 1) ^ ((s & 1) ? p.taps : 0);
+	}
+	this->check([p]() { return std::make_shared<filter_xor>(p); },
+		[&ks](std::size_t i) { return ks[i]; });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,248 @@
+/**
+ * @file   test-formatenum.cpp
+ * @brief  Test code for identifying file formats.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <boost/test/unit_test.hpp>
+#include <camoto/formatenum.hpp>
+#include <camoto/stream_string.hpp>
+
+using namespace camoto;
+
+/// Number of times any test_type::isInstance() has been called.
+static std::atomic<unsigned int> probes(0);
+
+/// Format handler recognising data that starts with a given string.
+class test_type
+{
+	public:
+		typedef int obj_t;
+
+		enum Certainty {
+			DefinitelyNo,
+			Unsure,
+			PossiblyYes,
+			DefinitelyYes,
+		};
+
+		test_type(const std::string& code, const std::string& magic,
+			stream::pos magicOffset, Certainty match)
+			:	code_(code),
+				magic(magic),
+				magicOffset(magicOffset),
+				match(match)
+		{
+		}
+
+		std::string code() const
+		{
+			return this->code_;
+		}
+
+		std::vector<std::string> fileExtensions() const
+		{
+			return {this->code_.substr(0, 3)};
+		}
+
+		Certainty isInstance(stream::input& content) const
+		{
+			probes++;
+			if (this->magic.empty()) return this->match;
+			if (content.size() < this->magicOffset + this->magic.length()) {
+				return DefinitelyNo;
+			}
+			content.seekg(this->magicOffset, stream::start);
+			if (content.read(this->magic.length()) != this->magic) {
+				return DefinitelyNo;
+			}
+			return this->match;
+		}
+
+		std::string code_;
+		std::string magic;
+		stream::pos magicOffset;
+		Certainty match;
+};
+
+namespace camoto {
+
+template <>
+const FormatEnumerator<test_type>::handler_list_t
+	FormatEnumerator<test_type>::formats()
+{
+	return {
+		std::make_shared<const test_type>("aaa-one", "AAAA", 0,
+			test_type::DefinitelyYes),
+		std::make_shared<const test_type>("bbb-two", "BB", 0,
+			test_type::PossiblyYes),
+		std::make_shared<const test_type>("ccc-far", "CCCC", 20000,
+			test_type::DefinitelyYes),
+		std::make_shared<const test_type>("ddd-any", "", 0, test_type::Unsure),
+		std::make_shared<const test_type>("aaa-dup", "AA", 0,
+			test_type::PossiblyYes),
+	};
+}
+
+template <>
+struct format_signatures<test_type> {
+	static std::vector<format_signature> get(const test_type& handler)
+	{
+		if (handler.magic.empty()) return {};
+		return {{handler.magicOffset, handler.magic}};
+	}
+};
+
+} // namespace camoto
+
+typedef FormatEnumerator<test_type> test_enum;
+
+/// Get the codes of the probe results, in order.
+static std::vector<std::string> codes(
+	const std::vector<test_enum::probe_result>& results)
+{
+	std::vector<std::string> list;
+	for (const auto& r : results) list.push_back(r.handler->code());
+	return list;
+}
+
+BOOST_AUTO_TEST_SUITE(formatenum)
+
+BOOST_AUTO_TEST_CASE(by_code)
+{
+	BOOST_TEST_MESSAGE("Look up handlers by code");
+
+	auto h = test_enum::byCode("ccc-far");
+	BOOST_REQUIRE(h);
+	BOOST_CHECK_EQUAL(h->code(), "ccc-far");
+	BOOST_CHECK(test_enum::byCode("ccc-far") == h);
+	BOOST_CHECK(!test_enum::byCode("zzz"));
+}
+
+BOOST_AUTO_TEST_CASE(signatures)
+{
+	BOOST_TEST_MESSAGE("Only handlers with matching signatures are probed");
+
+	auto content = std::make_shared<stream::string>(std::string("AAAAxyz"));
+	probes = 0;
+	auto results = test_enum::probe(content, "file.dat");
+	// aaa-one and aaa-dup match, ddd-any has no signature so is always probed
+	BOOST_CHECK_EQUAL(probes, 3);
+	std::vector<std::string> expected = {"aaa-one", "aaa-dup", "ddd-any"};
+	auto got = codes(results);
+	BOOST_CHECK_EQUAL_COLLECTIONS(got.begin(), got.end(),
+		expected.begin(), expected.end());
+	BOOST_CHECK(results[0].signature);
+	BOOST_CHECK(!results[2].signature);
+
+	// Probing everything gives the same answer, just more slowly
+	probe_options opt;
+	opt.all = true;
+	probes = 0;
+	results = test_enum::probe(content, "file.dat", opt);
+	BOOST_CHECK_EQUAL(probes, 5);
+	got = codes(results);
+	BOOST_CHECK_EQUAL_COLLECTIONS(got.begin(), got.end(),
+		expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(extensions)
+{
+	BOOST_TEST_MESSAGE("Handlers are probed when the file extension matches");
+
+	auto content = std::make_shared<stream::string>(std::string("xxBB"));
+	probes = 0;
+	auto results = test_enum::probe(content, "dir.aaa/FILE.BBB");
+	// bbb-two doesn't match its signature but the extension causes it to be
+	// probed anyway, and ddd-any always is
+	BOOST_CHECK_EQUAL(probes, 2);
+	BOOST_REQUIRE_EQUAL(results.size(), 1);
+	BOOST_CHECK_EQUAL(results[0].handler->code(), "ddd-any");
+
+	// Extension breaks ties
+	content = std::make_shared<stream::string>(std::string("AAAAAA"));
+	results = test_enum::probe(content, "file.bbb");
+	BOOST_REQUIRE_EQUAL(results.size(), 3);
+	BOOST_CHECK_EQUAL(results[0].handler->code(), "aaa-one");
+	BOOST_CHECK(!results[0].extension);
+}
+
+BOOST_AUTO_TEST_CASE(past_header)
+{
+	BOOST_TEST_MESSAGE("Handlers can read past the shared header");
+
+	std::string data(20004, '\0');
+	data.replace(20000, 4, "CCCC");
+	auto content = std::make_shared<stream::string>(data);
+	probe_options opt;
+	opt.lenHeader = 100;
+	auto results = test_enum::probe(content, std::string(), opt);
+	BOOST_REQUIRE_EQUAL(results.size(), 2);
+	BOOST_CHECK_EQUAL(results[0].handler->code(), "ccc-far");
+	BOOST_CHECK_EQUAL(results[1].handler->code(), "ddd-any");
+}
+
+BOOST_AUTO_TEST_CASE(parallel)
+{
+	BOOST_TEST_MESSAGE("Probes run in parallel give the same results");
+
+	thread_pool pool(4);
+	probe_options opt;
+	opt.pool = &pool;
+	opt.all = true;
+	auto content = std::make_shared<stream::string>(std::string("AAAAxyz"));
+	probes = 0;
+	auto results = test_enum::probe(content, "file.aaa", opt);
+	BOOST_CHECK_EQUAL(probes, 5);
+	std::vector<std::string> expected = {"aaa-one", "aaa-dup", "ddd-any"};
+	auto got = codes(results);
+	BOOST_CHECK_EQUAL_COLLECTIONS(got.begin(), got.end(),
+		expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(probe_stream)
+{
+	BOOST_TEST_MESSAGE("Probe stream reads from memory and parent alike");
+
+	auto parent = std::make_shared<stream::string>(std::string("0123456789"));
+	auto header = std::make_shared<const std::string>("0123");
+	stream::input_probe s(parent, header, 10);
+	BOOST_CHECK_EQUAL(s.size(), 10);
+	BOOST_CHECK_EQUAL(s.read(6), "012345");
+	s.seekg(-2, stream::end);
+	BOOST_CHECK_EQUAL(s.read(2), "89");
+	BOOST_CHECK_THROW(s.seekg(1, stream::cur), stream::seek_error);
+
+	stream::len got;
+	std::string scratch;
+	const uint8_t *v = s.view(1, 2, &got, scratch);
+	BOOST_CHECK_EQUAL(got, 2);
+	BOOST_CHECK(v == (const uint8_t *)header->data() + 1);
+	v = s.view(2, 4, &got, scratch);
+	BOOST_CHECK_EQUAL(got, 4);
+	BOOST_CHECK_EQUAL(v[3], '5');
+
+	// Views past the header don't touch the parent's read pointer
+	parent->seekg(3, stream::start);
+	v = s.view(6, 10, &got, scratch);
+	BOOST_CHECK_EQUAL(got, 4);
+	BOOST_CHECK_EQUAL(std::string((const char *)v, got), "6789");
+	BOOST_CHECK_EQUAL(parent->tellg(), 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
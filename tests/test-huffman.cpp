@@ -0,0 +1,166 @@
+/**
+ * @file   test-huffman.cpp
+ * @brief  Test code for the table-driven Huffman decoder.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <camoto/filter.hpp>
+#include <camoto/huffman.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+/// Encode symbols with the canonical codes for the given lengths.
+/**
+ * The codes are worked out by counting, independently of huffman_decoder, and
+ * written one bit at a time so the same code works for either endian.
+ */
+static std::vector<uint8_t> encode(const std::vector<uint8_t>& lengths,
+	const std::vector<unsigned int>& symbols, bitstream::endian endian)
+{
+	std::vector<uint32_t> codes(lengths.size());
+	uint32_t code = 0;
+	for (unsigned int l = 1; l <= HUFFMAN_MAX_BITS; l++) {
+		for (std::size_t i = 0; i < lengths.size(); i++) {
+			if (lengths[i] == l) codes[i] = code++;
+		}
+		code <<= 1;
+	}
+
+	std::vector<uint8_t> out;
+	bitstream bit(endian);
+	fn_putnextchar cbPut = [&out](uint8_t b) {
+		out.push_back(b);
+		return 1;
+	};
+	for (auto s : symbols) {
+		for (int b = lengths[s] - 1; b >= 0; b--) {
+			bit.write(cbPut, 1, (codes[s] >> b) & 1);
+		}
+	}
+	bit.flushByte(cbPut);
+	return out;
+}
+
+/// Lengths from 1 to 15 bits, so some codes need a second-level table.
+static std::vector<uint8_t> skewedLengths()
+{
+	std::vector<uint8_t> lengths;
+	for (unsigned int l = 1; l <= 15; l++) lengths.push_back(l);
+	lengths.push_back(15);
+	// Some unused symbols in between
+	lengths.insert(lengths.begin() + 3, 0);
+	lengths.insert(lengths.begin() + 9, 0);
+	return lengths;
+}
+
+static void roundtrip(bitstream::endian endian, unsigned int rootBits)
+{
+	auto lengths = skewedLengths();
+	std::vector<unsigned int> symbols;
+	uint32_t seed = 7;
+	for (int i = 0; i < 2000; i++) {
+		unsigned int s = (next_random(seed) >> 16) % lengths.size();
+		if (lengths[s]) symbols.push_back(s);
+	}
+	auto data = encode(lengths, symbols, endian);
+
+	huffman_decoder huff(lengths.data(), lengths.size(), endian, rootBits);
+	BOOST_CHECK_EQUAL(huff.max_length(), 15);
+
+	// One at a time
+	bitstream bit(endian);
+	const uint8_t *in = data.data(), *inEnd = in + data.size();
+	for (std::size_t i = 0; i < symbols.size(); i++) {
+		BOOST_REQUIRE_EQUAL(huff.decode(bit, &in, inEnd), symbols[i]);
+	}
+
+	// In a batch
+	bitstream bit2(endian);
+	in = data.data();
+	std::vector<unsigned int> out(symbols.size());
+	BOOST_REQUIRE_EQUAL(huff.decode_n(bit2, &in, inEnd, out.data(), out.size()),
+		symbols.size());
+	BOOST_CHECK(out == symbols);
+	return;
+}
+
+BOOST_AUTO_TEST_SUITE(huffman_suite)
+
+BOOST_AUTO_TEST_CASE(roundtrip_be)
+{
+	BOOST_TEST_MESSAGE("Decode big-endian codes, with and without subtables");
+	roundtrip(bitstream::bigEndian, HUFFMAN_ROOT_BITS);
+	roundtrip(bitstream::bigEndian, 4);
+}
+
+BOOST_AUTO_TEST_CASE(roundtrip_le)
+{
+	BOOST_TEST_MESSAGE("Decode little-endian codes, with and without subtables");
+	roundtrip(bitstream::littleEndian, HUFFMAN_ROOT_BITS);
+	roundtrip(bitstream::littleEndian, 4);
+}
+
+BOOST_AUTO_TEST_CASE(end_of_buffer)
+{
+	BOOST_TEST_MESSAGE("Stop at the end of the buffer without consuming the "
+		"partial code");
+
+	auto lengths = skewedLengths();
+	// Symbol 16 has a 15-bit code, so two of them take four bytes
+	std::vector<unsigned int> symbols = {16, 16};
+	auto data = encode(lengths, symbols, bitstream::bigEndian);
+	BOOST_REQUIRE_EQUAL(data.size(), 4);
+
+	huffman_decoder huff(lengths.data(), lengths.size(), bitstream::bigEndian, 4);
+	bitstream bit(bitstream::bigEndian);
+	const uint8_t *in = data.data(), *inEnd = in + 3;
+	std::vector<unsigned int> out(2);
+	BOOST_CHECK_EQUAL(huff.decode_n(bit, &in, inEnd, out.data(), 2), 1);
+	BOOST_CHECK_EQUAL(out[0], 16);
+	const uint8_t *stopped = in;
+	BOOST_CHECK_EQUAL(huff.decode(bit, &in, inEnd), -1);
+	BOOST_CHECK(in == stopped);
+
+	// Once the rest arrives the second code can be read
+	BOOST_CHECK_EQUAL(huff.decode(bit, &in, data.data() + data.size()), 16);
+}
+
+BOOST_AUTO_TEST_CASE(invalid)
+{
+	BOOST_TEST_MESSAGE("Reject bad code lengths and unused codes");
+
+	// Three 1-bit codes can't exist
+	std::vector<uint8_t> tooMany = {1, 1, 1};
+	BOOST_CHECK_THROW(huffman_decoder(tooMany.data(), tooMany.size(),
+		bitstream::bigEndian), filter_error);
+
+	// Codes 0, 10 but not 11
+	std::vector<uint8_t> incomplete = {1, 2};
+	huffman_decoder huff(incomplete.data(), incomplete.size(),
+		bitstream::bigEndian);
+	std::vector<uint8_t> data = {0x5F, 0xFF};
+	bitstream bit(bitstream::bigEndian);
+	const uint8_t *in = data.data(), *inEnd = in + data.size();
+	BOOST_CHECK_EQUAL(huff.decode(bit, &in, inEnd), 0);
+	BOOST_CHECK_EQUAL(huff.decode(bit, &in, inEnd), 1);
+	BOOST_CHECK_THROW(huff.decode(bit, &in, inEnd), filter_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
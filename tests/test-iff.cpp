@@ -18,6 +18,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
 #include <boost/test/unit_test.hpp>
 
 #include <camoto/iostream_helpers.hpp>
@@ -28,6 +29,39 @@
 
 using namespace camoto;
 
+/// Output stream that can't seek, like a pipe.
+class pipe_output: virtual public stream::output
+{
+	public:
+		virtual stream::len try_write(const uint8_t *buffer, stream::len len)
+		{
+			this->data.append((const char *)buffer, len);
+			return len;
+		}
+
+		virtual void seekp(stream::delta off, stream::seek_from from)
+		{
+			throw stream::seek_error("Cannot seek in a pipe");
+		}
+
+		virtual stream::pos tellp() const
+		{
+			throw stream::seek_error("Cannot tell in a pipe");
+		}
+
+		virtual void truncate(stream::pos size)
+		{
+			throw stream::write_error("Cannot truncate a pipe");
+		}
+
+		virtual void flush()
+		{
+			return;
+		}
+
+		std::string data;
+};
+
 BOOST_FIXTURE_TEST_SUITE(iff_suite, string_sample)
 
 #define RIFF_CONTENT makeString( \
@@ -113,6 +147,113 @@ BOOST_AUTO_TEST_CASE(riff_write)
 		"Writing RIFF file failed");
 }
 
+BOOST_AUTO_TEST_CASE(riff_write_streaming)
+{
+	BOOST_TEST_MESSAGE("Write a RIFF file to a stream that can't seek");
+
+	pipe_output pipe;
+	IFFWriter iff(pipe, IFF::Filetype_RIFF, true);
+	stream::output& out = iff.data();
+	iff.begin("RIFF", "test");
+		iff.begin("one ");
+		out.write("abcdefg");
+		iff.end();
+		iff.begin("LIST", "demo");
+			iff.begin("dem1", 3);
+			out.write("aaa");
+			iff.end();
+			iff.begin("dem2");
+			out.write("bbbb");
+			iff.end();
+		iff.end();
+		iff.begin("two ");
+		out.write("hijklm");
+		iff.end();
+		iff.begin("two ");
+		out.write("no");
+		iff.end();
+		iff.begin("two ");
+		out.write("pqr");
+		iff.end();
+		// Nothing can be written until the outer chunk's length is known
+		BOOST_CHECK(pipe.data.empty());
+	iff.end();
+
+	BOOST_CHECK_MESSAGE(is_equal(RIFF_CONTENT, pipe.data),
+		"Streaming RIFF file failed");
+}
+
+BOOST_AUTO_TEST_CASE(riff_write_declared)
+{
+	BOOST_TEST_MESSAGE("Write a RIFF file with chunk lengths given up front");
+
+	pipe_output pipe;
+	IFFWriter iff(pipe, IFF::Filetype_RIFF, true);
+	stream::output& out = iff.data();
+	iff.begin("RIFF", "test", 0x5C);
+		iff.begin("one ", 7);
+		out.write("abcdefg");
+		iff.end();
+		// Declared chunks are passed straight through
+		BOOST_CHECK_EQUAL(pipe.data.length(), 12 + 8 + 8);
+		BOOST_CHECK_EQUAL(out.tellp(), 12 + 8 + 8);
+		iff.begin("LIST", "demo");
+			iff.begin("dem1");
+			out.write("aaa");
+			iff.end();
+			iff.begin("dem2", 4);
+			out.write("bbbb");
+			iff.end();
+			BOOST_CHECK_EQUAL(pipe.data.length(), 12 + 8 + 8);
+		iff.end();
+		iff.begin("two ", 6);
+		out.write("hijklm");
+		iff.end();
+		iff.begin("two ", 2);
+		out.write("no");
+		iff.end();
+		iff.begin("two ", 3);
+		out.write("pqr");
+		iff.end();
+	iff.end();
+
+	BOOST_CHECK_MESSAGE(is_equal(RIFF_CONTENT, pipe.data),
+		"Streaming RIFF file with declared lengths failed");
+
+	iff.begin("bad ", 4);
+	out.write("abc");
+	BOOST_CHECK_THROW(iff.end(), stream::write_error);
+	BOOST_CHECK_THROW(out.seekp(0, stream::start), stream::seek_error);
+}
+
+BOOST_AUTO_TEST_CASE(riff_write_declared_seekable)
+{
+	BOOST_TEST_MESSAGE("Mix declared and undeclared chunks without streaming");
+
+	IFFWriter iff(this->out, IFF::Filetype_RIFF);
+	iff.begin("RIFF", "test");
+		iff.begin("one ", 7);
+		this->out.write("abcdefg");
+		iff.end();
+		iff.begin("LIST", "demo", 0x1C);
+			iff.begin("dem1");
+			this->out.write("aaa");
+			iff.end();
+			iff.begin("dem2", 4);
+			this->out.write("bbbb");
+			iff.end();
+		iff.end();
+		for (auto s : {"hijklm", "no", "pqr"}) {
+			iff.begin("two ");
+			this->out.write(s);
+			iff.end();
+		}
+	iff.end();
+
+	BOOST_CHECK_MESSAGE(is_equal(RIFF_CONTENT),
+		"Writing RIFF file with declared lengths failed");
+}
+
 BOOST_AUTO_TEST_CASE(riff_read_missing_pad)
 {
 	BOOST_TEST_MESSAGE("Read a padded RIFF file with a missing pad byte");
@@ -288,4 +429,95 @@ BOOST_AUTO_TEST_CASE(riff_write_unpadded)
 		"Writing RIFF file failed");
 }
 
+BOOST_AUTO_TEST_CASE(fourcc_pack)
+{
+	BOOST_TEST_MESSAGE("Convert fourcc codes to and from strings");
+
+	IFF::fourcc a("RIFF");
+	BOOST_CHECK_EQUAL(a.code, 0x52494646);
+	BOOST_CHECK_EQUAL(a.str(), "RIFF");
+	BOOST_CHECK(a == std::string("RIFF"));
+	BOOST_CHECK(a != "LIST");
+
+	IFF::fourcc b("ab");
+	BOOST_CHECK_EQUAL(b.code, 0x61620000);
+	BOOST_CHECK_EQUAL(b.str(), std::string("ab\0\0", 4));
+}
+
+/// Name of a chunk type, chosen at compile time.
+template <fourcc_t Name>
+std::string chunkName()
+{
+	return IFF::fourcc(Name).str();
+}
+
+BOOST_AUTO_TEST_CASE(fourcc_constexpr)
+{
+	BOOST_TEST_MESSAGE("Use fourcc codes as compile-time constants");
+
+	static_assert((uint32_t)"RIFF"_cc == 0x52494646, "fourcc literal packed wrongly");
+	static_assert((uint32_t)"ab"_cc == 0x61620000, "short fourcc not padded");
+	static_assert(IFF::fourcc("LIST") == "LIST"_cc, "fourcc not constexpr");
+	static_assert(IFF::fourcc("a\0b") == "a"_cc, "fourcc read past null");
+
+	BOOST_CHECK_EQUAL(chunkName<"dem1"_cc>(), "dem1");
+
+	IFF::fourcc name("LIST");
+	int found = 0;
+	switch (name.id()) {
+		case "RIFF"_cc: found = 1; break;
+		case "LIST"_cc: found = 2; break;
+		default: break;
+	}
+	BOOST_CHECK_EQUAL(found, 2);
+
+	this->in->write(RIFF_CONTENT);
+	IFFReader iff(this->in, IFF::Filetype_RIFF);
+	IFF::fourcc type;
+	iff.open("RIFF"_cc, &type);
+	BOOST_CHECK(type == "test"_cc);
+	// Must find by name, not be taken as a chunk index
+	BOOST_CHECK_EQUAL(iff.seek("two "_cc), 6);
+}
+
+BOOST_AUTO_TEST_CASE(riff_read_many)
+{
+	BOOST_TEST_MESSAGE("Read a RIFF file with many chunks");
+
+	const unsigned int num = 2000;
+	IFFWriter w(this->out, IFF::Filetype_RIFF);
+	w.begin("RIFF", "many");
+	for (unsigned int i = 0; i < num; i++) {
+		char name[5];
+		snprintf(name, sizeof(name), "%04u", i);
+		w.begin(name);
+		this->out.write(name, 1 + (i % 4));
+		w.end();
+	}
+	w.end();
+	this->out.seekg(0, stream::start);
+
+	IFFReader iff(this->out, IFF::Filetype_RIFF);
+	IFF::fourcc type;
+	iff.open("RIFF", &type);
+	BOOST_REQUIRE_EQUAL(type, "many");
+
+	// Look up chunks in an order that would be quadratic with a linear search
+	for (unsigned int i = num; i > 0; i -= 7) {
+		char name[5];
+		snprintf(name, sizeof(name), "%04u", i - 1);
+		stream::len len = iff.seek(name);
+		BOOST_REQUIRE_EQUAL(len, 1 + ((i - 1) % 4));
+		BOOST_REQUIRE_EQUAL(this->out.read(len), std::string(name, len));
+		if (i <= 7) break;
+	}
+	BOOST_CHECK_THROW(iff.seek("zzzz"), stream::error);
+	BOOST_CHECK_EQUAL(iff.list().size(), num);
+
+	// Opening without reading a type code
+	iff.root();
+	BOOST_CHECK_EQUAL(iff.open("RIFF", NULL), this->out.size() - 8);
+	BOOST_CHECK_EQUAL(iff.list()[0], "many");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
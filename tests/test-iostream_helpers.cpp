@@ -24,6 +24,36 @@
 
 using namespace camoto;
 
+/// String stream whose view() seeks, like most streams that aren't in memory.
+class seeking_view_string: public stream::string
+{
+	public:
+		seeking_view_string(std::string content)
+			:	stream::string_core(std::move(content)),
+				numReads(0)
+		{
+		}
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len)
+		{
+			this->numReads++;
+			return this->stream::string::try_read(buffer, len);
+		}
+
+		virtual const uint8_t *view(stream::pos pos, stream::len len,
+			stream::len *got, std::string& scratch)
+		{
+			return this->stream::input::view(pos, len, got, scratch);
+		}
+
+		virtual bool cheap_view() const
+		{
+			return false;
+		}
+
+		unsigned int numReads;
+};
+
 BOOST_AUTO_TEST_SUITE(iostream_helpers)
 
 BOOST_AUTO_TEST_CASE(null_padded_write)
@@ -107,6 +137,72 @@ BOOST_AUTO_TEST_CASE(null_terminated_read)
 	}
 }
 
+BOOST_AUTO_TEST_CASE(null_terminated_read_long)
+{
+	BOOST_TEST_MESSAGE("Read long and unterminated null-terminated strings");
+	{
+		// Longer than the block searched in one go
+		std::string name(1000, 'x');
+		stream::string content(name + std::string("\0after\0", 7));
+		std::string v;
+		content >> nullTerminated(v, 2000);
+		BOOST_CHECK(v == name);
+		BOOST_REQUIRE_EQUAL(content.tellg(), 1001);
+		std::string w;
+		content >> nullTerminated(w, 20);
+		BOOST_CHECK_EQUAL(w, "after");
+	}
+	{
+		// Limit reached before the null
+		stream::string content(std::string("ABCDEFGH\0", 9));
+		std::string v;
+		content >> nullTerminated(v, 4);
+		BOOST_CHECK_EQUAL(v, "ABCD");
+		BOOST_REQUIRE_EQUAL(content.tellg(), 4);
+	}
+	{
+		// EOF reached before the null
+		stream::string content(std::string("ABCD"));
+		std::string v;
+		BOOST_CHECK_THROW(content >> nullTerminated(v, 8), stream::incomplete_read);
+		BOOST_CHECK_EQUAL(v, "ABCD");
+	}
+}
+
+BOOST_AUTO_TEST_CASE(null_terminated_read_blocks)
+{
+	BOOST_TEST_MESSAGE("Read null-terminated strings without view()");
+	{
+		std::string name(1000, 'x');
+		seeking_view_string content(name + std::string("\0after\0", 7));
+		std::string v;
+		content >> nullTerminated(v, 2000);
+		BOOST_CHECK(v == name);
+		BOOST_REQUIRE_EQUAL(content.tellg(), 1001);
+		// Read in blocks, not once per byte or twice per block
+		BOOST_CHECK_LE(content.numReads, 4);
+		std::string w;
+		content >> nullTerminated(w, 20);
+		BOOST_CHECK_EQUAL(w, "after");
+		BOOST_REQUIRE_EQUAL(content.tellg(), 1007);
+	}
+	{
+		// Limit reached before the null
+		seeking_view_string content(std::string("ABCDEFGH\0", 9));
+		std::string v;
+		content >> nullTerminated(v, 4);
+		BOOST_CHECK_EQUAL(v, "ABCD");
+		BOOST_REQUIRE_EQUAL(content.tellg(), 4);
+	}
+	{
+		// EOF reached before the null
+		seeking_view_string content(std::string("ABCD"));
+		std::string v;
+		BOOST_CHECK_THROW(content >> nullTerminated(v, 8), stream::incomplete_read);
+		BOOST_CHECK_EQUAL(v, "ABCD");
+	}
+}
+
 BOOST_AUTO_TEST_CASE(stream_write)
 {
 	{
@@ -218,4 +314,75 @@ BOOST_AUTO_TEST_CASE(stream_read)
 	}
 }
 
+BOOST_AUTO_TEST_CASE(stream_packed)
+{
+	{
+		stream::string content;
+		const uint32_t a = 0x01234567;
+		write_packed(content, u32le(a), u16be(0x89AB), u8(0xCD), s16le(-2));
+		BOOST_CHECK_EQUAL(content.data,
+			std::string("\x67\x45\x23\x01" "\x89\xAB" "\xCD" "\xFE\xFF", 9));
+		// Everything should go out in a single write
+		BOOST_CHECK_EQUAL(content.tellp(), 9);
+	}
+	{
+		stream::string content;
+		content << std::string("\x67\x45\x23\x01" "\x89\xAB" "\xCD" "\xFE\xFF", 9);
+		content.seekg(0, stream::start);
+		uint32_t a = 0;
+		unsigned int b = 0;
+		uint8_t c = 0;
+		int d = 0;
+		read_packed(content, u32le(a), u16be(b), u8(c), s16le(d));
+		BOOST_CHECK_EQUAL(a, 0x01234567);
+		BOOST_CHECK_EQUAL(b, 0x89AB);
+		BOOST_CHECK_EQUAL(c, 0xCD);
+		BOOST_CHECK_EQUAL(d, -2);
+		BOOST_CHECK_EQUAL(content.tellg(), 9);
+	}
+	{
+		// Short read must not change any of the variables
+		stream::string content;
+		content << std::string("\x01\x02\x03\x04\x05", 5);
+		content.seekg(0, stream::start);
+		uint32_t a = 7;
+		uint16_t b = 8;
+		BOOST_CHECK_THROW(read_packed(content, u32le(a), u16le(b)),
+			stream::incomplete_read);
+		BOOST_CHECK_EQUAL(a, 7);
+		BOOST_CHECK_EQUAL(b, 8);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(stream_array)
+{
+	std::vector<uint16_t> v;
+	for (unsigned int i = 0; i < 3000; i++) v.push_back(i * 7);
+	{
+		stream::string content;
+		write_array<uint16_t, big_endian>(content, v);
+		BOOST_REQUIRE_EQUAL(content.data.length(), 6000);
+		BOOST_CHECK_EQUAL((uint8_t)content.data.at(2), 0x00);
+		BOOST_CHECK_EQUAL((uint8_t)content.data.at(3), 0x07);
+		BOOST_CHECK_EQUAL((uint8_t)content.data.at(5998), ((2999 * 7) >> 8) & 0xFF);
+		BOOST_CHECK_EQUAL((uint8_t)content.data.at(5999), (2999 * 7) & 0xFF);
+
+		content.seekg(0, stream::start);
+		std::vector<uint16_t> got;
+		read_array<uint16_t, big_endian>(content, got, v.size());
+		BOOST_CHECK(got == v);
+	}
+	{
+		stream::string content;
+		write_array<uint16_t, little_endian>(content, v);
+		BOOST_CHECK_EQUAL((uint8_t)content.data.at(2), 0x07);
+		content.seekg(0, stream::start);
+		std::vector<uint16_t> got;
+		read_array<uint16_t, little_endian>(content, got, v.size());
+		BOOST_CHECK(got == v);
+		BOOST_CHECK_THROW((read_array<uint16_t, little_endian>(content, got, 1)),
+			stream::incomplete_read);
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,151 @@
+/**
+ * @file   test-memory.cpp
+ * @brief  Test code for counting memory held by streams.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/filter-xor.hpp>
+#include <camoto/memory.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_paged.hpp>
+#include <camoto/stream_seg.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/util.hpp> // std::make_unique
+#include "tests.hpp"
+
+using namespace camoto;
+
+BOOST_FIXTURE_TEST_SUITE(memory_suite, default_sample)
+
+BOOST_AUTO_TEST_CASE(string)
+{
+	BOOST_TEST_MESSAGE("Count memory held by a string stream");
+
+	uint64_t before = memory::snapshot()[memory::owner::string];
+	{
+		stream::string s;
+		s.write(std::string(1000, 'x'));
+		BOOST_CHECK(s.buffered_bytes() >= 1000);
+		BOOST_CHECK_EQUAL(memory::snapshot()[memory::owner::string],
+			before + s.buffered_bytes());
+
+		std::string content = s.release();
+		BOOST_CHECK_EQUAL(memory::snapshot()[memory::owner::string],
+			before + s.buffered_bytes());
+	}
+	BOOST_CHECK_EQUAL(memory::snapshot()[memory::owner::string], before);
+}
+
+BOOST_AUTO_TEST_CASE(filtered)
+{
+	BOOST_TEST_MESSAGE("Count memory held by a filtered stream");
+
+	uint64_t before = memory::snapshot()[memory::owner::filtered];
+	{
+		auto parent = std::make_shared<stream::string>(std::string(5000, 'x'));
+		stream::filtered f(parent, std::make_shared<filter_xor>(0, 0),
+			std::make_shared<filter_xor>(0, 0), nullptr);
+		BOOST_CHECK_EQUAL(f.size(), 5000);
+		BOOST_CHECK(f.buffered_bytes() >= 5000);
+		BOOST_CHECK_EQUAL(memory::snapshot()[memory::owner::filtered],
+			before + f.buffered_bytes());
+	}
+	BOOST_CHECK_EQUAL(memory::snapshot()[memory::owner::filtered], before);
+}
+
+BOOST_AUTO_TEST_CASE(seg)
+{
+	BOOST_TEST_MESSAGE("Count memory held by data inserted into a segstream");
+
+	uint64_t before = memory::snapshot()[memory::owner::seg];
+	stream::seg s(std::make_unique<stream::string>("ABCDEFGH"));
+	s.seekp(4, stream::start);
+	s.insert(3000);
+	BOOST_CHECK(s.buffered_bytes() >= 3000);
+	BOOST_CHECK_EQUAL(memory::snapshot()[memory::owner::seg],
+		before + s.buffered_bytes());
+
+	// Committing the data frees it
+	s.flush();
+	BOOST_CHECK_EQUAL(s.buffered_bytes(), 0);
+	BOOST_CHECK_EQUAL(memory::snapshot()[memory::owner::seg], before);
+}
+
+BOOST_AUTO_TEST_CASE(paged)
+{
+	BOOST_TEST_MESSAGE("Pages shared with snapshots are only counted once");
+
+	uint64_t before = memory::snapshot()[memory::owner::paged];
+	{
+		stream::paged p;
+		p.write(std::string(PAGED_PAGE_SIZE + 1, 'x'));
+		BOOST_CHECK_EQUAL(p.buffered_bytes(), 2 * PAGED_PAGE_SIZE);
+		BOOST_CHECK_EQUAL(memory::snapshot()[memory::owner::paged],
+			before + 2 * PAGED_PAGE_SIZE);
+
+		auto snap = p.snapshot();
+		BOOST_CHECK_EQUAL(snap->buffered_bytes(), 2 * PAGED_PAGE_SIZE);
+		BOOST_CHECK_EQUAL(memory::snapshot()[memory::owner::paged],
+			before + 2 * PAGED_PAGE_SIZE);
+
+		// Changing one page makes a copy of it
+		p.seekp(0, stream::start);
+		p.write("y");
+		BOOST_CHECK_EQUAL(memory::snapshot()[memory::owner::paged],
+			before + 3 * PAGED_PAGE_SIZE);
+	}
+	BOOST_CHECK_EQUAL(memory::snapshot()[memory::owner::paged], before);
+}
+
+BOOST_AUTO_TEST_CASE(soft_limit)
+{
+	BOOST_TEST_MESSAGE("Soft limit callback runs once each time it is exceeded");
+
+	unsigned int calls = 0;
+	uint64_t reported = 0;
+	uint64_t limit = memory::snapshot().total + 100000;
+	memory::set_soft_limit(limit, [&](uint64_t total) {
+		calls++;
+		reported = total;
+	});
+
+	stream::string s;
+	s.write(std::string(50000, 'x'));
+	BOOST_CHECK_EQUAL(calls, 0);
+
+	s.write(std::string(100000, 'x'));
+	BOOST_CHECK_EQUAL(calls, 1);
+	BOOST_CHECK(reported > limit);
+	BOOST_CHECK(memory::snapshot().peak >= reported);
+
+	// Still over the limit, so no more calls
+	s.write(std::string(100000, 'x'));
+	BOOST_CHECK_EQUAL(calls, 1);
+
+	// Drop back under the limit and go over again
+	s.release();
+	s.write(std::string(200000, 'x'));
+	BOOST_CHECK_EQUAL(calls, 2);
+
+	memory::set_soft_limit(0, nullptr);
+	s.release();
+	s.write(std::string(200000, 'x'));
+	BOOST_CHECK_EQUAL(calls, 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,241 @@
+/**
+ * @file   test-repack.cpp
+ * @brief  Test code for rebuilding archives in one pass.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+
+#include <camoto/repack.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/stream_sub.hpp>
+#include <camoto/filter-lzw.hpp>
+
+#include "tests.hpp"
+
+#ifdef _WIN32
+#define unlink(x) _unlink(x)
+#endif
+
+using namespace camoto;
+
+#define LZW_PARAMS 9, 12, 0x101, 0x100, 0, \
+	LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT
+
+constexpr auto REPACK_TEST_FILE = "_repack.$";
+
+/// Item copied as-is.
+stream::repack_item item(std::shared_ptr<stream::input> source,
+	stream::pos srcOffset, stream::len srcLen,
+	stream::pos destOffset = REPACK_NEXT)
+{
+	return {source, srcOffset, srcLen, destOffset, nullptr, 0};
+}
+
+/// Item copied from a string.
+stream::repack_item item(const std::string& content)
+{
+	return item(std::make_shared<stream::string>(content), 0, content.length());
+}
+
+BOOST_FIXTURE_TEST_SUITE(repack_suite, default_sample)
+
+BOOST_AUTO_TEST_CASE(repack_new)
+{
+	BOOST_TEST_MESSAGE("Build a new archive from parts of others");
+
+	auto src = std::make_shared<stream::string>("0123456789ABCDEF");
+	std::vector<stream::repack_item> layout;
+	layout.push_back(item(src, 8, 4));
+	layout.push_back(item(src, 12, 4));
+	layout.push_back(item(src, 0, 4, 10));
+	layout.push_back(item("xyz"));
+
+	stream::string out("old content that should go");
+	stream::repack(layout, out);
+
+	BOOST_CHECK_MESSAGE(
+		is_equal(std::string("89ABCDEF\0\0" "0123" "xyz", 17), out.data),
+		"Archive was not built correctly");
+	BOOST_CHECK_EQUAL(layout[0].destOffset, 0);
+	BOOST_CHECK_EQUAL(layout[1].destOffset, 4);
+	BOOST_CHECK_EQUAL(layout[2].destOffset, 10);
+	BOOST_CHECK_EQUAL(layout[3].destOffset, 14);
+	BOOST_CHECK_EQUAL(layout[3].destLen, 3);
+}
+
+BOOST_AUTO_TEST_CASE(repack_filtered)
+{
+	BOOST_TEST_MESSAGE("Compress members in parallel while building an archive");
+
+	std::vector<std::string> originals;
+	std::vector<stream::repack_item> layout;
+	for (unsigned int i = 0; i < 30; i++) {
+		originals.push_back(sample_text(50 + i * 1013));
+		layout.push_back(item(originals.back()));
+		// Every third member is stored uncompressed
+		if (i % 3) {
+			layout.back().algo = std::make_shared<filter_lzw_compress>(LZW_PARAMS);
+		}
+	}
+
+	thread_pool pool(3);
+	auto out = std::make_shared<stream::string>();
+	stream::repack(layout, *out, &pool);
+
+	stream::pos next = 0;
+	for (unsigned int i = 0; i < layout.size(); i++) {
+		const auto& m = layout[i];
+		BOOST_REQUIRE_EQUAL(m.destOffset, next);
+		next += m.destLen;
+
+		std::shared_ptr<stream::input> member =
+			std::make_shared<stream::input_sub>(out, m.destOffset, m.destLen);
+		if (m.algo) {
+			BOOST_CHECK_LT(m.destLen, m.srcLen);
+			member = std::make_shared<stream::input_filtered>(member,
+				std::make_shared<filter_lzw_decompress>(LZW_PARAMS));
+		}
+		member->seekg(0, stream::start);
+		BOOST_CHECK_MESSAGE(member->read(member->size()) == originals[i],
+			"Member #" << i << " was not stored correctly");
+	}
+	BOOST_CHECK_EQUAL(out->size(), next);
+}
+
+BOOST_AUTO_TEST_CASE(in_place_remove)
+{
+	BOOST_TEST_MESSAGE("Remove a member by moving the rest down in place");
+
+	stream::string archive("AAAABBBBCCCCDDDD");
+	std::vector<stream::repack_item> layout;
+	layout.push_back(item(nullptr, 0, 4));
+	layout.push_back(item(nullptr, 8, 4));
+	layout.push_back(item(nullptr, 12, 4));
+
+	BOOST_CHECK(stream::repack_in_place(layout, archive));
+	BOOST_CHECK_MESSAGE(is_equal("AAAACCCCDDDD", archive.data),
+		"Archive was not compacted correctly");
+	BOOST_CHECK_EQUAL(layout[2].destOffset, 8);
+}
+
+BOOST_AUTO_TEST_CASE(in_place_insert)
+{
+	BOOST_TEST_MESSAGE("Insert a new member by moving the rest up in place");
+
+	stream::string archive("AAAABBBBCCCCDDDD");
+	std::vector<stream::repack_item> layout;
+	layout.push_back(item(nullptr, 0, 4));
+	layout.push_back(item("xx"));
+	layout.push_back(item(nullptr, 4, 4));
+	layout.push_back(item(nullptr, 8, 4));
+	layout.push_back(item(nullptr, 12, 4));
+
+	BOOST_CHECK(stream::repack_in_place(layout, archive));
+	BOOST_CHECK_MESSAGE(is_equal("AAAAxxBBBBCCCCDDDD", archive.data),
+		"Member was not inserted correctly");
+	BOOST_CHECK_EQUAL(layout[1].destOffset, 4);
+	BOOST_CHECK_EQUAL(layout[4].destOffset, 14);
+}
+
+BOOST_AUTO_TEST_CASE(in_place_swap)
+{
+	BOOST_TEST_MESSAGE("Swap members, which can't be done in place");
+
+	stream::string archive("AAAABBBBCCCCDDDD");
+	std::vector<stream::repack_item> layout;
+	layout.push_back(item(nullptr, 12, 4));
+	layout.push_back(item(nullptr, 4, 8));
+	layout.push_back(item(nullptr, 0, 4));
+
+	BOOST_CHECK(!stream::repack_in_place(layout, archive));
+	BOOST_CHECK_MESSAGE(is_equal("DDDDBBBBCCCCAAAA", archive.data),
+		"Members were not swapped correctly");
+	BOOST_CHECK_EQUAL(layout[2].destOffset, 12);
+}
+
+BOOST_AUTO_TEST_CASE(in_place_overlap)
+{
+	BOOST_TEST_MESSAGE("Reject a layout with overlapping members");
+
+	stream::string archive("AAAABBBBCCCCDDDD");
+	std::vector<stream::repack_item> layout;
+	layout.push_back(item(nullptr, 0, 8, 0));
+	layout.push_back(item(nullptr, 12, 4, 6));
+
+	BOOST_CHECK_THROW(stream::repack_in_place(layout, archive), stream::error);
+	BOOST_CHECK_MESSAGE(is_equal("AAAABBBBCCCCDDDD", archive.data),
+		"Archive was changed after an error");
+}
+
+BOOST_AUTO_TEST_CASE(file_replace)
+{
+	BOOST_TEST_MESSAGE("Rebuild an archive file through a new file");
+
+	{
+		stream::file f(REPACK_TEST_FILE, true);
+		f.write("AAAABBBBCCCCDDDD");
+	}
+
+	// Compressing a member means the archive can't be done in place
+	std::vector<stream::repack_item> layout;
+	layout.push_back(item(nullptr, 12, 4));
+	layout.push_back(item(nullptr, 0, 8));
+	layout.back().algo = std::make_shared<filter_lzw_compress>(LZW_PARAMS);
+	layout.push_back(item("xyz"));
+
+	BOOST_CHECK(!stream::repack_file(layout, REPACK_TEST_FILE));
+	{
+		auto f = std::make_shared<stream::input_file>(REPACK_TEST_FILE);
+		BOOST_REQUIRE_EQUAL(f->size(), 4 + layout[1].destLen + 3);
+		BOOST_CHECK_MESSAGE(is_equal("DDDD", f->read(4)),
+			"First member was not copied correctly");
+		stream::input_filtered member(
+			std::make_shared<stream::input_sub>(f, 4, layout[1].destLen),
+			std::make_shared<filter_lzw_decompress>(LZW_PARAMS));
+		BOOST_CHECK_MESSAGE(is_equal("AAAABBBB", member.read(member.size())),
+			"Compressed member was not stored correctly");
+		f->seekg(layout[2].destOffset, stream::start);
+		BOOST_CHECK_MESSAGE(is_equal("xyz", f->read(3)),
+			"New member was not added correctly");
+	}
+
+	// Removing the first member can be done in place
+	layout.erase(layout.begin());
+	for (auto& m : layout) {
+		m.source = nullptr;
+		m.srcOffset = m.destOffset;
+		m.srcLen = m.destLen;
+		m.destOffset = REPACK_NEXT;
+		m.algo = nullptr;
+	}
+	stream::len lenCompressed = layout[0].srcLen;
+	BOOST_CHECK(stream::repack_file(layout, REPACK_TEST_FILE));
+	{
+		stream::input_file f(REPACK_TEST_FILE);
+		BOOST_REQUIRE_EQUAL(f.size(), lenCompressed + 3);
+		f.seekg(lenCompressed, stream::start);
+		BOOST_CHECK_MESSAGE(is_equal("xyz", f.read(3)),
+			"Archive file was not compacted correctly");
+	}
+
+	unlink(REPACK_TEST_FILE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
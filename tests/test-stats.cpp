@@ -0,0 +1,104 @@
+/**
+ * @file   test-stats.cpp
+ * @brief  Test code for the optional stream and filter counters.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory>
+#include <thread>
+#include <boost/test/unit_test.hpp>
+#include <camoto/filter-dummy.hpp>
+#include <camoto/stats.hpp>
+#include <camoto/stream_filtered.hpp>
+#include <camoto/stream_seg.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/stream_sub.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+BOOST_AUTO_TEST_SUITE(stats_suite)
+
+BOOST_AUTO_TEST_CASE(counts)
+{
+	BOOST_TEST_MESSAGE("Stream and filter activity is counted when enabled");
+
+	auto before = stats::snapshot();
+
+	auto base = std::make_shared<stream::string>(std::string(1000, 'a'));
+	stream::input_sub sub(base, 100, 500);
+	for (int i = 0; i < 10; i++) {
+		sub.seekg(i * 10, stream::start);
+		sub.read(5);
+	}
+
+	{
+		stream::seg seg(std::unique_ptr<stream::inout>(
+			new stream::string(std::string(100, 'a'))));
+		seg.seekp(10, stream::start);
+		seg.insert(4);
+		seg.write("bbbb");
+		seg.flush();
+	}
+
+	// Read the filtered stream from another thread, to make sure its counters
+	// are kept once the thread has exited.
+	std::thread t([base]() {
+		stream::input_filtered filt(base, std::make_shared<filter_dummy>());
+		filt.read(filt.size());
+	});
+	t.join();
+
+	auto after = stats::snapshot();
+
+	if (!after.enabled) {
+		// Built without CAMOTO_STATS, so everything should be zero
+		BOOST_CHECK_EQUAL(after[stats::stream_type::sub].reads, 0);
+		BOOST_CHECK_EQUAL(after.commits, 0);
+		BOOST_CHECK(after.filters.empty());
+		return;
+	}
+
+	auto& subBefore = before[stats::stream_type::sub];
+	auto& subAfter = after[stats::stream_type::sub];
+	BOOST_CHECK_EQUAL(subAfter.reads - subBefore.reads, 10);
+	BOOST_CHECK_EQUAL(subAfter.bytesRead - subBefore.bytesRead, 50);
+	BOOST_CHECK_EQUAL(subAfter.seeks - subBefore.seeks, 10);
+
+	// The substream's reads went through to the string underneath
+	auto& strBefore = before[stats::stream_type::string];
+	auto& strAfter = after[stats::stream_type::string];
+	BOOST_CHECK_GE(strAfter.bytesRead - strBefore.bytesRead, 50);
+
+	BOOST_CHECK_EQUAL(after.commits - before.commits, 1);
+	BOOST_CHECK_EQUAL(after.populates - before.populates, 1);
+
+	auto& filtBefore = before[stats::stream_type::filtered];
+	auto& filtAfter = after[stats::stream_type::filtered];
+	BOOST_CHECK_EQUAL(filtAfter.bytesRead - filtBefore.bytesRead, 1000);
+
+	auto f = after.filters.find("camoto::filter_dummy");
+	BOOST_REQUIRE(f != after.filters.end());
+	stats::filter_counters prev = {};
+	auto p = before.filters.find("camoto::filter_dummy");
+	if (p != before.filters.end()) prev = p->second;
+	BOOST_CHECK_GE(f->second.calls - prev.calls, 1);
+	BOOST_CHECK_EQUAL(f->second.bytesIn - prev.bytesIn, 1000);
+	BOOST_CHECK_EQUAL(f->second.bytesOut - prev.bytesOut, 1000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -152,3 +152,93 @@ BOOST_AUTO_TEST_CASE(stream_move_extend_overlap)
 }
 
 BOOST_AUTO_TEST_SUITE_END() // stream_move_suite
+
+/// String stream that counts how many positional reads are made.
+class counted_string: public stream::input_string
+{
+	public:
+		counted_string(std::string content)
+			:	string_core(content),
+				input_string(content),
+				reads(0)
+		{
+		}
+
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len)
+		{
+			this->reads++;
+			return this->input_string::try_read_at(pos, buffer, len);
+		}
+
+		unsigned int reads;
+};
+
+BOOST_AUTO_TEST_SUITE(stream_range_suite)
+
+BOOST_AUTO_TEST_CASE(read_ranges)
+{
+	BOOST_TEST_MESSAGE("Read scattered ranges with as few reads as possible");
+
+	std::string content;
+	for (int i = 0; i < 100000; i++) content += (char)(i * 13 + (i >> 9));
+	counted_string src(content);
+
+	// Out of order, overlapping, close together and far apart, one past EOF
+	std::vector<stream::read_range> ranges = {
+		{50000, 100}, {100, 50}, {0, 20}, {120, 10}, {30, 5}, {50200, 300},
+		{99990, 20}, {200000, 5}, {40, 0},
+	};
+	std::vector<std::string> got(ranges.size());
+	std::vector<std::size_t> seen;
+	stream::read_ranges(src, ranges.data(), ranges.size(),
+		[&](std::size_t index, stream::len offset, const uint8_t *data,
+			stream::len len) {
+			BOOST_REQUIRE_EQUAL(offset, got[index].length());
+			got[index].append((const char *)data, len);
+			if (offset == 0) seen.push_back(index);
+		}, 1000, 1024 * 1024);
+
+	for (std::size_t i = 0; i < ranges.size(); i++) {
+		std::string expected;
+		if (ranges[i].pos < content.length()) {
+			expected = content.substr(ranges[i].pos, ranges[i].len);
+		}
+		BOOST_CHECK_MESSAGE(got[i] == expected, "Range " << i << " is wrong");
+	}
+
+	// Three groups: near the start, around 50000, and at the end
+	BOOST_CHECK_LE(src.reads, 6);
+
+	// Delivered in order of position
+	std::vector<std::size_t> expectedOrder = {2, 4, 1, 3, 0, 5, 6};
+	BOOST_CHECK_EQUAL_COLLECTIONS(seen.begin(), seen.end(),
+		expectedOrder.begin(), expectedOrder.end());
+}
+
+BOOST_AUTO_TEST_CASE(read_ranges_large)
+{
+	BOOST_TEST_MESSAGE("Ranges larger than the read size arrive in pieces");
+
+	std::string content;
+	for (int i = 0; i < 10000; i++) content += (char)(i * 7);
+	stream::input_string src(content);
+
+	std::vector<stream::read_range> ranges = {{100, 5000}, {5050, 10}};
+	std::vector<std::string> got(ranges.size());
+	unsigned int calls = 0;
+	stream::read_ranges(src, ranges.data(), ranges.size(),
+		[&](std::size_t index, stream::len offset, const uint8_t *data,
+			stream::len len) {
+			BOOST_REQUIRE_EQUAL(offset, got[index].length());
+			BOOST_REQUIRE_LE(len, 1024);
+			got[index].append((const char *)data, len);
+			calls++;
+		}, 100, 1024);
+
+	BOOST_CHECK(got[0] == content.substr(100, 5000));
+	BOOST_CHECK(got[1] == content.substr(5050, 10));
+	BOOST_CHECK_EQUAL(calls, 6);
+}
+
+BOOST_AUTO_TEST_SUITE_END() // stream_range_suite
@@ -0,0 +1,259 @@
+/**
+ * @file   test-stream_cached.cpp
+ * @brief  Test code for the block cache stream.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory>
+#include <boost/test/unit_test.hpp>
+#include <camoto/stream_cached.hpp>
+#include <camoto/stream_string.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+/// String stream that keeps track of how often it is accessed.
+class counting_parent: public stream::string
+{
+	public:
+		counting_parent(std::string content)
+			:	stream::string_core(content),
+				numReads(0),
+				numWrites(0)
+		{
+		}
+
+		// try_read() also ends up here
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len)
+		{
+			this->numReads++;
+			return this->stream::string::try_read_at(pos, buffer, len);
+		}
+
+		// try_write() also ends up here
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len)
+		{
+			this->numWrites++;
+			return this->stream::string::try_write_at(pos, buffer, len);
+		}
+
+		unsigned int numReads;
+		unsigned int numWrites;
+};
+
+struct stream_cached_sample: public default_sample {
+
+	std::string content;
+	std::shared_ptr<counting_parent> base;
+
+	stream_cached_sample()
+	{
+		for (int i = 0; i < 1000; i++) this->content += (char)('A' + (i % 26));
+		this->base = std::make_shared<counting_parent>(this->content);
+	}
+
+	boost::test_tools::predicate_result is_equal(const std::string& strExpected)
+	{
+		return this->default_sample::is_equal(strExpected, this->base->data);
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(stream_cached_suite, stream_cached_sample)
+
+BOOST_AUTO_TEST_CASE(read_small)
+{
+	BOOST_TEST_MESSAGE("Many small reads only hit the parent once per block");
+
+	stream::input_cached c(this->base, 100, 4, 1);
+	BOOST_REQUIRE_EQUAL(c.size(), this->content.length());
+
+	std::string got;
+	for (int i = 0; i < 250; i++) got += c.read(2);
+	BOOST_CHECK_MESSAGE(default_sample::is_equal(this->content.substr(0, 500),
+		got), "Reading through cache returned wrong data");
+	BOOST_CHECK_EQUAL(this->base->numReads, 5);
+
+	// Go back to a block that is still cached
+	c.seekg(420, stream::start);
+	BOOST_CHECK_EQUAL(c.read(10), this->content.substr(420, 10));
+	BOOST_CHECK_EQUAL(this->base->numReads, 5);
+}
+
+BOOST_AUTO_TEST_CASE(read_ahead)
+{
+	BOOST_TEST_MESSAGE("Sequential reads fetch several blocks at once");
+
+	stream::input_cached c(this->base, 100, 8, 4);
+	std::string got = c.read(1000);
+	BOOST_CHECK_MESSAGE(default_sample::is_equal(this->content, got),
+		"Reading ahead returned wrong data");
+	// 10 blocks, 4 at a time
+	BOOST_CHECK_EQUAL(this->base->numReads, 3);
+
+	// Short read at EOF
+	c.seekg(-5, stream::end);
+	BOOST_CHECK_EQUAL(c.try_read((uint8_t *)&got[0], 10), 5);
+}
+
+BOOST_AUTO_TEST_CASE(read_random)
+{
+	BOOST_TEST_MESSAGE("Random reads with a tiny cache");
+
+	stream::input_cached c(this->base, 16, 3, 2);
+	uint32_t r = 1;
+	auto rnd = [&r](unsigned int max) {
+		return (next_random(r) >> 8) % max;
+	};
+	for (int i = 0; i < 500; i++) {
+		stream::pos pos = rnd(this->content.length());
+		stream::len len = std::min<stream::len>(1 + rnd(40),
+			this->content.length() - pos);
+		std::string got(len, '\0');
+		BOOST_REQUIRE_EQUAL(c.try_read_at(pos, (uint8_t *)&got[0], len), len);
+		BOOST_REQUIRE_EQUAL(got, this->content.substr(pos, len));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(write_back)
+{
+	BOOST_TEST_MESSAGE("Writes reach the parent on flush");
+
+	stream::cached c(this->base, 100, 4, 1);
+	c.seekp(10, stream::start);
+	for (int i = 0; i < 20; i++) c.write("0123456789");
+	this->content.replace(10, 200, std::string(
+		"01234567890123456789012345678901234567890123456789"
+		"01234567890123456789012345678901234567890123456789"
+		"01234567890123456789012345678901234567890123456789"
+		"01234567890123456789012345678901234567890123456789"));
+	BOOST_CHECK_EQUAL(this->base->numWrites, 0);
+
+	c.seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(c.read(30), this->content.substr(0, 30));
+
+	c.flush();
+	BOOST_CHECK_EQUAL(this->base->numWrites, 3);
+	BOOST_CHECK_MESSAGE(is_equal(this->content),
+		"Flushing cached writes failed");
+}
+
+BOOST_AUTO_TEST_CASE(write_random)
+{
+	BOOST_TEST_MESSAGE("Random writes with a tiny cache, extending the parent");
+
+	stream::cached c(this->base, 16, 3, 2);
+	uint32_t r = 1;
+	auto rnd = [&r](unsigned int max) {
+		return (next_random(r) >> 8) % max;
+	};
+	for (int i = 0; i < 500; i++) {
+		stream::pos pos = rnd(this->content.length() + 1);
+		if (rnd(2)) {
+			std::string block(1 + rnd(40), 'a' + (i % 26));
+			c.seekp(pos, stream::start);
+			c.write(block);
+			this->content.replace(pos, block.length(), block);
+		} else {
+			stream::len len = std::min<stream::len>(1 + rnd(40),
+				this->content.length() - pos);
+			std::string got(len, '\0');
+			c.seekg(pos, stream::start);
+			BOOST_REQUIRE_EQUAL(c.try_read((uint8_t *)&got[0], len), len);
+			BOOST_REQUIRE_EQUAL(got, this->content.substr(pos, len));
+		}
+		BOOST_REQUIRE_EQUAL(c.size(), this->content.length());
+	}
+	c.flush();
+	BOOST_CHECK_MESSAGE(is_equal(this->content),
+		"Flushing random writes failed");
+}
+
+BOOST_AUTO_TEST_CASE(write_extend)
+{
+	BOOST_TEST_MESSAGE("Blocks past the end are written back in order");
+
+	stream::cached c(this->base, 100, 8, 1);
+	c.seekp(0, stream::end);
+	std::string extra(350, 'x');
+	c.write(extra);
+	this->content += extra;
+	BOOST_CHECK_EQUAL(c.size(), this->content.length());
+	BOOST_CHECK_EQUAL(this->base->data.length(), 1000);
+
+	// Filling the cache with other blocks forces the dirty ones out.
+	c.seekg(0, stream::start);
+	c.read(800);
+	BOOST_CHECK_EQUAL(this->base->data.length(), this->content.length());
+
+	c.flush();
+	BOOST_CHECK_MESSAGE(is_equal(this->content),
+		"Extending the parent through the cache failed");
+}
+
+BOOST_AUTO_TEST_CASE(truncate)
+{
+	BOOST_TEST_MESSAGE("Truncate writes back and shrinks the parent");
+
+	stream::cached c(this->base, 100, 4, 1);
+	c.seekp(190, stream::start);
+	c.write("0123456789");
+	c.truncate(195);
+	BOOST_CHECK_EQUAL(c.size(), 195);
+	BOOST_CHECK_EQUAL(c.tellp(), 195);
+	c.flush();
+	this->content.replace(190, 10, "0123456789");
+	this->content.resize(195);
+	BOOST_CHECK_MESSAGE(is_equal(this->content),
+		"Truncating through the cache failed");
+
+	c.seekg(185, stream::start);
+	BOOST_CHECK_EQUAL(c.read(10), this->content.substr(185, 10));
+}
+
+BOOST_AUTO_TEST_CASE(async_read)
+{
+	BOOST_TEST_MESSAGE("Background reads use the cache or go to the parent");
+
+	stream::cached c(this->base, 100, 4, 1);
+	uint8_t buf[50];
+
+	// Nothing cached, so it goes straight to the parent
+	BOOST_REQUIRE_EQUAL(c.async_read_at(420, buf, 50).get(), 50);
+	BOOST_CHECK_EQUAL(std::string((char *)buf, 50), this->content.substr(420, 50));
+	BOOST_CHECK_EQUAL(this->base->numReads, 1);
+
+	// Cached, so the parent isn't needed
+	c.seekg(100, stream::start);
+	c.read(10);
+	BOOST_CHECK_EQUAL(this->base->numReads, 2);
+	BOOST_REQUIRE_EQUAL(c.async_read_at(120, buf, 50).get(), 50);
+	BOOST_CHECK_EQUAL(std::string((char *)buf, 50), this->content.substr(120, 50));
+	BOOST_CHECK_EQUAL(this->base->numReads, 2);
+
+	// Changes not yet written back are seen
+	c.seekp(600, stream::start);
+	c.write("changed");
+	BOOST_REQUIRE_EQUAL(c.async_read_at(595, buf, 20).get(), 20);
+	BOOST_CHECK_EQUAL(std::string((char *)buf, 20),
+		this->content.substr(595, 5) + "changed" + this->content.substr(607, 8));
+
+	BOOST_CHECK_EQUAL(c.async_read_at(1000, buf, 20).get(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -19,10 +19,12 @@
  */
 
 #include <memory>
+#include <iomanip>
 #include <iostream>
 #include <errno.h>
 #include <boost/test/unit_test.hpp>
 #include <camoto/stream_file.hpp>
+#include <camoto/util.hpp>
 #include "tests.hpp"
 
 #ifdef _WIN32
@@ -145,4 +147,272 @@ BOOST_AUTO_TEST_CASE(expand)
 	f.reset();
 }
 
+BOOST_AUTO_TEST_CASE(view)
+{
+	BOOST_TEST_MESSAGE("View file data through a copy");
+
+	{
+		stream::output_file out(TEST_FILE, true);
+		out.write("abcdefghij");
+		out.flush();
+	}
+
+	stream::input_file in(TEST_FILE);
+	in.seekg(3, stream::start);
+
+	stream::len got = 0;
+	std::string scratch;
+	const uint8_t *p = in.view(6, 10, &got, scratch);
+	BOOST_REQUIRE_EQUAL(got, 4);
+	BOOST_CHECK_MESSAGE(is_equal("ghij", std::string((const char *)p, got)),
+		"Error viewing file data");
+
+	// Read pointer must not have moved
+	BOOST_REQUIRE_EQUAL(in.tellg(), 3);
+	BOOST_CHECK_MESSAGE(is_equal("def", in.read(3)),
+		"Error reading file data after view");
+}
+
+BOOST_AUTO_TEST_CASE(copy_file)
+{
+	BOOST_TEST_MESSAGE("Copy between files");
+
+	constexpr auto TEST_FILE2 = "_test2.$";
+	{
+		stream::file src(TEST_FILE, true);
+		for (int i = 0; i < 1000; i++) src.write("0123456789");
+		src.seekg(5, stream::start);
+
+		stream::output_file dest(TEST_FILE2, true);
+		// Leave some data in the stdio buffer to make sure it's written first
+		dest.write("abc");
+
+		uint8_t buffer[7];
+		stream::copy(dest, src, buffer, sizeof(buffer));
+		BOOST_CHECK_EQUAL(src.tellg(), 10000);
+		BOOST_CHECK_EQUAL(dest.tellp(), 3 + 9995);
+
+		// Make sure the write pointer ended up in the right place
+		dest.write("xyz");
+		dest.flush();
+	}
+
+	stream::input_file in(TEST_FILE2);
+	BOOST_REQUIRE_EQUAL(in.size(), 3 + 9995 + 3);
+	BOOST_CHECK_MESSAGE(is_equal("abc56789012", in.read(11)),
+		"Error copying start of file");
+	in.seekg(-8, stream::end);
+	BOOST_CHECK_MESSAGE(is_equal("56789xyz", in.read(8)),
+		"Error copying end of file");
+
+	unlink(TEST_FILE2);
+}
+
+BOOST_AUTO_TEST_CASE(reserve)
+{
+	BOOST_TEST_MESSAGE("Reserve space without changing the file");
+
+	{
+		stream::file f(TEST_FILE, true);
+		f.write("hello");
+		f.reserve(1024 * 1024);
+		BOOST_CHECK_EQUAL(f.size(), 5);
+		f.write("world");
+		// Smaller than the file, nothing to do
+		f.reserve(2);
+		BOOST_CHECK_EQUAL(f.size(), 10);
+	}
+
+	stream::input_file in(TEST_FILE);
+	BOOST_CHECK_EQUAL(in.size(), 10);
+	BOOST_CHECK_EQUAL(in.read(10), "helloworld");
+}
+
+BOOST_AUTO_TEST_CASE(move_file)
+{
+	BOOST_TEST_MESSAGE("Move overlapping data within a file");
+
+	stream::file f(TEST_FILE, true);
+	f.write("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+
+	uint8_t buffer[3];
+	stream::move(f, 5, 15, 10, buffer, sizeof(buffer));
+	stream::move(f, 2, 0, 20, buffer, sizeof(buffer));
+
+	f.seekg(0, stream::start);
+	BOOST_CHECK_MESSAGE(is_equal("CDEFGHIJKLMNOFGHIJKLKLM", f.read(23)),
+		"Error moving data within file");
+}
+
+BOOST_AUTO_TEST_CASE(positional)
+{
+	BOOST_TEST_MESSAGE("Mix positional and buffered access to a file");
+
+	stream::file f(TEST_FILE, true);
+	f.write("ABCDEFGHIJ");
+
+	// The positional read must see the data still in the stdio buffer
+	uint8_t buf[4];
+	BOOST_REQUIRE_EQUAL(f.try_read_at(6, buf, sizeof(buf)), 4);
+	BOOST_CHECK_MESSAGE(is_equal("GHIJ", std::string((char *)buf, 4)),
+		"Positional read after buffered write failed");
+	BOOST_CHECK_EQUAL(f.try_read_at(10, buf, sizeof(buf)), 0);
+
+	// Fill the stdio read buffer, then overwrite part of it directly
+	f.seekg(0, stream::start);
+	BOOST_CHECK_MESSAGE(is_equal("AB", f.read(2)),
+		"Buffered read failed");
+	BOOST_REQUIRE_EQUAL(f.try_write_at(2, (const uint8_t *)"12", 2), 2);
+	BOOST_CHECK_EQUAL(f.tellg(), 2);
+	BOOST_CHECK_MESSAGE(is_equal("12EF", f.read(4)),
+		"Buffered read after positional write failed");
+
+	// Seeking back within the buffer mustn't bring back the old data either
+	BOOST_REQUIRE_EQUAL(f.try_write_at(0, (const uint8_t *)"34", 2), 2);
+	f.seekg(0, stream::start);
+	BOOST_CHECK_MESSAGE(is_equal("3412", f.read(4)),
+		"Buffered read after positional write and seek failed");
+}
+
+BOOST_AUTO_TEST_CASE(size_cache)
+{
+	BOOST_TEST_MESSAGE("Cached file size follows writes and truncation");
+
+	stream::file f(TEST_FILE, true);
+	f.write("ABCDEFGHIJ");
+	BOOST_CHECK_EQUAL(f.size(), 10);
+	BOOST_CHECK_EQUAL(f.size(), 10);
+
+	f.write("KLM");
+	BOOST_CHECK_EQUAL(f.size(), 13);
+
+	BOOST_REQUIRE_EQUAL(f.try_write_at(13, (const uint8_t *)"NO", 2), 2);
+	BOOST_CHECK_EQUAL(f.size(), 15);
+
+	f.truncate(4);
+	BOOST_CHECK_EQUAL(f.size(), 4);
+}
+
+BOOST_AUTO_TEST_CASE(sequential_hint)
+{
+	BOOST_TEST_MESSAGE("Access hints and buffer sizes don't change the data");
+
+	std::string content;
+	for (int i = 0; i < 100000; i++) content += (char)('A' + (i % 26));
+	{
+		stream::output_file out(TEST_FILE, true, 0);
+		out.write(content);
+		out.flush();
+	}
+
+	for (stream::len lenBuffer : {0, 1000, FILE_BUFFER_SIZE}) {
+		for (auto pattern : {stream::access_pattern::normal,
+			stream::access_pattern::sequential, stream::access_pattern::random}
+		) {
+			stream::input_file in(TEST_FILE, lenBuffer);
+			in.hint(pattern);
+			BOOST_REQUIRE_EQUAL(in.size(), content.length());
+
+			// Small reads one after the other, then the same again in place
+			std::string got;
+			for (int i = 0; i < 1000; i++) got += in.read(100);
+			BOOST_CHECK_MESSAGE(is_equal(content, got),
+				"Sequential read with buffer size " << lenBuffer << " failed");
+
+			got.clear();
+			uint8_t buf[100];
+			for (stream::pos p = 0; p < content.length(); p += sizeof(buf)) {
+				stream::len r = in.try_read_at(p, buf, sizeof(buf));
+				got.append((char *)buf, r);
+			}
+			BOOST_CHECK_MESSAGE(is_equal(content, got),
+				"Positional read with buffer size " << lenBuffer << " failed");
+
+			in.seekg(50000, stream::start);
+			BOOST_CHECK_EQUAL(in.read(5), content.substr(50000, 5));
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(mixed_access)
+{
+	BOOST_TEST_MESSAGE("Interleaved reads and writes see each other's data");
+
+	std::string expected(10000, '.');
+	stream::file f(TEST_FILE, true, 64);
+	f.write(expected);
+
+	for (int i = 0; i < 200; i++) {
+		stream::pos p = (i * 7919) % 9990;
+		std::string w = createString(std::setw(4) << std::setfill('0') << i);
+		switch (i % 3) {
+			case 0:
+				f.seekp(p, stream::start);
+				f.write(w);
+				break;
+			case 1:
+				f.try_write_at(p, (const uint8_t *)w.data(), w.length());
+				break;
+			default:
+				// Write a large block that bypasses the buffer
+				w = std::string(200, 'a' + (i % 26));
+				p %= 9800;
+				f.seekp(p, stream::start);
+				f.write(w);
+				break;
+		}
+		expected.replace(p, w.length(), w);
+
+		stream::pos q = (i * 104729) % 9900;
+		f.seekg(q, stream::start);
+		BOOST_REQUIRE_MESSAGE(f.read(100) == expected.substr(q, 100),
+			"Read after write " << i << " returned the wrong data");
+
+		uint8_t buf[50];
+		BOOST_REQUIRE_EQUAL(f.try_read_at(p, buf, sizeof(buf)), sizeof(buf));
+		BOOST_REQUIRE_MESSAGE(
+			std::string((char *)buf, sizeof(buf)) == expected.substr(p, 50),
+			"Positional read after write " << i << " returned the wrong data");
+	}
+	f.flush();
+
+	stream::input_file check(TEST_FILE, 0);
+	BOOST_CHECK(is_equal(expected, check.read(check.size())));
+}
+
+BOOST_AUTO_TEST_CASE(async_read)
+{
+	BOOST_TEST_MESSAGE("Many background reads from a file at once");
+
+	std::string content;
+	for (int i = 0; i < 200000; i++) content += (char)(i * 31 + (i >> 10));
+	{
+		stream::output_file out(TEST_FILE, true);
+		out.write(content);
+	}
+
+	stream::input_file in(TEST_FILE);
+	const int count = 1000;
+	std::vector<std::vector<uint8_t>> bufs(count);
+	std::vector<std::future<stream::len>> reads;
+	std::vector<stream::pos> starts;
+	for (int i = 0; i < count; i++) {
+		stream::pos pos = (i * 7919) % content.length();
+		bufs[i].resize(500);
+		starts.push_back(pos);
+		reads.push_back(in.async_read_at(pos, bufs[i].data(), bufs[i].size()));
+	}
+	for (int i = 0; i < count; i++) {
+		stream::len r = reads[i].get();
+		stream::len expected = std::min<stream::len>(500,
+			content.length() - starts[i]);
+		BOOST_REQUIRE_EQUAL(r, expected);
+		BOOST_REQUIRE_MESSAGE(memcmp(bufs[i].data(), &content[starts[i]], r) == 0,
+			"Background read " << i << " returned the wrong data");
+	}
+
+	uint8_t buf[10];
+	BOOST_CHECK_EQUAL(in.async_read_at(content.length(), buf, 10).get(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
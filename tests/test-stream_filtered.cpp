@@ -19,16 +19,45 @@
  */
 
 #include <functional>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include <boost/test/unit_test.hpp>
 #include <boost/algorithm/string.hpp> // for case-insensitive string compare
 #include <camoto/stream.hpp>
 #include <camoto/stream_string.hpp>
 #include <camoto/stream_filtered.hpp>
+#include <camoto/stream_file.hpp>
 #include <camoto/filter-dummy.hpp>
+#include <camoto/filter-lzss.hpp>
+#include <camoto/filter-lzw.hpp>
+#include <camoto/filter-pad.hpp>
 #include "tests.hpp"
 
 using namespace camoto;
 
+/// String stream that counts how many bytes are read from it.
+class counting_input: public stream::string
+{
+	public:
+		counting_input(std::string content)
+			:	stream::string_core(std::move(content)),
+				lenRead(0)
+		{
+		}
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len)
+		{
+			stream::len r = this->stream::string::try_read(buffer, len);
+			this->lenRead += r;
+			return r;
+		}
+
+		stream::len lenRead;
+};
+
 BOOST_FIXTURE_TEST_SUITE(stream_filtered_suite, string_sample)
 
 BOOST_AUTO_TEST_CASE(stream_filtered_read)
@@ -188,4 +217,376 @@ BOOST_AUTO_TEST_CASE(double_stream_filtered_write)
 		"Write to double stream_filtered failed");
 }
 
+BOOST_AUTO_TEST_CASE(stream_filtered_view)
+{
+	BOOST_TEST_MESSAGE("View data in stream_filtered");
+
+	*this->in << "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+	auto algo = std::make_shared<filter_dummy>();
+	auto f = std::make_shared<stream::input_filtered>(this->in, algo);
+
+	stream::len got = 0;
+	std::string scratch;
+	const uint8_t *p = f->view(20, 10, &got, scratch);
+	BOOST_REQUIRE_EQUAL(got, 6);
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal("UVWXYZ", std::string((const char *)p, got)),
+		"View of stream_filtered data failed");
+	BOOST_REQUIRE_EQUAL(f->tellg(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_read_at)
+{
+	BOOST_TEST_MESSAGE("Positional read from stream_filtered");
+
+	*this->in << "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+	auto algo = std::make_shared<filter_dummy>();
+	auto f = std::make_shared<stream::input_filtered>(this->in, algo);
+
+	// This must run the filter first, as it's the first access
+	uint8_t buf[10];
+	BOOST_REQUIRE_EQUAL(f->try_read_at(20, buf, sizeof(buf)), 6);
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal("UVWXYZ", std::string((const char *)buf, 6)),
+		"Positional read of stream_filtered data failed");
+	BOOST_REQUIRE_EQUAL(f->tellg(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_streaming_read)
+{
+	BOOST_TEST_MESSAGE("Read from streaming filtered stream");
+
+	std::string content;
+	for (int i = 0; i < 20000; i++) content += (char)('A' + (i % 26));
+	*this->in << content;
+
+	auto algo = std::make_shared<filter_dummy>();
+	auto f = std::make_shared<stream::input_filtered_streaming>(this->in, algo);
+
+	// Only the start of the parent should have been read
+	BOOST_REQUIRE_EQUAL(f->read(5), "ABCDE");
+	BOOST_REQUIRE_LT(this->in->tellg(), 10000);
+
+	// Forward seek
+	f->seekg(10000, stream::cur);
+	BOOST_REQUIRE_EQUAL(f->tellg(), 10005);
+	BOOST_REQUIRE_EQUAL(f->read(3), content.substr(10005, 3));
+
+	// Backward seek, restarts the filter
+	f->seekg(26, stream::start);
+	BOOST_REQUIRE_EQUAL(f->read(2), "AB");
+
+	// Large read straight into caller's buffer
+	f->seekg(0, stream::start);
+	stream::copy(this->out, *f);
+	BOOST_CHECK_MESSAGE(is_equal(content),
+		"Read from streaming filtered stream failed");
+	BOOST_REQUIRE_EQUAL(f->tellg(), 20000);
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_streaming_size)
+{
+	BOOST_TEST_MESSAGE("Get size of streaming filtered stream");
+
+	std::string content;
+	for (int i = 0; i < 10000; i++) content += (char)('a' + (i % 26));
+	*this->in << content;
+
+	auto algo = std::make_shared<filter_dummy>();
+	auto f = std::make_shared<stream::input_filtered_streaming>(this->in, algo);
+
+	f->seekg(100, stream::start);
+	BOOST_REQUIRE_EQUAL(f->size(), 10000);
+	BOOST_REQUIRE_EQUAL(f->tellg(), 100);
+	BOOST_REQUIRE_EQUAL(f->read(4), content.substr(100, 4));
+
+	f->seekg(-3, stream::end);
+	BOOST_REQUIRE_EQUAL(f->read(3), content.substr(9997, 3));
+
+	BOOST_CHECK_THROW(
+		f->seekg(1, stream::cur),
+		stream::seek_error
+	);
+
+	// With a known size nothing needs to be decoded
+	this->in->seekg(0, stream::start);
+	auto g = std::make_shared<stream::input_filtered_streaming>(this->in, algo,
+		10000);
+	BOOST_REQUIRE_EQUAL(g->size(), 10000);
+	BOOST_REQUIRE_EQUAL(this->in->tellg(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_streaming_copy)
+{
+	BOOST_TEST_MESSAGE("Copy streaming filtered stream of unknown size");
+
+	std::string content = sample_text(50000);
+	auto parent = std::make_shared<counting_input>(content);
+
+	auto algo = std::make_shared<filter_dummy>();
+	auto f = std::make_shared<stream::input_filtered_streaming>(parent, algo);
+	BOOST_CHECK_EQUAL(f->size_hint(), 0);
+
+	// The data should only be decoded once, not again to find the size
+	stream::copy(this->out, *f);
+	BOOST_CHECK_MESSAGE(is_equal(content),
+		"Copy of streaming filtered stream failed");
+	BOOST_CHECK_EQUAL(parent->lenRead, content.length());
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_streaming_view)
+{
+	BOOST_TEST_MESSAGE("View data in streaming filtered stream");
+
+	std::string content = sample_text(50000);
+	auto parent = std::make_shared<counting_input>(content);
+
+	auto algo = std::make_shared<filter_dummy>();
+	auto f = std::make_shared<stream::input_filtered_streaming>(parent, algo);
+
+	// A view larger than the window, starting at the read position
+	BOOST_REQUIRE_EQUAL(f->read(5), content.substr(0, 5));
+	stream::len got = 0;
+	std::string scratch;
+	const uint8_t *p = f->view(5, 20000, &got, scratch);
+	BOOST_REQUIRE_EQUAL(got, 20000);
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal(content.substr(5, 20000),
+			std::string((const char *)p, got)),
+		"View of streaming filtered data failed");
+	BOOST_REQUIRE_EQUAL(f->tellg(), 5);
+
+	// Reading and seeking within the view doesn't restart the filter
+	f->seekg(15000, stream::start);
+	BOOST_REQUIRE_EQUAL(f->read(10), content.substr(15000, 10));
+	p = f->view(15010, 20000, &got, scratch);
+	BOOST_REQUIRE_EQUAL(got, 20000);
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal(content.substr(15010, 20000),
+			std::string((const char *)p, got)),
+		"Second view of streaming filtered data failed");
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal(content.substr(15010),
+			f->read(content.length() - 15010)),
+		"Read after view of streaming filtered data failed");
+	BOOST_CHECK_EQUAL(parent->lenRead, content.length());
+
+	// A view ahead of the decoded data, then reading from before it
+	f->seekg(100, stream::start);
+	p = f->view(40000, 20000, &got, scratch);
+	BOOST_REQUIRE_EQUAL(got, 10000);
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal(content.substr(40000),
+			std::string((const char *)p, got)),
+		"View ahead of streaming filtered data failed");
+	BOOST_REQUIRE_EQUAL(f->tellg(), 100);
+	BOOST_REQUIRE_EQUAL(f->read(10), content.substr(100, 10));
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_streaming_write)
+{
+	BOOST_TEST_MESSAGE("Write to streaming filtered stream");
+
+	std::string content;
+	for (int i = 0; i < 20000; i++) content += (char)('A' + (i % 26));
+	this->in->data = "existing data to be replaced";
+
+	stream::len lenNotified = 0;
+	auto algo = std::make_shared<filter_dummy>();
+	auto f = std::make_shared<stream::output_filtered_streaming>(this->in, algo,
+		[&lenNotified](stream::output_filtered *filt, stream::len len) {
+			BOOST_CHECK(filt == nullptr);
+			lenNotified = len;
+		}
+	);
+
+	for (unsigned int i = 0; i < content.length(); i += 1000) {
+		f->write(content.substr(i, 1000));
+	}
+	BOOST_REQUIRE_EQUAL(f->tellp(), 20000);
+
+	// Most of the data should already have reached the parent
+	BOOST_REQUIRE_GT(this->in->data.length(), 16000);
+
+	// Only the current position is allowed
+	f->seekp(0, stream::cur);
+	f->seekp(20000, stream::start);
+	BOOST_CHECK_THROW(
+		f->seekp(-1, stream::cur),
+		stream::seek_error
+	);
+
+	f->flush();
+	BOOST_CHECK_EQUAL(lenNotified, 20000);
+	BOOST_CHECK_MESSAGE(default_sample::is_equal(content, this->in->data),
+		"Write to streaming filtered stream failed");
+
+	BOOST_CHECK_THROW(
+		f->write("more"),
+		stream::write_error
+	);
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_streaming_write_truncate)
+{
+	BOOST_TEST_MESSAGE("Streaming filtered write cuts off old data");
+
+	this->in->data = "existing data to be replaced";
+	auto algo = std::make_shared<filter_dummy>();
+	stream::output_filtered_streaming f(this->in, algo, nullptr);
+	f.write("new");
+	f.flush();
+	BOOST_CHECK_MESSAGE(default_sample::is_equal("new", this->in->data),
+		"Streaming filtered write didn't truncate the parent");
+}
+
+#ifndef _WIN32
+BOOST_AUTO_TEST_CASE(stream_filtered_streaming_write_pipe)
+{
+	BOOST_TEST_MESSAGE("Streaming filtered write to a pipe");
+
+	constexpr auto TEST_FIFO = "_test_fifo.$";
+	unlink(TEST_FIFO);
+	BOOST_REQUIRE_EQUAL(mkfifo(TEST_FIFO, 0600), 0);
+	int fdRead = open(TEST_FIFO, O_RDONLY | O_NONBLOCK);
+	BOOST_REQUIRE_GE(fdRead, 0);
+
+	stream::len lenNotified = 0;
+	{
+		auto out = std::make_shared<stream::output_file>(TEST_FIFO, false);
+		auto algo = std::make_shared<filter_dummy>();
+		stream::output_filtered_streaming f(out, algo,
+			[&lenNotified](stream::output_filtered *filt, stream::len len) {
+				lenNotified = len;
+			}
+		);
+		f.write("hello");
+		// A pipe can't be truncated, which mustn't stop the flush
+		BOOST_CHECK_NO_THROW(f.flush());
+	}
+	BOOST_CHECK_EQUAL(lenNotified, 5);
+
+	char buf[16];
+	ssize_t r = ::read(fdRead, buf, sizeof(buf));
+	close(fdRead);
+	unlink(TEST_FIFO);
+	BOOST_REQUIRE_EQUAL(r, 5);
+	BOOST_CHECK_EQUAL(std::string(buf, r), "hello");
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(stream_filtered_streaming_checkpoints)
+{
+	BOOST_TEST_MESSAGE("Seek in streaming filtered stream using checkpoints");
+
+	std::string content = sample_text(200000);
+
+	std::vector<std::pair<std::shared_ptr<filter>, std::function<std::shared_ptr<filter>()>>> algos;
+	algos.emplace_back(
+		std::make_shared<filter_lzw_compress>(9, 12, 0x101, 0x100, 0,
+			LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT),
+		[]() {
+			return std::make_shared<filter_lzw_decompress>(9, 12, 0x101, 0x100, 0,
+				LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT);
+		}
+	);
+	algos.emplace_back(
+		std::make_shared<filter_lzss_compress>(bitstream::littleEndian, 4, 12,
+			filter_lzss_compress::Effort::Greedy),
+		[]() {
+			return std::make_shared<filter_lzss_decompress>(bitstream::littleEndian,
+				4, 12);
+		}
+	);
+
+	for (auto& a : algos) {
+		auto orig = std::make_shared<stream::string>(content);
+		stream::input_filtered comp(orig, a.first);
+		stream::string packed;
+		stream::copy(packed, comp);
+		auto compressed = std::make_shared<counting_input>(packed.data);
+
+		// Decode everything once to fill in the index
+		auto index = std::make_shared<stream::checkpoint_index>(16384);
+		auto f = std::make_shared<stream::input_filtered_streaming>(compressed,
+			a.second());
+		f->set_checkpoints(index);
+		stream::string result;
+		stream::copy(result, *f);
+		BOOST_REQUIRE_MESSAGE(default_sample::is_equal(content, result.data),
+			"Decoding while saving checkpoints failed");
+		BOOST_REQUIRE_GE(index->size(), 10);
+
+		// Seeking backwards shouldn't go all the way back to the start
+		stream::len lenBefore = compressed->lenRead;
+		f->seekg(150000, stream::start);
+		BOOST_REQUIRE_EQUAL(f->read(100), content.substr(150000, 100));
+		BOOST_CHECK_LT(compressed->lenRead - lenBefore, packed.data.length() / 4);
+
+		// Random seeks
+		for (unsigned int pos = 7; pos < content.length(); pos += 37813) {
+			f->seekg(pos, stream::start);
+			BOOST_REQUIRE_EQUAL(f->read(50), content.substr(pos, 50));
+		}
+
+		// A saved index works with a new stream
+		stream::string saved;
+		index->write(saved);
+		auto loaded = std::make_shared<stream::checkpoint_index>(1);
+		saved.seekg(0, stream::start);
+		loaded->read(saved);
+		BOOST_REQUIRE_EQUAL(loaded->size(), index->size());
+		BOOST_REQUIRE_EQUAL(loaded->interval(), 16384);
+
+		compressed->seekg(0, stream::start);
+		lenBefore = compressed->lenRead;
+		auto g = std::make_shared<stream::input_filtered_streaming>(compressed,
+			a.second(), content.length());
+		g->set_checkpoints(loaded);
+		g->seekg(190000, stream::start);
+		BOOST_REQUIRE_EQUAL(g->read(10000), content.substr(190000, 10000));
+		BOOST_CHECK_LT(compressed->lenRead - lenBefore, packed.data.length() / 4);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(stream_filtered_measure)
+{
+	BOOST_TEST_MESSAGE("Measure filtered size without storing the output");
+
+	std::string content = sample_text(100000);
+
+	auto pad = std::make_shared<filter_pad>();
+	pad->pad.write(std::string("header"));
+	std::vector<std::shared_ptr<filter>> algos = {
+		std::make_shared<filter_lzw_compress>(9, 12, 0x101, 0x100, 0,
+			LZW_BIG_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_FULL_DICT),
+		std::make_shared<filter_lzw_compress>(9, 9, 0x102, 0x101, 0x100,
+			LZW_LITTLE_ENDIAN | LZW_EOF_PARAM_VALID | LZW_RESET_PARAM_VALID
+			| LZW_FLUSH_ON_RESET),
+		std::make_shared<filter_lzss_compress>(bitstream::littleEndian, 4, 12,
+			filter_lzss_compress::Effort::Lazy),
+		std::make_shared<filter_lzss_compress>(bitstream::bigEndian, 4, 12,
+			filter_lzss_compress::Effort::Optimal),
+		pad,
+		// Uses the default measure()
+		std::make_shared<filter_dummy>(),
+	};
+
+	for (auto& a : algos) {
+		stream::string src(content);
+		stream::len lenMeasured = stream::filtered_size(*a, src);
+
+		auto written = std::make_shared<stream::string>();
+		stream::output_filtered out(written, a, stream::fn_notify_prefiltered_size());
+		out.write(content);
+		BOOST_CHECK_EQUAL(out.filtered_size(), lenMeasured);
+
+		// Measuring must not stop the data from being written afterwards
+		out.flush();
+		BOOST_CHECK_EQUAL(written->data.length(), lenMeasured);
+	}
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,232 @@
+/**
+ * @file   test-stream_mmap.cpp
+ * @brief  Test code for memory-mapped file stream class.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <memory>
+#include <iostream>
+#include <errno.h>
+#include <string.h>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/stream_mmap.hpp>
+#include "tests.hpp"
+
+#ifdef _WIN32
+#define unlink(x) _unlink(x)
+#endif
+
+#ifdef __linux__
+#include <fstream>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+using namespace camoto;
+
+constexpr auto TEST_MMAP_FILE = "_test_mmap.$";
+
+struct mmap_sample: public default_sample
+{
+	mmap_sample()
+	{
+		stream::output_file out(TEST_MMAP_FILE, true);
+		out.write("abcdefghijklmno");
+		out.flush();
+	}
+
+	~mmap_sample()
+	{
+		if (unlink(TEST_MMAP_FILE) < 0) {
+			std::cerr << "Could not remove test file \"" << TEST_MMAP_FILE << "\": "
+				<< strerror(errno) << std::endl;
+		}
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(stream_mmap_suite, mmap_sample)
+
+BOOST_AUTO_TEST_CASE(read)
+{
+	BOOST_TEST_MESSAGE("Read mapped file");
+
+	stream::input_mmap in(TEST_MMAP_FILE);
+	BOOST_REQUIRE_EQUAL(in.size(), 15);
+
+	std::string val;
+	in.seekg(4, stream::start);
+	BOOST_REQUIRE_NO_THROW(
+		val = in.read(5);
+	);
+	BOOST_CHECK_MESSAGE(is_equal("efghi", val),
+		"Error reading data from mapped file");
+	BOOST_REQUIRE_EQUAL(in.tellg(), 9);
+
+	uint8_t buf[10];
+	BOOST_REQUIRE_EQUAL(in.try_read(buf, sizeof(buf)), 6);
+	BOOST_REQUIRE_EQUAL(in.try_read(buf, sizeof(buf)), 0);
+
+	BOOST_CHECK_THROW(
+		in.seekg(1, stream::cur),
+		stream::seek_error
+	);
+}
+
+BOOST_AUTO_TEST_CASE(read_data)
+{
+	BOOST_TEST_MESSAGE("Access mapped file content directly");
+
+	stream::input_mmap in(TEST_MMAP_FILE);
+	const uint8_t *p = in.data();
+	BOOST_REQUIRE(p != NULL);
+	BOOST_CHECK_MESSAGE(
+		is_equal("abcdefghijklmno", std::string((const char *)p, in.size())),
+		"Error accessing data directly from mapped file");
+
+	stream::len got = 0;
+	std::string scratch;
+	BOOST_CHECK(in.view(10, 10, &got, scratch) == p + 10);
+	BOOST_REQUIRE_EQUAL(got, 5);
+}
+
+BOOST_AUTO_TEST_CASE(open_missing)
+{
+	BOOST_TEST_MESSAGE("Open missing file");
+
+	BOOST_CHECK_THROW(
+		stream::input_mmap in("_test_mmap_does_not_exist.$"),
+		stream::open_error
+	);
+}
+
+BOOST_AUTO_TEST_CASE(readwrite)
+{
+	BOOST_TEST_MESSAGE("Read+write mapped file");
+
+	{
+		stream::mmap f(TEST_MMAP_FILE, false);
+		f.seekp(4, stream::start);
+		f.write(" is a test");
+		f.data()[0] = 'A';
+
+		std::string val;
+		f.seekg(0, stream::start);
+		BOOST_REQUIRE_NO_THROW(
+			val = f.read(15);
+		);
+		BOOST_CHECK_MESSAGE(is_equal("Abcd is a testo", val),
+			"Error reading back data just written to mapped file");
+		f.flush();
+	}
+
+	stream::input_file in(TEST_MMAP_FILE);
+	BOOST_CHECK_MESSAGE(is_equal("Abcd is a testo", in.read(15)),
+		"Data written to mapped file did not reach the file");
+}
+
+BOOST_AUTO_TEST_CASE(expand)
+{
+	BOOST_TEST_MESSAGE("Expand and truncate mapped file");
+
+	{
+		stream::mmap f(TEST_MMAP_FILE, true);
+		BOOST_REQUIRE_EQUAL(f.size(), 0);
+
+		f.write("1234567890");
+		BOOST_REQUIRE_EQUAL(f.size(), 10);
+
+		f.write("abcde");
+		BOOST_REQUIRE_EQUAL(f.size(), 15);
+
+		f.truncate(8);
+		BOOST_REQUIRE_EQUAL(f.tellp(), 8);
+		f.write("zyx");
+		BOOST_REQUIRE_EQUAL(f.size(), 11);
+	}
+
+	stream::input_file in(TEST_MMAP_FILE);
+	BOOST_REQUIRE_EQUAL(in.size(), 11);
+	BOOST_CHECK_MESSAGE(is_equal("12345678zyx", in.read(11)),
+		"Error reading back expanded mapped file");
+}
+
+BOOST_AUTO_TEST_CASE(expand_append)
+{
+	BOOST_TEST_MESSAGE("Append to mapped file one byte at a time");
+
+	std::string content = sample_text(10000);
+	{
+		stream::mmap f(TEST_MMAP_FILE, true);
+		for (auto c : content) f.write(&c, 1);
+		BOOST_REQUIRE_EQUAL(f.size(), content.length());
+
+		// The file grows ahead of the data rather than being resized and mapped
+		// again for every byte
+		BOOST_CHECK_GT(stream::input_file(TEST_MMAP_FILE).size(),
+			content.length());
+
+		// The extra space is cut off when flushing
+		f.flush();
+		BOOST_REQUIRE_EQUAL(stream::input_file(TEST_MMAP_FILE).size(),
+			content.length());
+
+		f.write("end");
+	}
+
+	// And when closing
+	stream::input_file in(TEST_MMAP_FILE);
+	BOOST_REQUIRE_EQUAL(in.size(), content.length() + 3);
+	BOOST_CHECK_MESSAGE(is_equal(content + "end", in.read(in.size())),
+		"Error reading back appended mapped file");
+}
+
+#ifdef __linux__
+BOOST_AUTO_TEST_CASE(expand_remap_fail)
+{
+	BOOST_TEST_MESSAGE("Write past the end when the file can't be mapped again");
+
+	// Limit the address space so the file can be extended (sparsely) but the
+	// larger mapping fails.
+	stream::len vmPages = 0;
+	std::ifstream("/proc/self/statm") >> vmPages;
+	BOOST_REQUIRE_GT(vmPages, 0);
+	rlim_t limit = vmPages * sysconf(_SC_PAGESIZE) + 16 * 1024 * 1024;
+	std::vector<uint8_t> big(64 * 1024 * 1024, 'x');
+
+	stream::mmap f(TEST_MMAP_FILE, false);
+	f.seekp(0, stream::end);
+
+	struct rlimit orig, lowered;
+	BOOST_REQUIRE_EQUAL(getrlimit(RLIMIT_AS, &orig), 0);
+	lowered = orig;
+	if (lowered.rlim_cur == RLIM_INFINITY || lowered.rlim_cur > limit) {
+		lowered.rlim_cur = limit;
+	}
+	BOOST_REQUIRE_EQUAL(setrlimit(RLIMIT_AS, &lowered), 0);
+	stream::len w = 1;
+	BOOST_CHECK_NO_THROW(
+		w = f.try_write(big.data(), big.size())
+	);
+	setrlimit(RLIMIT_AS, &orig);
+
+	BOOST_CHECK_EQUAL(w, 0);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,191 @@
+/**
+ * @file   test-stream_paged.cpp
+ * @brief  Test code for the paged in-memory stream.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/stream_paged.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+/// Read the whole of a stream into a string.
+static std::string contents(stream::paged& s)
+{
+	s.seekg(0, stream::start);
+	return s.read(s.size());
+}
+
+BOOST_FIXTURE_TEST_SUITE(stream_paged_suite, default_sample)
+
+BOOST_AUTO_TEST_CASE(readwrite)
+{
+	BOOST_TEST_MESSAGE("Read+write paged stream");
+
+	stream::paged f;
+	std::string val;
+
+	f.write("abcdefghij");
+	f.seekp(4, stream::start);
+	f.write("12345");
+	f.seekg(2, stream::start);
+	BOOST_REQUIRE_NO_THROW(
+		val = f.read(5);
+	);
+	BOOST_CHECK_MESSAGE(is_equal("cd123", val),
+		"Error reading back data just written to paged stream");
+
+	BOOST_REQUIRE_EQUAL(f.size(), 10);
+	BOOST_CHECK_MESSAGE(is_equal("abcd12345j", contents(f)),
+		"Error reading paged stream content");
+
+	BOOST_CHECK_THROW(
+		f.seekp(11, stream::start),
+		stream::seek_error
+	);
+}
+
+BOOST_AUTO_TEST_CASE(cross_page)
+{
+	BOOST_TEST_MESSAGE("Read and write across page boundaries");
+
+	std::string content;
+	for (unsigned int i = 0; i < PAGED_PAGE_SIZE * 3; i++) {
+		content += (char)(i * 7);
+	}
+	stream::paged f(content);
+	BOOST_REQUIRE_EQUAL(f.size(), content.length());
+
+	f.seekp(PAGED_PAGE_SIZE - 3, stream::start);
+	f.write("0123456789");
+	content.replace(PAGED_PAGE_SIZE - 3, 10, "0123456789");
+
+	// Grow the stream by writing over the end of the last page
+	f.seekp(0, stream::end);
+	f.write("end");
+	content += "end";
+
+	BOOST_CHECK_MESSAGE(is_equal(content, contents(f)),
+		"Error writing data spanning pages");
+
+	stream::len got;
+	std::string scratch;
+	const uint8_t *p = f.view(PAGED_PAGE_SIZE - 3, 10, &got, scratch);
+	BOOST_REQUIRE_EQUAL(got, 10);
+	BOOST_CHECK_MESSAGE(is_equal("0123456789", std::string((const char *)p, got)),
+		"Error viewing data spanning pages");
+}
+
+BOOST_AUTO_TEST_CASE(snapshot)
+{
+	BOOST_TEST_MESSAGE("Snapshots are unaffected by later writes");
+
+	stream::paged f(std::string(PAGED_PAGE_SIZE * 2, 'a'));
+	auto snap = f.snapshot();
+	BOOST_REQUIRE_EQUAL(snap->size(), f.size());
+
+	f.seekp(PAGED_PAGE_SIZE + 10, stream::start);
+	f.write("hello");
+	f.truncate(PAGED_PAGE_SIZE + 20);
+
+	std::string orig(PAGED_PAGE_SIZE * 2, 'a');
+	BOOST_CHECK_MESSAGE(is_equal(orig, contents(*snap)),
+		"Snapshot changed by write to original stream");
+
+	snap->seekp(0, stream::start);
+	snap->write("snap");
+
+	std::string expected(PAGED_PAGE_SIZE + 20, 'a');
+	expected.replace(PAGED_PAGE_SIZE + 10, 5, "hello");
+	BOOST_CHECK_MESSAGE(is_equal(expected, contents(f)),
+		"Original stream changed by write to snapshot");
+}
+
+BOOST_AUTO_TEST_CASE(shared_pages)
+{
+	BOOST_TEST_MESSAGE("Only pages written to are copied");
+
+	stream::paged f(std::string(PAGED_PAGE_SIZE * 2, 'a'));
+	auto snap = f.snapshot();
+
+	stream::len got;
+	std::string scratch;
+	BOOST_CHECK(f.view(0, 1, &got, scratch) == snap->view(0, 1, &got, scratch));
+	BOOST_CHECK(f.view(PAGED_PAGE_SIZE, 1, &got, scratch)
+		== snap->view(PAGED_PAGE_SIZE, 1, &got, scratch));
+
+	f.seekp(PAGED_PAGE_SIZE, stream::start);
+	f.write("x");
+
+	// First page still shared, second one copied
+	BOOST_CHECK(f.view(0, 1, &got, scratch) == snap->view(0, 1, &got, scratch));
+	BOOST_CHECK(f.view(PAGED_PAGE_SIZE, 1, &got, scratch)
+		!= snap->view(PAGED_PAGE_SIZE, 1, &got, scratch));
+
+	// Once copied, further writes go straight to the page
+	const uint8_t *p = f.view(PAGED_PAGE_SIZE, 1, &got, scratch);
+	f.write("y");
+	BOOST_CHECK(f.view(PAGED_PAGE_SIZE, 1, &got, scratch) == p);
+}
+
+BOOST_AUTO_TEST_CASE(restore)
+{
+	BOOST_TEST_MESSAGE("Go back to an earlier snapshot");
+
+	stream::paged f("1234567890");
+	auto undo = f.snapshot();
+
+	f.seekp(0, stream::end);
+	f.write("abcdef");
+	BOOST_REQUIRE_EQUAL(f.tellp(), 16);
+
+	f.restore(*undo);
+	BOOST_REQUIRE_EQUAL(f.size(), 10);
+	BOOST_REQUIRE_EQUAL(f.tellp(), 10);
+	BOOST_CHECK_MESSAGE(is_equal("1234567890", contents(f)),
+		"Error restoring snapshot");
+
+	// The snapshot can be restored again after further changes
+	f.seekp(2, stream::start);
+	f.write("zz");
+	f.restore(*undo);
+	BOOST_CHECK_MESSAGE(is_equal("1234567890", contents(f)),
+		"Snapshot changed after being restored");
+}
+
+BOOST_AUTO_TEST_CASE(truncate_grow)
+{
+	BOOST_TEST_MESSAGE("Enlarged stream is filled with zeroes");
+
+	stream::paged f("1234567890");
+	f.truncate(4);
+	BOOST_REQUIRE_EQUAL(f.tellp(), 4);
+	f.truncate(8);
+	BOOST_CHECK_MESSAGE(is_equal(makeString("1234\0\0\0\0"), contents(f)),
+		"Old data visible after truncating and enlarging stream");
+
+	f.truncate(PAGED_PAGE_SIZE * 3);
+	stream::len got;
+	std::string scratch;
+	const uint8_t *p = f.view(PAGED_PAGE_SIZE * 2, 4, &got, scratch);
+	BOOST_REQUIRE_EQUAL(got, 4);
+	BOOST_CHECK_MESSAGE(is_equal(makeString("\0\0\0\0"),
+		std::string((const char *)p, got)), "Enlarged stream not zeroed");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,108 @@
+/**
+ * @file   test-stream_reader.cpp
+ * @brief  Test code for the typed stream reader.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/stream_reader.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+BOOST_FIXTURE_TEST_SUITE(stream_reader_suite, default_sample)
+
+BOOST_AUTO_TEST_CASE(read_values)
+{
+	BOOST_TEST_MESSAGE("Read numbers through a reader");
+
+	stream::string s(makeString("\x01\x02\x03\x04\x05\x06\x07\x08\x09"));
+	s.seekg(1, stream::start);
+	{
+		stream::reader<stream::string> r(s);
+		uint16_t a, b;
+		uint32_t c;
+		uint8_t d;
+		r >> u16le(a) >> u16be(b);
+		read_packed(r, u32le(c));
+		BOOST_CHECK_EQUAL(a, 0x0302);
+		BOOST_CHECK_EQUAL(b, 0x0405);
+		BOOST_CHECK_EQUAL(c, 0x09080706);
+		BOOST_CHECK_EQUAL(r.tell(), 9);
+
+		// Stream pointer is only moved once the reader is finished with
+		BOOST_CHECK_EQUAL(s.tellg(), 1);
+
+		BOOST_CHECK_THROW(
+			r >> u8(d),
+			stream::incomplete_read
+		);
+
+		r.seek(2);
+	}
+	BOOST_CHECK_EQUAL(s.tellg(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(no_copy)
+{
+	BOOST_TEST_MESSAGE("Reader uses string data in place");
+
+	stream::string s(std::string(10000, 'a'));
+	stream::reader<stream::string> r(s);
+	r.skip(9000);
+	BOOST_CHECK(r.take(100) == (const uint8_t *)s.data.data() + 9000);
+}
+
+BOOST_AUTO_TEST_CASE(window)
+{
+	BOOST_TEST_MESSAGE("Values crossing from one window to the next");
+
+	std::string content;
+	for (unsigned int i = 0; i < READER_WINDOW_SIZE * 3; i++) {
+		content += (char)i;
+	}
+	stream::string s(content);
+
+	// Going through the base class means the data is viewed a window at a time
+	stream::input& in = s;
+	in.seekg(1, stream::start);
+	stream::reader<stream::input> r(in);
+	std::size_t count = (content.length() - 1) / 4;
+	for (std::size_t i = 0; i < count; i++) {
+		uint32_t v, expected;
+		memcpy(&expected, &content[1 + i * 4], 4);
+		r >> u32le(v);
+		BOOST_REQUIRE_EQUAL(v, le32toh(expected));
+	}
+
+	std::vector<uint16_t> arr;
+	r.seek(READER_WINDOW_SIZE - 2);
+	read_array<uint16_t, little_endian>(r, arr, 1000);
+	BOOST_REQUIRE_EQUAL(arr.size(), 1000);
+	BOOST_CHECK_EQUAL(arr[0], 0xFFFE);
+	BOOST_CHECK_EQUAL(arr[1], 0x0100);
+
+	uint8_t buf[10];
+	r.seek(content.length() - 4);
+	BOOST_CHECK_THROW(
+		r.read(buf, 10),
+		stream::incomplete_read
+	);
+	BOOST_CHECK_EQUAL(r.tell(), content.length());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
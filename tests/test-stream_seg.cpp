@@ -787,4 +787,156 @@ BOOST_AUTO_TEST_CASE(segstream_remove_c08)
 		"Removing middle of second source failed");
 }
 
+BOOST_AUTO_TEST_CASE(segstream_many_edits)
+{
+	BOOST_TEST_MESSAGE("Many inserts, removes and writes before one flush");
+
+	// Apply the same edits to a plain string and make sure the segstream agrees
+	// with it both before and after the flush.
+	std::string expected = *this->baseContent;
+	uint32_t r = 1;
+	auto rnd = [&r](unsigned int max) {
+		return (next_random(r) >> 8) % max;
+	};
+	for (int i = 0; i < 500; i++) {
+		stream::pos pos = rnd(expected.length() + 1);
+		this->seg->seekp(pos, stream::start);
+		switch (rnd(3)) {
+			case 0: {
+				stream::len len = 1 + rnd(8);
+				this->seg->insert(len);
+				std::string block(len, 'a' + (i % 26));
+				this->seg->write(block);
+				expected.insert(pos, block);
+				break;
+			}
+			case 1: {
+				stream::len len = std::min<stream::len>(rnd(6),
+					expected.length() - pos);
+				this->seg->remove(len);
+				expected.erase(pos, len);
+				break;
+			}
+			case 2: {
+				stream::len len = std::min<stream::len>(rnd(6),
+					expected.length() - pos);
+				std::string block(len, '0' + (i % 10));
+				this->seg->write(block);
+				expected.replace(pos, len, block);
+				break;
+			}
+		}
+	}
+
+	BOOST_REQUIRE_EQUAL(this->seg->size(), expected.length());
+	this->seg->seekg(0, stream::start);
+	std::string content(expected.length(), '\0');
+	this->seg->read((uint8_t *)&content[0], content.length());
+	BOOST_CHECK_MESSAGE(this->default_sample::is_equal(expected, content),
+		"Reading back data before flush failed");
+
+	this->seg->seekp(7, stream::start);
+	this->seg->flush();
+
+	BOOST_CHECK_MESSAGE(is_equal(7, expected),
+		"Flushing many edits failed");
+}
+
+/// String stream that keeps track of how much data has been written to it.
+class counting_string: public stream::string
+{
+	public:
+		counting_string(std::string content)
+			:	stream::string_core(content),
+				lenWritten(0)
+		{
+		}
+
+		// try_write() also ends up here
+		virtual stream::len try_write_at(stream::pos pos, const uint8_t *buffer,
+			stream::len len)
+		{
+			stream::len w = this->stream::string::try_write_at(pos, buffer, len);
+			this->lenWritten += w;
+			return w;
+		}
+
+		stream::len lenWritten;
+};
+
+BOOST_AUTO_TEST_CASE(segstream_commit_minimal_io)
+{
+	BOOST_TEST_MESSAGE("Flush only moves each byte once");
+
+	std::string content;
+	for (int i = 0; i < 65536; i++) content += (char)('A' + (i % 26));
+	auto base = std::make_unique<counting_string>(content);
+	auto pbase = base.get();
+	stream::seg s(std::move(base));
+
+	// Several edits near the start, so everything after them has to be moved
+	// along by the combined amount.
+	s.seekp(100, stream::start);
+	s.insert(10);
+	s.write("0123456789");
+	s.seekp(50, stream::start);
+	s.insert(3);
+	s.write("abc");
+	s.seekp(200, stream::start);
+	s.remove(4);
+	s.insert(2);
+	s.write("XY");
+	s.remove(1);
+	content.insert(100, "0123456789");
+	content.insert(50, "abc");
+	content.erase(200, 4);
+	content.insert(200, "XY");
+	content.erase(202, 1);
+
+	s.flush();
+
+	BOOST_CHECK_MESSAGE(this->default_sample::is_equal(content, pbase->data),
+		"Flush with several edits near the start failed");
+
+	// Everything from offset 50 onwards had to be moved or written, but
+	// nothing more than once.
+	BOOST_CHECK_EQUAL(pbase->lenWritten, content.length() - 50);
+}
+
+BOOST_AUTO_TEST_CASE(segstream_spill)
+{
+	BOOST_TEST_MESSAGE("Inserted data over the memory budget goes to a file");
+
+	this->seg->set_memory_budget(8);
+	this->seg->seekp(5, stream::start);
+	this->seg->insert(6);
+	this->seg->write("012345");
+	// Over the budget, so this one is spilled
+	this->seg->insert(4);
+	this->seg->write("!@#$");
+	// Insert within the spilled block, and write across both kinds
+	this->seg->seekp(-2, stream::cur);
+	this->seg->insert(3);
+	this->seg->write("xyz");
+	this->seg->seekp(9, stream::start);
+	this->seg->write("45ab");
+	this->seg->seekp(0, stream::start);
+	BOOST_CHECK_EQUAL(this->seg->read(19), "ABCDE012345abxyz#$F");
+	this->seg->seekp(13, stream::start);
+
+	this->seg->flush();
+
+	BOOST_CHECK_MESSAGE(is_equal(13, "ABCDE012345abxyz#$FGHIJKLMNOPQRSTUVWXYZ"),
+		"Spilling inserted data failed");
+
+	// Spill file is gone after the flush, and can be made again
+	this->seg->seekp(0, stream::start);
+	this->seg->insert(20);
+	this->seg->write("abcdefghijklmnopqrst");
+	this->seg->flush();
+	BOOST_CHECK_MESSAGE(is_equal(20,
+		"abcdefghijklmnopqrstABCDE012345abxyz#$FGHIJKLMNOPQRSTUVWXYZ"),
+		"Spilling inserted data a second time failed");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
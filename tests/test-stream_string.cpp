@@ -160,4 +160,86 @@ BOOST_AUTO_TEST_CASE(expand)
 	BOOST_REQUIRE_EQUAL(f.data.length(), 11);
 }
 
+BOOST_AUTO_TEST_CASE(view)
+{
+	BOOST_TEST_MESSAGE("View string data without copying");
+
+	stream::string f("1234567890");
+	f.seekg(2, stream::start);
+
+	stream::len got = 0;
+	std::string scratch;
+	const uint8_t *p = f.view(4, 10, &got, scratch);
+	BOOST_REQUIRE_EQUAL(got, 6);
+	BOOST_CHECK(p == (const uint8_t *)f.data.data() + 4);
+	BOOST_CHECK_MESSAGE(is_equal("567890", std::string((const char *)p, got)),
+		"Error viewing string data");
+
+	// Read pointer must not have moved
+	BOOST_REQUIRE_EQUAL(f.tellg(), 2);
+
+	f.view(10, 5, &got, scratch);
+	BOOST_REQUIRE_EQUAL(got, 0);
+
+	BOOST_CHECK_THROW(
+		f.view(11, 1, &got, scratch),
+		stream::seek_error
+	);
+}
+
+BOOST_AUTO_TEST_CASE(release)
+{
+	BOOST_TEST_MESSAGE("Move data out of a string stream without copying");
+
+	std::string content(1000, 'x');
+	const char *p = content.data();
+	stream::string f(std::move(content));
+	BOOST_CHECK(f.data.data() == p);
+
+	f.reserve(5000);
+	BOOST_CHECK_GE(f.data.capacity(), 5000);
+	BOOST_REQUIRE_EQUAL(f.size(), 1000);
+	f.seekp(0, stream::end);
+	f.write("abc");
+	p = f.data.data();
+
+	std::string out = f.release();
+	BOOST_CHECK(out.data() == p);
+	BOOST_REQUIRE_EQUAL(out.length(), 1003);
+	BOOST_REQUIRE_EQUAL(f.size(), 0);
+	BOOST_REQUIRE_EQUAL(f.tellp(), 0);
+
+	// Stream is still usable afterwards
+	f.write("def");
+	BOOST_CHECK_MESSAGE(is_equal("def", f.data),
+		"Error writing after release");
+}
+
+BOOST_AUTO_TEST_CASE(span)
+{
+	BOOST_TEST_MESSAGE("Read from caller-owned memory");
+
+	const uint8_t mem[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9', '0'};
+	stream::input_span f(mem, sizeof(mem));
+	BOOST_REQUIRE_EQUAL(f.size(), 10);
+
+	f.seekg(3, stream::start);
+	BOOST_CHECK_MESSAGE(is_equal("456", f.read(3)),
+		"Error reading from span");
+	BOOST_REQUIRE_EQUAL(f.tellg(), 6);
+
+	uint8_t buf[4];
+	BOOST_REQUIRE_EQUAL(f.try_read_at(8, buf, 4), 2);
+	BOOST_REQUIRE_EQUAL(f.tellg(), 6);
+
+	stream::len got = 0;
+	std::string scratch;
+	const uint8_t *p = f.view(7, 10, &got, scratch);
+	BOOST_CHECK(p == mem + 7);
+	BOOST_REQUIRE_EQUAL(got, 3);
+
+	BOOST_CHECK_THROW(f.seekg(11, stream::start), stream::seek_error);
+	BOOST_CHECK_THROW(f.seekg(-11, stream::end), stream::seek_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
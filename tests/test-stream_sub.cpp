@@ -18,8 +18,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <thread>
+#include <vector>
 #include <errno.h>
 #include <boost/test/unit_test.hpp>
 #include <camoto/stream_sub.hpp>
@@ -258,4 +261,264 @@ BOOST_AUTO_TEST_CASE(write_past_eof_expand)
 		"Write past expanding substream's EOF");
 }
 
+BOOST_AUTO_TEST_CASE(view)
+{
+	BOOST_TEST_MESSAGE("View substream data without copying");
+
+	this->sub = std::make_shared<stream::sub>(
+		std::dynamic_pointer_cast<stream::inout>(this->base),
+		5, 6, stream::fn_truncate_sub()
+	);
+
+	stream::len got = 0;
+	std::string scratch;
+	const uint8_t *p = this->sub->view(2, 10, &got, scratch);
+	BOOST_REQUIRE_EQUAL(got, 4);
+	BOOST_CHECK(p == (const uint8_t *)this->base->data.data() + 7);
+	BOOST_CHECK_MESSAGE(
+		default_sample::is_equal("HIJK", std::string((const char *)p, got)),
+		"Error viewing substream data");
+	BOOST_REQUIRE_EQUAL(this->sub->tellg(), 0);
+
+	BOOST_CHECK_THROW(
+		this->sub->view(7, 1, &got, scratch),
+		stream::seek_error
+	);
+}
+
+BOOST_AUTO_TEST_CASE(positional)
+{
+	BOOST_TEST_MESSAGE("Positional reads and writes leave all pointers alone");
+
+	this->sub = std::make_shared<stream::sub>(
+		std::dynamic_pointer_cast<stream::inout>(this->base),
+		5, 6, stream::fn_truncate_sub()
+	);
+	this->base->seekg(20, stream::start);
+	this->sub->seekg(1, stream::start);
+
+	uint8_t buf[8];
+	BOOST_REQUIRE_EQUAL(this->sub->try_read_at(3, buf, sizeof(buf)), 3);
+	BOOST_CHECK_MESSAGE(this->default_sample::is_equal("IJK",
+		std::string((char *)buf, 3)),
+		"Positional read from substream failed");
+	BOOST_CHECK_EQUAL(this->sub->try_read_at(6, buf, sizeof(buf)), 0);
+
+	BOOST_CHECK_EQUAL(this->sub->try_write_at(2, (const uint8_t *)"12", 2), 2);
+	BOOST_CHECK_THROW(
+		this->sub->try_write_at(7, (const uint8_t *)"12", 2),
+		stream::seek_error
+	);
+
+	BOOST_CHECK_EQUAL(this->base->tellg(), 20);
+	BOOST_CHECK_EQUAL(this->sub->tellg(), 1);
+	BOOST_CHECK_MESSAGE(is_equal("FG12JK"),
+		"Positional write to substream failed");
+}
+
+/// String stream that only has the default, locking, positional read.
+class seek_only_string: public stream::input_string
+{
+	public:
+		seek_only_string(std::string content)
+			:	stream::string_core(content)
+		{
+		}
+
+		virtual stream::len try_read_at(stream::pos pos, uint8_t *buffer,
+			stream::len len)
+		{
+			return this->stream::input::try_read_at(pos, buffer, len);
+		}
+};
+
+/// Read from many substreams of one parent at once, checking every byte.
+/**
+ * @return Number of bytes that didn't match, across all threads.
+ */
+unsigned int concurrent_read(std::shared_ptr<stream::input> parent,
+	const std::string& content)
+{
+	const int numThreads = 8;
+	std::atomic<unsigned int> errors(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < numThreads; t++) {
+		threads.emplace_back([&, t]() {
+			uint32_t r = t + 1;
+			for (int i = 0; i < 200; i++) {
+				// Pick a random range, so they overlap with other threads
+				stream::pos start = (next_random(r) >> 8) % content.length();
+				stream::len len = (next_random(r) >> 8)
+					% (content.length() - start + 1);
+				stream::input_sub sub(parent, start, len);
+
+				// Read it in odd-sized pieces, with occasional seeks
+				uint8_t buf[97];
+				stream::pos pos = 0;
+				while (pos < len) {
+					if ((next_random(r) >> 8) % 8 == 0) {
+						pos = (r >> 12) % len;
+						sub.seekg(pos, stream::start);
+					}
+					stream::len got = sub.try_read(buf, 1 + ((r >> 16) % sizeof(buf)));
+					if (got == 0) {
+						errors++;
+						break;
+					}
+					if (memcmp(buf, content.data() + start + pos, got) != 0) errors++;
+					pos += got;
+				}
+			}
+		});
+	}
+	for (auto& i : threads) i.join();
+	return errors;
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_readers)
+{
+	BOOST_TEST_MESSAGE("Many threads reading substreams of one parent");
+
+	std::string content;
+	for (int i = 0; i < 65536; i++) content += (char)(i * 7 + (i >> 8));
+
+	BOOST_CHECK_EQUAL(concurrent_read(
+		std::make_shared<stream::input_string>(content), content), 0);
+
+	// The default try_read_at() has to lock, but must still give the right data
+	BOOST_CHECK_EQUAL(concurrent_read(
+		std::make_shared<seek_only_string>(content), content), 0);
+}
+
+BOOST_AUTO_TEST_CASE(registry)
+{
+	BOOST_TEST_MESSAGE("Shift many substreams at once through a registry");
+
+	auto parent = std::make_shared<stream::string>(std::string(100000, 'x'));
+	auto reg = std::make_shared<stream::sub_registry>();
+
+	const unsigned int count = 2000;
+	std::vector<std::unique_ptr<stream::sub>> subs;
+	std::vector<stream::pos> expected;
+	for (unsigned int i = 0; i < count; i++) {
+		subs.emplace_back(new stream::sub(parent, i * 10, 10,
+			stream::fn_truncate_sub()));
+		subs.back()->set_registry(reg);
+		expected.push_back(i * 10);
+	}
+	BOOST_REQUIRE_EQUAL(reg->size(), count);
+
+	// Fill in some substreams so a later read can confirm the right data moved
+	subs[1500]->write("ABCDEFGHIJ");
+
+	// Pretend data was inserted and removed in various places
+	uint32_t seed = 1;
+	for (int n = 0; n < 200; n++) {
+		stream::pos at = (next_random(seed) >> 8) % (count * 10);
+		stream::delta off = (n % 3 == 2) ? -5 : 7;
+		if (off < 0) {
+			// Don't move anything back past a substream that stays put
+			bool ok = true;
+			for (auto e : expected) {
+				if ((e < at) && (e + 5 > at)) ok = false;
+			}
+			if (!ok || (at < 5)) continue;
+		}
+		reg->shift(at, off);
+		for (auto& e : expected) if (e >= at) e += off;
+	}
+
+	// Move one individually as well
+	subs[10]->relocate(3);
+	expected[10] += 3;
+
+	for (unsigned int i = 0; i < count; i++) {
+		BOOST_REQUIRE_MESSAGE(subs[i]->sub_start() == expected[i],
+			"Substream " << i << " is at " << subs[i]->sub_start()
+			<< ", expected " << expected[i]);
+	}
+
+	// Destroying substreams takes them out of the registry
+	subs.erase(subs.begin() + 100, subs.begin() + 200);
+	expected.erase(expected.begin() + 100, expected.begin() + 200);
+	BOOST_REQUIRE_EQUAL(reg->size(), count - 100);
+	reg->shift(0, 1);
+	for (unsigned int i = 0; i < subs.size(); i++) {
+		BOOST_REQUIRE_EQUAL(subs[i]->sub_start(), expected[i] + 1);
+	}
+
+	// Leaving the registry keeps the current position
+	stream::pos p = subs[0]->sub_start();
+	subs[0]->set_registry(nullptr);
+	BOOST_CHECK_EQUAL(subs[0]->sub_start(), p);
+	BOOST_CHECK_EQUAL(reg->size(), count - 101);
+}
+
+BOOST_AUTO_TEST_CASE(async_read)
+{
+	BOOST_TEST_MESSAGE("Background reads are clipped and passed to the parent");
+
+	std::string content;
+	for (int i = 0; i < 1000; i++) content += (char)i;
+	auto parent = std::make_shared<stream::input_string>(content);
+	stream::input_sub sub(parent, 100, 200);
+
+	uint8_t buf[50];
+	BOOST_REQUIRE_EQUAL(sub.async_read_at(10, buf, 50).get(), 50);
+	BOOST_CHECK(memcmp(buf, &content[110], 50) == 0);
+
+	BOOST_REQUIRE_EQUAL(sub.async_read_at(180, buf, 50).get(), 20);
+	BOOST_CHECK(memcmp(buf, &content[280], 20) == 0);
+
+	BOOST_CHECK_EQUAL(sub.async_read_at(200, buf, 50).get(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(growth)
+{
+	BOOST_TEST_MESSAGE("Appending writes enlarge the substream in large steps");
+
+	unsigned int resizes = 0;
+	auto countResize = [this, &resizes](stream::output_sub *s, stream::len len) {
+		resizes++;
+		ss_resize(this->base, s, len);
+	};
+	this->sub = std::make_shared<stream::sub>(
+		std::dynamic_pointer_cast<stream::inout>(this->base),
+		26, 0, countResize);
+	this->sub->set_growth(true);
+
+	std::string expected;
+	for (int i = 0; i < 1000; i++) {
+		this->sub->write("0123456789");
+		expected += "0123456789";
+	}
+	BOOST_CHECK_LE(resizes, 20);
+	BOOST_CHECK_EQUAL(this->sub->size(), 10000);
+	BOOST_CHECK_GE(this->sub->sub_size(), 10000);
+
+	// Reserved space can't be reached
+	BOOST_CHECK_THROW(
+		this->sub->seekg(10001, stream::start),
+		stream::seek_error
+	);
+
+	this->sub->flush();
+	BOOST_CHECK_EQUAL(this->sub->sub_size(), 10000);
+	BOOST_CHECK_EQUAL(this->base->size(), 26 + 10000);
+	BOOST_CHECK_MESSAGE(is_equal(expected.c_str()),
+		"Error writing to growing substream");
+
+	// The size hint is reserved all at once
+	resizes = 0;
+	this->sub->set_growth(true, 50000);
+	this->sub->seekp(0, stream::end);
+	for (int i = 0; i < 4000; i++) {
+		this->sub->write("0123456789");
+	}
+	BOOST_CHECK_EQUAL(resizes, 1);
+	this->sub->truncate(20000);
+	BOOST_CHECK_EQUAL(this->sub->sub_size(), 20000);
+	BOOST_CHECK_EQUAL(this->base->size(), 26 + 20000);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,108 @@
+/**
+ * @file   test-stream_traced.cpp
+ * @brief  Test code for recording stream accesses.
+ *
+ * Copyright (C) 2010-2016 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/stream_traced.hpp>
+#include "tests.hpp"
+
+using namespace camoto;
+
+BOOST_FIXTURE_TEST_SUITE(stream_traced_suite, default_sample)
+
+BOOST_AUTO_TEST_CASE(record)
+{
+	BOOST_TEST_MESSAGE("Record operations and read them back");
+
+	auto log = std::make_shared<stream::string>();
+	{
+		auto base = std::make_shared<stream::string>();
+		stream::traced t(base, log);
+		t.write("ABCDEFGHIJ");
+		t.seekg(2, stream::start);
+		BOOST_CHECK_MESSAGE(is_equal("CDE", t.read(3)),
+			"Traced stream did not pass reads through to parent");
+		uint8_t buf[4];
+		BOOST_CHECK_EQUAL(t.try_read_at(8, buf, 4), 2);
+		t.truncate(6);
+		t.flush();
+		BOOST_CHECK_EQUAL(base->size(), 6);
+	}
+
+	log->seekg(0, stream::start);
+	stream::trace_reader r(log);
+	stream::trace_op op;
+	uint64_t lastStart = 0;
+
+	BOOST_REQUIRE(r.next(&op));
+	BOOST_CHECK(op.type == stream::trace_type::write);
+	BOOST_CHECK_EQUAL(op.positional, false);
+	BOOST_CHECK_EQUAL(op.pos, 0);
+	BOOST_CHECK_EQUAL(op.len, 10);
+	BOOST_CHECK_EQUAL(op.done, 10);
+
+	BOOST_REQUIRE(r.next(&op));
+	BOOST_CHECK(op.type == stream::trace_type::seekg);
+	BOOST_CHECK_EQUAL(op.pos, 2);
+	BOOST_CHECK(op.start >= lastStart);
+	lastStart = op.start;
+
+	BOOST_REQUIRE(r.next(&op));
+	BOOST_CHECK(op.type == stream::trace_type::read);
+	BOOST_CHECK_EQUAL(op.positional, false);
+	BOOST_CHECK_EQUAL(op.pos, 2);
+	BOOST_CHECK_EQUAL(op.len, 3);
+	BOOST_CHECK_EQUAL(op.done, 3);
+	BOOST_CHECK(op.start >= lastStart);
+
+	BOOST_REQUIRE(r.next(&op));
+	BOOST_CHECK(op.type == stream::trace_type::read);
+	BOOST_CHECK_EQUAL(op.positional, true);
+	BOOST_CHECK_EQUAL(op.pos, 8);
+	BOOST_CHECK_EQUAL(op.len, 4);
+	BOOST_CHECK_EQUAL(op.done, 2);
+
+	BOOST_REQUIRE(r.next(&op));
+	BOOST_CHECK(op.type == stream::trace_type::truncate);
+	BOOST_CHECK_EQUAL(op.pos, 6);
+
+	BOOST_REQUIRE(r.next(&op));
+	BOOST_CHECK(op.type == stream::trace_type::flush);
+
+	BOOST_CHECK_EQUAL(r.next(&op), false);
+}
+
+BOOST_AUTO_TEST_CASE(bad_log)
+{
+	BOOST_TEST_MESSAGE("Reject logs that aren't traces or are cut short");
+
+	BOOST_CHECK_THROW(
+		stream::trace_reader r(std::make_shared<stream::input_string>("CTR2")),
+		stream::error
+	);
+
+	// Write record with only the time values
+	stream::trace_reader r(std::make_shared<stream::input_string>(
+		makeString("CTR1\x04\x01\x01")));
+	stream::trace_op op;
+	BOOST_CHECK_THROW(r.next(&op), stream::error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
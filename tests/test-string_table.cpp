@@ -0,0 +1,98 @@
+/**
+ * @file  test-string_table.cpp
+ * @brief Test code for reading tables of fixed-length records.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/string_table.hpp>
+#include <camoto/util.hpp>
+
+using namespace camoto;
+
+BOOST_AUTO_TEST_SUITE(string_table_suite)
+
+BOOST_AUTO_TEST_CASE(read)
+{
+	BOOST_TEST_MESSAGE("Read a table of names, offsets and sizes");
+
+	stream::string content;
+	content.write("HEAD");
+	const unsigned int count = 50000;
+	for (unsigned int i = 0; i < count; i++) {
+		std::string name = createString("F" << i << ".DAT");
+		if (i == 7) name = "EXACTLY12CHR"; // fills the field with no null
+		if (i == 8) name = "";
+		content
+			<< nullPadded(name, 12)
+			<< u32le(i * 100)
+			<< u32le(i + 1)
+		;
+	}
+	content.write("TAIL");
+	content.seekg(4, stream::start);
+
+	string_table dir;
+	dir.read(content, count, 20, 0, 12);
+	BOOST_REQUIRE_EQUAL(dir.size(), count);
+	BOOST_CHECK_EQUAL(content.tellg(), 4 + count * 20);
+	BOOST_CHECK_EQUAL(content.read(4), "TAIL");
+
+	BOOST_CHECK(dir.name(0) == "F0.DAT");
+	BOOST_CHECK_EQUAL(dir.name(12345).str(), "F12345.DAT");
+	BOOST_CHECK_EQUAL(dir.name(7).str(), "EXACTLY12CHR");
+	BOOST_CHECK_EQUAL(dir.name(8).length, 0);
+	BOOST_CHECK(dir.name(9) != "F9");
+
+	for (unsigned int i = 0; i < count; i++) {
+		uint32_t offset, size;
+		dir.decode(i, 12, u32le(offset), u32le(size));
+		BOOST_REQUIRE_EQUAL(offset, i * 100);
+		BOOST_REQUIRE_EQUAL(size, i + 1);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(name_offset)
+{
+	BOOST_TEST_MESSAGE("Read a table where the name is not the first field");
+
+	stream::string content;
+	content << u16le(1) << nullPadded("ONE", 8) << u16le(2) << nullPadded("TWO", 8);
+	content.seekg(0, stream::start);
+
+	string_table dir;
+	dir.read(content, 2, 10, 2, 8);
+	BOOST_REQUIRE_EQUAL(dir.size(), 2);
+	BOOST_CHECK_EQUAL(dir.name(0).str(), "ONE");
+	BOOST_CHECK_EQUAL(dir.name(1).str(), "TWO");
+	uint16_t id;
+	dir.decode(1, 0, u16le(id));
+	BOOST_CHECK_EQUAL(id, 2);
+}
+
+BOOST_AUTO_TEST_CASE(truncated)
+{
+	BOOST_TEST_MESSAGE("Reading past the end of the stream leaves the table empty");
+
+	stream::string content(std::string(30, 'x'));
+	string_table dir;
+	BOOST_CHECK_THROW(dir.read(content, 2, 20, 0, 12), stream::incomplete_read);
+	BOOST_CHECK_EQUAL(dir.size(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,143 @@
+/**
+ * @file   test-suppitem.cpp
+ * @brief  Test code for opening supplementary files.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/stream_file.hpp>
+#include <camoto/stream_string.hpp>
+#include <camoto/suppitem.hpp>
+#include "tests.hpp"
+
+#ifdef _WIN32
+#define unlink(x) _unlink(x)
+#endif
+
+using namespace camoto;
+
+struct supp_sample: public default_sample
+{
+	unsigned int opens;
+	std::shared_ptr<SuppCache> cache;
+
+	supp_sample()
+		:	opens(0)
+	{
+		this->cache = std::make_shared<SuppCache>(
+			[this](const std::string& filename) {
+				this->opens++;
+				return std::make_shared<stream::string>("data:" + filename);
+			}, 2);
+	}
+};
+
+BOOST_FIXTURE_TEST_SUITE(suppitem_suite, supp_sample)
+
+BOOST_AUTO_TEST_CASE(lazy_open)
+{
+	BOOST_TEST_MESSAGE("Supplementary files are only opened when used");
+
+	SuppFilenames names;
+	names[SuppItem::Palette] = "pal";
+	names[SuppItem::FAT] = "fat";
+	SuppData supps = lazySuppData(names, this->cache);
+	BOOST_REQUIRE_EQUAL(supps.size(), 2);
+	BOOST_CHECK_EQUAL(this->opens, 0);
+
+	auto& pal = *supps[SuppItem::Palette];
+	pal.seekg(0, stream::start);
+	BOOST_CHECK_EQUAL(this->opens, 0);
+	BOOST_CHECK_EQUAL(pal.read(8), "data:pal");
+	BOOST_CHECK_EQUAL(this->opens, 1);
+	BOOST_CHECK(!dynamic_cast<SuppStream&>(*supps[SuppItem::FAT]).isOpen());
+}
+
+BOOST_AUTO_TEST_CASE(shared)
+{
+	BOOST_TEST_MESSAGE("Users of the same file share it but not seek pointers");
+
+	SuppFilenames names;
+	names[SuppItem::Palette] = "pal";
+	SuppData a = lazySuppData(names, this->cache);
+	SuppData b = lazySuppData(names, this->cache);
+
+	auto& palA = *a[SuppItem::Palette];
+	auto& palB = *b[SuppItem::Palette];
+	palA.seekg(5, stream::start);
+	BOOST_CHECK_EQUAL(palB.read(4), "data");
+	BOOST_CHECK_EQUAL(palA.read(3), "pal");
+	BOOST_CHECK_EQUAL(this->opens, 1);
+
+	// Writes are seen by everyone
+	palB.seekp(-3, stream::end);
+	palB.write("PAL");
+	palA.seekg(5, stream::start);
+	BOOST_CHECK_EQUAL(palA.read(3), "PAL");
+	BOOST_CHECK_THROW(palA.seekg(1, stream::cur), stream::seek_error);
+}
+
+BOOST_AUTO_TEST_CASE(idle)
+{
+	BOOST_TEST_MESSAGE("Only a few unused files are kept open");
+
+	{
+		auto f1 = this->cache->open("one");
+		BOOST_CHECK(this->cache->open("one") == f1);
+	}
+	this->cache->open("two");
+	this->cache->open("three");
+	this->cache->open("four");
+	BOOST_CHECK_EQUAL(this->opens, 4);
+
+	// Opening "four" left three unused files, so "one" was closed as the least
+	// recently opened
+	BOOST_CHECK_EQUAL(this->cache->count(), 3);
+	this->cache->open("two");
+	BOOST_CHECK_EQUAL(this->opens, 4);
+	this->cache->open("one");
+	BOOST_CHECK_EQUAL(this->opens, 5);
+
+	// Files in use are never closed
+	auto f = this->cache->open("four");
+	this->cache->trim();
+	BOOST_CHECK_EQUAL(this->cache->count(), 1);
+	BOOST_CHECK(this->cache->open("four") == f);
+}
+
+BOOST_AUTO_TEST_CASE(paths)
+{
+	BOOST_TEST_MESSAGE("Different paths to the same file give the same stream");
+
+	constexpr auto TEST_FILE = "_supp.$";
+	{
+		stream::file f(TEST_FILE, true);
+		f.write("palette");
+	}
+	SuppCache files;
+	auto f1 = files.open(TEST_FILE);
+	auto f2 = files.open(std::string("./") + TEST_FILE);
+	BOOST_CHECK(f1 == f2);
+	BOOST_CHECK_EQUAL(f1->read(7), "palette");
+	BOOST_CHECK_THROW(files.open("_missing.$"), stream::open_error);
+	f1.reset();
+	f2.reset();
+	files.trim();
+	unlink(TEST_FILE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,81 @@
+/**
+ * @file   test-thread_pool.cpp
+ * @brief  Test code for the thread pool.
+ *
+ * Copyright (C) 2010-2017 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <boost/test/unit_test.hpp>
+#include <camoto/thread_pool.hpp>
+
+using namespace camoto;
+
+BOOST_AUTO_TEST_SUITE(thread_pool_suite)
+
+BOOST_AUTO_TEST_CASE(run_all)
+{
+	BOOST_TEST_MESSAGE("Every task runs exactly once");
+
+	thread_pool pool(4);
+	BOOST_REQUIRE_EQUAL(pool.size(), 4);
+
+	std::vector<std::atomic<unsigned int>> hits(1000);
+	for (auto& h : hits) h = 0;
+	std::atomic<unsigned int> badWorker(0);
+	for (unsigned int i = 0; i < hits.size(); i++) {
+		pool.submit([&hits, &badWorker, i](unsigned int worker) {
+			if (worker >= 4) badWorker++;
+			// Uneven task lengths so some workers have to steal
+			if (i % 50 == 0) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			}
+			hits[i]++;
+		});
+	}
+	pool.wait();
+	for (auto& h : hits) BOOST_REQUIRE_EQUAL(h, 1);
+	BOOST_CHECK_EQUAL(badWorker, 0);
+
+	// Pool can be reused after waiting
+	std::atomic<unsigned int> count(0);
+	for (int i = 0; i < 10; i++) pool.submit([&count](unsigned int) { count++; });
+	pool.wait();
+	BOOST_CHECK_EQUAL(count, 10);
+}
+
+BOOST_AUTO_TEST_CASE(exception)
+{
+	BOOST_TEST_MESSAGE("Exceptions thrown by tasks reach wait()");
+
+	thread_pool pool(2);
+	std::atomic<unsigned int> count(0);
+	for (int i = 0; i < 20; i++) {
+		pool.submit([&count, i](unsigned int) {
+			count++;
+			if (i == 7) throw std::runtime_error("task failed");
+		});
+	}
+	BOOST_CHECK_THROW(pool.wait(), std::runtime_error);
+	BOOST_CHECK_EQUAL(count, 20);
+
+	// Exception is only reported once
+	pool.wait();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -110,3 +110,20 @@ boost::test_tools::predicate_result default_sample::is_equal(
 
 	return true;
 }
+
+std::string sample_text(unsigned int len)
+{
+	static const char *words[] = {
+		"the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ", "dog ",
+		"camoto ", "game ", "data ", "\x01\x02\x03", "\xff\xfe", ". ",
+	};
+	std::string s;
+	uint32_t seed = 12345;
+	while (s.length() < len) {
+		next_random(seed);
+		s += words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))];
+		if (((seed >> 8) & 0x1F) == 0) s += (char)(seed >> 24);
+	}
+	s.resize(len);
+	return s;
+}
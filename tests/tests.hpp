@@ -21,12 +21,21 @@
 #ifndef _CAMOTO_TESTS_HPP_
 #define _CAMOTO_TESTS_HPP_
 
+#include <algorithm>
+#include <memory>
+#include <string>
 #include <boost/test/unit_test.hpp>
+#include <camoto/filter.hpp>
+#include <camoto/stream_filtered.hpp>
 #include <camoto/stream_string.hpp>
+#include "corpus.hpp"
 
 // Allow a string constant to be passed around with embedded nulls
 #define makeString(x)  std::string((x), sizeof((x)) - 1)
 
+/// Pseudorandom text with plenty of repetition, for compressing.
+std::string sample_text(unsigned int len);
+
 struct default_sample
 {
 	default_sample();
@@ -62,4 +71,39 @@ struct string_sample: public default_sample
 	}
 };
 
+struct filter_sample: public default_sample
+{
+	/// Run data through a filter with stream::input_filtered.
+	std::string apply(std::shared_ptr<camoto::filter> f, const std::string& data)
+	{
+		auto src = std::make_shared<camoto::stream::string>(data);
+		camoto::stream::input_filtered filt(src, f);
+		camoto::stream::string result;
+		camoto::stream::copy(result, filt);
+		return result.data;
+	}
+
+	/// Run data through a filter a few bytes at a time.
+	std::string applySmall(camoto::filter& f, const std::string& data,
+		camoto::stream::len lenChunk)
+	{
+		std::string result;
+		f.reset(data.length());
+		const uint8_t *in = (const uint8_t *)data.data();
+		camoto::stream::len left = data.length();
+		for (;;) {
+			uint8_t buf[64];
+			camoto::stream::len lenOut = std::min<camoto::stream::len>(lenChunk,
+				sizeof(buf));
+			camoto::stream::len lenIn = left;
+			f.transform(buf, &lenOut, in, &lenIn);
+			if ((lenIn == 0) && (lenOut == 0)) break;
+			result.append((char *)buf, lenOut);
+			in += lenIn;
+			left -= lenIn;
+		}
+		return result;
+	}
+};
+
 #endif // _CAMOTO_TESTS_HPP_